@@ -5,37 +5,149 @@ echo.
 REM Kill running instance if any
 taskkill /F /IM xnote.exe >nul 2>&1
 
-echo [1/7] Compiling main.c...
+echo [1/35] Compiling main.c...
 gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/main.c -o src/main.o
 if errorlevel 1 goto error
 
-echo [2/7] Compiling file_ops.c...
+echo [2/35] Compiling file_ops.c...
 gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/file_ops.c -o src/file_ops.o
 if errorlevel 1 goto error
 
-echo [3/7] Compiling edit_ops.c...
+echo [3/35] Compiling edit_ops.c...
 gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/edit_ops.c -o src/edit_ops.o
 if errorlevel 1 goto error
 
-echo [4/7] Compiling dialogs.c...
+echo [4/35] Compiling dialogs.c...
 gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/dialogs.c -o src/dialogs.o
 if errorlevel 1 goto error
 
-echo [5/7] Compiling line_numbers.c...
+echo [5/35] Compiling line_numbers.c...
 gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/line_numbers.c -o src/line_numbers.o
 if errorlevel 1 goto error
 
-echo [6/7] Compiling statusbar.c...
+echo [6/35] Compiling statusbar.c...
 gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/statusbar.c -o src/statusbar.o
 if errorlevel 1 goto error
 
-echo [7/7] Compiling resources...
+echo [7/35] Compiling document.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/document.c -o src/document.o
+if errorlevel 1 goto error
+
+echo [8/35] Compiling large_viewer.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/large_viewer.c -o src/large_viewer.o
+if errorlevel 1 goto error
+
+echo [9/35] Compiling piece_table.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/piece_table.c -o src/piece_table.o
+if errorlevel 1 goto error
+
+echo [10/35] Compiling line_index.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/line_index.c -o src/line_index.o
+if errorlevel 1 goto error
+
+echo [11/35] Compiling text_scan.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/text_scan.c -o src/text_scan.o
+if errorlevel 1 goto error
+
+echo [12/35] Compiling transcode.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/transcode.c -o src/transcode.o
+if errorlevel 1 goto error
+
+echo [13/35] Compiling doc_writer.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/doc_writer.c -o src/doc_writer.o
+if errorlevel 1 goto error
+
+echo [14/35] Compiling large_view.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/large_view.c -o src/large_view.o
+if errorlevel 1 goto error
+
+echo [15/35] Compiling file_load.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/file_load.c -o src/file_load.o
+if errorlevel 1 goto error
+
+echo [16/35] Compiling doc_stats.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/doc_stats.c -o src/doc_stats.o
+if errorlevel 1 goto error
+
+echo [17/35] Compiling frame_sched.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/frame_sched.c -o src/frame_sched.o
+if errorlevel 1 goto error
+
+echo [18/35] Compiling undo_journal.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/undo_journal.c -o src/undo_journal.o
+if errorlevel 1 goto error
+
+echo [19/35] Compiling edit_journal.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/edit_journal.c -o src/edit_journal.o
+if errorlevel 1 goto error
+
+echo [20/35] Compiling recovery.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/recovery.c -o src/recovery.o
+if errorlevel 1 goto error
+
+echo [21/35] Compiling text_search.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/text_search.c -o src/text_search.o
+if errorlevel 1 goto error
+
+echo [22/35] Compiling regex_search.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/regex_search.c -o src/regex_search.o
+if errorlevel 1 goto error
+
+echo [23/35] Compiling find_files.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/find_files.c -o src/find_files.o
+if errorlevel 1 goto error
+
+echo [24/35] Compiling hibernate.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/hibernate.c -o src/hibernate.o
+if errorlevel 1 goto error
+
+echo [25/35] Compiling file_search.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/file_search.c -o src/file_search.o
+if errorlevel 1 goto error
+
+echo [26/35] Compiling doc_replace.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/doc_replace.c -o src/doc_replace.o
+if errorlevel 1 goto error
+
+echo [27/35] Compiling wrap_layout.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/wrap_layout.c -o src/wrap_layout.o
+if errorlevel 1 goto error
+
+echo [28/35] Compiling tab_registry.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/tab_registry.c -o src/tab_registry.o
+if errorlevel 1 goto error
+
+echo [29/35] Compiling text_pack.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/text_pack.c -o src/text_pack.o
+if errorlevel 1 goto error
+
+echo [30/35] Compiling session.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/session.c -o src/session.o
+if errorlevel 1 goto error
+
+echo [31/35] Compiling session_file.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/session_file.c -o src/session_file.o
+if errorlevel 1 goto error
+
+echo [32/35] Compiling line_cache.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/line_cache.c -o src/line_cache.o
+if errorlevel 1 goto error
+
+echo [33/35] Compiling text_encoding.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/text_encoding.c -o src/text_encoding.o
+if errorlevel 1 goto error
+
+echo [34/35] Compiling platform.c...
+gcc -Wall -Wextra -O3 -DUNICODE -D_UNICODE -c src/platform.c -o src/platform.o
+if errorlevel 1 goto error
+
+echo [35/35] Compiling resources...
 windres "--preprocessor=gcc -E -xc -DRC_INVOKED" src/notepad.rc -o src/notepad.o
 if errorlevel 1 goto error
 
 echo.
 echo Linking...
-gcc src/main.o src/file_ops.o src/edit_ops.o src/dialogs.o src/line_numbers.o src/statusbar.o src/notepad.o -o xnote.exe -mwindows -lcomctl32 -lcomdlg32 -s
+gcc src/main.o src/file_ops.o src/edit_ops.o src/dialogs.o src/line_numbers.o src/statusbar.o src/document.o src/large_viewer.o src/piece_table.o src/line_index.o src/text_scan.o src/transcode.o src/doc_writer.o src/large_view.o src/file_load.o src/doc_stats.o src/frame_sched.o src/undo_journal.o src/edit_journal.o src/recovery.o src/text_search.o src/regex_search.o src/find_files.o src/hibernate.o src/file_search.o src/doc_replace.o src/wrap_layout.o src/tab_registry.o src/text_pack.o src/session.o src/session_file.o src/line_cache.o src/text_encoding.o src/platform.o src/notepad.o -o xnote.exe -mwindows -lcomctl32 -lcomdlg32 -lole32 -lshell32 -s
 if errorlevel 1 goto error
 
 echo.
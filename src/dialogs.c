@@ -1,4 +1,5 @@
 #include "notepad.h"
+#include <shlobj.h>
 
 /* File filter for text files */
 static const TCHAR szFilter[] = TEXT("Text Files (*.txt)\0*.txt\0All Files (*.*)\0*.*\0\0");
@@ -78,3 +79,209 @@ void ShowErrorDialog(HWND hwnd, const TCHAR* szMessage) {
         MB_OK | MB_ICONERROR
     );
 }
+
+/* Modeless Find/Replace dialog (the common dialog keeps pointers to these) */
+static FINDREPLACE g_FindReplace;
+static TCHAR g_szFindWhat[FIND_TEXT_MAX];
+static TCHAR g_szReplaceWith[FIND_TEXT_MAX];
+static HWND g_hwndFindDialog = NULL;
+static BOOL g_bReplaceDialog = FALSE;
+static DWORD g_dwFindFlags = FR_DOWN;
+static BOOL g_bFindRegex = FALSE;
+static UINT g_uFindMessage = 0;
+
+/* Message the Find dialog sends its owner */
+UINT GetFindDialogMessage(void) {
+    if (!g_uFindMessage) {
+        g_uFindMessage = RegisterWindowMessage(FINDMSGSTRING);
+    }
+    return g_uFindMessage;
+}
+
+/* Take the selection as the text to find if it is short and on one line */
+static void SeedFindWhat(void) {
+    HWND hEdit = GetCurrentEdit();
+    TabState* pTab = GetCurrentTabState();
+    
+    if (hEdit && pTab && !pTab->bLargeFile && !pTab->pLoad) {
+        DWORD dwStart = 0, dwEnd = 0;
+        size_t nStart, nEnd;
+        SendMessage(hEdit, EM_GETSEL, (WPARAM)&dwStart, (LPARAM)&dwEnd);
+        nStart = DocOffsetFromEditPos(pTab, (LONG)dwStart);
+        nEnd = DocOffsetFromEditPos(pTab, (LONG)dwEnd);
+        if (nEnd > nStart && nEnd - nStart < FIND_TEXT_MAX) {
+            TCHAR szSel[FIND_TEXT_MAX];
+            size_t nLen = PieceTableCopy(&pTab->doc, nStart, (TextUnit*)szSel, nEnd - nStart);
+            szSel[nLen] = 0;
+            if (!_tcspbrk(szSel, TEXT("\r\n"))) {
+                lstrcpyn(g_szFindWhat, szSel, FIND_TEXT_MAX);
+            }
+        }
+    }
+}
+
+/* Show the Find (or Replace) dialog, seeded with the selection if it is short */
+void ShowFindDialog(HWND hwnd, BOOL bReplace) {
+    if (g_hwndFindDialog) {
+        if (g_bReplaceDialog == bReplace) {
+            SetFocus(g_hwndFindDialog);
+            return;
+        }
+        DestroyWindow(g_hwndFindDialog);
+        g_hwndFindDialog = NULL;
+    }
+    
+    SeedFindWhat();
+    
+    ZeroMemory(&g_FindReplace, sizeof(g_FindReplace));
+    g_FindReplace.lStructSize = sizeof(FINDREPLACE);
+    g_FindReplace.hwndOwner = hwnd;
+    g_FindReplace.Flags = g_dwFindFlags & (FR_DOWN | FR_MATCHCASE | FR_WHOLEWORD);
+    g_FindReplace.lpstrFindWhat = g_szFindWhat;
+    g_FindReplace.wFindWhatLen = FIND_TEXT_MAX;
+    g_FindReplace.lpstrReplaceWith = g_szReplaceWith;
+    g_FindReplace.wReplaceWithLen = FIND_TEXT_MAX;
+    
+    GetFindDialogMessage();
+    g_bReplaceDialog = bReplace;
+    g_hwndFindDialog = bReplace ? ReplaceText(&g_FindReplace) : FindText(&g_FindReplace);
+}
+
+/* Let the Find dialog handle its keyboard messages */
+BOOL IsFindDialogMessage(MSG* pMsg) {
+    return g_hwndFindDialog && IsDialogMessage(g_hwndFindDialog, pMsg);
+}
+
+/* TEXT_SEARCH_ flags for the dialog's options */
+static unsigned GetSearchFlags(void) {
+    unsigned nFlags = 0;
+    if (g_dwFindFlags & FR_MATCHCASE) nFlags |= TEXT_SEARCH_MATCH_CASE;
+    if (g_dwFindFlags & FR_WHOLEWORD) nFlags |= TEXT_SEARCH_WHOLE_WORD;
+    if (g_bFindRegex) nFlags |= FIND_REGEX;
+    return nFlags;
+}
+
+/* Switch between literal and regular expression search (the common dialog has no box for it) */
+void ToggleFindRegex(HWND hwnd) {
+    g_bFindRegex = !g_bFindRegex;
+    CheckMenuItem(GetMenu(hwnd), IDM_EDIT_REGEX, g_bFindRegex ? MF_CHECKED : MF_UNCHECKED);
+}
+
+/* Act on a button pressed in the Find dialog */
+void HandleFindDialogMessage(HWND hwnd, const FINDREPLACE* pFind) {
+    TabState* pTab = GetCurrentTabState();
+    
+    if (pFind->Flags & FR_DIALOGTERM) {
+        g_hwndFindDialog = NULL;
+        return;
+    }
+    g_dwFindFlags = pFind->Flags;
+    if (!pTab) return;
+    
+    if (pFind->Flags & FR_FINDNEXT) {
+        EditFindNext(hwnd, pTab, g_szFindWhat, GetSearchFlags(), !(pFind->Flags & FR_DOWN));
+    } else if (pFind->Flags & FR_REPLACE) {
+        EditReplace(hwnd, pTab, g_szFindWhat, g_szReplaceWith, GetSearchFlags());
+    } else if (pFind->Flags & FR_REPLACEALL) {
+        EditReplaceAll(hwnd, pTab, g_szFindWhat, g_szReplaceWith, GetSearchFlags());
+    }
+}
+
+/* Repeat the last search (F3 / Shift+F3) */
+void FindAgain(HWND hwnd, BOOL bBackward) {
+    TabState* pTab = GetCurrentTabState();
+    
+    if (!g_szFindWhat[0]) {
+        ShowFindDialog(hwnd, FALSE);
+        return;
+    }
+    if (pTab) {
+        EditFindNext(hwnd, pTab, g_szFindWhat, GetSearchFlags(), bBackward);
+    }
+}
+
+/* Folder picked last, offered again next time */
+static TCHAR g_szFindFolder[MAX_PATH];
+
+/* Folder browser callback: start at the given folder */
+static int CALLBACK BrowseFolderCallback(HWND hwnd, UINT uMsg, LPARAM lParam, LPARAM lpData) {
+    (void)lParam;
+    if (uMsg == BFFM_INITIALIZED && lpData && ((const TCHAR*)lpData)[0]) {
+        SendMessage(hwnd, BFFM_SETSELECTION, TRUE, lpData);
+    }
+    return 0;
+}
+
+/* Show the folder browser; szFolder (MAX_PATH) holds the starting folder and receives the choice */
+BOOL ShowFolderDialog(HWND hwnd, TCHAR* szFolder) {
+    TCHAR szTitle[FIND_TEXT_MAX + 32];
+    BROWSEINFO bi = {0};
+    LPITEMIDLIST pidl;
+    BOOL bOk = FALSE;
+    HRESULT hr = CoInitialize(NULL);
+    
+    _sntprintf(szTitle, FIND_TEXT_MAX + 32, TEXT("Find \"%s\" in the files of:"), g_szFindWhat);
+    szTitle[FIND_TEXT_MAX + 31] = 0;
+    
+    bi.hwndOwner = hwnd;
+    bi.lpszTitle = szTitle;
+    bi.ulFlags = BIF_RETURNONLYFSDIRS | BIF_NEWDIALOGSTYLE;
+    bi.lpfn = BrowseFolderCallback;
+    bi.lParam = (LPARAM)szFolder;
+    
+    pidl = SHBrowseForFolder(&bi);
+    if (pidl) {
+        bOk = SHGetPathFromIDList(pidl, szFolder);
+        CoTaskMemFree(pidl);
+    }
+    
+    if (SUCCEEDED(hr)) CoUninitialize();
+    return bOk;
+}
+
+/* Find the Find dialog's text in every file under a folder (Ctrl+Shift+F) */
+void ShowFindInFilesDialog(HWND hwnd) {
+    TabState* pTab = GetCurrentTabState();
+    
+    SeedFindWhat();
+    if (!g_szFindWhat[0]) {
+        /* Nothing to look for yet: ask for it first */
+        ShowFindDialog(hwnd, FALSE);
+        return;
+    }
+    
+    /* Start from the last folder, or the current file's */
+    if (!g_szFindFolder[0] && pTab && !pTab->bUntitled) {
+        TCHAR* pSlash;
+        lstrcpyn(g_szFindFolder, pTab->szFileName, MAX_PATH);
+        pSlash = _tcsrchr(g_szFindFolder, TEXT('\\'));
+        if (pSlash) *pSlash = 0;
+    }
+    
+    if (ShowFolderDialog(hwnd, g_szFindFolder)) {
+        BeginFindInFiles(hwnd, g_szFindFolder, g_szFindWhat, GetSearchFlags());
+    }
+}
+
+/* Tell the user the text is not in the document */
+void ShowNotFoundDialog(HWND hwnd, const TCHAR* szWhat) {
+    TCHAR szMessage[FIND_TEXT_MAX + 32];
+    
+    _sntprintf(szMessage, FIND_TEXT_MAX + 32, TEXT("Cannot find \"%s\""), szWhat);
+    MessageBox(
+        g_hwndFindDialog ? g_hwndFindDialog : hwnd,
+        szMessage,
+        APP_NAME,
+        MB_OK | MB_ICONINFORMATION
+    );
+}
+
+/* Ask before an edit too big for the undo history clears it */
+BOOL ShowConfirmNoUndoDialog(HWND hwnd) {
+    return MessageBox(
+        g_hwndFindDialog ? g_hwndFindDialog : hwnd,
+        TEXT("This replacement is too large to undo, and the undo history will be cleared.\n\nReplace anyway?"),
+        APP_NAME,
+        MB_OKCANCEL | MB_ICONWARNING
+    ) == IDOK;
+}
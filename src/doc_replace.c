@@ -0,0 +1,91 @@
+#include "doc_replace.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Make room for nMore units (capacity doubles, so appending stays linear) */
+static int Reserve(DocReplacement* pOut, size_t* pnCapacity, size_t nMore) {
+    size_t nCapacity = *pnCapacity ? *pnCapacity : 4096;
+    TextUnit* pNew;
+
+    if (nMore <= *pnCapacity - pOut->nLen) return 1;
+    if (nMore > SIZE_MAX / sizeof(TextUnit) / 2 - pOut->nLen) return 0;
+    while (nCapacity - pOut->nLen < nMore) nCapacity *= 2;
+    pNew = (TextUnit*)realloc(pOut->pText, nCapacity * sizeof(TextUnit));
+    if (!pNew) return 0;
+    pOut->pText = pNew;
+    *pnCapacity = nCapacity;
+    return 1;
+}
+
+/* Append [nOffset, nOffset + nLen) of the document */
+static int AppendDocument(DocReplacement* pOut, size_t* pnCapacity, const PieceTable* pDoc,
+                          size_t nOffset, size_t nLen) {
+    if (!Reserve(pOut, pnCapacity, nLen)) return 0;
+    pOut->nLen += PieceTableCopy(pDoc, nOffset, pOut->pText + pOut->nLen, nLen);
+    return 1;
+}
+
+/* Note one more match (capacity doubles) */
+static int AddMatch(DocReplacement* pOut, size_t* pnCapacity, size_t nAt, size_t nLen) {
+    if (pOut->nCount == *pnCapacity) {
+        size_t nCapacity = *pnCapacity ? *pnCapacity * 2 : 256;
+        UndoMatch* pNew;
+        if (nCapacity > SIZE_MAX / sizeof(UndoMatch)) return 0;
+        pNew = (UndoMatch*)realloc(pOut->pMatches, nCapacity * sizeof(UndoMatch));
+        if (!pNew) return 0;
+        pOut->pMatches = pNew;
+        *pnCapacity = nCapacity;
+    }
+    pOut->pMatches[pOut->nCount].nAt = nAt;
+    pOut->pMatches[pOut->nCount].nLen = nLen;
+    pOut->nCount++;
+    return 1;
+}
+
+int DocReplaceAll(const PieceTable* pDoc, ReplaceFindProc pfnFind, void* pContext,
+                  const TextUnit* pWith, size_t nWith, DocReplacement* pOut) {
+    size_t nDocLen = PieceTableLength(pDoc);
+    size_t nCapacity = 0, nMatchCapacity = 0, nPos, nAt, nMatchLen;
+
+    memset(pOut, 0, sizeof(*pOut));
+    if (!pfnFind(pContext, pDoc, 0, &nAt, &nMatchLen)) return 1;
+    pOut->nFrom = nAt;
+    nPos = nAt;
+
+    do {
+        /* The text since the last match, then the replacement */
+        if (!AppendDocument(pOut, &nCapacity, pDoc, nPos, nAt - nPos) || !Reserve(pOut, &nCapacity, nWith) ||
+            !AddMatch(pOut, &nMatchCapacity, nAt, nMatchLen)) {
+            DocReplacementFree(pOut);
+            return 0;
+        }
+        if (nWith > 0) {
+            memcpy(pOut->pText + pOut->nLen, pWith, nWith * sizeof(TextUnit));
+            pOut->nLen += nWith;
+        }
+        nPos = nAt + nMatchLen;
+        pOut->nTo = nPos;
+
+        if (nMatchLen == 0) {
+            /* Step past an empty match so it is not found again */
+            if (nPos >= nDocLen) break;
+            if (!AppendDocument(pOut, &nCapacity, pDoc, nPos, 1)) {
+                DocReplacementFree(pOut);
+                return 0;
+            }
+            nPos++;
+            pOut->nTo = nPos;
+        }
+    } while (nPos <= nDocLen && pfnFind(pContext, pDoc, nPos, &nAt, &nMatchLen));
+
+    return 1;
+}
+
+void DocReplacementFree(DocReplacement* pReplacement) {
+    free(pReplacement->pText);
+    free(pReplacement->pMatches);
+    pReplacement->pText = NULL;
+    pReplacement->pMatches = NULL;
+    pReplacement->nLen = 0;
+    pReplacement->nCount = 0;
+}
@@ -0,0 +1,44 @@
+#ifndef DOC_REPLACE_H
+#define DOC_REPLACE_H
+
+/*
+ * Replace All in one pass.
+ *
+ * Portable C. The document is scanned once from the first match to the
+ * last, and the text between matches is copied with the replacement in
+ * between into a single new buffer. The caller then swaps that one span
+ * into the document as one edit, so the cost is linear in the text
+ * scanned however many matches there are, and undo sees a single step.
+ * The matches are listed too, for an undo record that holds them alone.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "piece_table.h"
+#include "undo_journal.h"
+
+/* Finds the first match starting at or after nFrom (returns nonzero if found) */
+typedef int (*ReplaceFindProc)(void* pContext, const PieceTable* pDoc, size_t nFrom,
+                               size_t* pnAt, size_t* pnLen);
+
+/* Replacement text for one span of the document */
+typedef struct {
+    size_t nFrom;                /* Span replaced: from the first match... */
+    size_t nTo;                  /* ...to the end of the last */
+    TextUnit* pText;             /* Its new text (malloc) */
+    size_t nLen;                 /* Units in pText */
+    size_t nCount;               /* Matches replaced */
+    UndoMatch* pMatches;         /* Each of them, in order (malloc) */
+} DocReplacement;
+
+/*
+ * Build the text of the document with every match replaced by pWith. An
+ * empty match keeps the unit after it and the search resumes past that
+ * unit. Returns nonzero on success (nCount is zero if nothing matched);
+ * on failure pOut holds nothing.
+ */
+int DocReplaceAll(const PieceTable* pDoc, ReplaceFindProc pfnFind, void* pContext,
+                  const TextUnit* pWith, size_t nWith, DocReplacement* pOut);
+void DocReplacementFree(DocReplacement* pReplacement);
+
+#endif /* DOC_REPLACE_H */
@@ -0,0 +1,146 @@
+#include "doc_stats.h"
+#include "text_scan.h"
+#include <string.h>
+
+/* Totals of a run of text, given the unit before it */
+typedef struct {
+    DocStats sum;
+    TextUnit prev;               /* Last unit consumed */
+    int bHavePrev;               /* prev is valid (not at the document start) */
+} StatsScan;
+
+static inline int IsWordSpace(TextUnit u) {
+    return u == ' ' || u == '\t' || u == '\r' || u == '\n';
+}
+
+static inline int IsHighSurrogate(TextUnit u) {
+    return u >= 0xD800 && u <= 0xDBFF;
+}
+
+static inline int IsLowSurrogate(TextUnit u) {
+    return u >= 0xDC00 && u <= 0xDFFF;
+}
+
+static void StatsScanInit(StatsScan* pScan) {
+    memset(pScan, 0, sizeof(*pScan));
+}
+
+static void StatsScanUnits(StatsScan* pScan, const TextUnit* pText, size_t nLen) {
+    TextScan breaks;
+    int bInWord = pScan->bHavePrev && !IsWordSpace(pScan->prev);
+    TextUnit prev = pScan->bHavePrev ? pScan->prev : 0;
+    size_t nPairs = 0;
+    uint64_t nBytes = 0;
+
+    if (nLen == 0) return;
+
+    pScan->sum.nUnits += nLen;
+    pScan->sum.nWords += TextCountWords(pText, nLen, &bInWord);
+
+    /* A CR just before the run makes a leading LF the second half of a CRLF */
+    TextScanInit(&breaks, NULL, NULL);
+    breaks.bPendingCR = pScan->bHavePrev && pScan->prev == '\r';
+    TextScanUnits(&breaks, pText, nLen);
+    pScan->sum.nBreaks += breaks.nCR + breaks.nLF - breaks.nCRLF;
+
+    /* Unpaired surrogates are saved as U+FFFD (3 bytes); a pair takes 4 */
+    for (size_t i = 0; i < nLen; i++) {
+        TextUnit u = pText[i];
+        if (u < 0x80) {
+            nBytes += 1;
+        } else if (u < 0x800) {
+            nBytes += 2;
+        } else if (IsLowSurrogate(u) && IsHighSurrogate(prev)) {
+            nBytes += 1;
+            nPairs++;
+        } else {
+            nBytes += 3;
+        }
+        prev = u;
+    }
+    pScan->sum.nChars += nLen - nPairs;
+    pScan->sum.nBytes += nBytes;
+
+    pScan->prev = pText[nLen - 1];
+    pScan->bHavePrev = 1;
+}
+
+static int ScanSpan(void* pContext, const TextUnit* pText, size_t nLen) {
+    StatsScan* pScan = (StatsScan*)pContext;
+    StatsScanUnits(pScan, pText, nLen);
+    return 1;
+}
+
+/*
+ * Totals of the units in [nOffset, nOffset + nLen] (the unit after the range
+ * included, as its values depend on the last unit of the range).
+ */
+static int MeasureAround(const PieceTable* pDoc, size_t nOffset, size_t nLen, DocStats* pOut) {
+    size_t nDocLen = PieceTableLength(pDoc);
+    size_t nEnd = nOffset + nLen;
+    StatsScan scan;
+
+    if (nOffset > nDocLen || nEnd > nDocLen) return 0;
+    if (nEnd < nDocLen) nEnd++;
+
+    StatsScanInit(&scan);
+    if (nOffset > 0) {
+        PieceCursor cursor;
+        PieceCursorInit(&cursor, pDoc);
+        if (!PieceCursorAt(&cursor, nOffset - 1, &scan.prev)) return 0;
+        scan.bHavePrev = 1;
+    }
+    if (!PieceTableForEach(pDoc, nOffset, nEnd - nOffset, ScanSpan, &scan)) return 0;
+
+    *pOut = scan.sum;
+    return 1;
+}
+
+void DocStatsInit(DocStats* pStats) {
+    memset(pStats, 0, sizeof(*pStats));
+}
+
+int DocStatsBuild(DocStats* pStats, const PieceTable* pDoc) {
+    StatsScan scan;
+
+    StatsScanInit(&scan);
+    if (!PieceTableForEach(pDoc, 0, PieceTableLength(pDoc), ScanSpan, &scan)) return 0;
+    *pStats = scan.sum;
+    return 1;
+}
+
+void DocStatsBuildFromText(DocStats* pStats, const TextUnit* pText, size_t nLen) {
+    StatsScan scan;
+
+    StatsScanInit(&scan);
+    StatsScanUnits(&scan, pText, nLen);
+    *pStats = scan.sum;
+}
+
+int DocStatsRemove(DocStats* pStats, const PieceTable* pDoc, size_t nOffset, size_t nLen) {
+    DocStats part;
+
+    if (!MeasureAround(pDoc, nOffset, nLen, &part)) return 0;
+    pStats->nUnits -= part.nUnits;
+    pStats->nChars -= part.nChars;
+    pStats->nWords -= part.nWords;
+    pStats->nBreaks -= part.nBreaks;
+    pStats->nBytes -= part.nBytes;
+    return 1;
+}
+
+int DocStatsInsert(DocStats* pStats, const PieceTable* pDoc, size_t nOffset, size_t nLen) {
+    DocStats part;
+
+    if (!MeasureAround(pDoc, nOffset, nLen, &part)) return 0;
+    pStats->nUnits += part.nUnits;
+    pStats->nChars += part.nChars;
+    pStats->nWords += part.nWords;
+    pStats->nBreaks += part.nBreaks;
+    pStats->nBytes += part.nBytes;
+    return 1;
+}
+
+size_t DocStatsLineCount(const DocStats* pStats) {
+    return pStats->nBreaks + 1;
+}
@@ -0,0 +1,45 @@
+#ifndef DOC_STATS_H
+#define DOC_STATS_H
+
+/*
+ * Document statistics kept up to date from edit deltas.
+ *
+ * Portable C. Every count is a sum over units of a value that depends only
+ * on the unit and the one before it (a word starts where a word character
+ * follows a separator, a CRLF is counted at its LF, a low surrogate after a
+ * high one does not start a character). An edit of [nOffset, nOffset + n)
+ * can therefore only change the values of the units in that range and of
+ * the one unit after it: they are subtracted before the edit and added back
+ * afterwards, so the cost of an edit does not depend on the document size.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "piece_table.h"
+
+/* Document totals */
+typedef struct {
+    size_t nUnits;               /* UTF-16 units */
+    size_t nChars;               /* Characters (a surrogate pair counts once) */
+    size_t nWords;               /* Runs not containing space, tab, CR or LF */
+    size_t nBreaks;              /* Line breaks (CRLF counts once) */
+    uint64_t nBytes;             /* UTF-8 bytes when saved (no BOM) */
+} DocStats;
+
+void DocStatsInit(DocStats* pStats);
+
+/* Full rescan of a document or of a plain buffer */
+int DocStatsBuild(DocStats* pStats, const PieceTable* pDoc);
+void DocStatsBuildFromText(DocStats* pStats, const TextUnit* pText, size_t nLen);
+
+/*
+ * Incremental update around one edit: call DocStatsRemove before deleting
+ * nLen units at nOffset and DocStatsInsert after inserting nLen units there.
+ */
+int DocStatsRemove(DocStats* pStats, const PieceTable* pDoc, size_t nOffset, size_t nLen);
+int DocStatsInsert(DocStats* pStats, const PieceTable* pDoc, size_t nOffset, size_t nLen);
+
+/* Lines in the document (one more than the line breaks) */
+size_t DocStatsLineCount(const DocStats* pStats);
+
+#endif /* DOC_STATS_H */
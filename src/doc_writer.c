@@ -0,0 +1,178 @@
+#include "doc_writer.h"
+#include "text_encoding.h"
+#include "transcode.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Longest temp file path (the target path plus a short suffix) */
+#define SAVE_TEMP_PATH_MAX 4096
+
+/* Room a finishing encoder step needs (a replacement character) */
+#define FINISH_MAX_BYTES 4
+
+typedef struct {
+    int nEncoding;               /* TEXT_ENCODING_ written */
+    int bNative;                 /* nEncoding has the bytes of TextUnit text */
+    Utf8Encoder utf8;
+    Utf32Encoder utf32;
+    uint8_t* pBuffer;            /* DOC_WRITER_CHUNK bytes, reused for every chunk */
+    size_t nUsed;                /* Bytes waiting in pBuffer */
+    ByteSinkProc pfnSink;
+    void* pContext;
+} DocWriter;
+
+/* Hand the buffered bytes to the sink */
+static int FlushWriter(DocWriter* pWriter) {
+    if (pWriter->nUsed == 0) return 1;
+    if (!pWriter->pfnSink(pWriter->pContext, pWriter->pBuffer, pWriter->nUsed)) return 0;
+    pWriter->nUsed = 0;
+    return 1;
+}
+
+/* Encode what fits of nLen units into the buffer (returns the units used) */
+static size_t EncodeUnits(DocWriter* pWriter, const TextUnit* pText, size_t nLen, size_t* pnWritten) {
+    uint8_t* pOut = pWriter->pBuffer + pWriter->nUsed;
+    size_t nRoom = DOC_WRITER_CHUNK - pWriter->nUsed;
+
+    switch (pWriter->nEncoding) {
+        case TEXT_ENCODING_UTF16LE:
+        case TEXT_ENCODING_UTF16BE:
+            if (nLen > nRoom / 2) nLen = nRoom / 2;
+            Utf16ToBytes(pText, nLen, pWriter->nEncoding == TEXT_ENCODING_UTF16BE, pOut);
+            *pnWritten = nLen * 2;
+            return nLen;
+        case TEXT_ENCODING_UTF32LE:
+        case TEXT_ENCODING_UTF32BE:
+            return Utf32EncoderEncode(&pWriter->utf32, pText, nLen, pOut, nRoom, pnWritten);
+        default:
+            return Utf8EncoderEncode(&pWriter->utf8, pText, nLen, pOut, nRoom, pnWritten);
+    }
+}
+
+/* Encode one piece table span, flushing whenever the buffer fills */
+static int WriteSpan(void* pContext, const TextUnit* pText, size_t nLen) {
+    DocWriter* pWriter = (DocWriter*)pContext;
+
+    /* Already in the bytes written, and too long to be worth buffering */
+    if (pWriter->bNative && nLen >= DOC_WRITER_CHUNK / sizeof(TextUnit)) {
+        return FlushWriter(pWriter) &&
+               pWriter->pfnSink(pWriter->pContext, (const uint8_t*)pText, nLen * sizeof(TextUnit));
+    }
+
+    while (nLen > 0) {
+        size_t nWritten;
+        size_t nUsed = EncodeUnits(pWriter, pText, nLen, &nWritten);
+        pWriter->nUsed += nWritten;
+        pText += nUsed;
+        nLen -= nUsed;
+
+        if (nLen > 0 && !FlushWriter(pWriter)) return 0;
+    }
+    return 1;
+}
+
+/* Write the whole document in a Unicode encoding (returns nonzero on success) */
+int WriteDocumentText(const PieceTable* pDoc, int nEncoding, int bBom, ByteSinkProc pfnSink, void* pContext) {
+    DocWriter writer;
+    int bOk;
+
+    if (nEncoding == TEXT_ENCODING_ANSI) return 0;
+
+    writer.pBuffer = (uint8_t*)malloc(DOC_WRITER_CHUNK);
+    if (!writer.pBuffer) return 0;
+    writer.nEncoding = nEncoding;
+    writer.bNative = IsNativeEncoding(nEncoding);
+    writer.nUsed = bBom ? TextEncodingBom(nEncoding, writer.pBuffer) : 0;
+    writer.pfnSink = pfnSink;
+    writer.pContext = pContext;
+    Utf8EncoderInit(&writer.utf8);
+    Utf32EncoderInit(&writer.utf32, nEncoding == TEXT_ENCODING_UTF32BE);
+
+    bOk = PieceTableForEach(pDoc, 0, PieceTableLength(pDoc), WriteSpan, &writer);
+    if (bOk) {
+        /* A trailing unpaired surrogate still needs its replacement character */
+        if (DOC_WRITER_CHUNK - writer.nUsed < FINISH_MAX_BYTES) bOk = FlushWriter(&writer);
+        if (bOk) {
+            uint8_t* pOut = writer.pBuffer + writer.nUsed;
+            writer.nUsed += (nEncoding == TEXT_ENCODING_UTF8) ? Utf8EncoderFinish(&writer.utf8, pOut)
+                                                             : Utf32EncoderFinish(&writer.utf32, pOut);
+            bOk = FlushWriter(&writer);
+        }
+    }
+
+    free(writer.pBuffer);
+    return bOk;
+}
+
+/* Byte sink that appends encoded chunks to an open file */
+static int WriteChunkToFile(void* pContext, const uint8_t* pData, size_t nLen) {
+    return OutputFileWrite((OutputFile*)pContext, pData, nLen);
+}
+
+/* What SaveDocument writes */
+typedef struct {
+    const PieceTable* pDoc;
+    int nEncoding;
+    int bBom;
+} DocumentSource;
+
+/* Fills an open temp file (returns nonzero on success) */
+typedef int (*SaveFillProc)(OutputFile* pFile, const void* pSource);
+
+/* Stream to a temp file, flush, then swap it in (returns nonzero on success) */
+static int SaveThroughTemp(const PathChar* szPath, SaveFillProc pfnFill, const void* pSource) {
+    PathChar szTemp[SAVE_TEMP_PATH_MAX];
+    OutputFile file;
+    int bOk;
+
+    if (!OutputFileCreateTemp(&file, szPath, szTemp, SAVE_TEMP_PATH_MAX)) return 0;
+
+    bOk = pfnFill(&file, pSource);
+    if (bOk) bOk = OutputFileFlush(&file);
+    if (!OutputFileClose(&file)) bOk = 0;
+    if (bOk) bOk = ReplaceFileAtomic(szTemp, szPath);
+
+    if (!bOk) DeleteFilePath(szTemp);
+    return bOk;
+}
+
+static int FillWithDocument(OutputFile* pFile, const void* pSource) {
+    const DocumentSource* pDocument = (const DocumentSource*)pSource;
+    return WriteDocumentText(pDocument->pDoc, pDocument->nEncoding, pDocument->bBom, WriteChunkToFile, pFile);
+}
+
+/* Save the document through a temp file */
+int SaveDocument(const PieceTable* pDoc, const PathChar* szPath, int nEncoding, int bBom) {
+    DocumentSource document;
+    document.pDoc = pDoc;
+    document.nEncoding = nEncoding;
+    document.bBom = bBom;
+    return SaveThroughTemp(szPath, FillWithDocument, &document);
+}
+
+/* Bytes to copy for SaveBytes */
+typedef struct {
+    const uint8_t* pData;
+    uint64_t nSize;
+} ByteRange;
+
+static int FillWithBytes(OutputFile* pFile, const void* pSource) {
+    const ByteRange* pRange = (const ByteRange*)pSource;
+    uint64_t nPos = 0;
+
+    while (nPos < pRange->nSize) {
+        uint64_t nLeft = pRange->nSize - nPos;
+        size_t nChunk = (nLeft < DOC_WRITER_CHUNK) ? (size_t)nLeft : DOC_WRITER_CHUNK;
+        if (!OutputFileWrite(pFile, pRange->pData + nPos, nChunk)) return 0;
+        nPos += nChunk;
+    }
+    return 1;
+}
+
+/* Save raw bytes through a temp file */
+int SaveBytes(const uint8_t* pData, uint64_t nSize, const PathChar* szPath) {
+    ByteRange range;
+    range.pData = pData;
+    range.nSize = nSize;
+    return SaveThroughTemp(szPath, FillWithBytes, &range);
+}
@@ -0,0 +1,45 @@
+#ifndef DOC_WRITER_H
+#define DOC_WRITER_H
+
+/*
+ * Streaming document writer.
+ *
+ * Portable C. Encodes the piece table to UTF-8, UTF-16 or UTF-32 one
+ * fixed-size chunk at a time into a single reusable buffer and hands each
+ * full chunk to a byte sink, so peak memory stays at one chunk whatever
+ * the document size. UTF-16 in the host's byte order needs no encoding:
+ * spans of at least a chunk go to the sink straight from the document.
+ *
+ * Saving to disk goes through a sibling temp file that is flushed and then
+ * swapped in, so a crash or a full disk never leaves a truncated original.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "piece_table.h"
+#include "platform.h"
+
+/* Size of the reusable output buffer */
+#define DOC_WRITER_CHUNK (1024 * 1024)
+
+/* Receives encoded bytes (return nonzero to continue) */
+typedef int (*ByteSinkProc)(void* pContext, const uint8_t* pData, size_t nLen);
+
+/*
+ * Write the whole document in a Unicode encoding (a TEXT_ENCODING_ other
+ * than ANSI), optionally with a byte order mark. Returns nonzero on
+ * success.
+ */
+int WriteDocumentText(const PieceTable* pDoc, int nEncoding, int bBom, ByteSinkProc pfnSink, void* pContext);
+
+/*
+ * Save the document to szPath: stream it into a temp file, flush it, then
+ * atomically replace szPath. On failure szPath is left untouched and the
+ * temp file removed. Returns nonzero on success.
+ */
+int SaveDocument(const PieceTable* pDoc, const PathChar* szPath, int nEncoding, int bBom);
+
+/* Save nSize bytes verbatim to szPath the same way */
+int SaveBytes(const uint8_t* pData, uint64_t nSize, const PathChar* szPath);
+
+#endif /* DOC_WRITER_H */
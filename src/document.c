@@ -0,0 +1,667 @@
+#include "notepad.h"
+#include <richedit.h>
+
+/* The document model stores UTF-16 code units, same as WCHAR */
+typedef char WcharMatchesTextUnit[sizeof(WCHAR) == sizeof(TextUnit) ? 1 : -1];
+
+/* Release a document buffer allocated from the process heap */
+void ReleaseHeapText(void* pContext, const TextUnit* pText, size_t nLen) {
+    (void)pContext;
+    (void)nLen;
+    HeapFree(GetProcessHeap(), 0, (LPVOID)pText);
+}
+
+/* Check whether an edit control is a RichEdit (CR-only line breaks) */
+BOOL IsRichEditControl(HWND hEdit) {
+    TCHAR szClass[32];
+    if (!hEdit || !GetClassName(hEdit, szClass, 32)) return FALSE;
+    return _tcsicmp(szClass, TEXT("RICHEDIT50W")) == 0 ||
+           _tcsicmp(szClass, TEXT("RichEdit20W")) == 0;
+}
+
+/* Stream-in state for EM_STREAMIN */
+typedef struct {
+    const PieceTable* pDoc;
+    size_t nPos;
+} StreamInState;
+
+/* EM_STREAMIN callback: hand the control the next run of document text */
+static DWORD CALLBACK StreamInCallback(DWORD_PTR dwCookie, LPBYTE pbBuff, LONG cb, LONG* pcb) {
+    StreamInState* pState = (StreamInState*)dwCookie;
+    size_t nUnits = (size_t)cb / sizeof(TextUnit);
+    size_t nCopied = PieceTableCopy(pState->pDoc, pState->nPos, (TextUnit*)pbBuff, nUnits);
+
+    pState->nPos += nCopied;
+    *pcb = (LONG)(nCopied * sizeof(TextUnit));
+    return 0;
+}
+
+/* Fill an edit control with the document text */
+BOOL FeedEditFromDocument(HWND hEdit, const PieceTable* pDoc) {
+    if (!hEdit) return FALSE;
+
+    if (IsRichEditControl(hEdit)) {
+        /* Stream straight out of the piece table, no contiguous copy */
+        StreamInState state;
+        EDITSTREAM es = {0};
+        LRESULT lMask = SendMessage(hEdit, EM_SETEVENTMASK, 0, 0);
+
+        state.pDoc = pDoc;
+        state.nPos = 0;
+        es.dwCookie = (DWORD_PTR)&state;
+        es.pfnCallback = StreamInCallback;
+        SendMessage(hEdit, EM_STREAMIN, SF_TEXT | SF_UNICODE, (LPARAM)&es);
+
+        SendMessage(hEdit, EM_SETEVENTMASK, 0, lMask);
+        return es.dwError == 0;
+    }
+
+    /* Plain EDIT control needs one contiguous string */
+    size_t nLen = PieceTableLength(pDoc);
+    WCHAR* pText = (WCHAR*)HeapAlloc(GetProcessHeap(), 0, (nLen + 1) * sizeof(WCHAR));
+    if (!pText) return FALSE;
+
+    PieceTableCopy(pDoc, 0, (TextUnit*)pText, nLen);
+    pText[nLen] = L'\0';
+    SetWindowTextW(hEdit, pText);
+    HeapFree(GetProcessHeap(), 0, pText);
+    return TRUE;
+}
+
+/* Length of the control's text, counted as GetEditText copies it */
+static size_t GetEditLength(HWND hEdit, BOOL bRichEdit) {
+    int nLen;
+
+    if (bRichEdit) {
+        GETTEXTLENGTHEX gtl = {0};
+        gtl.flags = GTL_NUMCHARS | GTL_PRECISE;
+        gtl.codepage = 1200; /* UTF-16 */
+        nLen = (int)SendMessage(hEdit, EM_GETTEXTLENGTHEX, (WPARAM)&gtl, 0);
+    } else {
+        nLen = GetWindowTextLengthW(hEdit);
+    }
+    return (size_t)(nLen > 0 ? nLen : 0);
+}
+
+/* Copy the edit control's text; RichEdit returns CR-only line breaks */
+static WCHAR* GetEditText(HWND hEdit, BOOL bRichEdit, size_t* pnLen) {
+    WCHAR* pText;
+    int nLen = (int)GetEditLength(hEdit, bRichEdit);
+
+    pText = (WCHAR*)HeapAlloc(GetProcessHeap(), 0, ((size_t)nLen + 1) * sizeof(WCHAR));
+    if (!pText) return NULL;
+
+    if (bRichEdit) {
+        GETTEXTEX gt = {0};
+        gt.cb = (DWORD)(((size_t)nLen + 1) * sizeof(WCHAR));
+        gt.flags = GT_DEFAULT;
+        gt.codepage = 1200;
+        nLen = (int)SendMessage(hEdit, EM_GETTEXTEX, (WPARAM)&gt, (LPARAM)pText);
+    } else {
+        nLen = GetWindowTextW(hEdit, pText, nLen + 1);
+    }
+
+    *pnLen = (size_t)(nLen > 0 ? nLen : 0);
+    return pText;
+}
+
+/* Length of the line break starting at nPos in the document (0 if none) */
+static size_t BreakLengthAt(PieceCursor* pCursor, size_t nPos) {
+    TextUnit u, next;
+    if (!PieceCursorAt(pCursor, nPos, &u)) return 0;
+    if (u == L'\n') return 1;
+    if (u != L'\r') return 0;
+    return (PieceCursorAt(pCursor, nPos + 1, &next) && next == L'\n') ? 2 : 1;
+}
+
+/* Length of the line break ending at nEnd, not reaching below nFloor */
+static size_t BreakLengthBefore(PieceCursor* pCursor, size_t nEnd, size_t nFloor) {
+    TextUnit u, prev;
+    if (nEnd <= nFloor || !PieceCursorAt(pCursor, nEnd - 1, &u)) return 0;
+    if (u == L'\r') return 1;
+    if (u != L'\n') return 0;
+    return (nEnd - 1 > nFloor && PieceCursorAt(pCursor, nEnd - 2, &prev) && prev == L'\r') ? 2 : 1;
+}
+
+/* Line break sequence for a tab's line ending type */
+static const TextUnit* LineEndingUnits(LineEndingType type, size_t* pnLen) {
+    static const TextUnit crlf[] = { L'\r', L'\n' };
+    static const TextUnit lf[] = { L'\n' };
+    static const TextUnit cr[] = { L'\r' };
+
+    switch (type) {
+        case LINE_ENDING_LF: *pnLen = 1; return lf;
+        case LINE_ENDING_CR: *pnLen = 1; return cr;
+        case LINE_ENDING_CRLF:
+        default: *pnLen = 2; return crlf;
+    }
+}
+
+/* Replace [nOffset, nOffset + nRemove) of the document and update its line index and statistics */
+static BOOL ReplaceDocumentRange(TabState* pTab, size_t nOffset, size_t nRemove,
+                                 const TextUnit* pInsert, size_t nInsert) {
+    PieceTable* pDoc = &pTab->doc;
+    BOOL bStats, bOk;
+
+    /* The recovery journal describes the document before the edit */
+    JournalDocumentEdit(pTab, nOffset, nRemove, pInsert, nInsert);
+
+    /* Statistics only rescan the edited units and their neighbours */
+    bStats = DocStatsRemove(&pTab->stats, pDoc, nOffset, nRemove);
+    bOk = PieceTableDelete(pDoc, nOffset, nRemove) &&
+          PieceTableInsert(pDoc, nOffset, pInsert, nInsert);
+    if (bOk) {
+        LineIndexApplyEdit(&pTab->lines, pDoc, nOffset, nRemove, nInsert);
+        bStats = bStats && DocStatsInsert(&pTab->stats, pDoc, nOffset, nInsert);
+    } else {
+        /* Half applied: the journal no longer matches the text */
+        DiscardTabJournal(pTab);
+        LineIndexBuild(&pTab->lines, pDoc);
+        bStats = FALSE;
+    }
+    if (!bStats) {
+        DocStatsBuild(&pTab->stats, pDoc);
+    }
+    return bOk;
+}
+
+/* Copy nLen units of the control's text from nStart into pDest (returns the units copied) */
+static size_t GetEditRange(HWND hEdit, BOOL bRichEdit, size_t nStart, size_t nLen, WCHAR* pDest) {
+    size_t nCopied = 0;
+
+    if (nLen == 0) return 0;
+    if (bRichEdit) {
+        TEXTRANGEW tr;
+        tr.chrg.cpMin = (LONG)nStart;
+        tr.chrg.cpMax = (LONG)(nStart + nLen);
+        tr.lpstrText = pDest;
+        nCopied = (size_t)SendMessage(hEdit, EM_GETTEXTRANGE, 0, (LPARAM)&tr);
+    } else {
+        /* A multiline EDIT control lends out its own buffer */
+        HLOCAL hText = (HLOCAL)SendMessage(hEdit, EM_GETHANDLE, 0, 0);
+        const WCHAR* pText = hText ? (const WCHAR*)LocalLock(hText) : NULL;
+        if (pText) {
+            memcpy(pDest, pText + nStart, nLen * sizeof(WCHAR));
+            nCopied = nLen;
+            LocalUnlock(hText);
+        }
+    }
+    return nCopied > nLen ? nLen : nCopied;
+}
+
+/*
+ * Replace document [iDoc, jDoc) with nCtl units of control text, recording
+ * it for undo. RichEdit line breaks (CR) are stored using the tab's line
+ * ending type.
+ */
+static BOOL ApplyEditText(TabState* pTab, size_t iDoc, size_t jDoc, const WCHAR* pCtl, size_t nCtl) {
+    size_t nEolLen;
+    const TextUnit* pEol = LineEndingUnits(pTab->lineEnding, &nEolLen);
+    size_t nBreaks = 0;
+    BOOL bOk;
+
+    for (size_t i = 0; i < nCtl; i++) {
+        if (pTab->bRichEdit && pCtl[i] == L'\r') nBreaks++;
+    }
+
+    size_t nInsLen = nCtl + nBreaks * (nEolLen - 1);
+    TextUnit* pIns = (TextUnit*)HeapAlloc(GetProcessHeap(), 0, (nInsLen + 1) * sizeof(TextUnit));
+    if (!pIns) return FALSE;
+
+    size_t nOut = 0;
+    for (size_t i = 0; i < nCtl; i++) {
+        if (pTab->bRichEdit && pCtl[i] == L'\r') {
+            for (size_t k = 0; k < nEolLen; k++) pIns[nOut++] = pEol[k];
+        } else {
+            pIns[nOut++] = (TextUnit)pCtl[i];
+        }
+    }
+
+    /* Keep the old text for undo, then apply */
+    UndoJournalRecord(&pTab->undo, &pTab->doc, iDoc, jDoc - iDoc, pIns, nInsLen);
+    bOk = ReplaceDocumentRange(pTab, iDoc, jDoc - iDoc, pIns, nInsLen);
+
+    HeapFree(GetProcessHeap(), 0, pIns);
+    return bOk;
+}
+
+/*
+ * Work out what an editing message changed from the selection it started
+ * from, the caret it left and the change in length: typed or pasted text
+ * replaces the old selection, or sits between the old and the new caret,
+ * and Backspace or Delete removes what the length says. Control positions;
+ * returns FALSE for anything else (drag and drop, a selected result).
+ */
+static BOOL FindEditChange(const TabState* pTab, size_t nOldLen, size_t nNewLen,
+                           size_t* pnFrom, size_t* pnRemove, size_t* pnInsert) {
+    DWORD dwStart = 0, dwEnd = 0;
+    size_t nSelStart = pTab->dwSelBeforeStart, nSelEnd = pTab->dwSelBeforeEnd;
+    size_t nFrom, nInsert, nRemove;
+
+    SendMessage(pTab->hwndEdit, EM_GETSEL, (WPARAM)&dwStart, (LPARAM)&dwEnd);
+    if (dwStart != dwEnd || nSelStart > nSelEnd || nSelEnd > nOldLen || dwEnd > nNewLen) return FALSE;
+
+    nFrom = nSelStart < dwEnd ? nSelStart : dwEnd;
+    nInsert = dwEnd - nFrom;
+    if (nOldLen + nInsert < nNewLen) return FALSE;
+    nRemove = nOldLen + nInsert - nNewLen;
+
+    /* The old selection goes, and a caret that moved back only deleted up to it */
+    if (nFrom + nRemove > nOldLen || nFrom + nRemove < nSelEnd) return FALSE;
+    if (dwEnd < nSelStart && nFrom + nRemove != nSelEnd) return FALSE;
+
+    *pnFrom = nFrom;
+    *pnRemove = nRemove;
+    *pnInsert = nInsert;
+    return TRUE;
+}
+
+/* Apply an edit found by FindEditChange, reading only the inserted text */
+static BOOL SyncEditRange(TabState* pTab, size_t nFrom, size_t nRemove, size_t nInsert) {
+    WCHAR* pCtl = (WCHAR*)HeapAlloc(GetProcessHeap(), 0, (nInsert + 1) * sizeof(WCHAR));
+    size_t iDoc, jDoc;
+    BOOL bOk;
+
+    if (!pCtl) return FALSE;
+    if (GetEditRange(pTab->hwndEdit, pTab->bRichEdit, nFrom, nInsert, pCtl) != nInsert) {
+        HeapFree(GetProcessHeap(), 0, pCtl);
+        return FALSE;
+    }
+
+    /* The line index still describes the document before the edit */
+    iDoc = DocOffsetFromEditPos(pTab, (LONG)nFrom);
+    jDoc = DocOffsetFromEditPos(pTab, (LONG)(nFrom + nRemove));
+    bOk = (iDoc == jDoc && nInsert == 0) || ApplyEditText(pTab, iDoc, jDoc, pCtl, nInsert);
+
+    HeapFree(GetProcessHeap(), 0, pCtl);
+    return bOk;
+}
+
+/*
+ * Bring the whole document up to date with the edit control.
+ * The changed region is found by matching a common prefix and suffix, so it
+ * works for any kind of edit (typing, paste, undo, drag and drop). A RichEdit
+ * line break (CR) matches any CR, LF or CRLF break in the document; new
+ * breaks are stored using the tab's line ending type.
+ */
+static BOOL SyncWholeDocument(TabState* pTab) {
+    PieceTable* pDoc = &pTab->doc;
+    PieceCursor cursor;
+    BOOL bRichEdit = pTab->bRichEdit;
+    size_t nCtlLen, nDocLen;
+    size_t iCtl = 0, iDoc = 0;
+    size_t jCtl, jDoc;
+    WCHAR* pCtl;
+    BOOL bOk;
+
+    pCtl = GetEditText(pTab->hwndEdit, bRichEdit, &nCtlLen);
+    if (!pCtl) return FALSE;
+
+    nDocLen = PieceTableLength(pDoc);
+    PieceCursorInit(&cursor, pDoc);
+
+    /* Common prefix */
+    while (iCtl < nCtlLen && iDoc < nDocLen) {
+        TextUnit u;
+        if (bRichEdit && pCtl[iCtl] == L'\r') {
+            size_t nBreak = BreakLengthAt(&cursor, iDoc);
+            if (!nBreak) break;
+            iDoc += nBreak;
+        } else {
+            if (!PieceCursorAt(&cursor, iDoc, &u) || u != pCtl[iCtl]) break;
+            iDoc++;
+        }
+        iCtl++;
+    }
+
+    /* Common suffix, not overlapping the prefix */
+    jCtl = nCtlLen;
+    jDoc = nDocLen;
+    while (jCtl > iCtl && jDoc > iDoc) {
+        TextUnit u;
+        if (bRichEdit && pCtl[jCtl - 1] == L'\r') {
+            size_t nBreak = BreakLengthBefore(&cursor, jDoc, iDoc);
+            if (!nBreak) break;
+            jDoc -= nBreak;
+        } else {
+            if (!PieceCursorAt(&cursor, jDoc - 1, &u) || u != pCtl[jCtl - 1]) break;
+            jDoc--;
+        }
+        jCtl--;
+    }
+
+    bOk = (iCtl == jCtl && iDoc == jDoc) || ApplyEditText(pTab, iDoc, jDoc, pCtl + iCtl, jCtl - iCtl);
+    HeapFree(GetProcessHeap(), 0, pCtl);
+    return bOk;
+}
+
+/*
+ * Bring the document model up to date with the edit control after
+ * EN_CHANGE. An edit made by a message the control's subclass saw start
+ * (typing, Backspace, Delete, cut, paste, replace) is worked out from the
+ * selection and the length, so only the inserted text is read from the
+ * control. Anything else falls back to comparing the whole text.
+ */
+BOOL SyncDocumentFromEdit(TabState* pTab) {
+    size_t nOldLen, nNewLen, nFrom, nRemove, nInsert;
+    DWORD dwEnd = 0;
+
+    /* The control was just patched to match the document */
+    if (pTab->bPatchingEdit) return TRUE;
+    if (!pTab->bSelBefore) return SyncWholeDocument(pTab);
+
+    nOldLen = (size_t)EditPosFromDocOffset(pTab, PieceTableLength(&pTab->doc));
+    nNewLen = GetEditLength(pTab->hwndEdit, pTab->bRichEdit);
+    if (!FindEditChange(pTab, nOldLen, nNewLen, &nFrom, &nRemove, &nInsert) ||
+        !SyncEditRange(pTab, nFrom, nRemove, nInsert)) {
+        /* Stop guessing for the rest of this message */
+        pTab->bSelBefore = FALSE;
+        return SyncWholeDocument(pTab);
+    }
+
+    /* A second change in the same message starts from here */
+    SendMessage(pTab->hwndEdit, EM_GETSEL, (WPARAM)NULL, (LPARAM)&dwEnd);
+    pTab->dwSelBeforeStart = pTab->dwSelBeforeEnd = dwEnd;
+    return TRUE;
+}
+
+/* Convert an edit control character position to a document offset */
+size_t DocOffsetFromEditPos(const TabState* pTab, LONG nPos) {
+    if (nPos < 0) nPos = 0;
+    if (!pTab->bRichEdit) return (size_t)nPos;
+    return LineIndexOffsetFromCollapsed(&pTab->lines, (size_t)nPos);
+}
+
+/* Convert a document offset to an edit control character position */
+LONG EditPosFromDocOffset(const TabState* pTab, size_t nOffset) {
+    if (pTab->bRichEdit) nOffset = LineIndexCollapsedFromOffset(&pTab->lines, nOffset);
+    return (LONG)nOffset;
+}
+
+/*
+ * A control patch for one edit. A RichEdit counts any line break as one CR,
+ * and an edit can join or split a CRLF at either end, so the lines around
+ * the edit are replaced as a whole; the plain EDIT control is addressed in
+ * document units. The buffer is taken before anything changes, so running
+ * out of memory leaves the document, the control and the history as they were.
+ */
+typedef struct {
+    size_t nFrom;                /* Document range the control replaces (after the edit) */
+    size_t nTo;
+    LONG nCtlFrom;               /* The same range in the control (before the edit) */
+    LONG nCtlTo;
+    WCHAR* pText;                /* Room for the range's new text */
+} EditPatch;
+
+static BOOL BeginEditPatch(TabState* pTab, size_t nOffset, size_t nRemove, size_t nInsert, EditPatch* pPatch) {
+    size_t nDocLen = PieceTableLength(&pTab->doc);
+    size_t nFrom = nOffset, nTo = nOffset + nRemove;
+
+    if (nOffset > nDocLen || nRemove > nDocLen - nOffset) return FALSE;
+
+    if (pTab->bRichEdit) {
+        /* From the line before the edit to the end of the line it ends in */
+        size_t nFirst = LineIndexLineFromOffset(&pTab->lines, nOffset);
+        size_t nLast = LineIndexLineFromOffset(&pTab->lines, nOffset + nRemove);
+        if (nFirst > 0) nFirst--;
+        nFrom = LineIndexLineStart(&pTab->lines, nFirst);
+        nTo = (nLast + 1 < LineIndexCount(&pTab->lines)) ? LineIndexLineStart(&pTab->lines, nLast + 1) : nDocLen;
+    }
+    pPatch->nCtlFrom = EditPosFromDocOffset(pTab, nFrom);
+    pPatch->nCtlTo = EditPosFromDocOffset(pTab, nTo);
+
+    /* The same range after the edit, with breaks as the control stores them */
+    pPatch->nFrom = nFrom;
+    pPatch->nTo = nTo - nRemove + nInsert;
+    pPatch->pText = (WCHAR*)HeapAlloc(GetProcessHeap(), 0, (pPatch->nTo - nFrom + 1) * sizeof(WCHAR));
+    return pPatch->pText != NULL;
+}
+
+/* Apply the edit to the document, then patch the control to match */
+static BOOL FinishEditPatch(TabState* pTab, EditPatch* pPatch, size_t nOffset, size_t nRemove,
+                            const TextUnit* pInsert, size_t nInsert) {
+    HWND hEdit = pTab->hwndEdit;
+    WCHAR* pText = pPatch->pText;
+    size_t nLen;
+
+    if (!ReplaceDocumentRange(pTab, nOffset, nRemove, pInsert, nInsert)) {
+        /* Half applied: show whatever the document now holds */
+        HeapFree(GetProcessHeap(), 0, pText);
+        FeedEditFromDocument(hEdit, &pTab->doc);
+        return FALSE;
+    }
+    nLen = PieceTableCopy(&pTab->doc, pPatch->nFrom, (TextUnit*)pText, pPatch->nTo - pPatch->nFrom);
+    if (pTab->bRichEdit) {
+        size_t nOut = 0;
+        WCHAR prev = 0;
+        for (size_t i = 0; i < nLen; i++) {
+            WCHAR u = pText[i];
+            if (!(u == L'\n' && prev == L'\r')) pText[nOut++] = (u == L'\n') ? L'\r' : u;
+            prev = u;
+        }
+        nLen = nOut;
+    }
+    pText[nLen] = L'\0';
+
+    if (pTab->bRichEdit) {
+        LRESULT lMask = SendMessage(hEdit, EM_SETEVENTMASK, 0, 0);
+        SendMessage(hEdit, EM_SETSEL, (WPARAM)pPatch->nCtlFrom, (LPARAM)pPatch->nCtlTo);
+        SendMessageW(hEdit, EM_REPLACESEL, FALSE, (LPARAM)pText);
+        SendMessage(hEdit, EM_SETEVENTMASK, 0, lMask);
+    } else {
+        /* EN_CHANGE follows, but the control already matches the document */
+        pTab->bPatchingEdit = TRUE;
+        SendMessage(hEdit, EM_SETSEL, (WPARAM)pPatch->nCtlFrom, (LPARAM)pPatch->nCtlTo);
+        SendMessageW(hEdit, EM_REPLACESEL, FALSE, (LPARAM)pText);
+        pTab->bPatchingEdit = FALSE;
+    }
+
+    HeapFree(GetProcessHeap(), 0, pText);
+    return TRUE;
+}
+
+/* Undo journal callback: apply one edit to the document and the control */
+static int ApplyJournalEdit(void* pContext, size_t nOffset, size_t nRemove,
+                            const TextUnit* pInsert, size_t nInsert) {
+    TabState* pTab = (TabState*)pContext;
+    EditPatch patch;
+
+    if (!BeginEditPatch(pTab, nOffset, nRemove, nInsert, &patch)) return 0;
+    return FinishEditPatch(pTab, &patch, nOffset, nRemove, pInsert, nInsert);
+}
+
+/* Put the caret at a document offset and bring it into view */
+static void SetCaretToDocOffset(TabState* pTab, size_t nOffset) {
+    LONG nPos = EditPosFromDocOffset(pTab, nOffset);
+    SendMessage(pTab->hwndEdit, EM_SETSEL, (WPARAM)nPos, (LPARAM)nPos);
+    SendMessage(pTab->hwndEdit, EM_SCROLLCARET, 0, 0);
+}
+
+/* Undo the last edit step from the tab's journal */
+BOOL UndoDocumentEdit(TabState* pTab) {
+    size_t nCaret;
+
+    if (!pTab->hwndEdit || pTab->bLargeFile || pTab->pLoad) return FALSE;
+    if (!UndoJournalUndo(&pTab->undo, &pTab->doc, ApplyJournalEdit, pTab, &nCaret)) return FALSE;
+    SetCaretToDocOffset(pTab, nCaret);
+    return TRUE;
+}
+
+/* Redo the last undone edit step */
+BOOL RedoDocumentEdit(TabState* pTab) {
+    size_t nCaret;
+
+    if (!pTab->hwndEdit || pTab->bLargeFile || pTab->pLoad) return FALSE;
+    if (!UndoJournalRedo(&pTab->undo, &pTab->doc, ApplyJournalEdit, pTab, &nCaret)) return FALSE;
+    SetCaretToDocOffset(pTab, nCaret);
+    return TRUE;
+}
+
+/*
+ * Apply an edit already recorded as one undo step, leaving the caret after
+ * it. Half applied, the history no longer matches the text, and the tab is
+ * marked modified since its text may have changed.
+ */
+static BOOL FinishRecordedEdit(TabState* pTab, EditPatch* pPatch, size_t nOffset, size_t nRemove,
+                               const TextUnit* pInsert, size_t nInsert) {
+    UndoJournalSeal(&pTab->undo);
+    if (!FinishEditPatch(pTab, pPatch, nOffset, nRemove, pInsert, nInsert)) {
+        UndoJournalClear(&pTab->undo);
+        pTab->bModified = TRUE;
+        return FALSE;
+    }
+    SetCaretToDocOffset(pTab, nOffset + nInsert);
+    return TRUE;
+}
+
+/*
+ * Replace a range of the document and the control as one undo step, leaving
+ * the caret after it. Returns FALSE with nothing changed if memory runs out.
+ */
+BOOL ReplaceDocumentText(TabState* pTab, size_t nOffset, size_t nRemove,
+                         const TextUnit* pInsert, size_t nInsert) {
+    EditPatch patch;
+
+    if (!pTab->hwndEdit || pTab->bLargeFile || pTab->pLoad) return FALSE;
+    if (!BeginEditPatch(pTab, nOffset, nRemove, nInsert, &patch)) return FALSE;
+
+    UndoJournalSeal(&pTab->undo);
+    UndoJournalRecord(&pTab->undo, &pTab->doc, nOffset, nRemove, pInsert, nInsert);
+    return FinishRecordedEdit(pTab, &patch, nOffset, nRemove, pInsert, nInsert);
+}
+
+/*
+ * Replace All: swap in the span's new text as one edit, as ReplaceDocumentText
+ * does, but keep only the matches and their replacement in the undo history
+ */
+BOOL ReplaceDocumentMatches(TabState* pTab, const DocReplacement* pReplacement, const TextUnit* pWith, size_t nWith) {
+    size_t nOffset = pReplacement->nFrom, nRemove = pReplacement->nTo - pReplacement->nFrom;
+    EditPatch patch;
+
+    if (!pTab->hwndEdit || pTab->bLargeFile || pTab->pLoad) return FALSE;
+    if (!BeginEditPatch(pTab, nOffset, nRemove, pReplacement->nLen, &patch)) return FALSE;
+
+    UndoJournalSeal(&pTab->undo);
+    UndoJournalRecordMatches(&pTab->undo, &pTab->doc, nOffset, nRemove, pReplacement->pMatches,
+                             pReplacement->nCount, pWith, nWith);
+    return FinishRecordedEdit(pTab, &patch, nOffset, nRemove, pReplacement->pText, pReplacement->nLen);
+}
+
+/*
+ * Add text at the end of the document and the control without touching the
+ * undo history, the selection or the scroll position. Used for text the
+ * program writes into a tab as it arrives; the control may be read-only.
+ */
+BOOL AppendDocumentText(TabState* pTab, const TextUnit* pText, size_t nLen) {
+    HWND hEdit = pTab->hwndEdit;
+    size_t nDocLen = PieceTableLength(&pTab->doc);
+    BOOL bReadOnly;
+    DWORD dwStart = 0, dwEnd = 0;
+    POINT ptScroll = {0};
+    int nFirstLine = 0;
+    WCHAR* pCtl;
+    size_t nCtl = 0;
+    LONG nEnd;
+
+    if (!hEdit || pTab->bLargeFile || pTab->pLoad || nLen == 0) return FALSE;
+
+    /* The control's copy, with breaks as it stores them */
+    pCtl = (WCHAR*)HeapAlloc(GetProcessHeap(), 0, (nLen + 1) * sizeof(WCHAR));
+    if (!pCtl) return FALSE;
+    if (pTab->bRichEdit) {
+        TextUnit prev = 0;
+        if (nDocLen > 0) PieceTableCopy(&pTab->doc, nDocLen - 1, &prev, 1);
+        for (size_t i = 0; i < nLen; i++) {
+            TextUnit u = pText[i];
+            if (!(u == L'\n' && prev == L'\r')) pCtl[nCtl++] = (u == L'\n') ? L'\r' : u;
+            prev = u;
+        }
+    } else {
+        memcpy(pCtl, pText, nLen * sizeof(WCHAR));
+        nCtl = nLen;
+    }
+    pCtl[nCtl] = L'\0';
+
+    if (!ReplaceDocumentRange(pTab, nDocLen, 0, pText, nLen)) {
+        HeapFree(GetProcessHeap(), 0, pCtl);
+        FeedEditFromDocument(hEdit, &pTab->doc);
+        return FALSE;
+    }
+    nEnd = EditPosFromDocOffset(pTab, nDocLen);
+
+    /* Leave the view where the user had it */
+    bReadOnly = (GetWindowLongPtr(hEdit, GWL_STYLE) & ES_READONLY) != 0;
+    SendMessage(hEdit, EM_GETSEL, (WPARAM)&dwStart, (LPARAM)&dwEnd);
+    SendMessage(hEdit, WM_SETREDRAW, FALSE, 0);
+    if (bReadOnly) SendMessage(hEdit, EM_SETREADONLY, FALSE, 0);
+
+    if (nCtl > 0) {
+        if (pTab->bRichEdit) {
+            LRESULT lMask = SendMessage(hEdit, EM_SETEVENTMASK, 0, 0);
+            SendMessage(hEdit, EM_GETSCROLLPOS, 0, (LPARAM)&ptScroll);
+            SendMessage(hEdit, EM_SETSEL, (WPARAM)nEnd, (LPARAM)nEnd);
+            SendMessageW(hEdit, EM_REPLACESEL, FALSE, (LPARAM)pCtl);
+            SendMessage(hEdit, EM_SETSEL, (WPARAM)dwStart, (LPARAM)dwEnd);
+            SendMessage(hEdit, EM_SETSCROLLPOS, 0, (LPARAM)&ptScroll);
+            SendMessage(hEdit, EM_SETEVENTMASK, 0, lMask);
+        } else {
+            /* EN_CHANGE follows, but the control already matches the document */
+            nFirstLine = (int)SendMessage(hEdit, EM_GETFIRSTVISIBLELINE, 0, 0);
+            pTab->bPatchingEdit = TRUE;
+            SendMessage(hEdit, EM_SETSEL, (WPARAM)nEnd, (LPARAM)nEnd);
+            SendMessageW(hEdit, EM_REPLACESEL, FALSE, (LPARAM)pCtl);
+            pTab->bPatchingEdit = FALSE;
+            SendMessage(hEdit, EM_SETSEL, (WPARAM)dwStart, (LPARAM)dwEnd);
+            SendMessage(hEdit, EM_LINESCROLL, 0,
+                        (LPARAM)(nFirstLine - (int)SendMessage(hEdit, EM_GETFIRSTVISIBLELINE, 0, 0)));
+        }
+    }
+
+    if (bReadOnly) SendMessage(hEdit, EM_SETREADONLY, TRUE, 0);
+    SendMessage(hEdit, WM_SETREDRAW, TRUE, 0);
+    InvalidateRect(hEdit, NULL, TRUE);
+
+    HeapFree(GetProcessHeap(), 0, pCtl);
+    return TRUE;
+}
+
+/* Put the caret at the start of a line (one-based) and bring it into view */
+void GoToDocumentLine(TabState* pTab, size_t nLine) {
+    size_t nCount = LineIndexCount(&pTab->lines);
+
+    if (!pTab->hwndEdit || pTab->bLargeFile || pTab->pLoad || nLine == 0) return;
+    if (nLine > nCount) nLine = nCount;
+    SetCaretToDocOffset(pTab, LineIndexLineStart(&pTab->lines, nLine - 1));
+}
+
+/* Where a tab's selection and view are: from its edit control, or as saved while it has none */
+void GetTabPosition(const TabState* pTab, TabPosition* pPos) {
+    DWORD dwStart = 0, dwEnd = 0;
+
+    if (!pTab->hwndEdit || pTab->bLargeFile || pTab->pLoad) {
+        *pPos = pTab->savedPos;
+        return;
+    }
+    SendMessage(pTab->hwndEdit, EM_GETSEL, (WPARAM)&dwStart, (LPARAM)&dwEnd);
+    pPos->nSelStart = DocOffsetFromEditPos(pTab, dwStart);
+    pPos->nSelEnd = DocOffsetFromEditPos(pTab, dwEnd);
+    pPos->nFirstLine = (size_t)SendMessage(pTab->hwndEdit, EM_GETFIRSTVISIBLELINE, 0, 0);
+    pPos->bValid = TRUE;
+}
+
+/* Move a tab's new edit control to its saved position, then forget it (the text may have changed since) */
+void RestoreTabPosition(TabState* pTab) {
+    size_t nLen = PieceTableLength(&pTab->doc);
+    TabPosition pos = pTab->savedPos;
+
+    pTab->savedPos.bValid = FALSE;
+    if (!pos.bValid || !pTab->hwndEdit || pTab->bLargeFile || pTab->pLoad) return;
+    if (pos.nSelStart > nLen) pos.nSelStart = nLen;
+    if (pos.nSelEnd > nLen) pos.nSelEnd = nLen;
+    if (pos.nFirstLine >= LineIndexCount(&pTab->lines)) pos.nFirstLine = 0;
+
+    SendMessage(pTab->hwndEdit, EM_SETSEL, EditPosFromDocOffset(pTab, pos.nSelStart),
+                EditPosFromDocOffset(pTab, pos.nSelEnd));
+    SendMessage(pTab->hwndEdit, EM_LINESCROLL, 0, (LPARAM)((int)pos.nFirstLine -
+                (int)SendMessage(pTab->hwndEdit, EM_GETFIRSTVISIBLELINE, 0, 0)));
+}
@@ -0,0 +1,860 @@
+#include "edit_journal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* File magic */
+static const uint8_t g_Magic[4] = { 'X', 'N', 'J', '1' };
+
+/* Record types */
+#define RECORD_BASE 1
+#define RECORD_EDIT 2
+
+/* Text encodings in a record */
+#define TEXT_NARROW 0            /* One byte per unit (all units below 0x100) */
+#define TEXT_WIDE   1            /* Two bytes per unit, little-endian */
+
+/* Journal states */
+#define JOURNAL_ACTIVE     0
+#define JOURNAL_CLOSING    1     /* Write what is pending, keep the file */
+#define JOURNAL_DISCARDING 2     /* Drop what is pending, delete the file */
+
+struct EditJournal {
+    EditJournal* pNext;          /* Next journal of the writer */
+    JournalWriter* pWriter;      /* NULL until the writer serves it */
+    JournalWriter* pHome;        /* Writer a claimed journal goes to on resume */
+    PathChar szJournal[EDIT_JOURNAL_MAX_PATH];
+    PathChar szDocPath[EDIT_JOURNAL_MAX_PATH];
+    int nLineEnding;
+    uint64_t nLogBytes;          /* Edit bytes since the base (caller's thread) */
+
+    /* Guarded by the writer's signal */
+    uint8_t* pPending;           /* Records waiting for the writer */
+    size_t nPending;
+    size_t nPendingCapacity;
+    uint8_t* pSpare;             /* Buffer the writer handed back */
+    size_t nSpareCapacity;
+    int bRewrite;                /* pPending starts a new file (header and base) */
+    int nState;                  /* JOURNAL_ */
+    int bFailed;                 /* A write or an allocation failed */
+    uint64_t nQueued;            /* Edits queued */
+    uint64_t nDurable;           /* Edits flushed to disk */
+
+    /* Writer thread only (or the caller's, before the writer serves it) */
+    OutputFile file;             /* Open journal file (hFile NULL if none) */
+};
+
+static const uint32_t g_Crc32Table[256] = {
+    0x00000000u, 0x77073096u, 0xEE0E612Cu, 0x990951BAu, 0x076DC419u, 0x706AF48Fu,
+    0xE963A535u, 0x9E6495A3u, 0x0EDB8832u, 0x79DCB8A4u, 0xE0D5E91Eu, 0x97D2D988u,
+    0x09B64C2Bu, 0x7EB17CBDu, 0xE7B82D07u, 0x90BF1D91u, 0x1DB71064u, 0x6AB020F2u,
+    0xF3B97148u, 0x84BE41DEu, 0x1ADAD47Du, 0x6DDDE4EBu, 0xF4D4B551u, 0x83D385C7u,
+    0x136C9856u, 0x646BA8C0u, 0xFD62F97Au, 0x8A65C9ECu, 0x14015C4Fu, 0x63066CD9u,
+    0xFA0F3D63u, 0x8D080DF5u, 0x3B6E20C8u, 0x4C69105Eu, 0xD56041E4u, 0xA2677172u,
+    0x3C03E4D1u, 0x4B04D447u, 0xD20D85FDu, 0xA50AB56Bu, 0x35B5A8FAu, 0x42B2986Cu,
+    0xDBBBC9D6u, 0xACBCF940u, 0x32D86CE3u, 0x45DF5C75u, 0xDCD60DCFu, 0xABD13D59u,
+    0x26D930ACu, 0x51DE003Au, 0xC8D75180u, 0xBFD06116u, 0x21B4F4B5u, 0x56B3C423u,
+    0xCFBA9599u, 0xB8BDA50Fu, 0x2802B89Eu, 0x5F058808u, 0xC60CD9B2u, 0xB10BE924u,
+    0x2F6F7C87u, 0x58684C11u, 0xC1611DABu, 0xB6662D3Du, 0x76DC4190u, 0x01DB7106u,
+    0x98D220BCu, 0xEFD5102Au, 0x71B18589u, 0x06B6B51Fu, 0x9FBFE4A5u, 0xE8B8D433u,
+    0x7807C9A2u, 0x0F00F934u, 0x9609A88Eu, 0xE10E9818u, 0x7F6A0DBBu, 0x086D3D2Du,
+    0x91646C97u, 0xE6635C01u, 0x6B6B51F4u, 0x1C6C6162u, 0x856530D8u, 0xF262004Eu,
+    0x6C0695EDu, 0x1B01A57Bu, 0x8208F4C1u, 0xF50FC457u, 0x65B0D9C6u, 0x12B7E950u,
+    0x8BBEB8EAu, 0xFCB9887Cu, 0x62DD1DDFu, 0x15DA2D49u, 0x8CD37CF3u, 0xFBD44C65u,
+    0x4DB26158u, 0x3AB551CEu, 0xA3BC0074u, 0xD4BB30E2u, 0x4ADFA541u, 0x3DD895D7u,
+    0xA4D1C46Du, 0xD3D6F4FBu, 0x4369E96Au, 0x346ED9FCu, 0xAD678846u, 0xDA60B8D0u,
+    0x44042D73u, 0x33031DE5u, 0xAA0A4C5Fu, 0xDD0D7CC9u, 0x5005713Cu, 0x270241AAu,
+    0xBE0B1010u, 0xC90C2086u, 0x5768B525u, 0x206F85B3u, 0xB966D409u, 0xCE61E49Fu,
+    0x5EDEF90Eu, 0x29D9C998u, 0xB0D09822u, 0xC7D7A8B4u, 0x59B33D17u, 0x2EB40D81u,
+    0xB7BD5C3Bu, 0xC0BA6CADu, 0xEDB88320u, 0x9ABFB3B6u, 0x03B6E20Cu, 0x74B1D29Au,
+    0xEAD54739u, 0x9DD277AFu, 0x04DB2615u, 0x73DC1683u, 0xE3630B12u, 0x94643B84u,
+    0x0D6D6A3Eu, 0x7A6A5AA8u, 0xE40ECF0Bu, 0x9309FF9Du, 0x0A00AE27u, 0x7D079EB1u,
+    0xF00F9344u, 0x8708A3D2u, 0x1E01F268u, 0x6906C2FEu, 0xF762575Du, 0x806567CBu,
+    0x196C3671u, 0x6E6B06E7u, 0xFED41B76u, 0x89D32BE0u, 0x10DA7A5Au, 0x67DD4ACCu,
+    0xF9B9DF6Fu, 0x8EBEEFF9u, 0x17B7BE43u, 0x60B08ED5u, 0xD6D6A3E8u, 0xA1D1937Eu,
+    0x38D8C2C4u, 0x4FDFF252u, 0xD1BB67F1u, 0xA6BC5767u, 0x3FB506DDu, 0x48B2364Bu,
+    0xD80D2BDAu, 0xAF0A1B4Cu, 0x36034AF6u, 0x41047A60u, 0xDF60EFC3u, 0xA867DF55u,
+    0x316E8EEFu, 0x4669BE79u, 0xCB61B38Cu, 0xBC66831Au, 0x256FD2A0u, 0x5268E236u,
+    0xCC0C7795u, 0xBB0B4703u, 0x220216B9u, 0x5505262Fu, 0xC5BA3BBEu, 0xB2BD0B28u,
+    0x2BB45A92u, 0x5CB36A04u, 0xC2D7FFA7u, 0xB5D0CF31u, 0x2CD99E8Bu, 0x5BDEAE1Du,
+    0x9B64C2B0u, 0xEC63F226u, 0x756AA39Cu, 0x026D930Au, 0x9C0906A9u, 0xEB0E363Fu,
+    0x72076785u, 0x05005713u, 0x95BF4A82u, 0xE2B87A14u, 0x7BB12BAEu, 0x0CB61B38u,
+    0x92D28E9Bu, 0xE5D5BE0Du, 0x7CDCEFB7u, 0x0BDBDF21u, 0x86D3D2D4u, 0xF1D4E242u,
+    0x68DDB3F8u, 0x1FDA836Eu, 0x81BE16CDu, 0xF6B9265Bu, 0x6FB077E1u, 0x18B74777u,
+    0x88085AE6u, 0xFF0F6A70u, 0x66063BCAu, 0x11010B5Cu, 0x8F659EFFu, 0xF862AE69u,
+    0x616BFFD3u, 0x166CCF45u, 0xA00AE278u, 0xD70DD2EEu, 0x4E048354u, 0x3903B3C2u,
+    0xA7672661u, 0xD06016F7u, 0x4969474Du, 0x3E6E77DBu, 0xAED16A4Au, 0xD9D65ADCu,
+    0x40DF0B66u, 0x37D83BF0u, 0xA9BCAE53u, 0xDEBB9EC5u, 0x47B2CF7Fu, 0x30B5FFE9u,
+    0xBDBDF21Cu, 0xCABAC28Au, 0x53B39330u, 0x24B4A3A6u, 0xBAD03605u, 0xCDD70693u,
+    0x54DE5729u, 0x23D967BFu, 0xB3667A2Eu, 0xC4614AB8u, 0x5D681B02u, 0x2A6F2B94u,
+    0xB40BBE37u, 0xC30C8EA1u, 0x5A05DF1Bu, 0x2D02EF8Du
+};
+
+static uint32_t Crc32(const uint8_t* p, size_t nLen) {
+    uint32_t nCrc = 0xFFFFFFFFu;
+    while (nLen--) nCrc = g_Crc32Table[(nCrc ^ *p++) & 0xFF] ^ (nCrc >> 8);
+    return nCrc ^ 0xFFFFFFFFu;
+}
+
+/* ---- Encoding ---- */
+
+static size_t VarintSize(uint64_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static uint8_t* PutVarint(uint8_t* p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+/* Bounded varint read (NULL if it runs past pEnd or overflows) */
+static const uint8_t* GetVarint(const uint8_t* p, const uint8_t* pEnd, uint64_t* pv) {
+    uint64_t v = 0;
+    for (int nShift = 0; p < pEnd && nShift < 64; nShift += 7) {
+        uint8_t b = *p++;
+        v |= (uint64_t)(b & 0x7F) << nShift;
+        if (!(b & 0x80)) {
+            *pv = v;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static uint8_t* PutUint64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) *p++ = (uint8_t)(v >> (8 * i));
+    return p;
+}
+
+static uint64_t GetUint64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+static int FitsInBytes(const TextUnit* pText, size_t nLen) {
+    for (size_t i = 0; i < nLen; i++) {
+        if (pText[i] > 0xFF) return 0;
+    }
+    return 1;
+}
+
+static uint8_t* PutText(uint8_t* p, const TextUnit* pText, size_t nLen, int nEncoding) {
+    if (nEncoding == TEXT_WIDE) {
+        for (size_t i = 0; i < nLen; i++) {
+            *p++ = (uint8_t)pText[i];
+            *p++ = (uint8_t)(pText[i] >> 8);
+        }
+    } else {
+        for (size_t i = 0; i < nLen; i++) *p++ = (uint8_t)pText[i];
+    }
+    return p;
+}
+
+static void GetText(const uint8_t* p, size_t nLen, int nEncoding, TextUnit* pDest) {
+    if (nEncoding == TEXT_WIDE) {
+        for (size_t i = 0; i < nLen; i++) pDest[i] = (TextUnit)(p[2 * i] | (p[2 * i + 1] << 8));
+    } else {
+        for (size_t i = 0; i < nLen; i++) pDest[i] = p[i];
+    }
+}
+
+/* Bytes a record with an nBody byte body takes */
+static size_t RecordSize(size_t nBody) {
+    return VarintSize(nBody) + nBody + 4;
+}
+
+/* Frame the body written at pBody (nBody bytes, after room for the length) */
+static uint8_t* FinishRecord(uint8_t* pRecord, size_t nBody) {
+    uint8_t* pBody = pRecord + VarintSize(nBody);
+    uint32_t nCrc = Crc32(pBody, nBody);
+    uint8_t* p = pBody + nBody;
+
+    PutVarint(pRecord, nBody);
+    for (int i = 0; i < 4; i++) *p++ = (uint8_t)(nCrc >> (8 * i));
+    return p;
+}
+
+static size_t PathLength(const PathChar* szPath) {
+    size_t n = 0;
+    while (szPath[n]) n++;
+    return n;
+}
+
+static int CopyPath(PathChar* szDest, const PathChar* szSource) {
+    size_t n = szSource ? PathLength(szSource) : 0;
+    if (n >= EDIT_JOURNAL_MAX_PATH) return 0;
+    if (n) memcpy(szDest, szSource, n * sizeof(PathChar));
+    szDest[n] = 0;
+    return 1;
+}
+
+/* Gathers a snapshot of the document into one contiguous array */
+typedef struct {
+    TextUnit* pText;
+    size_t nLen;
+} SnapshotCopy;
+
+static int CopySpan(void* pContext, const TextUnit* pText, size_t nLen) {
+    SnapshotCopy* pCopy = (SnapshotCopy*)pContext;
+    memcpy(pCopy->pText + pCopy->nLen, pText, nLen * sizeof(TextUnit));
+    pCopy->nLen += nLen;
+    return 1;
+}
+
+/*
+ * Encode the file header and a base record into a new buffer. pDoc is used
+ * for a snapshot base, nFileSize/nFileHash for a file base.
+ */
+static uint8_t* EncodeBase(const EditJournal* pJournal, int nBaseKind, const PieceTable* pDoc,
+                           uint64_t nFileSize, uint64_t nFileHash, size_t* pnLen) {
+    size_t nPathBytes = PathLength(pJournal->szDocPath) * sizeof(PathChar);
+    size_t nUnits = 0, nBody, nTotal;
+    int nEncoding = TEXT_NARROW;
+    SnapshotCopy copy = { NULL, 0 };
+    uint8_t* pBuf;
+    uint8_t* p;
+
+    if (nBaseKind == EDIT_JOURNAL_BASE_SNAPSHOT) {
+        nUnits = PieceTableLength(pDoc);
+        copy.pText = (TextUnit*)malloc((nUnits ? nUnits : 1) * sizeof(TextUnit));
+        if (!copy.pText) return NULL;
+        PieceTableForEach(pDoc, 0, nUnits, CopySpan, &copy);
+        if (!FitsInBytes(copy.pText, nUnits)) nEncoding = TEXT_WIDE;
+    }
+
+    nBody = 2 + VarintSize((uint64_t)pJournal->nLineEnding) + VarintSize(nPathBytes) + nPathBytes;
+    if (nBaseKind == EDIT_JOURNAL_BASE_FILE) {
+        nBody += 16;
+    } else {
+        nBody += 1 + VarintSize(nUnits) + nUnits * (nEncoding == TEXT_WIDE ? 2 : 1);
+    }
+    nTotal = sizeof(g_Magic) + RecordSize(nBody);
+
+    pBuf = (uint8_t*)malloc(nTotal);
+    if (!pBuf) {
+        free(copy.pText);
+        return NULL;
+    }
+    memcpy(pBuf, g_Magic, sizeof(g_Magic));
+
+    p = pBuf + sizeof(g_Magic) + VarintSize(nBody);
+    *p++ = RECORD_BASE;
+    *p++ = (uint8_t)nBaseKind;
+    p = PutVarint(p, (uint64_t)pJournal->nLineEnding);
+    p = PutVarint(p, nPathBytes);
+    memcpy(p, pJournal->szDocPath, nPathBytes);
+    p += nPathBytes;
+    if (nBaseKind == EDIT_JOURNAL_BASE_FILE) {
+        p = PutUint64(p, nFileSize);
+        p = PutUint64(p, nFileHash);
+    } else {
+        *p++ = (uint8_t)nEncoding;
+        p = PutVarint(p, nUnits);
+        p = PutText(p, copy.pText, nUnits, nEncoding);
+    }
+    FinishRecord(pBuf + sizeof(g_Magic), nBody);
+
+    free(copy.pText);
+    *pnLen = nTotal;
+    return pBuf;
+}
+
+/* ---- Writer thread ---- */
+
+/* Whether a journal has something for the writer (lock held) */
+static int HasWork(const EditJournal* pJournal) {
+    return pJournal->nPending > 0 || pJournal->nState != JOURNAL_ACTIVE;
+}
+
+static int AnyWork(const JournalWriter* pWriter) {
+    for (const EditJournal* p = pWriter->pFirst; p; p = p->pNext) {
+        if (HasWork(p)) return 1;
+    }
+    return 0;
+}
+
+/* Write a new journal file next to the old one, flush it and swap it in */
+static int RewriteFile(EditJournal* pJournal, const uint8_t* pData, size_t nLen) {
+    PathChar szTemp[EDIT_JOURNAL_MAX_PATH + 16];
+    OutputFile temp;
+    int bOk;
+
+    if (pJournal->file.hFile) OutputFileClose(&pJournal->file);
+
+    if (!OutputFileCreateTemp(&temp, pJournal->szJournal, szTemp, sizeof(szTemp) / sizeof(szTemp[0]))) {
+        return 0;
+    }
+    bOk = OutputFileWrite(&temp, pData, nLen) && OutputFileFlush(&temp);
+    bOk = OutputFileClose(&temp) && bOk;
+    if (!bOk || !ReplaceFileAtomic(szTemp, pJournal->szJournal)) {
+        DeleteFilePath(szTemp);
+        return 0;
+    }
+    return OutputFileOpenExisting(&pJournal->file, pJournal->szJournal);
+}
+
+static void FreeJournal(EditJournal* pJournal) {
+    free(pJournal->pPending);
+    free(pJournal->pSpare);
+    free(pJournal);
+}
+
+/* Write out one journal's pending records (lock held; released during the I/O) */
+static void ServeJournal(JournalWriter* pWriter, EditJournal* pJournal) {
+    uint8_t* pData = pJournal->pPending;
+    size_t nLen = pJournal->nPending;
+    size_t nCapacity = pJournal->nPendingCapacity;
+    int bRewrite = pJournal->bRewrite;
+    uint64_t nQueued = pJournal->nQueued;
+    int bOk;
+
+    if (pJournal->bFailed) {
+        /* Nothing more reaches this file */
+        pJournal->nPending = 0;
+        return;
+    }
+    if (nLen == 0) return;
+
+    /* Take the pending buffer; the caller continues in the spare one */
+    pJournal->pPending = pJournal->pSpare;
+    pJournal->nPendingCapacity = pJournal->nSpareCapacity;
+    pJournal->nPending = 0;
+    pJournal->pSpare = NULL;
+    pJournal->nSpareCapacity = 0;
+    pJournal->bRewrite = 0;
+    WorkerSignalUnlock(&pWriter->signal);
+
+    if (bRewrite) {
+        bOk = RewriteFile(pJournal, pData, nLen);
+    } else {
+        bOk = pJournal->file.hFile && OutputFileWrite(&pJournal->file, pData, nLen) &&
+              OutputFileFlush(&pJournal->file);
+    }
+
+    WorkerSignalLock(&pWriter->signal);
+    if (bOk) {
+        pJournal->nDurable = nQueued;
+    } else {
+        pJournal->bFailed = 1;
+    }
+
+    /* Keep the bigger buffer as the spare */
+    if (!pJournal->pSpare) {
+        pJournal->pSpare = pData;
+        pJournal->nSpareCapacity = nCapacity;
+    } else {
+        free(pData);
+    }
+}
+
+/* Close (and for a discarded journal delete) the file and free the journal; lock not held */
+static void RetireJournal(EditJournal* pJournal) {
+    if (pJournal->file.hFile) OutputFileClose(&pJournal->file);
+    if (pJournal->nState == JOURNAL_DISCARDING) DeleteFilePath(pJournal->szJournal);
+    FreeJournal(pJournal);
+}
+
+/* One pass over all journals (lock held) */
+static void ServeAll(JournalWriter* pWriter) {
+    EditJournal** ppLink = &pWriter->pFirst;
+
+    while (*ppLink) {
+        EditJournal* pJournal = *ppLink;
+
+        int bRetire;
+
+        if (pJournal->nState != JOURNAL_DISCARDING) ServeJournal(pWriter, pJournal);
+
+        /* A journal let go of leaves once written out; when stopping, every journal does */
+        bRetire = pJournal->nState == JOURNAL_DISCARDING ||
+                  ((pJournal->nState == JOURNAL_CLOSING || pWriter->bStop) && pJournal->nPending == 0);
+        if (bRetire) {
+            *ppLink = pJournal->pNext;
+            WorkerSignalUnlock(&pWriter->signal);
+            RetireJournal(pJournal);
+            WorkerSignalLock(&pWriter->signal);
+            continue;
+        }
+        ppLink = &pJournal->pNext;
+    }
+    pWriter->nBatches++;
+}
+
+static void WriterMain(void* pContext) {
+    JournalWriter* pWriter = (JournalWriter*)pContext;
+
+    WorkerSignalLock(&pWriter->signal);
+    for (;;) {
+        while (!pWriter->bStop && !AnyWork(pWriter)) {
+            WorkerSignalWait(&pWriter->signal, WORKER_WAIT_INFINITE);
+        }
+
+        /* Let a burst of edits gather into one write and one flush */
+        if (!pWriter->bStop && !pWriter->bUrgent) {
+            WorkerSignalWait(&pWriter->signal, pWriter->nBatchMs);
+        }
+        pWriter->bUrgent = 0;
+
+        ServeAll(pWriter);
+        if (pWriter->bStop && !pWriter->pFirst) break;
+    }
+    WorkerSignalUnlock(&pWriter->signal);
+}
+
+/* Queue bytes for the writer (lock held); bUrgent skips the batching wait */
+static void WakeWriter(JournalWriter* pWriter, int bUrgent) {
+    if (bUrgent) pWriter->bUrgent = 1;
+    WorkerSignalNotify(&pWriter->signal);
+}
+
+/* Room for nLen more pending bytes (lock held; NULL marks the journal failed) */
+static uint8_t* ReservePending(EditJournal* pJournal, size_t nLen) {
+    if (pJournal->nPendingCapacity - pJournal->nPending < nLen) {
+        size_t nCapacity = pJournal->nPendingCapacity ? pJournal->nPendingCapacity : 4096;
+        uint8_t* pNew;
+        while (nCapacity - pJournal->nPending < nLen) nCapacity *= 2;
+        pNew = (uint8_t*)realloc(pJournal->pPending, nCapacity);
+        if (!pNew) {
+            pJournal->bFailed = 1;
+            return NULL;
+        }
+        pJournal->pPending = pNew;
+        pJournal->nPendingCapacity = nCapacity;
+    }
+    return pJournal->pPending + pJournal->nPending;
+}
+
+/* ---- Public interface ---- */
+
+int JournalWriterStart(JournalWriter* pWriter, unsigned nBatchMs) {
+    memset(pWriter, 0, sizeof(*pWriter));
+    pWriter->nBatchMs = nBatchMs;
+    if (!WorkerSignalInit(&pWriter->signal)) return 0;
+    if (!WorkerThreadStart(&pWriter->thread, WriterMain, pWriter)) {
+        WorkerSignalFree(&pWriter->signal);
+        return 0;
+    }
+    return 1;
+}
+
+void JournalWriterStop(JournalWriter* pWriter) {
+    if (!pWriter->thread.hThread) return;
+    WorkerSignalLock(&pWriter->signal);
+    pWriter->bStop = 1;
+    WakeWriter(pWriter, 1);
+    WorkerSignalUnlock(&pWriter->signal);
+
+    WorkerThreadJoin(&pWriter->thread);
+    WorkerSignalFree(&pWriter->signal);
+}
+
+/* Hand a journal to the writer with its first bytes pending */
+static void AttachJournal(JournalWriter* pWriter, EditJournal* pJournal) {
+    WorkerSignalLock(&pWriter->signal);
+    pJournal->pWriter = pWriter;
+    pJournal->pNext = pWriter->pFirst;
+    pWriter->pFirst = pJournal;
+    WakeWriter(pWriter, 0);
+    WorkerSignalUnlock(&pWriter->signal);
+}
+
+EditJournal* EditJournalCreate(JournalWriter* pWriter, const PathChar* szJournal, int nBaseKind,
+                               const PathChar* szDocPath, int nLineEnding, const PieceTable* pDoc) {
+    EditJournal* pJournal = (EditJournal*)calloc(1, sizeof(EditJournal));
+    uint64_t nFileSize = 0, nFileHash = 0;
+
+    if (!pJournal) return NULL;
+    pJournal->nLineEnding = nLineEnding;
+    if (!CopyPath(pJournal->szJournal, szJournal) || !CopyPath(pJournal->szDocPath, szDocPath) ||
+        (nBaseKind == EDIT_JOURNAL_BASE_FILE &&
+         (!szDocPath || !szDocPath[0] || !EditJournalFingerprint(szDocPath, &nFileSize, &nFileHash)))) {
+        free(pJournal);
+        return NULL;
+    }
+
+    pJournal->pPending = EncodeBase(pJournal, nBaseKind, pDoc, nFileSize, nFileHash, &pJournal->nPending);
+    if (!pJournal->pPending) {
+        free(pJournal);
+        return NULL;
+    }
+    pJournal->nPendingCapacity = pJournal->nPending;
+    pJournal->bRewrite = 1;
+
+    AttachJournal(pWriter, pJournal);
+    return pJournal;
+}
+
+int EditJournalAppend(EditJournal* pJournal, size_t nOffset, size_t nRemoved,
+                      const TextUnit* pInsert, size_t nInsert) {
+    JournalWriter* pWriter = pJournal->pWriter;
+    int nEncoding = FitsInBytes(pInsert, nInsert) ? TEXT_NARROW : TEXT_WIDE;
+    size_t nBody = 2 + VarintSize(nOffset) + VarintSize(nRemoved) + VarintSize(nInsert) +
+                   nInsert * (nEncoding == TEXT_WIDE ? 2 : 1);
+    size_t nSize = RecordSize(nBody);
+    uint8_t* pRecord;
+    uint8_t* p;
+    int bOk = 0;
+
+    if (!pWriter) return 0;
+    WorkerSignalLock(&pWriter->signal);
+    if (!pJournal->bFailed && (pRecord = ReservePending(pJournal, nSize)) != NULL) {
+        int bWasIdle = pJournal->nPending == 0;
+
+        p = pRecord + VarintSize(nBody);
+        *p++ = RECORD_EDIT;
+        *p++ = (uint8_t)nEncoding;
+        p = PutVarint(p, nOffset);
+        p = PutVarint(p, nRemoved);
+        p = PutVarint(p, nInsert);
+        PutText(p, pInsert, nInsert, nEncoding);
+        FinishRecord(pRecord, nBody);
+
+        pJournal->nPending += nSize;
+        pJournal->nQueued++;
+        pJournal->nLogBytes += nSize;
+        if (bWasIdle || pJournal->nPending >= EDIT_JOURNAL_BATCH_BYTES) {
+            WakeWriter(pWriter, pJournal->nPending >= EDIT_JOURNAL_BATCH_BYTES);
+        }
+        bOk = 1;
+    }
+    WorkerSignalUnlock(&pWriter->signal);
+    return bOk;
+}
+
+int EditJournalCheckpointDue(const EditJournal* pJournal, size_t nDocUnits) {
+    /* Worth it once replaying the log costs more than reading a snapshot twice */
+    return pJournal->nLogBytes >= EDIT_JOURNAL_CHECKPOINT_MIN &&
+           pJournal->nLogBytes / 4 >= (uint64_t)nDocUnits;
+}
+
+int EditJournalCheckpoint(EditJournal* pJournal, const PieceTable* pDoc) {
+    JournalWriter* pWriter = pJournal->pWriter;
+    size_t nLen;
+    uint8_t* pBase;
+    int bOk = 0;
+
+    if (!pWriter) return 0;
+
+    /* Encode outside the lock: the writer keeps going meanwhile */
+    pBase = EncodeBase(pJournal, EDIT_JOURNAL_BASE_SNAPSHOT, pDoc, 0, 0, &nLen);
+    if (!pBase) return 0;
+
+    WorkerSignalLock(&pWriter->signal);
+    if (!pJournal->bFailed) {
+        /* The snapshot already holds every edit still pending */
+        free(pJournal->pPending);
+        pJournal->pPending = pBase;
+        pJournal->nPending = nLen;
+        pJournal->nPendingCapacity = nLen;
+        pJournal->bRewrite = 1;
+        pJournal->nLogBytes = 0;
+        WakeWriter(pWriter, 0);
+        pBase = NULL;
+        bOk = 1;
+    }
+    WorkerSignalUnlock(&pWriter->signal);
+    free(pBase);
+    return bOk;
+}
+
+int EditJournalFailed(const EditJournal* pJournal) {
+    JournalWriter* pWriter = pJournal->pWriter;
+    int bFailed;
+
+    if (!pWriter) return pJournal->bFailed;
+    WorkerSignalLock(&pWriter->signal);
+    bFailed = pJournal->bFailed;
+    WorkerSignalUnlock(&pWriter->signal);
+    return bFailed;
+}
+
+uint64_t EditJournalQueuedEdits(const EditJournal* pJournal) {
+    JournalWriter* pWriter = pJournal->pWriter;
+    uint64_t nQueued;
+
+    if (!pWriter) return pJournal->nQueued;
+    WorkerSignalLock(&pWriter->signal);
+    nQueued = pJournal->nQueued;
+    WorkerSignalUnlock(&pWriter->signal);
+    return nQueued;
+}
+
+uint64_t EditJournalDurableEdits(const EditJournal* pJournal) {
+    JournalWriter* pWriter = pJournal->pWriter;
+    uint64_t nDurable;
+
+    if (!pWriter) return pJournal->nDurable;
+    WorkerSignalLock(&pWriter->signal);
+    nDurable = pJournal->nDurable;
+    WorkerSignalUnlock(&pWriter->signal);
+    return nDurable;
+}
+
+const PathChar* EditJournalPath(const EditJournal* pJournal) {
+    return pJournal->szJournal;
+}
+
+/* Hand a journal back to the writer to finish, or retire it here if the writer never had it */
+static void LetGo(EditJournal* pJournal, int nState) {
+    JournalWriter* pWriter = pJournal->pWriter;
+
+    if (!pWriter) {
+        pJournal->nState = nState;
+        RetireJournal(pJournal);
+        return;
+    }
+    WorkerSignalLock(&pWriter->signal);
+    pJournal->nState = nState;
+    if (nState == JOURNAL_DISCARDING) pJournal->nPending = 0;
+    WakeWriter(pWriter, 1);
+    WorkerSignalUnlock(&pWriter->signal);
+}
+
+void EditJournalClose(EditJournal* pJournal) {
+    LetGo(pJournal, JOURNAL_CLOSING);
+}
+
+void EditJournalDiscard(EditJournal* pJournal) {
+    LetGo(pJournal, JOURNAL_DISCARDING);
+}
+
+/* ---- Recovery ---- */
+
+EditJournal* EditJournalClaim(JournalWriter* pWriter, const PathChar* szJournal) {
+    EditJournal* pJournal = (EditJournal*)calloc(1, sizeof(EditJournal));
+
+    if (!pJournal) return NULL;
+    pJournal->pHome = pWriter;
+    if (!CopyPath(pJournal->szJournal, szJournal) ||
+        !OutputFileOpenExisting(&pJournal->file, szJournal)) {
+        free(pJournal);
+        return NULL;
+    }
+    return pJournal;
+}
+
+/* Journal being parsed */
+typedef struct {
+    const uint8_t* p;            /* Next record */
+    const uint8_t* pEnd;
+    const uint8_t* pBody;        /* Body of the last record read */
+    size_t nBody;
+} RecordReader;
+
+/* Next intact record, or 0 at the end or at a torn or corrupt one */
+static int NextRecord(RecordReader* pReader) {
+    const uint8_t* p;
+    uint64_t nBody;
+    uint32_t nCrc = 0;
+
+    p = GetVarint(pReader->p, pReader->pEnd, &nBody);
+    if (!p || nBody == 0 || nBody > (uint64_t)(pReader->pEnd - p) ||
+        (uint64_t)(pReader->pEnd - p) - nBody < 4) {
+        return 0;
+    }
+    for (int i = 0; i < 4; i++) nCrc |= (uint32_t)p[nBody + i] << (8 * i);
+    if (Crc32(p, (size_t)nBody) != nCrc) return 0;
+
+    pReader->pBody = p;
+    pReader->nBody = (size_t)nBody;
+    pReader->p = p + nBody + 4;
+    return 1;
+}
+
+/* Units of an encoded text run that fits in nAvail bytes (0 if it does not) */
+static int TextFits(uint64_t nUnits, int nEncoding, size_t nAvail) {
+    if (nEncoding != TEXT_NARROW && nEncoding != TEXT_WIDE) return 0;
+    return nUnits <= (uint64_t)nAvail / (nEncoding == TEXT_WIDE ? 2 : 1);
+}
+
+/* Parse the base record; pSnapshot/pnUnits/pnEncoding locate snapshot text */
+static int ParseBase(const uint8_t* pBody, size_t nBody, EditJournalInfo* pInfo,
+                     const uint8_t** ppText, uint64_t* pnUnits, int* pnEncoding) {
+    const uint8_t* p = pBody;
+    const uint8_t* pEnd = pBody + nBody;
+    uint64_t nLineEnding, nPathBytes;
+
+    if (nBody < 2 || p[0] != RECORD_BASE) return 0;
+    pInfo->nBaseKind = p[1];
+    p += 2;
+    if (!(p = GetVarint(p, pEnd, &nLineEnding)) || !(p = GetVarint(p, pEnd, &nPathBytes))) return 0;
+    if (nPathBytes > (uint64_t)(pEnd - p) || nPathBytes % sizeof(PathChar) != 0 ||
+        nPathBytes / sizeof(PathChar) >= EDIT_JOURNAL_MAX_PATH) {
+        return 0;
+    }
+    pInfo->nLineEnding = (int)nLineEnding;
+    memcpy(pInfo->szPath, p, (size_t)nPathBytes);
+    pInfo->szPath[nPathBytes / sizeof(PathChar)] = 0;
+    p += nPathBytes;
+
+    if (pInfo->nBaseKind == EDIT_JOURNAL_BASE_FILE) {
+        if (pEnd - p != 16) return 0;
+        pInfo->nFileSize = GetUint64(p);
+        pInfo->nFileHash = GetUint64(p + 8);
+        return 1;
+    }
+    if (pInfo->nBaseKind != EDIT_JOURNAL_BASE_SNAPSHOT || p >= pEnd) return 0;
+    *pnEncoding = *p++;
+    if (!(p = GetVarint(p, pEnd, pnUnits)) || !TextFits(*pnUnits, *pnEncoding, (size_t)(pEnd - p)) ||
+        (uint64_t)(pEnd - p) != *pnUnits * (*pnEncoding == TEXT_WIDE ? 2 : 1)) {
+        return 0;
+    }
+    *ppText = p;
+    return 1;
+}
+
+/* Map a journal and read its base record */
+static int OpenJournal(const PathChar* szJournal, MappedFile* pMap, RecordReader* pReader,
+                       EditJournalInfo* pInfo, const uint8_t** ppText, uint64_t* pnUnits, int* pnEncoding) {
+    memset(pInfo, 0, sizeof(*pInfo));
+    if (!MapFileReadOnly(pMap, szJournal)) return 0;
+    if (pMap->nSize < sizeof(g_Magic) || memcmp(pMap->pData, g_Magic, sizeof(g_Magic)) != 0) {
+        UnmapFile(pMap);
+        return 0;
+    }
+
+    pReader->p = pMap->pData + sizeof(g_Magic);
+    pReader->pEnd = pMap->pData + pMap->nSize;
+    if (!NextRecord(pReader) ||
+        !ParseBase(pReader->pBody, pReader->nBody, pInfo, ppText, pnUnits, pnEncoding)) {
+        UnmapFile(pMap);
+        return 0;
+    }
+    pInfo->nValidBytes = (uint64_t)(pReader->p - pMap->pData);
+    return 1;
+}
+
+int EditJournalReadBase(const PathChar* szJournal, EditJournalInfo* pInfo) {
+    MappedFile map;
+    RecordReader reader;
+    const uint8_t* pText = NULL;
+    uint64_t nUnits = 0;
+    int nEncoding = 0;
+
+    if (!OpenJournal(szJournal, &map, &reader, pInfo, &pText, &nUnits, &nEncoding)) return 0;
+    UnmapFile(&map);
+    return 1;
+}
+
+static void ReleaseMallocText(void* pContext, const TextUnit* pText, size_t nLen) {
+    (void)pContext;
+    (void)nLen;
+    free((void*)pText);
+}
+
+/* Apply one edit record to pDoc (0 if it is malformed or does not fit the document) */
+static int ApplyEditRecord(PieceTable* pDoc, const uint8_t* pBody, size_t nBody,
+                           TextUnit** ppScratch, size_t* pnScratch) {
+    const uint8_t* p = pBody;
+    const uint8_t* pEnd = pBody + nBody;
+    uint64_t nOffset, nRemoved, nInsert;
+    size_t nDocLen = PieceTableLength(pDoc);
+    int nEncoding;
+
+    if (nBody < 2 || p[0] != RECORD_EDIT) return 0;
+    nEncoding = p[1];
+    p += 2;
+    if (!(p = GetVarint(p, pEnd, &nOffset)) || !(p = GetVarint(p, pEnd, &nRemoved)) ||
+        !(p = GetVarint(p, pEnd, &nInsert))) {
+        return 0;
+    }
+    if (!TextFits(nInsert, nEncoding, (size_t)(pEnd - p)) ||
+        (uint64_t)(pEnd - p) != nInsert * (nEncoding == TEXT_WIDE ? 2 : 1) ||
+        nOffset > nDocLen || nRemoved > nDocLen - nOffset) {
+        return 0;
+    }
+
+    if (nInsert > *pnScratch) {
+        TextUnit* pNew = (TextUnit*)realloc(*ppScratch, (size_t)nInsert * sizeof(TextUnit));
+        if (!pNew) return 0;
+        *ppScratch = pNew;
+        *pnScratch = (size_t)nInsert;
+    }
+    GetText(p, (size_t)nInsert, nEncoding, *ppScratch);
+
+    return PieceTableDelete(pDoc, (size_t)nOffset, (size_t)nRemoved) &&
+           PieceTableInsert(pDoc, (size_t)nOffset, *ppScratch, (size_t)nInsert);
+}
+
+int EditJournalReplay(const PathChar* szJournal, PieceTable* pDoc, EditJournalInfo* pInfo) {
+    MappedFile map;
+    RecordReader reader;
+    const uint8_t* pText = NULL;
+    uint64_t nUnits = 0;
+    int nEncoding = 0;
+    TextUnit* pScratch = NULL;
+    size_t nScratch = 0;
+
+    if (!OpenJournal(szJournal, &map, &reader, pInfo, &pText, &nUnits, &nEncoding)) return 0;
+
+    if (pInfo->nBaseKind == EDIT_JOURNAL_BASE_SNAPSHOT) {
+        TextUnit* pSnapshot = (TextUnit*)malloc(nUnits ? (size_t)nUnits * sizeof(TextUnit) : 1);
+        if (!pSnapshot) {
+            UnmapFile(&map);
+            return 0;
+        }
+        GetText(pText, (size_t)nUnits, nEncoding, pSnapshot);
+        if (!PieceTableLoad(pDoc, pSnapshot, (size_t)nUnits, ReleaseMallocText, NULL)) {
+            UnmapFile(&map);
+            return 0;
+        }
+    }
+
+    /* Every intact edit in order; the first bad one ends the journal */
+    while (NextRecord(&reader) &&
+           ApplyEditRecord(pDoc, reader.pBody, reader.nBody, &pScratch, &nScratch)) {
+        pInfo->nEdits++;
+        pInfo->nLogBytes += (uint64_t)(reader.p - map.pData) - pInfo->nValidBytes;
+        pInfo->nValidBytes = (uint64_t)(reader.p - map.pData);
+    }
+
+    free(pScratch);
+    UnmapFile(&map);
+    return 1;
+}
+
+int EditJournalResume(EditJournal* pJournal, const EditJournalInfo* pInfo) {
+    if (!OutputFileTruncate(&pJournal->file, pInfo->nValidBytes) || !OutputFileFlush(&pJournal->file) ||
+        !CopyPath(pJournal->szDocPath, pInfo->szPath)) {
+        return 0;
+    }
+    pJournal->nLineEnding = pInfo->nLineEnding;
+    pJournal->nLogBytes = pInfo->nLogBytes;
+    pJournal->nQueued = pInfo->nEdits;
+    pJournal->nDurable = pInfo->nEdits;
+    AttachJournal(pJournal->pHome, pJournal);
+    return 1;
+}
+
+int EditJournalFingerprint(const PathChar* szPath, uint64_t* pnSize, uint64_t* pnHash) {
+    /* FNV-1a over the first and last 64 KB: cheap, and catches any ordinary rewrite */
+    const size_t nEdge = 64 * 1024;
+    uint64_t nHash = 0xCBF29CE484222325ull;
+    MappedFile map;
+    size_t nSize, nTail;
+
+    if (!MapFileReadOnly(&map, szPath)) return 0;
+    nSize = (size_t)map.nSize;
+    for (size_t i = 0; i < nSize && i < nEdge; i++) {
+        nHash = (nHash ^ map.pData[i]) * 0x100000001B3ull;
+    }
+    nTail = nSize > nEdge ? nSize - nEdge : 0;
+    if (nTail < nEdge) nTail = nEdge;
+    for (size_t i = nTail; i < nSize; i++) {
+        nHash = (nHash ^ map.pData[i]) * 0x100000001B3ull;
+    }
+    UnmapFile(&map);
+
+    *pnSize = (uint64_t)nSize;
+    *pnHash = nHash;
+    return 1;
+}
@@ -0,0 +1,127 @@
+#ifndef EDIT_JOURNAL_H
+#define EDIT_JOURNAL_H
+
+/*
+ * Append-only edit journal for crash recovery and hot exit.
+ *
+ * Portable C. Each modified document has a journal file that starts with a
+ * base record and grows by one record per edit:
+ *
+ *   "XNJ1" | record | record | ...
+ *   record = body length (varint) | body | CRC-32 of body (4 bytes)
+ *
+ * The base is either a reference to the document's file on disk (size and
+ * a hash of its ends, checked before replaying) or a snapshot of the text.
+ * Edits are offset, removed count and inserted text, so replay only needs
+ * the base and never the removed text. A torn or corrupt tail fails its
+ * length or CRC check and replay stops there, leaving the document as it
+ * was after the last complete edit.
+ *
+ * Appending only encodes into memory. One writer thread serves every
+ * journal: it waits a short batching interval after the first pending
+ * record, writes everything pending and flushes it to disk. A checkpoint
+ * replaces the file with a new one holding a snapshot of the text (temp
+ * file, flush, atomic rename), which bounds both the file size and the
+ * replay time.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "piece_table.h"
+#include "platform.h"
+
+/* Longest document path kept in a journal (in PathChar units) */
+#define EDIT_JOURNAL_MAX_PATH 1024
+
+/* Time the writer lets records gather before writing them */
+#define EDIT_JOURNAL_BATCH_MS 200
+
+/* Pending bytes that make the writer start at once */
+#define EDIT_JOURNAL_BATCH_BYTES (256 * 1024)
+
+/* Edit bytes logged since the base before a checkpoint is worth writing */
+#define EDIT_JOURNAL_CHECKPOINT_MIN (1024 * 1024)
+
+/* Base kinds */
+#define EDIT_JOURNAL_BASE_FILE     1 /* The document's file as it is on disk */
+#define EDIT_JOURNAL_BASE_SNAPSHOT 2 /* Text stored in the journal */
+
+typedef struct EditJournal EditJournal;
+
+/* Background writer shared by all journals */
+typedef struct {
+    WorkerThread thread;
+    WorkerSignal signal;         /* Guards everything below and the journals' queues */
+    EditJournal* pFirst;         /* Journals the writer knows about */
+    int bStop;                   /* Flush everything and exit */
+    int bUrgent;                 /* Skip the batching wait */
+    unsigned nBatchMs;           /* Batching interval */
+    uint64_t nBatches;           /* Batches written so far */
+} JournalWriter;
+
+/* What a journal describes */
+typedef struct {
+    int nBaseKind;               /* EDIT_JOURNAL_BASE_ */
+    int nLineEnding;             /* Caller's line ending code */
+    PathChar szPath[EDIT_JOURNAL_MAX_PATH]; /* Document file (empty if untitled) */
+    uint64_t nFileSize;          /* File base: size of the file */
+    uint64_t nFileHash;          /* File base: hash of its first and last bytes */
+    uint64_t nValidBytes;        /* Length of the intact part of the journal */
+    uint64_t nLogBytes;          /* Edit bytes after the base */
+    size_t nEdits;               /* Edits replayed */
+} EditJournalInfo;
+
+/* Writer lifetime. Stopping writes out all pending records and frees every journal. */
+int JournalWriterStart(JournalWriter* pWriter, unsigned nBatchMs);
+void JournalWriterStop(JournalWriter* pWriter);
+
+/*
+ * Start a journal at szJournal for a document about to be edited. With a
+ * file base, szDocPath must hold the document exactly as loaded; otherwise
+ * pDoc is stored as a snapshot. szDocPath may be empty for an untitled
+ * document. The file is written by the writer thread. Returns NULL on
+ * failure.
+ */
+EditJournal* EditJournalCreate(JournalWriter* pWriter, const PathChar* szJournal, int nBaseKind,
+                               const PathChar* szDocPath, int nLineEnding, const PieceTable* pDoc);
+
+/* Queue one edit: [nOffset, nOffset + nRemoved) replaced by pInsert (returns nonzero on success) */
+int EditJournalAppend(EditJournal* pJournal, size_t nOffset, size_t nRemoved,
+                      const TextUnit* pInsert, size_t nInsert);
+
+/* Whether enough has been logged that a checkpoint of a document of nDocUnits pays off */
+int EditJournalCheckpointDue(const EditJournal* pJournal, size_t nDocUnits);
+
+/* Replace the journal with a snapshot of pDoc (returns nonzero on success) */
+int EditJournalCheckpoint(EditJournal* pJournal, const PieceTable* pDoc);
+
+/* The writer could not keep the file up to date (the journal is no longer trustworthy) */
+int EditJournalFailed(const EditJournal* pJournal);
+
+/* Edits queued so far, and how many of them have reached the disk */
+uint64_t EditJournalQueuedEdits(const EditJournal* pJournal);
+uint64_t EditJournalDurableEdits(const EditJournal* pJournal);
+
+/* Path of the journal file */
+const PathChar* EditJournalPath(const EditJournal* pJournal);
+
+/* Stop journaling. Close keeps the file for the next launch; Discard deletes it. */
+void EditJournalClose(EditJournal* pJournal);
+void EditJournalDiscard(EditJournal* pJournal);
+
+/*
+ * Recovery. Claim opens an existing journal file so no other process
+ * takes it (NULL if it cannot). ReadBase describes it; Replay rebuilds the
+ * document: a snapshot base is loaded into pDoc, a file base expects pDoc
+ * to hold the file already. Resume cuts off any torn tail and continues
+ * journaling from where the replay ended.
+ */
+EditJournal* EditJournalClaim(JournalWriter* pWriter, const PathChar* szJournal);
+int EditJournalReadBase(const PathChar* szJournal, EditJournalInfo* pInfo);
+int EditJournalReplay(const PathChar* szJournal, PieceTable* pDoc, EditJournalInfo* pInfo);
+int EditJournalResume(EditJournal* pJournal, const EditJournalInfo* pInfo);
+
+/* Size and hash of a file, to check a file base against (returns nonzero on success) */
+int EditJournalFingerprint(const PathChar* szPath, uint64_t* pnSize, uint64_t* pnHash);
+
+#endif /* EDIT_JOURNAL_H */
@@ -1,8 +1,19 @@
 #include "notepad.h"
 
-/* Undo last edit operation */
-void EditUndo(HWND hEdit) {
-    SendMessage(hEdit, EM_UNDO, 0, 0);
+/* Undo the last edit step */
+void EditUndo(TabState* pTab) {
+    if (UndoDocumentEdit(pTab)) {
+        pTab->bModified = TRUE;
+        RequestFrame(GetParent(pTab->hwndEdit), FRAME_DIRTY_GUTTER | FRAME_DIRTY_STATUS | FRAME_DIRTY_TITLE);
+    }
+}
+
+/* Redo the last undone edit step */
+void EditRedo(TabState* pTab) {
+    if (RedoDocumentEdit(pTab)) {
+        pTab->bModified = TRUE;
+        RequestFrame(GetParent(pTab->hwndEdit), FRAME_DIRTY_GUTTER | FRAME_DIRTY_STATUS | FRAME_DIRTY_TITLE);
+    }
 }
 
 /* Cut selected text to clipboard */
@@ -24,3 +35,186 @@ void EditPaste(HWND hEdit) {
 void EditSelectAll(HWND hEdit) {
     SendMessage(hEdit, EM_SETSEL, 0, -1);
 }
+
+/* Compile the Find dialog's text for a search (FIND_REGEX in nFlags: a regular expression) */
+static BOOL CompileSearch(HWND hwnd, FindPattern* pFind, const TCHAR* szWhat, unsigned nFlags) {
+    const char* szError = "";
+    TCHAR szMessage[128];
+    
+    pFind->bRegex = (nFlags & FIND_REGEX) != 0;
+    nFlags &= ~FIND_REGEX;
+    if (!pFind->bRegex) {
+        return TextSearchInit(&pFind->text, (const TextUnit*)szWhat, _tcslen(szWhat), nFlags) ? TRUE : FALSE;
+    }
+    if (RegexSearchInit(&pFind->regex, (const TextUnit*)szWhat, _tcslen(szWhat), nFlags, &szError)) {
+        return TRUE;
+    }
+    _sntprintf(szMessage, 128, TEXT("Invalid regular expression: %hs."), szError);
+    szMessage[127] = 0;
+    ShowErrorDialog(hwnd, szMessage);
+    return FALSE;
+}
+
+static void FreeSearch(FindPattern* pFind) {
+    if (pFind->bRegex) {
+        RegexSearchFree(&pFind->regex);
+    } else {
+        TextSearchFree(&pFind->text);
+    }
+}
+
+/* First (or last) match starting in [nFrom, nTo) of the document, and its length */
+static BOOL FindMatch(TabState* pTab, FindPattern* pFind, size_t nFrom, size_t nTo, BOOL bLast,
+                      size_t* pnAt, size_t* pnLen) {
+    if (pFind->bRegex) {
+        return (bLast ? RegexSearchDocumentLast(&pFind->regex, &pTab->doc, nFrom, nTo, pnAt, pnLen)
+                      : RegexSearchDocument(&pFind->regex, &pTab->doc, nFrom, nTo, pnAt, pnLen)) ? TRUE : FALSE;
+    }
+    *pnLen = pFind->text.nUnits;
+    return (bLast ? TextSearchDocumentLast(&pFind->text, &pTab->doc, nFrom, nTo, pnAt)
+                  : TextSearchDocument(&pFind->text, &pTab->doc, nFrom, nTo, pnAt)) ? TRUE : FALSE;
+}
+
+/* Current selection as document offsets */
+static void GetDocSelection(const TabState* pTab, size_t* pnStart, size_t* pnEnd) {
+    DWORD dwStart = 0, dwEnd = 0;
+    SendMessage(pTab->hwndEdit, EM_GETSEL, (WPARAM)&dwStart, (LPARAM)&dwEnd);
+    *pnStart = DocOffsetFromEditPos(pTab, (LONG)dwStart);
+    *pnEnd = DocOffsetFromEditPos(pTab, (LONG)dwEnd);
+}
+
+/* Search the document from the selection, wrapping around, and select the match */
+static BOOL FindInDocument(TabState* pTab, FindPattern* pFind, BOOL bBackward) {
+    size_t nSelStart, nSelEnd, nFrom, nAt, nLen;
+    BOOL bFound;
+    
+    GetDocSelection(pTab, &nSelStart, &nSelEnd);
+    
+    if (!bBackward) {
+        /* From the caret, or just past the start of a selection so the next match is found */
+        nFrom = nSelEnd > nSelStart ? nSelStart + 1 : nSelStart;
+        bFound = FindMatch(pTab, pFind, nFrom, (size_t)-1, FALSE, &nAt, &nLen);
+        if (bFound && nLen == 0 && nAt == nSelStart && nSelEnd == nSelStart) {
+            /* An empty match at the caret is the one found last time */
+            bFound = FindMatch(pTab, pFind, nFrom + 1, (size_t)-1, FALSE, &nAt, &nLen);
+        }
+        bFound = bFound || FindMatch(pTab, pFind, 0, nFrom, FALSE, &nAt, &nLen);
+    } else {
+        bFound = FindMatch(pTab, pFind, 0, nSelStart, TRUE, &nAt, &nLen) ||
+                 FindMatch(pTab, pFind, nSelStart, (size_t)-1, TRUE, &nAt, &nLen);
+    }
+    if (!bFound) return FALSE;
+    
+    SendMessage(pTab->hwndEdit, EM_SETSEL, (WPARAM)EditPosFromDocOffset(pTab, nAt),
+                (LPARAM)EditPosFromDocOffset(pTab, nAt + nLen));
+    SendMessage(pTab->hwndEdit, EM_SCROLLCARET, 0, 0);
+    return TRUE;
+}
+
+/* Find the next (or previous) occurrence of szWhat; nFlags are TEXT_SEARCH_ flags and FIND_REGEX */
+BOOL EditFindNext(HWND hwnd, TabState* pTab, const TCHAR* szWhat, unsigned nFlags, BOOL bBackward) {
+    FindPattern find;
+    BOOL bFound;
+    
+    if (!pTab->hwndEdit || pTab->pLoad || !szWhat[0]) return FALSE;
+    
+    if (pTab->bLargeFile) {
+        /* The viewer searches the mapped bytes in the file's own encoding */
+        const LargeView* pView = GetLargeFileView(pTab->hwndEdit);
+        if (!pView) return FALSE;
+        if (!pView->bUtf8) nFlags |= TEXT_SEARCH_LATIN1;
+    }
+    if (!CompileSearch(hwnd, &find, szWhat, nFlags)) return FALSE;
+    
+    bFound = pTab->bLargeFile ? LargeViewerFind(pTab->hwndEdit, &find, bBackward)
+                              : FindInDocument(pTab, &find, bBackward);
+    FreeSearch(&find);
+    
+    if (!bFound) {
+        ShowNotFoundDialog(hwnd, szWhat);
+    }
+    return bFound;
+}
+
+/* Whether the selection is exactly an occurrence */
+static BOOL SelectionMatches(TabState* pTab, FindPattern* pFind) {
+    size_t nSelStart, nSelEnd, nAt, nLen;
+    
+    GetDocSelection(pTab, &nSelStart, &nSelEnd);
+    return FindMatch(pTab, pFind, nSelStart, nSelStart + 1, FALSE, &nAt, &nLen) &&
+           nAt == nSelStart && nLen == nSelEnd - nSelStart;
+}
+
+/* Replace the selection if it is an occurrence, then find the next one */
+BOOL EditReplace(HWND hwnd, TabState* pTab, const TCHAR* szWhat, const TCHAR* szWith, unsigned nFlags) {
+    FindPattern find;
+    
+    if (!pTab->hwndEdit || pTab->pLoad || pTab->bLargeFile || !szWhat[0]) return FALSE;
+    if (!CompileSearch(hwnd, &find, szWhat, nFlags)) return FALSE;
+    
+    if (SelectionMatches(pTab, &find)) {
+        /* Each replacement is an undo step of its own */
+        UndoJournalSeal(&pTab->undo);
+        SendMessage(pTab->hwndEdit, EM_REPLACESEL, TRUE, (LPARAM)szWith);
+        UndoJournalSeal(&pTab->undo);
+    }
+    FreeSearch(&find);
+    
+    return EditFindNext(hwnd, pTab, szWhat, nFlags, FALSE);
+}
+
+/* ReplaceAll match finder: the next match from nFrom on */
+static int FindNextMatch(void* pContext, const PieceTable* pDoc, size_t nFrom, size_t* pnAt, size_t* pnLen) {
+    FindPattern* pFind = (FindPattern*)pContext;
+    if (pFind->bRegex) {
+        return RegexSearchDocument(&pFind->regex, pDoc, nFrom, (size_t)-1, pnAt, pnLen);
+    }
+    *pnLen = pFind->text.nUnits;
+    return TextSearchDocument(&pFind->text, pDoc, nFrom, (size_t)-1, pnAt);
+}
+
+/*
+ * Replace every occurrence in one pass: the text from the first match to
+ * the last is rebuilt once and swapped in as a single edit. The undo step
+ * holds the matches alone; one too big even so is confirmed first.
+ */
+size_t EditReplaceAll(HWND hwnd, TabState* pTab, const TCHAR* szWhat, const TCHAR* szWith, unsigned nFlags) {
+    FindPattern find;
+    DocReplacement replacement;
+    size_t nCount;
+    int bBuilt;
+    
+    if (!pTab->hwndEdit || pTab->pLoad || pTab->bLargeFile || !szWhat[0]) return 0;
+    if (!CompileSearch(hwnd, &find, szWhat, nFlags)) return 0;
+    
+    bBuilt = DocReplaceAll(&pTab->doc, FindNextMatch, &find, (const TextUnit*)szWith, _tcslen(szWith),
+                           &replacement);
+    FreeSearch(&find);
+    if (!bBuilt) {
+        ShowErrorDialog(hwnd, TEXT("Not enough memory to replace."));
+        return 0;
+    }
+    
+    nCount = replacement.nCount;
+    if (nCount == 0) {
+        ShowNotFoundDialog(hwnd, szWhat);
+        return 0;
+    }
+    
+    if (!UndoJournalCanRecordMatches(&pTab->undo, &pTab->doc, replacement.nFrom, replacement.nTo - replacement.nFrom,
+                                     replacement.pMatches, nCount, (const TextUnit*)szWith, _tcslen(szWith)) &&
+        !ShowConfirmNoUndoDialog(hwnd)) {
+        DocReplacementFree(&replacement);
+        return 0;
+    }
+    if (!ReplaceDocumentMatches(pTab, &replacement, (const TextUnit*)szWith, _tcslen(szWith))) {
+        DocReplacementFree(&replacement);
+        ShowErrorDialog(hwnd, TEXT("Not enough memory to replace."));
+        return 0;
+    }
+    DocReplacementFree(&replacement);
+    
+    pTab->bModified = TRUE;
+    RequestFrame(GetParent(pTab->hwndEdit), FRAME_DIRTY_GUTTER | FRAME_DIRTY_STATUS | FRAME_DIRTY_TITLE);
+    return nCount;
+}
@@ -0,0 +1,367 @@
+#include "file_load.h"
+#include "text_encoding.h"
+#include "transcode.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Progress counters, chunk states and the cancel flag are shared with other threads */
+#if defined(__GNUC__)
+#define PUBLISH_SIZE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define ACQUIRE_SIZE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define PUBLISH_INT(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define ACQUIRE_INT(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define CLAIM_NEXT(p) __atomic_fetch_add((p), 1, __ATOMIC_RELAXED)
+#define SET_FLAG(p) __atomic_store_n((p), 1, __ATOMIC_RELAXED)
+#define TEST_FLAG(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#else
+#include <intrin.h>
+#define PUBLISH_SIZE(p, v) (*(volatile size_t*)(p) = (v))
+#define ACQUIRE_SIZE(p) (*(const volatile size_t*)(p))
+#define PUBLISH_INT(p, v) (*(volatile int*)(p) = (v))
+#define ACQUIRE_INT(p) (*(const volatile int*)(p))
+#define CLAIM_NEXT(p) (_InterlockedExchangeAdd((volatile long*)(p), 1))
+#define SET_FLAG(p) (*(volatile int*)(p) = 1)
+#define TEST_FLAG(p) (*(const volatile int*)(p))
+#endif
+
+/* Map a file, find its text and guess its encoding (returns nonzero on success) */
+int FileLoadOpen(FileLoad* pLoad, const PathChar* szPath) {
+    size_t nBom;
+
+    memset(pLoad, 0, sizeof(*pLoad));
+
+    if (!MapFileReadOnly(&pLoad->map, szPath)) return 0;
+
+    /* The text must be addressable as a whole */
+    if (pLoad->map.nSize > (uint64_t)SIZE_MAX) {
+        UnmapFile(&pLoad->map);
+        return 0;
+    }
+
+    pLoad->pText = pLoad->map.pData;
+    pLoad->nTextSize = (size_t)pLoad->map.nSize;
+
+    pLoad->nEncoding = DetectTextEncoding(pLoad->pText, pLoad->nTextSize, &nBom);
+    pLoad->pText += nBom;
+    pLoad->nTextSize -= nBom;
+    pLoad->bBom = nBom > 0;
+    return 1;
+}
+
+void FileLoadClose(FileLoad* pLoad) {
+    UnmapFile(&pLoad->map);
+    pLoad->pText = NULL;
+    pLoad->nTextSize = 0;
+}
+
+/* Give the mapping to the caller; the load keeps pointing into it */
+void FileLoadTakeMapping(FileLoad* pLoad, MappedFile* pMap) {
+    *pMap = pLoad->map;
+    memset(&pLoad->map, 0, sizeof(pLoad->map));
+}
+
+/* Where an opened file's text goes */
+int FileLoadRoute(const FileLoad* pLoad) {
+    /*
+     * The document's own form of UTF-16, in whole aligned units (a BOM keeps
+     * the alignment), costs no copy at any size, so it is edited however big
+     */
+    if (IsNativeEncoding(pLoad->nEncoding) && pLoad->nTextSize % sizeof(uint16_t) == 0 &&
+        (uintptr_t)pLoad->pText % sizeof(uint16_t) == 0) {
+        return FILE_LOAD_ROUTE_MAPPED;
+    }
+
+    if (pLoad->map.nSize >= LARGE_FILE_THRESHOLD) {
+        /* The viewer pages bytes, so it reads only the byte encodings */
+        return pLoad->nEncoding == TEXT_ENCODING_UTF8 || pLoad->nEncoding == TEXT_ENCODING_ANSI
+                   ? FILE_LOAD_ROUTE_VIEWER
+                   : FILE_LOAD_ROUTE_NONE;
+    }
+    return FILE_LOAD_ROUTE_DECODE;
+}
+
+/* Chunk states (published by the thread that decoded the chunk) */
+#define CHUNK_PENDING 0
+#define CHUNK_DONE    1
+#define CHUNK_INVALID 2
+
+/* Line breaks are packed as (end << 2) | kind, the end relative to the chunk */
+#define BREAK_KIND_BITS 2
+typedef char ChunkFitsBreakPacking[FILE_LOAD_CHUNK < (UINT32_MAX >> BREAK_KIND_BITS) ? 1 : -1];
+
+/* One chunk of the text */
+typedef struct {
+    size_t nStart;               /* First text byte; also where its units are decoded */
+    size_t nEnd;                 /* Past the last text byte */
+    size_t nUnits;               /* Units decoded */
+    uint32_t* pBreaks;           /* Packed line breaks in order */
+    size_t nBreaks;              /* Breaks stored */
+    size_t nBreakCapacity;       /* Breaks allocated */
+    int bBreaksLost;             /* Out of memory for pBreaks */
+    int nState;                  /* CHUNK_ state */
+} DecodeChunk;
+
+/* Shared state of one decode */
+typedef struct {
+    FileLoad* pLoad;
+    uint16_t* pDst;              /* Caller's buffer */
+    DecodeChunk* pChunks;        /* Chunks in text order */
+    size_t nChunks;
+    long nNextChunk;             /* Next chunk to claim */
+    int bStop;                   /* Workers should quit (error or cancellation) */
+} ChunkDecode;
+
+/* Stitching state: where the next chunk goes and the line being built */
+typedef struct {
+    size_t nUnits;               /* Units stitched so far */
+    size_t nLineStart;           /* Start of the current line */
+    int bHeldCR;                 /* Stitched text ends with a CR that an LF may join */
+    int bIndexFailed;            /* Lines could not be stored */
+} ChunkStitch;
+
+/* End of the chunk starting at nPos, moved back so no UTF-8 sequence is split */
+static size_t ChunkEnd(const uint8_t* pText, size_t nPos, size_t nChunk, size_t nSize) {
+    size_t nEnd = (nSize - nPos > nChunk) ? nPos + nChunk : nSize;
+    size_t nBack = 0;
+
+    if (nEnd == nSize) return nEnd;
+
+    /* A sequence is at most four bytes: back up over up to three continuations */
+    while (nBack < 3 && (pText[nEnd - nBack] & 0xC0) == 0x80) nBack++;
+
+    /* More than that is invalid anyway and the decoder will say so */
+    if ((pText[nEnd - nBack] & 0xC0) == 0x80) return nEnd;
+    return nEnd - nBack;
+}
+
+/* Cut the text into chunks (returns the count, 0 on allocation failure) */
+static size_t SplitChunks(const FileLoad* pLoad, DecodeChunk** ppChunks) {
+    size_t nCapacity = 2 + pLoad->nTextSize / FILE_LOAD_CHUNK;
+    size_t nChunks = 0;
+    size_t nPos = 0;
+    DecodeChunk* pChunks = (DecodeChunk*)calloc(nCapacity, sizeof(DecodeChunk));
+
+    if (!pChunks) return 0;
+
+    while (nPos < pLoad->nTextSize) {
+        size_t nSize = nChunks == 0 ? FILE_LOAD_FIRST_CHUNK : FILE_LOAD_CHUNK;
+        pChunks[nChunks].nStart = nPos;
+        pChunks[nChunks].nEnd = ChunkEnd(pLoad->pText, nPos, nSize, pLoad->nTextSize);
+        nPos = pChunks[nChunks].nEnd;
+        nChunks++;
+    }
+    *ppChunks = pChunks;
+    return nChunks;
+}
+
+/* TextScan callback: remember a line break of the chunk */
+static void CollectBreak(void* pContext, size_t nEnd, int nBreak) {
+    DecodeChunk* pChunk = (DecodeChunk*)pContext;
+
+    if (pChunk->bBreaksLost) return;
+    if (pChunk->nBreaks == pChunk->nBreakCapacity) {
+        size_t nCapacity = pChunk->nBreakCapacity ? pChunk->nBreakCapacity * 2 : 1024;
+        uint32_t* pBreaks = (uint32_t*)realloc(pChunk->pBreaks, nCapacity * sizeof(uint32_t));
+        if (!pBreaks) {
+            pChunk->bBreaksLost = 1;
+            return;
+        }
+        pChunk->pBreaks = pBreaks;
+        pChunk->nBreakCapacity = nCapacity;
+    }
+    pChunk->pBreaks[pChunk->nBreaks++] = ((uint32_t)nEnd << BREAK_KIND_BITS) | (uint32_t)nBreak;
+}
+
+/* Decode one chunk in place at its byte offset and collect its line breaks */
+static void DecodeOneChunk(ChunkDecode* pDecode, DecodeChunk* pChunk) {
+    const FileLoad* pLoad = pDecode->pLoad;
+    TextScan scan;
+    size_t nBad;
+    int bValid;
+
+    TextScanInit(&scan, CollectBreak, pChunk);
+    bValid = Utf8ToUtf16(pLoad->pText + pChunk->nStart, pChunk->nEnd - pChunk->nStart,
+                         pDecode->pDst + pChunk->nStart, &pChunk->nUnits, &nBad, &scan);
+
+    /* A CR at the very end is reported as a lone CR; stitching may join it to an LF */
+    if (bValid) TextScanFinish(&scan);
+
+    PUBLISH_INT(&pChunk->nState, bValid ? CHUNK_DONE : CHUNK_INVALID);
+}
+
+/* Claim and decode the next unclaimed chunk (returns 0 if none is left) */
+static int DecodeNextChunk(ChunkDecode* pDecode) {
+    long nChunk;
+
+    if (ACQUIRE_INT(&pDecode->bStop) || FileLoadIsCancelled(pDecode->pLoad)) return 0;
+
+    nChunk = CLAIM_NEXT(&pDecode->nNextChunk);
+    if ((size_t)nChunk >= pDecode->nChunks) return 0;
+
+    DecodeOneChunk(pDecode, &pDecode->pChunks[nChunk]);
+    return 1;
+}
+
+/* Worker thread: decode chunks until none are left */
+static void DecodeWorker(void* pContext) {
+    ChunkDecode* pDecode = (ChunkDecode*)pContext;
+    while (DecodeNextChunk(pDecode)) {
+    }
+}
+
+/* Append one line to the index and count its break */
+static void StitchLine(FileLoad* pLoad, LineIndex* pLines, ChunkStitch* pStitch, size_t nEnd, int nBreak) {
+    if (!pStitch->bIndexFailed && !LineIndexAppendLine(pLines, nEnd - pStitch->nLineStart, nBreak)) {
+        pStitch->bIndexFailed = 1;
+    }
+    pStitch->nLineStart = nEnd;
+
+    if (nBreak == LINE_BREAK_CRLF) pLoad->nCRLF++;
+    else if (nBreak == LINE_BREAK_LF) pLoad->nLoneLF++;
+    else if (nBreak == LINE_BREAK_CR) pLoad->nLoneCR++;
+}
+
+/* Move a decoded chunk into place after the text before it and index its lines */
+static void StitchChunk(FileLoad* pLoad, uint16_t* pDst, LineIndex* pLines, ChunkStitch* pStitch,
+                        DecodeChunk* pChunk, int bLast) {
+    size_t nBase = pStitch->nUnits;
+    size_t i = 0;
+
+    /* Chunks shrink only when multi-byte sequences were decoded before them */
+    if (nBase != pChunk->nStart && pChunk->nUnits > 0) {
+        memmove(pDst + nBase, pDst + pChunk->nStart, pChunk->nUnits * sizeof(uint16_t));
+    }
+
+    if (pChunk->bBreaksLost) pStitch->bIndexFailed = 1;
+
+    /* A CR that ended the previous chunk pairs with an LF that starts this one */
+    if (pStitch->bHeldCR) {
+        pStitch->bHeldCR = 0;
+        if (pChunk->nBreaks > 0 && pChunk->pBreaks[0] == ((1u << BREAK_KIND_BITS) | LINE_BREAK_LF)) {
+            StitchLine(pLoad, pLines, pStitch, nBase + 1, LINE_BREAK_CRLF);
+            i = 1;
+        } else {
+            StitchLine(pLoad, pLines, pStitch, nBase, LINE_BREAK_CR);
+        }
+    }
+
+    for (; i < pChunk->nBreaks; i++) {
+        size_t nEnd = pChunk->pBreaks[i] >> BREAK_KIND_BITS;
+        int nBreak = (int)(pChunk->pBreaks[i] & ((1u << BREAK_KIND_BITS) - 1));
+
+        if (nBreak == LINE_BREAK_CR && nEnd == pChunk->nUnits && !bLast) {
+            pStitch->bHeldCR = 1;
+            break;
+        }
+        StitchLine(pLoad, pLines, pStitch, nBase + nEnd, nBreak);
+    }
+
+    pStitch->nUnits = nBase + pChunk->nUnits;
+    free(pChunk->pBreaks);
+    pChunk->pBreaks = NULL;
+}
+
+/* Decode and index the text, reporting progress after every chunk */
+int FileLoadDecode(FileLoad* pLoad, uint16_t* pDst, LineIndex* pLines, int nMaxThreads,
+                   FileLoadProgressProc pfnProgress, void* pContext) {
+    WorkerThread workers[FILE_LOAD_MAX_THREADS];
+    int nWorkers = 0;
+    ChunkDecode decode;
+    ChunkStitch stitch;
+    int nResult = FILE_LOAD_OK;
+    size_t i;
+
+    pLoad->bIndexed = 0;
+    pLoad->nCRLF = pLoad->nLoneLF = pLoad->nLoneCR = 0;
+    pLoad->nThreads = 1;
+    PUBLISH_SIZE(&pLoad->nBytesDone, 0);
+    PUBLISH_SIZE(&pLoad->nUnitsReady, 0);
+
+    memset(&decode, 0, sizeof(decode));
+    memset(&stitch, 0, sizeof(stitch));
+    decode.pLoad = pLoad;
+    decode.pDst = pDst;
+    LineIndexReset(pLines);
+
+    if (pLoad->nTextSize > 0) {
+        decode.nChunks = SplitChunks(pLoad, &decode.pChunks);
+        if (decode.nChunks == 0) stitch.bIndexFailed = 1;
+    }
+
+    for (i = 0; i < decode.nChunks; i++) {
+        DecodeChunk* pChunk = &decode.pChunks[i];
+        int nState;
+
+        /* Wait for the chunk, decoding others meanwhile rather than sitting idle */
+        while ((nState = ACQUIRE_INT(&pChunk->nState)) == CHUNK_PENDING && !FileLoadIsCancelled(pLoad)) {
+            if (!DecodeNextChunk(&decode)) WorkerThreadYield();
+        }
+        if (FileLoadIsCancelled(pLoad)) {
+            nResult = FILE_LOAD_CANCELLED;
+            break;
+        }
+        if (nState == CHUNK_INVALID) {
+            nResult = FILE_LOAD_NOT_UTF8;
+            break;
+        }
+
+        StitchChunk(pLoad, pDst, pLines, &stitch, pChunk, i + 1 == decode.nChunks);
+
+        /* Units last: a reader that sees them also sees the text */
+        PUBLISH_SIZE(&pLoad->nBytesDone, pChunk->nEnd);
+        PUBLISH_SIZE(&pLoad->nUnitsReady, stitch.nUnits);
+        if (pfnProgress) pfnProgress(pContext, pLoad);
+
+        /* The first screen is out: bring in the workers for the rest */
+        if (i == 0 && pLoad->nTextSize >= FILE_LOAD_PARALLEL_MIN) {
+            int nThreads = nMaxThreads > 0 ? nMaxThreads : ProcessorCount();
+            if (nThreads > FILE_LOAD_MAX_THREADS) nThreads = FILE_LOAD_MAX_THREADS;
+            while (nWorkers + 1 < nThreads &&
+                   WorkerThreadStart(&workers[nWorkers], DecodeWorker, &decode)) {
+                nWorkers++;
+            }
+            pLoad->nThreads = nWorkers + 1;
+        }
+    }
+
+    /* Stop the workers and release what was not stitched */
+    PUBLISH_INT(&decode.bStop, 1);
+    while (nWorkers > 0) WorkerThreadJoin(&workers[--nWorkers]);
+    for (i = 0; i < decode.nChunks; i++) free(decode.pChunks[i].pBreaks);
+    free(decode.pChunks);
+
+    if (nResult != FILE_LOAD_OK) return nResult;
+
+    /* Last line (no break) */
+    if (!stitch.bIndexFailed) {
+        StitchLine(pLoad, pLines, &stitch, stitch.nUnits, LINE_BREAK_NONE);
+    }
+    if (stitch.bIndexFailed || !LineIndexFinish(pLines)) {
+        LineIndexReset(pLines);
+        LineIndexFinish(pLines);
+    } else {
+        pLoad->bIndexed = 1;
+    }
+    return FILE_LOAD_OK;
+}
+
+/* Ask a running decode to stop (safe from any thread) */
+void FileLoadCancel(FileLoad* pLoad) {
+    SET_FLAG(&pLoad->bCancel);
+}
+
+int FileLoadIsCancelled(const FileLoad* pLoad) {
+    return TEST_FLAG(&pLoad->bCancel);
+}
+
+/* Decoded units another thread may read from the destination buffer */
+size_t FileLoadUnitsReady(const FileLoad* pLoad) {
+    return ACQUIRE_SIZE(&pLoad->nUnitsReady);
+}
+
+/* Decoded share of the text in percent */
+int FileLoadPercent(const FileLoad* pLoad) {
+    size_t nDone = ACQUIRE_SIZE(&pLoad->nBytesDone);
+    if (pLoad->nTextSize == 0 || nDone >= pLoad->nTextSize) return 100;
+    return (int)((uint64_t)nDone * 100 / pLoad->nTextSize);
+}
@@ -0,0 +1,109 @@
+#ifndef FILE_LOAD_H
+#define FILE_LOAD_H
+
+/*
+ * File loading pipeline: map, decode and index, meant to run on a worker
+ * thread.
+ *
+ * Portable C. Opening a file guesses its encoding (see text_encoding.h);
+ * the decoder here is for UTF-8 text. The mapped text is cut into chunks
+ * that never split a UTF-8 sequence. Each chunk is decoded and scanned
+ * for line breaks in one pass, on a pool of worker threads when the text
+ * is big enough. Every chunk is
+ * decoded in place at its byte offset (UTF-8 never needs more UTF-16 units
+ * than bytes); the calling thread then stitches the chunks in order: it
+ * moves each one down to follow the last, joins a CR and LF split between
+ * chunks into one CRLF and appends the chunk's lines to the index.
+ *
+ * After every stitched chunk the decoded prefix is published and a
+ * progress callback runs, so the UI can show the start of a file while the
+ * rest is still decoding. The first chunk is small and decoded before any
+ * worker starts, to get the first screen out quickly. Any thread may cancel
+ * a load; the decoder checks between chunks.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "platform.h"
+#include "line_index.h"
+
+/* Bytes decoded before the first progress report */
+#define FILE_LOAD_FIRST_CHUNK (64 * 1024)
+
+/* Bytes per later chunk (the unit of work, progress and cancellation) */
+#define FILE_LOAD_CHUNK (4 * 1024 * 1024)
+
+/* Text smaller than this is decoded on the calling thread alone */
+#define FILE_LOAD_PARALLEL_MIN (16 * 1024 * 1024)
+
+/* Most threads one decode uses, the calling thread included */
+#define FILE_LOAD_MAX_THREADS 16
+
+/* Files this size or larger open in the read-only large file viewer (unless their text can be used where it lies) */
+#define LARGE_FILE_THRESHOLD ((uint64_t)256 * 1024 * 1024)
+
+/* FileLoadDecode results */
+#define FILE_LOAD_OK        0    /* Whole text decoded and indexed */
+#define FILE_LOAD_CANCELLED 1    /* Stopped by FileLoadCancel */
+#define FILE_LOAD_NOT_UTF8  2    /* Text is not valid UTF-8 */
+
+/* FileLoadRoute results */
+#define FILE_LOAD_ROUTE_DECODE 0 /* Decoded into the document */
+#define FILE_LOAD_ROUTE_MAPPED 1 /* UTF-16 in the host's order, any size: the mapping is the document's text */
+#define FILE_LOAD_ROUTE_VIEWER 2 /* Too big to edit: paged by the large file viewer (UTF-8 or ANSI) */
+#define FILE_LOAD_ROUTE_NONE   3 /* Too big to edit, in an encoding the viewer cannot page */
+
+/* Load state */
+typedef struct {
+    MappedFile map;              /* Whole file, read-only */
+    const uint8_t* pText;        /* Text bytes (after a byte order mark) */
+    size_t nTextSize;            /* Text bytes */
+    int nEncoding;               /* TEXT_ENCODING_ of the text, as detected */
+    int bBom;                    /* File starts with a byte order mark */
+    size_t nBytesDone;           /* Text bytes decoded so far (published) */
+    size_t nUnitsReady;          /* Units decoded so far (published) */
+    int bIndexed;                /* Decode built the line index */
+    size_t nCRLF;                /* CRLF breaks (after FILE_LOAD_OK) */
+    size_t nLoneLF;              /* LF breaks not after a CR */
+    size_t nLoneCR;              /* CR breaks not before an LF */
+    int nThreads;                /* Threads the last decode used */
+    int bCancel;                 /* Cancellation requested */
+} FileLoad;
+
+/* Runs on the thread calling FileLoadDecode after every stitched chunk */
+typedef void (*FileLoadProgressProc)(void* pContext, const FileLoad* pLoad);
+
+/* Map a file, find its text and guess its encoding (returns nonzero on success) */
+int FileLoadOpen(FileLoad* pLoad, const PathChar* szPath);
+void FileLoadClose(FileLoad* pLoad);
+
+/*
+ * Hand the mapping over to *pMap, for text used where it lies (pText stays
+ * valid until pMap is unmapped). FileLoadClose then leaves it mapped.
+ */
+void FileLoadTakeMapping(FileLoad* pLoad, MappedFile* pMap);
+
+/* Where an opened file's text goes, by its size and detected encoding (a FILE_LOAD_ROUTE_) */
+int FileLoadRoute(const FileLoad* pLoad);
+
+/*
+ * Decode UTF-8 text into pDst, which must hold nTextSize units, and rebuild
+ * pLines from it, using up to nMaxThreads threads (0 for one per
+ * processor). Returns one of the FILE_LOAD_ results; pLines is only
+ * meaningful after FILE_LOAD_OK, and only if bIndexed is set. pfnProgress
+ * may be NULL; it always runs on the calling thread.
+ */
+int FileLoadDecode(FileLoad* pLoad, uint16_t* pDst, LineIndex* pLines, int nMaxThreads,
+                   FileLoadProgressProc pfnProgress, void* pContext);
+
+/* Ask a running decode to stop (safe from any thread) */
+void FileLoadCancel(FileLoad* pLoad);
+int FileLoadIsCancelled(const FileLoad* pLoad);
+
+/* Decoded units another thread may read from pDst */
+size_t FileLoadUnitsReady(const FileLoad* pLoad);
+
+/* Decoded share of the text in percent */
+int FileLoadPercent(const FileLoad* pLoad);
+
+#endif /* FILE_LOAD_H */
@@ -1,5 +1,10 @@
 #include "notepad.h"
+#include "platform.h"
+#include "transcode.h"
+#include "doc_writer.h"
+#include "file_load.h"
 #include <stdio.h>
+#include <limits.h>
 
 /* Update window title based on current tab */
 void UpdateWindowTitle(HWND hwnd) {
@@ -23,198 +28,591 @@ void UpdateWindowTitle(HWND hwnd) {
     SetWindowText(hwnd, szTitle);
 }
 
-/* Check if buffer has UTF-8 BOM */
-static BOOL HasUtf8Bom(const char* pBuffer, DWORD dwSize) {
-    if (dwSize >= 3) {
-        return (unsigned char)pBuffer[0] == 0xEF &&
-               (unsigned char)pBuffer[1] == 0xBB &&
-               (unsigned char)pBuffer[2] == 0xBF;
-    }
-    return FALSE;
+/* Pick the line ending type from break counts */
+static LineEndingType LineEndingFromCounts(size_t nCRLF, size_t nLoneLF, size_t nLoneCR) {
+    /* Prioritize: CRLF > LF > CR */
+    if (nCRLF) return LINE_ENDING_CRLF;
+    if (nLoneLF) return LINE_ENDING_LF;
+    if (nLoneCR) return LINE_ENDING_CR;
+    
+    /* Default to Windows line ending */
+    return LINE_ENDING_CRLF;
 }
 
 /* Detect line ending type from buffer */
-static LineEndingType DetectLineEnding(const char* pBuffer, DWORD dwSize) {
-    BOOL bHasCR = FALSE;
-    BOOL bHasLF = FALSE;
-    BOOL bHasCRLF = FALSE;
-    
-    for (DWORD i = 0; i < dwSize; i++) {
-        if (pBuffer[i] == '\r') {
-            if (i + 1 < dwSize && pBuffer[i + 1] == '\n') {
-                bHasCRLF = TRUE;
-                i++; /* Skip the LF */
-            } else {
-                bHasCR = TRUE;
-            }
-        } else if (pBuffer[i] == '\n') {
-            bHasLF = TRUE;
-        }
+static LineEndingType DetectLineEnding(const char* pBuffer, size_t nSize) {
+    TextScan scan;
+    
+    /* Count-only scan (no per-break callback) */
+    TextScanInit(&scan, NULL, NULL);
+    TextScanBytes(&scan, (const uint8_t*)pBuffer, nSize);
+    TextScanFinish(&scan);
+    
+    return LineEndingFromCounts(scan.nCRLF, TextScanLoneLF(&scan), TextScanLoneCR(&scan));
+}
+
+/* Bytes handed to MultiByteToWideChar per call for ANSI text (it takes int lengths) */
+#define DECODE_CHUNK_SIZE (16 * 1024 * 1024)
+
+/* End of the next decode chunk, moved back so no character is split */
+static size_t DecodeChunkEnd(const char* pText, size_t nStart, size_t nSize) {
+    size_t nEnd = nStart + DECODE_CHUNK_SIZE;
+    if (nEnd >= nSize) return nSize;
+    
+    /* Bytes below 0x40 are never part of a multi-byte character (UTF-8 or DBCS) */
+    for (size_t nBack = 0; nBack < 4096 && nEnd - nBack > nStart; nBack++) {
+        if ((unsigned char)pText[nEnd - nBack - 1] < 0x40) return nEnd - nBack;
     }
     
-    /* Prioritize: CRLF > LF > CR */
-    if (bHasCRLF) return LINE_ENDING_CRLF;
-    if (bHasLF) return LINE_ENDING_LF;
-    if (bHasCR) return LINE_ENDING_CR;
+    /* No such byte nearby: at least keep UTF-8 sequences whole */
+    while (nEnd > nStart + 1 && ((unsigned char)pText[nEnd] & 0xC0) == 0x80) nEnd--;
+    return nEnd;
+}
+
+/* Decode ANSI text of any size into pWide (room for nSize units, enough for any code page) */
+static BOOL DecodeAnsi(const char* pText, size_t nSize, WCHAR* pWide, size_t* pnWide) {
+    size_t nOut = 0;
+    
+    for (size_t nPos = 0; nPos < nSize; ) {
+        size_t nEnd = DecodeChunkEnd(pText, nPos, nSize);
+        size_t nRoom = nSize - nOut;
+        int nLen = MultiByteToWideChar(CP_ACP, 0, pText + nPos, (int)(nEnd - nPos),
+                                       pWide + nOut, (int)(nRoom < INT_MAX ? nRoom : INT_MAX));
+        if (nLen <= 0) return FALSE;
+        nOut += (size_t)nLen;
+        nPos = nEnd;
+    }
     
-    /* Default to Windows line ending */
-    return LINE_ENDING_CRLF;
+    *pnWide = nOut;
+    return TRUE;
+}
+
+/* UTF-16 LE file text used where it lies, as a document's original buffer */
+typedef struct {
+    MappedFile map;              /* The whole file */
+    const WCHAR* pText;          /* Its text, after any BOM */
+    TCHAR szFileName[MAX_PATH];  /* File mapped */
+} MappedText;
+
+/* Unmap a document's file once the document is done with its text */
+static void ReleaseMappedText(void* pContext, const TextUnit* pText, size_t nLen) {
+    MappedText* pMapped = (MappedText*)pContext;
+    (void)pText;
+    (void)nLen;
+    UnmapFile(&pMapped->map);
+    HeapFree(GetProcessHeap(), 0, pMapped);
 }
 
-/* Read file content into edit control - simple and reliable method */
-BOOL ReadFileContent(HWND hEdit, const TCHAR* szFileName) {
-    HANDLE hFile;
-    LARGE_INTEGER liFileSize;
-    DWORD dwFileSize, dwBytesRead;
-    char* pBuffer;
-    WCHAR* pWideBuffer;
-    int nWideLen;
-    const char* pText;
-    DWORD dwTextSize;
-    
-    hFile = CreateFile(szFileName, GENERIC_READ, FILE_SHARE_READ, NULL,
-                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
-    if (hFile == INVALID_HANDLE_VALUE) {
+/* Background open of one file; owned by the main window until WM_FILELOAD_DONE */
+struct FileLoadJob {
+    FileLoad load;               /* Portable map/decode/index state */
+    HWND hwndNotify;             /* Receives WM_FILELOAD_PROGRESS and WM_FILELOAD_DONE */
+    TabHandle hTab;              /* Tab the file is opening in */
+    HANDLE hThread;              /* Worker thread */
+    TCHAR szFileName[MAX_PATH];  /* File being opened */
+    WCHAR* pWide;                /* Decoded text, handed to the document when done */
+    MappedText* pMapped;         /* Or the file's own text, when no decoding is needed (NULL if not) */
+    WCHAR* pStale;               /* Buffer replaced by the ANSI fallback (freed when done) */
+    size_t nWide;                /* Units in pWide (or pMapped) */
+    LineIndex lines;             /* Line starts of pWide */
+    BOOL bIndexed;               /* lines is complete */
+    DocStats stats;              /* Counts of pWide */
+    LineEndingType lineEnding;   /* Detected line ending type */
+    int nEncoding;               /* TEXT_ENCODING_ the text was decoded from */
+    BOOL bLarge;                 /* Too big to edit: open in the large file viewer */
+    BOOL bNoViewer;              /* Too big to edit, in an encoding the viewer cannot page */
+    BOOL bTooLarge;              /* Too big for this address space */
+    BOOL bOk;                    /* Load succeeded */
+    BOOL bFirstScreen;           /* The decoded start has been shown */
+    volatile LONG bProgressPosted; /* A progress message is waiting in the queue */
+};
+
+/* Index the line starts of the whole text at once (nWide units) */
+static void IndexWholeText(FileLoadJob* pJob, const WCHAR* pText) {
+    LineIndexBuilder builder;
+    
+    LineIndexBuilderBegin(&builder, &pJob->lines);
+    TextScanUnits(&builder.scan, (const uint16_t*)pText, pJob->nWide);
+    pJob->bIndexed = LineIndexBuilderEnd(&builder);
+    pJob->lineEnding = LineEndingFromCounts(builder.scan.nCRLF, TextScanLoneLF(&builder.scan),
+                                            TextScanLoneCR(&builder.scan));
+}
+
+/*
+ * Decode the whole text from an encoding other than UTF-8 into pWide in one
+ * pass, then index its line starts. These encodings are rare enough that
+ * the parallel decode is kept for UTF-8.
+ */
+static BOOL DecodeWholeText(FileLoadJob* pJob, int nEncoding) {
+    const FileLoad* pLoad = &pJob->load;
+    
+    switch (nEncoding) {
+        case TEXT_ENCODING_UTF16LE:
+        case TEXT_ENCODING_UTF16BE:
+            pJob->nWide = Utf16FromBytes(pLoad->pText, pLoad->nTextSize, nEncoding == TEXT_ENCODING_UTF16BE,
+                                         (uint16_t*)pJob->pWide);
+            break;
+        case TEXT_ENCODING_UTF32LE:
+        case TEXT_ENCODING_UTF32BE:
+            pJob->nWide = Utf32ToUtf16(pLoad->pText, pLoad->nTextSize, nEncoding == TEXT_ENCODING_UTF32BE,
+                                       (uint16_t*)pJob->pWide);
+            break;
+        default:
+            if (!DecodeAnsi((const char*)pLoad->pText, pLoad->nTextSize, pJob->pWide, &pJob->nWide)) {
+                return FALSE;
+            }
+            break;
+    }
+    pJob->nEncoding = nEncoding;
+    IndexWholeText(pJob, pJob->pWide);
+    return TRUE;
+}
+
+/*
+ * UTF-16 in the host's byte order is already what the document holds, so
+ * the mapping itself becomes the document's text: nothing is decoded or
+ * copied, and only the line scan and the counts read it.
+ */
+static BOOL UseMappedText(FileLoadJob* pJob) {
+    FileLoad* pLoad = &pJob->load;
+    MappedText* pMapped = (MappedText*)HeapAlloc(GetProcessHeap(), 0, sizeof(MappedText));
+    
+    if (!pMapped) {
         return FALSE;
     }
+    
+    FileLoadTakeMapping(pLoad, &pMapped->map);
+    pMapped->pText = (const WCHAR*)pLoad->pText;
+    _tcscpy(pMapped->szFileName, pJob->szFileName);
+    pJob->pMapped = pMapped;
+    pJob->nWide = pLoad->nTextSize / sizeof(WCHAR);
+    pJob->nEncoding = pLoad->nEncoding;
+    
+    IndexWholeText(pJob, pMapped->pText);
+    DocStatsBuildFromText(&pJob->stats, (const TextUnit*)pMapped->pText, pJob->nWide);
+    return !FileLoadIsCancelled(pLoad);
+}
+
+/* Worker progress: one message in flight at a time is enough */
+static void PostLoadProgress(void* pContext, const FileLoad* pLoad) {
+    FileLoadJob* pJob = (FileLoadJob*)pContext;
+    (void)pLoad;
+    if (!InterlockedExchange(&pJob->bProgressPosted, TRUE)) {
+        PostMessage(pJob->hwndNotify, WM_FILELOAD_PROGRESS, 0, (LPARAM)pJob);
+    }
+}
 
-    /* Get file size */
-    if (!GetFileSizeEx(hFile, &liFileSize)) {
-        CloseHandle(hFile);
+/* Worker: map, decode and index the file (the UI thread is not touched) */
+static BOOL LoadFileInBackground(FileLoadJob* pJob) {
+    FileLoad* pLoad = &pJob->load;
+    int nRoute, nResult;
+    
+    if (!FileLoadOpen(pLoad, pJob->szFileName)) {
         return FALSE;
     }
     
-    /* Limit to 100MB for practical use with this method */
-    if (liFileSize.HighPart > 0 || liFileSize.LowPart > 100 * 1024 * 1024) {
-        CloseHandle(hFile);
-        ShowErrorDialog(GetParent(hEdit), TEXT("File is too large (max 100MB)."));
+    /* Too big to edit: the UI thread opens it in the read-only viewer instead, in the encoding found here */
+    nRoute = FileLoadRoute(pLoad);
+    if (nRoute == FILE_LOAD_ROUTE_VIEWER) {
+        pJob->bLarge = TRUE;
+        pJob->nEncoding = pLoad->nEncoding;
+        return TRUE;
+    }
+    if (nRoute == FILE_LOAD_ROUTE_NONE) {
+        pJob->bNoViewer = TRUE;
         return FALSE;
     }
     
-    dwFileSize = liFileSize.LowPart;
+    /* The decoded text needs two bytes per input byte at most */
+    if (pLoad->nTextSize > SIZE_MAX / sizeof(WCHAR) - 1) {
+        pJob->bTooLarge = TRUE;
+        return FALSE;
+    }
+    
+    if (pLoad->nTextSize == 0) {
+        /* Empty file */
+        pJob->nEncoding = pLoad->nEncoding;
+        pJob->bIndexed = LineIndexFinish(&pJob->lines);
+        return TRUE;
+    }
+    
+    /* The document's own form of UTF-16 */
+    if (nRoute == FILE_LOAD_ROUTE_MAPPED) {
+        return UseMappedText(pJob);
+    }
     
-    /* Allocate buffer */
-    pBuffer = (char*)HeapAlloc(GetProcessHeap(), 0, dwFileSize + 1);
-    if (!pBuffer) {
-        CloseHandle(hFile);
+    /* No encoding needs more UTF-16 units than the source has bytes */
+    pJob->pWide = (WCHAR*)HeapAlloc(GetProcessHeap(), 0, (pLoad->nTextSize + 1) * sizeof(WCHAR));
+    if (!pJob->pWide) {
         return FALSE;
     }
     
-    /* Read entire file */
-    if (!ReadFile(hFile, pBuffer, dwFileSize, &dwBytesRead, NULL)) {
-        HeapFree(GetProcessHeap(), 0, pBuffer);
-        CloseHandle(hFile);
+    if (pLoad->nEncoding == TEXT_ENCODING_UTF8) {
+        /* Looks like UTF-8: decode on all cores, indexing line starts in the same pass */
+        nResult = FileLoadDecode(pLoad, (uint16_t*)pJob->pWide, &pJob->lines, 0, PostLoadProgress, pJob);
+        if (nResult == FILE_LOAD_CANCELLED) {
+            return FALSE;
+        }
+        
+        if (nResult == FILE_LOAD_OK) {
+            pJob->nEncoding = TEXT_ENCODING_UTF8;
+            pJob->nWide = pLoad->nUnitsReady;
+            pJob->bIndexed = pLoad->bIndexed;
+            pJob->lineEnding = LineEndingFromCounts(pLoad->nCRLF, pLoad->nLoneLF, pLoad->nLoneCR);
+        } else {
+            /* Not UTF-8 after all: decode as ANSI into a fresh buffer, the UI may be showing the old one */
+            pJob->pStale = pJob->pWide;
+            pJob->pWide = (WCHAR*)HeapAlloc(GetProcessHeap(), 0, (pLoad->nTextSize + 1) * sizeof(WCHAR));
+            if (!pJob->pWide || !DecodeWholeText(pJob, TEXT_ENCODING_ANSI)) {
+                /* Not UTF-8, and not valid ANSI either */
+                return FALSE;
+            }
+        }
+    } else if (!DecodeWholeText(pJob, pLoad->nEncoding)) {
         return FALSE;
     }
     
-    pBuffer[dwBytesRead] = '\0';
-    CloseHandle(hFile);
+    /* Counted here so the UI thread never has to scan the whole text */
+    DocStatsBuildFromText(&pJob->stats, (const TextUnit*)pJob->pWide, pJob->nWide);
     
-    /* Detect line ending type and store in tab state */
-    TabState* pTab = GetCurrentTabState();
-    if (pTab) {
-        pTab->lineEnding = DetectLineEnding(pBuffer, dwBytesRead);
+    /* Give back the slack reserved for the worst case (in place: the UI may be reading) */
+    if (pJob->nWide < pLoad->nTextSize) {
+        HeapReAlloc(GetProcessHeap(), HEAP_REALLOC_IN_PLACE_ONLY, pJob->pWide,
+                    (pJob->nWide + 1) * sizeof(WCHAR));
     }
     
-    /* Check for UTF-8 BOM and skip it */
-    if (HasUtf8Bom(pBuffer, dwBytesRead)) {
-        pText = pBuffer + 3;
-        dwTextSize = dwBytesRead - 3;
-    } else {
-        pText = pBuffer;
-        dwTextSize = dwBytesRead;
+    return !FileLoadIsCancelled(pLoad);
+}
+
+static DWORD WINAPI FileLoadThreadProc(LPVOID pParam) {
+    FileLoadJob* pJob = (FileLoadJob*)pParam;
+    
+    pJob->bOk = LoadFileInBackground(pJob);
+    FileLoadClose(&pJob->load);
+    PostMessage(pJob->hwndNotify, WM_FILELOAD_DONE, 0, (LPARAM)pJob);
+    return 0;
+}
+
+/* Release a finished job and anything the tab did not take over */
+static void FreeFileLoadJob(FileLoadJob* pJob) {
+    if (pJob->hThread) {
+        WaitForSingleObject(pJob->hThread, INFINITE);
+        CloseHandle(pJob->hThread);
     }
+    if (pJob->pWide) HeapFree(GetProcessHeap(), 0, pJob->pWide);
+    if (pJob->pMapped) ReleaseMappedText(pJob->pMapped, NULL, 0);
+    if (pJob->pStale) HeapFree(GetProcessHeap(), 0, pJob->pStale);
+    LineIndexFree(&pJob->lines);
+    HeapFree(GetProcessHeap(), 0, pJob);
+}
+
+/* Tab that a load belongs to (-1 if it was cancelled: the tab closed, or stopped or replaced the load) */
+static int FindLoadingTab(const FileLoadJob* pJob) {
+    const TabState* pTab = (const TabState*)TabRegistryGet(&g_AppState.tabs, pJob->hTab);
+    size_t nIndex;
     
-    /* Try UTF-8 first, then ANSI */
-    nWideLen = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, pText, dwTextSize, NULL, 0);
+    if (!pTab || pTab->pLoad != pJob || !TabRegistryIndexOf(&g_AppState.tabs, pJob->hTab, &nIndex)) return -1;
+    return (int)nIndex;
+}
+
+/* Start reading a file into a tab on a worker thread */
+BOOL BeginFileLoad(HWND hwnd, TabState* pTab, const TCHAR* szFileName) {
+    FileLoadJob* pJob = (FileLoadJob*)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(FileLoadJob));
     
-    if (nWideLen == 0) {
-        /* UTF-8 failed, try ANSI */
-        nWideLen = MultiByteToWideChar(CP_ACP, 0, pText, dwTextSize, NULL, 0);
+    if (!pJob) {
+        return FALSE;
     }
     
-    if (nWideLen > 0) {
-        pWideBuffer = (WCHAR*)HeapAlloc(GetProcessHeap(), 0, (nWideLen + 1) * sizeof(WCHAR));
-        if (pWideBuffer) {
-            /* Try UTF-8 first */
-            int nConverted = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, pText, dwTextSize, pWideBuffer, nWideLen);
-            if (nConverted == 0) {
-                /* Fallback to ANSI */
-                nConverted = MultiByteToWideChar(CP_ACP, 0, pText, dwTextSize, pWideBuffer, nWideLen);
+    pJob->hwndNotify = hwnd;
+    pJob->hTab = pTab->hTab;
+    _tcscpy(pJob->szFileName, szFileName);
+    LineIndexInit(&pJob->lines);
+    
+    pJob->hThread = CreateThread(NULL, 0, FileLoadThreadProc, pJob, 0, NULL);
+    if (!pJob->hThread) {
+        FreeFileLoadJob(pJob);
+        return FALSE;
+    }
+    
+    /* The tab shows the file name but stays read-only until the text is in */
+    pTab->pLoad = pJob;
+    _tcscpy(pTab->szFileName, szFileName);
+    pTab->bModified = FALSE;
+    pTab->bUntitled = FALSE;
+    SendMessage(pTab->hwndEdit, EM_SETREADONLY, TRUE, 0);
+    
+    return TRUE;
+}
+
+/* WM_FILELOAD_PROGRESS: show the first screen as soon as it is decoded */
+void ShowFileLoadProgress(HWND hwnd, FileLoadJob* pJob) {
+    int nTab;
+    
+    InterlockedExchange(&pJob->bProgressPosted, FALSE);
+    
+    nTab = FindLoadingTab(pJob);
+    if (nTab < 0) return;
+    
+    if (!pJob->bFirstScreen) {
+        TabState* pTab = GetTab(nTab);
+        size_t nReady = FileLoadUnitsReady(&pJob->load);
+        PieceTable prefix;
+        
+        /* A borrowed view of the decoded start; the worker only writes past it */
+        PieceTableInit(&prefix);
+        if (nReady > 0 && PieceTableLoad(&prefix, (const TextUnit*)pJob->pWide, nReady, NULL, NULL)) {
+            FeedEditFromDocument(pTab->hwndEdit, &prefix);
+            SendMessage(pTab->hwndEdit, EM_SETSEL, 0, 0);
+            pJob->bFirstScreen = TRUE;
+        }
+        PieceTableFree(&prefix);
+    }
+    
+    if (nTab == g_AppState.nCurrentTab) {
+        RequestFrame(hwnd, FRAME_DIRTY_STATUS);
+    }
+}
+
+/* WM_FILELOAD_DONE: move the decoded text into the tab's document */
+void FinishFileLoad(HWND hwnd, FileLoadJob* pJob) {
+    int nTab = FindLoadingTab(pJob);
+    TabState* pTab;
+    
+    /* Wait for the thread to exit; it has nothing left to do */
+    WaitForSingleObject(pJob->hThread, INFINITE);
+    
+    if (nTab < 0) {
+        /* Cancelled: the tab was closed or reused */
+        FreeFileLoadJob(pJob);
+        return;
+    }
+    
+    pTab = GetTab(nTab);
+    SendMessage(pTab->hwndEdit, EM_SETREADONLY, FALSE, 0);
+    
+    /* Whatever the outcome, the old history no longer applies */
+    UndoJournalClear(&pTab->undo);
+    
+    if (pJob->bOk && pJob->bLarge) {
+        /* Mapping a file is quick, so the viewer is set up right here */
+        pJob->bOk = ReadLargeFile(pTab, pJob->szFileName, pJob->nEncoding);
+    } else if (pJob->bOk) {
+        BOOL bLoaded;
+        
+        if (pJob->pMapped) {
+            /* The mapped file is the document's original buffer, unmapped with it */
+            bLoaded = PieceTableLoad(&pTab->doc, (const TextUnit*)pJob->pMapped->pText, pJob->nWide,
+                                     ReleaseMappedText, pJob->pMapped);
+            pJob->pMapped = NULL;
+        } else {
+            /* Decoded buffer becomes the document's original buffer (no copy) */
+            bLoaded = PieceTableLoad(&pTab->doc, (const TextUnit*)pJob->pWide, pJob->nWide,
+                                     pJob->pWide ? ReleaseHeapText : NULL, NULL);
+            pJob->pWide = NULL;
+        }
+        
+        /* The document owns the buffer now (it is released on failure too) */
+        
+        if (bLoaded) {
+            /* Take over the line index unless building it failed */
+            if (pJob->bIndexed) {
+                LineIndexFree(&pTab->lines);
+                pTab->lines = pJob->lines;
+                LineIndexInit(&pJob->lines);
+            } else {
+                LineIndexBuild(&pTab->lines, &pTab->doc);
             }
+            pTab->stats = pJob->stats;
+            pTab->lineEnding = pJob->lineEnding;
+            pTab->nEncoding = pJob->nEncoding;
             
-            if (nConverted > 0) {
-                pWideBuffer[nConverted] = L'\0';
-                SetWindowTextW(hEdit, pWideBuffer);
-            }
+            /* Feed the edit control from the document */
+            FeedEditFromDocument(pTab->hwndEdit, &pTab->doc);
             
-            HeapFree(GetProcessHeap(), 0, pWideBuffer);
+            /* Move cursor to beginning */
+            SendMessage(pTab->hwndEdit, EM_SETSEL, 0, 0);
+            SendMessage(pTab->hwndEdit, EM_SCROLLCARET, 0, 0);
+        } else {
+            pJob->bOk = FALSE;
         }
-    } else {
-        /* Last resort: set as ANSI directly */
-        SetWindowTextA(hEdit, pText);
     }
     
-    HeapFree(GetProcessHeap(), 0, pBuffer);
+    if (!pJob->bOk) {
+        /* Leave an empty untitled tab behind */
+        PieceTableLoad(&pTab->doc, NULL, 0, NULL, NULL);
+        LineIndexBuild(&pTab->lines, &pTab->doc);
+        DocStatsInit(&pTab->stats);
+        FeedEditFromDocument(pTab->hwndEdit, &pTab->doc);
+        pTab->szFileName[0] = TEXT('\0');
+        pTab->bUntitled = TRUE;
+        pTab->nEncoding = TEXT_ENCODING_UTF8;
+    }
+    
+    /* Only now, so feeding the control above is not taken for an edit */
+    pTab->pLoad = NULL;
+    pTab->bModified = FALSE;
     
-    /* Move cursor to beginning */
-    SendMessage(hEdit, EM_SETSEL, 0, 0);
-    SendMessage(hEdit, EM_SCROLLCARET, 0, 0);
+    /* A file reopened for recovery gets its journaled edits back */
+    if (pTab->bReplayJournal) {
+        FinishTabRecovery(hwnd, pTab, pJob->bOk);
+    }
     
-    return TRUE;
+    /* A tab reopened from the last session goes back to where it was */
+    if (pJob->bOk) {
+        RestoreTabPosition(pTab);
+    }
+    pTab->savedPos.bValid = FALSE;
+    
+    /* A file opened from Find in Files shows the line that matched */
+    if (pJob->bOk && pTab->nGotoLine) {
+        GoToDocumentLine(pTab, pTab->nGotoLine);
+    }
+    pTab->nGotoLine = 0;
+    NoteSessionTab(nTab);
+    
+    /* A file that finished opening in the background can hibernate from now on */
+    ScheduleHibernation(hwnd);
+    
+    /* Update titles */
+    UpdateTabTitle(nTab);
+    if (nTab == g_AppState.nCurrentTab) {
+        UpdateWindowTitle(hwnd);
+        RequestFrame(hwnd, FRAME_DIRTY_GUTTER | FRAME_DIRTY_STATUS);
+        
+        /* Force redraw (a large file replaces the edit control with a viewer) */
+        InvalidateRect(pTab->hwndEdit, NULL, TRUE);
+        UpdateWindow(pTab->hwndEdit);
+    }
+    
+    if (!pJob->bOk && pJob->bNoViewer) {
+        ShowErrorDialog(hwnd, TEXT("File is too large to edit, and the large file viewer reads only UTF-8 and ANSI text."));
+    } else if (!pJob->bOk) {
+        ShowErrorDialog(hwnd, pJob->bTooLarge ? TEXT("File is too large to open on this system.")
+                                              : TEXT("Failed to open file."));
+    }
+    
+    FreeFileLoadJob(pJob);
 }
 
-/* UTF-8 BOM bytes */
-static const unsigned char UTF8_BOM[] = {0xEF, 0xBB, 0xBF};
+/* Stop a tab's load; the job is freed when its WM_FILELOAD_DONE arrives */
+void CancelFileLoad(TabState* pTab) {
+    if (!pTab->pLoad) return;
+    
+    FileLoadCancel(&pTab->pLoad->load);
+    pTab->pLoad = NULL;
+    SendMessage(pTab->hwndEdit, EM_SETREADONLY, FALSE, 0);
+}
 
-/* Write edit control content to file with UTF-8 encoding */
-BOOL WriteFileContent(HWND hEdit, const TCHAR* szFileName) {
-    HANDLE hFile;
-    DWORD dwBytesWritten;
-    WCHAR* pWideBuffer;
-    char* pUtf8Buffer;
-    int nWideLen, nUtf8Len;
+/* Stop a tab's load and wait for its worker (when no more messages will be handled) */
+void AbortFileLoad(TabState* pTab) {
+    FileLoadJob* pJob = pTab->pLoad;
+    
+    if (!pJob) return;
     
-    hFile = CreateFile(szFileName, GENERIC_WRITE, 0, NULL,
-                       CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
-    if (hFile == INVALID_HANDLE_VALUE) {
+    CancelFileLoad(pTab);
+    FreeFileLoadJob(pJob);
+}
+
+/* Share of a loading tab's text decoded so far */
+int GetFileLoadPercent(const TabState* pTab) {
+    return pTab->pLoad ? FileLoadPercent(&pTab->pLoad->load) : 100;
+}
+
+/* Open a file detected as nEncoding in the read-only large file viewer, replacing the tab's edit control */
+BOOL ReadLargeFile(TabState* pTab, const TCHAR* szFileName, int nEncoding) {
+    HWND hwndParent = GetParent(pTab->hwndEdit);
+    HFONT hFont = (HFONT)SendMessage(pTab->hwndEdit, WM_GETFONT, 0, 0);
+    HWND hwndViewer = CreateLargeFileViewer(hwndParent, szFileName, nEncoding, hFont);
+    const LargeView* pView;
+    
+    if (!hwndViewer) {
         return FALSE;
     }
     
-    /* Get text length */
-    nWideLen = GetWindowTextLengthW(hEdit);
+    /* Detect line endings from the first checkpoint's worth of text */
+    pView = GetLargeFileView(hwndViewer);
+    pTab->lineEnding = DetectLineEnding((const char*)pView->pData,
+                                        (size_t)(pView->nSize < LARGE_VIEW_CHECKPOINT ?
+                                                 pView->nSize : LARGE_VIEW_CHECKPOINT));
+    pTab->nEncoding = nEncoding;
+    
+    /* The viewer draws its own line numbers */
+    if (pTab->lineNumState.hwndLineNumbers) {
+        DestroyWindow(pTab->lineNumState.hwndLineNumbers);
+        pTab->lineNumState.hwndLineNumbers = NULL;
+    }
     
-    /* Write UTF-8 BOM first */
-    WriteFile(hFile, UTF8_BOM, sizeof(UTF8_BOM), &dwBytesWritten, NULL);
+    DestroyWindow(pTab->hwndEdit);
+    pTab->hwndEdit = hwndViewer;
+    pTab->bRichEdit = FALSE;
+    pTab->bLargeFile = TRUE;
     
-    if (nWideLen > 0) {
-        /* Allocate buffer for wide string */
-        pWideBuffer = (WCHAR*)HeapAlloc(GetProcessHeap(), 0, (nWideLen + 1) * sizeof(WCHAR));
-        if (!pWideBuffer) {
-            CloseHandle(hFile);
-            return FALSE;
-        }
+    /* A background load may finish while another tab is showing */
+    if (pTab == GetCurrentTabState()) {
+        ShowWindow(hwndViewer, SW_SHOW);
+        RepositionControls(hwndParent);
+        SetFocus(hwndViewer);
+    }
+    
+    return TRUE;
+}
+
+/* Copy a large file tab's bytes unchanged to a new file */
+BOOL WriteLargeFile(const TabState* pTab, const TCHAR* szFileName) {
+    const LargeView* pView = GetLargeFileView(pTab->hwndEdit);
+    if (!pView) return FALSE;
+    return SaveBytes(pView->pData, pView->nSize, szFileName) ? TRUE : FALSE;
+}
+
+/* Encoding a document in nEncoding is saved in: text from the ANSI code page is saved as UTF-8 */
+static int SavedEncoding(int nEncoding) {
+    return nEncoding == TEXT_ENCODING_ANSI ? TEXT_ENCODING_UTF8 : nEncoding;
+}
+
+/*
+ * Windows will not replace a file that is mapped, so before one is saved
+ * over, any document still using its text where it lies takes a copy.
+ */
+static BOOL UnmapDocumentsOf(const TCHAR* szFileName) {
+    for (int i = 0; i < GetTabCount(); i++) {
+        PieceTable* pDoc = &GetTab(i)->doc;
+        const MappedText* pMapped = (const MappedText*)pDoc->pReleaseContext;
+        WCHAR* pCopy;
         
-        GetWindowTextW(hEdit, pWideBuffer, nWideLen + 1);
+        if (pDoc->pfnRelease != ReleaseMappedText || _tcsicmp(pMapped->szFileName, szFileName) != 0) continue;
         
-        /* Convert wide string to UTF-8 */
-        nUtf8Len = WideCharToMultiByte(CP_UTF8, 0, pWideBuffer, nWideLen, NULL, 0, NULL, NULL);
-        if (nUtf8Len > 0) {
-            pUtf8Buffer = (char*)HeapAlloc(GetProcessHeap(), 0, nUtf8Len);
-            if (pUtf8Buffer) {
-                WideCharToMultiByte(CP_UTF8, 0, pWideBuffer, nWideLen, pUtf8Buffer, nUtf8Len, NULL, NULL);
-                WriteFile(hFile, pUtf8Buffer, nUtf8Len, &dwBytesWritten, NULL);
-                HeapFree(GetProcessHeap(), 0, pUtf8Buffer);
-            }
-        }
+        /* Mapped files are never empty */
+        pCopy = (WCHAR*)HeapAlloc(GetProcessHeap(), 0, pDoc->nOriginalLen * sizeof(WCHAR));
+        if (!pCopy) return FALSE;
+        memcpy(pCopy, pDoc->pOriginal, pDoc->nOriginalLen * sizeof(WCHAR));
+        PieceTableMoveOriginal(pDoc, (const TextUnit*)pCopy, ReleaseHeapText, NULL);
+    }
+    return TRUE;
+}
+
+/*
+ * A large file viewer keeps its file mapped for as long as its tab is
+ * open, and its rows are read from the mapping on every paint, so it
+ * cannot take a copy the way a document does: saving over that file is
+ * refused instead (TRUE if pTab may write szFileName).
+ */
+static BOOL CheckViewersOf(HWND hwnd, const TabState* pTab, const TCHAR* szFileName) {
+    for (int i = 0; i < GetTabCount(); i++) {
+        const TabState* pViewer = GetTab(i);
+        if (pViewer == pTab || !pViewer->bLargeFile || _tcsicmp(pViewer->szFileName, szFileName) != 0) continue;
         
-        HeapFree(GetProcessHeap(), 0, pWideBuffer);
+        ShowErrorDialog(hwnd, TEXT("This file is open in a read-only viewer tab. Close that tab, then save again."));
+        return FALSE;
     }
-    
-    CloseHandle(hFile);
     return TRUE;
 }
 
+/* Write document content to file with a BOM (temp file, then atomic replace) */
+BOOL WriteFileContent(const PieceTable* pDoc, int nEncoding, const TCHAR* szFileName) {
+    if (!UnmapDocumentsOf(szFileName)) return FALSE;
+    return SaveDocument(pDoc, szFileName, SavedEncoding(nEncoding), TRUE) ? TRUE : FALSE;
+}
+
 /* Create new document in current tab */
 BOOL FileNew(HWND hwnd) {
     TabState* pTab = GetCurrentTabState();
@@ -227,16 +625,41 @@ BOOL FileNew(HWND hwnd) {
         }
     }
     
-    /* Clear edit control */
-    SetWindowText(pTab->hwndEdit, TEXT(""));
+    /* Drop a load or search still in progress */
+    CancelFileLoad(pTab);
+    CancelFindInFiles(pTab);
+    
+    /* Reset tab state, keeping its windows */
+    HWND hwndEdit = pTab->hwndEdit;
+    BOOL bRichEdit = pTab->bRichEdit;
+    BOOL bLargeFile = pTab->bLargeFile;
+    LineNumberState lineNumState = pTab->lineNumState;
     
-    /* Reset tab state */
+    DiscardTabJournal(pTab);
+    PieceTableFree(&pTab->doc);
+    LineIndexFree(&pTab->lines);
+    UndoJournalFree(&pTab->undo);
     InitTabState(pTab);
-    pTab->hwndEdit = GetCurrentEdit(); /* Keep the edit control */
+    pTab->hwndEdit = hwndEdit;
+    pTab->bRichEdit = bRichEdit;
+    pTab->lineNumState = lineNumState;
+    
+    if (bLargeFile) {
+        /* Swap the read-only viewer back for an edit control */
+        RecreateEditControl(hwnd, g_AppState.nCurrentTab, g_AppState.bWordWrap);
+        SwitchToTab(hwnd, g_AppState.nCurrentTab);
+    } else {
+        /* Clear edit control */
+        FeedEditFromDocument(pTab->hwndEdit, &pTab->doc);
+    }
     
     /* Update tab and window title */
     UpdateTabTitle(g_AppState.nCurrentTab);
     UpdateWindowTitle(hwnd);
+    RequestFrame(hwnd, FRAME_DIRTY_GUTTER | FRAME_DIRTY_STATUS);
+    
+    /* An untitled tab is not reopened next launch */
+    NoteSessionTab(g_AppState.nCurrentTab);
     
     return TRUE;
 }
@@ -256,40 +679,29 @@ BOOL FileOpen(HWND hwnd) {
     pTab = GetCurrentTabState();
     
     /* If current tab is untitled and unmodified, use it; otherwise create new tab */
-    if (!pTab || !pTab->bUntitled || pTab->bModified) {
+    if (!pTab || !pTab->bUntitled || pTab->bModified || pTab->bFindResults) {
         int nNewTab = AddNewTab(hwnd, TEXT("Loading..."));
         if (nNewTab < 0) return FALSE;
     }
     
-    /* Get the edit control handle directly */
+    /* Get tab state again after potential tab creation */
+    pTab = GetCurrentTabState();
     hwndEdit = GetCurrentEdit();
-    if (!hwndEdit) {
+    if (!pTab || !hwndEdit) {
         ShowErrorDialog(hwnd, TEXT("Failed to get edit control."));
         return FALSE;
     }
     
-    /* Read file content */
-    if (!ReadFileContent(hwndEdit, szFileName)) {
+    /* Read the file on a worker thread; FinishFileLoad completes the open */
+    if (!BeginFileLoad(hwnd, pTab, szFileName)) {
         ShowErrorDialog(hwnd, TEXT("Failed to open file."));
         return FALSE;
     }
     
-    /* Get tab state again after potential tab creation */
-    pTab = GetCurrentTabState();
-    if (!pTab) return FALSE;
-    
-    /* Update tab state */
-    _tcscpy(pTab->szFileName, szFileName);
-    pTab->bModified = FALSE;
-    pTab->bUntitled = FALSE;
-    
     /* Update titles */
     UpdateTabTitle(g_AppState.nCurrentTab);
     UpdateWindowTitle(hwnd);
-    
-    /* Force redraw */
-    InvalidateRect(hwndEdit, NULL, TRUE);
-    UpdateWindow(hwndEdit);
+    RequestFrame(hwnd, FRAME_DIRTY_STATUS);
     
     return TRUE;
 }
@@ -299,17 +711,34 @@ BOOL FileSave(HWND hwnd) {
     TabState* pTab = GetCurrentTabState();
     if (!pTab) return FALSE;
     
+    /* Nothing to save until the text has loaded */
+    if (pTab->pLoad) {
+        return FALSE;
+    }
+    
     if (pTab->bUntitled) {
         return FileSaveAs(hwnd);
     }
     
-    if (!WriteFileContent(pTab->hwndEdit, pTab->szFileName)) {
+    /* The large file viewer is read-only: the file on disk is already current */
+    if (pTab->bLargeFile) {
+        return TRUE;
+    }
+    
+    if (!CheckViewersOf(hwnd, pTab, pTab->szFileName)) {
+        return FALSE;
+    }
+    
+    if (!WriteFileContent(&pTab->doc, pTab->nEncoding, pTab->szFileName)) {
         ShowErrorDialog(hwnd, TEXT("Failed to save file."));
         return FALSE;
     }
     
+    pTab->nEncoding = SavedEncoding(pTab->nEncoding);
     pTab->bModified = FALSE;
+    DiscardTabJournal(pTab);
     UpdateTabTitle(g_AppState.nCurrentTab);
+    RequestFrame(hwnd, FRAME_DIRTY_STATUS);
     
     return TRUE;
 }
@@ -319,7 +748,7 @@ BOOL FileSaveAs(HWND hwnd) {
     TCHAR szFileName[MAX_PATH];
     TabState* pTab = GetCurrentTabState();
     
-    if (!pTab) return FALSE;
+    if (!pTab || pTab->pLoad) return FALSE;
     
     if (pTab->bUntitled) {
         _tcscpy(szFileName, TEXT("Untitled.txt"));
@@ -331,17 +760,32 @@ BOOL FileSaveAs(HWND hwnd) {
         return FALSE;
     }
     
-    if (!WriteFileContent(pTab->hwndEdit, szFileName)) {
+    if (!CheckViewersOf(hwnd, pTab, szFileName)) {
+        return FALSE;
+    }
+    
+    /* A viewer saved onto its own file: the bytes are already there */
+    if (pTab->bLargeFile && _tcsicmp(pTab->szFileName, szFileName) == 0) {
+        return TRUE;
+    }
+    
+    if (pTab->bLargeFile ? !WriteLargeFile(pTab, szFileName)
+                         : !WriteFileContent(&pTab->doc, pTab->nEncoding, szFileName)) {
         ShowErrorDialog(hwnd, TEXT("Failed to save file."));
         return FALSE;
     }
     
+    if (!pTab->bLargeFile) pTab->nEncoding = SavedEncoding(pTab->nEncoding);
     _tcscpy(pTab->szFileName, szFileName);
     pTab->bModified = FALSE;
     pTab->bUntitled = FALSE;
+    DiscardTabJournal(pTab);
     
+    /* The file type shown in the status bar follows the new name */
     UpdateTabTitle(g_AppState.nCurrentTab);
     UpdateWindowTitle(hwnd);
+    RequestFrame(hwnd, FRAME_DIRTY_STATUS);
+    NoteSessionTab(g_AppState.nCurrentTab);
     
     return TRUE;
 }
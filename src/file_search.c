@@ -0,0 +1,523 @@
+#include "file_search.h"
+#include "text_scan.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* The cancel and limit flags are shared with other threads */
+#if defined(__GNUC__)
+#define SET_FLAG(p) __atomic_store_n((p), 1, __ATOMIC_RELAXED)
+#define TEST_FLAG(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#else
+#define SET_FLAG(p) (*(volatile int*)(p) = 1)
+#define TEST_FLAG(p) (*(const volatile int*)(p))
+#endif
+
+/* FileSearchCancel cannot wake a waiting thread, so waits recheck the flags this often */
+#define FILE_SEARCH_POLL_MS 50
+
+/* Worker thread and its own copies of the regular expression (they are not thread-safe) */
+struct FileSearchWorker {
+    FileSearch* pSearch;
+    WorkerThread thread;
+    RegexSearch reUtf8;
+    RegexSearch reLatin1;
+    int bReUtf8;                 /* reUtf8 is compiled */
+    int bReLatin1;
+    FileSearchHit hits[FILE_SEARCH_BATCH]; /* Lines not yet handed to the callback */
+    size_t nHits;
+};
+
+/* Directories still to be listed, deepest last */
+typedef struct {
+    FileSearch* pSearch;
+    const PathChar* szDir;       /* Directory being listed */
+    PathChar** ppStack;
+    size_t nStack;
+    size_t nCapacity;
+    int bFailed;                 /* Out of memory */
+} TreeWalk;
+
+static int IsStopping(const FileSearch* pSearch) {
+    return TEST_FLAG(&pSearch->bCancel) || TEST_FLAG(&pSearch->bLimited);
+}
+
+static size_t PathLength(const PathChar* szPath) {
+    size_t n = 0;
+    while (szPath[n]) n++;
+    return n;
+}
+
+/* szDir and szName joined by a separator (szName may be NULL for a copy of szDir) */
+static PathChar* PathJoin(const PathChar* szDir, const PathChar* szName) {
+    size_t nDir = PathLength(szDir);
+    size_t nName = szName ? PathLength(szName) : 0;
+    PathChar* szPath = (PathChar*)malloc((nDir + nName + 2) * sizeof(PathChar));
+
+    if (!szPath) return NULL;
+    memcpy(szPath, szDir, nDir * sizeof(PathChar));
+    if (szName) {
+        if (nDir > 0 && szDir[nDir - 1] != PATH_SEPARATOR && szDir[nDir - 1] != '/') {
+            szPath[nDir++] = PATH_SEPARATOR;
+        }
+        memcpy(szPath + nDir, szName, nName * sizeof(PathChar));
+    }
+    szPath[nDir + nName] = 0;
+    return szPath;
+}
+
+/* Whether the text is valid UTF-8 (a sequence cut off by the end is allowed if bCut) */
+static int IsUtf8(const uint8_t* p, size_t n, int bCut) {
+    size_t i = 0;
+
+    while (i < n) {
+        uint8_t c = p[i];
+        size_t nMore;
+        uint32_t cp, cpMin;
+
+        if (c < 0x80) {
+            i++;
+            continue;
+        }
+        if (c >= 0xC2 && c <= 0xDF) {
+            nMore = 1, cp = c & 0x1F, cpMin = 0x80;
+        } else if ((c & 0xF0) == 0xE0) {
+            nMore = 2, cp = c & 0x0F, cpMin = 0x800;
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            nMore = 3, cp = c & 0x07, cpMin = 0x10000;
+        } else {
+            return 0;
+        }
+        if (n - i - 1 < nMore) {
+            for (size_t k = i + 1; k < n; k++) {
+                if ((p[k] & 0xC0) != 0x80) return 0;
+            }
+            return bCut;
+        }
+        for (size_t k = 1; k <= nMore; k++) {
+            if ((p[i + k] & 0xC0) != 0x80) return 0;
+            cp = (cp << 6) | (p[i + k] & 0x3F);
+        }
+        if (cp < cpMin || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) return 0;
+        i += 1 + nMore;
+    }
+    return 1;
+}
+
+/* Queue a file for the workers, waiting while the queue is full (takes szPath; zero when stopping) */
+static int QueuePath(FileSearch* pSearch, PathChar* szPath) {
+    WorkerSignalLock(&pSearch->queue);
+    while (pSearch->nQueued == FILE_SEARCH_QUEUE && !IsStopping(pSearch)) {
+        WorkerSignalWait(&pSearch->queue, FILE_SEARCH_POLL_MS);
+    }
+    if (IsStopping(pSearch)) {
+        WorkerSignalUnlock(&pSearch->queue);
+        free(szPath);
+        return 0;
+    }
+    pSearch->queued[(pSearch->nQueueHead + pSearch->nQueued) % FILE_SEARCH_QUEUE] = szPath;
+    /* Workers only wait on an empty queue */
+    if (pSearch->nQueued++ == 0) WorkerSignalNotify(&pSearch->queue);
+    WorkerSignalUnlock(&pSearch->queue);
+    return 1;
+}
+
+/* Next file to search (NULL once the walk is done and the queue empty, or when stopping) */
+static PathChar* TakePath(FileSearch* pSearch) {
+    PathChar* szPath = NULL;
+
+    WorkerSignalLock(&pSearch->queue);
+    while (pSearch->nQueued == 0 && !pSearch->bWalkDone && !IsStopping(pSearch)) {
+        WorkerSignalWait(&pSearch->queue, FILE_SEARCH_POLL_MS);
+    }
+    if (pSearch->nQueued > 0 && !IsStopping(pSearch)) {
+        szPath = pSearch->queued[pSearch->nQueueHead];
+        pSearch->nQueueHead = (pSearch->nQueueHead + 1) % FILE_SEARCH_QUEUE;
+        /* The walker only waits on a full queue */
+        if (pSearch->nQueued-- == FILE_SEARCH_QUEUE) WorkerSignalNotify(&pSearch->queue);
+    }
+    WorkerSignalUnlock(&pSearch->queue);
+    return szPath;
+}
+
+/* Add one file's outcome to the totals */
+static void CountFile(FileSearch* pSearch, uint64_t nBytes, int bMatched, int bBinary, int bError) {
+    WorkerSignalLock(&pSearch->output);
+    if (bError) {
+        pSearch->stats.nErrors++;
+    } else if (bBinary) {
+        pSearch->stats.nBinary++;
+    } else {
+        pSearch->stats.nFiles++;
+        pSearch->stats.nBytes += nBytes;
+        if (bMatched) pSearch->stats.nFilesMatched++;
+    }
+    WorkerSignalUnlock(&pSearch->output);
+}
+
+/* Hand the worker's pending lines to the callback, up to the search's limit */
+static void FlushHits(FileSearchWorker* pWorker, const PathChar* szPath, int bLatin1) {
+    FileSearch* pSearch = pWorker->pSearch;
+    size_t nHits = pWorker->nHits;
+
+    pWorker->nHits = 0;
+    if (nHits == 0) return;
+
+    WorkerSignalLock(&pSearch->output);
+    if (!TEST_FLAG(&pSearch->bCancel) && !TEST_FLAG(&pSearch->bLimited)) {
+        if (pSearch->nMaxHits) {
+            uint64_t nRoom = pSearch->stats.nHits < pSearch->nMaxHits ? pSearch->nMaxHits - pSearch->stats.nHits : 0;
+            if (nHits >= nRoom) {
+                nHits = (size_t)nRoom;
+                SET_FLAG(&pSearch->bLimited);
+            }
+        }
+        if (nHits > 0) {
+            pSearch->pfnHits(pSearch->pContext, szPath, bLatin1, pWorker->hits, nHits);
+            pSearch->stats.nHits += nHits;
+        }
+    }
+    WorkerSignalUnlock(&pSearch->output);
+}
+
+/* The worker's regular expression for an encoding, compiled on first use */
+static RegexSearch* WorkerRegex(FileSearchWorker* pWorker, int bLatin1) {
+    FileSearch* pSearch = pWorker->pSearch;
+    RegexSearch* pRe = bLatin1 ? &pWorker->reLatin1 : &pWorker->reUtf8;
+    int* pbReady = bLatin1 ? &pWorker->bReLatin1 : &pWorker->bReUtf8;
+    const char* szError;
+
+    if (!*pbReady) {
+        if (!RegexSearchInit(pRe, pSearch->pPattern, pSearch->nPattern,
+                             pSearch->nFlags | (bLatin1 ? TEXT_SEARCH_LATIN1 : 0), &szError)) {
+            return NULL;
+        }
+        *pbReady = 1;
+    }
+    return pRe;
+}
+
+/* Fill in the excerpt of a matching line: all of it, or a window around the match */
+static void SetExcerpt(FileSearchHit* pHit, const uint8_t* pText, size_t nLineStart, size_t nLineEnd,
+                       size_t nAt, int bLatin1) {
+    size_t nStart = nLineStart, nEnd = nLineEnd;
+
+    pHit->bClipped = 0;
+    if (nEnd - nStart > FILE_SEARCH_EXCERPT) {
+        /* Keep a little of the text before the match */
+        if (nAt > nStart + FILE_SEARCH_EXCERPT / 4) nStart = nAt - FILE_SEARCH_EXCERPT / 4;
+        if (nEnd - nStart > FILE_SEARCH_EXCERPT) nEnd = nStart + FILE_SEARCH_EXCERPT;
+        if (!bLatin1) {
+            /* Cut between characters */
+            while (nStart < nEnd && (pText[nStart] & 0xC0) == 0x80) nStart++;
+            while (nEnd > nStart && nEnd < nLineEnd && (pText[nEnd] & 0xC0) == 0x80) nEnd--;
+        }
+        pHit->bClipped = 1;
+    }
+    pHit->pExcerpt = pText + nStart;
+    pHit->nExcerpt = nEnd - nStart;
+}
+
+/*
+ * Report the first match of every line of the text. nBase is where the
+ * text starts in the file. Returns nonzero if anything matched.
+ */
+static int SearchText(FileSearchWorker* pWorker, const PathChar* szPath, const uint8_t* pText, size_t nLen,
+                      uint64_t nBase, int bLatin1) {
+    FileSearch* pSearch = pWorker->pSearch;
+    const TextSearch* pLiteral = bLatin1 ? &pSearch->textLatin1 : &pSearch->textUtf8;
+    RegexSearch* pRe = NULL;
+    TextScan scan;
+    size_t nScanned = 0;         /* Text counted for line numbers */
+    size_t nResume = 0;          /* Start of the line after the last one reported */
+    size_t nFrom = 0;
+    int bMatched = 0;
+
+    if (pSearch->bRegex) {
+        pRe = WorkerRegex(pWorker, bLatin1);
+        if (!pRe) return 0;
+    }
+    TextScanInit(&scan, NULL, NULL);
+
+    while (nFrom < nLen && !IsStopping(pSearch)) {
+        size_t nTo = nLen - nFrom > FILE_SEARCH_CHUNK ? nFrom + FILE_SEARCH_CHUNK : nLen;
+        size_t nAt, nMatchLen, nLineStart, nLineEnd;
+        const uint8_t* pLF;
+        const uint8_t* pCR;
+        FileSearchHit* pHit;
+        int bFound;
+
+        if (pRe) {
+            bFound = RegexSearchBytes(pRe, pText, nLen, nFrom, nTo, &nAt, &nMatchLen);
+        } else {
+            bFound = TextSearchBytes(pLiteral, pText, nLen, nFrom, nTo, &nAt);
+            nMatchLen = pLiteral->nBytes;
+        }
+        if (!bFound) {
+            nFrom = nTo;
+            continue;
+        }
+
+        /* The line the match starts on (an LF after a CR ends the CR's line) */
+        nLineStart = nAt;
+        if (nAt > nResume && pText[nAt] == '\n' && pText[nAt - 1] == '\r') nLineStart--;
+        while (nLineStart > nResume && pText[nLineStart - 1] != '\n' && pText[nLineStart - 1] != '\r') {
+            nLineStart--;
+        }
+        pLF = (const uint8_t*)memchr(pText + nLineStart, '\n', nLen - nLineStart);
+        nLineEnd = pLF ? (size_t)(pLF - pText) : nLen;
+        pCR = (const uint8_t*)memchr(pText + nLineStart, '\r', nLineEnd - nLineStart);
+        if (pCR) nLineEnd = (size_t)(pCR - pText);
+
+        /* Line breaks before it give its number */
+        TextScanBytes(&scan, pText + nScanned, nLineStart - nScanned);
+        nScanned = nLineStart;
+
+        pHit = &pWorker->hits[pWorker->nHits++];
+        pHit->nLine = (uint64_t)(scan.nCR + scan.nLF - scan.nCRLF) + 1;
+        pHit->nOffset = nBase + nAt;
+        pHit->nMatchLen = nMatchLen;
+        SetExcerpt(pHit, pText, nLineStart, nLineEnd, nAt, bLatin1);
+        bMatched = 1;
+        if (pWorker->nHits == FILE_SEARCH_BATCH) FlushHits(pWorker, szPath, bLatin1);
+
+        /* Go on with the next line */
+        nFrom = nLineEnd;
+        if (nFrom < nLen) nFrom += (pText[nFrom] == '\r' && nFrom + 1 < nLen && pText[nFrom + 1] == '\n') ? 2 : 1;
+        nResume = nFrom;
+    }
+
+    FlushHits(pWorker, szPath, bLatin1);
+    return bMatched;
+}
+
+/* Map one file and search it unless it looks binary */
+static void SearchFile(FileSearchWorker* pWorker, const PathChar* szPath) {
+    FileSearch* pSearch = pWorker->pSearch;
+    MappedFile map;
+    const uint8_t* pText;
+    size_t nLen, nProbe, nBom = 0;
+    int bLatin1, bMatched;
+
+    if (!MapFileReadOnly(&map, szPath)) {
+        CountFile(pSearch, 0, 0, 0, 1);
+        return;
+    }
+    if (map.nSize > (uint64_t)SIZE_MAX) {
+        UnmapFile(&map);
+        CountFile(pSearch, 0, 0, 0, 1);
+        return;
+    }
+    pText = map.pData;
+    nLen = (size_t)map.nSize;
+
+    nProbe = nLen < FILE_SEARCH_PROBE ? nLen : FILE_SEARCH_PROBE;
+    if (nProbe > 0 && memchr(pText, 0, nProbe)) {
+        UnmapFile(&map);
+        CountFile(pSearch, 0, 0, 1, 0);
+        return;
+    }
+
+    bLatin1 = !IsUtf8(pText, nProbe, nProbe < nLen);
+    if (!bLatin1 && nLen >= 3 && pText[0] == 0xEF && pText[1] == 0xBB && pText[2] == 0xBF) nBom = 3;
+
+    bMatched = nLen > nBom && SearchText(pWorker, szPath, pText + nBom, nLen - nBom, nBom, bLatin1);
+    UnmapFile(&map);
+    CountFile(pSearch, (uint64_t)nLen, bMatched, 0, 0);
+}
+
+static void SearchWorkerMain(void* pContext) {
+    FileSearchWorker* pWorker = (FileSearchWorker*)pContext;
+    PathChar* szPath;
+
+    while ((szPath = TakePath(pWorker->pSearch)) != NULL) {
+        SearchFile(pWorker, szPath);
+        free(szPath);
+    }
+}
+
+/* Keep a directory to be listed later (takes szPath) */
+static int PushDirectory(TreeWalk* pWalk, PathChar* szPath) {
+    if (pWalk->nStack == pWalk->nCapacity) {
+        size_t nCapacity = pWalk->nCapacity ? pWalk->nCapacity * 2 : 64;
+        PathChar** ppStack = (PathChar**)realloc(pWalk->ppStack, nCapacity * sizeof(PathChar*));
+        if (!ppStack) {
+            free(szPath);
+            pWalk->bFailed = 1;
+            return 0;
+        }
+        pWalk->ppStack = ppStack;
+        pWalk->nCapacity = nCapacity;
+    }
+    pWalk->ppStack[pWalk->nStack++] = szPath;
+    return 1;
+}
+
+/* ListDirectory callback: queue files, keep subdirectories for later */
+static int WalkEntry(void* pContext, const PathChar* szName, int bDirectory) {
+    TreeWalk* pWalk = (TreeWalk*)pContext;
+    PathChar* szPath = PathJoin(pWalk->szDir, szName);
+
+    if (!szPath) {
+        pWalk->bFailed = 1;
+        return 0;
+    }
+    if (!bDirectory) return QueuePath(pWalk->pSearch, szPath);
+    return PushDirectory(pWalk, szPath);
+}
+
+/* List the tree depth first, queueing every file (returns a FILE_SEARCH_ result) */
+static int WalkTree(FileSearch* pSearch) {
+    TreeWalk walk;
+    PathChar* szRoot;
+    int nResult = FILE_SEARCH_OK;
+    int bRoot = 1;
+
+    memset(&walk, 0, sizeof(walk));
+    walk.pSearch = pSearch;
+    szRoot = PathJoin(pSearch->szRoot, NULL);
+    if (!szRoot || !PushDirectory(&walk, szRoot)) return FILE_SEARCH_FAILED;
+
+    while (walk.nStack > 0 && !walk.bFailed && !IsStopping(pSearch)) {
+        PathChar* szDir = walk.ppStack[--walk.nStack];
+
+        walk.szDir = szDir;
+        if (!ListDirectory(szDir, WalkEntry, &walk)) {
+            if (bRoot) {
+                nResult = FILE_SEARCH_NO_FOLDER;
+            } else {
+                CountFile(pSearch, 0, 0, 0, 1);
+            }
+        }
+        bRoot = 0;
+        free(szDir);
+    }
+    if (walk.bFailed) nResult = FILE_SEARCH_FAILED;
+
+    while (walk.nStack > 0) free(walk.ppStack[--walk.nStack]);
+    free(walk.ppStack);
+    return nResult;
+}
+
+/* Compile a pattern for searching under szRoot */
+int FileSearchInit(FileSearch* pSearch, const PathChar* szRoot, const TextUnit* pPattern, size_t nLen,
+                   unsigned nFlags, int bRegex, const char** pszError) {
+    size_t nRoot = PathLength(szRoot);
+
+    memset(pSearch, 0, sizeof(*pSearch));
+    *pszError = "";
+    if (nLen == 0) {
+        *pszError = "empty pattern";
+        return 0;
+    }
+
+    pSearch->nFlags = nFlags & ~TEXT_SEARCH_LATIN1;
+    pSearch->bRegex = bRegex;
+    pSearch->szRoot = (PathChar*)malloc((nRoot + 1) * sizeof(PathChar));
+    pSearch->pPattern = (TextUnit*)malloc(nLen * sizeof(TextUnit));
+    if (!pSearch->szRoot || !pSearch->pPattern) {
+        *pszError = "out of memory";
+        FileSearchFree(pSearch);
+        return 0;
+    }
+    memcpy(pSearch->szRoot, szRoot, (nRoot + 1) * sizeof(PathChar));
+    memcpy(pSearch->pPattern, pPattern, nLen * sizeof(TextUnit));
+    pSearch->nPattern = nLen;
+
+    if (bRegex) {
+        /* Only checked here: every worker compiles its own copy */
+        RegexSearch re;
+        if (!RegexSearchInit(&re, pPattern, nLen, pSearch->nFlags, pszError)) {
+            FileSearchFree(pSearch);
+            return 0;
+        }
+        RegexSearchFree(&re);
+    } else if (!TextSearchInit(&pSearch->textUtf8, pPattern, nLen, pSearch->nFlags) ||
+               !TextSearchInit(&pSearch->textLatin1, pPattern, nLen, pSearch->nFlags | TEXT_SEARCH_LATIN1)) {
+        *pszError = "out of memory";
+        FileSearchFree(pSearch);
+        return 0;
+    }
+    return 1;
+}
+
+void FileSearchFree(FileSearch* pSearch) {
+    TextSearchFree(&pSearch->textUtf8);
+    TextSearchFree(&pSearch->textLatin1);
+    free(pSearch->szRoot);
+    free(pSearch->pPattern);
+    pSearch->szRoot = NULL;
+    pSearch->pPattern = NULL;
+    pSearch->nPattern = 0;
+}
+
+/* Walk the tree here and search it on the worker threads */
+int FileSearchRun(FileSearch* pSearch, int nMaxThreads, FileSearchHitsProc pfnHits, void* pContext) {
+    FileSearchWorker* pWorkers;
+    int nThreads, nStarted = 0, nResult;
+
+    memset(&pSearch->stats, 0, sizeof(pSearch->stats));
+    pSearch->pfnHits = pfnHits;
+    pSearch->pContext = pContext;
+    pSearch->nQueueHead = 0;
+    pSearch->nQueued = 0;
+    pSearch->bWalkDone = 0;
+    pSearch->bLimited = 0;
+
+    nThreads = nMaxThreads;
+    if (nThreads <= 0) {
+        nThreads = ProcessorCount();
+        if (nThreads < FILE_SEARCH_MIN_THREADS) nThreads = FILE_SEARCH_MIN_THREADS;
+    }
+    if (nThreads > FILE_SEARCH_MAX_THREADS) nThreads = FILE_SEARCH_MAX_THREADS;
+    if (nThreads < 1) nThreads = 1;
+
+    if (!WorkerSignalInit(&pSearch->queue)) return FILE_SEARCH_FAILED;
+    if (!WorkerSignalInit(&pSearch->output)) {
+        WorkerSignalFree(&pSearch->queue);
+        return FILE_SEARCH_FAILED;
+    }
+    pWorkers = (FileSearchWorker*)calloc((size_t)nThreads, sizeof(FileSearchWorker));
+    if (pWorkers) {
+        for (nStarted = 0; nStarted < nThreads; nStarted++) {
+            pWorkers[nStarted].pSearch = pSearch;
+            if (!WorkerThreadStart(&pWorkers[nStarted].thread, SearchWorkerMain, &pWorkers[nStarted])) break;
+        }
+    }
+
+    /* The tree is listed while the first files are already being searched */
+    nResult = nStarted > 0 ? WalkTree(pSearch) : FILE_SEARCH_FAILED;
+
+    WorkerSignalLock(&pSearch->queue);
+    pSearch->bWalkDone = 1;
+    WorkerSignalNotify(&pSearch->queue);
+    WorkerSignalUnlock(&pSearch->queue);
+
+    for (int i = 0; i < nStarted; i++) {
+        WorkerThreadJoin(&pWorkers[i].thread);
+        if (pWorkers[i].bReUtf8) RegexSearchFree(&pWorkers[i].reUtf8);
+        if (pWorkers[i].bReLatin1) RegexSearchFree(&pWorkers[i].reLatin1);
+    }
+    free(pWorkers);
+
+    /* Paths left behind by a stopped search */
+    while (pSearch->nQueued > 0) {
+        free(pSearch->queued[pSearch->nQueueHead]);
+        pSearch->nQueueHead = (pSearch->nQueueHead + 1) % FILE_SEARCH_QUEUE;
+        pSearch->nQueued--;
+    }
+    WorkerSignalFree(&pSearch->output);
+    WorkerSignalFree(&pSearch->queue);
+
+    if (nResult == FILE_SEARCH_OK && TEST_FLAG(&pSearch->bCancel)) return FILE_SEARCH_CANCELLED;
+    if (nResult == FILE_SEARCH_OK && TEST_FLAG(&pSearch->bLimited)) return FILE_SEARCH_LIMITED;
+    return nResult;
+}
+
+/* Ask a running search to stop (safe from any thread) */
+void FileSearchCancel(FileSearch* pSearch) {
+    SET_FLAG(&pSearch->bCancel);
+}
+
+int FileSearchIsCancelled(const FileSearch* pSearch) {
+    return TEST_FLAG(&pSearch->bCancel);
+}
@@ -0,0 +1,135 @@
+#ifndef FILE_SEARCH_H
+#define FILE_SEARCH_H
+
+/*
+ * Find in Files: search every file under a folder on a pool of threads.
+ *
+ * Portable C. The calling thread walks the tree and queues the paths it
+ * finds; worker threads take them off the queue, map each file and search
+ * its bytes in place with the TextSearch or RegexSearch kernels, so no file
+ * is ever read into a buffer or decoded. The queue is bounded, which keeps
+ * memory flat however big the tree is, and searching starts as soon as the
+ * first path is queued.
+ *
+ * A file whose first bytes hold a NUL is taken as binary and skipped
+ * (UTF-16 text included). The rest are searched as UTF-8, or as Latin-1 if
+ * those first bytes are not valid UTF-8. Each line is reported once, at its
+ * first match, with its number counted the way the editor counts lines.
+ *
+ * Matching lines are handed to a callback in batches, one call at a time,
+ * while the search goes on. Any thread may cancel a search; workers check
+ * between files and between chunks of a big file.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "platform.h"
+#include "piece_table.h"
+#include "text_search.h"
+#include "regex_search.h"
+
+/* Leading bytes checked for NULs and for valid UTF-8 */
+#define FILE_SEARCH_PROBE (8 * 1024)
+
+/* Bytes searched between checks for cancellation */
+#define FILE_SEARCH_CHUNK (16 * 1024 * 1024)
+
+/* Paths waiting for a worker */
+#define FILE_SEARCH_QUEUE 1024
+
+/* Matching lines per callback */
+#define FILE_SEARCH_BATCH 256
+
+/* Longest excerpt of a matching line handed to the callback, in bytes */
+#define FILE_SEARCH_EXCERPT 400
+
+/*
+ * Fewest and most worker threads one search uses. A page fault on a mapped
+ * file blocks its worker, so a few more workers than processors keep the
+ * disk busy.
+ */
+#define FILE_SEARCH_MIN_THREADS 4
+#define FILE_SEARCH_MAX_THREADS 16
+
+/* FileSearchRun results */
+#define FILE_SEARCH_OK        0  /* Whole tree searched */
+#define FILE_SEARCH_CANCELLED 1  /* Stopped by FileSearchCancel */
+#define FILE_SEARCH_LIMITED   2  /* Stopped after nMaxHits lines */
+#define FILE_SEARCH_NO_FOLDER 3  /* The folder could not be read */
+#define FILE_SEARCH_FAILED    4  /* Out of memory or threads */
+
+/* One matching line */
+typedef struct {
+    uint64_t nLine;              /* Line number, one-based */
+    uint64_t nOffset;            /* Byte offset of the match in the file */
+    size_t nMatchLen;            /* Bytes matched (may be zero for a regular expression) */
+    const uint8_t* pExcerpt;     /* The line, or the part of it around the match */
+    size_t nExcerpt;             /* Bytes in pExcerpt (no line break) */
+    int bClipped;                /* The line was longer than the excerpt */
+} FileSearchHit;
+
+/*
+ * Receives matching lines of one file, in order. pExcerpt points into the
+ * mapped file and is only valid during the call; bLatin1 tells how its
+ * bytes are encoded (otherwise UTF-8). Runs on a worker thread, but never
+ * on two threads at once.
+ */
+typedef void (*FileSearchHitsProc)(void* pContext, const PathChar* szPath, int bLatin1,
+                                   const FileSearchHit* pHits, size_t nHits);
+
+/* What was searched (published under the hit lock, so approximate while running) */
+typedef struct {
+    uint64_t nFiles;             /* Files searched */
+    uint64_t nFilesMatched;      /* Files with at least one match */
+    uint64_t nBinary;            /* Files skipped as binary */
+    uint64_t nErrors;            /* Files or folders that could not be read */
+    uint64_t nBytes;             /* Bytes searched */
+    uint64_t nHits;              /* Matching lines reported */
+} FileSearchStats;
+
+typedef struct FileSearchWorker FileSearchWorker;
+
+/* Search state */
+typedef struct {
+    PathChar* szRoot;            /* Folder searched */
+    TextUnit* pPattern;          /* Pattern as given */
+    size_t nPattern;
+    unsigned nFlags;             /* TEXT_SEARCH_ flags (without TEXT_SEARCH_LATIN1) */
+    int bRegex;                  /* pPattern is a regular expression */
+    TextSearch textUtf8;         /* Literal pattern, shared by the workers */
+    TextSearch textLatin1;
+    uint64_t nMaxHits;           /* Stop after this many lines (0 for no limit) */
+    FileSearchHitsProc pfnHits;
+    void* pContext;
+    FileSearchStats stats;
+    WorkerSignal queue;          /* Guards the path queue */
+    WorkerSignal output;         /* Guards stats and the callback */
+    PathChar* queued[FILE_SEARCH_QUEUE]; /* Ring of paths waiting for a worker */
+    size_t nQueueHead;
+    size_t nQueued;
+    int bWalkDone;               /* No more paths will be queued */
+    int bLimited;                /* nMaxHits was reached */
+    int bCancel;                 /* Cancellation requested */
+} FileSearch;
+
+/*
+ * Compile a pattern for searching under szRoot. nFlags are TEXT_SEARCH_
+ * flags. Returns nonzero on success; on failure *pszError says why.
+ */
+int FileSearchInit(FileSearch* pSearch, const PathChar* szRoot, const TextUnit* pPattern, size_t nLen,
+                   unsigned nFlags, int bRegex, const char** pszError);
+void FileSearchFree(FileSearch* pSearch);
+
+/*
+ * Walk the tree on the calling thread and search it on nMaxThreads
+ * workers (0 for one per processor, but at least FILE_SEARCH_MIN_THREADS).
+ * pfnHits receives the matching lines. Returns one of the FILE_SEARCH_
+ * results.
+ */
+int FileSearchRun(FileSearch* pSearch, int nMaxThreads, FileSearchHitsProc pfnHits, void* pContext);
+
+/* Ask a running search to stop (safe from any thread) */
+void FileSearchCancel(FileSearch* pSearch);
+int FileSearchIsCancelled(const FileSearch* pSearch);
+
+#endif /* FILE_SEARCH_H */
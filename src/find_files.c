@@ -0,0 +1,365 @@
+#include "notepad.h"
+#include "platform.h"
+#include "file_search.h"
+#include <limits.h>
+
+/* Title of a tab listing Find in Files results */
+#define FIND_RESULTS_TITLE TEXT("Find Results")
+
+/* Find in Files search; owned by the main window until WM_FINDFILES_DONE */
+struct FindFilesJob {
+    FileSearch search;           /* Portable walk/search state */
+    HWND hwndNotify;             /* Receives WM_FINDFILES_PROGRESS and WM_FINDFILES_DONE */
+    TabHandle hTab;              /* Tab the results go to */
+    HANDLE hThread;              /* Thread walking the tree (the search adds its own workers) */
+    WorkerSignal lock;           /* Guards pPending */
+    WCHAR* pPending;             /* Result lines not yet added to the tab */
+    size_t nPending;             /* Units in pPending */
+    size_t nPendingCap;          /* Units pPending has room for */
+    int nResult;                 /* FILE_SEARCH_ result, once done */
+    volatile LONG bProgressPosted; /* A progress message is waiting in the queue */
+};
+
+/* Make room for nMore units in the pending text (called with the lock held) */
+static BOOL ReservePending(FindFilesJob* pJob, size_t nMore) {
+    size_t nCap = pJob->nPendingCap ? pJob->nPendingCap : 4096;
+    WCHAR* pNew;
+
+    if (pJob->nPending + nMore <= pJob->nPendingCap) return TRUE;
+    while (nCap < pJob->nPending + nMore) nCap *= 2;
+    pNew = pJob->pPending ? (WCHAR*)HeapReAlloc(GetProcessHeap(), 0, pJob->pPending, nCap * sizeof(WCHAR))
+                          : (WCHAR*)HeapAlloc(GetProcessHeap(), 0, nCap * sizeof(WCHAR));
+    if (!pNew) return FALSE;
+    pJob->pPending = pNew;
+    pJob->nPendingCap = nCap;
+    return TRUE;
+}
+
+/* Search callback (worker thread): format one file's matching lines as path(line): text */
+static void QueueFindResults(void* pContext, const PathChar* szPath, int bLatin1,
+                             const FileSearchHit* pHits, size_t nHits) {
+    FindFilesJob* pJob = (FindFilesJob*)pContext;
+    size_t nPath = wcslen(szPath);
+
+    WorkerSignalLock(&pJob->lock);
+    for (size_t i = 0; i < nHits; i++) {
+        const FileSearchHit* pHit = &pHits[i];
+        WCHAR szLine[32];
+        int nLine = _snwprintf(szLine, 32, L"(%I64u): ", (unsigned long long)pHit->nLine);
+        int nText = 0;
+
+        /* Neither code page makes more units than there are bytes */
+        if (nLine < 0 || !ReservePending(pJob, nPath + (size_t)nLine + pHit->nExcerpt + 5)) {
+            FileSearchCancel(&pJob->search);
+            break;
+        }
+
+        WCHAR* pOut = pJob->pPending + pJob->nPending;
+        memcpy(pOut, szPath, nPath * sizeof(WCHAR));
+        memcpy(pOut + nPath, szLine, (size_t)nLine * sizeof(WCHAR));
+        pOut += nPath + (size_t)nLine;
+
+        /* Latin-1 files open as ANSI, so their lines are shown the same way */
+        if (pHit->nExcerpt > 0) {
+            nText = MultiByteToWideChar(bLatin1 ? CP_ACP : CP_UTF8, 0, (const char*)pHit->pExcerpt,
+                                        (int)pHit->nExcerpt, pOut, (int)pHit->nExcerpt);
+            if (nText < 0) nText = 0;
+        }
+
+        /* A stray NUL would end the text handed to the control */
+        for (int k = 0; k < nText; k++) {
+            if (pOut[k] == L'\0') pOut[k] = L' ';
+        }
+        if (pHit->bClipped) {
+            pOut[nText++] = L'.';
+            pOut[nText++] = L'.';
+            pOut[nText++] = L'.';
+        }
+        pOut[nText++] = L'\r';
+        pOut[nText++] = L'\n';
+        pJob->nPending += nPath + (size_t)nLine + (size_t)nText;
+    }
+    WorkerSignalUnlock(&pJob->lock);
+
+    /* One message in flight at a time is enough */
+    if (!InterlockedExchange(&pJob->bProgressPosted, TRUE)) {
+        PostMessage(pJob->hwndNotify, WM_FINDFILES_PROGRESS, 0, (LPARAM)pJob);
+    }
+}
+
+static DWORD WINAPI FindFilesThreadProc(LPVOID pParam) {
+    FindFilesJob* pJob = (FindFilesJob*)pParam;
+
+    pJob->nResult = FileSearchRun(&pJob->search, 0, QueueFindResults, pJob);
+    PostMessage(pJob->hwndNotify, WM_FINDFILES_DONE, 0, (LPARAM)pJob);
+    return 0;
+}
+
+/* Release a finished job */
+static void FreeFindFilesJob(FindFilesJob* pJob) {
+    if (pJob->hThread) {
+        WaitForSingleObject(pJob->hThread, INFINITE);
+        CloseHandle(pJob->hThread);
+    }
+    FileSearchFree(&pJob->search);
+    WorkerSignalFree(&pJob->lock);
+    if (pJob->pPending) HeapFree(GetProcessHeap(), 0, pJob->pPending);
+    HeapFree(GetProcessHeap(), 0, pJob);
+}
+
+/* Tab that a search belongs to (-1 if it was cancelled: the tab closed, or stopped the search) */
+static int FindSearchingTab(const FindFilesJob* pJob) {
+    const TabState* pTab = (const TabState*)TabRegistryGet(&g_AppState.tabs, pJob->hTab);
+    size_t nIndex;
+
+    if (!pTab || pTab->pFindFiles != pJob || !TabRegistryIndexOf(&g_AppState.tabs, pJob->hTab, &nIndex)) return -1;
+    return (int)nIndex;
+}
+
+/* Add a line of text to a results tab */
+static void AppendResultText(TabState* pTab, const TCHAR* szText) {
+    AppendDocumentText(pTab, (const TextUnit*)szText, _tcslen(szText));
+}
+
+/* Search every file under a folder, listing the matching lines in a new tab */
+BOOL BeginFindInFiles(HWND hwnd, const TCHAR* szFolder, const TCHAR* szWhat, unsigned nFlags) {
+    FindFilesJob* pJob;
+    TabState* pTab;
+    const char* szError = "";
+    TCHAR szText[FIND_TEXT_MAX + MAX_PATH + 32];
+    int nTab;
+
+    if (!szWhat[0]) return FALSE;
+
+    pJob = (FindFilesJob*)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(FindFilesJob));
+    if (!pJob) {
+        ShowErrorDialog(hwnd, TEXT("Not enough memory to search."));
+        return FALSE;
+    }
+    if (!WorkerSignalInit(&pJob->lock)) {
+        HeapFree(GetProcessHeap(), 0, pJob);
+        ShowErrorDialog(hwnd, TEXT("Not enough memory to search."));
+        return FALSE;
+    }
+
+    /* Everything but FIND_REGEX is a TEXT_SEARCH_ flag */
+    if (!FileSearchInit(&pJob->search, szFolder, (const TextUnit*)szWhat, _tcslen(szWhat),
+                        nFlags & ~FIND_REGEX, (nFlags & FIND_REGEX) != 0, &szError)) {
+        TCHAR szMessage[128];
+        _sntprintf(szMessage, 128, (nFlags & FIND_REGEX) ? TEXT("Invalid regular expression: %hs.")
+                                                         : TEXT("Cannot search: %hs."), szError);
+        szMessage[127] = 0;
+        FreeFindFilesJob(pJob);
+        ShowErrorDialog(hwnd, szMessage);
+        return FALSE;
+    }
+    pJob->search.nMaxHits = FIND_FILES_MAX_RESULTS;
+    pJob->hwndNotify = hwnd;
+
+    nTab = AddNewTab(hwnd, FIND_RESULTS_TITLE);
+    if (nTab < 0) {
+        FreeFindFilesJob(pJob);
+        return FALSE;
+    }
+    pTab = GetTab(nTab);
+    pTab->bFindResults = TRUE;
+    pJob->hTab = pTab->hTab;
+
+    _sntprintf(szText, FIND_TEXT_MAX + MAX_PATH + 32, TEXT("Find \"%s\" in %s\r\n\r\n"), szWhat, szFolder);
+    szText[FIND_TEXT_MAX + MAX_PATH + 31] = 0;
+    AppendResultText(pTab, szText);
+
+    pJob->hThread = CreateThread(NULL, 0, FindFilesThreadProc, pJob, 0, NULL);
+    if (!pJob->hThread) {
+        FreeFindFilesJob(pJob);
+        AppendResultText(pTab, TEXT("Search failed.\r\n"));
+        return FALSE;
+    }
+
+    /* Read-only while results are still coming in */
+    pTab->pFindFiles = pJob;
+    SendMessage(pTab->hwndEdit, EM_SETREADONLY, TRUE, 0);
+    UpdateTabTitle(nTab);
+    return TRUE;
+}
+
+/* WM_FINDFILES_PROGRESS: add the lines found since the last message */
+void ShowFindFilesProgress(HWND hwnd, FindFilesJob* pJob) {
+    WCHAR* pText;
+    size_t nText;
+    int nTab;
+
+    InterlockedExchange(&pJob->bProgressPosted, FALSE);
+
+    nTab = FindSearchingTab(pJob);
+    if (nTab < 0) return;
+
+    /* Take the whole buffer; the workers start a new one */
+    WorkerSignalLock(&pJob->lock);
+    pText = pJob->pPending;
+    nText = pJob->nPending;
+    pJob->pPending = NULL;
+    pJob->nPending = 0;
+    pJob->nPendingCap = 0;
+    WorkerSignalUnlock(&pJob->lock);
+
+    if (pText) {
+        AppendDocumentText(GetTab(nTab), (const TextUnit*)pText, nText);
+        HeapFree(GetProcessHeap(), 0, pText);
+    }
+
+    if (nTab == g_AppState.nCurrentTab) {
+        RequestFrame(hwnd, FRAME_DIRTY_GUTTER | FRAME_DIRTY_STATUS);
+    }
+}
+
+/* WM_FINDFILES_DONE: add the last lines and a summary */
+void FinishFindInFiles(HWND hwnd, FindFilesJob* pJob) {
+    const FileSearchStats* pStats = &pJob->search.stats;
+    int nTab = FindSearchingTab(pJob);
+    TCHAR szText[256];
+    TabState* pTab;
+
+    /* Wait for the thread to exit; it has nothing left to do */
+    WaitForSingleObject(pJob->hThread, INFINITE);
+
+    if (nTab < 0) {
+        /* Cancelled: the tab was closed or reused */
+        FreeFindFilesJob(pJob);
+        return;
+    }
+
+    ShowFindFilesProgress(hwnd, pJob);
+    pTab = GetTab(nTab);
+
+    switch (pJob->nResult) {
+        case FILE_SEARCH_NO_FOLDER:
+            _sntprintf(szText, 256, TEXT("The folder could not be read.\r\n"));
+            break;
+        case FILE_SEARCH_FAILED:
+            _sntprintf(szText, 256, TEXT("Search failed: not enough memory.\r\n"));
+            break;
+        default:
+            _sntprintf(szText, 256, TEXT("\r\n%I64u matching lines in %I64u files (%I64u files searched, ")
+                                    TEXT("%I64u binary skipped, %I64u unreadable)%s\r\n"),
+                       (unsigned long long)pStats->nHits, (unsigned long long)pStats->nFilesMatched,
+                       (unsigned long long)pStats->nFiles, (unsigned long long)pStats->nBinary,
+                       (unsigned long long)pStats->nErrors,
+                       pJob->nResult == FILE_SEARCH_CANCELLED ? TEXT(" - search stopped") :
+                       pJob->nResult == FILE_SEARCH_LIMITED ? TEXT(" - too many results, search stopped") : TEXT(""));
+            break;
+    }
+    szText[255] = 0;
+    AppendResultText(pTab, szText);
+
+    pTab->pFindFiles = NULL;
+    SendMessage(pTab->hwndEdit, EM_SETREADONLY, FALSE, 0);
+
+    UpdateTabTitle(nTab);
+    if (nTab == g_AppState.nCurrentTab) {
+        RequestFrame(hwnd, FRAME_DIRTY_GUTTER | FRAME_DIRTY_STATUS);
+    }
+
+    FreeFindFilesJob(pJob);
+}
+
+/* Stop a tab's search, keeping the results found so far */
+void StopFindInFiles(TabState* pTab) {
+    if (pTab->pFindFiles) FileSearchCancel(&pTab->pFindFiles->search);
+}
+
+/* Stop a tab's search; the job is freed when its WM_FINDFILES_DONE arrives */
+void CancelFindInFiles(TabState* pTab) {
+    if (!pTab->pFindFiles) return;
+
+    FileSearchCancel(&pTab->pFindFiles->search);
+    pTab->pFindFiles = NULL;
+    SendMessage(pTab->hwndEdit, EM_SETREADONLY, FALSE, 0);
+}
+
+/* Stop a tab's search and wait for its threads (when no more messages will be handled) */
+void AbortFindInFiles(TabState* pTab) {
+    FindFilesJob* pJob = pTab->pFindFiles;
+
+    if (!pJob) return;
+
+    CancelFindInFiles(pTab);
+    FreeFindFilesJob(pJob);
+}
+
+/* Split a results line "path(line): text" into its path and line number */
+static BOOL ParseFindResult(const WCHAR* pLine, size_t nLen, TCHAR* szPath, size_t* pnLine) {
+    /* A Windows path holds no ':' past its drive, so the first "(digits):" ends it */
+    for (size_t i = 1; i < nLen; i++) {
+        size_t j = i + 1, nNumber = 0;
+
+        if (pLine[i] != L'(') continue;
+        while (j < nLen && pLine[j] >= L'0' && pLine[j] <= L'9' && nNumber < SIZE_MAX / 10 - 9) {
+            nNumber = nNumber * 10 + (size_t)(pLine[j] - L'0');
+            j++;
+        }
+        if (j == i + 1 || j + 1 >= nLen || pLine[j] != L')' || pLine[j + 1] != L':') continue;
+        if (i >= MAX_PATH) return FALSE;
+
+        memcpy(szPath, pLine, i * sizeof(WCHAR));
+        szPath[i] = 0;
+        *pnLine = nNumber;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/* Open the file and line named by the results line under the caret */
+BOOL OpenFindResult(HWND hwnd, TabState* pTab) {
+    TCHAR szPath[MAX_PATH];
+    DWORD dwStart = 0, dwEnd = 0;
+    size_t nLine, nFrom, nTo, nLen, nFileLine;
+    WCHAR* pText;
+    BOOL bParsed;
+    int nTab;
+
+    if (!pTab->bFindResults || pTab->bLargeFile) return FALSE;
+
+    /* The document line under the caret */
+    SendMessage(pTab->hwndEdit, EM_GETSEL, (WPARAM)&dwStart, (LPARAM)&dwEnd);
+    nLine = LineIndexLineFromOffset(&pTab->lines, DocOffsetFromEditPos(pTab, (LONG)dwStart));
+    nFrom = LineIndexLineStart(&pTab->lines, nLine);
+    nTo = (nLine + 1 < LineIndexCount(&pTab->lines)) ? LineIndexLineStart(&pTab->lines, nLine + 1)
+                                                     : PieceTableLength(&pTab->doc);
+
+    pText = (WCHAR*)HeapAlloc(GetProcessHeap(), 0, (nTo - nFrom + 1) * sizeof(WCHAR));
+    if (!pText) return FALSE;
+    nLen = PieceTableCopy(&pTab->doc, nFrom, (TextUnit*)pText, nTo - nFrom);
+    bParsed = ParseFindResult(pText, nLen, szPath, &nFileLine);
+    HeapFree(GetProcessHeap(), 0, pText);
+    if (!bParsed) return FALSE;
+
+    /* Already open: just go to the line */
+    for (nTab = 0; nTab < GetTabCount(); nTab++) {
+        TabState* pOpen = GetTab(nTab);
+        if (pOpen->bUntitled || _tcsicmp(pOpen->szFileName, szPath) != 0) continue;
+
+        SwitchToTab(hwnd, nTab);
+        if (pOpen->pLoad) {
+            pOpen->nGotoLine = nFileLine;
+        } else {
+            GoToDocumentLine(pOpen, nFileLine);
+        }
+        return TRUE;
+    }
+
+    /* Otherwise open it in a new tab; FinishFileLoad goes to the line */
+    nTab = AddNewTab(hwnd, TEXT("Loading..."));
+    if (nTab < 0) return FALSE;
+    pTab = GetTab(nTab);
+    if (!BeginFileLoad(hwnd, pTab, szPath)) {
+        ShowErrorDialog(hwnd, TEXT("Failed to open file."));
+        return FALSE;
+    }
+    pTab->nGotoLine = nFileLine;
+
+    UpdateTabTitle(nTab);
+    UpdateWindowTitle(hwnd);
+    RequestFrame(hwnd, FRAME_DIRTY_STATUS);
+    return TRUE;
+}
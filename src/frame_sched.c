@@ -0,0 +1,40 @@
+#include "frame_sched.h"
+#include <string.h>
+
+void FrameSchedInit(FrameScheduler* pSched) {
+    memset(pSched, 0, sizeof(*pSched));
+}
+
+int FrameSchedInvalidate(FrameScheduler* pSched, unsigned nDirty, uint64_t nNow) {
+    uint64_t nDue = nNow;
+
+    if (nDirty == 0) return FRAME_NO_WAKEUP;
+    pSched->nDirty |= nDirty;
+    if (pSched->bArmed) return FRAME_NO_WAKEUP;
+
+    /* Keep frames apart; after a pause the next one may run at once */
+    if (pSched->bHadFrame && pSched->nLastFrame + FRAME_INTERVAL_MS > nNow) {
+        nDue = pSched->nLastFrame + FRAME_INTERVAL_MS;
+    }
+    pSched->bArmed = 1;
+    pSched->nDueAt = nDue;
+    return (int)(nDue - nNow);
+}
+
+unsigned FrameSchedBeginFrame(FrameScheduler* pSched, uint64_t nNow) {
+    unsigned nDirty = pSched->nDirty;
+
+    /* Work marked while the frame runs goes to the next one */
+    pSched->nDirty = 0;
+    pSched->bArmed = 0;
+    if (nDirty == 0) return 0;
+
+    pSched->nLastFrame = nNow;
+    pSched->bHadFrame = 1;
+    pSched->nFrames++;
+    return nDirty;
+}
+
+int FrameSchedIsIdle(const FrameScheduler* pSched) {
+    return pSched->nDirty == 0 && !pSched->bArmed;
+}
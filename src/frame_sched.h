@@ -0,0 +1,54 @@
+#ifndef FRAME_SCHED_H
+#define FRAME_SCHED_H
+
+/*
+ * Frame scheduler: coalesces UI refresh requests into paced frames.
+ *
+ * Portable C. Callers mark parts of the window dirty as things happen; the
+ * first mark after a frame asks the host for one wakeup, and every mark
+ * until then rides along with it. Frames are at least FRAME_INTERVAL_MS
+ * apart, and with nothing dirty no wakeup is pending at all, so an idle
+ * window costs nothing. Time is passed in by the caller in milliseconds
+ * from any monotonic clock.
+ */
+
+#include <stdint.h>
+
+/* Parts of the window a frame brings up to date */
+#define FRAME_DIRTY_GUTTER 0x01  /* Line number gutter (width and contents) */
+#define FRAME_DIRTY_STATUS 0x02  /* Status bar */
+#define FRAME_DIRTY_LAYOUT 0x04  /* Child window positions */
+#define FRAME_DIRTY_TITLE  0x08  /* Tab and window titles */
+
+/* Shortest time between two frames (about 60 per second) */
+#define FRAME_INTERVAL_MS 16
+
+/* FrameSchedInvalidate result when no new wakeup is needed */
+#define FRAME_NO_WAKEUP (-1)
+
+/* Scheduler state */
+typedef struct {
+    unsigned nDirty;             /* Parts waiting for the next frame */
+    int bArmed;                  /* A wakeup is pending */
+    uint64_t nDueAt;             /* When the pending wakeup is due */
+    uint64_t nLastFrame;         /* When the last frame ran */
+    int bHadFrame;               /* nLastFrame is valid */
+    uint64_t nFrames;            /* Frames run so far */
+} FrameScheduler;
+
+void FrameSchedInit(FrameScheduler* pSched);
+
+/*
+ * Mark parts dirty at time nNow. Returns the delay in milliseconds after
+ * which the host must call FrameSchedBeginFrame, or FRAME_NO_WAKEUP if a
+ * wakeup is already pending (or nDirty is 0).
+ */
+int FrameSchedInvalidate(FrameScheduler* pSched, unsigned nDirty, uint64_t nNow);
+
+/* The wakeup fired: returns the parts to update now and clears them */
+unsigned FrameSchedBeginFrame(FrameScheduler* pSched, uint64_t nNow);
+
+/* Nothing dirty and no wakeup pending */
+int FrameSchedIsIdle(const FrameScheduler* pSched);
+
+#endif /* FRAME_SCHED_H */
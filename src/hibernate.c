@@ -0,0 +1,116 @@
+#include "notepad.h"
+#include "text_pack.h"
+
+/* What a hibernating tab keeps in place of its edit control and document (its position goes in savedPos) */
+struct TabHibernation {
+    TextPack text;               /* Compressed document */
+};
+
+/* Whether a tab can give up its edit control and text */
+static BOOL CanHibernateTab(const TabState* pTab) {
+    size_t nLen = PieceTableLength(&pTab->doc);
+    return pTab->hwndEdit && !pTab->pHibernation && !pTab->bLargeFile && !pTab->pLoad &&
+           !pTab->pFindFiles && nLen >= HIBERNATE_MIN_UNITS && nLen <= HIBERNATE_MAX_UNITS;
+}
+
+/* Compress a tab's text and destroy its edit control (FALSE leaves it as it was) */
+static BOOL HibernateTab(TabState* pTab) {
+    TabHibernation* pHibernation;
+
+    pHibernation = (TabHibernation*)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(TabHibernation));
+    if (!pHibernation) return FALSE;
+    if (!TextPackDocument(&pHibernation->text, &pTab->doc)) {
+        HeapFree(GetProcessHeap(), 0, pHibernation);
+        return FALSE;
+    }
+
+    /* Where the user was, to put them back there on waking */
+    GetTabPosition(pTab, &pTab->savedPos);
+
+    /* The control's copy and the document's copy both go; undo history and stats stay */
+    DestroyWindow(pTab->hwndEdit);
+    pTab->hwndEdit = NULL;
+    PieceTableFree(&pTab->doc);
+    LineIndexFree(&pTab->lines);
+    pTab->pHibernation = pHibernation;
+    return TRUE;
+}
+
+/* Arm TIMER_HIBERNATE for the first background tab to go idle long enough (none: no timer) */
+void ScheduleHibernation(HWND hwnd) {
+    DWORD dwNow = GetTickCount(), dwIdle = g_AppState.nHibernateSeconds * 1000, dwWait = 0;
+    BOOL bAny = FALSE;
+
+    for (int i = 0; g_AppState.bHibernate && i < GetTabCount(); i++) {
+        const TabState* pTab = GetTab(i);
+        DWORD dwSince = dwNow - pTab->dwLastActive, dwLeft;
+        if (i == g_AppState.nCurrentTab || !CanHibernateTab(pTab)) continue;
+        dwLeft = dwSince < dwIdle ? dwIdle - dwSince : 0;
+        if (!bAny || dwLeft < dwWait) dwWait = dwLeft;
+        bAny = TRUE;
+    }
+
+    if (bAny) {
+        SetTimer(hwnd, TIMER_HIBERNATE, dwWait, NULL);
+    } else {
+        KillTimer(hwnd, TIMER_HIBERNATE);
+    }
+}
+
+/* Hibernate a tab that has sat in the background long enough (one per call), then wait for the next */
+void HibernateIdleTabs(HWND hwnd) {
+    DWORD dwNow = GetTickCount();
+
+    KillTimer(hwnd, TIMER_HIBERNATE);
+    for (int i = 0; g_AppState.bHibernate && i < GetTabCount(); i++) {
+        TabState* pTab = GetTab(i);
+        if (i == g_AppState.nCurrentTab || !CanHibernateTab(pTab)) continue;
+        if (dwNow - pTab->dwLastActive < g_AppState.nHibernateSeconds * 1000) continue;
+
+        /* Compressing a big document takes a moment: one tab per timer keeps the window responsive */
+        if (HibernateTab(pTab)) break;
+    }
+    ScheduleHibernation(hwnd);
+}
+
+/* Bring a hibernating tab back: text, edit control and position (FALSE if out of memory) */
+BOOL WakeTab(HWND hwnd, int nTabIndex) {
+    TabState* pTab = GetTab(nTabIndex);
+    TabHibernation* pHibernation = pTab ? pTab->pHibernation : NULL;
+    size_t nLen;
+    TextUnit* pText;
+
+    if (!pHibernation) return TRUE;
+
+    nLen = pHibernation->text.nUnits;
+    pText = (TextUnit*)HeapAlloc(GetProcessHeap(), 0, (nLen ? nLen : 1) * sizeof(TextUnit));
+    if (!pText) return FALSE;
+    if (!TextPackUnpack(&pHibernation->text, pText)) {
+        HeapFree(GetProcessHeap(), 0, pText);
+        return FALSE;
+    }
+
+    /* The text comes back as one buffer, so the document starts out as a single piece */
+    if (!PieceTableLoad(&pTab->doc, pText, nLen, ReleaseHeapText, NULL) ||
+        !LineIndexBuild(&pTab->lines, &pTab->doc)) {
+        PieceTableFree(&pTab->doc);
+        LineIndexFree(&pTab->lines);
+        return FALSE;
+    }
+    pTab->pHibernation = NULL;
+
+    RecreateEditControl(hwnd, nTabIndex, g_AppState.bWordWrap);
+    RestoreTabPosition(pTab);
+
+    TextPackFree(&pHibernation->text);
+    HeapFree(GetProcessHeap(), 0, pHibernation);
+    return TRUE;
+}
+
+/* Drop a hibernating tab's compressed text (the tab is closing) */
+void DiscardHibernation(TabState* pTab) {
+    if (!pTab->pHibernation) return;
+    TextPackFree(&pTab->pHibernation->text);
+    HeapFree(GetProcessHeap(), 0, pTab->pHibernation);
+    pTab->pHibernation = NULL;
+}
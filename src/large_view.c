@@ -0,0 +1,338 @@
+#include "large_view.h"
+#include "line_cache.h"
+#include "text_encoding.h"
+#include "text_scan.h"
+#include "transcode.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Bytes at the start a grown file must still match for its cached index to be kept */
+#define CACHE_SAMPLE (1024 * 1024)
+
+/* How far back a row lookup searches for the start of its line */
+#define LINE_SEEK_BACK (1024 * 1024)
+
+/* The checkpoint count is written by the indexer and read by the UI thread */
+#if defined(__GNUC__)
+#define PUBLISH_SIZE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define ACQUIRE_SIZE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#else
+#define PUBLISH_SIZE(p, v) (*(volatile size_t*)(p) = (v))
+#define ACQUIRE_SIZE(p) (*(const volatile size_t*)(p))
+#endif
+
+static inline int IsBreakByte(uint8_t b) {
+    return b == '\n' || b == '\r';
+}
+
+/*
+ * Line breaks ending at or before nEnd among those starting at or after
+ * nBegin. A CR just before nEnd only counts if no LF follows it, so the
+ * counts of adjacent ranges always add up.
+ */
+static uint64_t CountBreaks(const LargeView* pView, uint64_t nBegin, uint64_t nEnd) {
+    TextScan scan;
+    uint64_t nCount;
+
+    if (nEnd <= nBegin) return 0;
+
+    TextScanInit(&scan, NULL, NULL);
+    TextScanBytes(&scan, pView->pData + nBegin, (size_t)(nEnd - nBegin));
+    nCount = (uint64_t)(scan.nCR + scan.nLF - scan.nCRLF);
+
+    if (scan.bPendingCR && nEnd < pView->nSize && pView->pData[nEnd] == '\n') nCount--;
+    return nCount;
+}
+
+/* Checkpoints of a line cache entry that still hold for the mapped file (0 if none) */
+static size_t UsableCheckpoints(const LargeView* pView, const LineCacheInfo* pInfo) {
+    if (pInfo->nInterval != LARGE_VIEW_CHECKPOINT || pInfo->nSize > pView->nSize || pInfo->bUtf8 != pView->bUtf8 ||
+        pInfo->nCheckpoints != (size_t)(pInfo->nSize / LARGE_VIEW_CHECKPOINT) + 1) {
+        return 0;
+    }
+
+    if (pInfo->nSize == pView->nSize) {
+        if (pInfo->nModified != pView->map.nModified ||
+            pInfo->nSampleHash != LineCacheSampleHash(pView->pData, pView->nSize)) {
+            return 0;
+        }
+        return pInfo->nCheckpoints;
+    }
+
+    /* Grown: the old part must be unchanged, including all of the sample */
+    if (pInfo->nSize < CACHE_SAMPLE || pInfo->nSampleHash != LineCacheSampleHash(pView->pData, pInfo->nSize)) {
+        return 0;
+    }
+
+    /* A checkpoint right at the old end may move: an appended LF can join a CR there */
+    return (size_t)((pInfo->nSize + LARGE_VIEW_CHECKPOINT - 1) / LARGE_VIEW_CHECKPOINT);
+}
+
+/* Take the checkpoints from the line cache (returns nonzero if any were usable) */
+static int LoadCachedIndex(LargeView* pView, const PathChar* szPath, const PathChar* szCacheDir) {
+    LineCacheEntry entry;
+    size_t nUsable;
+
+    if (!LineCacheLookup(szCacheDir, szPath, &entry)) return 0;
+    nUsable = UsableCheckpoints(pView, &entry.info);
+    if (nUsable > 0) {
+        for (size_t k = 0; k < nUsable; k++) pView->pCheckpoints[k] = LineCacheCheckpoint(&entry, k);
+        pView->nReady = nUsable;
+
+        if (nUsable == pView->nCheckpoints && entry.info.nSize == pView->nSize) {
+            pView->nBreaks = entry.info.nBreaks;
+        } else if (nUsable == pView->nCheckpoints) {
+            /* Grown without reaching another checkpoint: only the tail needs counting */
+            uint64_t nLast = (uint64_t)(nUsable - 1) * LARGE_VIEW_CHECKPOINT;
+            pView->nBreaks = pView->pCheckpoints[nUsable - 1] + CountBreaks(pView, nLast, pView->nSize);
+        }
+    }
+    LineCacheRelease(&entry);
+    return nUsable > 0;
+}
+
+/* Map a file and prepare the view (returns nonzero on success) */
+int LargeViewOpen(LargeView* pView, const PathChar* szPath, int nEncoding, const PathChar* szCacheDir) {
+    memset(pView, 0, sizeof(*pView));
+
+    /* Rows are found by their break bytes, which UTF-16 and UTF-32 do not have */
+    if (nEncoding != TEXT_ENCODING_UTF8 && nEncoding != TEXT_ENCODING_ANSI) return 0;
+    if (!MapFileReadOnly(&pView->map, szPath)) return 0;
+
+    pView->pData = pView->map.pData;
+    pView->nSize = pView->map.nSize;
+    pView->bUtf8 = nEncoding == TEXT_ENCODING_UTF8;
+    if (pView->bUtf8 && pView->nSize >= 3 && pView->pData[0] == 0xEF && pView->pData[1] == 0xBB &&
+        pView->pData[2] == 0xBF) {
+        pView->nStart = 3;
+    }
+
+    pView->nCheckpoints = (size_t)(pView->nSize / LARGE_VIEW_CHECKPOINT) + 1;
+    pView->pCheckpoints = (uint64_t*)malloc(pView->nCheckpoints * sizeof(uint64_t));
+    if (!pView->pCheckpoints) {
+        UnmapFile(&pView->map);
+        return 0;
+    }
+
+    if (szCacheDir && LoadCachedIndex(pView, szPath, szCacheDir)) return 1;
+
+    pView->pCheckpoints[0] = 0;
+    pView->nReady = 1;
+
+    /* A file smaller than one checkpoint is indexed on the spot */
+    if (pView->nCheckpoints == 1) pView->nBreaks = CountBreaks(pView, 0, pView->nSize);
+    return 1;
+}
+
+/* Keep the finished index in the line cache */
+int LargeViewSaveIndex(const LargeView* pView, const PathChar* szPath, const PathChar* szCacheDir) {
+    LineCacheInfo info;
+
+    if (ACQUIRE_SIZE(&pView->nReady) < pView->nCheckpoints) return 0;
+
+    info.nSize = pView->nSize;
+    info.nModified = pView->map.nModified;
+    info.nSampleHash = LineCacheSampleHash(pView->pData, pView->nSize);
+    info.nInterval = LARGE_VIEW_CHECKPOINT;
+    info.nStart = pView->nStart;
+    info.bUtf8 = pView->bUtf8;
+    info.nBreaks = pView->nBreaks;
+    info.nCheckpoints = pView->nCheckpoints;
+    return LineCacheStore(szCacheDir, szPath, &info, pView->pCheckpoints, LINE_CACHE_MAX_BYTES);
+}
+
+void LargeViewClose(LargeView* pView) {
+    free(pView->pCheckpoints);
+    UnmapFile(&pView->map);
+    memset(pView, 0, sizeof(*pView));
+}
+
+/* Index up to nBudget more bytes of line checkpoints (returns nonzero when complete) */
+int LargeViewIndexStep(LargeView* pView, uint64_t nBudget) {
+    size_t nReady = pView->nReady;
+    uint64_t nDone = 0;
+
+    while (nReady < pView->nCheckpoints) {
+        uint64_t nBegin = (uint64_t)(nReady - 1) * LARGE_VIEW_CHECKPOINT;
+        uint64_t nEnd = nBegin + LARGE_VIEW_CHECKPOINT;
+
+        if (nDone > 0 && nDone >= nBudget) return 0;
+
+        pView->pCheckpoints[nReady] = pView->pCheckpoints[nReady - 1] + CountBreaks(pView, nBegin, nEnd);
+        nDone += LARGE_VIEW_CHECKPOINT;
+
+        /* The total must be in place before the last checkpoint is published */
+        if (nReady + 1 == pView->nCheckpoints) {
+            pView->nBreaks = pView->pCheckpoints[nReady] + CountBreaks(pView, nEnd, pView->nSize);
+        }
+        PUBLISH_SIZE(&pView->nReady, ++nReady);
+    }
+    return 1;
+}
+
+/* Indexed share of the file in percent */
+int LargeViewIndexPercent(const LargeView* pView) {
+    size_t nReady = ACQUIRE_SIZE(&pView->nReady);
+    if (nReady >= pView->nCheckpoints) return 100;
+    return (int)((uint64_t)nReady * 100 / pView->nCheckpoints);
+}
+
+/* Total lines, if the index is complete */
+int LargeViewLineCount(const LargeView* pView, uint64_t* pnLines) {
+    if (ACQUIRE_SIZE(&pView->nReady) < pView->nCheckpoints) return 0;
+    *pnLines = pView->nBreaks + 1;
+    return 1;
+}
+
+/* Zero-based line holding byte nPos, if indexed that far */
+int LargeViewLineAt(const LargeView* pView, uint64_t nPos, uint64_t* pnLine) {
+    size_t nCheckpoint;
+
+    if (nPos > pView->nSize) nPos = pView->nSize;
+    nCheckpoint = (size_t)(nPos / LARGE_VIEW_CHECKPOINT);
+    if (nCheckpoint >= ACQUIRE_SIZE(&pView->nReady)) return 0;
+
+    *pnLine = pView->pCheckpoints[nCheckpoint] +
+              CountBreaks(pView, (uint64_t)nCheckpoint * LARGE_VIEW_CHECKPOINT, nPos);
+    return 1;
+}
+
+/*
+ * Find where the row starting at nRow ends. Returns the end of its text;
+ * *pnNext receives the next row start (nRow itself for the last row) and
+ * *pbLineEnd whether a line break ends the row.
+ */
+static uint64_t FindRowEnd(const LargeView* pView, uint64_t nRow, uint64_t* pnNext, int* pbLineEnd) {
+    const uint8_t* pData = pView->pData;
+    uint64_t nLimit = nRow + LARGE_VIEW_MAX_ROW;
+    uint64_t nPos;
+
+    if (nLimit > pView->nSize) nLimit = pView->nSize;
+
+    for (nPos = nRow; nPos < nLimit; nPos++) {
+        if (IsBreakByte(pData[nPos])) {
+            uint64_t nNext = nPos + 1;
+            if (pData[nPos] == '\r' && nNext < pView->nSize && pData[nNext] == '\n') nNext++;
+            *pnNext = nNext;
+            *pbLineEnd = 1;
+            return nPos;
+        }
+    }
+
+    *pbLineEnd = 0;
+    if (nLimit == pView->nSize) {
+        /* Last row of the file */
+        *pnNext = nRow;
+        return nLimit;
+    }
+
+    /* Cut an overlong line, keeping UTF-8 sequences whole */
+    if (pView->bUtf8) {
+        uint64_t nCut = nLimit;
+        while (nCut > nRow + 1 && nLimit - nCut < 3 && (pData[nCut] & 0xC0) == 0x80) nCut--;
+        if ((pData[nCut] & 0xC0) != 0x80) nLimit = nCut;
+    }
+    *pnNext = nLimit;
+    return nLimit;
+}
+
+/* Start of the row after the row starting at nRow */
+uint64_t LargeViewNextRow(const LargeView* pView, uint64_t nRow) {
+    uint64_t nNext;
+    int bLineEnd;
+
+    if (nRow >= pView->nSize) return pView->nSize;
+    FindRowEnd(pView, nRow, &nNext, &bLineEnd);
+    return nNext;
+}
+
+/* Start of the row holding byte nPos */
+uint64_t LargeViewRowStart(const LargeView* pView, uint64_t nPos) {
+    const uint8_t* pData = pView->pData;
+    uint64_t nFloor, nLine, nRow;
+
+    if (nPos <= pView->nStart) return pView->nStart;
+    if (nPos > pView->nSize) nPos = pView->nSize;
+
+    /* Between the CR and LF of a CRLF counts as the CR */
+    if (nPos < pView->nSize && pData[nPos] == '\n' && pData[nPos - 1] == '\r') nPos--;
+
+    /* Find the start of the line, looking back a bounded distance */
+    nFloor = (nPos - pView->nStart > LINE_SEEK_BACK) ? nPos - LINE_SEEK_BACK : pView->nStart;
+    for (nLine = nPos; nLine > nFloor && !IsBreakByte(pData[nLine - 1]); nLine--) {
+    }
+
+    /* Very long line: start somewhere on a character boundary */
+    if (nLine == nFloor && nFloor > pView->nStart && !IsBreakByte(pData[nLine - 1]) && pView->bUtf8) {
+        while (nLine < nPos && (pData[nLine] & 0xC0) == 0x80) nLine++;
+    }
+
+    /* Walk the rows of that line up to nPos */
+    nRow = nLine;
+    for (;;) {
+        uint64_t nNext = LargeViewNextRow(pView, nRow);
+        if (nNext == nRow || nNext > nPos) break;
+        nRow = nNext;
+    }
+    return nRow;
+}
+
+/* Start of the row before the row starting at nRow */
+uint64_t LargeViewPrevRow(const LargeView* pView, uint64_t nRow) {
+    if (nRow <= pView->nStart) return pView->nStart;
+    return LargeViewRowStart(pView, nRow - 1);
+}
+
+/* Decode bytes leniently: invalid UTF-8 becomes U+FFFD */
+static size_t DecodeBytes(const LargeView* pView, const uint8_t* pSrc, size_t nSrc,
+                          uint16_t* pDst, size_t nDstSize) {
+    size_t nOut = 0;
+
+    if (!pView->bUtf8) {
+        if (nSrc > nDstSize) nSrc = nDstSize;
+        for (size_t i = 0; i < nSrc; i++) pDst[i] = pSrc[i];
+        return nSrc;
+    }
+
+    while (nSrc > 0 && nOut < nDstSize) {
+        /* UTF-8 never produces more units than bytes */
+        size_t nChunk = (nSrc < nDstSize - nOut) ? nSrc : nDstSize - nOut;
+        size_t nUnits, nBad;
+
+        if (Utf8ToUtf16(pSrc, nChunk, pDst + nOut, &nUnits, &nBad, NULL)) {
+            nOut += nUnits;
+            pSrc += nChunk;
+            nSrc -= nChunk;
+            continue;
+        }
+
+        /* Keep the valid prefix */
+        if (nBad > 0) {
+            size_t nIgnored;
+            Utf8ToUtf16(pSrc, nBad, pDst + nOut, &nUnits, &nIgnored, NULL);
+            nOut += nUnits;
+        }
+
+        /* A sequence cut off by the room left ends the row */
+        if (nChunk < nSrc && nBad + 4 > nChunk) break;
+
+        pSrc += nBad + 1;
+        nSrc -= nBad + 1;
+        if (nOut < nDstSize) pDst[nOut++] = 0xFFFD;
+    }
+    return nOut;
+}
+
+/* Decode the row starting at nRow */
+size_t LargeViewDecodeRow(const LargeView* pView, uint64_t nRow, uint16_t* pDst, size_t nDstSize,
+                          uint64_t* pnNext, int* pbLineEnd) {
+    uint64_t nEnd;
+
+    if (nRow >= pView->nSize) {
+        *pnNext = pView->nSize;
+        *pbLineEnd = 0;
+        return 0;
+    }
+    nEnd = FindRowEnd(pView, nRow, pnNext, pbLineEnd);
+    return DecodeBytes(pView, pView->pData + nRow, (size_t)(nEnd - nRow), pDst, nDstSize);
+}
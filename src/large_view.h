@@ -0,0 +1,87 @@
+#ifndef LARGE_VIEW_H
+#define LARGE_VIEW_H
+
+/*
+ * Read-only paging over a mapped file too large to load into the editor.
+ *
+ * Portable C. The file stays mapped and nothing is decoded up front: the
+ * viewer asks for display rows starting at byte positions and only those
+ * bytes are decoded. Lines longer than LARGE_VIEW_MAX_ROW bytes are cut
+ * into several rows so every step is bounded.
+ *
+ * Line numbers come from a sparse checkpoint index (the number of line
+ * breaks before every LARGE_VIEW_CHECKPOINT bytes) built in steps, usually
+ * on a worker thread, while the viewer is already usable. A single writer
+ * may step the index while other threads read it. A finished index can be
+ * kept in a line cache (see line_cache.h), so reopening the file, or the
+ * file with more appended to it, scans little or nothing.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "platform.h"
+
+/* Bytes between line checkpoints */
+#define LARGE_VIEW_CHECKPOINT (1024 * 1024)
+
+/* Longest display row in bytes (longer lines are cut) */
+#define LARGE_VIEW_MAX_ROW (16 * 1024)
+
+/* Large file view state */
+typedef struct {
+    MappedFile map;              /* Whole file, read-only */
+    const uint8_t* pData;        /* Mapped bytes */
+    uint64_t nSize;              /* File size in bytes */
+    uint64_t nStart;             /* First text byte (after a BOM) */
+    int bUtf8;                   /* Decode as UTF-8 (otherwise bytes are Latin-1) */
+    uint64_t* pCheckpoints;      /* Line breaks before checkpoint k (k * LARGE_VIEW_CHECKPOINT) */
+    size_t nCheckpoints;         /* Checkpoints covering the file, including 0 */
+    size_t nReady;               /* Checkpoints filled in so far (published) */
+    uint64_t nBreaks;            /* Line breaks in the whole file, once indexed */
+} LargeView;
+
+/*
+ * Map a file and prepare the view (returns nonzero on success). nEncoding
+ * is the TEXT_ENCODING_ the file was detected as (see text_encoding.h);
+ * only UTF-8 and ANSI can be paged, and any other fails the open. With a
+ * cache directory, whatever checkpoints the line cache holds for the file
+ * are taken from there; szCacheDir may be NULL.
+ */
+int LargeViewOpen(LargeView* pView, const PathChar* szPath, int nEncoding, const PathChar* szCacheDir);
+void LargeViewClose(LargeView* pView);
+
+/* Keep the finished index in the line cache (returns nonzero if it was written) */
+int LargeViewSaveIndex(const LargeView* pView, const PathChar* szPath, const PathChar* szCacheDir);
+
+/*
+ * Index up to nBudget more bytes of line checkpoints. Returns nonzero once
+ * the whole file is indexed. Only one thread may call this at a time.
+ */
+int LargeViewIndexStep(LargeView* pView, uint64_t nBudget);
+
+/* Indexed share of the file in percent (100 when complete) */
+int LargeViewIndexPercent(const LargeView* pView);
+
+/* Total lines, if the index is complete (returns nonzero if known) */
+int LargeViewLineCount(const LargeView* pView, uint64_t* pnLines);
+
+/* Zero-based line holding byte nPos, if indexed that far (returns nonzero if known) */
+int LargeViewLineAt(const LargeView* pView, uint64_t nPos, uint64_t* pnLine);
+
+/* Start of the row holding byte nPos */
+uint64_t LargeViewRowStart(const LargeView* pView, uint64_t nPos);
+
+/* Start of the row after / before the row starting at nRow (nRow itself at either end) */
+uint64_t LargeViewNextRow(const LargeView* pView, uint64_t nRow);
+uint64_t LargeViewPrevRow(const LargeView* pView, uint64_t nRow);
+
+/*
+ * Decode the row starting at nRow into pDst (at most nDstSize units; the
+ * rest of the row is dropped). Returns the units stored. *pnNext receives
+ * the next row start and *pbLineEnd whether the row ends a line (as
+ * opposed to being cut).
+ */
+size_t LargeViewDecodeRow(const LargeView* pView, uint64_t nRow, uint16_t* pDst, size_t nDstSize,
+                          uint64_t* pnNext, int* pbLineEnd);
+
+#endif /* LARGE_VIEW_H */
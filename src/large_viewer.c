@@ -0,0 +1,685 @@
+#include "notepad.h"
+#include "wrap_layout.h"
+#include <limits.h>
+
+/* Large file viewer window class name */
+static const TCHAR szLargeViewerClassName[] = TEXT("LargeFileViewer");
+
+/* Posted by the index thread once every line checkpoint is in place */
+#define WM_LARGEVIEW_INDEXED (WM_APP + 1)
+
+/* Posted by the index thread when the indexed percentage moves on */
+#define WM_LARGEVIEW_PROGRESS (WM_APP + 2)
+
+/* Line cache folder, under the application data folder */
+#define LINE_CACHE_DIR_NAME L"\\LineCache"
+
+/* Bytes indexed between checks for a stop request */
+#define INDEX_STEP_BYTES (64 * 1024 * 1024)
+
+/* Units of each row decoded for display (a row never has more units than bytes) */
+#define VIEW_ROW_UNITS LARGE_VIEW_MAX_ROW
+
+/* Vertical scroll bar resolution (the thumb maps to a byte position) */
+#define VIEW_SCROLL_RANGE 0x10000
+
+/* Rows per mouse wheel notch */
+#define WHEEL_ROWS 3
+
+/* Gap between the line numbers and the text */
+#define GUTTER_PADDING 8
+
+/* Viewer state, owned by the window */
+typedef struct {
+    LargeView view;              /* Mapped file and line checkpoints */
+    HWND hwnd;                   /* Viewer window */
+    HANDLE hIndexThread;         /* Builds the line checkpoints */
+    volatile LONG bStopIndex;    /* Asks the index thread to stop */
+    WCHAR szFileName[MAX_PATH];  /* File shown */
+    WCHAR szCacheDir[MAX_PATH];  /* Line cache folder (empty if there is none) */
+    HFONT hFont;                 /* Font shared with the edit controls */
+    int nLineHeight;             /* Row height in pixels */
+    int nCharWidth;              /* Average character width in pixels */
+    uint64_t nTop;               /* Byte position of the first visible row */
+    size_t nTopSub;              /* First visible wrapped row of that row */
+    int nLeftCol;                /* First visible column (0 when wrapping) */
+    BOOL bWrap;                  /* Rows wrap at the window width */
+    WrapCache wrap;              /* Wrapped layout of recently shown rows, keyed by byte position */
+    int nWheelDelta;             /* Wheel movement not yet turned into rows */
+    uint64_t nMatchStart;        /* Last Find match in bytes (its row is marked) */
+    BOOL bMatch;                 /* FALSE if there is none */
+    WCHAR szRow[VIEW_ROW_UNITS]; /* Decode buffer for one row */
+} LargeViewer;
+
+static LargeViewer* GetViewer(HWND hwnd) {
+    return (LargeViewer*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+}
+
+/* Index thread: step through the file until done or told to stop */
+static DWORD WINAPI IndexThreadProc(LPVOID pParam) {
+    LargeViewer* pViewer = (LargeViewer*)pParam;
+    int nLastPercent = 0;
+
+    while (!pViewer->bStopIndex) {
+        if (LargeViewIndexStep(&pViewer->view, INDEX_STEP_BYTES)) {
+            /* Also when it all came from the cache: rewriting the entry marks it as recently used */
+            if (pViewer->szCacheDir[0]) {
+                LargeViewSaveIndex(&pViewer->view, pViewer->szFileName, pViewer->szCacheDir);
+            }
+            PostMessage(pViewer->hwnd, WM_LARGEVIEW_INDEXED, 0, 0);
+            break;
+        }
+
+        /* At most a hundred of these, so the status bar needs no polling */
+        int nPercent = LargeViewIndexPercent(&pViewer->view);
+        if (nPercent != nLastPercent) {
+            nLastPercent = nPercent;
+            PostMessage(pViewer->hwnd, WM_LARGEVIEW_PROGRESS, 0, 0);
+        }
+    }
+    return 0;
+}
+
+/* Measure the font */
+static void UpdateFontMetrics(LargeViewer* pViewer) {
+    HDC hdc = GetDC(pViewer->hwnd);
+    HFONT hOldFont = pViewer->hFont ? (HFONT)SelectObject(hdc, pViewer->hFont) : NULL;
+    TEXTMETRIC tm;
+
+    GetTextMetrics(hdc, &tm);
+    pViewer->nLineHeight = tm.tmHeight > 0 ? tm.tmHeight : 16;
+    pViewer->nCharWidth = tm.tmAveCharWidth > 0 ? tm.tmAveCharWidth : 8;
+
+    if (hOldFont) SelectObject(hdc, hOldFont);
+    ReleaseDC(pViewer->hwnd, hdc);
+}
+
+/* Rows that fit in the window */
+static int VisibleRows(const LargeViewer* pViewer) {
+    RECT rc;
+    GetClientRect(pViewer->hwnd, &rc);
+    int nRows = rc.bottom / pViewer->nLineHeight;
+    return nRows > 0 ? nRows : 1;
+}
+
+/* Width of the line number gutter (0 when line numbers are off) */
+static int GutterWidth(const LargeViewer* pViewer) {
+    if (!g_AppState.bShowLineNumbers) return 0;
+
+    /* Until the count is known, size for a guess of 40 bytes per line */
+    uint64_t nLines;
+    if (!LargeViewLineCount(&pViewer->view, &nLines)) nLines = pViewer->view.nSize / 40 + 1;
+    if (nLines > INT_MAX) nLines = INT_MAX;
+    return CalculateLineNumberWidth((int)nLines) + GUTTER_PADDING;
+}
+
+/* Sync the scroll bars with the view position */
+static void UpdateScrollBars(LargeViewer* pViewer) {
+    const LargeView* pView = &pViewer->view;
+    uint64_t nSpan = pView->nSize - pView->nStart;
+    SCROLLINFO si = {0};
+    RECT rc;
+
+    si.cbSize = sizeof(si);
+    si.fMask = SIF_RANGE | SIF_POS | SIF_PAGE;
+    si.nMin = 0;
+    si.nMax = VIEW_SCROLL_RANGE - 1;
+    si.nPage = 0;
+    si.nPos = nSpan ? (int)((pViewer->nTop - pView->nStart) * (double)VIEW_SCROLL_RANGE / nSpan) : 0;
+    if (si.nPos > si.nMax) si.nPos = si.nMax;
+    SetScrollInfo(pViewer->hwnd, SB_VERT, &si, TRUE);
+
+    /* Nothing to scroll sideways when wrapping, which hides the bar */
+    GetClientRect(pViewer->hwnd, &rc);
+    si.nMax = pViewer->bWrap ? 0 : VIEW_ROW_UNITS - 1;
+    si.nPage = pViewer->bWrap ? 1 : (UINT)(rc.right / pViewer->nCharWidth);
+    si.nPos = pViewer->nLeftCol;
+    SetScrollInfo(pViewer->hwnd, SB_HORZ, &si, TRUE);
+}
+
+/* Columns of text that fit beside the gutter (the wrap width) */
+static size_t TextColumns(const LargeViewer* pViewer) {
+    RECT rc;
+    GetClientRect(pViewer->hwnd, &rc);
+    int nCols = (rc.right - GutterWidth(pViewer)) / pViewer->nCharWidth;
+    return nCols > 0 ? (size_t)nCols : 1;
+}
+
+/* Wrapped layout of the row at nRow, decoding it unless cached (NULL when not wrapping) */
+static const WrapLine* WrappedRow(LargeViewer* pViewer, uint64_t nRow) {
+    const WrapLine* pLine;
+    uint64_t nNext;
+    int bLineEnd;
+
+    if (!pViewer->bWrap) return NULL;
+    WrapCacheSetColumns(&pViewer->wrap, TextColumns(pViewer));
+    pLine = WrapCacheFind(&pViewer->wrap, nRow);
+    if (pLine) return pLine;
+
+    size_t nUnits = LargeViewDecodeRow(&pViewer->view, nRow, (uint16_t*)pViewer->szRow, VIEW_ROW_UNITS,
+                                       &nNext, &bLineEnd);
+    return WrapCacheLayout(&pViewer->wrap, nRow, (const TextUnit*)pViewer->szRow, nUnits);
+}
+
+/* Wrapped rows the row at nRow takes (1 when not wrapping) */
+static size_t WrappedRowCount(LargeViewer* pViewer, uint64_t nRow) {
+    const WrapLine* pLine = WrappedRow(pViewer, nRow);
+    return pLine ? pLine->nRows : 1;
+}
+
+/* Units a row decodes to before byte position nAt in it */
+static size_t UnitsBefore(const LargeView* pView, uint64_t nRow, uint64_t nAt) {
+    size_t nUnits = 0;
+
+    if (!pView->bUtf8) return (size_t)(nAt - nRow);
+    for (uint64_t i = nRow; i < nAt; i++) {
+        uint8_t b = pView->pData[i];
+        if ((b & 0xC0) != 0x80) nUnits += b >= 0xF0 ? 2 : 1;
+    }
+    return nUnits;
+}
+
+/* Move the view to a new top row (and wrapped row within it) */
+static void SetTopRow(LargeViewer* pViewer, uint64_t nTop, size_t nTopSub) {
+    if (nTop == pViewer->nTop && nTopSub == pViewer->nTopSub) return;
+    pViewer->nTop = nTop;
+    pViewer->nTopSub = nTopSub;
+    UpdateScrollBars(pViewer);
+    InvalidateRect(pViewer->hwnd, NULL, FALSE);
+    RequestFrame(GetParent(pViewer->hwnd), FRAME_DIRTY_STATUS);
+}
+
+/* Scroll by whole rows, wrapped rows when wrapping (negative is up) */
+static void ScrollRows(LargeViewer* pViewer, int nRows) {
+    uint64_t nTop = pViewer->nTop;
+    size_t nSub = pViewer->nTopSub;
+
+    for (; nRows > 0; nRows--) {
+        if (nSub + 1 < WrappedRowCount(pViewer, nTop)) {
+            nSub++;
+            continue;
+        }
+        uint64_t nNext = LargeViewNextRow(&pViewer->view, nTop);
+        if (nNext == nTop) break;
+        nTop = nNext;
+        nSub = 0;
+    }
+    for (; nRows < 0; nRows++) {
+        if (nSub > 0) {
+            nSub--;
+            continue;
+        }
+        if (nTop <= pViewer->view.nStart) break;
+        nTop = LargeViewPrevRow(&pViewer->view, nTop);
+        nSub = WrappedRowCount(pViewer, nTop) - 1;
+    }
+    SetTopRow(pViewer, nTop, nSub);
+}
+
+/* Show the last page of the file */
+static void ScrollToEnd(LargeViewer* pViewer) {
+    pViewer->nTop = LargeViewRowStart(&pViewer->view, pViewer->view.nSize);
+    pViewer->nTopSub = WrappedRowCount(pViewer, pViewer->nTop) - 1;
+    ScrollRows(pViewer, -(VisibleRows(pViewer) - 1));
+    UpdateScrollBars(pViewer);
+    InvalidateRect(pViewer->hwnd, NULL, FALSE);
+    RequestFrame(GetParent(pViewer->hwnd), FRAME_DIRTY_STATUS);
+}
+
+/* Set the first visible column */
+static void SetLeftColumn(LargeViewer* pViewer, int nCol) {
+    if (pViewer->bWrap) nCol = 0;
+    if (nCol > VIEW_ROW_UNITS - 1) nCol = VIEW_ROW_UNITS - 1;
+    if (nCol < 0) nCol = 0;
+    if (nCol == pViewer->nLeftCol) return;
+    pViewer->nLeftCol = nCol;
+    UpdateScrollBars(pViewer);
+    InvalidateRect(pViewer->hwnd, NULL, FALSE);
+}
+
+/* Paint the visible rows, decoding only those */
+static void PaintViewer(LargeViewer* pViewer, HDC hdcScreen) {
+    const LargeView* pView = &pViewer->view;
+    RECT rcClient;
+    GetClientRect(pViewer->hwnd, &rcClient);
+    int nWidth = rcClient.right;
+    int nHeight = rcClient.bottom;
+    if (nWidth <= 0 || nHeight <= 0) return;
+
+    /* Double buffer, same as the line number window */
+    HDC hdc = CreateCompatibleDC(hdcScreen);
+    HBITMAP hBitmap = CreateCompatibleBitmap(hdcScreen, nWidth, nHeight);
+    HBITMAP hOldBitmap = (HBITMAP)SelectObject(hdc, hBitmap);
+    HFONT hOldFont = pViewer->hFont ? (HFONT)SelectObject(hdc, pViewer->hFont) : NULL;
+
+    HBRUSH hBrush = CreateSolidBrush(RGB(255, 255, 255));
+    FillRect(hdc, &rcClient, hBrush);
+    DeleteObject(hBrush);
+    SetBkMode(hdc, TRANSPARENT);
+
+    int nGutter = GutterWidth(pViewer);
+    if (nGutter > 0) {
+        HPEN hPen = CreatePen(PS_SOLID, 1, RGB(200, 200, 200));
+        HPEN hOldPen = (HPEN)SelectObject(hdc, hPen);
+        MoveToEx(hdc, nGutter - GUTTER_PADDING / 2, 0, NULL);
+        LineTo(hdc, nGutter - GUTTER_PADDING / 2, nHeight);
+        SelectObject(hdc, hOldPen);
+        DeleteObject(hPen);
+    }
+
+    /* Line numbers show once the index has reached the top row */
+    uint64_t nLine = 0;
+    BOOL bNumbered = nGutter > 0 && LargeViewLineAt(pView, pViewer->nTop, &nLine);
+    BOOL bLineStart = pViewer->nTop <= pView->nStart ||
+                      pView->pData[pViewer->nTop - 1] == '\n' || pView->pData[pViewer->nTop - 1] == '\r';
+    int nColumns = (nWidth - nGutter) / pViewer->nCharWidth + 2;
+    uint64_t nRow = pViewer->nTop;
+
+    /* Only rows on screen are laid out; a resize keeps rows it does not affect */
+    if (pViewer->bWrap) WrapCacheSetColumns(&pViewer->wrap, TextColumns(pViewer));
+
+    for (int nY = 0; nY < nHeight; ) {
+        uint64_t nNext;
+        int bLineEnd;
+        size_t nUnits = LargeViewDecodeRow(pView, nRow, (uint16_t*)pViewer->szRow, VIEW_ROW_UNITS,
+                                           &nNext, &bLineEnd);
+        const WrapLine* pWrap = NULL;
+        size_t nSub = 0, nSubs = 1, nMatchSub = 0;
+
+        if (pViewer->bWrap) {
+            pWrap = WrapCacheLayout(&pViewer->wrap, nRow, (const TextUnit*)pViewer->szRow, nUnits);
+            if (pWrap) nSubs = pWrap->nRows;
+        }
+        if (nRow == pViewer->nTop) {
+            /* A resize may have left fewer wrapped rows than the top one */
+            if (pViewer->nTopSub >= nSubs) pViewer->nTopSub = nSubs - 1;
+            nSub = pViewer->nTopSub;
+        }
+
+        BOOL bMatchRow = pViewer->bMatch && pViewer->nMatchStart >= nRow &&
+                         (pViewer->nMatchStart < nNext || nNext == nRow);
+        if (bMatchRow && pWrap) nMatchSub = WrapLineRowOf(pWrap, UnitsBefore(pView, nRow, pViewer->nMatchStart));
+
+        for (; nSub < nSubs && nY < nHeight; nSub++, nY += pViewer->nLineHeight) {
+            size_t nFrom = pWrap ? WrapLineRowStart(pWrap, nSub) : (size_t)pViewer->nLeftCol;
+            size_t nTo = pWrap ? WrapLineRowEnd(pWrap, nSub) : nUnits;
+
+            if (bNumbered && bLineStart && nSub == 0) {
+                TCHAR szLineNum[24];
+                RECT rcNum = {0, nY, nGutter - GUTTER_PADDING, nY + pViewer->nLineHeight};
+                _sntprintf(szLineNum, 24, TEXT("%I64u"), (unsigned long long)(nLine + 1));
+                SetTextColor(hdc, RGB(80, 80, 80));
+                DrawText(hdc, szLineNum, -1, &rcNum, DT_RIGHT | DT_TOP | DT_SINGLELINE);
+            }
+
+            if (bMatchRow && nSub == nMatchSub) {
+                RECT rcRow = {nGutter, nY, nWidth, nY + pViewer->nLineHeight};
+                HBRUSH hMatch = CreateSolidBrush(RGB(255, 236, 150));
+                FillRect(hdc, &rcRow, hMatch);
+                DeleteObject(hMatch);
+            }
+
+            if (nTo > nFrom) {
+                int nCount = nTo - nFrom > (size_t)nColumns ? nColumns : (int)(nTo - nFrom);
+                SetTextColor(hdc, RGB(0, 0, 0));
+                TabbedTextOutW(hdc, nGutter, nY, pViewer->szRow + nFrom, nCount, 0, NULL, nGutter);
+            }
+        }
+
+        if (bLineEnd) nLine++;
+        bLineStart = bLineEnd;
+        if (nNext == nRow) break;
+        nRow = nNext;
+    }
+
+    BitBlt(hdcScreen, 0, 0, nWidth, nHeight, hdc, 0, 0, SRCCOPY);
+
+    if (hOldFont) SelectObject(hdc, hOldFont);
+    SelectObject(hdc, hOldBitmap);
+    DeleteObject(hBitmap);
+    DeleteDC(hdc);
+}
+
+/* Large file viewer window procedure */
+static LRESULT CALLBACK LargeViewerWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+    LargeViewer* pViewer = GetViewer(hwnd);
+
+    switch (msg) {
+        case WM_NCCREATE: {
+            CREATESTRUCT* pCreate = (CREATESTRUCT*)lParam;
+            pViewer = (LargeViewer*)pCreate->lpCreateParams;
+            pViewer->hwnd = hwnd;
+            SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR)pViewer);
+            break;
+        }
+
+        case WM_SETFONT:
+            if (pViewer) {
+                pViewer->hFont = (HFONT)wParam;
+                UpdateFontMetrics(pViewer);
+                if (LOWORD(lParam)) InvalidateRect(hwnd, NULL, FALSE);
+            }
+            return 0;
+
+        case WM_GETFONT:
+            return pViewer ? (LRESULT)pViewer->hFont : 0;
+
+        case WM_SIZE:
+            if (pViewer) {
+                UpdateScrollBars(pViewer);
+                InvalidateRect(hwnd, NULL, FALSE);
+            }
+            return 0;
+
+        case WM_PAINT: {
+            PAINTSTRUCT ps;
+            HDC hdc = BeginPaint(hwnd, &ps);
+            if (pViewer) PaintViewer(pViewer, hdc);
+            EndPaint(hwnd, &ps);
+            return 0;
+        }
+
+        case WM_ERASEBKGND:
+            return 1; /* We handle background in WM_PAINT */
+
+        case WM_VSCROLL: {
+            if (!pViewer) return 0;
+            int nPage = VisibleRows(pViewer) - 1;
+            switch (LOWORD(wParam)) {
+                case SB_LINEUP:   ScrollRows(pViewer, -1); break;
+                case SB_LINEDOWN: ScrollRows(pViewer, 1); break;
+                case SB_PAGEUP:   ScrollRows(pViewer, -(nPage > 0 ? nPage : 1)); break;
+                case SB_PAGEDOWN: ScrollRows(pViewer, nPage > 0 ? nPage : 1); break;
+                case SB_TOP:      SetTopRow(pViewer, pViewer->view.nStart, 0); break;
+                case SB_BOTTOM:   ScrollToEnd(pViewer); break;
+                case SB_THUMBTRACK:
+                case SB_THUMBPOSITION: {
+                    /* The thumb picks a byte position; snap it to a row */
+                    SCROLLINFO si = {0};
+                    si.cbSize = sizeof(si);
+                    si.fMask = SIF_TRACKPOS;
+                    GetScrollInfo(hwnd, SB_VERT, &si);
+                    uint64_t nSpan = pViewer->view.nSize - pViewer->view.nStart;
+                    uint64_t nPos = pViewer->view.nStart +
+                                    (uint64_t)((double)si.nTrackPos / VIEW_SCROLL_RANGE * nSpan);
+                    pViewer->nTop = LargeViewRowStart(&pViewer->view, nPos);
+                    pViewer->nTopSub = 0;
+                    UpdateScrollBars(pViewer);
+                    InvalidateRect(hwnd, NULL, FALSE);
+                    RequestFrame(GetParent(hwnd), FRAME_DIRTY_STATUS);
+                    break;
+                }
+            }
+            return 0;
+        }
+
+        case WM_HSCROLL: {
+            if (!pViewer) return 0;
+            RECT rc;
+            GetClientRect(hwnd, &rc);
+            int nPage = rc.right / pViewer->nCharWidth;
+            switch (LOWORD(wParam)) {
+                case SB_LINELEFT:  SetLeftColumn(pViewer, pViewer->nLeftCol - 1); break;
+                case SB_LINERIGHT: SetLeftColumn(pViewer, pViewer->nLeftCol + 1); break;
+                case SB_PAGELEFT:  SetLeftColumn(pViewer, pViewer->nLeftCol - nPage); break;
+                case SB_PAGERIGHT: SetLeftColumn(pViewer, pViewer->nLeftCol + nPage); break;
+                case SB_LEFT:      SetLeftColumn(pViewer, 0); break;
+                case SB_THUMBTRACK:
+                case SB_THUMBPOSITION: SetLeftColumn(pViewer, HIWORD(wParam)); break;
+            }
+            return 0;
+        }
+
+        case WM_MOUSEWHEEL: {
+            if (!pViewer) return 0;
+            pViewer->nWheelDelta += GET_WHEEL_DELTA_WPARAM(wParam);
+            int nNotches = pViewer->nWheelDelta / WHEEL_DELTA;
+            pViewer->nWheelDelta -= nNotches * WHEEL_DELTA;
+            if (nNotches) ScrollRows(pViewer, -nNotches * WHEEL_ROWS);
+            return 0;
+        }
+
+        case WM_KEYDOWN: {
+            if (!pViewer) return 0;
+            BOOL bCtrl = GetKeyState(VK_CONTROL) < 0;
+            int nPage = VisibleRows(pViewer) - 1;
+            if (nPage < 1) nPage = 1;
+            switch (wParam) {
+                case VK_UP:    ScrollRows(pViewer, -1); break;
+                case VK_DOWN:  ScrollRows(pViewer, 1); break;
+                case VK_PRIOR: ScrollRows(pViewer, -nPage); break;
+                case VK_NEXT:  ScrollRows(pViewer, nPage); break;
+                case VK_LEFT:  SetLeftColumn(pViewer, pViewer->nLeftCol - 1); break;
+                case VK_RIGHT: SetLeftColumn(pViewer, pViewer->nLeftCol + 1); break;
+                case VK_HOME:
+                    if (bCtrl) SetTopRow(pViewer, pViewer->view.nStart, 0);
+                    SetLeftColumn(pViewer, 0);
+                    break;
+                case VK_END:
+                    if (bCtrl) ScrollToEnd(pViewer);
+                    break;
+            }
+            return 0;
+        }
+
+        case WM_LBUTTONDOWN:
+            SetFocus(hwnd);
+            return 0;
+
+        case WM_LARGEVIEW_INDEXED:
+            /* Line count is known now: resize the gutter */
+            InvalidateRect(hwnd, NULL, FALSE);
+            RequestFrame(GetParent(hwnd), FRAME_DIRTY_STATUS);
+            return 0;
+
+        case WM_LARGEVIEW_PROGRESS:
+            RequestFrame(GetParent(hwnd), FRAME_DIRTY_STATUS);
+            return 0;
+
+        case WM_NCDESTROY:
+            if (pViewer) {
+                if (pViewer->hIndexThread) {
+                    InterlockedExchange(&pViewer->bStopIndex, 1);
+                    WaitForSingleObject(pViewer->hIndexThread, INFINITE);
+                    CloseHandle(pViewer->hIndexThread);
+                }
+                LargeViewClose(&pViewer->view);
+                WrapCacheFree(&pViewer->wrap);
+                HeapFree(GetProcessHeap(), 0, pViewer);
+                SetWindowLongPtr(hwnd, GWLP_USERDATA, 0);
+            }
+            break;
+    }
+
+    return DefWindowProc(hwnd, msg, wParam, lParam);
+}
+
+/* Register large file viewer window class */
+static BOOL RegisterLargeViewerClass(HINSTANCE hInstance) {
+    static BOOL bRegistered = FALSE;
+
+    if (bRegistered) return TRUE;
+
+    WNDCLASSEX wc = {0};
+    wc.cbSize        = sizeof(WNDCLASSEX);
+    wc.style         = CS_HREDRAW | CS_VREDRAW;
+    wc.lpfnWndProc   = LargeViewerWndProc;
+    wc.hInstance     = hInstance;
+    wc.hCursor       = LoadCursor(NULL, IDC_IBEAM);
+    wc.hbrBackground = NULL;
+    wc.lpszClassName = szLargeViewerClassName;
+
+    if (RegisterClassEx(&wc)) {
+        bRegistered = TRUE;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/* %LOCALAPPDATA%\XNote\LineCache, created if missing */
+static BOOL FindLineCacheDir(WCHAR* szDir, DWORD cchDir) {
+    if (!FindAppDataDir(szDir, cchDir) || lstrlenW(szDir) + lstrlenW(LINE_CACHE_DIR_NAME) >= (int)cchDir) {
+        return FALSE;
+    }
+    lstrcatW(szDir, LINE_CACHE_DIR_NAME);
+    if (!CreateDirectoryW(szDir, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* Create a read-only viewer over a mapped file in nEncoding, as detected (hidden; NULL on failure) */
+HWND CreateLargeFileViewer(HWND hwndParent, const TCHAR* szFileName, int nEncoding, HFONT hFont) {
+    if (!RegisterLargeViewerClass(g_AppState.hInstance)) return NULL;
+
+    LargeViewer* pViewer = (LargeViewer*)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(LargeViewer));
+    if (!pViewer) return NULL;
+
+    /* Without a cache folder every open scans the whole file */
+    lstrcpynW(pViewer->szFileName, szFileName, MAX_PATH);
+    if (!FindLineCacheDir(pViewer->szCacheDir, MAX_PATH)) pViewer->szCacheDir[0] = L'\0';
+
+    if (!LargeViewOpen(&pViewer->view, szFileName, nEncoding, pViewer->szCacheDir[0] ? pViewer->szCacheDir : NULL)) {
+        HeapFree(GetProcessHeap(), 0, pViewer);
+        return NULL;
+    }
+    pViewer->nTop = pViewer->view.nStart;
+    pViewer->nLineHeight = 16;
+    pViewer->nCharWidth = 8;
+    pViewer->bWrap = g_AppState.bWordWrap;
+    WrapCacheInit(&pViewer->wrap, 1);
+
+    /* The window owns the viewer from here on and frees it in WM_NCDESTROY */
+    HWND hwnd = CreateWindowEx(
+        WS_EX_CLIENTEDGE,
+        szLargeViewerClassName,
+        TEXT(""),
+        WS_CHILD | WS_VSCROLL | WS_HSCROLL,
+        0, 0, 0, 0,
+        hwndParent,
+        (HMENU)IDC_EDIT,
+        g_AppState.hInstance,
+        pViewer
+    );
+    if (!hwnd) {
+        LargeViewClose(&pViewer->view);
+        HeapFree(GetProcessHeap(), 0, pViewer);
+        return NULL;
+    }
+
+    SendMessage(hwnd, WM_SETFONT, (WPARAM)hFont, FALSE);
+    UpdateScrollBars(pViewer);
+
+    /* Line checkpoints are built in the background; the view works without them */
+    pViewer->hIndexThread = CreateThread(NULL, 0, IndexThreadProc, pViewer, 0, NULL);
+    if (pViewer->hIndexThread) {
+        SetThreadPriority(pViewer->hIndexThread, THREAD_PRIORITY_BELOW_NORMAL);
+    }
+
+    return hwnd;
+}
+
+/* First (or last) match starting in [nFrom, nTo) of the text after the BOM */
+static BOOL FindInView(FindPattern* pFind, const LargeView* pView, size_t nFrom, size_t nTo,
+                       BOOL bLast, size_t* pnAt) {
+    const uint8_t* pText = pView->pData + pView->nStart;
+    size_t nLen = (size_t)(pView->nSize - pView->nStart);
+    size_t nStart = (size_t)pView->nStart, nAt, nMatchLen;
+    int bFound;
+
+    if (pFind->bRegex) {
+        bFound = bLast ? RegexSearchBytesLast(&pFind->regex, pText, nLen, nFrom - nStart, nTo - nStart, &nAt, &nMatchLen)
+                       : RegexSearchBytes(&pFind->regex, pText, nLen, nFrom - nStart, nTo - nStart, &nAt, &nMatchLen);
+    } else {
+        bFound = bLast ? TextSearchBytesLast(&pFind->text, pText, nLen, nFrom - nStart, nTo - nStart, &nAt)
+                       : TextSearchBytes(&pFind->text, pText, nLen, nFrom - nStart, nTo - nStart, &nAt);
+    }
+    if (bFound) *pnAt = nStart + nAt;
+    return bFound ? TRUE : FALSE;
+}
+
+/*
+ * Find the next or previous match after the last one (or from the top row)
+ * in the mapped bytes, wrapping around, and scroll it into view.
+ */
+BOOL LargeViewerFind(HWND hwndViewer, FindPattern* pFind, BOOL bBackward) {
+    const LargeView* pView = GetLargeFileView(hwndViewer);
+    LargeViewer* pViewer;
+    size_t nSize, nStart, nFrom, nAt;
+    BOOL bFound;
+
+    if (!pView || pView->nSize > (uint64_t)SIZE_MAX) return FALSE;
+    pViewer = GetViewer(hwndViewer);
+    nSize = (size_t)pView->nSize;
+    nStart = (size_t)pView->nStart;
+    nFrom = pViewer->bMatch ? (size_t)pViewer->nMatchStart + (bBackward ? 0 : 1) : (size_t)pViewer->nTop;
+    if (nFrom < nStart) nFrom = nStart;
+    if (nFrom > nSize) nFrom = nSize;
+
+    if (!bBackward) {
+        bFound = FindInView(pFind, pView, nFrom, nSize, FALSE, &nAt) ||
+                 FindInView(pFind, pView, nStart, nFrom, FALSE, &nAt);
+    } else {
+        bFound = FindInView(pFind, pView, nStart, nFrom, TRUE, &nAt) ||
+                 FindInView(pFind, pView, nFrom, nSize, TRUE, &nAt);
+    }
+    if (!bFound) return FALSE;
+
+    /* The match row goes a third of the way down the page */
+    pViewer->nMatchStart = nAt;
+    pViewer->bMatch = TRUE;
+    pViewer->nTop = LargeViewRowStart(pView, nAt);
+    pViewer->nTopSub = 0;
+    const WrapLine* pLine = WrappedRow(pViewer, pViewer->nTop);
+    if (pLine) pViewer->nTopSub = WrapLineRowOf(pLine, UnitsBefore(pView, pViewer->nTop, nAt));
+    ScrollRows(pViewer, -(VisibleRows(pViewer) / 3));
+    UpdateScrollBars(pViewer);
+    InvalidateRect(hwndViewer, NULL, FALSE);
+    RequestFrame(GetParent(hwndViewer), FRAME_DIRTY_STATUS);
+    return TRUE;
+}
+
+/* Wrap rows at the window width, or scroll them sideways */
+void SetLargeViewerWrap(HWND hwndViewer, BOOL bWrap) {
+    LargeViewer* pViewer;
+
+    if (!GetLargeFileView(hwndViewer)) return;
+    pViewer = GetViewer(hwndViewer);
+    if (pViewer->bWrap == bWrap) return;
+
+    /* Keep the top row; only the view's layout changes */
+    pViewer->bWrap = bWrap;
+    pViewer->nTopSub = 0;
+    pViewer->nLeftCol = 0;
+    UpdateScrollBars(pViewer);
+    InvalidateRect(hwndViewer, NULL, FALSE);
+}
+
+/* Mapped file behind a viewer (NULL if hwnd is not one) */
+const LargeView* GetLargeFileView(HWND hwndViewer) {
+    LargeViewer* pViewer;
+    TCHAR szClass[32];
+
+    if (!hwndViewer || !GetClassName(hwndViewer, szClass, 32) ||
+        _tcscmp(szClass, szLargeViewerClassName) != 0) {
+        return NULL;
+    }
+    pViewer = GetViewer(hwndViewer);
+    return pViewer ? &pViewer->view : NULL;
+}
+
+/* Fill in status bar details for a viewer (FALSE if hwnd is not one) */
+BOOL GetLargeViewerStatus(HWND hwndViewer, LargeViewerStatus* pStatus) {
+    const LargeView* pView = GetLargeFileView(hwndViewer);
+    if (!pView) return FALSE;
+
+    LargeViewer* pViewer = GetViewer(hwndViewer);
+    uint64_t nLine;
+
+    pStatus->nBytes = pView->nSize;
+    pStatus->bUtf8 = pView->bUtf8;
+    pStatus->nIndexPercent = LargeViewIndexPercent(pView);
+    pStatus->bLinesKnown = LargeViewLineCount(pView, &pStatus->nLines);
+    pStatus->nTopLine = LargeViewLineAt(pView, pViewer->nTop, &nLine) ? nLine + 1 : 0;
+    return TRUE;
+}
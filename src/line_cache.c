@@ -0,0 +1,294 @@
+#include "line_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Entry magic */
+static const uint8_t g_Magic[4] = { 'X', 'L', 'C', '1' };
+
+/*
+ * Header: magic, path bytes (4), then size, write time, sample hash,
+ * checkpoint interval, text start, line breaks and checkpoint count (8
+ * each), then flags (4)
+ */
+#define HEADER_SIZE 68
+
+/* Header flag: the file is UTF-8 */
+#define FLAG_UTF8 1
+
+/* Blocks hashed by LineCacheSampleHash, and their size */
+#define SAMPLE_BLOCKS 16
+#define SAMPLE_BLOCK_BYTES 4096
+
+/* Entry file name: 16 hex digits of the path hash and this extension */
+#define ENTRY_EXTENSION ".xlc"
+#define ENTRY_NAME_LENGTH 20
+
+#define FNV_OFFSET 0xCBF29CE484222325ull
+#define FNV_PRIME 0x100000001B3ull
+
+/* ---- Encoding ---- */
+
+/* CRC-32 (the journal's polynomial); entries are small, so no table */
+static uint32_t Crc32(const uint8_t* p, size_t nLen) {
+    uint32_t nCrc = 0xFFFFFFFFu;
+    while (nLen--) {
+        nCrc ^= *p++;
+        for (int i = 0; i < 8; i++) nCrc = (nCrc >> 1) ^ (0xEDB88320u & (0u - (nCrc & 1)));
+    }
+    return nCrc ^ 0xFFFFFFFFu;
+}
+
+static uint64_t Fnv1a(uint64_t nHash, const uint8_t* p, size_t nLen) {
+    while (nLen--) nHash = (nHash ^ *p++) * FNV_PRIME;
+    return nHash;
+}
+
+static void Put32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void Put64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t Get32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t Get64(const uint8_t* p) {
+    return (uint64_t)Get32(p) | ((uint64_t)Get32(p + 4) << 32);
+}
+
+static size_t PathLength(const PathChar* szPath) {
+    size_t n = 0;
+    while (szPath[n]) n++;
+    return n;
+}
+
+/* szDir, a separator and an ASCII name (returns 0 if it does not fit) */
+static int JoinPath(PathChar* szDest, size_t cchDest, const PathChar* szDir, const char* szName) {
+    size_t nDir = PathLength(szDir);
+    size_t nName = strlen(szName);
+
+    if (nDir + 1 + nName >= cchDest) return 0;
+    memcpy(szDest, szDir, nDir * sizeof(PathChar));
+    if (nDir > 0 && szDir[nDir - 1] != PATH_SEPARATOR) szDest[nDir++] = PATH_SEPARATOR;
+    for (size_t i = 0; i <= nName; i++) szDest[nDir + i] = (PathChar)szName[i];
+    return 1;
+}
+
+/* Where the entry for szPath lives */
+static int EntryPath(PathChar* szEntry, size_t cchEntry, const PathChar* szDir, const PathChar* szPath) {
+    static const char szHex[] = "0123456789abcdef";
+    uint64_t nHash = Fnv1a(FNV_OFFSET, (const uint8_t*)szPath, PathLength(szPath) * sizeof(PathChar));
+    char szName[ENTRY_NAME_LENGTH + 1];
+
+    for (int i = 0; i < 16; i++) szName[i] = szHex[(nHash >> (60 - 4 * i)) & 15];
+    memcpy(szName + 16, ENTRY_EXTENSION, sizeof(ENTRY_EXTENSION));
+    return JoinPath(szEntry, cchEntry, szDir, szName);
+}
+
+uint64_t LineCacheSampleHash(const uint8_t* pData, uint64_t nSize) {
+    uint8_t size[8];
+    uint64_t nHash;
+
+    Put64(size, nSize);
+    nHash = Fnv1a(FNV_OFFSET, size, sizeof(size));
+
+    /* A small file is hashed whole */
+    if (nSize <= (uint64_t)SAMPLE_BLOCKS * SAMPLE_BLOCK_BYTES) return Fnv1a(nHash, pData, (size_t)nSize);
+
+    /* The first and last blocks, and the rest evenly between (appends and headers both show) */
+    for (uint64_t i = 0; i < SAMPLE_BLOCKS; i++) {
+        uint64_t nAt = (nSize - SAMPLE_BLOCK_BYTES) / (SAMPLE_BLOCKS - 1) * i;
+        if (i == SAMPLE_BLOCKS - 1) nAt = nSize - SAMPLE_BLOCK_BYTES;
+        nHash = Fnv1a(nHash, pData + nAt, SAMPLE_BLOCK_BYTES);
+    }
+    return nHash;
+}
+
+/* ---- Reading ---- */
+
+/* Check a mapped entry belongs to szPath and is intact, and read its header */
+static int ParseEntry(const uint8_t* p, uint64_t nSize, const PathChar* szPath, LineCacheEntry* pEntry) {
+    size_t nPathBytes = PathLength(szPath) * sizeof(PathChar);
+    uint64_t nCheckpoints;
+
+    if (nSize < HEADER_SIZE + nPathBytes + 4 || memcmp(p, g_Magic, sizeof(g_Magic)) != 0) return 0;
+
+    /* Another path with the same hash, or an entry of the wrong length, does not count */
+    if (Get32(p + 4) != nPathBytes || memcmp(p + HEADER_SIZE, szPath, nPathBytes) != 0) return 0;
+    nCheckpoints = Get64(p + 56);
+    if (nCheckpoints == 0 || nCheckpoints != (nSize - HEADER_SIZE - nPathBytes - 4) / 8 ||
+        (nSize - HEADER_SIZE - nPathBytes - 4) % 8 != 0) {
+        return 0;
+    }
+    if (Crc32(p, (size_t)nSize - 4) != Get32(p + nSize - 4)) return 0;
+
+    pEntry->info.nSize = Get64(p + 8);
+    pEntry->info.nModified = Get64(p + 16);
+    pEntry->info.nSampleHash = Get64(p + 24);
+    pEntry->info.nInterval = Get64(p + 32);
+    pEntry->info.nStart = Get64(p + 40);
+    pEntry->info.nBreaks = Get64(p + 48);
+    pEntry->info.nCheckpoints = (size_t)nCheckpoints;
+    pEntry->info.bUtf8 = (Get32(p + 64) & FLAG_UTF8) != 0;
+    pEntry->pCheckpoints = p + HEADER_SIZE + nPathBytes;
+    return pEntry->info.nInterval != 0;
+}
+
+int LineCacheLookup(const PathChar* szDir, const PathChar* szPath, LineCacheEntry* pEntry) {
+    PathChar szEntry[LINE_CACHE_MAX_PATH];
+
+    memset(pEntry, 0, sizeof(*pEntry));
+    if (!EntryPath(szEntry, LINE_CACHE_MAX_PATH, szDir, szPath)) return 0;
+    if (!MapFileReadOnly(&pEntry->map, szEntry)) return 0;
+
+    if (!ParseEntry(pEntry->map.pData, pEntry->map.nSize, szPath, pEntry)) {
+        LineCacheRelease(pEntry);
+        return 0;
+    }
+    return 1;
+}
+
+uint64_t LineCacheCheckpoint(const LineCacheEntry* pEntry, size_t k) {
+    return Get64(pEntry->pCheckpoints + k * 8);
+}
+
+void LineCacheRelease(LineCacheEntry* pEntry) {
+    UnmapFile(&pEntry->map);
+    memset(pEntry, 0, sizeof(*pEntry));
+}
+
+/* ---- Writing ---- */
+
+int LineCacheStore(const PathChar* szDir, const PathChar* szPath, const LineCacheInfo* pInfo,
+                   const uint64_t* pCheckpoints, uint64_t nMaxBytes) {
+    PathChar szEntry[LINE_CACHE_MAX_PATH];
+    PathChar szTemp[LINE_CACHE_MAX_PATH];
+    size_t nPathBytes = PathLength(szPath) * sizeof(PathChar);
+    size_t nBytes, nAt;
+    OutputFile file;
+    uint8_t* pBuf;
+    int bOk;
+
+    if (pInfo->nCheckpoints == 0 || pInfo->nCheckpoints > (SIZE_MAX - HEADER_SIZE - nPathBytes - 4) / 8) {
+        return 0;
+    }
+    if (!EntryPath(szEntry, LINE_CACHE_MAX_PATH, szDir, szPath)) return 0;
+
+    nBytes = HEADER_SIZE + nPathBytes + pInfo->nCheckpoints * 8 + 4;
+    pBuf = (uint8_t*)malloc(nBytes);
+    if (!pBuf) return 0;
+
+    memcpy(pBuf, g_Magic, sizeof(g_Magic));
+    Put32(pBuf + 4, (uint32_t)nPathBytes);
+    Put64(pBuf + 8, pInfo->nSize);
+    Put64(pBuf + 16, pInfo->nModified);
+    Put64(pBuf + 24, pInfo->nSampleHash);
+    Put64(pBuf + 32, pInfo->nInterval);
+    Put64(pBuf + 40, pInfo->nStart);
+    Put64(pBuf + 48, pInfo->nBreaks);
+    Put64(pBuf + 56, (uint64_t)pInfo->nCheckpoints);
+    Put32(pBuf + 64, pInfo->bUtf8 ? FLAG_UTF8 : 0);
+    memcpy(pBuf + HEADER_SIZE, szPath, nPathBytes);
+    nAt = HEADER_SIZE + nPathBytes;
+    for (size_t k = 0; k < pInfo->nCheckpoints; k++, nAt += 8) Put64(pBuf + nAt, pCheckpoints[k]);
+    Put32(pBuf + nAt, Crc32(pBuf, nAt));
+
+    /* A cache needs no flush: an entry cut short by a crash fails its CRC */
+    bOk = OutputFileCreateTemp(&file, szEntry, szTemp, LINE_CACHE_MAX_PATH);
+    if (bOk) {
+        bOk = OutputFileWrite(&file, pBuf, nBytes);
+        bOk = OutputFileClose(&file) && bOk;
+        if (!bOk || !ReplaceFileAtomic(szTemp, szEntry)) {
+            DeleteFilePath(szTemp);
+            bOk = 0;
+        }
+    }
+    free(pBuf);
+
+    LineCacheTrim(szDir, nMaxBytes);
+    return bOk;
+}
+
+/* One entry found while trimming */
+typedef struct {
+    char szName[ENTRY_NAME_LENGTH + 1];
+    uint64_t nSize;
+    uint64_t nModified;
+} TrimEntry;
+
+typedef struct {
+    TrimEntry* pEntries;         /* malloc */
+    size_t nEntries;
+    size_t nCapacity;
+    int bFailed;                 /* Out of memory */
+} TrimList;
+
+/* Collect the names that look like entries */
+static int CollectEntry(void* pContext, const PathChar* szName, int bDirectory) {
+    TrimList* pList = (TrimList*)pContext;
+    size_t nName = PathLength(szName);
+    size_t nExtension = sizeof(ENTRY_EXTENSION) - 1;
+    TrimEntry* pEntry;
+
+    if (bDirectory || nName != ENTRY_NAME_LENGTH) return 1;
+    for (size_t i = 0; i < nExtension; i++) {
+        if (szName[nName - nExtension + i] != (PathChar)ENTRY_EXTENSION[i]) return 1;
+    }
+
+    if (pList->nEntries == pList->nCapacity) {
+        size_t nCapacity = pList->nCapacity ? pList->nCapacity * 2 : 64;
+        TrimEntry* pGrown = (TrimEntry*)realloc(pList->pEntries, nCapacity * sizeof(TrimEntry));
+        if (!pGrown) {
+            pList->bFailed = 1;
+            return 0;
+        }
+        pList->pEntries = pGrown;
+        pList->nCapacity = nCapacity;
+    }
+    pEntry = &pList->pEntries[pList->nEntries++];
+    for (size_t i = 0; i <= nName; i++) pEntry->szName[i] = (char)szName[i];
+    return 1;
+}
+
+static int CompareAge(const void* pA, const void* pB) {
+    const TrimEntry* a = (const TrimEntry*)pA;
+    const TrimEntry* b = (const TrimEntry*)pB;
+    return a->nModified < b->nModified ? -1 : a->nModified > b->nModified;
+}
+
+void LineCacheTrim(const PathChar* szDir, uint64_t nMaxBytes) {
+    PathChar szEntry[LINE_CACHE_MAX_PATH];
+    TrimList list;
+    uint64_t nTotal = 0;
+
+    memset(&list, 0, sizeof(list));
+    if (!ListDirectory(szDir, CollectEntry, &list) || list.bFailed) {
+        free(list.pEntries);
+        return;
+    }
+
+    /* Every use rewrites an entry, so its write time is its last use */
+    for (size_t i = 0; i < list.nEntries; i++) {
+        TrimEntry* pEntry = &list.pEntries[i];
+        MappedFile map;
+
+        if (!JoinPath(szEntry, LINE_CACHE_MAX_PATH, szDir, pEntry->szName) || !MapFileReadOnly(&map, szEntry)) {
+            continue;
+        }
+        pEntry->nSize = map.nSize;
+        pEntry->nModified = map.nModified;
+        nTotal += map.nSize;
+        UnmapFile(&map);
+    }
+
+    qsort(list.pEntries, list.nEntries, sizeof(TrimEntry), CompareAge);
+    for (size_t i = 0; i < list.nEntries && nTotal > nMaxBytes; i++) {
+        if (JoinPath(szEntry, LINE_CACHE_MAX_PATH, szDir, list.pEntries[i].szName) && DeleteFilePath(szEntry)) {
+            nTotal -= list.pEntries[i].nSize;
+        }
+    }
+    free(list.pEntries);
+}
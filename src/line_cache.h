@@ -0,0 +1,82 @@
+#ifndef LINE_CACHE_H
+#define LINE_CACHE_H
+
+/*
+ * Sidecar cache of line indexes for large files.
+ *
+ * Portable C. Indexing a multi-gigabyte file reads all of it, yet the
+ * index is a few kilobytes, so it is kept on disk for the next time. Each
+ * file gets one entry in a cache directory, named after a hash of its
+ * path:
+ *
+ *   header | path | checkpoints | CRC-32 of everything before
+ *
+ * with every number little endian. An entry only counts for a file whose
+ * size and last write time match and whose sampled blocks (see
+ * LineCacheSampleHash) hash the same. A file that has only grown, like a
+ * log, keeps the checkpoints before its old end if the blocks sampled for
+ * the old size still hash the same, so only what was appended is scanned.
+ *
+ * Entries are read through a mapping and written whole to a temp file that
+ * is renamed over the old one, so a reader never sees half an entry. Every
+ * use rewrites the entry; when the directory holds more than its cap the
+ * entries written longest ago are deleted.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "platform.h"
+
+/* Default cap on the bytes kept in the cache directory */
+#define LINE_CACHE_MAX_BYTES (16 * 1024 * 1024)
+
+/* Longest file path an entry is kept for (in PathChar units) */
+#define LINE_CACHE_MAX_PATH 1024
+
+/* What an entry records about a file and its index */
+typedef struct {
+    uint64_t nSize;              /* File size when indexed */
+    uint64_t nModified;          /* File's last write time then (MappedFile.nModified) */
+    uint64_t nSampleHash;        /* LineCacheSampleHash of the file then */
+    uint64_t nInterval;          /* Bytes between checkpoints */
+    uint64_t nStart;             /* First text byte (after a BOM) */
+    int bUtf8;                   /* Encoding detected */
+    uint64_t nBreaks;            /* Line breaks in the whole file */
+    size_t nCheckpoints;         /* Line breaks before k * nInterval, for each k */
+} LineCacheInfo;
+
+/* An entry read from the cache */
+typedef struct {
+    LineCacheInfo info;
+    const uint8_t* pCheckpoints; /* Packed checkpoints, inside the mapping */
+    MappedFile map;              /* The entry file */
+} LineCacheEntry;
+
+/*
+ * Hash of the file size and a few blocks spread evenly over the first
+ * nSize bytes of pData. Where the blocks sit depends only on nSize, so
+ * for a file that has grown, hashing it with its old size tells whether
+ * the old part is still the same.
+ */
+uint64_t LineCacheSampleHash(const uint8_t* pData, uint64_t nSize);
+
+/* Map the entry for szPath and check it is intact (returns nonzero if there is one) */
+int LineCacheLookup(const PathChar* szDir, const PathChar* szPath, LineCacheEntry* pEntry);
+
+/* Checkpoint k of a looked up entry */
+uint64_t LineCacheCheckpoint(const LineCacheEntry* pEntry, size_t k);
+
+void LineCacheRelease(LineCacheEntry* pEntry);
+
+/*
+ * Write the entry for szPath (pInfo->nCheckpoints counts from
+ * pCheckpoints), then trim the directory to nMaxBytes. Returns nonzero if
+ * the entry was written.
+ */
+int LineCacheStore(const PathChar* szDir, const PathChar* szPath, const LineCacheInfo* pInfo,
+                   const uint64_t* pCheckpoints, uint64_t nMaxBytes);
+
+/* Delete the entries written longest ago until the rest fit in nMaxBytes */
+void LineCacheTrim(const PathChar* szDir, uint64_t nMaxBytes);
+
+#endif /* LINE_CACHE_H */
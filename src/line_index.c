@@ -0,0 +1,645 @@
+#include "line_index.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Lines per chunk */
+#define LINE_CHUNK_MAX 512
+
+/* Fill target when chunks are rebuilt, leaving room for typing */
+#define LINE_CHUNK_FILL 384
+
+/* Chunks smaller than this are merged with a neighbour when rebuilt */
+#define LINE_CHUNK_MIN 64
+
+/* Fixed-size run of line records */
+struct LineChunk {
+    size_t nCount;               /* Lines in this chunk */
+    size_t nUnits;               /* Sum of line lengths */
+    size_t nCrlf;                /* CRLF breaks in this chunk */
+    uint32_t aLens[LINE_CHUNK_MAX];  /* Line lengths including the break */
+    uint8_t aBreaks[LINE_CHUNK_MAX]; /* LINE_BREAK_* per line */
+};
+
+/* Growable list of line records produced by a scan */
+typedef struct {
+    uint32_t* pLens;
+    uint8_t* pBreaks;
+    size_t nCount;
+    size_t nCapacity;
+    int bFailed;
+} LineList;
+
+/* ---- Fenwick trees over chunk sums ---- */
+
+static void FenAdd(size_t* pFen, size_t nSize, size_t nPos, size_t nDelta) {
+    /* nDelta may be a wrapped negative value; unsigned arithmetic is modular */
+    for (size_t i = nPos + 1; i <= nSize; i += i & (~i + 1)) {
+        pFen[i - 1] += nDelta;
+    }
+}
+
+/* Sum of the first nPos entries */
+static size_t FenPrefix(const size_t* pFen, size_t nPos) {
+    size_t nSum = 0;
+    for (size_t i = nPos; i > 0; i -= i & (~i + 1)) {
+        nSum += pFen[i - 1];
+    }
+    return nSum;
+}
+
+/* Largest nPos with FenPrefix(nPos) <= nTarget; *pnRemain = nTarget - that prefix */
+static size_t FenSearch(const size_t* pFen, size_t nSize, size_t nTarget, size_t* pnRemain) {
+    size_t nPos = 0;
+    size_t nStep = 1;
+
+    while (nStep * 2 <= nSize) nStep *= 2;
+    for (; nStep > 0; nStep /= 2) {
+        size_t nNext = nPos + nStep;
+        if (nNext <= nSize && pFen[nNext - 1] <= nTarget) {
+            nPos = nNext;
+            nTarget -= pFen[nNext - 1];
+        }
+    }
+    *pnRemain = nTarget;
+    return nPos;
+}
+
+static size_t CollapsedUnits(const LineChunk* pChunk) {
+    return pChunk->nUnits - pChunk->nCrlf;
+}
+
+/* Rebuild all Fenwick trees from chunk sums in O(chunks) */
+static int RebuildFenwick(LineIndex* pIndex) {
+    size_t n = pIndex->nChunks;
+    size_t nBytes = (n ? n : 1) * sizeof(size_t);
+    size_t* pLines = (size_t*)realloc(pIndex->pFenLines, nBytes);
+    if (pLines) pIndex->pFenLines = pLines;
+    size_t* pUnits = (size_t*)realloc(pIndex->pFenUnits, nBytes);
+    if (pUnits) pIndex->pFenUnits = pUnits;
+    size_t* pCollapsed = (size_t*)realloc(pIndex->pFenCollapsed, nBytes);
+    if (pCollapsed) pIndex->pFenCollapsed = pCollapsed;
+    if (!pLines || !pUnits || !pCollapsed) return 0;
+
+    for (size_t i = 0; i < n; i++) {
+        pLines[i] = pIndex->ppChunks[i]->nCount;
+        pUnits[i] = pIndex->ppChunks[i]->nUnits;
+        pCollapsed[i] = CollapsedUnits(pIndex->ppChunks[i]);
+    }
+    for (size_t i = 1; i <= n; i++) {
+        size_t nParent = i + (i & (~i + 1));
+        if (nParent <= n) {
+            pLines[nParent - 1] += pLines[i - 1];
+            pUnits[nParent - 1] += pUnits[i - 1];
+            pCollapsed[nParent - 1] += pCollapsed[i - 1];
+        }
+    }
+    return 1;
+}
+
+/* ---- Chunk helpers ---- */
+
+static LineChunk* NewChunk(void) {
+    LineChunk* pChunk = (LineChunk*)malloc(sizeof(LineChunk));
+    if (pChunk) {
+        pChunk->nCount = 0;
+        pChunk->nUnits = 0;
+        pChunk->nCrlf = 0;
+    }
+    return pChunk;
+}
+
+static int ReserveChunks(LineIndex* pIndex, size_t nNeeded) {
+    size_t nCapacity;
+    LineChunk** ppNew;
+
+    if (nNeeded <= pIndex->nChunkCapacity) return 1;
+    nCapacity = pIndex->nChunkCapacity ? pIndex->nChunkCapacity * 2 : 16;
+    while (nCapacity < nNeeded) nCapacity *= 2;
+
+    ppNew = (LineChunk**)realloc(pIndex->ppChunks, nCapacity * sizeof(LineChunk*));
+    if (!ppNew) return 0;
+    pIndex->ppChunks = ppNew;
+    pIndex->nChunkCapacity = nCapacity;
+    return 1;
+}
+
+/* Append one record to a chunk (caller checks capacity) */
+static void ChunkPush(LineChunk* pChunk, uint32_t nLen, uint8_t nBreak) {
+    pChunk->aLens[pChunk->nCount] = nLen;
+    pChunk->aBreaks[pChunk->nCount] = nBreak;
+    pChunk->nCount++;
+    pChunk->nUnits += nLen;
+    if (nBreak == LINE_BREAK_CRLF) pChunk->nCrlf++;
+}
+
+/* Locate the chunk holding nLine; *pnInChunk receives the line within it */
+static size_t ChunkOfLine(const LineIndex* pIndex, size_t nLine, size_t* pnInChunk) {
+    size_t nChunk = FenSearch(pIndex->pFenLines, pIndex->nChunks, nLine, pnInChunk);
+    if (nChunk >= pIndex->nChunks) {
+        nChunk = pIndex->nChunks - 1;
+        *pnInChunk = pIndex->ppChunks[nChunk]->nCount - 1;
+    }
+    return nChunk;
+}
+
+/* ---- Line list (scan output) ---- */
+
+static void LineListPush(LineList* pList, size_t nLen, int nBreak) {
+    if (pList->bFailed) return;
+    if (nLen > UINT32_MAX) {
+        pList->bFailed = 1;
+        return;
+    }
+    if (pList->nCount == pList->nCapacity) {
+        size_t nCapacity = pList->nCapacity ? pList->nCapacity * 2 : 64;
+        uint32_t* pLens = (uint32_t*)realloc(pList->pLens, nCapacity * sizeof(uint32_t));
+        if (pLens) pList->pLens = pLens;
+        uint8_t* pBreaks = (uint8_t*)realloc(pList->pBreaks, nCapacity);
+        if (pBreaks) pList->pBreaks = pBreaks;
+        if (!pLens || !pBreaks) {
+            pList->bFailed = 1;
+            return;
+        }
+        pList->nCapacity = nCapacity;
+    }
+    pList->pLens[pList->nCount] = (uint32_t)nLen;
+    pList->pBreaks[pList->nCount] = (uint8_t)nBreak;
+    pList->nCount++;
+}
+
+static void LineListFree(LineList* pList) {
+    free(pList->pLens);
+    free(pList->pBreaks);
+}
+
+/* ---- Scanning ---- */
+
+/* Receives each complete line found by a scan */
+typedef void (*LineSink)(void* pContext, size_t nLen, int nBreak);
+
+/* Turns break positions from the text scanner into line records */
+typedef struct {
+    TextScan scan;
+    LineSink pfnSink;
+    void* pContext;
+    size_t nLineStart;           /* Scan offset of the current line */
+} LineScanner;
+
+static void ScanBreak(void* pContext, size_t nEnd, int nBreak) {
+    LineScanner* pScan = (LineScanner*)pContext;
+    pScan->pfnSink(pScan->pContext, nEnd - pScan->nLineStart, nBreak);
+    pScan->nLineStart = nEnd;
+}
+
+static void ScanBegin(LineScanner* pScan, LineSink pfnSink, void* pContext) {
+    TextScanInit(&pScan->scan, ScanBreak, pScan);
+    pScan->pfnSink = pfnSink;
+    pScan->pContext = pContext;
+    pScan->nLineStart = 0;
+}
+
+static int ScanSpan(void* pContext, const TextUnit* pText, size_t nLen) {
+    TextScanUnits(&((LineScanner*)pContext)->scan, pText, nLen);
+    return 1;
+}
+
+/* Flush a pending CR; emit the unterminated tail if bDocEnd */
+static void ScanFinish(LineScanner* pScan, int bDocEnd) {
+    TextScanFinish(&pScan->scan);
+    if (bDocEnd) {
+        pScan->pfnSink(pScan->pContext, pScan->scan.nPos - pScan->nLineStart, LINE_BREAK_NONE);
+        pScan->nLineStart = pScan->scan.nPos;
+    }
+}
+
+static void SinkToList(void* pContext, size_t nLen, int nBreak) {
+    LineListPush((LineList*)pContext, nLen, nBreak);
+}
+
+static void BuilderBreak(void* pContext, size_t nEnd, int nBreak) {
+    LineIndexBuilder* pBuilder = (LineIndexBuilder*)pContext;
+    if (!pBuilder->bFailed &&
+        !LineIndexAppendLine(pBuilder->pIndex, nEnd - pBuilder->nLineStart, nBreak)) {
+        pBuilder->bFailed = 1;
+    }
+    pBuilder->nLineStart = nEnd;
+}
+
+static int BuilderSpan(void* pContext, const TextUnit* pText, size_t nLen) {
+    TextScanUnits(&((LineIndexBuilder*)pContext)->scan, pText, nLen);
+    return 1;
+}
+
+/* ---- Public API ---- */
+
+/* Initialize an empty index (call Build or Reset/Finish before querying) */
+void LineIndexInit(LineIndex* pIndex) {
+    memset(pIndex, 0, sizeof(*pIndex));
+}
+
+/* Free all storage */
+void LineIndexFree(LineIndex* pIndex) {
+    for (size_t i = 0; i < pIndex->nChunks; i++) {
+        free(pIndex->ppChunks[i]);
+    }
+    free(pIndex->ppChunks);
+    free(pIndex->pFenLines);
+    free(pIndex->pFenUnits);
+    free(pIndex->pFenCollapsed);
+    LineIndexInit(pIndex);
+}
+
+/* Drop all lines, keeping allocations for reuse */
+void LineIndexReset(LineIndex* pIndex) {
+    for (size_t i = 0; i < pIndex->nChunks; i++) {
+        free(pIndex->ppChunks[i]);
+    }
+    pIndex->nChunks = 0;
+    pIndex->nLines = 0;
+    pIndex->nUnits = 0;
+    pIndex->nCrlf = 0;
+}
+
+/* Append a line at the end of the index (bulk construction) */
+int LineIndexAppendLine(LineIndex* pIndex, size_t nLen, int nBreak) {
+    LineChunk* pChunk = pIndex->nChunks ? pIndex->ppChunks[pIndex->nChunks - 1] : NULL;
+
+    if (nLen > UINT32_MAX) return 0;
+
+    if (!pChunk || pChunk->nCount == LINE_CHUNK_MAX) {
+        if (!ReserveChunks(pIndex, pIndex->nChunks + 1)) return 0;
+        pChunk = NewChunk();
+        if (!pChunk) return 0;
+        pIndex->ppChunks[pIndex->nChunks++] = pChunk;
+    }
+
+    ChunkPush(pChunk, (uint32_t)nLen, (uint8_t)nBreak);
+    pIndex->nLines++;
+    pIndex->nUnits += nLen;
+    if (nBreak == LINE_BREAK_CRLF) pIndex->nCrlf++;
+    return 1;
+}
+
+/* Complete bulk construction; an empty index gets one empty line */
+int LineIndexFinish(LineIndex* pIndex) {
+    if (pIndex->nLines == 0 && !LineIndexAppendLine(pIndex, 0, LINE_BREAK_NONE)) return 0;
+    return RebuildFenwick(pIndex);
+}
+
+/* Start rebuilding pIndex from text fed to pBuilder->scan in document order */
+void LineIndexBuilderBegin(LineIndexBuilder* pBuilder, LineIndex* pIndex) {
+    LineIndexReset(pIndex);
+    TextScanInit(&pBuilder->scan, BuilderBreak, pBuilder);
+    pBuilder->pIndex = pIndex;
+    pBuilder->nLineStart = 0;
+    pBuilder->bFailed = 0;
+}
+
+/* Complete the rebuild; on failure the index is left with one empty line */
+int LineIndexBuilderEnd(LineIndexBuilder* pBuilder) {
+    LineIndex* pIndex = pBuilder->pIndex;
+
+    TextScanFinish(&pBuilder->scan);
+    if (!pBuilder->bFailed &&
+        !LineIndexAppendLine(pIndex, pBuilder->scan.nPos - pBuilder->nLineStart, LINE_BREAK_NONE)) {
+        pBuilder->bFailed = 1;
+    }
+
+    if (pBuilder->bFailed) {
+        LineIndexReset(pIndex);
+        LineIndexFinish(pIndex);
+        return 0;
+    }
+    return LineIndexFinish(pIndex);
+}
+
+/* Rebuild the index from scratch */
+int LineIndexBuild(LineIndex* pIndex, const PieceTable* pDoc) {
+    LineIndexBuilder builder;
+
+    LineIndexBuilderBegin(&builder, pIndex);
+    PieceTableForEach(pDoc, 0, PieceTableLength(pDoc), BuilderSpan, &builder);
+    return LineIndexBuilderEnd(&builder);
+}
+
+/* Number of lines (an empty document has one) */
+size_t LineIndexCount(const LineIndex* pIndex) {
+    return pIndex->nLines ? pIndex->nLines : 1;
+}
+
+/* Offset of the first unit of nLine (clamped to the last line) */
+size_t LineIndexLineStart(const LineIndex* pIndex, size_t nLine) {
+    size_t nInChunk;
+    size_t nChunk;
+    size_t nStart;
+    const LineChunk* pChunk;
+
+    if (pIndex->nChunks == 0) return 0;
+    nChunk = ChunkOfLine(pIndex, nLine, &nInChunk);
+    pChunk = pIndex->ppChunks[nChunk];
+
+    nStart = FenPrefix(pIndex->pFenUnits, nChunk);
+    for (size_t k = 0; k < nInChunk; k++) {
+        nStart += pChunk->aLens[k];
+    }
+    return nStart;
+}
+
+/* Length of nLine including its break; *pnBreak receives the break kind */
+size_t LineIndexLineLength(const LineIndex* pIndex, size_t nLine, int* pnBreak) {
+    size_t nInChunk;
+    size_t nChunk;
+
+    if (pIndex->nChunks == 0) {
+        if (pnBreak) *pnBreak = LINE_BREAK_NONE;
+        return 0;
+    }
+    nChunk = ChunkOfLine(pIndex, nLine, &nInChunk);
+    if (pnBreak) *pnBreak = pIndex->ppChunks[nChunk]->aBreaks[nInChunk];
+    return pIndex->ppChunks[nChunk]->aLens[nInChunk];
+}
+
+/* Chunk and line holding nOffset; *pnLineStart receives that line's start */
+static size_t LocateOffset(const LineIndex* pIndex, size_t nOffset,
+                           size_t* pnChunk, size_t* pnInChunk, size_t* pnLineStart) {
+    size_t nRemain;
+    size_t nChunk;
+    const LineChunk* pChunk;
+
+    if (nOffset >= pIndex->nUnits) {
+        /* At or past the end: last line */
+        size_t nLast = pIndex->nLines - 1;
+        *pnChunk = ChunkOfLine(pIndex, nLast, pnInChunk);
+        *pnLineStart = pIndex->nUnits - pIndex->ppChunks[*pnChunk]->aLens[*pnInChunk];
+        return nLast;
+    }
+
+    nChunk = FenSearch(pIndex->pFenUnits, pIndex->nChunks, nOffset, &nRemain);
+    pChunk = pIndex->ppChunks[nChunk];
+
+    size_t k = 0;
+    while (k + 1 < pChunk->nCount && nRemain >= pChunk->aLens[k]) {
+        nRemain -= pChunk->aLens[k];
+        k++;
+    }
+
+    *pnChunk = nChunk;
+    *pnInChunk = k;
+    *pnLineStart = nOffset - nRemain;
+    return FenPrefix(pIndex->pFenLines, nChunk) + k;
+}
+
+/* Line containing nOffset (the last line for offsets at or past the end) */
+size_t LineIndexLineFromOffset(const LineIndex* pIndex, size_t nOffset) {
+    size_t nChunk, nInChunk, nLineStart;
+    if (pIndex->nChunks == 0) return 0;
+    return LocateOffset(pIndex, nOffset, &nChunk, &nInChunk, &nLineStart);
+}
+
+/* Convert a document offset to a collapsed (one unit per break) offset */
+size_t LineIndexCollapsedFromOffset(const LineIndex* pIndex, size_t nOffset) {
+    size_t nChunk, nInChunk, nLineStart;
+    size_t nCollapsed;
+    size_t nInto;
+    const LineChunk* pChunk;
+
+    if (pIndex->nChunks == 0) return 0;
+    if (nOffset > pIndex->nUnits) nOffset = pIndex->nUnits;
+
+    LocateOffset(pIndex, nOffset, &nChunk, &nInChunk, &nLineStart);
+    pChunk = pIndex->ppChunks[nChunk];
+
+    nCollapsed = FenPrefix(pIndex->pFenCollapsed, nChunk);
+    for (size_t k = 0; k < nInChunk; k++) {
+        nCollapsed += pChunk->aLens[k] - (pChunk->aBreaks[k] == LINE_BREAK_CRLF);
+    }
+
+    /* An offset between CR and LF maps to the end of the break */
+    nInto = nOffset - nLineStart;
+    if (pChunk->aBreaks[nInChunk] == LINE_BREAK_CRLF && nInto >= pChunk->aLens[nInChunk] - 1) {
+        nInto = pChunk->aLens[nInChunk] - 1;
+    }
+    return nCollapsed + nInto;
+}
+
+/* Convert a collapsed offset back to a document offset */
+size_t LineIndexOffsetFromCollapsed(const LineIndex* pIndex, size_t nCollapsed) {
+    size_t nRemain;
+    size_t nChunk;
+    size_t nOffset;
+    const LineChunk* pChunk;
+
+    if (pIndex->nChunks == 0) return 0;
+    if (nCollapsed >= pIndex->nUnits - pIndex->nCrlf) return pIndex->nUnits;
+
+    nChunk = FenSearch(pIndex->pFenCollapsed, pIndex->nChunks, nCollapsed, &nRemain);
+    pChunk = pIndex->ppChunks[nChunk];
+    nOffset = FenPrefix(pIndex->pFenUnits, nChunk);
+
+    for (size_t k = 0; k < pChunk->nCount; k++) {
+        size_t nLineCollapsed = pChunk->aLens[k] - (pChunk->aBreaks[k] == LINE_BREAK_CRLF);
+        if (nRemain < nLineCollapsed || k + 1 == pChunk->nCount) {
+            return nOffset + nRemain;
+        }
+        nRemain -= nLineCollapsed;
+        nOffset += pChunk->aLens[k];
+    }
+    return nOffset;
+}
+
+/*
+ * Replace nRemove lines starting at nFirst with the records in pList.
+ * Small edits inside one chunk are patched in place; anything else rebuilds
+ * the touched chunks and the Fenwick trees.
+ */
+static int Splice(LineIndex* pIndex, size_t nFirst, size_t nRemove, const LineList* pList) {
+    size_t nInChunk;
+    size_t nChunk = ChunkOfLine(pIndex, nFirst, &nInChunk);
+    LineChunk* pChunk = pIndex->ppChunks[nChunk];
+
+    /* Fast path: stays within one chunk and leaves it non-empty */
+    if (nInChunk + nRemove <= pChunk->nCount &&
+        pChunk->nCount - nRemove + pList->nCount <= LINE_CHUNK_MAX &&
+        pChunk->nCount - nRemove + pList->nCount > 0) {
+        size_t nOldUnits = pChunk->nUnits;
+        size_t nOldCrlf = pChunk->nCrlf;
+        size_t nOldCount = pChunk->nCount;
+        size_t nTail = pChunk->nCount - nInChunk - nRemove;
+
+        for (size_t k = nInChunk; k < nInChunk + nRemove; k++) {
+            pChunk->nUnits -= pChunk->aLens[k];
+            if (pChunk->aBreaks[k] == LINE_BREAK_CRLF) pChunk->nCrlf--;
+        }
+        memmove(pChunk->aLens + nInChunk + pList->nCount, pChunk->aLens + nInChunk + nRemove,
+                nTail * sizeof(uint32_t));
+        memmove(pChunk->aBreaks + nInChunk + pList->nCount, pChunk->aBreaks + nInChunk + nRemove,
+                nTail);
+        for (size_t k = 0; k < pList->nCount; k++) {
+            pChunk->aLens[nInChunk + k] = pList->pLens[k];
+            pChunk->aBreaks[nInChunk + k] = pList->pBreaks[k];
+            pChunk->nUnits += pList->pLens[k];
+            if (pList->pBreaks[k] == LINE_BREAK_CRLF) pChunk->nCrlf++;
+        }
+        pChunk->nCount = nOldCount - nRemove + pList->nCount;
+
+        FenAdd(pIndex->pFenLines, pIndex->nChunks, nChunk, pChunk->nCount - nOldCount);
+        FenAdd(pIndex->pFenUnits, pIndex->nChunks, nChunk, pChunk->nUnits - nOldUnits);
+        FenAdd(pIndex->pFenCollapsed, pIndex->nChunks, nChunk,
+               (pChunk->nUnits - pChunk->nCrlf) - (nOldUnits - nOldCrlf));
+
+        pIndex->nLines += pChunk->nCount - nOldCount;
+        pIndex->nUnits += pChunk->nUnits - nOldUnits;
+        pIndex->nCrlf += pChunk->nCrlf - nOldCrlf;
+        return 1;
+    }
+
+    /* General path: gather the affected chunks, splice, and re-chunk */
+    size_t nLastLine = nFirst + nRemove;  /* First line kept after the removal */
+    size_t nFirstChunk = nChunk;
+    size_t nLastChunk;
+    size_t nLastInChunk;
+
+    if (nLastLine >= pIndex->nLines) {
+        nLastChunk = pIndex->nChunks - 1;
+    } else {
+        nLastChunk = ChunkOfLine(pIndex, nLastLine, &nLastInChunk);
+    }
+
+    /* Pull in a neighbour if the result would be too small */
+    size_t nGathered = 0;
+    for (size_t c = nFirstChunk; c <= nLastChunk; c++) {
+        nGathered += pIndex->ppChunks[c]->nCount;
+    }
+    nGathered = nGathered - nRemove + pList->nCount;
+    if (nGathered < LINE_CHUNK_MIN) {
+        if (nLastChunk + 1 < pIndex->nChunks) {
+            nLastChunk++;
+            nGathered += pIndex->ppChunks[nLastChunk]->nCount;
+        } else if (nFirstChunk > 0) {
+            nFirstChunk--;
+            nGathered += pIndex->ppChunks[nFirstChunk]->nCount;
+        }
+    }
+
+    /* Line number of the first gathered record */
+    size_t nBase = FenPrefix(pIndex->pFenLines, nFirstChunk);
+    LineList merged = {0};
+
+    for (size_t c = nFirstChunk; c <= nLastChunk; c++) {
+        const LineChunk* pSrc = pIndex->ppChunks[c];
+        for (size_t k = 0; k < pSrc->nCount; k++, nBase++) {
+            if (nBase == nFirst) {
+                for (size_t n = 0; n < pList->nCount; n++) {
+                    LineListPush(&merged, pList->pLens[n], pList->pBreaks[n]);
+                }
+            }
+            if (nBase < nFirst || nBase >= nFirst + nRemove) {
+                LineListPush(&merged, pSrc->aLens[k], pSrc->aBreaks[k]);
+            }
+        }
+    }
+    if (nBase == nFirst) {
+        /* Insertion after the last gathered line */
+        for (size_t n = 0; n < pList->nCount; n++) {
+            LineListPush(&merged, pList->pLens[n], pList->pBreaks[n]);
+        }
+    }
+    if (merged.bFailed) {
+        LineListFree(&merged);
+        return 0;
+    }
+
+    /* Build replacement chunks */
+    size_t nNewChunks = (merged.nCount + LINE_CHUNK_FILL - 1) / LINE_CHUNK_FILL;
+    size_t nOldChunks = nLastChunk - nFirstChunk + 1;
+    LineChunk** ppNew = (LineChunk**)malloc((nNewChunks ? nNewChunks : 1) * sizeof(LineChunk*));
+    if (!ppNew || !ReserveChunks(pIndex, pIndex->nChunks - nOldChunks + nNewChunks)) {
+        free(ppNew);
+        LineListFree(&merged);
+        return 0;
+    }
+
+    size_t nPos = 0;
+    for (size_t c = 0; c < nNewChunks; c++) {
+        ppNew[c] = NewChunk();
+        if (!ppNew[c]) {
+            while (c > 0) free(ppNew[--c]);
+            free(ppNew);
+            LineListFree(&merged);
+            return 0;
+        }
+        /* Spread records evenly across the new chunks */
+        size_t nTake = (merged.nCount - nPos) / (nNewChunks - c);
+        for (size_t k = 0; k < nTake; k++, nPos++) {
+            ChunkPush(ppNew[c], merged.pLens[nPos], merged.pBreaks[nPos]);
+        }
+    }
+
+    for (size_t c = nFirstChunk; c <= nLastChunk; c++) {
+        free(pIndex->ppChunks[c]);
+    }
+    memmove(pIndex->ppChunks + nFirstChunk + nNewChunks, pIndex->ppChunks + nLastChunk + 1,
+            (pIndex->nChunks - nLastChunk - 1) * sizeof(LineChunk*));
+    memcpy(pIndex->ppChunks + nFirstChunk, ppNew, nNewChunks * sizeof(LineChunk*));
+    pIndex->nChunks = pIndex->nChunks - nOldChunks + nNewChunks;
+
+    free(ppNew);
+    LineListFree(&merged);
+
+    /* Recompute totals from chunk sums */
+    pIndex->nLines = 0;
+    pIndex->nUnits = 0;
+    pIndex->nCrlf = 0;
+    for (size_t c = 0; c < pIndex->nChunks; c++) {
+        pIndex->nLines += pIndex->ppChunks[c]->nCount;
+        pIndex->nUnits += pIndex->ppChunks[c]->nUnits;
+        pIndex->nCrlf += pIndex->ppChunks[c]->nCrlf;
+    }
+    return RebuildFenwick(pIndex);
+}
+
+/*
+ * Update the index after the document changed. pDoc must already contain
+ * the edit: nRemoved units at nOffset were replaced by nInserted units.
+ * Only the lines touching the edit are rescanned. The line before the edit
+ * is included so a CR and LF that meet (or separate) are handled.
+ */
+int LineIndexApplyEdit(LineIndex* pIndex, const PieceTable* pDoc,
+                       size_t nOffset, size_t nRemoved, size_t nInserted) {
+    size_t nFirst, nLast;
+    size_t nStart, nOldEnd, nNewEnd;
+    int bDocEnd;
+    LineList list = {0};
+    LineScanner scan;
+
+    if (pIndex->nChunks == 0) return LineIndexBuild(pIndex, pDoc);
+    if (nOffset > pIndex->nUnits || nRemoved > pIndex->nUnits - nOffset) {
+        return LineIndexBuild(pIndex, pDoc);
+    }
+
+    nFirst = LineIndexLineFromOffset(pIndex, nOffset > 0 ? nOffset - 1 : 0);
+    nLast = LineIndexLineFromOffset(pIndex, nOffset + nRemoved);
+    nStart = LineIndexLineStart(pIndex, nFirst);
+    nOldEnd = LineIndexLineStart(pIndex, nLast) + LineIndexLineLength(pIndex, nLast, NULL);
+    nNewEnd = nOldEnd - nRemoved + nInserted;
+    bDocEnd = (nLast + 1 == pIndex->nLines);
+
+    if (nNewEnd > PieceTableLength(pDoc) ||
+        (bDocEnd && nNewEnd != PieceTableLength(pDoc))) {
+        return LineIndexBuild(pIndex, pDoc);
+    }
+
+    ScanBegin(&scan, SinkToList, &list);
+    PieceTableForEach(pDoc, nStart, nNewEnd - nStart, ScanSpan, &scan);
+    ScanFinish(&scan, bDocEnd);
+
+    /* A partial line left over means the index was out of step */
+    if (list.bFailed || scan.nLineStart != scan.scan.nPos) {
+        LineListFree(&list);
+        return LineIndexBuild(pIndex, pDoc);
+    }
+
+    int bOk = Splice(pIndex, nFirst, nLast - nFirst + 1, &list);
+    LineListFree(&list);
+    return bOk ? 1 : LineIndexBuild(pIndex, pDoc);
+}
@@ -0,0 +1,68 @@
+#ifndef LINE_INDEX_H
+#define LINE_INDEX_H
+
+/*
+ * Line-start index for a piece table document.
+ *
+ * Portable C. Line lengths are kept in fixed-size chunks; Fenwick trees over
+ * the per-chunk sums answer line -> offset and offset -> line in O(log n)
+ * plus a bounded scan inside one chunk. Edits are applied incrementally by
+ * rescanning only the lines they touch.
+ *
+ * Offsets are in document units. "Collapsed" offsets count every line break
+ * as a single unit, which is how RichEdit addresses its text.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "piece_table.h"
+#include "text_scan.h"
+
+typedef struct LineChunk LineChunk;
+
+/* Line index state */
+typedef struct {
+    LineChunk** ppChunks;        /* Chunks in document order */
+    size_t nChunks;              /* Chunks in use */
+    size_t nChunkCapacity;       /* Slots allocated in ppChunks */
+    size_t* pFenLines;           /* Fenwick tree: lines per chunk */
+    size_t* pFenUnits;           /* Fenwick tree: units per chunk */
+    size_t* pFenCollapsed;       /* Fenwick tree: collapsed units per chunk */
+    size_t nLines;               /* Total lines */
+    size_t nUnits;               /* Total units */
+    size_t nCrlf;                /* Total CRLF breaks */
+} LineIndex;
+
+/* Streaming rebuild: Begin, feed text with TextScanUnits(&builder.scan, ...), End */
+typedef struct {
+    TextScan scan;               /* Scanner to feed the text through */
+    LineIndex* pIndex;           /* Index being rebuilt */
+    size_t nLineStart;           /* Offset of the current line */
+    int bFailed;                 /* Allocation failed */
+} LineIndexBuilder;
+
+/* Lifetime */
+void LineIndexInit(LineIndex* pIndex);
+void LineIndexFree(LineIndex* pIndex);
+int LineIndexBuild(LineIndex* pIndex, const PieceTable* pDoc);
+
+/* Bulk construction: Reset, append every line in order, then Finish */
+void LineIndexReset(LineIndex* pIndex);
+int LineIndexAppendLine(LineIndex* pIndex, size_t nLen, int nBreak);
+int LineIndexFinish(LineIndex* pIndex);
+void LineIndexBuilderBegin(LineIndexBuilder* pBuilder, LineIndex* pIndex);
+int LineIndexBuilderEnd(LineIndexBuilder* pBuilder);
+
+/* Incremental update after pDoc changed [nOffset, nOffset + nRemoved) into nInserted units */
+int LineIndexApplyEdit(LineIndex* pIndex, const PieceTable* pDoc,
+                       size_t nOffset, size_t nRemoved, size_t nInserted);
+
+/* Queries */
+size_t LineIndexCount(const LineIndex* pIndex);
+size_t LineIndexLineStart(const LineIndex* pIndex, size_t nLine);
+size_t LineIndexLineLength(const LineIndex* pIndex, size_t nLine, int* pnBreak);
+size_t LineIndexLineFromOffset(const LineIndex* pIndex, size_t nOffset);
+size_t LineIndexCollapsedFromOffset(const LineIndex* pIndex, size_t nOffset);
+size_t LineIndexOffsetFromCollapsed(const LineIndex* pIndex, size_t nCollapsed);
+
+#endif /* LINE_INDEX_H */
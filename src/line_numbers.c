@@ -54,13 +54,6 @@ int CalculateLineNumberWidth(int nLineCount) {
 }
 
 
-/* Get line count from edit control */
-static int GetEditLineCount(HWND hwndEdit) {
-    if (!hwndEdit) return 1;
-    int nLines = (int)SendMessage(hwndEdit, EM_GETLINECOUNT, 0, 0);
-    return (nLines > 0) ? nLines : 1;
-}
-
 /* Get first visible line in edit control */
 static int GetFirstVisibleLine(HWND hwndEdit) {
     if (!hwndEdit) return 0;
@@ -88,59 +81,6 @@ HWND CreateLineNumberWindow(HWND hwndParent, HINSTANCE hInstance) {
     return hwndLineNum;
 }
 
-/* Count logical lines (based on newline characters) */
-static int CountLogicalLines(HWND hwndEdit) {
-    int nTextLen = GetWindowTextLength(hwndEdit);
-    if (nTextLen == 0) return 1;
-    
-    /* For performance, use EM_GETLINECOUNT for non-wrapped mode */
-    /* In wrapped mode, we need to count actual newlines */
-    int nLines = 1;
-    
-    /* Get text and count newlines */
-    TCHAR* pText = (TCHAR*)HeapAlloc(GetProcessHeap(), 0, (nTextLen + 1) * sizeof(TCHAR));
-    if (pText) {
-        GetWindowText(hwndEdit, pText, nTextLen + 1);
-        for (int i = 0; i < nTextLen; i++) {
-            if (pText[i] == TEXT('\n')) {
-                nLines++;
-            }
-        }
-        HeapFree(GetProcessHeap(), 0, pText);
-    }
-    
-    return nLines;
-}
-
-/* Get character index for logical line (counting newlines) */
-static int GetLogicalLineCharIndex(HWND hwndEdit, int nLogicalLine) {
-    if (nLogicalLine == 0) return 0;
-    
-    int nTextLen = GetWindowTextLength(hwndEdit);
-    if (nTextLen == 0) return 0;
-    
-    TCHAR* pText = (TCHAR*)HeapAlloc(GetProcessHeap(), 0, (nTextLen + 1) * sizeof(TCHAR));
-    if (!pText) return 0;
-    
-    GetWindowText(hwndEdit, pText, nTextLen + 1);
-    
-    int nCurrentLine = 0;
-    int nCharIndex = 0;
-    
-    for (int i = 0; i < nTextLen && nCurrentLine < nLogicalLine; i++) {
-        if (pText[i] == TEXT('\n')) {
-            nCurrentLine++;
-            if (nCurrentLine == nLogicalLine) {
-                nCharIndex = i + 1;
-                break;
-            }
-        }
-    }
-    
-    HeapFree(GetProcessHeap(), 0, pText);
-    return nCharIndex;
-}
-
 /* Line number window procedure */
 LRESULT CALLBACK LineNumberWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
     switch (msg) {
@@ -149,8 +89,9 @@ LRESULT CALLBACK LineNumberWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lP
             HDC hdcScreen = BeginPaint(hwnd, &ps);
             
             /* Get associated edit control from parent's current tab */
+            TabState* pTab = GetCurrentTabState();
             HWND hwndEdit = GetCurrentEdit();
-            if (!hwndEdit) {
+            if (!pTab || !hwndEdit) {
                 EndPaint(hwnd, &ps);
                 return 0;
             }
@@ -196,9 +137,6 @@ LRESULT CALLBACK LineNumberWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lP
             GetTextMetrics(hdc, &tm);
             int nLineHeight = tm.tmHeight;
             
-            /* Get total logical lines (based on newlines, not visual wrapping) */
-            int nTotalLines = CountLogicalLines(hwndEdit);
-            
             /* Set text properties - dark gray like Notepad++ */
             SetBkMode(hdc, TRANSPARENT);
             SetTextColor(hdc, RGB(80, 80, 80));
@@ -211,9 +149,15 @@ LRESULT CALLBACK LineNumberWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lP
             /* Track last Y position to avoid drawing at same position */
             int nLastY = -10000;
             
-            for (int nLine = 0; nLine < nTotalLines; nLine++) {
+            /* Start at the logical line holding the first visible (visual) line */
+            int nFirstVisible = GetFirstVisibleLine(hwndEdit);
+            LONG nFirstChar = (LONG)SendMessage(hwndEdit, EM_LINEINDEX, nFirstVisible, 0);
+            size_t nTotalLines = LineIndexCount(&pTab->lines);
+            size_t nLine = LineIndexLineFromOffset(&pTab->lines, DocOffsetFromEditPos(pTab, nFirstChar));
+            
+            for (; nLine < nTotalLines; nLine++) {
                 /* Get character index at start of this logical line */
-                int nCharIndex = GetLogicalLineCharIndex(hwndEdit, nLine);
+                LONG nCharIndex = EditPosFromDocOffset(pTab, LineIndexLineStart(&pTab->lines, nLine));
                 
                 /* Get Y position of this character */
                 LRESULT lPos = SendMessage(hwndEdit, EM_POSFROMCHAR, nCharIndex, 0);
@@ -221,7 +165,7 @@ LRESULT CALLBACK LineNumberWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lP
                 /* Extract Y coordinate - handle as signed short for proper negative values */
                 short nY = (short)HIWORD(lPos);
                 
-                /* Skip if line is above visible area (scrolled past) */
+                /* Skip if line is above visible area (wrapped line scrolled past) */
                 if (nY < -nLineHeight) continue;
                 
                 /* Stop if line is below visible area */
@@ -235,7 +179,7 @@ LRESULT CALLBACK LineNumberWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lP
                 rcLine.top = (int)nY;
                 rcLine.bottom = rcLine.top + nLineHeight;
                 
-                _sntprintf(szLineNum, 16, TEXT("%d"), nLine + 1);
+                _sntprintf(szLineNum, 16, TEXT("%d"), (int)(nLine + 1));
                 DrawText(hdc, szLineNum, -1, &rcLine, DT_RIGHT | DT_TOP | DT_SINGLELINE);
             }
             
@@ -268,16 +212,7 @@ void UpdateLineNumbers(HWND hwndLineNumbers, HWND hwndEdit) {
     (void)hwndEdit; /* Unused - we get edit from GetCurrentEdit() */
     if (!hwndLineNumbers || !IsWindowVisible(hwndLineNumbers)) return;
     
-    /* Invalidate to trigger repaint */
-    InvalidateRect(hwndLineNumbers, NULL, TRUE);
-}
-
-/* Sync line number scroll with edit control */
-void SyncLineNumberScroll(HWND hwndLineNumbers, HWND hwndEdit) {
-    (void)hwndEdit; /* Unused - we get edit from GetCurrentEdit() */
-    if (!hwndLineNumbers || !IsWindowVisible(hwndLineNumbers)) return;
-    
-    /* Invalidate without erasing background for smoother redraw */
+    /* Invalidate without erasing background (painting is double buffered) */
     InvalidateRect(hwndLineNumbers, NULL, FALSE);
 }
 
@@ -292,7 +227,10 @@ void ToggleLineNumbers(HWND hwnd) {
     
     /* Update current tab's line number window */
     TabState* pTab = GetCurrentTabState();
-    if (pTab) {
+    if (pTab && pTab->bLargeFile) {
+        /* The large file viewer draws its own gutter */
+        InvalidateRect(pTab->hwndEdit, NULL, FALSE);
+    } else if (pTab) {
         if (g_AppState.bShowLineNumbers) {
             /* Create line number window if not exists */
             if (!pTab->lineNumState.hwndLineNumbers) {
@@ -300,22 +238,16 @@ void ToggleLineNumbers(HWND hwnd) {
             }
             
             /* Calculate width based on line count */
-            int nLines = GetEditLineCount(pTab->hwndEdit);
+            int nLines = (int)LineIndexCount(&pTab->lines);
             pTab->lineNumState.nLineNumberWidth = CalculateLineNumberWidth(nLines);
             pTab->lineNumState.bShowLineNumbers = TRUE;
             
             ShowWindow(pTab->lineNumState.hwndLineNumbers, SW_SHOW);
-            
-            /* Start periodic sync timer - 100ms is enough for smooth sync */
-            SetTimer(hwnd, 2, 100, NULL);
         } else {
             pTab->lineNumState.bShowLineNumbers = FALSE;
             if (pTab->lineNumState.hwndLineNumbers) {
                 ShowWindow(pTab->lineNumState.hwndLineNumbers, SW_HIDE);
             }
-            
-            /* Stop periodic sync timer */
-            KillTimer(hwnd, 2);
         }
     }
     
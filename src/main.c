@@ -16,62 +16,134 @@ static HMODULE g_hRichEdit = NULL;
 /* Original edit control window procedure */
 static WNDPROC g_OrigEditProc = NULL;
 
-/* Subclassed edit control procedure to catch scroll events */
+/* Coalesces gutter, status bar, layout and title refreshes into frames */
+static FrameScheduler g_FrameSched;
+
+/* Where a 32-bit build keeps the top half of an edit control's tab handle */
+#ifndef _WIN64
+static const TCHAR szTabGenerationProp[] = TEXT("XNoteTabGeneration");
+#endif
+
+/* Tag an edit control with the handle of the tab it belongs to */
+static void SetEditTab(HWND hwndEdit, TabHandle hTab) {
+    SetWindowLongPtr(hwndEdit, GWLP_USERDATA, (LONG_PTR)hTab);
+#ifndef _WIN64
+    /* LONG_PTR holds only the slot half here; the generation goes beside it */
+    SetProp(hwndEdit, szTabGenerationProp, (HANDLE)(UINT_PTR)(hTab >> 32));
+#endif
+}
+
+/* Tab that owns an edit control (NULL if none) */
+static TabState* FindTabByEdit(HWND hwndEdit) {
+    TabHandle hTab = (TabHandle)(ULONG_PTR)GetWindowLongPtr(hwndEdit, GWLP_USERDATA);
+#ifndef _WIN64
+    hTab |= (TabHandle)(UINT_PTR)GetProp(hwndEdit, szTabGenerationProp) << 32;
+#endif
+    return (TabState*)TabRegistryGet(&g_AppState.tabs, hTab);
+}
+
+/* Keys that move the caret without editing */
+static BOOL IsNavigationKey(WPARAM vk) {
+    return vk == VK_LEFT || vk == VK_RIGHT || vk == VK_UP || vk == VK_DOWN ||
+           vk == VK_HOME || vk == VK_END || vk == VK_PRIOR || vk == VK_NEXT;
+}
+
+/*
+ * Pass on a message that may edit the text, noting the selection it starts
+ * from: EN_CHANGE then reads only the text that changed.
+ */
+static LRESULT CallEditingProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+    TabState* pTab = FindTabByEdit(hwnd);
+    BOOL bOuter = pTab && !pTab->bSelBefore;
+    LRESULT result;
+    
+    if (bOuter) {
+        SendMessage(hwnd, EM_GETSEL, (WPARAM)&pTab->dwSelBeforeStart, (LPARAM)&pTab->dwSelBeforeEnd);
+        pTab->bSelBefore = TRUE;
+    }
+    result = CallWindowProc(g_OrigEditProc, hwnd, msg, wParam, lParam);
+    if (bOuter) pTab->bSelBefore = FALSE;
+    return result;
+}
+
+/* Subclassed edit control procedure to catch scrolling and caret movement */
 static LRESULT CALLBACK EditSubclassProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
     switch (msg) {
-        case WM_VSCROLL:
-        case WM_HSCROLL:
-        case WM_MOUSEWHEEL: {
-            /* Call original proc first */
-            LRESULT result = CallWindowProc(g_OrigEditProc, hwnd, msg, wParam, lParam);
-            
-            /* Then sync line numbers */
-            TabState* pTab = GetCurrentTabState();
-            if (pTab && g_AppState.bShowLineNumbers && pTab->lineNumState.hwndLineNumbers) {
-                SyncLineNumberScroll(pTab->lineNumState.hwndLineNumbers, pTab->hwndEdit);
+        case WM_UNDO:
+        case EM_UNDO: {
+            /* The context menu's Undo goes through the tab's journal too */
+            TabState* pTab = FindTabByEdit(hwnd);
+            if (pTab) {
+                EditUndo(pTab);
+                return TRUE;
             }
-            return result;
+            break;
         }
         
         case WM_KEYDOWN:
-        case WM_KEYUP: {
-            /* Call original proc first */
-            LRESULT result = CallWindowProc(g_OrigEditProc, hwnd, msg, wParam, lParam);
-            
-            /* Sync line numbers for navigation keys */
-            if (wParam == VK_UP || wParam == VK_DOWN || wParam == VK_PRIOR || 
-                wParam == VK_NEXT || wParam == VK_HOME || wParam == VK_END) {
-                TabState* pTab = GetCurrentTabState();
-                if (pTab && g_AppState.bShowLineNumbers && pTab->lineNumState.hwndLineNumbers) {
-                    SyncLineNumberScroll(pTab->lineNumState.hwndLineNumbers, pTab->hwndEdit);
-                }
+        case WM_LBUTTONDOWN: {
+            /* Moving the caret ends the current typing run */
+            if (msg == WM_LBUTTONDOWN || IsNavigationKey(wParam)) {
+                TabState* pTab = FindTabByEdit(hwnd);
+                if (pTab) UndoJournalSeal(&pTab->undo);
             }
+            if (msg == WM_KEYDOWN && wParam == VK_ESCAPE) {
+                /* Escape stops a Find in Files search, keeping what it found */
+                TabState* pTab = FindTabByEdit(hwnd);
+                if (pTab) StopFindInFiles(pTab);
+            }
+            /* A drag and drop inside the control is left to the full comparison */
+            LRESULT result = (msg == WM_KEYDOWN) ? CallEditingProc(hwnd, msg, wParam, lParam)
+                                                 : CallWindowProc(g_OrigEditProc, hwnd, msg, wParam, lParam);
+            RequestFrame(GetParent(hwnd), FRAME_DIRTY_GUTTER | FRAME_DIRTY_STATUS);
             return result;
         }
         
-        case WM_LBUTTONDOWN:
-        case WM_LBUTTONUP: {
+        case WM_CHAR:
+        case WM_IME_CHAR:
+        case WM_PASTE:
+        case WM_CUT:
+        case WM_CLEAR:
+        case EM_REPLACESEL:
+            return CallEditingProc(hwnd, msg, wParam, lParam);
+        
+        case WM_VSCROLL:
+        case WM_HSCROLL:
+        case WM_MOUSEWHEEL:
+        case WM_LBUTTONUP:
+        case EM_SCROLL:
+        case EM_LINESCROLL:
+        case EM_SETSEL: {
             /* Call original proc first */
             LRESULT result = CallWindowProc(g_OrigEditProc, hwnd, msg, wParam, lParam);
             
-            /* Sync line numbers after mouse click (might cause scroll) */
-            TabState* pTab = GetCurrentTabState();
-            if (pTab && g_AppState.bShowLineNumbers && pTab->lineNumState.hwndLineNumbers) {
-                SyncLineNumberScroll(pTab->lineNumState.hwndLineNumbers, pTab->hwndEdit);
+            /* The view or the caret may have moved: refresh on the next frame */
+            RequestFrame(GetParent(hwnd), FRAME_DIRTY_GUTTER | FRAME_DIRTY_STATUS);
+            return result;
+        }
+        
+        case WM_LBUTTONDBLCLK: {
+            /* Double-clicking a Find in Files result opens it */
+            LRESULT result = CallWindowProc(g_OrigEditProc, hwnd, msg, wParam, lParam);
+            TabState* pTab = FindTabByEdit(hwnd);
+            if (pTab && pTab->bFindResults) {
+                OpenFindResult(GetParent(hwnd), pTab);
             }
             return result;
         }
         
-        case EM_SCROLL:
-        case EM_LINESCROLL:
-        case WM_SIZE: {
-            /* Call original proc first */
+#ifndef _WIN64
+        case WM_NCDESTROY:
+            RemoveProp(hwnd, szTabGenerationProp);
+            break;
+#endif
+        
+        case WM_MOUSEMOVE: {
             LRESULT result = CallWindowProc(g_OrigEditProc, hwnd, msg, wParam, lParam);
             
-            /* Sync line numbers */
-            TabState* pTab = GetCurrentTabState();
-            if (pTab && g_AppState.bShowLineNumbers && pTab->lineNumState.hwndLineNumbers) {
-                SyncLineNumberScroll(pTab->lineNumState.hwndLineNumbers, pTab->hwndEdit);
+            /* Dragging a selection moves the caret and may scroll */
+            if (wParam & MK_LBUTTON) {
+                RequestFrame(GetParent(hwnd), FRAME_DIRTY_GUTTER | FRAME_DIRTY_STATUS);
             }
             return result;
         }
@@ -173,18 +245,28 @@ static LRESULT CALLBACK TabSubclassProc(HWND hwnd, UINT msg, WPARAM wParam, LPAR
     return CallWindowProc(g_OrigTabProc, hwnd, msg, wParam, lParam);
 }
 
+/* Number of open tabs */
+int GetTabCount(void) {
+    return (int)TabRegistryCount(&g_AppState.tabs);
+}
+
+/* Tab at a position in the tab strip (NULL if out of range) */
+TabState* GetTab(int nTabIndex) {
+    return nTabIndex >= 0 ? (TabState*)TabRegistryAt(&g_AppState.tabs, (size_t)nTabIndex) : NULL;
+}
+
 /* Get current edit control */
 HWND GetCurrentEdit(void) {
-    if (g_AppState.nCurrentTab >= 0 && g_AppState.nCurrentTab < g_AppState.nTabCount) {
-        return g_AppState.tabs[g_AppState.nCurrentTab].hwndEdit;
+    if (g_AppState.nCurrentTab >= 0 && g_AppState.nCurrentTab < GetTabCount()) {
+        return GetTab(g_AppState.nCurrentTab)->hwndEdit;
     }
     return NULL;
 }
 
 /* Get current tab state */
 TabState* GetCurrentTabState(void) {
-    if (g_AppState.nCurrentTab >= 0 && g_AppState.nCurrentTab < g_AppState.nTabCount) {
-        return &g_AppState.tabs[g_AppState.nCurrentTab];
+    if (g_AppState.nCurrentTab >= 0 && g_AppState.nCurrentTab < GetTabCount()) {
+        return GetTab(g_AppState.nCurrentTab);
     }
     return NULL;
 }
@@ -195,17 +277,50 @@ void InitTabState(TabState* pState) {
     pState->bModified = FALSE;
     pState->bUntitled = TRUE;
     pState->hwndEdit = NULL;
-    pState->pContent = NULL;
-    pState->dwContentSize = 0;
+    pState->bRichEdit = FALSE;
+    PieceTableInit(&pState->doc);
+    LineIndexInit(&pState->lines);
+    DocStatsInit(&pState->stats);
+    UndoJournalInit(&pState->undo, UNDO_BUDGET_BYTES);
     pState->lineNumState.bShowLineNumbers = FALSE;
     pState->lineNumState.hwndLineNumbers = NULL;
     pState->lineNumState.nLineNumberWidth = 0;
     pState->lineEnding = LINE_ENDING_CRLF;  /* Default Windows line ending */
+    pState->nEncoding = TEXT_ENCODING_UTF8;
     pState->bInsertMode = TRUE;              /* Default insert mode */
+    pState->bLargeFile = FALSE;
+    pState->pLoad = NULL;
+    pState->pJournal = NULL;
+    pState->bReplayJournal = FALSE;
+    pState->nGotoLine = 0;
+    pState->bFindResults = FALSE;
+    pState->pFindFiles = NULL;
+    pState->pHibernation = NULL;
+    pState->dwLastActive = GetTickCount();
+    pState->savedPos.bValid = FALSE;
+    pState->bDeferred = FALSE;
+    pState->nSessionId = 0;
+    pState->nSessionCrc = 0;
+    pState->bSelBefore = FALSE;
+    pState->bPatchingEdit = FALSE;
+}
+
+/*
+ * Switch word wrap on an edit control in place. RichEdit only lays out
+ * what it shows, so this costs nothing like refilling it; the plain EDIT
+ * control fixes wrapping at creation (FALSE: recreate it instead).
+ */
+static BOOL SetEditWordWrap(HWND hwndEdit, BOOL bWordWrap) {
+    if (!IsRichEditControl(hwndEdit)) return FALSE;
+    
+    /* Target width 0 wraps at the window; 1 (twip) means no wrapping */
+    SendMessage(hwndEdit, EM_SETTARGETDEVICE, 0, bWordWrap ? 0 : 1);
+    SendMessage(hwndEdit, EM_SHOWSCROLLBAR, SB_HORZ, !bWordWrap);
+    return TRUE;
 }
 
 /* Create edit control for a tab */
-static HWND CreateTabEditControl(HWND hwndParent, BOOL bWordWrap) {
+static HWND CreateTabEditControl(HWND hwndParent, TabHandle hTab, BOOL bWordWrap) {
     DWORD dwStyle = WS_CHILD | WS_VSCROLL | ES_MULTILINE | 
                     ES_AUTOVSCROLL | ES_WANTRETURN | ES_NOHIDESEL;
     
@@ -217,12 +332,15 @@ static HWND CreateTabEditControl(HWND hwndParent, BOOL bWordWrap) {
     
     /* Try RichEdit first (better for large files) */
     if (g_hRichEdit) {
+        /* RichEdit always gets a horizontal scroll bar; wrapping is switched by message */
+        DWORD dwRichStyle = dwStyle | WS_HSCROLL | ES_AUTOHSCROLL;
+        
         /* Try RICHEDIT50W first (from Msftedit.dll) */
         hwndEdit = CreateWindowEx(
             WS_EX_CLIENTEDGE,
             TEXT("RICHEDIT50W"),
             TEXT(""),
-            dwStyle,
+            dwRichStyle,
             0, 0, 0, 0,
             hwndParent,
             (HMENU)IDC_EDIT,
@@ -236,7 +354,7 @@ static HWND CreateTabEditControl(HWND hwndParent, BOOL bWordWrap) {
                 WS_EX_CLIENTEDGE,
                 TEXT("RichEdit20W"),
                 TEXT(""),
-                dwStyle,
+                dwRichStyle,
                 0, 0, 0, 0,
                 hwndParent,
                 (HMENU)IDC_EDIT,
@@ -265,8 +383,21 @@ static HWND CreateTabEditControl(HWND hwndParent, BOOL bWordWrap) {
         /* Set font */
         SendMessage(hwndEdit, WM_SETFONT, (WPARAM)g_hFont, TRUE);
         
-        /* Set text limit to maximum */
-        SendMessage(hwndEdit, EM_SETLIMITTEXT, 0, 0);
+        if (IsRichEditControl(hwndEdit)) {
+            /* RichEdit needs an explicit limit and opt-in for EN_CHANGE */
+            SendMessage(hwndEdit, EM_EXLIMITTEXT, 0, 0x7FFFFFFE);
+            SendMessage(hwndEdit, EM_SETEVENTMASK, 0, ENM_CHANGE);
+            
+            /* Undo comes from the tab's journal, so the control keeps no history */
+            SendMessage(hwndEdit, EM_SETUNDOLIMIT, 0, 0);
+            SetEditWordWrap(hwndEdit, bWordWrap);
+        } else {
+            /* Set text limit to maximum */
+            SendMessage(hwndEdit, EM_SETLIMITTEXT, 0, 0);
+        }
+        
+        /* Messages to the control find its tab by this, with no search */
+        SetEditTab(hwndEdit, hTab);
         
         /* Subclass edit control to catch scroll events */
         g_OrigEditProc = (WNDPROC)SetWindowLongPtr(hwndEdit, GWLP_WNDPROC, (LONG_PTR)EditSubclassProc);
@@ -277,24 +408,29 @@ static HWND CreateTabEditControl(HWND hwndParent, BOOL bWordWrap) {
 
 /* Add a new tab */
 int AddNewTab(HWND hwnd, const TCHAR* szTitle) {
-    if (g_AppState.nTabCount >= MAX_TABS) {
-        ShowErrorDialog(hwnd, TEXT("Maximum number of tabs reached."));
+    int nNewTab = GetTabCount();
+    
+    /* Its state gets a slot of its own that stays put until the tab closes */
+    TabHandle hTab;
+    TabState* pTab = (TabState*)TabRegistryAdd(&g_AppState.tabs, &hTab);
+    if (!pTab) {
+        ShowErrorDialog(hwnd, TEXT("Not enough memory to open another tab."));
         return -1;
     }
     
-    int nNewTab = g_AppState.nTabCount;
-    
     /* Initialize tab state */
-    InitTabState(&g_AppState.tabs[nNewTab]);
+    InitTabState(pTab);
+    pTab->hTab = hTab;
     
     /* Create edit control for this tab */
-    g_AppState.tabs[nNewTab].hwndEdit = CreateTabEditControl(hwnd, g_AppState.bWordWrap);
+    pTab->hwndEdit = CreateTabEditControl(hwnd, hTab, g_AppState.bWordWrap);
+    pTab->bRichEdit = IsRichEditControl(pTab->hwndEdit);
     
     /* Create line number window if line numbers are enabled */
     if (g_AppState.bShowLineNumbers) {
-        g_AppState.tabs[nNewTab].lineNumState.hwndLineNumbers = CreateLineNumberWindow(hwnd, g_AppState.hInstance);
-        g_AppState.tabs[nNewTab].lineNumState.bShowLineNumbers = TRUE;
-        g_AppState.tabs[nNewTab].lineNumState.nLineNumberWidth = CalculateLineNumberWidth(1);
+        pTab->lineNumState.hwndLineNumbers = CreateLineNumberWindow(hwnd, g_AppState.hInstance);
+        pTab->lineNumState.bShowLineNumbers = TRUE;
+        pTab->lineNumState.nLineNumberWidth = CalculateLineNumberWidth(1);
     }
     
     /* Add tab to tab control */
@@ -303,8 +439,6 @@ int AddNewTab(HWND hwnd, const TCHAR* szTitle) {
     tie.pszText = (LPTSTR)szTitle;
     TabCtrl_InsertItem(g_AppState.hwndTab, nNewTab, &tie);
     
-    g_AppState.nTabCount++;
-    
     /* Switch to new tab */
     SwitchToTab(hwnd, nNewTab);
     
@@ -313,9 +447,9 @@ int AddNewTab(HWND hwnd, const TCHAR* szTitle) {
 
 /* Close a tab */
 void CloseTab(HWND hwnd, int nTabIndex) {
-    if (nTabIndex < 0 || nTabIndex >= g_AppState.nTabCount) return;
+    if (nTabIndex < 0 || nTabIndex >= GetTabCount()) return;
     
-    TabState* pTab = &g_AppState.tabs[nTabIndex];
+    TabState* pTab = GetTab(nTabIndex);
     
     /* Check for unsaved changes */
     if (pTab->bModified) {
@@ -326,6 +460,12 @@ void CloseTab(HWND hwnd, int nTabIndex) {
         }
     }
     
+    /* Stop loading into this tab; its unsaved changes are gone for good */
+    CancelFileLoad(pTab);
+    CancelFindInFiles(pTab);
+    DiscardTabJournal(pTab);
+    DiscardHibernation(pTab);
+    
     /* Destroy edit control */
     if (pTab->hwndEdit) {
         DestroyWindow(pTab->hwndEdit);
@@ -336,50 +476,64 @@ void CloseTab(HWND hwnd, int nTabIndex) {
         DestroyWindow(pTab->lineNumState.hwndLineNumbers);
     }
     
-    /* Free content buffer if allocated */
-    if (pTab->pContent) {
-        HeapFree(GetProcessHeap(), 0, pTab->pContent);
-    }
+    /* Free document model */
+    PieceTableFree(&pTab->doc);
+    LineIndexFree(&pTab->lines);
+    UndoJournalFree(&pTab->undo);
     
     /* Remove tab from tab control */
     TabCtrl_DeleteItem(g_AppState.hwndTab, nTabIndex);
     
-    /* Shift remaining tabs */
-    for (int i = nTabIndex; i < g_AppState.nTabCount - 1; i++) {
-        g_AppState.tabs[i] = g_AppState.tabs[i + 1];
-    }
-    
-    g_AppState.nTabCount--;
+    /* Release its slot; the other tabs' state stays where it is */
+    TabRegistryRemove(&g_AppState.tabs, (size_t)nTabIndex);
     
     /* If no tabs left, create a new one */
-    if (g_AppState.nTabCount == 0) {
+    if (GetTabCount() == 0) {
         AddNewTab(hwnd, TEXT("Untitled"));
     } else {
         /* Switch to appropriate tab */
-        int nNewCurrent = (nTabIndex >= g_AppState.nTabCount) ? 
-                          g_AppState.nTabCount - 1 : nTabIndex;
+        int nNewCurrent = (nTabIndex >= GetTabCount()) ? 
+                          GetTabCount() - 1 : nTabIndex;
         SwitchToTab(hwnd, nNewCurrent);
     }
 }
 
 /* Switch to a specific tab */
 void SwitchToTab(HWND hwnd, int nTabIndex) {
-    if (nTabIndex < 0 || nTabIndex >= g_AppState.nTabCount) return;
+    if (nTabIndex < 0 || nTabIndex >= GetTabCount()) return;
     
     /* Hide current edit control and line numbers */
-    if (g_AppState.nCurrentTab >= 0 && g_AppState.nCurrentTab < g_AppState.nTabCount) {
-        ShowWindow(g_AppState.tabs[g_AppState.nCurrentTab].hwndEdit, SW_HIDE);
-        if (g_AppState.tabs[g_AppState.nCurrentTab].lineNumState.hwndLineNumbers) {
-            ShowWindow(g_AppState.tabs[g_AppState.nCurrentTab].lineNumState.hwndLineNumbers, SW_HIDE);
+    if (g_AppState.nCurrentTab >= 0 && g_AppState.nCurrentTab < GetTabCount()) {
+        TabState* pOld = GetTab(g_AppState.nCurrentTab);
+        ShowWindow(pOld->hwndEdit, SW_HIDE);
+        if (pOld->lineNumState.hwndLineNumbers) {
+            ShowWindow(pOld->lineNumState.hwndLineNumbers, SW_HIDE);
         }
+        pOld->dwLastActive = GetTickCount();
+        
+        /* Its caret as the user leaves it goes to the session */
+        NoteSessionTab(g_AppState.nCurrentTab);
     }
     
     g_AppState.nCurrentTab = nTabIndex;
     
-    TabState* pTab = &g_AppState.tabs[nTabIndex];
+    /* The tab left behind may be the next to go idle; the one shown is no longer a candidate */
+    ScheduleHibernation(hwnd);
     
-    /* Show line number window if enabled */
-    if (g_AppState.bShowLineNumbers) {
+    TabState* pTab = GetTab(nTabIndex);
+    
+    /* A hibernating tab gets its text and edit control back first */
+    if (pTab->pHibernation && !WakeTab(hwnd, nTabIndex)) {
+        ShowErrorDialog(hwnd, TEXT("Not enough memory to restore this tab."));
+    }
+    
+    /* A tab reopened from the last session reads its file the first time it is shown */
+    if (pTab->bDeferred && !LoadDeferredTab(hwnd, nTabIndex)) {
+        ShowErrorDialog(hwnd, TEXT("Failed to open file."));
+    }
+    
+    /* Show line number window if enabled (the large file viewer draws its own) */
+    if (g_AppState.bShowLineNumbers && !pTab->bLargeFile) {
         /* Create line number window if not exists */
         if (!pTab->lineNumState.hwndLineNumbers) {
             pTab->lineNumState.hwndLineNumbers = CreateLineNumberWindow(hwnd, g_AppState.hInstance);
@@ -404,16 +558,23 @@ void SwitchToTab(HWND hwnd, int nTabIndex) {
     
     /* Update window title */
     UpdateWindowTitle(hwnd);
+    RequestFrame(hwnd, FRAME_DIRTY_GUTTER | FRAME_DIRTY_STATUS);
+    
+    /* The active tab changed */
+    NoteSessionTab(nTabIndex);
 }
 
 /* Update tab title */
 void UpdateTabTitle(int nTabIndex) {
-    if (nTabIndex < 0 || nTabIndex >= g_AppState.nTabCount) return;
+    if (nTabIndex < 0 || nTabIndex >= GetTabCount()) return;
     
-    TabState* pTab = &g_AppState.tabs[nTabIndex];
+    TabState* pTab = GetTab(nTabIndex);
     TCHAR szTitle[MAX_PATH + 4];
     
-    if (pTab->bUntitled) {
+    if (pTab->bUntitled && pTab->bFindResults) {
+        _sntprintf(szTitle, MAX_PATH + 4, TEXT("Find Results%s"),
+                   pTab->pFindFiles ? TEXT("...") : pTab->bModified ? TEXT(" *") : TEXT(""));
+    } else if (pTab->bUntitled) {
         _sntprintf(szTitle, MAX_PATH + 4, TEXT("Untitled%s"), 
                    pTab->bModified ? TEXT(" *") : TEXT(""));
     } else {
@@ -425,7 +586,7 @@ void UpdateTabTitle(int nTabIndex) {
             pFileName = pTab->szFileName;
         }
         _sntprintf(szTitle, MAX_PATH + 4, TEXT("%s%s"), 
-                   pFileName, pTab->bModified ? TEXT(" *") : TEXT(""));
+                   pFileName, pTab->pLoad ? TEXT("...") : pTab->bModified ? TEXT(" *") : TEXT(""));
     }
     
     TCITEM tie = {0};
@@ -477,14 +638,74 @@ HWND CreateMainWindow(HINSTANCE hInstance, int nCmdShow) {
     return hwnd;
 }
 
+/* Ask for the given parts of the window to be refreshed on the next frame */
+void RequestFrame(HWND hwnd, unsigned nDirty) {
+    int nDelay = FrameSchedInvalidate(&g_FrameSched, nDirty, GetTickCount64());
+    if (nDelay != FRAME_NO_WAKEUP) {
+        SetTimer(hwnd, TIMER_FRAME, (UINT)nDelay, NULL);
+    }
+}
+
+/* Bring every dirty part of the window up to date in one pass */
+static void RunFrame(HWND hwnd) {
+    unsigned nDirty = FrameSchedBeginFrame(&g_FrameSched, GetTickCount64());
+    TabState* pTab = GetCurrentTabState();
+    
+    /* A gutter that needs more digits changes the layout */
+    if ((nDirty & FRAME_DIRTY_GUTTER) && pTab && !pTab->bLargeFile && !pTab->pLoad &&
+        g_AppState.bShowLineNumbers && pTab->lineNumState.hwndLineNumbers) {
+        int nWidth = CalculateLineNumberWidth((int)LineIndexCount(&pTab->lines));
+        if (nWidth != pTab->lineNumState.nLineNumberWidth) {
+            pTab->lineNumState.nLineNumberWidth = nWidth;
+            nDirty |= FRAME_DIRTY_LAYOUT;
+        }
+    }
+    
+    if (nDirty & FRAME_DIRTY_LAYOUT) {
+        /* Repaints the gutter as well */
+        RepositionControls(hwnd);
+    } else if ((nDirty & FRAME_DIRTY_GUTTER) && pTab && g_AppState.bShowLineNumbers) {
+        UpdateLineNumbers(pTab->lineNumState.hwndLineNumbers, pTab->hwndEdit);
+    }
+    
+    if (nDirty & FRAME_DIRTY_TITLE) {
+        UpdateTabTitle(g_AppState.nCurrentTab);
+        UpdateWindowTitle(hwnd);
+    }
+    
+    if (nDirty & FRAME_DIRTY_STATUS) {
+        UpdateStatusBar(hwnd);
+    }
+    
+    /* The caret or view moved: the session hears of it (nothing is written unless they changed) */
+    if (nDirty & (FRAME_DIRTY_GUTTER | FRAME_DIRTY_STATUS)) {
+        NoteSessionTab(g_AppState.nCurrentTab);
+    }
+}
+
 /* Window procedure */
 LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+    /* The Find dialog reports through a registered message, so it cannot be a case label */
+    UINT uFindMsg = GetFindDialogMessage();
+    if (uFindMsg && msg == uFindMsg) {
+        HandleFindDialogMessage(hwnd, (const FINDREPLACE*)lParam);
+        return 0;
+    }
+    
     switch (msg) {
         case WM_CREATE: {
+            /* Nothing is refreshed on a timer until something changes */
+            FrameSchedInit(&g_FrameSched);
+            
+            /* Unsaved changes are journaled from here on (quietly off if that fails) */
+            StartRecovery();
+            
             /* Initialize word wrap to OFF by default */
             g_AppState.bWordWrap = FALSE;
             g_AppState.bShowLineNumbers = TRUE;  /* Line numbers ON by default */
-            g_AppState.nTabCount = 0;
+            g_AppState.bHibernate = TRUE;
+            g_AppState.nHibernateSeconds = HIBERNATE_IDLE_SECONDS;
+            TabRegistryInit(&g_AppState.tabs, sizeof(TabState));
             g_AppState.nCurrentTab = -1;
             
             /* Create font for edit controls */
@@ -517,8 +738,21 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
             /* Set tab item size for close button */
             TabCtrl_SetItemSize(g_AppState.hwndTab, 120, TAB_HEIGHT - 4);
             
+            /* Reopen the last session's tabs; none reads its file until it is shown */
+            int nSessionTab = RestoreSession();
+            
             /* Create first tab */
-            AddNewTab(hwnd, TEXT("Untitled"));
+            if (GetTabCount() == 0) {
+                AddNewTab(hwnd, TEXT("Untitled"));
+            }
+            
+            /* Bring back what the last session left unsaved */
+            RestoreRecoveredTabs(hwnd);
+            
+            /* Only the tab that was active is read now */
+            if (nSessionTab >= 0) {
+                SwitchToTab(hwnd, nSessionTab);
+            }
             
             /* Initialize menu check marks */
             HMENU hMenu = GetMenu(hwnd);
@@ -526,14 +760,8 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
                           g_AppState.bShowLineNumbers ? MF_CHECKED : MF_UNCHECKED);
             CheckMenuItem(hMenu, IDM_FORMAT_WORDWRAP, 
                           g_AppState.bWordWrap ? MF_CHECKED : MF_UNCHECKED);
-            
-            /* Start periodic sync timer for line numbers if enabled */
-            if (g_AppState.bShowLineNumbers) {
-                SetTimer(hwnd, 2, 100, NULL);
-            }
-            
-            /* Start status bar update timer */
-            SetTimer(hwnd, TIMER_STATUSBAR, 100, NULL);
+            CheckMenuItem(hMenu, IDM_VIEW_HIBERNATE, 
+                          g_AppState.bHibernate ? MF_CHECKED : MF_UNCHECKED);
             
             /* Initial status bar update */
             UpdateStatusBar(hwnd);
@@ -541,52 +769,42 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
             return 0;
         }
         
-        case WM_SIZE: {
-            /* Debounce resize - use timer to avoid too many redraws */
-            SetTimer(hwnd, 3, 16, NULL); /* ~60fps */
+        case WM_SIZE:
+            /* Resizes are merged: the layout runs once per frame */
+            RequestFrame(hwnd, FRAME_DIRTY_LAYOUT);
             return 0;
-        }
         
-        case WM_TIMER: {
-            if (wParam == 1) {
-                /* Scroll sync timer */
-                KillTimer(hwnd, 1);
-                TabState* pTab = GetCurrentTabState();
-                if (pTab && g_AppState.bShowLineNumbers && pTab->lineNumState.hwndLineNumbers) {
-                    InvalidateRect(pTab->lineNumState.hwndLineNumbers, NULL, FALSE);
-                }
-            } else if (wParam == 2) {
-                /* Periodic sync timer for line numbers - only sync if scroll position changed */
-                TabState* pTab = GetCurrentTabState();
-                if (pTab && pTab->hwndEdit && g_AppState.bShowLineNumbers && pTab->lineNumState.hwndLineNumbers) {
-                    static int s_nLastFirstLine = -1;
-                    static int s_nLastLineCount = -1;
-                    int nFirstLine = (int)SendMessage(pTab->hwndEdit, EM_GETFIRSTVISIBLELINE, 0, 0);
-                    int nLineCount = (int)SendMessage(pTab->hwndEdit, EM_GETLINECOUNT, 0, 0);
-                    if (nFirstLine != s_nLastFirstLine || nLineCount != s_nLastLineCount) {
-                        s_nLastFirstLine = nFirstLine;
-                        s_nLastLineCount = nLineCount;
-                        InvalidateRect(pTab->lineNumState.hwndLineNumbers, NULL, FALSE);
-                    }
-                }
-            } else if (wParam == 3) {
-                /* Resize debounce timer */
-                KillTimer(hwnd, 3);
-                RepositionControls(hwnd);
-            } else if (wParam == TIMER_STATUSBAR) {
-                /* Update status bar periodically */
-                UpdateStatusBar(hwnd);
+        case WM_TIMER:
+            if (wParam == TIMER_FRAME) {
+                /* One-shot: the next change arms it again */
+                KillTimer(hwnd, TIMER_FRAME);
+                RunFrame(hwnd);
+            } else if (wParam == TIMER_HIBERNATE) {
+                /* One-shot: due when the first background tab has sat idle long enough */
+                HibernateIdleTabs(hwnd);
             }
             return 0;
-        }
+        
+        case WM_FILELOAD_PROGRESS:
+            ShowFileLoadProgress(hwnd, (FileLoadJob*)lParam);
+            return 0;
+        
+        case WM_FILELOAD_DONE:
+            FinishFileLoad(hwnd, (FileLoadJob*)lParam);
+            return 0;
+        
+        case WM_FINDFILES_PROGRESS:
+            ShowFindFilesProgress(hwnd, (FindFilesJob*)lParam);
+            return 0;
+        
+        case WM_FINDFILES_DONE:
+            FinishFindInFiles(hwnd, (FindFilesJob*)lParam);
+            return 0;
         
         case WM_VSCROLL:
         case WM_MOUSEWHEEL: {
             /* Sync line numbers when scrolling */
-            TabState* pTab = GetCurrentTabState();
-            if (pTab && g_AppState.bShowLineNumbers && pTab->lineNumState.hwndLineNumbers) {
-                SetTimer(hwnd, 1, 16, NULL);
-            }
+            RequestFrame(hwnd, FRAME_DIRTY_GUTTER);
             break;
         }
         
@@ -722,7 +940,10 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
 
                 /* Edit menu */
                 case IDM_EDIT_UNDO:
-                    if (hwndEdit) EditUndo(hwndEdit);
+                    if (pTab) EditUndo(pTab);
+                    break;
+                case IDM_EDIT_REDO:
+                    if (pTab) EditRedo(pTab);
                     break;
                 case IDM_EDIT_CUT:
                     if (hwndEdit) EditCut(hwndEdit);
@@ -737,6 +958,30 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
                     if (hwndEdit) EditSelectAll(hwndEdit);
                     break;
                 
+                case IDM_EDIT_FIND:
+                    ShowFindDialog(hwnd, FALSE);
+                    break;
+                
+                case IDM_EDIT_FINDNEXT:
+                    FindAgain(hwnd, FALSE);
+                    break;
+                
+                case IDM_EDIT_FINDPREV:
+                    FindAgain(hwnd, TRUE);
+                    break;
+                
+                case IDM_EDIT_REPLACE:
+                    ShowFindDialog(hwnd, TRUE);
+                    break;
+                
+                case IDM_EDIT_FINDINFILES:
+                    ShowFindInFilesDialog(hwnd);
+                    break;
+                
+                case IDM_EDIT_REGEX:
+                    ToggleFindRegex(hwnd);
+                    break;
+                
                 /* Format menu */
                 case IDM_FORMAT_WORDWRAP:
                     ToggleWordWrap(hwnd);
@@ -747,6 +992,14 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
                     ToggleLineNumbers(hwnd);
                     break;
                 
+                case IDM_VIEW_HIBERNATE:
+                    /* Tabs already hibernating stay so until shown */
+                    g_AppState.bHibernate = !g_AppState.bHibernate;
+                    CheckMenuItem(GetMenu(hwnd), IDM_VIEW_HIBERNATE, 
+                                  g_AppState.bHibernate ? MF_CHECKED : MF_UNCHECKED);
+                    ScheduleHibernation(hwnd);
+                    break;
+                
                 /* Help menu */
                 case IDM_HELP_ABOUT:
                     ShowAboutDialog(hwnd);
@@ -754,21 +1007,12 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
                 
                 /* Edit control notifications */
                 default:
-                    if (HIWORD(wParam) == EN_CHANGE && pTab) {
+                    if (HIWORD(wParam) == EN_CHANGE && pTab && (HWND)lParam == pTab->hwndEdit &&
+                        !pTab->pLoad && !pTab->pFindFiles) {
+                        /* The model stays in step with every edit; the views catch up next frame */
+                        SyncDocumentFromEdit(pTab);
                         pTab->bModified = TRUE;
-                        UpdateTabTitle(g_AppState.nCurrentTab);
-                        
-                        /* Update line numbers if visible */
-                        if (g_AppState.bShowLineNumbers && pTab->lineNumState.hwndLineNumbers) {
-                            /* Recalculate width if line count changed significantly */
-                            int nLines = (int)SendMessage(pTab->hwndEdit, EM_GETLINECOUNT, 0, 0);
-                            int nNewWidth = CalculateLineNumberWidth(nLines);
-                            if (nNewWidth != pTab->lineNumState.nLineNumberWidth) {
-                                pTab->lineNumState.nLineNumberWidth = nNewWidth;
-                                RepositionControls(hwnd);
-                            }
-                            UpdateLineNumbers(pTab->lineNumState.hwndLineNumbers, pTab->hwndEdit);
-                        }
+                        RequestFrame(hwnd, FRAME_DIRTY_GUTTER | FRAME_DIRTY_STATUS | FRAME_DIRTY_TITLE);
                     }
                     break;
             }
@@ -776,9 +1020,10 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
         }
 
         case WM_CLOSE: {
-            /* Check all tabs for unsaved changes */
-            for (int i = 0; i < g_AppState.nTabCount; i++) {
-                if (g_AppState.tabs[i].bModified) {
+            /* Check all tabs for unsaved changes (journaled ones come back next launch) */
+            for (int i = 0; i < GetTabCount(); i++) {
+                TabState* pTab = GetTab(i);
+                if (pTab->bModified && !CanHotExitTab(pTab)) {
                     SwitchToTab(hwnd, i);
                     if (!PromptSaveChanges(hwnd)) {
                         return 0; /* User cancelled */
@@ -790,18 +1035,33 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
         }
         
         case WM_DESTROY:
+            KillTimer(hwnd, TIMER_FRAME);
+            KillTimer(hwnd, TIMER_HIBERNATE);
+            
+            /* Every tab's last position goes to the session while the edit controls are there */
+            SaveSession();
+            
             /* Cleanup all tabs */
-            for (int i = 0; i < g_AppState.nTabCount; i++) {
-                if (g_AppState.tabs[i].hwndEdit) {
-                    DestroyWindow(g_AppState.tabs[i].hwndEdit);
+            for (int i = 0; i < GetTabCount(); i++) {
+                TabState* pTab = GetTab(i);
+                AbortFileLoad(pTab);
+                AbortFindInFiles(pTab);
+                ReleaseTabJournal(pTab);
+                DiscardHibernation(pTab);
+                if (pTab->hwndEdit) {
+                    DestroyWindow(pTab->hwndEdit);
                 }
-                if (g_AppState.tabs[i].lineNumState.hwndLineNumbers) {
-                    DestroyWindow(g_AppState.tabs[i].lineNumState.hwndLineNumbers);
-                }
-                if (g_AppState.tabs[i].pContent) {
-                    HeapFree(GetProcessHeap(), 0, g_AppState.tabs[i].pContent);
+                if (pTab->lineNumState.hwndLineNumbers) {
+                    DestroyWindow(pTab->lineNumState.hwndLineNumbers);
                 }
+                PieceTableFree(&pTab->doc);
+                LineIndexFree(&pTab->lines);
+                UndoJournalFree(&pTab->undo);
             }
+            TabRegistryFree(&g_AppState.tabs);
+            
+            /* Everything journaled is on disk once the writer has stopped */
+            StopRecovery();
             
             if (g_hFont) {
                 DeleteObject(g_hFont);
@@ -823,60 +1083,66 @@ void ToggleWordWrap(HWND hwnd) {
     CheckMenuItem(hMenu, IDM_FORMAT_WORDWRAP, 
                   g_AppState.bWordWrap ? MF_CHECKED : MF_UNCHECKED);
     
-    /* Only recreate current tab's edit control for better performance */
-    if (g_AppState.nCurrentTab >= 0) {
-        RecreateEditControl(hwnd, g_AppState.nCurrentTab, g_AppState.bWordWrap);
+    /* Wrap is a property of each view: switch it in place, keeping text, caret and undo */
+    for (int i = 0; i < GetTabCount(); i++) {
+        TabState* pTab = GetTab(i);
+        if (pTab->pHibernation || pTab->bDeferred) {
+            /* Gets an edit control with the new setting when it wakes or is first shown */
+            continue;
+        } else if (pTab->bLargeFile) {
+            SetLargeViewerWrap(pTab->hwndEdit, g_AppState.bWordWrap);
+        } else if (!SetEditWordWrap(pTab->hwndEdit, g_AppState.bWordWrap)) {
+            RecreateEditControl(hwnd, i, g_AppState.bWordWrap);
+        }
     }
+    
+    /* Wrapped lines change what the gutter numbers */
+    RequestFrame(hwnd, FRAME_DIRTY_GUTTER | FRAME_DIRTY_STATUS);
 }
 
-/* Recreate edit control with word wrap setting */
+/* Recreate edit control with word wrap setting (or create one for a tab waking from hibernation) */
 void RecreateEditControl(HWND hwnd, int nTabIndex, BOOL bWordWrap) {
-    if (nTabIndex < 0 || nTabIndex >= g_AppState.nTabCount) return;
+    if (nTabIndex < 0 || nTabIndex >= GetTabCount()) return;
     
-    TabState* pTab = &g_AppState.tabs[nTabIndex];
+    TabState* pTab = GetTab(nTabIndex);
     HWND hwndOldEdit = pTab->hwndEdit;
     
-    if (!hwndOldEdit) return;
-    
-    /* Stop timers during recreation to prevent crashes */
-    KillTimer(hwnd, 1);
-    KillTimer(hwnd, 2);
-    KillTimer(hwnd, 3);
-    
     /* Disable redraw during recreation */
     SendMessage(hwnd, WM_SETREDRAW, FALSE, 0);
     
-    /* Get current text using wide char for better performance */
-    int nLen = GetWindowTextLengthW(hwndOldEdit);
-    WCHAR* pText = NULL;
     BOOL bWasModified = pTab->bModified;
     
-    if (nLen > 0) {
-        pText = (WCHAR*)HeapAlloc(GetProcessHeap(), 0, (nLen + 1) * sizeof(WCHAR));
-        if (pText) {
-            GetWindowTextW(hwndOldEdit, pText, nLen + 1);
-        }
+    /* Selection in document offsets, which survive the new control's line breaks */
+    DWORD dwStart = 0, dwEnd = 0;
+    size_t nSelStart = 0, nSelEnd = 0;
+    if (hwndOldEdit) {
+        SendMessage(hwndOldEdit, EM_GETSEL, (WPARAM)&dwStart, (LPARAM)&dwEnd);
+        nSelStart = DocOffsetFromEditPos(pTab, dwStart);
+        nSelEnd = DocOffsetFromEditPos(pTab, dwEnd);
+        
+        /* Destroy old edit control (the document model keeps the text) */
+        DestroyWindow(hwndOldEdit);
+        pTab->hwndEdit = NULL;
     }
     
-    /* Destroy old edit control */
-    DestroyWindow(hwndOldEdit);
-    pTab->hwndEdit = NULL;
-    
     /* Create new edit control */
-    pTab->hwndEdit = CreateTabEditControl(hwnd, bWordWrap);
+    pTab->hwndEdit = CreateTabEditControl(hwnd, pTab->hTab, bWordWrap);
+    pTab->bRichEdit = IsRichEditControl(pTab->hwndEdit);
     
     if (!pTab->hwndEdit) {
         /* Failed to create - cleanup and return */
-        if (pText) HeapFree(GetProcessHeap(), 0, pText);
         SendMessage(hwnd, WM_SETREDRAW, TRUE, 0);
         return;
     }
     
-    /* Restore text */
-    if (pText) {
-        SetWindowTextW(pTab->hwndEdit, pText);
-        HeapFree(GetProcessHeap(), 0, pText);
+    /* Refill from the document model (a tab still loading gets its text when done) */
+    FeedEditFromDocument(pTab->hwndEdit, &pTab->doc);
+    if (pTab->pLoad || pTab->bFindResults) {
+        SendMessage(pTab->hwndEdit, EM_SETREADONLY, TRUE, 0);
     }
+    SendMessage(pTab->hwndEdit, EM_SETSEL, EditPosFromDocOffset(pTab, nSelStart),
+                EditPosFromDocOffset(pTab, nSelEnd));
+    SendMessage(pTab->hwndEdit, EM_SCROLLCARET, 0, 0);
     
     /* Restore modified flag */
     pTab->bModified = bWasModified;
@@ -894,10 +1160,8 @@ void RecreateEditControl(HWND hwnd, int nTabIndex, BOOL bWordWrap) {
     SendMessage(hwnd, WM_SETREDRAW, TRUE, 0);
     InvalidateRect(hwnd, NULL, TRUE);
     
-    /* Restart periodic timer if line numbers are visible */
-    if (g_AppState.bShowLineNumbers) {
-        SetTimer(hwnd, 2, 100, NULL);
-    }
+    /* Gutter and caret position belong to the new control now */
+    RequestFrame(hwnd, FRAME_DIRTY_GUTTER | FRAME_DIRTY_STATUS);
 }
 
 /* WinMain entry point */
@@ -906,6 +1170,8 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
     MSG msg;
     
     (void)hPrevInstance;
+    
+    /* ANSI only: OpenCommandLineFiles reads the wide command line instead */
     (void)lpCmdLine;
     
     /* Load RichEdit library */
@@ -938,11 +1204,15 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
         return 1;
     }
     
+    /* Files named on the command line open on top of the restored session */
+    OpenCommandLineFiles(g_AppState.hwndMain);
+    
     /* Load accelerator table */
     g_AppState.hAccel = LoadAccelerators(hInstance, MAKEINTRESOURCE(IDR_ACCEL));
     
     /* Message loop with accelerator handling */
     while (GetMessage(&msg, NULL, 0, 0)) {
+        if (IsFindDialogMessage(&msg)) continue;
         if (!TranslateAccelerator(g_AppState.hwndMain, g_AppState.hAccel, &msg)) {
             TranslateMessage(&msg);
             DispatchMessage(&msg);
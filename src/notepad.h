@@ -6,13 +6,61 @@
 #include <commctrl.h>
 #include <commdlg.h>
 #include "resource.h"
+#include "piece_table.h"
+#include "line_index.h"
+#include "doc_stats.h"
+#include "undo_journal.h"
+#include "doc_replace.h"
+#include "edit_journal.h"
+#include "text_search.h"
+#include "regex_search.h"
+#include "large_view.h"
+#include "frame_sched.h"
+#include "file_search.h"
+#include "tab_registry.h"
+#include "text_encoding.h"
 
 /* Application name */
 #define APP_NAME TEXT("XNote")
 #define APP_VERSION TEXT("1.0")
 
-/* Maximum number of tabs */
-#define MAX_TABS 32
+/* Longest text the Find and Replace boxes take */
+#define FIND_TEXT_MAX 256
+
+/* Background tabs idle this long hibernate: their text is compressed and their edit control destroyed */
+#define HIBERNATE_IDLE_SECONDS (5 * 60)
+
+/* Tabs with less text than this never hibernate (too little to win back) */
+#define HIBERNATE_MIN_UNITS (256 * 1024)
+
+/* Tabs with more text than this never hibernate: packing runs on the UI thread, at about 350 MB/s */
+#define HIBERNATE_MAX_UNITS (8 * 1024 * 1024)
+
+/* Find flag next to the TEXT_SEARCH_ ones: the text is a regular expression */
+#define FIND_REGEX 0x100
+
+/* Memory each tab's undo history may use before its oldest steps are dropped */
+#define UNDO_BUDGET_BYTES ((size_t)32 * 1024 * 1024)
+
+/* Posted to the main window by a file load worker (lParam = FileLoadJob*) */
+#define WM_FILELOAD_PROGRESS (WM_APP + 1)
+#define WM_FILELOAD_DONE     (WM_APP + 2)
+
+/* Posted to the main window by a Find in Files search (lParam = FindFilesJob*) */
+#define WM_FINDFILES_PROGRESS (WM_APP + 3)
+#define WM_FINDFILES_DONE     (WM_APP + 4)
+
+/* Matching lines one Find in Files search lists before it stops */
+#define FIND_FILES_MAX_RESULTS 100000
+
+/* Background file open in progress (defined in file_ops.c) */
+typedef struct FileLoadJob FileLoadJob;
+
+/* Find in Files search in progress (defined in find_files.c) */
+typedef struct FindFilesJob FindFilesJob;
+
+/* Compressed text of a hibernating tab (defined in hibernate.c) */
+typedef struct TabHibernation TabHibernation;
 
 /* Line number state structure */
 typedef struct {
@@ -28,19 +76,59 @@ typedef enum {
     LINE_ENDING_CR               /* Mac (CR) */
 } LineEndingType;
 
+/* Selection and view of a tab, kept while it has no edit control */
+typedef struct {
+    BOOL bValid;                 /* Holds a position to restore */
+    size_t nSelStart;            /* Selection in document offsets */
+    size_t nSelEnd;
+    size_t nFirstLine;           /* First visible line of the edit control */
+} TabPosition;
+
 /* Tab/Document state structure */
 typedef struct {
     TCHAR szFileName[MAX_PATH];  /* Full path of current file */
+    TabHandle hTab;              /* Names this tab to workers and posted messages */
     BOOL bModified;              /* Unsaved changes flag */
     BOOL bUntitled;              /* New document without name flag */
     HWND hwndEdit;               /* Edit control for this tab */
-    WCHAR* pContent;             /* Content buffer for large files */
-    DWORD dwContentSize;         /* Size of content */
+    BOOL bRichEdit;              /* Edit control is RichEdit (CR-only breaks) */
+    PieceTable doc;              /* Document model (owns the text) */
+    LineIndex lines;             /* Line starts of doc */
+    DocStats stats;              /* Character, word, line and byte counts of doc */
+    UndoJournal undo;            /* Undo/redo history of doc */
     LineNumberState lineNumState; /* Line number state for this tab */
     LineEndingType lineEnding;   /* Line ending type */
+    int nEncoding;               /* TEXT_ENCODING_ the file is read and saved in */
     BOOL bInsertMode;            /* Insert/Overwrite mode */
+    BOOL bLargeFile;             /* hwndEdit is a read-only large file viewer */
+    FileLoadJob* pLoad;          /* File still loading into this tab (NULL if none) */
+    EditJournal* pJournal;       /* Crash recovery journal of unsaved changes (NULL if none) */
+    BOOL bReplayJournal;         /* pJournal is replayed once pLoad finishes */
+    size_t nGotoLine;            /* Line to show once pLoad finishes (one-based, 0 for none) */
+    BOOL bFindResults;           /* Tab lists Find in Files results (double-click opens one) */
+    FindFilesJob* pFindFiles;    /* Search still adding results to this tab (NULL if none) */
+    TabHibernation* pHibernation; /* Text while hibernating: doc, lines and hwndEdit are empty (NULL if awake) */
+    DWORD dwLastActive;          /* GetTickCount when the tab was last shown */
+    TabPosition savedPos;        /* Where to put the caret once the tab has an edit control again */
+    BOOL bDeferred;              /* Reopened from the last session: file not read, no edit control until shown */
+    uint64_t nSessionId;         /* Names the tab in the session file (0 until it has a record) */
+    uint32_t nSessionCrc;        /* Checksum of the tab's last session record */
+    BOOL bSelBefore;             /* An editing message is in the control: the selection it started from follows */
+    DWORD dwSelBeforeStart;      /* Control selection before the edit (see SyncDocumentFromEdit) */
+    DWORD dwSelBeforeEnd;
+    BOOL bPatchingEdit;          /* The control is being patched to match the document: EN_CHANGE is no edit */
 } TabState;
 
+/* Large file viewer details for the status bar */
+typedef struct {
+    uint64_t nBytes;             /* File size */
+    uint64_t nLines;             /* Total lines (when bLinesKnown) */
+    BOOL bLinesKnown;            /* Line index complete */
+    uint64_t nTopLine;           /* First visible line, one-based (0 if not indexed yet) */
+    int nIndexPercent;           /* Share of the file indexed */
+    BOOL bUtf8;                  /* Decoded as UTF-8 (otherwise Latin-1) */
+} LargeViewerStatus;
+
 /* Application state structure */
 typedef struct {
     HINSTANCE hInstance;         /* Application instance handle */
@@ -50,9 +138,10 @@ typedef struct {
     HACCEL hAccel;               /* Accelerator table handle */
     BOOL bWordWrap;              /* Word wrap enabled flag */
     BOOL bShowLineNumbers;       /* Global line numbers enabled flag */
-    int nTabCount;               /* Number of open tabs */
+    BOOL bHibernate;             /* Idle background tabs hibernate */
+    DWORD nHibernateSeconds;     /* Idle time before a background tab hibernates */
     int nCurrentTab;             /* Currently active tab index */
-    TabState tabs[MAX_TABS];     /* Array of tab states */
+    TabRegistry tabs;            /* Open tabs' states, in tab strip order */
 } AppState;
 
 /* Global application state */
@@ -72,11 +161,22 @@ BOOL PromptSaveChanges(HWND hwnd);
 void UpdateWindowTitle(HWND hwnd);
 
 /* Edit operations */
-void EditUndo(HWND hEdit);
+void EditUndo(TabState* pTab);
+void EditRedo(TabState* pTab);
 void EditCut(HWND hEdit);
 void EditCopy(HWND hEdit);
 void EditPaste(HWND hEdit);
 void EditSelectAll(HWND hEdit);
+/* Find text compiled for searching */
+typedef struct {
+    BOOL bRegex;
+    TextSearch text;             /* Literal text, or */
+    RegexSearch regex;           /* a regular expression */
+} FindPattern;
+
+BOOL EditFindNext(HWND hwnd, TabState* pTab, const TCHAR* szWhat, unsigned nFlags, BOOL bBackward);
+BOOL EditReplace(HWND hwnd, TabState* pTab, const TCHAR* szWhat, const TCHAR* szWith, unsigned nFlags);
+size_t EditReplaceAll(HWND hwnd, TabState* pTab, const TCHAR* szWhat, const TCHAR* szWith, unsigned nFlags);
 
 /* Dialog operations */
 BOOL ShowOpenDialog(HWND hwnd, TCHAR* szFileName, DWORD nMaxFile);
@@ -84,23 +184,82 @@ BOOL ShowSaveDialog(HWND hwnd, TCHAR* szFileName, DWORD nMaxFile);
 int ShowConfirmSaveDialog(HWND hwnd);
 void ShowAboutDialog(HWND hwnd);
 void ShowErrorDialog(HWND hwnd, const TCHAR* szMessage);
+void ShowNotFoundDialog(HWND hwnd, const TCHAR* szWhat);
+BOOL ShowConfirmNoUndoDialog(HWND hwnd);
+
+/* Find dialog */
+void ShowFindDialog(HWND hwnd, BOOL bReplace);
+BOOL IsFindDialogMessage(MSG* pMsg);
+UINT GetFindDialogMessage(void);
+void HandleFindDialogMessage(HWND hwnd, const FINDREPLACE* pFind);
+void FindAgain(HWND hwnd, BOOL bBackward);
+void ToggleFindRegex(HWND hwnd);
+void ShowFindInFilesDialog(HWND hwnd);
+BOOL ShowFolderDialog(HWND hwnd, TCHAR* szFolder);
 
 /* Helper functions */
 void InitTabState(TabState* pState);
-BOOL ReadFileContent(HWND hEdit, const TCHAR* szFileName);
-BOOL WriteFileContent(HWND hEdit, const TCHAR* szFileName);
-BOOL ReadLargeFile(const TCHAR* szFileName, WCHAR** ppContent, DWORD* pdwSize);
-BOOL WriteLargeFile(const TCHAR* szFileName, const WCHAR* pContent, DWORD dwSize);
+BOOL WriteFileContent(const PieceTable* pDoc, int nEncoding, const TCHAR* szFileName);
+BOOL ReadLargeFile(TabState* pTab, const TCHAR* szFileName, int nEncoding);
+BOOL WriteLargeFile(const TabState* pTab, const TCHAR* szFileName);
+BOOL FindAppDataDir(WCHAR* szDir, DWORD cchDir);
+
+/* Background file loading */
+BOOL BeginFileLoad(HWND hwnd, TabState* pTab, const TCHAR* szFileName);
+void ShowFileLoadProgress(HWND hwnd, FileLoadJob* pJob);
+void FinishFileLoad(HWND hwnd, FileLoadJob* pJob);
+void CancelFileLoad(TabState* pTab);
+void AbortFileLoad(TabState* pTab);
+int GetFileLoadPercent(const TabState* pTab);
+
+/* Find in Files (find_files.c) */
+BOOL BeginFindInFiles(HWND hwnd, const TCHAR* szFolder, const TCHAR* szWhat, unsigned nFlags);
+void ShowFindFilesProgress(HWND hwnd, FindFilesJob* pJob);
+void FinishFindInFiles(HWND hwnd, FindFilesJob* pJob);
+void StopFindInFiles(TabState* pTab);
+void CancelFindInFiles(TabState* pTab);
+void AbortFindInFiles(TabState* pTab);
+BOOL OpenFindResult(HWND hwnd, TabState* pTab);
+
+/* Crash recovery and hot exit */
+BOOL StartRecovery(void);
+void StopRecovery(void);
+void RestoreRecoveredTabs(HWND hwnd);
+void JournalDocumentEdit(TabState* pTab, size_t nOffset, size_t nRemove,
+                         const TextUnit* pInsert, size_t nInsert);
+void DiscardTabJournal(TabState* pTab);
+void ReleaseTabJournal(TabState* pTab);
+BOOL CanHotExitTab(const TabState* pTab);
+void FinishTabRecovery(HWND hwnd, TabState* pTab, BOOL bLoaded);
+
+/* Session snapshot: tabs reopened at the next launch */
+int RestoreSession(void);
+void OpenCommandLineFiles(HWND hwnd);
+void NoteSessionTab(int nTabIndex);
+void SaveSession(void);
+BOOL LoadDeferredTab(HWND hwnd, int nTabIndex);
+int ClaimDeferredTab(HWND hwnd, const WCHAR* szFileName);
+
+/* Tab hibernation */
+void ScheduleHibernation(HWND hwnd);
+void HibernateIdleTabs(HWND hwnd);
+BOOL WakeTab(HWND hwnd, int nTabIndex);
+void DiscardHibernation(TabState* pTab);
 
 /* Format operations */
 void ToggleWordWrap(HWND hwnd);
 void RecreateEditControl(HWND hwnd, int nTabIndex, BOOL bWordWrap);
 
+/* Frame scheduling (nDirty is a mask of FRAME_DIRTY_ flags) */
+void RequestFrame(HWND hwnd, unsigned nDirty);
+
 /* Tab operations */
 int AddNewTab(HWND hwnd, const TCHAR* szTitle);
 void CloseTab(HWND hwnd, int nTabIndex);
 void SwitchToTab(HWND hwnd, int nTabIndex);
 void UpdateTabTitle(int nTabIndex);
+int GetTabCount(void);
+TabState* GetTab(int nTabIndex);
 HWND GetCurrentEdit(void);
 TabState* GetCurrentTabState(void);
 
@@ -108,7 +267,6 @@ TabState* GetCurrentTabState(void);
 HWND CreateLineNumberWindow(HWND hwndParent, HINSTANCE hInstance);
 void UpdateLineNumbers(HWND hwndLineNumbers, HWND hwndEdit);
 void ToggleLineNumbers(HWND hwnd);
-void SyncLineNumberScroll(HWND hwndLineNumbers, HWND hwndEdit);
 int CalculateLineNumberWidth(int nLineCount);
 LRESULT CALLBACK LineNumberWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
 void RepositionControls(HWND hwnd);
@@ -118,6 +276,29 @@ HWND CreateStatusBar(HWND hwndParent, HINSTANCE hInstance);
 void UpdateStatusBar(HWND hwnd);
 void SetStatusBarParts(HWND hwndStatus, int nWidth);
 const TCHAR* GetFileTypeString(const TCHAR* szFileName);
-int CountWords(HWND hwndEdit);
+
+/* Large file viewer operations */
+HWND CreateLargeFileViewer(HWND hwndParent, const TCHAR* szFileName, int nEncoding, HFONT hFont);
+const LargeView* GetLargeFileView(HWND hwndViewer);
+BOOL GetLargeViewerStatus(HWND hwndViewer, LargeViewerStatus* pStatus);
+BOOL LargeViewerFind(HWND hwndViewer, FindPattern* pFind, BOOL bBackward);
+void SetLargeViewerWrap(HWND hwndViewer, BOOL bWrap);
+
+/* Document model operations */
+void ReleaseHeapText(void* pContext, const TextUnit* pText, size_t nLen);
+BOOL IsRichEditControl(HWND hEdit);
+BOOL FeedEditFromDocument(HWND hEdit, const PieceTable* pDoc);
+BOOL SyncDocumentFromEdit(TabState* pTab);
+BOOL UndoDocumentEdit(TabState* pTab);
+BOOL RedoDocumentEdit(TabState* pTab);
+BOOL ReplaceDocumentText(TabState* pTab, size_t nOffset, size_t nRemove,
+                         const TextUnit* pInsert, size_t nInsert);
+BOOL ReplaceDocumentMatches(TabState* pTab, const DocReplacement* pReplacement, const TextUnit* pWith, size_t nWith);
+BOOL AppendDocumentText(TabState* pTab, const TextUnit* pText, size_t nLen);
+void GoToDocumentLine(TabState* pTab, size_t nLine);
+void GetTabPosition(const TabState* pTab, TabPosition* pPos);
+void RestoreTabPosition(TabState* pTab);
+size_t DocOffsetFromEditPos(const TabState* pTab, LONG nPos);
+LONG EditPosFromDocOffset(const TabState* pTab, size_t nOffset);
 
 #endif /* NOTEPAD_H */
@@ -0,0 +1,480 @@
+#include "piece_table.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Nodes allocated per block */
+#define PIECE_BLOCK_NODES 256
+
+/* Minimum add buffer growth (in units) */
+#define ADD_BUFFER_MIN 4096
+
+/* Piece treap node */
+struct PieceNode {
+    PieceNode* pLeft;
+    PieceNode* pRight;
+    size_t nStart;               /* Offset into source buffer */
+    size_t nLength;              /* Units in this piece */
+    size_t nSubtreeLen;          /* Units in this subtree */
+    size_t nSubtreeCount;        /* Pieces in this subtree */
+    uint32_t nPriority;          /* Heap priority */
+    int bAdd;                    /* Source: 0 = original, 1 = add buffer */
+};
+
+/* Block of nodes, freed together */
+struct PieceNodeBlock {
+    PieceNodeBlock* pNext;
+    PieceNode nodes[PIECE_BLOCK_NODES];
+};
+
+/* xorshift32 priority generator */
+static uint32_t NextPriority(PieceTable* pTable) {
+    uint32_t x = pTable->nSeed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    pTable->nSeed = x;
+    return x;
+}
+
+static size_t SubtreeLen(const PieceNode* pNode) {
+    return pNode ? pNode->nSubtreeLen : 0;
+}
+
+static size_t SubtreeCount(const PieceNode* pNode) {
+    return pNode ? pNode->nSubtreeCount : 0;
+}
+
+static void UpdateNode(PieceNode* pNode) {
+    pNode->nSubtreeLen = SubtreeLen(pNode->pLeft) + pNode->nLength + SubtreeLen(pNode->pRight);
+    pNode->nSubtreeCount = SubtreeCount(pNode->pLeft) + 1 + SubtreeCount(pNode->pRight);
+}
+
+static const TextUnit* NodeText(const PieceTable* pTable, const PieceNode* pNode) {
+    return (pNode->bAdd ? pTable->pAdd : pTable->pOriginal) + pNode->nStart;
+}
+
+/* Allocate a node from the free list, growing the pool if needed */
+static PieceNode* AllocNode(PieceTable* pTable, int bAdd, size_t nStart, size_t nLength) {
+    PieceNode* pNode;
+
+    if (!pTable->pFreeNodes) {
+        PieceNodeBlock* pBlock = (PieceNodeBlock*)malloc(sizeof(PieceNodeBlock));
+        if (!pBlock) return NULL;
+        pBlock->pNext = pTable->pBlocks;
+        pTable->pBlocks = pBlock;
+        for (int i = PIECE_BLOCK_NODES - 1; i >= 0; i--) {
+            pBlock->nodes[i].pLeft = pTable->pFreeNodes;
+            pTable->pFreeNodes = &pBlock->nodes[i];
+        }
+    }
+
+    pNode = pTable->pFreeNodes;
+    pTable->pFreeNodes = pNode->pLeft;
+
+    pNode->pLeft = NULL;
+    pNode->pRight = NULL;
+    pNode->nStart = nStart;
+    pNode->nLength = nLength;
+    pNode->nPriority = NextPriority(pTable);
+    pNode->bAdd = bAdd;
+    UpdateNode(pNode);
+    return pNode;
+}
+
+static void ReleaseNode(PieceTable* pTable, PieceNode* pNode) {
+    pNode->pLeft = pTable->pFreeNodes;
+    pTable->pFreeNodes = pNode;
+}
+
+/* Return a whole subtree to the free list */
+static void ReleaseSubtree(PieceTable* pTable, PieceNode* pNode) {
+    while (pNode) {
+        PieceNode* pRight = pNode->pRight;
+        ReleaseSubtree(pTable, pNode->pLeft);
+        ReleaseNode(pTable, pNode);
+        pNode = pRight;
+    }
+}
+
+/* Merge two treaps where every position in pLeft precedes pRight */
+static PieceNode* Merge(PieceNode* pLeft, PieceNode* pRight) {
+    if (!pLeft) return pRight;
+    if (!pRight) return pLeft;
+
+    if (pLeft->nPriority > pRight->nPriority) {
+        pLeft->pRight = Merge(pLeft->pRight, pRight);
+        UpdateNode(pLeft);
+        return pLeft;
+    }
+    pRight->pLeft = Merge(pLeft, pRight->pLeft);
+    UpdateNode(pRight);
+    return pRight;
+}
+
+/*
+ * Split a treap so that *ppLeft holds the first nOffset units and *ppRight
+ * the rest. A piece straddling the split point is cut in two.
+ * Returns 0 if a node could not be allocated (tree left unchanged).
+ */
+static int Split(PieceTable* pTable, PieceNode* pNode, size_t nOffset,
+                 PieceNode** ppLeft, PieceNode** ppRight) {
+    size_t nLeftLen;
+
+    if (!pNode) {
+        *ppLeft = NULL;
+        *ppRight = NULL;
+        return 1;
+    }
+
+    nLeftLen = SubtreeLen(pNode->pLeft);
+
+    if (nOffset <= nLeftLen) {
+        PieceNode* pSubLeft;
+        PieceNode* pSubRight;
+        if (!Split(pTable, pNode->pLeft, nOffset, &pSubLeft, &pSubRight)) return 0;
+        pNode->pLeft = pSubRight;
+        UpdateNode(pNode);
+        *ppLeft = pSubLeft;
+        *ppRight = pNode;
+        return 1;
+    }
+
+    if (nOffset >= nLeftLen + pNode->nLength) {
+        PieceNode* pSubLeft;
+        PieceNode* pSubRight;
+        if (!Split(pTable, pNode->pRight, nOffset - nLeftLen - pNode->nLength,
+                   &pSubLeft, &pSubRight)) return 0;
+        pNode->pRight = pSubLeft;
+        UpdateNode(pNode);
+        *ppLeft = pNode;
+        *ppRight = pSubRight;
+        return 1;
+    }
+
+    /* Split point falls inside this piece */
+    {
+        size_t nCut = nOffset - nLeftLen;
+        PieceNode* pTail = AllocNode(pTable, pNode->bAdd, pNode->nStart + nCut,
+                                     pNode->nLength - nCut);
+        if (!pTail) return 0;
+
+        /* Tail takes over the right subtree, so it inherits the heap priority */
+        pTail->nPriority = pNode->nPriority;
+        pNode->nLength = nCut;
+        pTail->pRight = pNode->pRight;
+        pNode->pRight = NULL;
+        UpdateNode(pNode);
+        UpdateNode(pTail);
+
+        *ppLeft = pNode;
+        *ppRight = pTail;
+        return 1;
+    }
+}
+
+/* Rightmost node of a subtree */
+static PieceNode* Rightmost(PieceNode* pNode) {
+    while (pNode && pNode->pRight) pNode = pNode->pRight;
+    return pNode;
+}
+
+/* Grow the rightmost piece by nLen units, fixing sums along the spine */
+static void ExtendRightmost(PieceNode* pNode, size_t nLen) {
+    while (pNode) {
+        pNode->nSubtreeLen += nLen;
+        if (!pNode->pRight) {
+            pNode->nLength += nLen;
+            return;
+        }
+        pNode = pNode->pRight;
+    }
+}
+
+/* Make room for nLen more units in the add buffer */
+static int ReserveAdd(PieceTable* pTable, size_t nLen) {
+    size_t nNeeded = pTable->nAddLen + nLen;
+    size_t nCapacity;
+    TextUnit* pNew;
+
+    if (nNeeded <= pTable->nAddCapacity) return 1;
+    if (nNeeded < pTable->nAddLen) return 0; /* Overflow */
+
+    nCapacity = pTable->nAddCapacity ? pTable->nAddCapacity : ADD_BUFFER_MIN;
+    while (nCapacity < nNeeded) {
+        if (nCapacity > ((size_t)-1 / sizeof(TextUnit)) / 2) {
+            nCapacity = nNeeded;
+            break;
+        }
+        nCapacity *= 2;
+    }
+
+    pNew = (TextUnit*)realloc(pTable->pAdd, nCapacity * sizeof(TextUnit));
+    if (!pNew) return 0;
+
+    pTable->pAdd = pNew;
+    pTable->nAddCapacity = nCapacity;
+    return 1;
+}
+
+/* Initialize an empty table */
+void PieceTableInit(PieceTable* pTable) {
+    memset(pTable, 0, sizeof(*pTable));
+    pTable->nSeed = 0x9E3779B9u;
+}
+
+/* Free all storage and release the original buffer */
+void PieceTableFree(PieceTable* pTable) {
+    PieceNodeBlock* pBlock = pTable->pBlocks;
+
+    while (pBlock) {
+        PieceNodeBlock* pNext = pBlock->pNext;
+        free(pBlock);
+        pBlock = pNext;
+    }
+
+    if (pTable->pfnRelease && pTable->pOriginal) {
+        pTable->pfnRelease(pTable->pReleaseContext, pTable->pOriginal, pTable->nOriginalLen);
+    }
+
+    free(pTable->pAdd);
+    PieceTableInit(pTable);
+}
+
+/*
+ * Replace the document with pText, which becomes the original buffer.
+ * The table does not copy it; pfnRelease (if any) is called when the table
+ * is freed or reloaded. On failure the buffer is released and the table is
+ * left empty.
+ */
+int PieceTableLoad(PieceTable* pTable, const TextUnit* pText, size_t nLen,
+                   PieceReleaseProc pfnRelease, void* pContext) {
+    PieceTableFree(pTable);
+
+    pTable->pOriginal = pText;
+    pTable->nOriginalLen = nLen;
+    pTable->pfnRelease = pfnRelease;
+    pTable->pReleaseContext = pContext;
+
+    if (nLen > 0) {
+        pTable->pRoot = AllocNode(pTable, 0, 0, nLen);
+        if (!pTable->pRoot) {
+            PieceTableFree(pTable);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Switch the original buffer to pText, a copy of it, and release the old
+ * one. Pieces refer to the buffer by offset, so none of them change. pText
+ * is then owned like a buffer passed to PieceTableLoad.
+ */
+void PieceTableMoveOriginal(PieceTable* pTable, const TextUnit* pText,
+                            PieceReleaseProc pfnRelease, void* pContext) {
+    if (pTable->pfnRelease && pTable->pOriginal) {
+        pTable->pfnRelease(pTable->pReleaseContext, pTable->pOriginal, pTable->nOriginalLen);
+    }
+    pTable->pOriginal = pText;
+    pTable->pfnRelease = pfnRelease;
+    pTable->pReleaseContext = pContext;
+}
+
+/* Total document length in units */
+size_t PieceTableLength(const PieceTable* pTable) {
+    return SubtreeLen(pTable->pRoot);
+}
+
+/* Number of pieces currently describing the document */
+size_t PieceTablePieceCount(const PieceTable* pTable) {
+    return SubtreeCount(pTable->pRoot);
+}
+
+/*
+ * Return a pointer to the contiguous run of text starting at nOffset and
+ * store its length in *pnSpanLen. Returns NULL at or past the end.
+ */
+const TextUnit* PieceTableSpanAt(const PieceTable* pTable, size_t nOffset, size_t* pnSpanLen) {
+    const PieceNode* pNode = pTable->pRoot;
+
+    while (pNode) {
+        size_t nLeftLen = SubtreeLen(pNode->pLeft);
+        if (nOffset < nLeftLen) {
+            pNode = pNode->pLeft;
+        } else if (nOffset < nLeftLen + pNode->nLength) {
+            size_t nInto = nOffset - nLeftLen;
+            if (pnSpanLen) *pnSpanLen = pNode->nLength - nInto;
+            return NodeText(pTable, pNode) + nInto;
+        } else {
+            nOffset -= nLeftLen + pNode->nLength;
+            pNode = pNode->pRight;
+        }
+    }
+
+    if (pnSpanLen) *pnSpanLen = 0;
+    return NULL;
+}
+
+/* In-order walk of [nOffset, nOffset + nLen) within a subtree */
+static int WalkRange(const PieceTable* pTable, const PieceNode* pNode,
+                     size_t nOffset, size_t nLen, PieceSpanProc pfnSpan, void* pContext) {
+    while (pNode && nLen > 0) {
+        size_t nLeftLen = SubtreeLen(pNode->pLeft);
+
+        if (nOffset < nLeftLen) {
+            size_t nTake = nLeftLen - nOffset;
+            if (nTake > nLen) nTake = nLen;
+            if (!WalkRange(pTable, pNode->pLeft, nOffset, nTake, pfnSpan, pContext)) return 0;
+            nOffset = nLeftLen;
+            nLen -= nTake;
+            if (nLen == 0) break;
+        }
+
+        if (nOffset < nLeftLen + pNode->nLength) {
+            size_t nInto = nOffset - nLeftLen;
+            size_t nTake = pNode->nLength - nInto;
+            if (nTake > nLen) nTake = nLen;
+            if (!pfnSpan(pContext, NodeText(pTable, pNode) + nInto, nTake)) return 0;
+            nOffset += nTake;
+            nLen -= nTake;
+        }
+
+        /* Continue in the right subtree */
+        nOffset -= nLeftLen + pNode->nLength;
+        pNode = pNode->pRight;
+    }
+    return 1;
+}
+
+/*
+ * Visit the text in [nOffset, nOffset + nLen) as contiguous spans, in order.
+ * Returns 0 if the callback stopped the walk.
+ */
+int PieceTableForEach(const PieceTable* pTable, size_t nOffset, size_t nLen,
+                      PieceSpanProc pfnSpan, void* pContext) {
+    size_t nTotal = PieceTableLength(pTable);
+
+    if (nOffset >= nTotal) return 1;
+    if (nLen > nTotal - nOffset) nLen = nTotal - nOffset;
+    return WalkRange(pTable, pTable->pRoot, nOffset, nLen, pfnSpan, pContext);
+}
+
+/* Copy state for PieceTableCopy */
+typedef struct {
+    TextUnit* pDest;
+    size_t nCopied;
+} CopyContext;
+
+static int CopySpan(void* pContext, const TextUnit* pText, size_t nLen) {
+    CopyContext* pCopy = (CopyContext*)pContext;
+    memcpy(pCopy->pDest + pCopy->nCopied, pText, nLen * sizeof(TextUnit));
+    pCopy->nCopied += nLen;
+    return 1;
+}
+
+/* Copy up to nLen units starting at nOffset; returns units copied */
+size_t PieceTableCopy(const PieceTable* pTable, size_t nOffset, TextUnit* pDest, size_t nLen) {
+    CopyContext copy;
+    copy.pDest = pDest;
+    copy.nCopied = 0;
+    PieceTableForEach(pTable, nOffset, nLen, CopySpan, &copy);
+    return copy.nCopied;
+}
+
+/* Insert nLen units of pText at nOffset */
+int PieceTableInsert(PieceTable* pTable, size_t nOffset, const TextUnit* pText, size_t nLen) {
+    PieceNode* pLeft;
+    PieceNode* pRight;
+    PieceNode* pLast;
+    size_t nAddStart;
+
+    if (nLen == 0) return 1;
+    if (nOffset > PieceTableLength(pTable)) return 0;
+    if (!ReserveAdd(pTable, nLen)) return 0;
+
+    nAddStart = pTable->nAddLen;
+
+    if (!Split(pTable, pTable->pRoot, nOffset, &pLeft, &pRight)) return 0;
+
+    /* Typing run: the piece before the caret ends where the add buffer ends */
+    pLast = Rightmost(pLeft);
+    if (pLast && pLast->bAdd && pLast->nStart + pLast->nLength == nAddStart) {
+        ExtendRightmost(pLeft, nLen);
+    } else {
+        PieceNode* pNew = AllocNode(pTable, 1, nAddStart, nLen);
+        if (!pNew) {
+            pTable->pRoot = Merge(pLeft, pRight);
+            return 0;
+        }
+        pLeft = Merge(pLeft, pNew);
+    }
+
+    memcpy(pTable->pAdd + nAddStart, pText, nLen * sizeof(TextUnit));
+    pTable->nAddLen += nLen;
+    pTable->pRoot = Merge(pLeft, pRight);
+    return 1;
+}
+
+/* Delete nLen units starting at nOffset */
+int PieceTableDelete(PieceTable* pTable, size_t nOffset, size_t nLen) {
+    PieceNode* pLeft;
+    PieceNode* pMiddle;
+    PieceNode* pRight;
+    size_t nTotal = PieceTableLength(pTable);
+
+    if (nOffset > nTotal) return 0;
+    if (nOffset == nTotal || nLen == 0) return 1;
+    if (nLen > nTotal - nOffset) nLen = nTotal - nOffset;
+
+    if (!Split(pTable, pTable->pRoot, nOffset, &pLeft, &pRight)) return 0;
+    if (!Split(pTable, pRight, nLen, &pMiddle, &pRight)) {
+        pTable->pRoot = Merge(pLeft, pRight);
+        return 0;
+    }
+
+    ReleaseSubtree(pTable, pMiddle);
+    pTable->pRoot = Merge(pLeft, pRight);
+    return 1;
+}
+
+/* Initialize a cursor over a table */
+void PieceCursorInit(PieceCursor* pCursor, const PieceTable* pTable) {
+    pCursor->pTable = pTable;
+    pCursor->pSpan = NULL;
+    pCursor->nSpanStart = 0;
+    pCursor->nSpanLen = 0;
+}
+
+/*
+ * Read the unit at nOffset, reusing the cached span when possible.
+ * Returns 0 if nOffset is past the end.
+ */
+int PieceCursorAt(PieceCursor* pCursor, size_t nOffset, TextUnit* pUnit) {
+    if (!pCursor->pSpan || nOffset < pCursor->nSpanStart ||
+        nOffset - pCursor->nSpanStart >= pCursor->nSpanLen) {
+        const PieceNode* pNode = pCursor->pTable->pRoot;
+        size_t nBase = 0;
+        size_t nRel = nOffset;
+
+        pCursor->pSpan = NULL;
+        while (pNode) {
+            size_t nLeftLen = SubtreeLen(pNode->pLeft);
+            if (nRel < nLeftLen) {
+                pNode = pNode->pLeft;
+            } else if (nRel < nLeftLen + pNode->nLength) {
+                pCursor->pSpan = NodeText(pCursor->pTable, pNode);
+                pCursor->nSpanStart = nBase + nLeftLen;
+                pCursor->nSpanLen = pNode->nLength;
+                break;
+            } else {
+                nRel -= nLeftLen + pNode->nLength;
+                nBase += nLeftLen + pNode->nLength;
+                pNode = pNode->pRight;
+            }
+        }
+        if (!pCursor->pSpan) return 0;
+    }
+
+    *pUnit = pCursor->pSpan[nOffset - pCursor->nSpanStart];
+    return 1;
+}
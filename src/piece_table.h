@@ -0,0 +1,77 @@
+#ifndef PIECE_TABLE_H
+#define PIECE_TABLE_H
+
+/*
+ * Piece table document model.
+ *
+ * Portable C (no Windows headers) so it can be built and exercised headless.
+ * The text is a sequence of pieces that reference either the read-only
+ * original buffer (a decoded file, or a file mapping) or the append-only add
+ * buffer that receives every inserted run. Pieces live in an implicit treap
+ * ordered by document position, so insert, delete and offset lookup are
+ * O(log n) in the number of pieces.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Text unit stored by the document model (UTF-16 code unit) */
+typedef uint16_t TextUnit;
+
+/* Releases the original buffer once the table no longer references it */
+typedef void (*PieceReleaseProc)(void* pContext, const TextUnit* pText, size_t nLen);
+
+/* Receives one contiguous span of text; return 0 to stop the walk */
+typedef int (*PieceSpanProc)(void* pContext, const TextUnit* pText, size_t nLen);
+
+typedef struct PieceNode PieceNode;
+typedef struct PieceNodeBlock PieceNodeBlock;
+
+/* Piece table state */
+typedef struct {
+    const TextUnit* pOriginal;   /* Read-only original buffer */
+    size_t nOriginalLen;         /* Length of original buffer in units */
+    PieceReleaseProc pfnRelease; /* Called when original buffer is dropped */
+    void* pReleaseContext;       /* Context for pfnRelease */
+    TextUnit* pAdd;              /* Append-only add buffer */
+    size_t nAddLen;              /* Units used in add buffer */
+    size_t nAddCapacity;         /* Units allocated in add buffer */
+    PieceNode* pRoot;            /* Root of the piece treap */
+    PieceNode* pFreeNodes;       /* Recycled nodes */
+    PieceNodeBlock* pBlocks;     /* Node allocation blocks */
+    uint32_t nSeed;              /* Treap priority generator state */
+} PieceTable;
+
+/* Cached reader for sequential or nearby random access */
+typedef struct {
+    const PieceTable* pTable;
+    const TextUnit* pSpan;       /* Current span */
+    size_t nSpanStart;           /* Document offset of pSpan[0] */
+    size_t nSpanLen;             /* Units in current span */
+} PieceCursor;
+
+/* Lifetime */
+void PieceTableInit(PieceTable* pTable);
+void PieceTableFree(PieceTable* pTable);
+int PieceTableLoad(PieceTable* pTable, const TextUnit* pText, size_t nLen,
+                   PieceReleaseProc pfnRelease, void* pContext);
+void PieceTableMoveOriginal(PieceTable* pTable, const TextUnit* pText,
+                            PieceReleaseProc pfnRelease, void* pContext);
+
+/* Queries */
+size_t PieceTableLength(const PieceTable* pTable);
+size_t PieceTablePieceCount(const PieceTable* pTable);
+const TextUnit* PieceTableSpanAt(const PieceTable* pTable, size_t nOffset, size_t* pnSpanLen);
+size_t PieceTableCopy(const PieceTable* pTable, size_t nOffset, TextUnit* pDest, size_t nLen);
+int PieceTableForEach(const PieceTable* pTable, size_t nOffset, size_t nLen,
+                      PieceSpanProc pfnSpan, void* pContext);
+
+/* Edits (return nonzero on success) */
+int PieceTableInsert(PieceTable* pTable, size_t nOffset, const TextUnit* pText, size_t nLen);
+int PieceTableDelete(PieceTable* pTable, size_t nOffset, size_t nLen);
+
+/* Cursor */
+void PieceCursorInit(PieceCursor* pCursor, const PieceTable* pTable);
+int PieceCursorAt(PieceCursor* pCursor, size_t nOffset, TextUnit* pUnit);
+
+#endif /* PIECE_TABLE_H */
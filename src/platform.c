@@ -0,0 +1,609 @@
+#include "platform.h"
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+/* Map a file read-only (returns nonzero on success) */
+int MapFileReadOnly(MappedFile* pMap, const PathChar* szPath) {
+    LARGE_INTEGER liSize;
+    FILETIME ftWrite;
+    HANDLE hFile;
+    HANDLE hMapping;
+    const void* pView;
+
+    pMap->pData = NULL;
+    pMap->nSize = 0;
+    pMap->nModified = 0;
+    pMap->hFile = NULL;
+    pMap->hMapping = NULL;
+
+    /* Allow other processes to keep writing (log files) */
+    hFile = CreateFileW(szPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) return 0;
+
+    if (!GetFileSizeEx(hFile, &liSize) || liSize.QuadPart < 0 ||
+        (uint64_t)liSize.QuadPart > (uint64_t)SIZE_MAX) {
+        CloseHandle(hFile);
+        return 0;
+    }
+
+    pMap->hFile = hFile;
+    pMap->nSize = (uint64_t)liSize.QuadPart;
+    if (GetFileTime(hFile, NULL, NULL, &ftWrite)) {
+        pMap->nModified = ((uint64_t)ftWrite.dwHighDateTime << 32) | ftWrite.dwLowDateTime;
+    }
+
+    /* Zero-length files cannot be mapped */
+    if (pMap->nSize == 0) return 1;
+
+    hMapping = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!hMapping) {
+        UnmapFile(pMap);
+        return 0;
+    }
+    pMap->hMapping = hMapping;
+
+    pView = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (!pView) {
+        UnmapFile(pMap);
+        return 0;
+    }
+
+    pMap->pData = (const uint8_t*)pView;
+    return 1;
+}
+
+/* Release the view and its handles */
+void UnmapFile(MappedFile* pMap) {
+    if (pMap->pData) UnmapViewOfFile(pMap->pData);
+    if (pMap->hMapping) CloseHandle((HANDLE)pMap->hMapping);
+    if (pMap->hFile) CloseHandle((HANDLE)pMap->hFile);
+
+    pMap->pData = NULL;
+    pMap->nSize = 0;
+    pMap->nModified = 0;
+    pMap->hFile = NULL;
+    pMap->hMapping = NULL;
+}
+
+/* Create or truncate a file for writing (returns nonzero on success) */
+int OutputFileCreate(OutputFile* pFile, const PathChar* szPath) {
+    HANDLE hFile = CreateFileW(szPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                               FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    pFile->hFile = NULL;
+    if (hFile == INVALID_HANDLE_VALUE) return 0;
+    pFile->hFile = hFile;
+    return 1;
+}
+
+/* Write all of pData, retrying short writes (returns nonzero on success) */
+int OutputFileWrite(OutputFile* pFile, const void* pData, size_t nLen) {
+    const uint8_t* p = (const uint8_t*)pData;
+
+    while (nLen > 0) {
+        DWORD dwChunk = (nLen > 0x40000000) ? 0x40000000 : (DWORD)nLen;
+        DWORD dwWritten = 0;
+        if (!WriteFile((HANDLE)pFile->hFile, p, dwChunk, &dwWritten, NULL) || dwWritten == 0) {
+            return 0;
+        }
+        p += dwWritten;
+        nLen -= dwWritten;
+    }
+    return 1;
+}
+
+/* Open an existing file for writing at its end */
+int OutputFileOpenExisting(OutputFile* pFile, const PathChar* szPath) {
+    LARGE_INTEGER liZero = {0};
+    HANDLE hFile = CreateFileW(szPath, GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                               FILE_ATTRIBUTE_NORMAL, NULL);
+    pFile->hFile = NULL;
+    if (hFile == INVALID_HANDLE_VALUE) return 0;
+    if (!SetFilePointerEx(hFile, liZero, NULL, FILE_END)) {
+        CloseHandle(hFile);
+        return 0;
+    }
+    pFile->hFile = hFile;
+    return 1;
+}
+
+/* Cut the file to nSize bytes and continue writing there */
+int OutputFileTruncate(OutputFile* pFile, uint64_t nSize) {
+    LARGE_INTEGER liPos;
+    liPos.QuadPart = (LONGLONG)nSize;
+    return SetFilePointerEx((HANDLE)pFile->hFile, liPos, NULL, FILE_BEGIN) &&
+           SetEndOfFile((HANDLE)pFile->hFile);
+}
+
+/* Close the file (returns nonzero if the close succeeded) */
+int OutputFileClose(OutputFile* pFile) {
+    BOOL bOk = TRUE;
+    if (pFile->hFile) bOk = CloseHandle((HANDLE)pFile->hFile);
+    pFile->hFile = NULL;
+    return bOk ? 1 : 0;
+}
+
+/* Push written data through to the disk (returns nonzero on success) */
+int OutputFileFlush(OutputFile* pFile) {
+    return FlushFileBuffers((HANDLE)pFile->hFile) ? 1 : 0;
+}
+
+/* Create a uniquely named temp file next to szTarget */
+int OutputFileCreateTemp(OutputFile* pFile, const PathChar* szTarget,
+                         PathChar* szTempPath, size_t cchTemp) {
+    size_t nTarget = lstrlenW(szTarget);
+    DWORD dwSeed = GetCurrentProcessId() ^ GetTickCount();
+
+    pFile->hFile = NULL;
+    /* Room for ".~" + 8 hex digits + ".tmp" and the terminator */
+    if (nTarget + 15 > cchTemp) return 0;
+
+    for (DWORD i = 0; i < 16; i++) {
+        HANDLE hFile;
+        wsprintfW(szTempPath, L"%s.~%08x.tmp", szTarget, (unsigned)(dwSeed + i));
+        hFile = CreateFileW(szTempPath, GENERIC_WRITE, 0, NULL, CREATE_NEW,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (hFile != INVALID_HANDLE_VALUE) {
+            pFile->hFile = hFile;
+            return 1;
+        }
+        if (GetLastError() != ERROR_FILE_EXISTS) return 0;
+    }
+    return 0;
+}
+
+/* Atomically replace szTarget with szSource */
+int ReplaceFileAtomic(const PathChar* szSource, const PathChar* szTarget) {
+    /* ReplaceFile keeps the original's attributes, ACLs and streams */
+    if (GetFileAttributesW(szTarget) != INVALID_FILE_ATTRIBUTES &&
+        ReplaceFileW(szTarget, szSource, NULL, REPLACEFILE_IGNORE_MERGE_ERRORS, NULL, NULL)) {
+        return 1;
+    }
+    return MoveFileExW(szSource, szTarget, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) ? 1 : 0;
+}
+
+/* Delete a file (returns nonzero on success) */
+int DeleteFilePath(const PathChar* szPath) {
+    return DeleteFileW(szPath) ? 1 : 0;
+}
+
+/* List a directory's files and subdirectories */
+int ListDirectory(const PathChar* szDir, DirEntryProc pfnEntry, void* pContext) {
+    size_t nDir = lstrlenW(szDir);
+    WCHAR* szPattern = (WCHAR*)HeapAlloc(GetProcessHeap(), 0, (nDir + 3) * sizeof(WCHAR));
+    WIN32_FIND_DATAW fd;
+    HANDLE hFind;
+
+    if (!szPattern) return 0;
+    lstrcpyW(szPattern, szDir);
+    if (nDir > 0 && szDir[nDir - 1] != L'\\' && szDir[nDir - 1] != L'/') szPattern[nDir++] = L'\\';
+    szPattern[nDir++] = L'*';
+    szPattern[nDir] = L'\0';
+
+    /* No short names, and entries fetched in large batches */
+    hFind = FindFirstFileExW(szPattern, FindExInfoBasic, &fd, FindExSearchNameMatch, NULL,
+                             FIND_FIRST_EX_LARGE_FETCH);
+    HeapFree(GetProcessHeap(), 0, szPattern);
+    if (hFind == INVALID_HANDLE_VALUE) {
+        /* An empty drive root has no entries at all */
+        return GetLastError() == ERROR_FILE_NOT_FOUND;
+    }
+
+    do {
+        BOOL bDirectory = (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        if (bDirectory) {
+            if (fd.cFileName[0] == L'.' &&
+                (fd.cFileName[1] == L'\0' || (fd.cFileName[1] == L'.' && fd.cFileName[2] == L'\0'))) {
+                continue;
+            }
+            /* Junctions and directory links may point back up the tree */
+            if (fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) continue;
+        }
+        if (!pfnEntry(pContext, fd.cFileName, bDirectory ? 1 : 0)) break;
+    } while (FindNextFileW(hFind, &fd));
+
+    FindClose(hFind);
+    return 1;
+}
+
+static DWORD WINAPI WorkerThreadMain(LPVOID pParam) {
+    WorkerThread* pThread = (WorkerThread*)pParam;
+    pThread->pfnProc(pThread->pContext);
+    return 0;
+}
+
+/* Start pfnProc(pContext) on a new thread (returns nonzero on success) */
+int WorkerThreadStart(WorkerThread* pThread, WorkerProc pfnProc, void* pContext) {
+    pThread->pfnProc = pfnProc;
+    pThread->pContext = pContext;
+    pThread->hThread = CreateThread(NULL, 0, WorkerThreadMain, pThread, 0, NULL);
+    return pThread->hThread != NULL;
+}
+
+/* Wait for a started thread to finish and release it */
+void WorkerThreadJoin(WorkerThread* pThread) {
+    WaitForSingleObject((HANDLE)pThread->hThread, INFINITE);
+    CloseHandle((HANDLE)pThread->hThread);
+    pThread->hThread = NULL;
+}
+
+void WorkerThreadYield(void) {
+    SwitchToThread();
+}
+
+/* An SRWLOCK and a CONDITION_VARIABLE are one pointer each, so they live in the handle fields */
+typedef char SrwLockFitsHandle[sizeof(SRWLOCK) == sizeof(void*) ? 1 : -1];
+typedef char ConditionFitsHandle[sizeof(CONDITION_VARIABLE) == sizeof(void*) ? 1 : -1];
+
+int WorkerSignalInit(WorkerSignal* pSignal) {
+    InitializeSRWLock((PSRWLOCK)&pSignal->hLock);
+    InitializeConditionVariable((PCONDITION_VARIABLE)&pSignal->hCondition);
+    return 1;
+}
+
+void WorkerSignalFree(WorkerSignal* pSignal) {
+    (void)pSignal;
+}
+
+void WorkerSignalLock(WorkerSignal* pSignal) {
+    AcquireSRWLockExclusive((PSRWLOCK)&pSignal->hLock);
+}
+
+void WorkerSignalUnlock(WorkerSignal* pSignal) {
+    ReleaseSRWLockExclusive((PSRWLOCK)&pSignal->hLock);
+}
+
+void WorkerSignalWait(WorkerSignal* pSignal, unsigned nTimeoutMs) {
+    SleepConditionVariableSRW((PCONDITION_VARIABLE)&pSignal->hCondition, (PSRWLOCK)&pSignal->hLock,
+                              nTimeoutMs == WORKER_WAIT_INFINITE ? INFINITE : nTimeoutMs, 0);
+}
+
+void WorkerSignalNotify(WorkerSignal* pSignal) {
+    WakeAllConditionVariable((PCONDITION_VARIABLE)&pSignal->hCondition);
+}
+
+/* Logical processors available to the process */
+int ProcessorCount(void) {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors > 0 ? (int)si.dwNumberOfProcessors : 1;
+}
+
+#else /* POSIX */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Map a file read-only (returns nonzero on success) */
+int MapFileReadOnly(MappedFile* pMap, const PathChar* szPath) {
+    struct stat st;
+    void* pView;
+    int fd;
+
+    pMap->pData = NULL;
+    pMap->nSize = 0;
+    pMap->nModified = 0;
+    pMap->hFile = NULL;
+    pMap->hMapping = NULL;
+
+    fd = open(szPath, O_RDONLY);
+    if (fd < 0) return 0;
+
+    if (fstat(fd, &st) != 0 || st.st_size < 0 || (uint64_t)st.st_size > (uint64_t)SIZE_MAX) {
+        close(fd);
+        return 0;
+    }
+
+    /* The descriptor is stored biased by one so that NULL means "none" */
+    pMap->hFile = (void*)(intptr_t)(fd + 1);
+    pMap->nSize = (uint64_t)st.st_size;
+    pMap->nModified = (uint64_t)st.st_mtim.tv_sec * 1000000000u + (uint64_t)st.st_mtim.tv_nsec;
+
+    if (pMap->nSize == 0) return 1;
+
+    pView = mmap(NULL, (size_t)pMap->nSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (pView == MAP_FAILED) {
+        UnmapFile(pMap);
+        return 0;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(pView, (size_t)pMap->nSize, MADV_SEQUENTIAL);
+#endif
+
+    pMap->pData = (const uint8_t*)pView;
+    return 1;
+}
+
+/* Release the view and its handles */
+void UnmapFile(MappedFile* pMap) {
+    if (pMap->pData) munmap((void*)pMap->pData, (size_t)pMap->nSize);
+    if (pMap->hFile) close((int)((intptr_t)pMap->hFile - 1));
+
+    pMap->pData = NULL;
+    pMap->nSize = 0;
+    pMap->nModified = 0;
+    pMap->hFile = NULL;
+    pMap->hMapping = NULL;
+}
+
+/* Create or truncate a file for writing (returns nonzero on success) */
+int OutputFileCreate(OutputFile* pFile, const PathChar* szPath) {
+    int fd = open(szPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    pFile->hFile = NULL;
+    if (fd < 0) return 0;
+    pFile->hFile = (void*)(intptr_t)(fd + 1);
+    return 1;
+}
+
+/* Write all of pData, retrying short writes (returns nonzero on success) */
+int OutputFileWrite(OutputFile* pFile, const void* pData, size_t nLen) {
+    const uint8_t* p = (const uint8_t*)pData;
+    int fd = (int)((intptr_t)pFile->hFile - 1);
+
+    while (nLen > 0) {
+        ssize_t nWritten = write(fd, p, nLen);
+        if (nWritten < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        if (nWritten == 0) return 0;
+        p += nWritten;
+        nLen -= (size_t)nWritten;
+    }
+    return 1;
+}
+
+/* Open an existing file for writing at its end */
+int OutputFileOpenExisting(OutputFile* pFile, const PathChar* szPath) {
+    int fd = open(szPath, O_WRONLY);
+    pFile->hFile = NULL;
+    if (fd < 0) return 0;
+
+    /* An advisory lock stands in for Windows' share modes */
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0 || lseek(fd, 0, SEEK_END) < 0) {
+        close(fd);
+        return 0;
+    }
+    pFile->hFile = (void*)(intptr_t)(fd + 1);
+    return 1;
+}
+
+/* Cut the file to nSize bytes and continue writing there */
+int OutputFileTruncate(OutputFile* pFile, uint64_t nSize) {
+    int fd = (int)((intptr_t)pFile->hFile - 1);
+    return ftruncate(fd, (off_t)nSize) == 0 && lseek(fd, (off_t)nSize, SEEK_SET) >= 0;
+}
+
+/* Close the file (returns nonzero if the close succeeded) */
+int OutputFileClose(OutputFile* pFile) {
+    int nResult = 0;
+    if (pFile->hFile) nResult = close((int)((intptr_t)pFile->hFile - 1));
+    pFile->hFile = NULL;
+    return nResult == 0;
+}
+
+/* Push written data through to the disk (returns nonzero on success) */
+int OutputFileFlush(OutputFile* pFile) {
+    return fsync((int)((intptr_t)pFile->hFile - 1)) == 0;
+}
+
+/* Create a uniquely named temp file next to szTarget */
+int OutputFileCreateTemp(OutputFile* pFile, const PathChar* szTarget,
+                         PathChar* szTempPath, size_t cchTemp) {
+    unsigned nSeed = (unsigned)getpid();
+
+    pFile->hFile = NULL;
+    for (unsigned i = 0; i < 16; i++) {
+        int n = snprintf(szTempPath, cchTemp, "%s.~%08x.tmp", szTarget, nSeed + i);
+        int fd;
+        if (n < 0 || (size_t)n >= cchTemp) return 0;
+        fd = open(szTempPath, O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (fd >= 0) {
+            pFile->hFile = (void*)(intptr_t)(fd + 1);
+            return 1;
+        }
+        if (errno != EEXIST) return 0;
+    }
+    return 0;
+}
+
+/* Atomically replace szTarget with szSource */
+int ReplaceFileAtomic(const PathChar* szSource, const PathChar* szTarget) {
+    struct stat st;
+    const char* pSlash;
+    int fdDir;
+
+    /* Keep the permissions of the file being replaced */
+    if (stat(szTarget, &st) == 0) chmod(szSource, st.st_mode & 07777);
+
+    if (rename(szSource, szTarget) != 0) return 0;
+
+    /* Make the rename itself durable */
+    pSlash = strrchr(szTarget, '/');
+    if (!pSlash) {
+        fdDir = open(".", O_RDONLY);
+    } else if (pSlash == szTarget) {
+        fdDir = open("/", O_RDONLY);
+    } else {
+        char szDir[4096];
+        size_t nDir = (size_t)(pSlash - szTarget);
+        if (nDir >= sizeof(szDir)) return 1;
+        memcpy(szDir, szTarget, nDir);
+        szDir[nDir] = '\0';
+        fdDir = open(szDir, O_RDONLY);
+    }
+    if (fdDir >= 0) {
+        fsync(fdDir);
+        close(fdDir);
+    }
+    return 1;
+}
+
+/* Delete a file (returns nonzero on success) */
+int DeleteFilePath(const PathChar* szPath) {
+    return unlink(szPath) == 0;
+}
+
+/* List a directory's files and subdirectories */
+int ListDirectory(const PathChar* szDir, DirEntryProc pfnEntry, void* pContext) {
+    DIR* pDir = opendir(szDir);
+    struct dirent* pEntry;
+
+    if (!pDir) return 0;
+
+    while ((pEntry = readdir(pDir)) != NULL) {
+        const char* szName = pEntry->d_name;
+        struct stat st;
+        int bDirectory;
+
+        if (szName[0] == '.' && (szName[1] == '\0' || (szName[1] == '.' && szName[2] == '\0'))) continue;
+
+        if (pEntry->d_type == DT_DIR || pEntry->d_type == DT_REG) {
+            bDirectory = pEntry->d_type == DT_DIR;
+        } else if (pEntry->d_type == DT_LNK || pEntry->d_type == DT_UNKNOWN) {
+            /* Links count when they lead to a regular file; links to directories could loop */
+            if (fstatat(dirfd(pDir), szName, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+            if (S_ISLNK(st.st_mode) && fstatat(dirfd(pDir), szName, &st, 0) != 0) continue;
+            if (S_ISDIR(st.st_mode) && pEntry->d_type == DT_LNK) continue;
+            if (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode)) continue;
+            bDirectory = S_ISDIR(st.st_mode);
+        } else {
+            /* Pipes, sockets and devices would block or never end */
+            continue;
+        }
+
+        if (!pfnEntry(pContext, szName, bDirectory)) break;
+    }
+
+    closedir(pDir);
+    return 1;
+}
+
+static void* WorkerThreadMain(void* pParam) {
+    WorkerThread* pThread = (WorkerThread*)pParam;
+    pThread->pfnProc(pThread->pContext);
+    return NULL;
+}
+
+/* Start pfnProc(pContext) on a new thread (returns nonzero on success) */
+int WorkerThreadStart(WorkerThread* pThread, WorkerProc pfnProc, void* pContext) {
+    pthread_t* pHandle = (pthread_t*)malloc(sizeof(pthread_t));
+
+    if (!pHandle) return 0;
+    pThread->pfnProc = pfnProc;
+    pThread->pContext = pContext;
+    if (pthread_create(pHandle, NULL, WorkerThreadMain, pThread) != 0) {
+        free(pHandle);
+        return 0;
+    }
+    pThread->hThread = pHandle;
+    return 1;
+}
+
+/* Wait for a started thread to finish and release it */
+void WorkerThreadJoin(WorkerThread* pThread) {
+    pthread_t* pHandle = (pthread_t*)pThread->hThread;
+    pthread_join(*pHandle, NULL);
+    free(pHandle);
+    pThread->hThread = NULL;
+}
+
+void WorkerThreadYield(void) {
+    sched_yield();
+}
+
+/* The mutex and condition variable are allocated together */
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} PosixSignal;
+
+int WorkerSignalInit(WorkerSignal* pSignal) {
+    PosixSignal* pPosix = (PosixSignal*)malloc(sizeof(PosixSignal));
+    pthread_condattr_t attr;
+
+    pSignal->hLock = NULL;
+    pSignal->hCondition = NULL;
+    if (!pPosix) return 0;
+
+    /* Time out against the monotonic clock, immune to clock changes */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (pthread_mutex_init(&pPosix->mutex, NULL) != 0) {
+        pthread_condattr_destroy(&attr);
+        free(pPosix);
+        return 0;
+    }
+    if (pthread_cond_init(&pPosix->cond, &attr) != 0) {
+        pthread_condattr_destroy(&attr);
+        pthread_mutex_destroy(&pPosix->mutex);
+        free(pPosix);
+        return 0;
+    }
+    pthread_condattr_destroy(&attr);
+
+    pSignal->hLock = pPosix;
+    pSignal->hCondition = &pPosix->cond;
+    return 1;
+}
+
+void WorkerSignalFree(WorkerSignal* pSignal) {
+    PosixSignal* pPosix = (PosixSignal*)pSignal->hLock;
+    if (!pPosix) return;
+    pthread_cond_destroy(&pPosix->cond);
+    pthread_mutex_destroy(&pPosix->mutex);
+    free(pPosix);
+    pSignal->hLock = NULL;
+    pSignal->hCondition = NULL;
+}
+
+void WorkerSignalLock(WorkerSignal* pSignal) {
+    pthread_mutex_lock(&((PosixSignal*)pSignal->hLock)->mutex);
+}
+
+void WorkerSignalUnlock(WorkerSignal* pSignal) {
+    pthread_mutex_unlock(&((PosixSignal*)pSignal->hLock)->mutex);
+}
+
+void WorkerSignalWait(WorkerSignal* pSignal, unsigned nTimeoutMs) {
+    PosixSignal* pPosix = (PosixSignal*)pSignal->hLock;
+    struct timespec ts;
+
+    if (nTimeoutMs == WORKER_WAIT_INFINITE) {
+        pthread_cond_wait(&pPosix->cond, &pPosix->mutex);
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += nTimeoutMs / 1000;
+    ts.tv_nsec += (long)(nTimeoutMs % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&pPosix->cond, &pPosix->mutex, &ts);
+}
+
+void WorkerSignalNotify(WorkerSignal* pSignal) {
+    pthread_cond_broadcast(&((PosixSignal*)pSignal->hLock)->cond);
+}
+
+/* Logical processors available to the process */
+int ProcessorCount(void) {
+    long nCount = sysconf(_SC_NPROCESSORS_ONLN);
+    return nCount > 0 ? (int)nCount : 1;
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,143 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+/*
+ * Operating system shim for file access and worker threads.
+ *
+ * Keeps Win32 and POSIX calls out of the portable modules so they can be
+ * built and exercised on Linux. Windows uses CreateFileMapping and
+ * MapViewOfFile for reading, CreateFile/WriteFile for writing and
+ * CreateThread for threads; other systems use open, mmap, write and
+ * pthreads.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Native path character (wide on Windows, bytes elsewhere) */
+#ifdef _WIN32
+typedef wchar_t PathChar;
+#define PATH_SEPARATOR L'\\'
+#else
+typedef char PathChar;
+#define PATH_SEPARATOR '/'
+#endif
+
+/* Read-only view of a whole file */
+typedef struct {
+    const uint8_t* pData;        /* First byte of the view (NULL for an empty file) */
+    uint64_t nSize;              /* File size in bytes */
+    uint64_t nModified;          /* Last write time (platform units; only compared for equality) */
+    void* hFile;                 /* Platform file handle */
+    void* hMapping;              /* Platform mapping handle */
+} MappedFile;
+
+/* Map a file read-only (returns nonzero on success) */
+int MapFileReadOnly(MappedFile* pMap, const PathChar* szPath);
+
+/* Release the view and its handles */
+void UnmapFile(MappedFile* pMap);
+
+/* File opened for writing */
+typedef struct {
+    void* hFile;                 /* Platform file handle */
+} OutputFile;
+
+/* Create or truncate a file for writing (returns nonzero on success) */
+int OutputFileCreate(OutputFile* pFile, const PathChar* szPath);
+
+/* Write all of pData, retrying short writes (returns nonzero on success) */
+int OutputFileWrite(OutputFile* pFile, const void* pData, size_t nLen);
+
+/*
+ * Open an existing file for writing at its end. Other handles may read it
+ * but not write it, so a second process cannot claim the same file.
+ * Returns nonzero on success.
+ */
+int OutputFileOpenExisting(OutputFile* pFile, const PathChar* szPath);
+
+/* Cut the file to nSize bytes and continue writing there (returns nonzero on success) */
+int OutputFileTruncate(OutputFile* pFile, uint64_t nSize);
+
+/* Close the file (returns nonzero if the close succeeded) */
+int OutputFileClose(OutputFile* pFile);
+
+/* Push written data through to the disk (returns nonzero on success) */
+int OutputFileFlush(OutputFile* pFile);
+
+/*
+ * Create a new, uniquely named temp file next to szTarget and store its
+ * path in szTempPath (cchTemp characters). Returns nonzero on success.
+ */
+int OutputFileCreateTemp(OutputFile* pFile, const PathChar* szTarget,
+                         PathChar* szTempPath, size_t cchTemp);
+
+/*
+ * Atomically replace szTarget with szSource (which is consumed). An
+ * existing target keeps its attributes. Returns nonzero on success.
+ */
+int ReplaceFileAtomic(const PathChar* szSource, const PathChar* szTarget);
+
+/* Delete a file (returns nonzero on success) */
+int DeleteFilePath(const PathChar* szPath);
+
+/* Receives each entry of a directory; return zero to stop listing */
+typedef int (*DirEntryProc)(void* pContext, const PathChar* szName, int bDirectory);
+
+/*
+ * Call pfnEntry for each file and subdirectory of szDir (not "." and "..",
+ * in no particular order). Links to directories are left out, so a walk
+ * down the tree cannot loop. Returns nonzero if the directory could be
+ * read.
+ */
+int ListDirectory(const PathChar* szDir, DirEntryProc pfnEntry, void* pContext);
+
+/* Body of a worker thread */
+typedef void (*WorkerProc)(void* pContext);
+
+/* Worker thread (must stay in place until joined) */
+typedef struct {
+    void* hThread;               /* Platform thread handle */
+    WorkerProc pfnProc;          /* Thread body */
+    void* pContext;              /* Context for pfnProc */
+} WorkerThread;
+
+/* Start pfnProc(pContext) on a new thread (returns nonzero on success) */
+int WorkerThreadStart(WorkerThread* pThread, WorkerProc pfnProc, void* pContext);
+
+/* Wait for a started thread to finish and release it */
+void WorkerThreadJoin(WorkerThread* pThread);
+
+/* Give up the rest of this thread's time slice */
+void WorkerThreadYield(void);
+
+/* Wait forever in WorkerSignalWait */
+#define WORKER_WAIT_INFINITE 0xFFFFFFFFu
+
+/* Lock with a condition to wait on, for handing work to a thread */
+typedef struct {
+    void* hLock;                 /* Platform lock */
+    void* hCondition;            /* Platform condition variable */
+} WorkerSignal;
+
+/* Lifetime (WorkerSignalInit returns nonzero on success) */
+int WorkerSignalInit(WorkerSignal* pSignal);
+void WorkerSignalFree(WorkerSignal* pSignal);
+
+void WorkerSignalLock(WorkerSignal* pSignal);
+void WorkerSignalUnlock(WorkerSignal* pSignal);
+
+/*
+ * With the lock held: release it, sleep until notified or nTimeoutMs
+ * passed (WORKER_WAIT_INFINITE for no limit), then take it again. Callers
+ * recheck their condition, as wakeups may be spurious.
+ */
+void WorkerSignalWait(WorkerSignal* pSignal, unsigned nTimeoutMs);
+
+/* Wake every waiting thread */
+void WorkerSignalNotify(WorkerSignal* pSignal);
+
+/* Logical processors available to the process */
+int ProcessorCount(void);
+
+#endif /* PLATFORM_H */
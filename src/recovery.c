@@ -0,0 +1,323 @@
+#include "notepad.h"
+#include "platform.h"
+#include "edit_journal.h"
+#include <stdlib.h>
+
+/*
+ * Crash recovery and hot exit.
+ *
+ * Every tab with unsaved changes has an edit journal in the recovery folder
+ * (see edit_journal.h). Saving, discarding or closing the tab deletes it.
+ * At exit, modified tabs whose journal is healthy are not prompted for:
+ * their journals stay behind and the next launch reopens them as they were.
+ * After a crash the same happens with whatever reached the disk.
+ */
+
+/* Journals in the recovery folder */
+#define RECOVERY_PATTERN TEXT("*.xnj")
+
+/* Most journals restored in one launch (the rest wait for the next) */
+#define RECOVERY_MAX_FILES 1024
+
+static JournalWriter g_Writer;
+static BOOL g_bRecovery = FALSE;
+static WCHAR g_szRecoveryDir[MAX_PATH];
+
+/* %LOCALAPPDATA%\XNote, created if missing (falls back to the temp folder) */
+BOOL FindAppDataDir(WCHAR* szDir, DWORD cchDir) {
+    DWORD nLen = GetEnvironmentVariableW(L"LOCALAPPDATA", szDir, cchDir);
+
+    if (nLen == 0 || nLen >= cchDir) {
+        nLen = GetTempPathW(cchDir, szDir);
+        if (nLen == 0 || nLen >= cchDir) return FALSE;
+    }
+    if (szDir[nLen - 1] == L'\\') szDir[--nLen] = L'\0';
+    if (nLen + 24 >= cchDir) return FALSE;
+
+    lstrcatW(szDir, L"\\XNote");
+    if (!CreateDirectoryW(szDir, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* %LOCALAPPDATA%\XNote\Recovery, created if missing */
+static BOOL FindRecoveryDir(WCHAR* szDir, DWORD cchDir) {
+    if (!FindAppDataDir(szDir, cchDir) || lstrlenW(szDir) + 10 >= (int)cchDir) return FALSE;
+
+    lstrcatW(szDir, L"\\Recovery");
+    if (!CreateDirectoryW(szDir, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* Start the journal writer (without it nothing is journaled) */
+BOOL StartRecovery(void) {
+    if (g_bRecovery) return TRUE;
+    if (!FindRecoveryDir(g_szRecoveryDir, MAX_PATH)) return FALSE;
+    if (!JournalWriterStart(&g_Writer, EDIT_JOURNAL_BATCH_MS)) return FALSE;
+    g_bRecovery = TRUE;
+    return TRUE;
+}
+
+/* Write out everything still pending and stop the writer */
+void StopRecovery(void) {
+    if (!g_bRecovery) return;
+    JournalWriterStop(&g_Writer);
+    g_bRecovery = FALSE;
+}
+
+/* New journal file name: creation time first, so listing by name restores tabs in order */
+static BOOL MakeJournalPath(WCHAR* szPath, size_t cchPath) {
+    static LONG nCounter = 0;
+    FILETIME ft;
+
+    if (lstrlenW(g_szRecoveryDir) + 48 > (int)cchPath) return FALSE;
+    GetSystemTimeAsFileTime(&ft);
+    wsprintfW(szPath, L"%s\\%08lX%08lX-%lX-%lX.xnj", g_szRecoveryDir,
+              ft.dwHighDateTime, ft.dwLowDateTime, GetCurrentProcessId(),
+              (unsigned long)InterlockedIncrement(&nCounter));
+    return TRUE;
+}
+
+/* Journal an edit about to be made to a tab's document */
+void JournalDocumentEdit(TabState* pTab, size_t nOffset, size_t nRemove,
+                         const TextUnit* pInsert, size_t nInsert) {
+    /* Find in Files results can be searched for again, so they are never journaled */
+    if (!g_bRecovery || pTab->bLargeFile || pTab->bReplayJournal || pTab->bFindResults ||
+        (nRemove == 0 && nInsert == 0)) {
+        return;
+    }
+
+    if (!pTab->pJournal) {
+        WCHAR szJournal[MAX_PATH];
+
+        /* Unchanged since it was loaded or saved: the file itself is the base */
+        if (!MakeJournalPath(szJournal, MAX_PATH)) return;
+        if (!pTab->bUntitled && !pTab->bModified) {
+            pTab->pJournal = EditJournalCreate(&g_Writer, szJournal, EDIT_JOURNAL_BASE_FILE,
+                                               pTab->szFileName, pTab->lineEnding, &pTab->doc);
+        }
+        if (!pTab->pJournal) {
+            pTab->pJournal = EditJournalCreate(&g_Writer, szJournal, EDIT_JOURNAL_BASE_SNAPSHOT,
+                                               pTab->bUntitled ? L"" : pTab->szFileName,
+                                               pTab->lineEnding, &pTab->doc);
+        }
+        if (!pTab->pJournal) return;
+    } else if (EditJournalFailed(pTab->pJournal)) {
+        /* The disk let us down: no more journaling until the tab is saved */
+        return;
+    } else if (EditJournalCheckpointDue(pTab->pJournal, PieceTableLength(&pTab->doc))) {
+        EditJournalCheckpoint(pTab->pJournal, &pTab->doc);
+    }
+
+    EditJournalAppend(pTab->pJournal, nOffset, nRemove, pInsert, nInsert);
+}
+
+/* The tab's changes are saved or thrown away: delete its journal */
+void DiscardTabJournal(TabState* pTab) {
+    if (pTab->pJournal) {
+        EditJournalDiscard(pTab->pJournal);
+        pTab->pJournal = NULL;
+    }
+    pTab->bReplayJournal = FALSE;
+}
+
+/* Whether a tab's unsaved changes are safe in its journal (so exit need not ask) */
+BOOL CanHotExitTab(const TabState* pTab) {
+    return g_bRecovery && pTab->pJournal && !EditJournalFailed(pTab->pJournal);
+}
+
+/* At exit: keep the journal of a tab that will be restored, delete any other */
+void ReleaseTabJournal(TabState* pTab) {
+    if (pTab->pJournal && (pTab->bReplayJournal || (pTab->bModified && CanHotExitTab(pTab)))) {
+        EditJournalClose(pTab->pJournal);
+        pTab->pJournal = NULL;
+        pTab->bReplayJournal = FALSE;
+    } else {
+        DiscardTabJournal(pTab);
+    }
+}
+
+/* Show a restored document and continue journaling it */
+static void ShowRecoveredDocument(TabState* pTab, const EditJournalInfo* pInfo) {
+    LineIndexBuild(&pTab->lines, &pTab->doc);
+    DocStatsBuild(&pTab->stats, &pTab->doc);
+    pTab->lineEnding = (LineEndingType)pInfo->nLineEnding;
+    if (pInfo->szPath[0] && lstrlenW(pInfo->szPath) < MAX_PATH) {
+        lstrcpyW(pTab->szFileName, pInfo->szPath);
+        pTab->bUntitled = FALSE;
+    }
+
+    /* Feeding the control is not an edit: the journal is attached afterwards */
+    FeedEditFromDocument(pTab->hwndEdit, &pTab->doc);
+    SendMessage(pTab->hwndEdit, EM_SETSEL, 0, 0);
+    RestoreTabPosition(pTab);
+    pTab->bModified = TRUE;
+
+    if (!EditJournalResume(pTab->pJournal, pInfo)) {
+        /* The text is back; the next edit starts a fresh journal */
+        DiscardTabJournal(pTab);
+    }
+}
+
+/* Called by FinishFileLoad when the file under a journal has been read */
+void FinishTabRecovery(HWND hwnd, TabState* pTab, BOOL bLoaded) {
+    EditJournalInfo info;
+
+    pTab->bReplayJournal = FALSE;
+    if (!pTab->pJournal) return;
+
+    if (!bLoaded || pTab->bLargeFile ||
+        !EditJournalReplay(EditJournalPath(pTab->pJournal), &pTab->doc, &info)) {
+        DiscardTabJournal(pTab);
+        if (bLoaded) {
+            ShowErrorDialog(hwnd, TEXT("Unsaved changes to this file could not be recovered."));
+        }
+        return;
+    }
+    ShowRecoveredDocument(pTab, &info);
+}
+
+/* Tab to restore into: the file's tab reopened from the session, the first, empty tab, or a new one */
+static int TabForRecovery(HWND hwnd, const WCHAR* szPath) {
+    int nTab = szPath[0] ? ClaimDeferredTab(hwnd, szPath) : -1;
+
+    if (nTab >= 0) return nTab;
+    if (GetTabCount() == 1) {
+        TabState* pFirst = GetTab(0);
+        if (pFirst->bUntitled && !pFirst->bModified && !pFirst->pLoad && !pFirst->pJournal &&
+            !pFirst->pHibernation && PieceTableLength(&pFirst->doc) == 0) {
+            return 0;
+        }
+    }
+    return AddNewTab(hwnd, TEXT("Untitled"));
+}
+
+/* Delete temp files a checkpoint of szJournal left behind when its process died */
+static void DeleteStaleTemps(const WCHAR* szJournal) {
+    WCHAR szPattern[MAX_PATH];
+    WCHAR szTemp[MAX_PATH];
+    WIN32_FIND_DATAW fd;
+    HANDLE hFind;
+
+    if (lstrlenW(szJournal) + 8 > MAX_PATH) return;
+    wsprintfW(szPattern, L"%s.~*.tmp", szJournal);
+    hFind = FindFirstFileW(szPattern, &fd);
+    if (hFind == INVALID_HANDLE_VALUE) return;
+    do {
+        if (lstrlenW(g_szRecoveryDir) + lstrlenW(fd.cFileName) + 2 > MAX_PATH) continue;
+        wsprintfW(szTemp, L"%s\\%s", g_szRecoveryDir, fd.cFileName);
+        DeleteFileW(szTemp);
+    } while (FindNextFileW(hFind, &fd));
+    FindClose(hFind);
+}
+
+/* Reopen one journal (returns FALSE if its changes are lost) */
+static BOOL RestoreJournal(HWND hwnd, const WCHAR* szJournal) {
+    EditJournal* pJournal;
+    EditJournalInfo info;
+    TabState* pTab;
+    int nTab;
+
+    /* Another instance may be restoring it already */
+    pJournal = EditJournalClaim(&g_Writer, szJournal);
+    if (!pJournal) return TRUE;
+    DeleteStaleTemps(szJournal);
+
+    if (!EditJournalReadBase(szJournal, &info)) {
+        EditJournalDiscard(pJournal);
+        return FALSE;
+    }
+
+    if (info.nBaseKind == EDIT_JOURNAL_BASE_FILE) {
+        uint64_t nSize, nHash;
+
+        /* The edits only apply to the file exactly as it was */
+        if (lstrlenW(info.szPath) >= MAX_PATH || !EditJournalFingerprint(info.szPath, &nSize, &nHash) ||
+            nSize != info.nFileSize || nHash != info.nFileHash) {
+            EditJournalDiscard(pJournal);
+            return FALSE;
+        }
+    }
+
+    nTab = TabForRecovery(hwnd, info.szPath);
+    if (nTab < 0) {
+        /* No tab for it: leave it for the next launch */
+        EditJournalClose(pJournal);
+        return TRUE;
+    }
+    pTab = GetTab(nTab);
+    pTab->pJournal = pJournal;
+
+    if (info.nBaseKind == EDIT_JOURNAL_BASE_FILE) {
+        /* Read the file as usual; FinishFileLoad replays the edits on top */
+        pTab->bReplayJournal = TRUE;
+        if (!BeginFileLoad(hwnd, pTab, info.szPath)) {
+            DiscardTabJournal(pTab);
+            return FALSE;
+        }
+    } else {
+        if (!EditJournalReplay(szJournal, &pTab->doc, &info)) {
+            DiscardTabJournal(pTab);
+            return FALSE;
+        }
+        ShowRecoveredDocument(pTab, &info);
+    }
+
+    UpdateTabTitle(nTab);
+    return TRUE;
+}
+
+static int CompareNames(const void* a, const void* b) {
+    return lstrcmpW((const WCHAR*)a, (const WCHAR*)b);
+}
+
+/* Reopen the tabs left by the last session (hot exit or crash) */
+void RestoreRecoveredTabs(HWND hwnd) {
+    WCHAR (*pNames)[MAX_PATH];
+    WCHAR szPattern[MAX_PATH];
+    WIN32_FIND_DATAW fd;
+    HANDLE hFind;
+    int nNames = 0;
+    int nLost = 0;
+
+    if (!g_bRecovery) return;
+
+    pNames = (WCHAR (*)[MAX_PATH])HeapAlloc(GetProcessHeap(), 0, sizeof(WCHAR[MAX_PATH]) * RECOVERY_MAX_FILES);
+    if (!pNames) return;
+
+    wsprintfW(szPattern, L"%s\\%s", g_szRecoveryDir, RECOVERY_PATTERN);
+    hFind = FindFirstFileW(szPattern, &fd);
+    if (hFind != INVALID_HANDLE_VALUE) {
+        do {
+            int nLen = lstrlenW(fd.cFileName);
+
+            /* The pattern also matches longer extensions through short names */
+            if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+            if (nLen < 4 || lstrcmpiW(fd.cFileName + nLen - 4, L".xnj") != 0) continue;
+            if (lstrlenW(g_szRecoveryDir) + nLen + 2 > MAX_PATH) continue;
+            wsprintfW(pNames[nNames++], L"%s\\%s", g_szRecoveryDir, fd.cFileName);
+        } while (nNames < RECOVERY_MAX_FILES && FindNextFileW(hFind, &fd));
+        FindClose(hFind);
+    }
+
+    /* Oldest journal first, so tabs come back in the order they were edited */
+    qsort(pNames, nNames, sizeof(pNames[0]), CompareNames);
+    for (int i = 0; i < nNames; i++) {
+        if (!RestoreJournal(hwnd, pNames[i])) nLost++;
+    }
+    HeapFree(GetProcessHeap(), 0, pNames);
+
+    if (nLost > 0) {
+        ShowErrorDialog(hwnd, TEXT("Some unsaved changes from the last session could not be recovered ")
+                              TEXT("because their files have changed or are missing."));
+    }
+
+    if (nNames > 0) {
+        SwitchToTab(hwnd, g_AppState.nCurrentTab);
+        UpdateWindowTitle(hwnd);
+        RequestFrame(hwnd, FRAME_DIRTY_GUTTER | FRAME_DIRTY_STATUS);
+    }
+}
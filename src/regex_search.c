@@ -0,0 +1,1840 @@
+#include "regex_search.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Largest code point */
+#define RE_MAX_CP 0x10FFFF
+
+/* Groups a pattern may nest */
+#define RE_MAX_DEPTH 256
+
+/* Literal prefix lengths worth handing to TextSearch */
+#define RE_MIN_PREFIX 1
+#define RE_MAX_PREFIX 64
+
+/* Units read at a time when scanning a document backwards */
+#define RE_CHUNK 4096
+
+/* Returned by the DFA when its cache keeps overflowing */
+#define RE_FALLBACK (-2)
+
+/* ---- Assertions ---- */
+
+/* Character kinds, as assertions see them */
+#define RE_KIND_OTHER 0
+#define RE_KIND_WORD  1
+#define RE_KIND_CR    2
+#define RE_KIND_LF    3
+#define RE_KIND_EDGE  4 /* Start or end of the text */
+#define RE_KIND_TRAIL 5 /* Inside a character: low surrogate or UTF-8 continuation byte (a word character) */
+#define RE_KINDS      6
+
+#define RE_ASSERT_BOL        1 /* ^ */
+#define RE_ASSERT_EOL        2 /* $ */
+#define RE_ASSERT_WORD       3 /* \b */
+#define RE_ASSERT_NOT_WORD   4 /* \B */
+#define RE_ASSERT_WORD_START 5 /* Whole word: no word character on the left */
+#define RE_ASSERT_WORD_END   6 /* Whole word: none on the right */
+#define RE_ASSERT_CHAR_START 7 /* Not inside a character (every match starts with this) */
+
+#define IS_WORD_KIND(k) ((k) == RE_KIND_WORD || (k) == RE_KIND_TRAIL)
+
+/* Whether an assertion holds between characters of kinds nLeft and nRight */
+static int AssertHolds(int nAssert, int nLeft, int nRight) {
+    switch (nAssert) {
+        case RE_ASSERT_BOL:
+            return nLeft == RE_KIND_LF || nLeft == RE_KIND_EDGE || (nLeft == RE_KIND_CR && nRight != RE_KIND_LF);
+        case RE_ASSERT_EOL:
+            return nRight == RE_KIND_CR || nRight == RE_KIND_EDGE || (nRight == RE_KIND_LF && nLeft != RE_KIND_CR);
+        case RE_ASSERT_WORD:
+            return IS_WORD_KIND(nLeft) != IS_WORD_KIND(nRight);
+        case RE_ASSERT_NOT_WORD:
+            return IS_WORD_KIND(nLeft) == IS_WORD_KIND(nRight);
+        case RE_ASSERT_WORD_START:
+            return !IS_WORD_KIND(nLeft);
+        case RE_ASSERT_WORD_END:
+            return !IS_WORD_KIND(nRight);
+        case RE_ASSERT_CHAR_START:
+            return nRight != RE_KIND_TRAIL;
+    }
+    return 0;
+}
+
+/* ---- Character sets (sorted ranges) ---- */
+
+typedef struct {
+    uint32_t nLo, nHi;
+} ReRange;
+
+typedef struct {
+    ReRange* pRanges;
+    size_t nCount, nCap;
+} ReSet;
+
+static int SetAdd(ReSet* pSet, uint32_t nLo, uint32_t nHi) {
+    if (pSet->nCount == pSet->nCap) {
+        size_t nCap = pSet->nCap ? pSet->nCap * 2 : 8;
+        ReRange* pNew = (ReRange*)realloc(pSet->pRanges, nCap * sizeof(ReRange));
+        if (!pNew) return 0;
+        pSet->pRanges = pNew;
+        pSet->nCap = nCap;
+    }
+    pSet->pRanges[pSet->nCount].nLo = nLo;
+    pSet->pRanges[pSet->nCount].nHi = nHi;
+    pSet->nCount++;
+    return 1;
+}
+
+static int CompareRanges(const void* pA, const void* pB) {
+    const ReRange* a = (const ReRange*)pA;
+    const ReRange* b = (const ReRange*)pB;
+    return a->nLo < b->nLo ? -1 : a->nLo > b->nLo;
+}
+
+/* Sort and merge overlapping or touching ranges */
+static void SetNormalize(ReSet* pSet) {
+    size_t nOut = 0;
+
+    if (pSet->nCount < 2) return;
+    qsort(pSet->pRanges, pSet->nCount, sizeof(ReRange), CompareRanges);
+    for (size_t i = 1; i < pSet->nCount; i++) {
+        ReRange* pLast = &pSet->pRanges[nOut];
+        if (pSet->pRanges[i].nLo <= pLast->nHi + 1) {
+            if (pSet->pRanges[i].nHi > pLast->nHi) pLast->nHi = pSet->pRanges[i].nHi;
+        } else {
+            pSet->pRanges[++nOut] = pSet->pRanges[i];
+        }
+    }
+    pSet->nCount = nOut + 1;
+}
+
+static int SetContains(const ReSet* pSet, uint32_t c) {
+    size_t nLo = 0, nHi = pSet->nCount;
+
+    /* Normalized sets are sorted */
+    while (nLo < nHi) {
+        size_t nMid = (nLo + nHi) / 2;
+        if (c < pSet->pRanges[nMid].nLo) nHi = nMid;
+        else if (c > pSet->pRanges[nMid].nHi) nLo = nMid + 1;
+        else return 1;
+    }
+    return 0;
+}
+
+static int SetNegate(ReSet* pSet) {
+    ReSet out = {0};
+    uint32_t nNext = 0;
+
+    SetNormalize(pSet);
+    for (size_t i = 0; i < pSet->nCount; i++) {
+        if (pSet->pRanges[i].nLo > nNext && !SetAdd(&out, nNext, pSet->pRanges[i].nLo - 1)) goto fail;
+        nNext = pSet->pRanges[i].nHi + 1;
+    }
+    if (nNext <= RE_MAX_CP && !SetAdd(&out, nNext, RE_MAX_CP)) goto fail;
+    free(pSet->pRanges);
+    *pSet = out;
+    return 1;
+
+fail:
+    free(out.pRanges);
+    return 0;
+}
+
+/* Add every character that folds like one already in the set (folding only moves code points below 0x500) */
+static int SetFold(ReSet* pSet) {
+    uint8_t folded[0x500];
+    size_t nCount = pSet->nCount;
+
+    memset(folded, 0, sizeof(folded));
+    for (size_t i = 0; i < nCount; i++) {
+        for (uint32_t c = pSet->pRanges[i].nLo; c <= pSet->pRanges[i].nHi && c < 0x500; c++) {
+            folded[TextSearchFold((TextUnit)c)] = 1;
+        }
+    }
+    for (uint32_t c = 0; c < 0x500; c++) {
+        if (folded[TextSearchFold((TextUnit)c)] && !SetAdd(pSet, c, c)) return 0;
+    }
+    SetNormalize(pSet);
+    return 1;
+}
+
+/* \d \w \s, or their negations when bNegate */
+static int SetAddShorthand(ReSet* pSet, TextUnit cClass, int bNegate) {
+    static const uint32_t digits[] = {'0', '9'};
+    static const uint32_t words[] = {'0', '9', 'A', 'Z', '_', '_', 'a', 'z', 0xC0, 0xD6, 0xD8, 0xF6,
+                                     0xF8, 0x1FFF, 0x2070, 0x2FFF, 0x3001, RE_MAX_CP};
+    static const uint32_t spaces[] = {0x09, 0x0D, 0x20, 0x20, 0x85, 0x85, 0xA0, 0xA0, 0x1680, 0x1680,
+                                      0x2000, 0x200A, 0x2028, 0x2029, 0x202F, 0x202F, 0x205F, 0x205F,
+                                      0x3000, 0x3000};
+    const uint32_t* pPairs = cClass == 'd' ? digits : cClass == 'w' ? words : spaces;
+    size_t nPairs = cClass == 'd' ? sizeof(digits) / sizeof(digits[0]) / 2
+                  : cClass == 'w' ? sizeof(words) / sizeof(words[0]) / 2
+                  : sizeof(spaces) / sizeof(spaces[0]) / 2;
+    ReSet tmp = {0};
+    int bOk = 1;
+
+    for (size_t i = 0; i < nPairs && bOk; i++) bOk = SetAdd(&tmp, pPairs[2 * i], pPairs[2 * i + 1]);
+    if (bOk && bNegate) bOk = SetNegate(&tmp);
+    for (size_t i = 0; i < tmp.nCount && bOk; i++) bOk = SetAdd(pSet, tmp.pRanges[i].nLo, tmp.pRanges[i].nHi);
+    free(tmp.pRanges);
+    return bOk;
+}
+
+/* ---- Parser ---- */
+
+enum { RE_NODE_EMPTY, RE_NODE_SET, RE_NODE_CAT, RE_NODE_ALT, RE_NODE_REPEAT, RE_NODE_ASSERT };
+
+#define RE_NO_LITERAL 0xFFFFFFFFu
+
+typedef struct {
+    int nType;
+    int nLeft, nRight;           /* CAT and ALT operands; a REPEAT's operand is nLeft */
+    int nMin, nMax;              /* REPEAT bounds (nMax < 0: unbounded) */
+    int bLazy;
+    int nSet;                    /* SET: index of its character set */
+    uint32_t nLiteral;           /* SET written as one character (RE_NO_LITERAL otherwise) */
+    int nAssert;                 /* ASSERT: RE_ASSERT_ */
+} ReNode;
+
+typedef struct {
+    const TextUnit* pPattern;
+    size_t nLen, nPos;
+    int bFold;                   /* Case-insensitive */
+    ReNode* pNodes;
+    size_t nNodes, nNodeCap;
+    ReSet* pSets;
+    size_t nSets, nSetCap;
+    int nDepth;
+    const char* szError;
+} ReParser;
+
+static int Fail(ReParser* p, const char* szError) {
+    if (!p->szError) p->szError = szError;
+    return -1;
+}
+
+static int NewNode(ReParser* p, int nType) {
+    ReNode* pNode;
+
+    if (p->nNodes == p->nNodeCap) {
+        size_t nCap = p->nNodeCap ? p->nNodeCap * 2 : 64;
+        ReNode* pNew = (ReNode*)realloc(p->pNodes, nCap * sizeof(ReNode));
+        if (!pNew) return Fail(p, "Out of memory");
+        p->pNodes = pNew;
+        p->nNodeCap = nCap;
+    }
+    pNode = &p->pNodes[p->nNodes];
+    memset(pNode, 0, sizeof(*pNode));
+    pNode->nType = nType;
+    pNode->nLiteral = RE_NO_LITERAL;
+    return (int)p->nNodes++;
+}
+
+static int NewPair(ReParser* p, int nType, int nLeft, int nRight) {
+    int nNode = NewNode(p, nType);
+    if (nNode < 0) return -1;
+    p->pNodes[nNode].nLeft = nLeft;
+    p->pNodes[nNode].nRight = nRight;
+    return nNode;
+}
+
+static int NewAssert(ReParser* p, int nAssert) {
+    int nNode = NewNode(p, RE_NODE_ASSERT);
+    if (nNode < 0) return -1;
+    p->pNodes[nNode].nAssert = nAssert;
+    return nNode;
+}
+
+static int NewSet(ReParser* p) {
+    if (p->nSets == p->nSetCap) {
+        size_t nCap = p->nSetCap ? p->nSetCap * 2 : 16;
+        ReSet* pNew = (ReSet*)realloc(p->pSets, nCap * sizeof(ReSet));
+        if (!pNew) return Fail(p, "Out of memory");
+        p->pSets = pNew;
+        p->nSetCap = nCap;
+    }
+    memset(&p->pSets[p->nSets], 0, sizeof(ReSet));
+    return (int)p->nSets++;
+}
+
+/* A SET node over the finished set nSet (folded first when case-insensitive, then negated if asked) */
+static int NewSetNode(ReParser* p, int nSet, int bNegate, uint32_t nLiteral) {
+    ReSet* pSet = &p->pSets[nSet];
+    int nNode;
+
+    SetNormalize(pSet);
+    if (p->bFold && !SetFold(pSet)) return Fail(p, "Out of memory");
+    if (bNegate && !SetNegate(pSet)) return Fail(p, "Out of memory");
+    nNode = NewNode(p, RE_NODE_SET);
+    if (nNode < 0) return -1;
+    p->pNodes[nNode].nSet = nSet;
+    p->pNodes[nNode].nLiteral = nLiteral;
+    return nNode;
+}
+
+static int NewLiteral(ReParser* p, uint32_t c) {
+    int nSet = NewSet(p);
+    if (nSet < 0) return -1;
+    if (!SetAdd(&p->pSets[nSet], c, c)) return Fail(p, "Out of memory");
+    return NewSetNode(p, nSet, 0, c);
+}
+
+/* Next pattern character, joining surrogate pairs */
+static uint32_t NextChar(ReParser* p) {
+    uint32_t c = p->pPattern[p->nPos++];
+
+    if (c >= 0xD800 && c <= 0xDBFF && p->nPos < p->nLen &&
+        p->pPattern[p->nPos] >= 0xDC00 && p->pPattern[p->nPos] <= 0xDFFF) {
+        c = 0x10000 + ((c - 0xD800) << 10) + (p->pPattern[p->nPos++] - 0xDC00);
+    }
+    return c;
+}
+
+static int HexValue(TextUnit c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/* Escape results */
+#define RE_ESCAPE_CHAR   1
+#define RE_ESCAPE_CLASS  2
+#define RE_ESCAPE_ASSERT 3
+
+/*
+ * Parse the escape after a backslash: a character (*pnChar), a shorthand
+ * class (added to pSet) or, outside classes, an assertion (*pnAssert).
+ */
+static int ParseEscape(ReParser* p, int bInClass, ReSet* pSet, uint32_t* pnChar, int* pnAssert) {
+    TextUnit c;
+
+    if (p->nPos >= p->nLen) return Fail(p, "Trailing backslash");
+    c = p->pPattern[p->nPos++];
+
+    switch (c) {
+        case 'd': case 'w': case 's':
+            return SetAddShorthand(pSet, c, 0) ? RE_ESCAPE_CLASS : Fail(p, "Out of memory");
+        case 'D': case 'W': case 'S':
+            return SetAddShorthand(pSet, (TextUnit)(c + 32), 1) ? RE_ESCAPE_CLASS : Fail(p, "Out of memory");
+        case 'b':
+            if (bInClass) {
+                *pnChar = 0x08;
+                return RE_ESCAPE_CHAR;
+            }
+            *pnAssert = RE_ASSERT_WORD;
+            return RE_ESCAPE_ASSERT;
+        case 'B':
+            if (bInClass) return Fail(p, "\\B is not allowed in a class");
+            *pnAssert = RE_ASSERT_NOT_WORD;
+            return RE_ESCAPE_ASSERT;
+        case 't': *pnChar = '\t'; return RE_ESCAPE_CHAR;
+        case 'n': *pnChar = '\n'; return RE_ESCAPE_CHAR;
+        case 'r': *pnChar = '\r'; return RE_ESCAPE_CHAR;
+        case 'f': *pnChar = '\f'; return RE_ESCAPE_CHAR;
+        case 'v': *pnChar = '\v'; return RE_ESCAPE_CHAR;
+        case '0': *pnChar = 0; return RE_ESCAPE_CHAR;
+        case 'x': case 'u': {
+            int nDigits = c == 'x' ? 2 : 4;
+            uint32_t nValue = 0;
+            for (int i = 0; i < nDigits; i++) {
+                int h = p->nPos < p->nLen ? HexValue(p->pPattern[p->nPos]) : -1;
+                if (h < 0) return Fail(p, c == 'x' ? "\\x needs two hex digits" : "\\u needs four hex digits");
+                nValue = nValue * 16 + (uint32_t)h;
+                p->nPos++;
+            }
+            *pnChar = nValue;
+            return RE_ESCAPE_CHAR;
+        }
+    }
+
+    /* Anything else that is not a letter or digit stands for itself */
+    if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')) {
+        return Fail(p, "Unknown escape");
+    }
+    p->nPos--;
+    *pnChar = NextChar(p);
+    return RE_ESCAPE_CHAR;
+}
+
+/* [...] */
+static int ParseClass(ReParser* p) {
+    int bNegate = 0, bFirst = 1;
+    int nSet;
+
+    p->nPos++;
+    if (p->nPos < p->nLen && p->pPattern[p->nPos] == '^') {
+        bNegate = 1;
+        p->nPos++;
+    }
+    nSet = NewSet(p);
+    if (nSet < 0) return -1;
+
+    for (;;) {
+        uint32_t nLo, nHi;
+        int nAssert;
+
+        if (p->nPos >= p->nLen) return Fail(p, "Missing ]");
+        if (p->pPattern[p->nPos] == ']' && !bFirst) {
+            p->nPos++;
+            break;
+        }
+        bFirst = 0;
+
+        if (p->pPattern[p->nPos] == '\\') {
+            int r;
+            p->nPos++;
+            r = ParseEscape(p, 1, &p->pSets[nSet], &nLo, &nAssert);
+            if (r < 0) return -1;
+            if (r == RE_ESCAPE_CLASS) continue;
+        } else {
+            nLo = NextChar(p);
+        }
+
+        nHi = nLo;
+        if (p->nPos + 1 < p->nLen && p->pPattern[p->nPos] == '-' && p->pPattern[p->nPos + 1] != ']') {
+            p->nPos++;
+            if (p->pPattern[p->nPos] == '\\') {
+                p->nPos++;
+                if (ParseEscape(p, 1, &p->pSets[nSet], &nHi, &nAssert) != RE_ESCAPE_CHAR) {
+                    return Fail(p, "Invalid range in class");
+                }
+            } else {
+                nHi = NextChar(p);
+            }
+            if (nHi < nLo) return Fail(p, "Invalid range in class");
+        }
+        if (!SetAdd(&p->pSets[nSet], nLo, nHi)) return Fail(p, "Out of memory");
+    }
+    return NewSetNode(p, nSet, bNegate, RE_NO_LITERAL);
+}
+
+static int ParseAlternation(ReParser* p);
+
+static int ParseAtom(ReParser* p) {
+    TextUnit c = p->pPattern[p->nPos];
+
+    switch (c) {
+        case '(': {
+            int nNode;
+            if (++p->nDepth > RE_MAX_DEPTH) return Fail(p, "Groups nest too deeply");
+            p->nPos++;
+            if (p->nPos < p->nLen && p->pPattern[p->nPos] == '?') {
+                if (p->nPos + 1 >= p->nLen || p->pPattern[p->nPos + 1] != ':') {
+                    return Fail(p, "Unsupported group");
+                }
+                p->nPos += 2;
+            }
+            nNode = ParseAlternation(p);
+            if (nNode < 0) return -1;
+            if (p->nPos >= p->nLen || p->pPattern[p->nPos] != ')') return Fail(p, "Missing )");
+            p->nPos++;
+            p->nDepth--;
+            return nNode;
+        }
+        case '[':
+            return ParseClass(p);
+        case '.': {
+            int nSet = NewSet(p);
+            p->nPos++;
+            if (nSet < 0) return -1;
+            if (!SetAdd(&p->pSets[nSet], '\n', '\n') || !SetAdd(&p->pSets[nSet], '\r', '\r')) {
+                return Fail(p, "Out of memory");
+            }
+            SetNormalize(&p->pSets[nSet]);
+            if (!SetNegate(&p->pSets[nSet])) return Fail(p, "Out of memory");
+            return NewSetNode(p, nSet, 0, RE_NO_LITERAL);
+        }
+        case '^':
+            p->nPos++;
+            return NewAssert(p, RE_ASSERT_BOL);
+        case '$':
+            p->nPos++;
+            return NewAssert(p, RE_ASSERT_EOL);
+        case '*': case '+': case '?':
+            return Fail(p, "Nothing to repeat");
+        case '\\': {
+            uint32_t nChar = 0;
+            int nAssert = 0, nSet, r;
+            p->nPos++;
+            nSet = NewSet(p);
+            if (nSet < 0) return -1;
+            r = ParseEscape(p, 0, &p->pSets[nSet], &nChar, &nAssert);
+            if (r < 0) return -1;
+            if (r == RE_ESCAPE_ASSERT) return NewAssert(p, nAssert);
+            if (r == RE_ESCAPE_CLASS) return NewSetNode(p, nSet, 0, RE_NO_LITERAL);
+            if (!SetAdd(&p->pSets[nSet], nChar, nChar)) return Fail(p, "Out of memory");
+            return NewSetNode(p, nSet, 0, nChar);
+        }
+    }
+    return NewLiteral(p, NextChar(p));
+}
+
+/* {n}, {n,} or {n,m}: 1 if parsed, 0 if the brace is a plain character */
+static int ParseBounds(ReParser* p, int* pnMin, int* pnMax) {
+    size_t nPos = p->nPos + 1;
+    long nMin = 0, nMax;
+    int bDigits = 0;
+
+    while (nPos < p->nLen && p->pPattern[nPos] >= '0' && p->pPattern[nPos] <= '9') {
+        if (nMin <= REGEX_MAX_REPEAT) nMin = nMin * 10 + (p->pPattern[nPos] - '0');
+        nPos++;
+        bDigits = 1;
+    }
+    if (!bDigits || nPos >= p->nLen) return 0;
+    nMax = nMin;
+    if (p->pPattern[nPos] == ',') {
+        nPos++;
+        nMax = -1;
+        if (nPos < p->nLen && p->pPattern[nPos] >= '0' && p->pPattern[nPos] <= '9') {
+            nMax = 0;
+            while (nPos < p->nLen && p->pPattern[nPos] >= '0' && p->pPattern[nPos] <= '9') {
+                if (nMax <= REGEX_MAX_REPEAT) nMax = nMax * 10 + (p->pPattern[nPos] - '0');
+                nPos++;
+            }
+        }
+    }
+    if (nPos >= p->nLen || p->pPattern[nPos] != '}') return 0;
+    if (nMin > REGEX_MAX_REPEAT || nMax > REGEX_MAX_REPEAT) return Fail(p, "Repeat count is too large");
+    if (nMax >= 0 && nMax < nMin) return Fail(p, "Repeat bounds are out of order");
+    p->nPos = nPos + 1;
+    *pnMin = (int)nMin;
+    *pnMax = (int)nMax;
+    return 1;
+}
+
+static int ParseRepeat(ReParser* p) {
+    int nNode = ParseAtom(p);
+    int bRepeated = 0;
+
+    while (nNode >= 0 && p->nPos < p->nLen) {
+        TextUnit c = p->pPattern[p->nPos];
+        int nMin, nMax, nRepeat;
+
+        if (c == '*' || c == '+' || c == '?') {
+            nMin = c == '+' ? 1 : 0;
+            nMax = c == '?' ? 1 : -1;
+            p->nPos++;
+        } else if (c == '{') {
+            int r = ParseBounds(p, &nMin, &nMax);
+            if (r < 0) return -1;
+            if (r == 0) break;
+        } else {
+            break;
+        }
+        if (bRepeated) return Fail(p, "Nested quantifier");
+        bRepeated = 1;
+
+        nRepeat = NewNode(p, RE_NODE_REPEAT);
+        if (nRepeat < 0) return -1;
+        p->pNodes[nRepeat].nLeft = nNode;
+        p->pNodes[nRepeat].nMin = nMin;
+        p->pNodes[nRepeat].nMax = nMax;
+        if (p->nPos < p->nLen && p->pPattern[p->nPos] == '?') {
+            p->pNodes[nRepeat].bLazy = 1;
+            p->nPos++;
+        }
+        nNode = nRepeat;
+    }
+    return nNode;
+}
+
+static int ParseConcatenation(ReParser* p) {
+    int nNode = -1;
+
+    while (p->nPos < p->nLen && p->pPattern[p->nPos] != '|' && p->pPattern[p->nPos] != ')') {
+        int nNext = ParseRepeat(p);
+        if (nNext < 0) return -1;
+        nNode = nNode < 0 ? nNext : NewPair(p, RE_NODE_CAT, nNode, nNext);
+        if (nNode < 0) return -1;
+    }
+    return nNode < 0 ? NewNode(p, RE_NODE_EMPTY) : nNode;
+}
+
+static int ParseAlternation(ReParser* p) {
+    int nNode = ParseConcatenation(p);
+
+    while (nNode >= 0 && p->nPos < p->nLen && p->pPattern[p->nPos] == '|') {
+        int nRight;
+        p->nPos++;
+        nRight = ParseConcatenation(p);
+        if (nRight < 0) return -1;
+        nNode = NewPair(p, RE_NODE_ALT, nNode, nRight);
+    }
+    return nNode;
+}
+
+static void FreeParser(ReParser* p) {
+    for (size_t i = 0; i < p->nSets; i++) free(p->pSets[i].pRanges);
+    free(p->pSets);
+    free(p->pNodes);
+}
+
+/* Append the literal characters every match of a node starts with; returns whether the node is all literal */
+static int CollectPrefix(const ReParser* p, int nNode, uint32_t* pChars, size_t* pnChars) {
+    const ReNode* pNode = &p->pNodes[nNode];
+
+    switch (pNode->nType) {
+        case RE_NODE_EMPTY:
+        case RE_NODE_ASSERT:
+            return 1;
+        case RE_NODE_SET:
+            if (pNode->nLiteral == RE_NO_LITERAL || *pnChars == RE_MAX_PREFIX) return 0;
+            pChars[(*pnChars)++] = pNode->nLiteral;
+            return 1;
+        case RE_NODE_CAT:
+            return CollectPrefix(p, pNode->nLeft, pChars, pnChars) &&
+                   CollectPrefix(p, pNode->nRight, pChars, pnChars);
+    }
+    return 0;
+}
+
+/* ---- Programs ---- */
+
+enum { RE_OP_SET, RE_OP_SPLIT, RE_OP_ASSERT, RE_OP_MATCH };
+
+typedef struct {
+    int32_t nOp;
+    int32_t nNext;               /* Following instruction (the preferred branch of a SPLIT) */
+    int32_t nArg;                /* SPLIT: the other branch; SET: symbol set; ASSERT: RE_ASSERT_ */
+} ReInst;
+
+typedef struct {
+    ReInst* pInsts;
+    int32_t nInsts, nCap;
+    int32_t nStart;
+} ReProg;
+
+/* Thread on the closure stack */
+typedef struct {
+    int32_t nPc;
+    size_t nStart;
+} ReThread;
+
+/* DFA state flags the scan loops stop for */
+#define RE_STATE_MATCH 0x01      /* A match ends (starts, in reverse) before the last symbol */
+#define RE_STATE_DEAD  0x02      /* Nothing can match from here on */
+#define RE_STATE_IDLE  0x04      /* No match in progress (only marked when a prefix filter is used) */
+
+/* DFA state key: the kind of the last symbol (low bits) and these */
+#define RE_KEY_KIND     0x07
+#define RE_KEY_NO_START 0x08     /* No new matches may start */
+#define RE_KEY_MATCH    0x10
+
+typedef struct {
+    int nWidth;                  /* Classes, then one end-of-text pseudo-class per kind */
+    int32_t nStates, nStateCap;
+    int32_t* pTrans;             /* nStateCap rows of nWidth transitions (see EncodeTransition) */
+    uint8_t* pFlags;
+    uint8_t* pKey;
+    int32_t* pKernelAt;          /* Each state's threads (instructions in priority order) */
+    int32_t* pKernelLen;
+    int32_t* pPcs;
+    size_t nPcs, nPcsCap;
+    int32_t* pHash;              /* Open addressing over state indices */
+    size_t nHashMask;
+    int bIdleStops;              /* Mark idle states */
+    unsigned nFlushes;           /* Cache clears in the current search */
+} ReDfa;
+
+struct RegexTarget {
+    int bBytes;                  /* Symbols are bytes (otherwise UTF-16 units) */
+    int bLatin1;                 /* Bytes are Latin-1 (otherwise UTF-8) */
+    ReProg fwd;
+    ReProg rev;                  /* The pattern read right to left */
+    ReSet* pSymSets;             /* Symbol ranges of the SET instructions */
+    size_t nSymSets, nSymSetCap;
+    uint16_t* pClassMap;         /* Symbol to class */
+    uint8_t* pClassKind;         /* Kind of each class and pseudo-class */
+    int nClasses;
+    uint32_t* pSetBits;          /* For each symbol set, the classes in it */
+    int nSetWords;
+    ReDfa* pDfa[2];              /* Forward and reverse, built on first use */
+    uint32_t* pMark;             /* Closure scratch */
+    uint32_t* pOutMark;
+    uint32_t nGen;
+    ReThread* pStack;
+    int32_t* pKernelIn;
+    int32_t* pKernelOut;
+    size_t* pStartsIn;
+    size_t* pStartsOut;
+};
+
+/* ---- Compiler ---- */
+
+/* Symbol ranges a character set becomes in one encoding: up to four steps */
+typedef struct {
+    int nLen;
+    uint32_t lo[4], hi[4];
+} ReSeq;
+
+typedef struct {
+    ReSeq* pSeqs;
+    size_t nCount, nCap;
+} ReSeqList;
+
+typedef struct {
+    const ReParser* pParser;
+    RegexTarget* pTarget;
+    ReProg* pProg;
+    int bReverse;
+    const char* szError;
+} ReCompiler;
+
+static int AddSeq(ReSeqList* pList, int nLen, const uint32_t* pLo, const uint32_t* pHi) {
+    if (pList->nCount == pList->nCap) {
+        size_t nCap = pList->nCap ? pList->nCap * 2 : 16;
+        ReSeq* pNew = (ReSeq*)realloc(pList->pSeqs, nCap * sizeof(ReSeq));
+        if (!pNew) return 0;
+        pList->pSeqs = pNew;
+        pList->nCap = nCap;
+    }
+    pList->pSeqs[pList->nCount].nLen = nLen;
+    for (int i = 0; i < nLen; i++) {
+        pList->pSeqs[pList->nCount].lo[i] = pLo[i];
+        pList->pSeqs[pList->nCount].hi[i] = pHi[i];
+    }
+    pList->nCount++;
+    return 1;
+}
+
+static int EncodeUtf8(uint32_t c, uint32_t* pOut) {
+    if (c < 0x80) {
+        pOut[0] = c;
+        return 1;
+    }
+    if (c < 0x800) {
+        pOut[0] = 0xC0 | (c >> 6);
+        pOut[1] = 0x80 | (c & 0x3F);
+        return 2;
+    }
+    if (c < 0x10000) {
+        pOut[0] = 0xE0 | (c >> 12);
+        pOut[1] = 0x80 | ((c >> 6) & 0x3F);
+        pOut[2] = 0x80 | (c & 0x3F);
+        return 3;
+    }
+    pOut[0] = 0xF0 | (c >> 18);
+    pOut[1] = 0x80 | ((c >> 12) & 0x3F);
+    pOut[2] = 0x80 | ((c >> 6) & 0x3F);
+    pOut[3] = 0x80 | (c & 0x3F);
+    return 4;
+}
+
+/* Code points [nLo, nHi] as UTF-8 byte range sequences (surrogates have no encoding) */
+static int SplitUtf8(ReSeqList* pList, uint32_t nLo, uint32_t nHi) {
+    static const uint32_t lengthEnds[] = {0x7F, 0x7FF, 0xFFFF};
+    uint32_t lo[4], hi[4];
+    int nLen;
+
+    if (nLo <= 0xDFFF && nHi >= 0xD800) {
+        if (nLo < 0xD800 && !SplitUtf8(pList, nLo, 0xD7FF)) return 0;
+        return nHi > 0xDFFF ? SplitUtf8(pList, 0xE000, nHi) : 1;
+    }
+
+    /* One encoded length at a time */
+    for (int i = 0; i < 3; i++) {
+        if (nLo <= lengthEnds[i] && nHi > lengthEnds[i]) {
+            return SplitUtf8(pList, nLo, lengthEnds[i]) && SplitUtf8(pList, lengthEnds[i] + 1, nHi);
+        }
+    }
+
+    /* Then until every continuation byte spans a whole range or only varies at the end */
+    for (int i = 1; i < 4; i++) {
+        uint32_t m = (1u << (6 * i)) - 1;
+        if ((nLo & ~m) != (nHi & ~m)) {
+            if ((nLo & m) != 0) {
+                return SplitUtf8(pList, nLo, nLo | m) && SplitUtf8(pList, (nLo | m) + 1, nHi);
+            }
+            if ((nHi & m) != m) {
+                return SplitUtf8(pList, nLo, (nHi & ~m) - 1) && SplitUtf8(pList, nHi & ~m, nHi);
+            }
+        }
+    }
+
+    nLen = EncodeUtf8(nLo, lo);
+    EncodeUtf8(nHi, hi);
+    return AddSeq(pList, nLen, lo, hi);
+}
+
+/* Supplementary code points [nLo, nHi] as surrogate pair sequences */
+static int SplitUtf16(ReSeqList* pList, uint32_t nLo, uint32_t nHi) {
+    uint32_t nHighLo = 0xD800 + ((nLo - 0x10000) >> 10), nLowLo = 0xDC00 + ((nLo - 0x10000) & 0x3FF);
+    uint32_t nHighHi = 0xD800 + ((nHi - 0x10000) >> 10), nLowHi = 0xDC00 + ((nHi - 0x10000) & 0x3FF);
+    uint32_t lo[2], hi[2];
+
+    if (nHighLo == nHighHi) {
+        lo[0] = hi[0] = nHighLo;
+        lo[1] = nLowLo;
+        hi[1] = nLowHi;
+        return AddSeq(pList, 2, lo, hi);
+    }
+    lo[0] = hi[0] = nHighLo;
+    lo[1] = nLowLo;
+    hi[1] = 0xDFFF;
+    if (!AddSeq(pList, 2, lo, hi)) return 0;
+    if (nHighHi - nHighLo > 1) {
+        lo[0] = nHighLo + 1;
+        hi[0] = nHighHi - 1;
+        lo[1] = 0xDC00;
+        hi[1] = 0xDFFF;
+        if (!AddSeq(pList, 2, lo, hi)) return 0;
+    }
+    lo[0] = hi[0] = nHighHi;
+    lo[1] = 0xDC00;
+    hi[1] = nLowHi;
+    return AddSeq(pList, 2, lo, hi);
+}
+
+/* A character set in the target's encoding */
+static int LowerSet(const RegexTarget* t, const ReSet* pSet, ReSeqList* pList) {
+    for (size_t i = 0; i < pSet->nCount; i++) {
+        uint32_t nLo = pSet->pRanges[i].nLo, nHi = pSet->pRanges[i].nHi;
+
+        if (t->bBytes && !t->bLatin1) {
+            if (!SplitUtf8(pList, nLo, nHi)) return 0;
+            continue;
+        }
+        if (t->bBytes) {
+            uint32_t nByteHi = nHi > 0xFF ? 0xFF : nHi;
+            if (nLo <= 0xFF && !AddSeq(pList, 1, &nLo, &nByteHi)) return 0;
+            continue;
+        }
+        /* Surrogates only match as pairs, as in the UTF-8 program */
+        for (int k = 0; k < 2; k++) {
+            uint32_t nPartLo = k ? 0xE000 : 0, nPartHi = k ? 0xFFFF : 0xD7FF;
+            if (nPartLo < nLo) nPartLo = nLo;
+            if (nPartHi > nHi) nPartHi = nHi;
+            if (nPartLo <= nPartHi && !AddSeq(pList, 1, &nPartLo, &nPartHi)) return 0;
+        }
+        if (nHi >= 0x10000 && !SplitUtf16(pList, nLo > 0x10000 ? nLo : 0x10000, nHi)) return 0;
+    }
+    return 1;
+}
+
+/* Index of a symbol set, shared with an equal one already used */
+static int AddSymSet(ReCompiler* c, ReSet* pSet) {
+    RegexTarget* t = c->pTarget;
+
+    SetNormalize(pSet);
+    for (size_t i = 0; i < t->nSymSets; i++) {
+        if (t->pSymSets[i].nCount == pSet->nCount && pSet->nCount &&
+            memcmp(t->pSymSets[i].pRanges, pSet->pRanges, pSet->nCount * sizeof(ReRange)) == 0) {
+            free(pSet->pRanges);
+            return (int)i;
+        }
+        if (t->pSymSets[i].nCount == 0 && pSet->nCount == 0) return (int)i;
+    }
+    if (t->nSymSets == t->nSymSetCap) {
+        size_t nCap = t->nSymSetCap ? t->nSymSetCap * 2 : 16;
+        ReSet* pNew = (ReSet*)realloc(t->pSymSets, nCap * sizeof(ReSet));
+        if (!pNew) {
+            free(pSet->pRanges);
+            c->szError = "Out of memory";
+            return -1;
+        }
+        t->pSymSets = pNew;
+        t->nSymSetCap = nCap;
+    }
+    t->pSymSets[t->nSymSets] = *pSet;
+    return (int)t->nSymSets++;
+}
+
+static int32_t Emit(ReCompiler* c, int nOp, int32_t nNext, int32_t nArg) {
+    ReProg* g = c->pProg;
+
+    if (c->szError) return -1;
+    if (g->nInsts >= REGEX_MAX_INSTS) {
+        c->szError = "Pattern is too large";
+        return -1;
+    }
+    if (g->nInsts == g->nCap) {
+        int32_t nCap = g->nCap ? g->nCap * 2 : 64;
+        ReInst* pNew = (ReInst*)realloc(g->pInsts, (size_t)nCap * sizeof(ReInst));
+        if (!pNew) {
+            c->szError = "Out of memory";
+            return -1;
+        }
+        g->pInsts = pNew;
+        g->nCap = nCap;
+    }
+    g->pInsts[g->nInsts].nOp = nOp;
+    g->pInsts[g->nInsts].nNext = nNext;
+    g->pInsts[g->nInsts].nArg = nArg;
+    return g->nInsts++;
+}
+
+static int32_t EmitSymbols(ReCompiler* c, uint32_t nLo, uint32_t nHi, int32_t nNext) {
+    ReSet set = {0};
+    int nSym;
+
+    if (!SetAdd(&set, nLo, nHi)) {
+        c->szError = "Out of memory";
+        return -1;
+    }
+    nSym = AddSymSet(c, &set);
+    return nSym < 0 ? -1 : Emit(c, RE_OP_SET, nNext, nSym);
+}
+
+/* Instructions matching one character of a set, continuing at nNext */
+static int32_t EmitSet(ReCompiler* c, const ReSet* pSet, int32_t nNext) {
+    ReSeqList seqs = {0};
+    ReSet single = {0};
+    int32_t* pEntries;
+    size_t nEntries = 0;
+    int32_t nEntry = -1;
+
+    if (!LowerSet(c->pTarget, pSet, &seqs) || !(pEntries = (int32_t*)malloc((seqs.nCount + 1) * sizeof(int32_t)))) {
+        free(seqs.pSeqs);
+        c->szError = "Out of memory";
+        return -1;
+    }
+
+    /* One-symbol characters share an instruction; longer ones get a chain each */
+    for (size_t i = 0; i < seqs.nCount; i++) {
+        if (seqs.pSeqs[i].nLen == 1 && !SetAdd(&single, seqs.pSeqs[i].lo[0], seqs.pSeqs[i].hi[0])) {
+            c->szError = "Out of memory";
+        }
+    }
+    if (single.nCount || seqs.nCount == 0) {
+        int nSym = AddSymSet(c, &single);
+        pEntries[nEntries++] = nSym < 0 ? -1 : Emit(c, RE_OP_SET, nNext, nSym);
+    } else {
+        free(single.pRanges);
+    }
+    for (size_t i = 0; i < seqs.nCount; i++) {
+        const ReSeq* pSeq = &seqs.pSeqs[i];
+        int32_t nPc = nNext;
+        if (pSeq->nLen == 1) continue;
+        for (int k = 0; k < pSeq->nLen; k++) {
+            int j = c->bReverse ? k : pSeq->nLen - 1 - k;
+            nPc = EmitSymbols(c, pSeq->lo[j], pSeq->hi[j], nPc);
+        }
+        pEntries[nEntries++] = nPc;
+    }
+
+    nEntry = pEntries[nEntries - 1];
+    for (size_t i = nEntries - 1; i > 0; i--) {
+        nEntry = Emit(c, RE_OP_SPLIT, pEntries[i - 1], nEntry);
+    }
+    free(pEntries);
+    free(seqs.pSeqs);
+    return nEntry;
+}
+
+/* Instructions for a node, continuing at nNext; returns the entry */
+static int32_t CompileNode(ReCompiler* c, int nNode, int32_t nNext) {
+    const ReNode* pNode = &c->pParser->pNodes[nNode];
+
+    if (c->szError) return -1;
+    switch (pNode->nType) {
+        case RE_NODE_EMPTY:
+            return nNext;
+        case RE_NODE_SET:
+            return EmitSet(c, &c->pParser->pSets[pNode->nSet], nNext);
+        case RE_NODE_ASSERT:
+            return Emit(c, RE_OP_ASSERT, nNext, pNode->nAssert);
+        case RE_NODE_CAT:
+            if (c->bReverse) return CompileNode(c, pNode->nRight, CompileNode(c, pNode->nLeft, nNext));
+            return CompileNode(c, pNode->nLeft, CompileNode(c, pNode->nRight, nNext));
+        case RE_NODE_ALT: {
+            int32_t nLeft = CompileNode(c, pNode->nLeft, nNext);
+            int32_t nRight = CompileNode(c, pNode->nRight, nNext);
+            return Emit(c, RE_OP_SPLIT, nLeft, nRight);
+        }
+        case RE_NODE_REPEAT: {
+            int32_t nTail = nNext;
+            int nCopies = pNode->nMin;
+
+            if (pNode->nMax < 0) {
+                /* A loop: x* is the loop itself; x{n,} is n - 1 copies and then x+ */
+                int32_t nLoop = Emit(c, RE_OP_SPLIT, -1, -1);
+                int32_t nBody = CompileNode(c, pNode->nLeft, nLoop);
+                if (c->szError) return -1;
+                c->pProg->pInsts[nLoop].nNext = pNode->bLazy ? nNext : nBody;
+                c->pProg->pInsts[nLoop].nArg = pNode->bLazy ? nBody : nNext;
+                nTail = nCopies > 0 ? nBody : nLoop;
+                if (nCopies > 0) nCopies--;
+            } else {
+                /* Optional copies nest: x{0,2} is (x(x)?)? */
+                for (int i = pNode->nMin; i < pNode->nMax; i++) {
+                    int32_t nBody = CompileNode(c, pNode->nLeft, nTail);
+                    nTail = pNode->bLazy ? Emit(c, RE_OP_SPLIT, nTail, nBody) : Emit(c, RE_OP_SPLIT, nBody, nTail);
+                }
+            }
+            while (nCopies-- > 0) nTail = CompileNode(c, pNode->nLeft, nTail);
+            return nTail;
+        }
+    }
+    return -1;
+}
+
+static int SymbolKind(const RegexTarget* t, uint32_t s) {
+    if (s == '\r') return RE_KIND_CR;
+    if (s == '\n') return RE_KIND_LF;
+    if (t->bBytes && !t->bLatin1 && s >= 0x80) return s < 0xC0 ? RE_KIND_TRAIL : RE_KIND_WORD;
+    if (!t->bBytes && s >= 0xDC00 && s <= 0xDFFF) return RE_KIND_TRAIL;
+    return TextSearchIsWordUnit((TextUnit)s) ? RE_KIND_WORD : RE_KIND_OTHER;
+}
+
+/*
+ * Split the symbols into classes: symbols in exactly the same symbol sets
+ * and of the same kind are interchangeable, so DFA rows need one column
+ * per class instead of one per symbol.
+ */
+static int BuildClasses(RegexTarget* t) {
+    const size_t nDomain = t->bBytes ? 256 : 65536;
+    const int nWords = (int)((t->nSymSets + 31) / 32);
+    uint8_t* pCut = (uint8_t*)calloc(nDomain + 1, 1);
+    uint32_t* pSigs = NULL;
+    uint32_t* pReps = NULL;
+    uint32_t* pSig = (uint32_t*)malloc(((size_t)nWords + 1) * sizeof(uint32_t));
+    size_t nClassCap = 0;
+    int bOk = 0;
+
+    t->pClassMap = (uint16_t*)malloc(nDomain * sizeof(uint16_t));
+    if (!pCut || !pSig || !t->pClassMap) goto done;
+
+    /* Runs of symbols that no set boundary or kind change splits */
+    pCut[0] = 1;
+    for (size_t i = 0; i < t->nSymSets; i++) {
+        for (size_t j = 0; j < t->pSymSets[i].nCount; j++) {
+            pCut[t->pSymSets[i].pRanges[j].nLo] = 1;
+            if (t->pSymSets[i].pRanges[j].nHi + 1 < nDomain) pCut[t->pSymSets[i].pRanges[j].nHi + 1] = 1;
+        }
+    }
+    for (size_t s = 1; s < nDomain; s++) {
+        if (SymbolKind(t, (uint32_t)s) != SymbolKind(t, (uint32_t)(s - 1))) pCut[s] = 1;
+    }
+
+    /* Runs with the same signature (kind and set membership) share a class */
+    t->nClasses = 0;
+    for (size_t s = 0; s < nDomain;) {
+        size_t nEnd = s + 1;
+        int nClass = -1;
+
+        while (nEnd < nDomain && !pCut[nEnd]) nEnd++;
+        memset(pSig, 0, ((size_t)nWords + 1) * sizeof(uint32_t));
+        pSig[0] = (uint32_t)SymbolKind(t, (uint32_t)s);
+        for (size_t i = 0; i < t->nSymSets; i++) {
+            if (SetContains(&t->pSymSets[i], (uint32_t)s)) pSig[1 + i / 32] |= 1u << (i % 32);
+        }
+        for (int k = 0; k < t->nClasses; k++) {
+            if (memcmp(pSigs + (size_t)k * (nWords + 1), pSig, ((size_t)nWords + 1) * sizeof(uint32_t)) == 0) {
+                nClass = k;
+                break;
+            }
+        }
+        if (nClass < 0) {
+            if ((size_t)t->nClasses == nClassCap) {
+                size_t nCap = nClassCap ? nClassCap * 2 : 32;
+                uint32_t* pNewSigs = (uint32_t*)realloc(pSigs, nCap * ((size_t)nWords + 1) * sizeof(uint32_t));
+                uint32_t* pNewReps;
+                if (!pNewSigs) goto done;
+                pSigs = pNewSigs;
+                pNewReps = (uint32_t*)realloc(pReps, nCap * sizeof(uint32_t));
+                if (!pNewReps) goto done;
+                pReps = pNewReps;
+                nClassCap = nCap;
+            }
+            nClass = t->nClasses++;
+            memcpy(pSigs + (size_t)nClass * (nWords + 1), pSig, ((size_t)nWords + 1) * sizeof(uint32_t));
+            pReps[nClass] = (uint32_t)s;
+        }
+        for (size_t i = s; i < nEnd; i++) t->pClassMap[i] = (uint16_t)nClass;
+        s = nEnd;
+    }
+
+    /* Class kinds, then the end-of-text pseudo-classes */
+    t->nSetWords = (t->nClasses + RE_KINDS + 31) / 32;
+    t->pClassKind = (uint8_t*)malloc((size_t)t->nClasses + RE_KINDS);
+    t->pSetBits = (uint32_t*)calloc(t->nSymSets ? t->nSymSets : 1, (size_t)t->nSetWords * sizeof(uint32_t));
+    if (!t->pClassKind || !t->pSetBits) goto done;
+    for (int k = 0; k < t->nClasses; k++) {
+        t->pClassKind[k] = (uint8_t)pSigs[(size_t)k * (nWords + 1)];
+        for (size_t i = 0; i < t->nSymSets; i++) {
+            if (SetContains(&t->pSymSets[i], pReps[k])) {
+                t->pSetBits[i * t->nSetWords + k / 32] |= 1u << (k % 32);
+            }
+        }
+    }
+    for (int k = 0; k < RE_KINDS; k++) t->pClassKind[t->nClasses + k] = (uint8_t)k;
+    bOk = 1;
+
+done:
+    free(pCut);
+    free(pSigs);
+    free(pReps);
+    free(pSig);
+    return bOk;
+}
+
+static void FreeDfa(ReDfa* d) {
+    if (!d) return;
+    free(d->pTrans);
+    free(d->pFlags);
+    free(d->pKey);
+    free(d->pKernelAt);
+    free(d->pKernelLen);
+    free(d->pPcs);
+    free(d->pHash);
+    free(d);
+}
+
+static void FreeTarget(RegexTarget* t) {
+    if (!t) return;
+    free(t->fwd.pInsts);
+    free(t->rev.pInsts);
+    for (size_t i = 0; i < t->nSymSets; i++) free(t->pSymSets[i].pRanges);
+    free(t->pSymSets);
+    free(t->pClassMap);
+    free(t->pClassKind);
+    free(t->pSetBits);
+    FreeDfa(t->pDfa[0]);
+    FreeDfa(t->pDfa[1]);
+    free(t->pMark);
+    free(t->pOutMark);
+    free(t->pStack);
+    free(t->pKernelIn);
+    free(t->pKernelOut);
+    free(t->pStartsIn);
+    free(t->pStartsOut);
+    free(t);
+}
+
+/* Compile the parsed pattern for one encoding, in both directions */
+static RegexTarget* BuildTarget(const ReParser* p, int nRoot, int bBytes, int bLatin1, const char** pszError) {
+    RegexTarget* t = (RegexTarget*)calloc(1, sizeof(RegexTarget));
+    ReCompiler c;
+    size_t nInsts;
+
+    if (!t) {
+        *pszError = "Out of memory";
+        return NULL;
+    }
+    t->bBytes = bBytes;
+    t->bLatin1 = bLatin1;
+
+    memset(&c, 0, sizeof(c));
+    c.pParser = p;
+    c.pTarget = t;
+    for (int bReverse = 0; bReverse < 2; bReverse++) {
+        ReProg* g = bReverse ? &t->rev : &t->fwd;
+        c.pProg = g;
+        c.bReverse = bReverse;
+        g->nStart = CompileNode(&c, nRoot, Emit(&c, RE_OP_MATCH, -1, 0));
+    }
+    if (c.szError) {
+        *pszError = c.szError;
+        FreeTarget(t);
+        return NULL;
+    }
+
+    nInsts = (size_t)(t->fwd.nInsts > t->rev.nInsts ? t->fwd.nInsts : t->rev.nInsts);
+    t->pMark = (uint32_t*)calloc(nInsts, sizeof(uint32_t));
+    t->pOutMark = (uint32_t*)calloc(nInsts, sizeof(uint32_t));
+    t->pStack = (ReThread*)malloc((2 * nInsts + 2) * sizeof(ReThread));
+    t->pKernelIn = (int32_t*)malloc(nInsts * sizeof(int32_t));
+    t->pKernelOut = (int32_t*)malloc(nInsts * sizeof(int32_t));
+    t->pStartsIn = (size_t*)malloc(nInsts * sizeof(size_t));
+    t->pStartsOut = (size_t*)malloc(nInsts * sizeof(size_t));
+    if (!t->pMark || !t->pOutMark || !t->pStack || !t->pKernelIn || !t->pKernelOut ||
+        !t->pStartsIn || !t->pStartsOut || !BuildClasses(t)) {
+        *pszError = "Out of memory";
+        FreeTarget(t);
+        return NULL;
+    }
+    return t;
+}
+
+/* ---- Stepping threads ---- */
+
+static uint32_t NextGeneration(RegexTarget* t) {
+    if (++t->nGen == 0) {
+        size_t nInsts = (size_t)(t->fwd.nInsts > t->rev.nInsts ? t->fwd.nInsts : t->rev.nInsts);
+        memset(t->pMark, 0, nInsts * sizeof(uint32_t));
+        memset(t->pOutMark, 0, nInsts * sizeof(uint32_t));
+        t->nGen = 1;
+    }
+    return t->nGen;
+}
+
+/*
+ * Advance a list of threads over one symbol of class nClass. The threads
+ * (and a new one at the start of the program if bInject) are followed
+ * through splits and assertions in priority order, then those whose set
+ * holds the symbol move into pOut. Returns whether a thread reached MATCH
+ * first; with bCut, lower priority threads are then dropped (leftmost
+ * first). Starts are tracked when pStarts is given.
+ */
+static int StepThreads(RegexTarget* t, const ReProg* g, const int32_t* pKernel, const size_t* pStarts, int nKernel,
+                       int bInject, size_t nInjectStart, int nLeft, int nRight, int nClass, int bCut,
+                       int32_t* pOut, size_t* pOutStarts, int* pnOut, size_t* pnMatchStart) {
+    const uint32_t nGen = NextGeneration(t);
+    const int bSymbol = nClass < t->nClasses;
+    ReThread* pStack = t->pStack;
+    int nOut = 0, bMatch = 0;
+
+    for (int k = 0; k <= nKernel; k++) {
+        int nTop = 0;
+
+        if (k < nKernel) {
+            pStack[0].nPc = pKernel[k];
+            pStack[0].nStart = pStarts ? pStarts[k] : 0;
+        } else if (bInject) {
+            pStack[0].nPc = g->nStart;
+            pStack[0].nStart = nInjectStart;
+        } else {
+            break;
+        }
+        nTop = 1;
+
+        while (nTop > 0) {
+            ReThread th = pStack[--nTop];
+
+            for (;;) {
+                const ReInst* pInst;
+                if (t->pMark[th.nPc] == nGen) break;
+                t->pMark[th.nPc] = nGen;
+                pInst = &g->pInsts[th.nPc];
+
+                if (pInst->nOp == RE_OP_SPLIT) {
+                    pStack[nTop].nPc = pInst->nArg;
+                    pStack[nTop].nStart = th.nStart;
+                    nTop++;
+                    th.nPc = pInst->nNext;
+                    continue;
+                }
+                if (pInst->nOp == RE_OP_ASSERT) {
+                    if (!AssertHolds(pInst->nArg, nLeft, nRight)) break;
+                    th.nPc = pInst->nNext;
+                    continue;
+                }
+                if (pInst->nOp == RE_OP_SET) {
+                    if (bSymbol && (t->pSetBits[(size_t)pInst->nArg * t->nSetWords + nClass / 32] >> (nClass % 32) & 1) &&
+                        t->pOutMark[pInst->nNext] != nGen) {
+                        t->pOutMark[pInst->nNext] = nGen;
+                        pOut[nOut] = pInst->nNext;
+                        if (pOutStarts) pOutStarts[nOut] = th.nStart;
+                        nOut++;
+                    }
+                    break;
+                }
+
+                /* MATCH */
+                if (!bMatch) {
+                    bMatch = 1;
+                    if (pnMatchStart) *pnMatchStart = th.nStart;
+                }
+                if (bCut) goto done;
+                break;
+            }
+        }
+    }
+
+done:
+    *pnOut = nOut;
+    return bMatch;
+}
+
+/* ---- Lazy DFA ---- */
+
+/* Transition not computed yet */
+#define RE_TRANS_UNKNOWN INT32_MIN
+
+static ReDfa* CreateDfa(const RegexTarget* t, size_t nBudget, int bIdleStops) {
+    ReDfa* d = (ReDfa*)calloc(1, sizeof(ReDfa));
+    size_t nInsts = (size_t)(t->fwd.nInsts > t->rev.nInsts ? t->fwd.nInsts : t->rev.nInsts);
+    size_t nPerState, nCap, nHash = 16;
+
+    if (!d) return NULL;
+    d->nWidth = t->nClasses + RE_KINDS;
+    d->bIdleStops = bIdleStops;
+
+    /* Half the budget for transition rows, half for the states' thread lists */
+    nPerState = (size_t)d->nWidth * sizeof(int32_t) + 2 + 2 * sizeof(int32_t) + 2 * sizeof(int32_t);
+    nCap = nBudget / 2 / nPerState;
+    if (nCap < 8) nCap = 8;
+    if (nCap > 0x7FFFFFF) nCap = 0x7FFFFFF;
+    d->nStateCap = (int32_t)nCap;
+    d->nPcsCap = nBudget / 2 / sizeof(int32_t);
+    if (d->nPcsCap < 4 * nInsts + 16) d->nPcsCap = 4 * nInsts + 16;
+    while (nHash < 2 * nCap) nHash *= 2;
+    d->nHashMask = nHash - 1;
+
+    d->pTrans = (int32_t*)malloc(nCap * (size_t)d->nWidth * sizeof(int32_t));
+    d->pFlags = (uint8_t*)malloc(nCap);
+    d->pKey = (uint8_t*)malloc(nCap);
+    d->pKernelAt = (int32_t*)malloc(nCap * sizeof(int32_t));
+    d->pKernelLen = (int32_t*)malloc(nCap * sizeof(int32_t));
+    d->pPcs = (int32_t*)malloc(d->nPcsCap * sizeof(int32_t));
+    d->pHash = (int32_t*)malloc(nHash * sizeof(int32_t));
+    if (!d->pTrans || !d->pFlags || !d->pKey || !d->pKernelAt || !d->pKernelLen || !d->pPcs || !d->pHash) {
+        FreeDfa(d);
+        return NULL;
+    }
+    memset(d->pHash, 0xFF, nHash * sizeof(int32_t));
+    return d;
+}
+
+static ReDfa* GetDfa(RegexSearch* pRe, RegexTarget* t, int bReverse, int bIdleStops) {
+    if (!t->pDfa[bReverse]) t->pDfa[bReverse] = CreateDfa(t, pRe->nCacheBytes, bIdleStops);
+    return t->pDfa[bReverse];
+}
+
+static size_t HashState(int nKey, const int32_t* pPcs, int n) {
+    uint32_t h = 2166136261u ^ (uint32_t)nKey;
+    for (int i = 0; i < n; i++) h = (h ^ (uint32_t)pPcs[i]) * 16777619u;
+    return h;
+}
+
+static void FlushDfa(ReDfa* d) {
+    d->nStates = 0;
+    d->nPcs = 0;
+    memset(d->pHash, 0xFF, (d->nHashMask + 1) * sizeof(int32_t));
+}
+
+/*
+ * The state with this key and thread list, added if new. When the cache
+ * is full it is cleared first (pPcs must not point into it); once that has
+ * happened too often in one search, returns RE_FALLBACK.
+ */
+static int32_t GetState(RegexSearch* pRe, ReDfa* d, int nKey, const int32_t* pPcs, int n) {
+    size_t h = HashState(nKey, pPcs, n) & d->nHashMask;
+    int32_t s;
+
+    while ((s = d->pHash[h]) >= 0) {
+        if (d->pKey[s] == nKey && d->pKernelLen[s] == n &&
+            (n == 0 || memcmp(d->pPcs + d->pKernelAt[s], pPcs, (size_t)n * sizeof(int32_t)) == 0)) {
+            return s;
+        }
+        h = (h + 1) & d->nHashMask;
+    }
+
+    if (d->nStates == d->nStateCap || d->nPcs + (size_t)n > d->nPcsCap) {
+        FlushDfa(d);
+        pRe->stats.nFlushes++;
+        if (++d->nFlushes > REGEX_DFA_MAX_FLUSHES) return RE_FALLBACK;
+        h = HashState(nKey, pPcs, n) & d->nHashMask;
+    }
+
+    s = d->nStates++;
+    for (int c = 0; c < d->nWidth; c++) d->pTrans[(size_t)s * d->nWidth + c] = RE_TRANS_UNKNOWN;
+    d->pKey[s] = (uint8_t)nKey;
+    d->pKernelAt[s] = (int32_t)d->nPcs;
+    d->pKernelLen[s] = n;
+    if (n) memcpy(d->pPcs + d->nPcs, pPcs, (size_t)n * sizeof(int32_t));
+    d->nPcs += (size_t)n;
+    d->pFlags[s] = 0;
+    if (nKey & RE_KEY_MATCH) d->pFlags[s] |= RE_STATE_MATCH;
+    if (n == 0 && (nKey & RE_KEY_NO_START)) d->pFlags[s] |= RE_STATE_DEAD;
+    if (n == 0 && !(nKey & (RE_KEY_NO_START | RE_KEY_MATCH)) && d->bIdleStops) d->pFlags[s] |= RE_STATE_IDLE;
+    d->pHash[h] = s;
+    pRe->stats.nStates++;
+    return s;
+}
+
+/*
+ * Transitions hold the next state's row offset, so the scan loops follow
+ * them with one load and no multiply; those to states the loops have to
+ * stop for are stored as -1 - state instead.
+ */
+static int32_t EncodeTransition(const ReDfa* d, int32_t s) {
+    return d->pFlags[s] ? -1 - s : s * d->nWidth;
+}
+
+static int32_t DecodeTransition(const ReDfa* d, int32_t nEntry) {
+    return nEntry < 0 ? -1 - nEntry : nEntry / d->nWidth;
+}
+
+/* Compute the transition of state s on class nClass (caching it unless the cache was cleared) */
+static int32_t Transition(RegexSearch* pRe, RegexTarget* t, ReDfa* d, int bReverse, int32_t s, int nClass) {
+    const ReProg* g = bReverse ? &t->rev : &t->fwd;
+    int nKernel = d->pKernelLen[s];
+    int nKey = d->pKey[s];
+    int nKind = t->pClassKind[nClass];
+    int nLast = nKey & RE_KEY_KIND;
+    unsigned nFlushes = d->nFlushes;
+    int nOut, bMatch, nNewKey;
+    int32_t nNext;
+
+    memcpy(t->pKernelIn, d->pPcs + d->pKernelAt[s], (size_t)nKernel * sizeof(int32_t));
+    bMatch = StepThreads(t, g, t->pKernelIn, NULL, nKernel, !(nKey & RE_KEY_NO_START), 0,
+                         bReverse ? nKind : nLast, bReverse ? nLast : nKind, nClass, !bReverse,
+                         t->pKernelOut, NULL, &nOut, NULL);
+
+    nNewKey = nKind | (nKey & RE_KEY_NO_START);
+    if (bMatch) nNewKey |= RE_KEY_MATCH | (bReverse ? 0 : RE_KEY_NO_START);
+    nNext = GetState(pRe, d, nNewKey, t->pKernelOut, nOut);
+    if (nNext >= 0 && d->nFlushes == nFlushes) {
+        d->pTrans[(size_t)s * d->nWidth + nClass] = EncodeTransition(d, nNext);
+    }
+    return nNext;
+}
+
+/* The same state with no new matches allowed to start */
+static int32_t NoStartState(RegexSearch* pRe, RegexTarget* t, ReDfa* d, int32_t s) {
+    int n = d->pKernelLen[s];
+    memcpy(t->pKernelIn, d->pPcs + d->pKernelAt[s], (size_t)n * sizeof(int32_t));
+    return GetState(pRe, d, d->pKey[s] | RE_KEY_NO_START, t->pKernelIn, n);
+}
+
+/* ---- Input ---- */
+
+typedef struct {
+    const PieceTable* pDoc;      /* A document, or */
+    const void* pText;           /* a buffer of units or bytes */
+    size_t nLen;
+} ReInput;
+
+/* Symbols from nPos on that are contiguous in memory (at least one) */
+static const void* InputSpan(const ReInput* pIn, int bBytes, size_t nPos, size_t* pnSpan) {
+    if (pIn->pDoc) return PieceTableSpanAt(pIn->pDoc, nPos, pnSpan);
+    *pnSpan = pIn->nLen - nPos;
+    return bBytes ? (const void*)((const uint8_t*)pIn->pText + nPos)
+                  : (const void*)((const TextUnit*)pIn->pText + nPos);
+}
+
+static uint32_t InputSymbol(const ReInput* pIn, int bBytes, size_t nPos) {
+    size_t nSpan;
+    const void* p = InputSpan(pIn, bBytes, nPos, &nSpan);
+    if (!p) return 0;
+    return bBytes ? *(const uint8_t*)p : *(const TextUnit*)p;
+}
+
+/* Kind of the symbol before nPos, and of the one at nPos */
+static int KindBefore(const RegexTarget* t, const ReInput* pIn, size_t nPos) {
+    if (nPos == 0) return RE_KIND_EDGE;
+    return t->pClassKind[t->pClassMap[InputSymbol(pIn, t->bBytes, nPos - 1)]];
+}
+
+static int KindAt(const RegexTarget* t, const ReInput* pIn, size_t nPos) {
+    if (nPos >= pIn->nLen) return RE_KIND_EDGE;
+    return t->pClassKind[t->pClassMap[InputSymbol(pIn, t->bBytes, nPos)]];
+}
+
+/* The nearest prefix occurrence starting in [nPos, nTo) */
+static int FindPrefix(const RegexTarget* t, TextSearch* pPrefix, const ReInput* pIn,
+                      size_t nPos, size_t nTo, size_t* pnAt) {
+    if (pIn->pDoc) return TextSearchDocument(pPrefix, pIn->pDoc, nPos, nTo, pnAt);
+    if (t->bBytes) return TextSearchBytes(pPrefix, (const uint8_t*)pIn->pText, pIn->nLen, nPos, nTo, pnAt);
+    return TextSearchUnits(pPrefix, (const TextUnit*)pIn->pText, pIn->nLen, nPos, nTo, pnAt);
+}
+
+/* ---- Scans ---- */
+
+/*
+ * Forward pass: where the leftmost-first match starting in [nFrom, nTo)
+ * ends. Returns 1 with *pnEnd set, 0 if there is none, or RE_FALLBACK.
+ */
+static int ScanForward(RegexSearch* pRe, RegexTarget* t, TextSearch* pPrefix, const ReInput* pIn,
+                       size_t nFrom, size_t nTo, size_t* pnEnd) {
+    ReDfa* d = GetDfa(pRe, t, 0, pPrefix != NULL);
+    const uint16_t* pMap = t->pClassMap;
+    size_t i = nFrom, nNoSkip = (size_t)-1;
+    int bFound = 0;
+    int32_t s;
+
+    if (!d) return RE_FALLBACK;
+    d->nFlushes = 0;
+    s = GetState(pRe, d, KindBefore(t, pIn, nFrom), NULL, 0);
+    if (s < 0) return RE_FALLBACK;
+
+    while (i < pIn->nLen) {
+        const void* pSpan;
+        size_t nSpan, nLimit, j = 0, n;
+
+        if (!(d->pKey[s] & RE_KEY_NO_START)) {
+            /* Past the last allowed start only the matches in progress continue */
+            if (i >= nTo) {
+                s = NoStartState(pRe, t, d, s);
+                if (s < 0) return RE_FALLBACK;
+                if (d->pFlags[s] & RE_STATE_DEAD) return bFound;
+                continue;
+            }
+
+            /* Nothing in progress: skip to where the literal prefix occurs */
+            if ((d->pFlags[s] & RE_STATE_IDLE) && i != nNoSkip) {
+                size_t nAt;
+                if (!FindPrefix(t, pPrefix, pIn, i, nTo, &nAt)) return 0;
+                nNoSkip = nAt;
+                if (nAt != i) {
+                    i = nAt;
+                    s = GetState(pRe, d, KindBefore(t, pIn, i), NULL, 0);
+                    if (s < 0) return RE_FALLBACK;
+                }
+                continue;
+            }
+        }
+
+        pSpan = InputSpan(pIn, t->bBytes, i, &nSpan);
+        if (!pSpan) break;
+        nLimit = i + nSpan;
+        if (!(d->pKey[s] & RE_KEY_NO_START) && nTo < nLimit) nLimit = nTo;
+        n = nLimit - i;
+
+        /* Follow known transitions until a state needs a look */
+        {
+            const int32_t* pTrans = d->pTrans;
+            int32_t nRow = s * d->nWidth;
+            if (t->bBytes) {
+                const uint8_t* p = (const uint8_t*)pSpan;
+                while (j < n) {
+                    int32_t nEntry = pTrans[nRow + pMap[p[j]]];
+                    if (nEntry < 0) break;
+                    nRow = nEntry;
+                    j++;
+                }
+            } else {
+                const TextUnit* p = (const TextUnit*)pSpan;
+                while (j < n) {
+                    int32_t nEntry = pTrans[nRow + pMap[p[j]]];
+                    if (nEntry < 0) break;
+                    nRow = nEntry;
+                    j++;
+                }
+            }
+            s = nRow / d->nWidth;
+        }
+        i += j;
+        if (j == n) continue;
+
+        /* One symbol the slow way */
+        {
+            uint32_t nSym = t->bBytes ? ((const uint8_t*)pSpan)[j] : ((const TextUnit*)pSpan)[j];
+            int nClass = pMap[nSym];
+            int32_t nEntry = d->pTrans[(size_t)s * d->nWidth + nClass];
+            int32_t nNext = nEntry == RE_TRANS_UNKNOWN ? Transition(pRe, t, d, 0, s, nClass)
+                                                       : DecodeTransition(d, nEntry);
+            if (nNext < 0) return RE_FALLBACK;
+            s = nNext;
+            if (d->pFlags[s] & RE_STATE_MATCH) {
+                bFound = 1;
+                *pnEnd = i;
+            }
+            i++;
+            if (d->pFlags[s] & RE_STATE_DEAD) return bFound;
+        }
+    }
+
+    /* End of the text */
+    if (!(d->pKey[s] & RE_KEY_NO_START) && pIn->nLen >= nTo) {
+        s = NoStartState(pRe, t, d, s);
+        if (s < 0) return RE_FALLBACK;
+    }
+    s = Transition(pRe, t, d, 0, s, t->nClasses + RE_KIND_EDGE);
+    if (s < 0) return RE_FALLBACK;
+    if (d->pFlags[s] & RE_STATE_MATCH) {
+        bFound = 1;
+        *pnEnd = pIn->nLen;
+    }
+    return bFound;
+}
+
+/* Symbols [*pnStart, nPos) for reading backwards, no further back than nLo */
+static const void* InputSpanBefore(RegexSearch* pRe, const RegexTarget* t, const ReInput* pIn,
+                                   size_t nLo, size_t nPos, size_t* pnStart) {
+    if (pIn->pDoc) {
+        size_t n = nPos - nLo > RE_CHUNK ? RE_CHUNK : nPos - nLo;
+        *pnStart = nPos - n;
+        PieceTableCopy(pIn->pDoc, nPos - n, pRe->pChunk, n);
+        return pRe->pChunk;
+    }
+    *pnStart = nLo;
+    return t->bBytes ? (const void*)((const uint8_t*)pIn->pText + nLo)
+                     : (const void*)((const TextUnit*)pIn->pText + nLo);
+}
+
+/*
+ * Reverse pass: the earliest start, no earlier than nLo, of a match that
+ * ends at nEnd. Returns 1 with *pnStart set, 0 or RE_FALLBACK.
+ */
+static int ScanReverse(RegexSearch* pRe, RegexTarget* t, const ReInput* pIn,
+                       size_t nLo, size_t nEnd, size_t* pnStart) {
+    ReDfa* d = GetDfa(pRe, t, 1, 0);
+    const uint16_t* pMap = t->pClassMap;
+    int32_t nPc = t->rev.nStart;
+    size_t i = nEnd;
+    int bFound = 0;
+    int32_t s;
+
+    if (!d) return RE_FALLBACK;
+    d->nFlushes = 0;
+    s = GetState(pRe, d, KindAt(t, pIn, nEnd) | RE_KEY_NO_START, &nPc, 1);
+    if (s < 0) return RE_FALLBACK;
+
+    while (i > nLo) {
+        size_t nBase;
+        const void* pSpan = InputSpanBefore(pRe, t, pIn, nLo, i, &nBase);
+        const int32_t* pTrans = d->pTrans;
+        int32_t nRow = s * d->nWidth;
+
+        while (i > nBase) {
+            uint32_t nSym = t->bBytes ? ((const uint8_t*)pSpan)[i - 1 - nBase]
+                                      : ((const TextUnit*)pSpan)[i - 1 - nBase];
+            int32_t nEntry = pTrans[nRow + pMap[nSym]];
+
+            if (nEntry < 0) {
+                int32_t nNext = nEntry == RE_TRANS_UNKNOWN ? Transition(pRe, t, d, 1, nRow / d->nWidth, pMap[nSym])
+                                                           : DecodeTransition(d, nEntry);
+                if (nNext < 0) return RE_FALLBACK;
+                if (d->pFlags[nNext] & RE_STATE_MATCH) {
+                    bFound = 1;
+                    *pnStart = i;
+                }
+                if (d->pFlags[nNext] & RE_STATE_DEAD) return bFound;
+                nEntry = nNext * d->nWidth;
+            }
+            nRow = nEntry;
+            i--;
+        }
+        s = nRow / d->nWidth;
+    }
+
+    /* The left end of the range */
+    s = Transition(pRe, t, d, 1, s, t->nClasses + KindBefore(t, pIn, nLo));
+    if (s < 0) return RE_FALLBACK;
+    if (d->pFlags[s] & RE_STATE_MATCH) {
+        bFound = 1;
+        *pnStart = nLo;
+    }
+    return bFound;
+}
+
+/* NFA simulation with match starts, for when the DFA cache cannot keep up */
+static int ScanNfa(RegexSearch* pRe, RegexTarget* t, TextSearch* pPrefix, const ReInput* pIn,
+                   size_t nFrom, size_t nTo, size_t* pnStart, size_t* pnEnd) {
+    int32_t* pKernel = t->pKernelIn;
+    int32_t* pOut = t->pKernelOut;
+    size_t* pStarts = t->pStartsIn;
+    size_t* pOutStarts = t->pStartsOut;
+    const void* pSpan = NULL;
+    size_t nSpanAt = 0, nSpanLen = 0, nNoSkip = (size_t)-1;
+    size_t i = nFrom;
+    int nKernel = 0, bMatched = 0;
+    int nLeft = KindBefore(t, pIn, nFrom);
+
+    (void)pRe;
+    for (;;) {
+        int nClass, nOut;
+        size_t nMatchStart = 0;
+
+        if (nKernel == 0 && !bMatched) {
+            if (i >= nTo) return 0;
+            if (pPrefix && i != nNoSkip) {
+                size_t nAt;
+                if (!FindPrefix(t, pPrefix, pIn, i, nTo, &nAt)) return 0;
+                nNoSkip = nAt;
+                if (nAt != i) {
+                    i = nAt;
+                    nLeft = KindBefore(t, pIn, i);
+                }
+            }
+        }
+
+        if (i < pIn->nLen) {
+            if (!pSpan || i < nSpanAt || i >= nSpanAt + nSpanLen) {
+                pSpan = InputSpan(pIn, t->bBytes, i, &nSpanLen);
+                nSpanAt = i;
+                if (!pSpan) return bMatched;
+            }
+            nClass = t->pClassMap[t->bBytes ? ((const uint8_t*)pSpan)[i - nSpanAt]
+                                            : ((const TextUnit*)pSpan)[i - nSpanAt]];
+        } else {
+            nClass = t->nClasses + RE_KIND_EDGE;
+        }
+
+        if (StepThreads(t, &t->fwd, pKernel, pStarts, nKernel, !bMatched && i < nTo, i,
+                        nLeft, t->pClassKind[nClass], nClass, 1, pOut, pOutStarts, &nOut, &nMatchStart)) {
+            bMatched = 1;
+            *pnStart = nMatchStart;
+            *pnEnd = i;
+        }
+        {
+            int32_t* pSwap = pKernel;
+            size_t* pSwapStarts = pStarts;
+            pKernel = pOut;
+            pOut = pSwap;
+            pStarts = pOutStarts;
+            pOutStarts = pSwapStarts;
+        }
+        nKernel = nOut;
+        if (i >= pIn->nLen || (nKernel == 0 && bMatched)) break;
+        nLeft = t->pClassKind[nClass];
+        i++;
+    }
+    return bMatched;
+}
+
+/* First match starting in [nFrom, nTo) */
+static int Search(RegexSearch* pRe, RegexTarget* t, TextSearch* pPrefix, const ReInput* pIn,
+                  size_t nFrom, size_t nTo, size_t* pnMatch, size_t* pnMatchLen) {
+    size_t nStart = 0, nEnd = 0;
+    int r;
+
+    if (!t) return 0;
+    if (nTo > pIn->nLen + 1) nTo = pIn->nLen + 1;
+    if (nFrom >= nTo) return 0;
+
+    r = ScanForward(pRe, t, pPrefix, pIn, nFrom, nTo, &nEnd);
+    if (r == 0) return 0;
+    if (r > 0) r = ScanReverse(pRe, t, pIn, nFrom, nEnd, &nStart);
+    if (r <= 0) {
+        pRe->stats.nFallbacks++;
+        if (!ScanNfa(pRe, t, pPrefix, pIn, nFrom, nTo, &nStart, &nEnd)) return 0;
+    }
+    *pnMatch = nStart;
+    *pnMatchLen = nEnd - nStart;
+    return 1;
+}
+
+/* Last of the successive matches starting in [nFrom, nTo), looking at windows from the end */
+static int SearchLast(RegexSearch* pRe, RegexTarget* t, TextSearch* pPrefix, const ReInput* pIn,
+                      size_t nFrom, size_t nTo, size_t* pnMatch, size_t* pnMatchLen) {
+    size_t nHi = nTo > pIn->nLen + 1 ? pIn->nLen + 1 : nTo;
+
+    while (nHi > nFrom) {
+        size_t nLo = nHi - nFrom > TEXT_SEARCH_BACK_WINDOW ? nHi - TEXT_SEARCH_BACK_WINDOW : nFrom;
+        size_t nAt = nLo, nFound, nLen;
+        int bFound = 0;
+
+        while (nAt < nHi && Search(pRe, t, pPrefix, pIn, nAt, nHi, &nFound, &nLen)) {
+            *pnMatch = nFound;
+            *pnMatchLen = nLen;
+            bFound = 1;
+            nAt = nFound + (nLen ? nLen : 1);
+        }
+        if (bFound) return 1;
+        nHi = nLo;
+    }
+    return 0;
+}
+
+/* ---- Interface ---- */
+
+/* A prefix filter for one encoding, from the pattern's leading literal characters */
+static int BuildPrefix(TextSearch* pPrefix, const uint32_t* pChars, size_t nChars, unsigned nFlags, int bBytes) {
+    TextUnit units[RE_MAX_PREFIX];
+    const int bFold = !(nFlags & TEXT_SEARCH_MATCH_CASE);
+    const int bLatin1 = (nFlags & TEXT_SEARCH_LATIN1) != 0;
+    size_t n = 0;
+
+    /* Stop where the literal search would fold or encode differently from the program */
+    while (n < nChars) {
+        uint32_t c = pChars[n];
+        if (c > 0xFFFF || (c >= 0xD800 && c <= 0xDFFF)) break;
+        if (bBytes && bLatin1 && c > 0xFF) break;
+        if (bBytes && bFold && c >= 0x80) break;
+        units[n++] = (TextUnit)c;
+    }
+    if (n < RE_MIN_PREFIX) return 0;
+    if (!TextSearchInit(pPrefix, units, n, nFlags & (TEXT_SEARCH_MATCH_CASE | TEXT_SEARCH_LATIN1))) return 0;
+    if (bBytes && !pPrefix->pBytes) {
+        TextSearchFree(pPrefix);
+        return 0;
+    }
+    return 1;
+}
+
+int RegexSearchInit(RegexSearch* pRe, const TextUnit* pPattern, size_t nLen, unsigned nFlags,
+                    const char** pszError) {
+    ReParser parser;
+    const char* szError = NULL;
+    int nRoot;
+
+    memset(pRe, 0, sizeof(*pRe));
+    pRe->nFlags = nFlags;
+    pRe->nCacheBytes = REGEX_DFA_CACHE_BYTES;
+
+    memset(&parser, 0, sizeof(parser));
+    parser.pPattern = pPattern;
+    parser.nLen = nLen;
+    parser.bFold = !(nFlags & TEXT_SEARCH_MATCH_CASE);
+
+    nRoot = ParseAlternation(&parser);
+    if (nRoot >= 0 && parser.nPos < nLen) nRoot = Fail(&parser, "Unmatched )");
+
+    /* Whole word: nothing wordy may touch either end */
+    if (nRoot >= 0 && (nFlags & TEXT_SEARCH_WHOLE_WORD)) {
+        int nStart = NewAssert(&parser, RE_ASSERT_WORD_START);
+        int nEnd = NewAssert(&parser, RE_ASSERT_WORD_END);
+        if (nStart >= 0 && nEnd >= 0) nRoot = NewPair(&parser, RE_NODE_CAT, nStart, nRoot);
+        if (nRoot >= 0 && nEnd >= 0) nRoot = NewPair(&parser, RE_NODE_CAT, nRoot, nEnd);
+        else nRoot = -1;
+    }
+
+    if (nRoot >= 0) {
+        int nStart = NewAssert(&parser, RE_ASSERT_CHAR_START);
+        nRoot = nStart < 0 ? -1 : NewPair(&parser, RE_NODE_CAT, nStart, nRoot);
+    }
+
+    if (nRoot >= 0) {
+        uint32_t prefix[RE_MAX_PREFIX];
+        size_t nPrefix = 0;
+
+        pRe->pUnits = BuildTarget(&parser, nRoot, 0, 0, &szError);
+        if (pRe->pUnits) {
+            pRe->pBytes = BuildTarget(&parser, nRoot, 1, (nFlags & TEXT_SEARCH_LATIN1) != 0, &szError);
+        }
+        pRe->pChunk = (TextUnit*)malloc(RE_CHUNK * sizeof(TextUnit));
+        if (!pRe->pChunk && !szError) szError = "Out of memory";
+
+        CollectPrefix(&parser, nRoot, prefix, &nPrefix);
+        pRe->bPrefixUnits = BuildPrefix(&pRe->prefixUnits, prefix, nPrefix, nFlags, 0);
+        pRe->bPrefixBytes = BuildPrefix(&pRe->prefixBytes, prefix, nPrefix, nFlags, 1);
+    } else {
+        szError = parser.szError ? parser.szError : "Invalid pattern";
+    }
+    FreeParser(&parser);
+
+    if (szError || !pRe->pUnits || !pRe->pBytes) {
+        if (pszError) *pszError = szError ? szError : "Out of memory";
+        RegexSearchFree(pRe);
+        return 0;
+    }
+    return 1;
+}
+
+void RegexSearchFree(RegexSearch* pRe) {
+    FreeTarget(pRe->pUnits);
+    FreeTarget(pRe->pBytes);
+    if (pRe->bPrefixUnits) TextSearchFree(&pRe->prefixUnits);
+    if (pRe->bPrefixBytes) TextSearchFree(&pRe->prefixBytes);
+    free(pRe->pChunk);
+    memset(pRe, 0, sizeof(*pRe));
+}
+
+int RegexSearchUnits(RegexSearch* pRe, const TextUnit* pText, size_t nLen,
+                     size_t nFrom, size_t nTo, size_t* pnMatch, size_t* pnMatchLen) {
+    ReInput in = {NULL, pText, nLen};
+    return Search(pRe, pRe->pUnits, pRe->bPrefixUnits ? &pRe->prefixUnits : NULL, &in,
+                  nFrom, nTo, pnMatch, pnMatchLen);
+}
+
+int RegexSearchBytes(RegexSearch* pRe, const uint8_t* pText, size_t nLen,
+                     size_t nFrom, size_t nTo, size_t* pnMatch, size_t* pnMatchLen) {
+    ReInput in = {NULL, pText, nLen};
+    return Search(pRe, pRe->pBytes, pRe->bPrefixBytes ? &pRe->prefixBytes : NULL, &in,
+                  nFrom, nTo, pnMatch, pnMatchLen);
+}
+
+int RegexSearchDocument(RegexSearch* pRe, const PieceTable* pDoc,
+                        size_t nFrom, size_t nTo, size_t* pnMatch, size_t* pnMatchLen) {
+    ReInput in = {pDoc, NULL, PieceTableLength(pDoc)};
+    return Search(pRe, pRe->pUnits, pRe->bPrefixUnits ? &pRe->prefixUnits : NULL, &in,
+                  nFrom, nTo, pnMatch, pnMatchLen);
+}
+
+int RegexSearchBytesLast(RegexSearch* pRe, const uint8_t* pText, size_t nLen,
+                         size_t nFrom, size_t nTo, size_t* pnMatch, size_t* pnMatchLen) {
+    ReInput in = {NULL, pText, nLen};
+    return SearchLast(pRe, pRe->pBytes, pRe->bPrefixBytes ? &pRe->prefixBytes : NULL, &in,
+                      nFrom, nTo, pnMatch, pnMatchLen);
+}
+
+int RegexSearchDocumentLast(RegexSearch* pRe, const PieceTable* pDoc,
+                            size_t nFrom, size_t nTo, size_t* pnMatch, size_t* pnMatchLen) {
+    ReInput in = {pDoc, NULL, PieceTableLength(pDoc)};
+    return SearchLast(pRe, pRe->pUnits, pRe->bPrefixUnits ? &pRe->prefixUnits : NULL, &in,
+                      nFrom, nTo, pnMatch, pnMatchLen);
+}
@@ -0,0 +1,97 @@
+#ifndef REGEX_SEARCH_H
+#define REGEX_SEARCH_H
+
+/*
+ * Regular expression search.
+ *
+ * Portable C. A pattern is parsed and compiled to a Thompson NFA, once for
+ * UTF-16 units and once for bytes (UTF-8, or Latin-1 with
+ * TEXT_SEARCH_LATIN1), so documents and mapped files are both searched in
+ * their own encoding.
+ *
+ * Searching never backtracks. A forward DFA, built lazily from the NFA as
+ * the text is read, finds where the leftmost match ends; a reverse DFA of
+ * the reversed pattern then walks back from there to where it starts. Each
+ * DFA keeps its states in a cache of fixed size that is cleared when it
+ * fills up; a search that keeps overflowing it is finished by simulating
+ * the NFA instead. Every path is linear in the length of the text.
+ *
+ * When every match must begin with some literal text, the forward pass
+ * skips ahead with the TextSearch kernels whenever no match is in progress.
+ *
+ * Syntax: literals, . (any character but a line break), [...] and [^...]
+ * with ranges, \d \w \s \D \W \S, \t \n \r \f \v \xHH \uHHHH, escaped
+ * punctuation, ( ) (?: ) and |, the quantifiers * + ? {n} {n,} {n,m} and
+ * their lazy forms, ^ and $ (start and end of line, for LF, CRLF or CR
+ * line breaks) and \b \B. Matches are leftmost, preferring earlier
+ * alternatives and greedy repeats as Perl does (a repeated subpattern that
+ * can match empty text may pick a different match). Case-insensitive
+ * matching uses TextSearchFold. Matches never start inside a character.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "piece_table.h"
+#include "text_search.h"
+
+/* Memory for each lazily built DFA (a pattern has up to four: two directions, two encodings) */
+#define REGEX_DFA_CACHE_BYTES (1024 * 1024)
+
+/* Times a DFA cache may fill up in one search before the NFA takes over */
+#define REGEX_DFA_MAX_FLUSHES 8
+
+/* Largest count in {n,m}, and largest compiled program */
+#define REGEX_MAX_REPEAT 1000
+#define REGEX_MAX_INSTS 100000
+
+typedef struct RegexTarget RegexTarget;
+
+/* What the searches cost (cumulative) */
+typedef struct {
+    uint64_t nStates;            /* DFA states built */
+    uint64_t nFlushes;           /* Times a DFA cache was full and cleared */
+    uint64_t nFallbacks;         /* Searches finished by NFA simulation */
+} RegexStats;
+
+/* Compiled pattern */
+typedef struct {
+    unsigned nFlags;             /* TEXT_SEARCH_ flags */
+    size_t nCacheBytes;          /* DFA cache size (may be changed before the first search) */
+    RegexTarget* pUnits;         /* Program over UTF-16 units */
+    RegexTarget* pBytes;         /* Program over bytes */
+    TextSearch prefixUnits;      /* Literal every match starts with, if any */
+    TextSearch prefixBytes;
+    int bPrefixUnits;
+    int bPrefixBytes;
+    TextUnit* pChunk;            /* Document text read backwards */
+    RegexStats stats;
+} RegexSearch;
+
+/*
+ * Compile a pattern. nFlags are TEXT_SEARCH_ flags (whole word puts the
+ * match between non-word characters). Returns nonzero on success; on
+ * failure *pszError describes the problem.
+ */
+int RegexSearchInit(RegexSearch* pRe, const TextUnit* pPattern, size_t nLen, unsigned nFlags,
+                    const char** pszError);
+void RegexSearchFree(RegexSearch* pRe);
+
+/*
+ * First match starting in [nFrom, nTo) (it may run on past nTo). Reports
+ * its start and length, which may be zero. Searches use the pattern's
+ * caches, so one thread at a time.
+ */
+int RegexSearchUnits(RegexSearch* pRe, const TextUnit* pText, size_t nLen,
+                     size_t nFrom, size_t nTo, size_t* pnMatch, size_t* pnMatchLen);
+int RegexSearchBytes(RegexSearch* pRe, const uint8_t* pText, size_t nLen,
+                     size_t nFrom, size_t nTo, size_t* pnMatch, size_t* pnMatchLen);
+int RegexSearchDocument(RegexSearch* pRe, const PieceTable* pDoc,
+                        size_t nFrom, size_t nTo, size_t* pnMatch, size_t* pnMatchLen);
+
+/* Last of the successive matches starting in [nFrom, nTo) */
+int RegexSearchBytesLast(RegexSearch* pRe, const uint8_t* pText, size_t nLen,
+                         size_t nFrom, size_t nTo, size_t* pnMatch, size_t* pnMatchLen);
+int RegexSearchDocumentLast(RegexSearch* pRe, const PieceTable* pDoc,
+                            size_t nFrom, size_t nTo, size_t* pnMatch, size_t* pnMatchLen);
+
+#endif /* REGEX_SEARCH_H */
@@ -14,12 +14,20 @@
 #define IDM_EDIT_COPY       203
 #define IDM_EDIT_PASTE      204
 #define IDM_EDIT_SELECTALL  205
+#define IDM_EDIT_REDO       206
+#define IDM_EDIT_FIND       207
+#define IDM_EDIT_FINDNEXT   208
+#define IDM_EDIT_FINDPREV   209
+#define IDM_EDIT_REPLACE    210
+#define IDM_EDIT_REGEX      211
+#define IDM_EDIT_FINDINFILES 212
 
 /* Format menu command IDs */
 #define IDM_FORMAT_WORDWRAP 251
 
 /* View menu command IDs */
 #define IDM_VIEW_LINENUMBERS 261
+#define IDM_VIEW_HIBERNATE  262
 
 /* Help menu command IDs */
 #define IDM_HELP_ABOUT      301
@@ -52,14 +60,15 @@
 
 /* Status bar widths */
 #define SB_WIDTH_FILETYPE   120
-#define SB_WIDTH_LENGTH     100
+#define SB_WIDTH_LENGTH     170
 #define SB_WIDTH_LINES      80
 #define SB_WIDTH_POSITION   180
 #define SB_WIDTH_LINEENDING 100
-#define SB_WIDTH_ENCODING   70
+#define SB_WIDTH_ENCODING   80
 #define SB_WIDTH_INSERTMODE 50
 
 /* Timer IDs */
-#define TIMER_STATUSBAR     4
+#define TIMER_FRAME         4
+#define TIMER_HIBERNATE     5
 
 #endif /* RESOURCE_H */
@@ -0,0 +1,264 @@
+#include "notepad.h"
+#include "session_file.h"
+#include <shellapi.h>
+
+/*
+ * Session snapshot.
+ *
+ * The tabs showing files, with their caret and scroll positions, are kept
+ * in %LOCALAPPDATA%\XNote\session.xns (see session_file.h). A record is
+ * appended when a tab is left, loaded or saved under a new name, and when
+ * a frame finds the gutter or status bar dirty (the caret or view may have
+ * moved) and the current tab's position changed, so a crash loses little
+ * and an idle window writes nothing. At launch the file is mapped and
+ * read, and every tab comes back at once as a tab strip entry with no edit
+ * control and no text: a tab reads its file the first time it is shown,
+ * and only the active one is shown at startup. Tabs with unsaved changes
+ * also come back through crash recovery, which takes over the session's
+ * tab for the same file.
+ */
+
+/* Session file, in the application data folder */
+#define SESSION_FILE_NAME L"\\session.xns"
+
+static SessionWriter g_Session;
+static BOOL g_bSession = FALSE;
+static uint64_t g_nLastSessionId = 0;
+static uint32_t g_nOrderCrc = 0;
+
+/* Whether a tab is reopened next launch: it shows a file (results and untitled text are not) */
+static BOOL IsSessionTab(const TabState* pTab) {
+    return !pTab->bUntitled && !pTab->bFindResults && pTab->szFileName[0];
+}
+
+/* What the session file says about a tab (gives the tab an id on its first record) */
+static void DescribeTab(TabState* pTab, SessionTab* pSaved) {
+    TabPosition pos;
+
+    if (!pTab->nSessionId) pTab->nSessionId = ++g_nLastSessionId;
+    GetTabPosition(pTab, &pos);
+
+    pSaved->nId = pTab->nSessionId;
+    pSaved->nEncoding = pTab->nEncoding;
+    pSaved->nLineEnding = (int)pTab->lineEnding;
+    pSaved->nSelStart = pos.bValid ? pos.nSelStart : 0;
+    pSaved->nSelEnd = pos.bValid ? pos.nSelEnd : 0;
+    pSaved->nFirstLine = pos.bValid ? pos.nFirstLine : 0;
+    lstrcpynW(pSaved->szPath, pTab->szFileName, SESSION_MAX_PATH);
+}
+
+static void PutTab(TabState* pTab) {
+    SessionTab saved;
+
+    DescribeTab(pTab, &saved);
+    SessionWriterPutTab(&g_Session, &saved, &pTab->nSessionCrc);
+}
+
+/* Session id of the active tab (0 if it is not in the session) */
+static uint64_t ActiveSessionId(void) {
+    TabState* pCurrent = GetCurrentTabState();
+    return pCurrent && IsSessionTab(pCurrent) ? pCurrent->nSessionId : 0;
+}
+
+/* Record the tab order, and the active tab, if either changed */
+static void PutOrder(void) {
+    int nTabs = GetTabCount();
+    uint64_t* pIds = (uint64_t*)HeapAlloc(GetProcessHeap(), 0, (nTabs ? nTabs : 1) * sizeof(uint64_t));
+    size_t nIds = 0;
+
+    if (!pIds) return;
+    for (int i = 0; i < nTabs; i++) {
+        TabState* pTab = GetTab(i);
+        if (!IsSessionTab(pTab)) continue;
+
+        /* The order only names tabs the file has a record for */
+        if (!pTab->nSessionId) PutTab(pTab);
+        pIds[nIds++] = pTab->nSessionId;
+    }
+    SessionWriterPutOrder(&g_Session, pIds, nIds, ActiveSessionId(), &g_nOrderCrc);
+    HeapFree(GetProcessHeap(), 0, pIds);
+}
+
+/* Replace the session file with a fresh one holding only the open tabs */
+static BOOL RewriteSession(void) {
+    int nTabs = GetTabCount();
+    SessionTab* pSaved = (SessionTab*)HeapAlloc(GetProcessHeap(), 0, (nTabs ? nTabs : 1) * sizeof(SessionTab));
+    size_t nSaved = 0;
+    BOOL bOk;
+
+    if (!pSaved) return FALSE;
+    for (int i = 0; i < nTabs; i++) {
+        TabState* pTab = GetTab(i);
+        if (IsSessionTab(pTab)) DescribeTab(pTab, &pSaved[nSaved++]);
+    }
+    bOk = SessionWriterRewrite(&g_Session, pSaved, nSaved, ActiveSessionId());
+    HeapFree(GetProcessHeap(), 0, pSaved);
+    return bOk;
+}
+
+/* Record a tab's file and position if they changed, then the tab order */
+void NoteSessionTab(int nTabIndex) {
+    TabState* pTab = GetTab(nTabIndex);
+
+    if (!g_bSession) return;
+    if (pTab && IsSessionTab(pTab)) PutTab(pTab);
+    PutOrder();
+
+    if (SessionWriterRewriteDue(&g_Session)) RewriteSession();
+}
+
+/* At exit: write the final state of every tab and close the file */
+void SaveSession(void) {
+    if (!g_bSession) return;
+    RewriteSession();
+    SessionWriterClose(&g_Session);
+    g_bSession = FALSE;
+}
+
+/* Open a tab for a remembered file without reading it or creating its edit control */
+static int AddDeferredTab(const SessionTab* pSaved) {
+    int nNewTab = GetTabCount();
+    TabHandle hTab;
+    TabState* pTab;
+    TCITEM tie = {0};
+
+    if (lstrlenW(pSaved->szPath) >= MAX_PATH) return -1;
+    pTab = (TabState*)TabRegistryAdd(&g_AppState.tabs, &hTab);
+    if (!pTab) return -1;
+
+    InitTabState(pTab);
+    pTab->hTab = hTab;
+    lstrcpyW(pTab->szFileName, pSaved->szPath);
+    pTab->bUntitled = FALSE;
+    pTab->bDeferred = TRUE;
+    if (pSaved->nLineEnding <= LINE_ENDING_CR) pTab->lineEnding = (LineEndingType)pSaved->nLineEnding;
+    if (pSaved->nEncoding <= TEXT_ENCODING_ANSI) pTab->nEncoding = pSaved->nEncoding;
+    pTab->savedPos.bValid = TRUE;
+    pTab->savedPos.nSelStart = (size_t)pSaved->nSelStart;
+    pTab->savedPos.nSelEnd = (size_t)pSaved->nSelEnd;
+    pTab->savedPos.nFirstLine = (size_t)pSaved->nFirstLine;
+    pTab->nSessionId = pSaved->nId;
+
+    tie.mask = TCIF_TEXT;
+    tie.pszText = (LPTSTR)TEXT("");
+    TabCtrl_InsertItem(g_AppState.hwndTab, nNewTab, &tie);
+    UpdateTabTitle(nNewTab);
+    return nNewTab;
+}
+
+/*
+ * At launch: claim the session file and reopen its tabs, none of them read
+ * yet. Returns the tab that was active (-1 if none came back); showing it
+ * is what reads its file.
+ */
+int RestoreSession(void) {
+    WCHAR szPath[MAX_PATH];
+    SessionSnapshot snapshot;
+    int nActive = -1;
+
+    if (!FindAppDataDir(szPath, MAX_PATH) || lstrlenW(szPath) + lstrlenW(SESSION_FILE_NAME) >= MAX_PATH) {
+        return -1;
+    }
+    lstrcatW(szPath, SESSION_FILE_NAME);
+
+    /* Held by another instance: that one keeps the session, this one runs without */
+    if (!SessionWriterOpen(&g_Session, szPath, &snapshot)) return -1;
+    g_bSession = TRUE;
+    g_nLastSessionId = snapshot.nMaxId;
+
+    for (size_t i = 0; i < snapshot.nTabs; i++) {
+        int nTab = AddDeferredTab(&snapshot.pTabs[i]);
+        if (nTab >= 0 && (i == snapshot.nActive || nActive < 0)) nActive = nTab;
+    }
+    SessionSnapshotFree(&snapshot);
+    return nActive;
+}
+
+/* Give a reopened tab its edit control and start reading its file (FALSE leaves it empty and untitled) */
+BOOL LoadDeferredTab(HWND hwnd, int nTabIndex) {
+    TabState* pTab = GetTab(nTabIndex);
+    WCHAR szFileName[MAX_PATH];
+
+    if (!pTab || !pTab->bDeferred) return TRUE;
+    pTab->bDeferred = FALSE;
+    lstrcpyW(szFileName, pTab->szFileName);
+
+    RecreateEditControl(hwnd, nTabIndex, g_AppState.bWordWrap);
+    if (!pTab->hwndEdit || !BeginFileLoad(hwnd, pTab, szFileName)) {
+        pTab->szFileName[0] = L'\0';
+        pTab->bUntitled = TRUE;
+        pTab->savedPos.bValid = FALSE;
+        UpdateTabTitle(nTabIndex);
+        return FALSE;
+    }
+    UpdateTabTitle(nTabIndex);
+    return TRUE;
+}
+
+/* Hand crash recovery the reopened tab of a file, with an edit control but unread (-1 if none) */
+int ClaimDeferredTab(HWND hwnd, const WCHAR* szFileName) {
+    for (int i = 0; i < GetTabCount(); i++) {
+        TabState* pTab = GetTab(i);
+        if (!pTab->bDeferred || lstrcmpiW(pTab->szFileName, szFileName) != 0) continue;
+
+        pTab->bDeferred = FALSE;
+        RecreateEditControl(hwnd, i, g_AppState.bWordWrap);
+        if (!pTab->hwndEdit) {
+            pTab->bDeferred = TRUE;
+            return -1;
+        }
+        return i;
+    }
+    return -1;
+}
+
+/* Tab showing a file already (-1 if none) */
+static int FindFileTab(const WCHAR* szFileName) {
+    for (int i = 0; i < GetTabCount(); i++) {
+        TabState* pTab = GetTab(i);
+        if (!pTab->bUntitled && lstrcmpiW(pTab->szFileName, szFileName) == 0) return i;
+    }
+    return -1;
+}
+
+/*
+ * Open the files named on the command line, each in a tab of its own (one
+ * already open is just shown). WinMain's lpCmdLine is in the ANSI code
+ * page, so the wide command line is parsed instead.
+ */
+void OpenCommandLineFiles(HWND hwnd) {
+    int nArgs = 0;
+    LPWSTR* ppArgs = CommandLineToArgvW(GetCommandLineW(), &nArgs);
+
+    if (!ppArgs) return;
+    for (int i = 1; i < nArgs; i++) {
+        WCHAR szFileName[MAX_PATH];
+        DWORD nLen = GetFullPathNameW(ppArgs[i], MAX_PATH, szFileName, NULL);
+        TabState* pTab;
+        int nTab;
+
+        if (nLen == 0 || nLen >= MAX_PATH) continue;
+
+        nTab = FindFileTab(szFileName);
+        if (nTab >= 0) {
+            SwitchToTab(hwnd, nTab);
+            continue;
+        }
+
+        /* The empty tab a fresh start leaves is used; otherwise a new one */
+        pTab = GetCurrentTabState();
+        if (!pTab || !pTab->bUntitled || pTab->bModified || pTab->bFindResults || pTab->pLoad ||
+            pTab->pJournal || PieceTableLength(&pTab->doc) != 0) {
+            if (AddNewTab(hwnd, TEXT("Loading...")) < 0) break;
+            pTab = GetCurrentTabState();
+        }
+        if (!BeginFileLoad(hwnd, pTab, szFileName)) {
+            ShowErrorDialog(hwnd, TEXT("Failed to open file."));
+            continue;
+        }
+        UpdateTabTitle(g_AppState.nCurrentTab);
+        UpdateWindowTitle(hwnd);
+    }
+    LocalFree(ppArgs);
+    RequestFrame(hwnd, FRAME_DIRTY_GUTTER | FRAME_DIRTY_STATUS);
+}
@@ -0,0 +1,475 @@
+#include "session_file.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* File magic */
+static const uint8_t g_Magic[4] = { 'X', 'N', 'S', '1' };
+
+/* Record types */
+#define RECORD_TAB   1
+#define RECORD_ORDER 2
+
+/* Longest varint */
+#define VARINT_MAX 10
+
+/* ---- Encoding ---- */
+
+/* CRC-32 (the journal's polynomial); session records are small, so no table */
+static uint32_t Crc32(const uint8_t* p, size_t nLen) {
+    uint32_t nCrc = 0xFFFFFFFFu;
+    while (nLen--) {
+        nCrc ^= *p++;
+        for (int i = 0; i < 8; i++) nCrc = (nCrc >> 1) ^ (0xEDB88320u & (0u - (nCrc & 1)));
+    }
+    return nCrc ^ 0xFFFFFFFFu;
+}
+
+static size_t VarintSize(uint64_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static uint8_t* PutVarint(uint8_t* p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+/* Bounded varint read (NULL if it runs past pEnd or overflows) */
+static const uint8_t* GetVarint(const uint8_t* p, const uint8_t* pEnd, uint64_t* pv) {
+    uint64_t v = 0;
+    for (int nShift = 0; p < pEnd && nShift < 64; nShift += 7) {
+        uint8_t b = *p++;
+        v |= (uint64_t)(b & 0x7F) << nShift;
+        if (!(b & 0x80)) {
+            *pv = v;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static size_t PathLength(const PathChar* szPath) {
+    size_t n = 0;
+    while (szPath[n]) n++;
+    return n;
+}
+
+/*
+ * Frame a body encoded at pBody, which starts VARINT_MAX bytes into
+ * pRecord: the length goes right before it and the CRC after it. Returns
+ * the record's first byte; *pnRecord receives its size and *pnCrc the CRC.
+ */
+static uint8_t* FinishRecord(uint8_t* pRecord, size_t nBody, size_t* pnRecord, uint32_t* pnCrc) {
+    uint8_t* pBody = pRecord + VARINT_MAX;
+    uint8_t* pStart = pBody - VarintSize(nBody);
+    uint32_t nCrc = Crc32(pBody, nBody);
+    uint8_t* p = pBody + nBody;
+
+    PutVarint(pStart, nBody);
+    for (int i = 0; i < 4; i++) *p++ = (uint8_t)(nCrc >> (8 * i));
+    *pnRecord = (size_t)(p - pStart);
+    *pnCrc = nCrc;
+    return pStart;
+}
+
+/* Buffer bytes a tab record needs */
+static size_t TabRecordBound(const SessionTab* pTab) {
+    return VARINT_MAX + 1 + 7 * VARINT_MAX + PathLength(pTab->szPath) * sizeof(PathChar) + 4;
+}
+
+/* Encode a tab record into pBuf (TabRecordBound bytes) */
+static uint8_t* EncodeTab(uint8_t* pBuf, const SessionTab* pTab, size_t* pnRecord, uint32_t* pnCrc) {
+    size_t nPathBytes = PathLength(pTab->szPath) * sizeof(PathChar);
+    uint8_t* p = pBuf + VARINT_MAX;
+
+    *p++ = RECORD_TAB;
+    p = PutVarint(p, pTab->nId);
+    p = PutVarint(p, (uint64_t)pTab->nEncoding);
+    p = PutVarint(p, (uint64_t)pTab->nLineEnding);
+    p = PutVarint(p, pTab->nSelStart);
+    p = PutVarint(p, pTab->nSelEnd);
+    p = PutVarint(p, pTab->nFirstLine);
+    p = PutVarint(p, nPathBytes);
+    memcpy(p, pTab->szPath, nPathBytes);
+    p += nPathBytes;
+    return FinishRecord(pBuf, (size_t)(p - (pBuf + VARINT_MAX)), pnRecord, pnCrc);
+}
+
+/* Buffer bytes an order record of nIds tabs needs (0 if that overflows) */
+static size_t OrderRecordBound(size_t nIds) {
+    if (nIds > (SIZE_MAX - 64) / VARINT_MAX) return 0;
+    return VARINT_MAX + 1 + 2 * VARINT_MAX + nIds * VARINT_MAX + 4;
+}
+
+/* Encode an order record into pBuf (OrderRecordBound bytes) */
+static uint8_t* EncodeOrder(uint8_t* pBuf, const uint64_t* pIds, size_t nIds, uint64_t nActiveId,
+                            size_t* pnRecord, uint32_t* pnCrc) {
+    uint8_t* p = pBuf + VARINT_MAX;
+
+    *p++ = RECORD_ORDER;
+    p = PutVarint(p, nActiveId);
+    p = PutVarint(p, nIds);
+    for (size_t i = 0; i < nIds; i++) p = PutVarint(p, pIds[i]);
+    return FinishRecord(pBuf, (size_t)(p - (pBuf + VARINT_MAX)), pnRecord, pnCrc);
+}
+
+/* ---- Reading ---- */
+
+/* Session file being parsed */
+typedef struct {
+    const uint8_t* p;            /* Next record */
+    const uint8_t* pEnd;
+    const uint8_t* pBody;        /* Body of the last record read */
+    size_t nBody;
+} RecordReader;
+
+/* Next intact record, or 0 at the end or at a torn or corrupt one */
+static int NextRecord(RecordReader* pReader) {
+    const uint8_t* p;
+    uint64_t nBody;
+    uint32_t nCrc = 0;
+
+    p = GetVarint(pReader->p, pReader->pEnd, &nBody);
+    if (!p || nBody == 0 || nBody > (uint64_t)(pReader->pEnd - p) ||
+        (uint64_t)(pReader->pEnd - p) - nBody < 4) {
+        return 0;
+    }
+    for (int i = 0; i < 4; i++) nCrc |= (uint32_t)p[nBody + i] << (8 * i);
+    if (Crc32(p, (size_t)nBody) != nCrc) return 0;
+
+    pReader->pBody = p;
+    pReader->nBody = (size_t)nBody;
+    pReader->p = p + nBody + 4;
+    return 1;
+}
+
+/* Decode a tab record body (0 if it is malformed) */
+static int ParseTab(const uint8_t* pBody, size_t nBody, SessionTab* pTab) {
+    const uint8_t* p = pBody + 1;
+    const uint8_t* pEnd = pBody + nBody;
+    uint64_t nEncoding, nLineEnding, nPathBytes;
+
+    if (!(p = GetVarint(p, pEnd, &pTab->nId)) || pTab->nId == 0 ||
+        !(p = GetVarint(p, pEnd, &nEncoding)) || !(p = GetVarint(p, pEnd, &nLineEnding)) ||
+        !(p = GetVarint(p, pEnd, &pTab->nSelStart)) || !(p = GetVarint(p, pEnd, &pTab->nSelEnd)) ||
+        !(p = GetVarint(p, pEnd, &pTab->nFirstLine)) || !(p = GetVarint(p, pEnd, &nPathBytes))) {
+        return 0;
+    }
+    if (nEncoding > 0xFFFF || nLineEnding > 0xFFFF || nPathBytes != (uint64_t)(pEnd - p) ||
+        nPathBytes % sizeof(PathChar) != 0 || nPathBytes / sizeof(PathChar) >= SESSION_MAX_PATH) {
+        return 0;
+    }
+    pTab->nEncoding = (int)nEncoding;
+    pTab->nLineEnding = (int)nLineEnding;
+    memcpy(pTab->szPath, p, (size_t)nPathBytes);
+    pTab->szPath[nPathBytes / sizeof(PathChar)] = 0;
+    return 1;
+}
+
+/* Check an order record body; *pp is left at its first tab id (0 if it is malformed) */
+static int ParseOrder(const uint8_t* pBody, size_t nBody, uint64_t* pnActiveId, uint64_t* pnIds,
+                      const uint8_t** pp) {
+    const uint8_t* p = pBody + 1;
+    const uint8_t* pEnd = pBody + nBody;
+    const uint8_t* pIds;
+    uint64_t nId;
+
+    if (!(p = GetVarint(p, pEnd, pnActiveId)) || !(p = GetVarint(p, pEnd, pnIds))) return 0;
+    if (*pnIds > (uint64_t)(pEnd - p)) return 0;
+    pIds = p;
+    for (uint64_t i = 0; i < *pnIds; i++) {
+        if (!(p = GetVarint(p, pEnd, &nId)) || nId == 0) return 0;
+    }
+    if (p != pEnd) return 0;
+    *pp = pIds;
+    return 1;
+}
+
+/* Latest record of the tab with id nId (-1 if none) */
+static ptrdiff_t FindTab(const SessionTab* pTabs, size_t nTabs, uint64_t nId) {
+    for (size_t i = 0; i < nTabs; i++) {
+        if (pTabs[i].nId == nId) return (ptrdiff_t)i;
+    }
+    return -1;
+}
+
+int SessionParse(const uint8_t* pData, size_t nLen, SessionSnapshot* pSnapshot) {
+    RecordReader reader;
+    SessionTab* pAll = NULL;
+    size_t nAll = 0, nAllCapacity = 0;
+    const uint8_t* pOrder = NULL;
+    uint64_t nOrder = 0, nActiveId = 0;
+    int bOk = 1;
+
+    memset(pSnapshot, 0, sizeof(*pSnapshot));
+    if (nLen < sizeof(g_Magic) || memcmp(pData, g_Magic, sizeof(g_Magic)) != 0) return 0;
+
+    reader.p = pData + sizeof(g_Magic);
+    reader.pEnd = pData + nLen;
+    pSnapshot->nValidBytes = sizeof(g_Magic);
+
+    /* Every tab's latest record, and the last order */
+    while (bOk && NextRecord(&reader)) {
+        const uint8_t* pBody = reader.pBody;
+
+        if (pBody[0] == RECORD_TAB) {
+            SessionTab tab;
+            ptrdiff_t nAt;
+
+            if (!ParseTab(pBody, reader.nBody, &tab)) break;
+            nAt = FindTab(pAll, nAll, tab.nId);
+            if (nAt < 0) {
+                if (nAll == nAllCapacity) {
+                    size_t nCapacity = nAllCapacity ? nAllCapacity * 2 : 16;
+                    SessionTab* pNew = (SessionTab*)realloc(pAll, nCapacity * sizeof(SessionTab));
+                    if (!pNew) {
+                        bOk = 0;
+                        break;
+                    }
+                    pAll = pNew;
+                    nAllCapacity = nCapacity;
+                }
+                nAt = (ptrdiff_t)nAll++;
+            }
+            pAll[nAt] = tab;
+            if (tab.nId > pSnapshot->nMaxId) pSnapshot->nMaxId = tab.nId;
+        } else if (pBody[0] == RECORD_ORDER) {
+            uint64_t nIds, nActive;
+            const uint8_t* pIds;
+
+            if (!ParseOrder(pBody, reader.nBody, &nActive, &nIds, &pIds)) break;
+            pOrder = pIds;
+            nOrder = nIds;
+            nActiveId = nActive;
+        }
+        /* Other record types come from a newer version and are skipped */
+
+        pSnapshot->nValidBytes = (uint64_t)(reader.p - pData);
+    }
+
+    /* The order picks the open tabs out of everything recorded */
+    if (bOk && nOrder) {
+        const uint8_t* pEnd = pData + pSnapshot->nValidBytes;
+        const uint8_t* p = pOrder;
+
+        pSnapshot->pTabs = (SessionTab*)malloc((size_t)nOrder * sizeof(SessionTab));
+        if (!pSnapshot->pTabs) bOk = 0;
+        for (uint64_t i = 0; bOk && i < nOrder; i++) {
+            uint64_t nId = 0;
+            ptrdiff_t nAt;
+
+            p = GetVarint(p, pEnd, &nId);
+            if (nId > pSnapshot->nMaxId) pSnapshot->nMaxId = nId;
+            nAt = FindTab(pAll, nAll, nId);
+            if (nAt < 0 || FindTab(pSnapshot->pTabs, pSnapshot->nTabs, nId) >= 0) continue;
+            if (nId == nActiveId) pSnapshot->nActive = pSnapshot->nTabs;
+            pSnapshot->pTabs[pSnapshot->nTabs++] = pAll[nAt];
+        }
+    }
+
+    free(pAll);
+    if (!bOk) {
+        SessionSnapshotFree(pSnapshot);
+        return 0;
+    }
+    return 1;
+}
+
+int SessionLoad(const PathChar* szPath, SessionSnapshot* pSnapshot) {
+    MappedFile map;
+    int bOk;
+
+    memset(pSnapshot, 0, sizeof(*pSnapshot));
+    if (!MapFileReadOnly(&map, szPath)) return 0;
+    bOk = map.pData && map.nSize <= SIZE_MAX && SessionParse(map.pData, (size_t)map.nSize, pSnapshot);
+    UnmapFile(&map);
+    return bOk;
+}
+
+void SessionSnapshotFree(SessionSnapshot* pSnapshot) {
+    free(pSnapshot->pTabs);
+    memset(pSnapshot, 0, sizeof(*pSnapshot));
+}
+
+/* ---- Writing ---- */
+
+static int CopyPath(PathChar* szDest, const PathChar* szSource) {
+    size_t n = PathLength(szSource);
+    if (n >= SESSION_MAX_PATH) return 0;
+    memcpy(szDest, szSource, n * sizeof(PathChar));
+    szDest[n] = 0;
+    return 1;
+}
+
+/* Start the open file over with just the magic */
+static int ResetFile(SessionWriter* pWriter) {
+    if (!OutputFileTruncate(&pWriter->file, 0) ||
+        !OutputFileWrite(&pWriter->file, g_Magic, sizeof(g_Magic))) {
+        return 0;
+    }
+    pWriter->nBytes = sizeof(g_Magic);
+    return 1;
+}
+
+int SessionWriterOpen(SessionWriter* pWriter, const PathChar* szPath, SessionSnapshot* pSnapshot) {
+    memset(pWriter, 0, sizeof(*pWriter));
+    memset(pSnapshot, 0, sizeof(*pSnapshot));
+    if (!CopyPath(pWriter->szPath, szPath)) return 0;
+
+    if (!OutputFileOpenExisting(&pWriter->file, szPath)) {
+        MappedFile map;
+
+        /* A file that is there but cannot be opened belongs to another process */
+        if (MapFileReadOnly(&map, szPath)) {
+            UnmapFile(&map);
+            return 0;
+        }
+
+        /* Create it empty, then hold it the same way as one that was there */
+        if (!OutputFileCreate(&pWriter->file, szPath)) return 0;
+        OutputFileClose(&pWriter->file);
+        if (!OutputFileOpenExisting(&pWriter->file, szPath)) return 0;
+    }
+
+    /* Held for writing first, so no other process changes it under the reader */
+    if (SessionLoad(szPath, pSnapshot)) {
+        pWriter->nBytes = pSnapshot->nValidBytes;
+        if (!OutputFileTruncate(&pWriter->file, pWriter->nBytes)) {
+            OutputFileClose(&pWriter->file);
+            SessionSnapshotFree(pSnapshot);
+            return 0;
+        }
+    } else if (!ResetFile(pWriter)) {
+        OutputFileClose(&pWriter->file);
+        return 0;
+    }
+    pWriter->nRewritten = pSnapshot->nValidBytes = pWriter->nBytes;
+    return 1;
+}
+
+/* Append one encoded record unless it matches *pnLast */
+static int PutRecord(SessionWriter* pWriter, const uint8_t* pRecord, size_t nRecord, uint32_t nCrc,
+                     uint32_t* pnLast) {
+    if (pnLast && *pnLast == nCrc) return 1;
+    if (!OutputFileWrite(&pWriter->file, pRecord, nRecord)) {
+        pWriter->bFailed = 1;
+        return 0;
+    }
+    pWriter->nBytes += nRecord;
+    if (pnLast) *pnLast = nCrc;
+    return 1;
+}
+
+int SessionWriterPutTab(SessionWriter* pWriter, const SessionTab* pTab, uint32_t* pnLast) {
+    uint8_t* pBuf;
+    const uint8_t* pRecord;
+    size_t nRecord;
+    uint32_t nCrc;
+    int bOk;
+
+    if (!pWriter->file.hFile || pTab->nId == 0 || PathLength(pTab->szPath) >= SESSION_MAX_PATH) return 0;
+    pBuf = (uint8_t*)malloc(TabRecordBound(pTab));
+    if (!pBuf) return 0;
+    pRecord = EncodeTab(pBuf, pTab, &nRecord, &nCrc);
+    bOk = PutRecord(pWriter, pRecord, nRecord, nCrc, pnLast);
+    free(pBuf);
+    return bOk;
+}
+
+int SessionWriterPutOrder(SessionWriter* pWriter, const uint64_t* pIds, size_t nIds,
+                          uint64_t nActiveId, uint32_t* pnLast) {
+    size_t nBound = OrderRecordBound(nIds);
+    uint8_t* pBuf;
+    const uint8_t* pRecord;
+    size_t nRecord;
+    uint32_t nCrc;
+    int bOk;
+
+    if (!pWriter->file.hFile || !nBound) return 0;
+    pBuf = (uint8_t*)malloc(nBound);
+    if (!pBuf) return 0;
+    pRecord = EncodeOrder(pBuf, pIds, nIds, nActiveId, &nRecord, &nCrc);
+    bOk = PutRecord(pWriter, pRecord, nRecord, nCrc, pnLast);
+    free(pBuf);
+    return bOk;
+}
+
+int SessionWriterRewriteDue(const SessionWriter* pWriter) {
+    return pWriter->file.hFile && pWriter->nBytes > 2 * pWriter->nRewritten + SESSION_REWRITE_SLACK;
+}
+
+int SessionWriterRewrite(SessionWriter* pWriter, const SessionTab* pTabs, size_t nTabs, uint64_t nActiveId) {
+    PathChar szTemp[SESSION_MAX_PATH + 16];
+    size_t nBound = sizeof(g_Magic) + OrderRecordBound(nTabs);
+    uint64_t* pIds;
+    uint8_t* pBuf;
+    uint8_t* p;
+    size_t nRecord;
+    uint32_t nCrc;
+    OutputFile temp;
+    int bOk;
+
+    if (!pWriter->file.hFile || nBound == sizeof(g_Magic)) return 0;
+    for (size_t i = 0; i < nTabs; i++) nBound += TabRecordBound(&pTabs[i]);
+    pIds = (uint64_t*)malloc((nTabs ? nTabs : 1) * sizeof(uint64_t));
+    pBuf = (uint8_t*)malloc(nBound);
+    if (!pIds || !pBuf) {
+        free(pIds);
+        free(pBuf);
+        return 0;
+    }
+
+    /* Records are encoded in place, one after another */
+    memcpy(pBuf, g_Magic, sizeof(g_Magic));
+    p = pBuf + sizeof(g_Magic);
+    for (size_t i = 0; i < nTabs; i++) {
+        uint8_t* pRecord = EncodeTab(p, &pTabs[i], &nRecord, &nCrc);
+        memmove(p, pRecord, nRecord);
+        p += nRecord;
+        pIds[i] = pTabs[i].nId;
+    }
+    {
+        uint8_t* pRecord = EncodeOrder(p, pIds, nTabs, nActiveId, &nRecord, &nCrc);
+        memmove(p, pRecord, nRecord);
+        p += nRecord;
+    }
+    free(pIds);
+
+    /* The new file is complete on disk before it takes the old one's place */
+    bOk = OutputFileCreateTemp(&temp, pWriter->szPath, szTemp, sizeof(szTemp) / sizeof(szTemp[0]));
+    if (bOk) {
+        bOk = OutputFileWrite(&temp, pBuf, (size_t)(p - pBuf)) && OutputFileFlush(&temp);
+        bOk = OutputFileClose(&temp) && bOk;
+        if (bOk) {
+            OutputFileClose(&pWriter->file);
+            bOk = ReplaceFileAtomic(szTemp, pWriter->szPath);
+            if (bOk) pWriter->nBytes = pWriter->nRewritten = (uint64_t)(p - pBuf);
+
+            /* Either way there is a whole file to append to */
+            if (!OutputFileOpenExisting(&pWriter->file, pWriter->szPath)) {
+                pWriter->file.hFile = NULL;
+                pWriter->bFailed = 1;
+                bOk = 0;
+            }
+        }
+        if (!bOk) DeleteFilePath(szTemp);
+    }
+    free(pBuf);
+    if (bOk) pWriter->bFailed = 0;
+    return bOk;
+}
+
+void SessionWriterClose(SessionWriter* pWriter) {
+    if (!pWriter->file.hFile) return;
+    OutputFileFlush(&pWriter->file);
+    OutputFileClose(&pWriter->file);
+    pWriter->file.hFile = NULL;
+}
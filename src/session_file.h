@@ -0,0 +1,104 @@
+#ifndef SESSION_FILE_H
+#define SESSION_FILE_H
+
+/*
+ * Session snapshot: the tabs to reopen at the next launch.
+ *
+ * Portable C. The file is a log, so a change costs one small append
+ * instead of a rewrite:
+ *
+ *   "XNS1" | record | record | ...
+ *   record = body length (varint) | body | CRC-32 of body (4 bytes)
+ *
+ * A tab record holds one tab's file, caret, scroll position, encoding and
+ * line ending under the tab's id; a later record for the same id replaces
+ * it. An order record lists the ids of the open tabs in tab strip order
+ * and names the active one; the last one decides what is restored, so a
+ * closed tab needs no record of its own. A torn or corrupt tail fails its
+ * length or CRC check and reading stops there.
+ *
+ * The writer keeps the file open (other processes may read it but not
+ * write it) and appends without flushing; the log is rewritten from
+ * scratch (temp file, flush, atomic rename) once it has grown well past
+ * what the live tabs need, and at exit.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "platform.h"
+
+/* Longest file path kept for a tab (in PathChar units) */
+#define SESSION_MAX_PATH 1024
+
+/* Appended bytes tolerated on top of twice the last rewrite before the next */
+#define SESSION_REWRITE_SLACK (64 * 1024)
+
+/* One tab as the session remembers it */
+typedef struct {
+    uint64_t nId;                /* Names the tab within the file (never 0) */
+    int nEncoding;               /* Caller's encoding code */
+    int nLineEnding;             /* Caller's line ending code */
+    uint64_t nSelStart;          /* Selection, in document offsets */
+    uint64_t nSelEnd;
+    uint64_t nFirstLine;         /* First visible line, zero-based */
+    PathChar szPath[SESSION_MAX_PATH]; /* File shown in the tab */
+} SessionTab;
+
+/* What a session file holds */
+typedef struct {
+    SessionTab* pTabs;           /* Open tabs in tab strip order (malloc) */
+    size_t nTabs;
+    size_t nActive;              /* Index of the active tab in pTabs */
+    uint64_t nMaxId;             /* Largest tab id used (new tabs take ids above it) */
+    uint64_t nValidBytes;        /* Length of the intact part of the file */
+} SessionSnapshot;
+
+/* Appends to a session file */
+typedef struct {
+    OutputFile file;             /* hFile NULL when not open */
+    PathChar szPath[SESSION_MAX_PATH];
+    uint64_t nBytes;             /* Length of the file */
+    uint64_t nRewritten;         /* Length right after the last rewrite */
+    int bFailed;                 /* A write failed: the file may be short of the latest state */
+} SessionWriter;
+
+/*
+ * Read a session from memory. Returns nonzero if pData starts with the
+ * file magic (a file with a torn tail still counts); records past the
+ * last intact one are ignored.
+ */
+int SessionParse(const uint8_t* pData, size_t nLen, SessionSnapshot* pSnapshot);
+
+/* Map a session file and read it (returns nonzero on success) */
+int SessionLoad(const PathChar* szPath, SessionSnapshot* pSnapshot);
+
+void SessionSnapshotFree(SessionSnapshot* pSnapshot);
+
+/*
+ * Claim the session file for writing, creating it if missing, and read
+ * what it holds into pSnapshot (empty for a new or unreadable file). A torn
+ * tail is cut off. Returns 0 if the file cannot be claimed, as when
+ * another process is writing it.
+ */
+int SessionWriterOpen(SessionWriter* pWriter, const PathChar* szPath, SessionSnapshot* pSnapshot);
+
+/*
+ * Append a tab record, or an order record (nActiveId names the active tab,
+ * 0 for none). When pnLast is given it holds the checksum of the previous
+ * record of the same kind for the same tab: an unchanged record is not
+ * written again, and a written one updates it. Returns nonzero on success.
+ */
+int SessionWriterPutTab(SessionWriter* pWriter, const SessionTab* pTab, uint32_t* pnLast);
+int SessionWriterPutOrder(SessionWriter* pWriter, const uint64_t* pIds, size_t nIds,
+                          uint64_t nActiveId, uint32_t* pnLast);
+
+/* Whether the log has grown enough that a rewrite pays off */
+int SessionWriterRewriteDue(const SessionWriter* pWriter);
+
+/* Replace the file with one holding just these tabs, in this order (returns nonzero on success) */
+int SessionWriterRewrite(SessionWriter* pWriter, const SessionTab* pTabs, size_t nTabs, uint64_t nActiveId);
+
+/* Flush and close the file */
+void SessionWriterClose(SessionWriter* pWriter);
+
+#endif /* SESSION_FILE_H */
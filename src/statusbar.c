@@ -24,6 +24,18 @@ HWND CreateStatusBar(HWND hwndParent, HINSTANCE hInstance) {
     return hwndStatus;
 }
 
+/* Status bar name of a TEXT_ENCODING_ */
+static const TCHAR* GetEncodingName(int nEncoding) {
+    switch (nEncoding) {
+        case TEXT_ENCODING_UTF16LE: return TEXT("UTF-16 LE");
+        case TEXT_ENCODING_UTF16BE: return TEXT("UTF-16 BE");
+        case TEXT_ENCODING_UTF32LE: return TEXT("UTF-32 LE");
+        case TEXT_ENCODING_UTF32BE: return TEXT("UTF-32 BE");
+        case TEXT_ENCODING_ANSI:    return TEXT("ANSI");
+        default:                    return TEXT("UTF-8");
+    }
+}
+
 /* Set status bar parts based on window width */
 void SetStatusBarParts(HWND hwndStatus, int nWidth) {
     if (!hwndStatus) return;
@@ -101,39 +113,6 @@ const TCHAR* GetFileTypeString(const TCHAR* szFileName) {
     return TEXT("Normal text file");
 }
 
-/* Count words in edit control */
-int CountWords(HWND hwndEdit) {
-    if (!hwndEdit) return 0;
-    
-    int nLen = GetWindowTextLength(hwndEdit);
-    if (nLen == 0) return 0;
-    
-    TCHAR* pText = (TCHAR*)HeapAlloc(GetProcessHeap(), 0, (nLen + 1) * sizeof(TCHAR));
-    if (!pText) return 0;
-    
-    GetWindowText(hwndEdit, pText, nLen + 1);
-    
-    int nWords = 0;
-    BOOL bInWord = FALSE;
-    
-    for (int i = 0; i < nLen; i++) {
-        TCHAR ch = pText[i];
-        BOOL bIsSpace = (ch == TEXT(' ') || ch == TEXT('\t') || 
-                         ch == TEXT('\r') || ch == TEXT('\n'));
-        
-        if (bIsSpace) {
-            bInWord = FALSE;
-        } else if (!bInWord) {
-            bInWord = TRUE;
-            nWords++;
-        }
-    }
-    
-    HeapFree(GetProcessHeap(), 0, pText);
-    return nWords;
-}
-
-
 /* Update status bar with current document info */
 void UpdateStatusBar(HWND hwnd) {
     if (!g_AppState.hwndStatus) return;
@@ -142,6 +121,8 @@ void UpdateStatusBar(HWND hwnd) {
     HWND hwndEdit = GetCurrentEdit();
     
     TCHAR szText[256];
+    LargeViewerStatus large;
+    BOOL bLarge = pTab && pTab->bLargeFile && GetLargeViewerStatus(hwndEdit, &large);
     
     /* Part 0: File type */
     if (pTab) {
@@ -151,17 +132,40 @@ void UpdateStatusBar(HWND hwnd) {
         SendMessage(g_AppState.hwndStatus, SB_SETTEXT, SB_PART_FILETYPE, (LPARAM)TEXT("Normal text file"));
     }
     
-    if (hwndEdit) {
-        /* Part 1: Length (character count) */
-        int nLength = GetWindowTextLength(hwndEdit);
-        _sntprintf(szText, 256, TEXT("length: %d"), nLength);
+    if (bLarge) {
+        /* Large file viewer: the text is never decoded as a whole, so report bytes */
+        _sntprintf(szText, 256, TEXT("bytes: %I64u"), (unsigned long long)large.nBytes);
         SendMessage(g_AppState.hwndStatus, SB_SETTEXT, SB_PART_LENGTH, (LPARAM)szText);
         
-        /* Part 2: Lines count */
-        int nLines = (int)SendMessage(hwndEdit, EM_GETLINECOUNT, 0, 0);
-        _sntprintf(szText, 256, TEXT("lines: %d"), nLines);
+        /* Part 2: Lines count, or how far the background index has got */
+        if (large.bLinesKnown) {
+            _sntprintf(szText, 256, TEXT("lines: %I64u"), (unsigned long long)large.nLines);
+        } else {
+            _sntprintf(szText, 256, TEXT("indexing %d%%"), large.nIndexPercent);
+        }
         SendMessage(g_AppState.hwndStatus, SB_SETTEXT, SB_PART_LINES, (LPARAM)szText);
         
+        /* Part 3: First visible line */
+        if (large.nTopLine) {
+            _sntprintf(szText, 256, TEXT("Ln: %I64u  (read-only)"), (unsigned long long)large.nTopLine);
+        } else {
+            _sntprintf(szText, 256, TEXT("Ln: ?  (read-only)"));
+        }
+        SendMessage(g_AppState.hwndStatus, SB_SETTEXT, SB_PART_POSITION, (LPARAM)szText);
+    } else if (hwndEdit) {
+        /* Parts 1 and 2: counts kept up to date by every edit, or progress while loading */
+        if (pTab && pTab->pLoad) {
+            SendMessage(g_AppState.hwndStatus, SB_SETTEXT, SB_PART_LENGTH, (LPARAM)TEXT("length: ..."));
+            _sntprintf(szText, 256, TEXT("loading %d%%"), GetFileLoadPercent(pTab));
+            SendMessage(g_AppState.hwndStatus, SB_SETTEXT, SB_PART_LINES, (LPARAM)szText);
+        } else if (pTab) {
+            _sntprintf(szText, 256, TEXT("length: %I64u  words: %I64u"),
+                       (unsigned long long)pTab->stats.nChars, (unsigned long long)pTab->stats.nWords);
+            SendMessage(g_AppState.hwndStatus, SB_SETTEXT, SB_PART_LENGTH, (LPARAM)szText);
+            _sntprintf(szText, 256, TEXT("lines: %I64u"), (unsigned long long)DocStatsLineCount(&pTab->stats));
+            SendMessage(g_AppState.hwndStatus, SB_SETTEXT, SB_PART_LINES, (LPARAM)szText);
+        }
+        
         /* Part 3: Current position (Ln, Col, Pos) */
         DWORD dwStart = 0, dwEnd = 0;
         SendMessage(hwndEdit, EM_GETSEL, (WPARAM)&dwStart, (LPARAM)&dwEnd);
@@ -204,11 +208,14 @@ void UpdateStatusBar(HWND hwnd) {
         SendMessage(g_AppState.hwndStatus, SB_SETTEXT, SB_PART_LINEENDING, (LPARAM)TEXT("Windows (CRLF)"));
     }
     
-    /* Part 5: Encoding (always UTF-8 for now) */
-    SendMessage(g_AppState.hwndStatus, SB_SETTEXT, SB_PART_ENCODING, (LPARAM)TEXT("UTF-8"));
+    /* Part 5: Encoding the file is read and saved in */
+    SendMessage(g_AppState.hwndStatus, SB_SETTEXT, SB_PART_ENCODING,
+                (LPARAM)GetEncodingName(pTab ? pTab->nEncoding : TEXT_ENCODING_UTF8));
     
     /* Part 6: Insert/Overwrite mode */
-    if (pTab) {
+    if (bLarge) {
+        SendMessage(g_AppState.hwndStatus, SB_SETTEXT, SB_PART_INSERTMODE, (LPARAM)TEXT("R/O"));
+    } else if (pTab) {
         SendMessage(g_AppState.hwndStatus, SB_SETTEXT, SB_PART_INSERTMODE, 
                     (LPARAM)(pTab->bInsertMode ? TEXT("INS") : TEXT("OVR")));
     } else {
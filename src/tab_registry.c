@@ -0,0 +1,139 @@
+#include "tab_registry.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Slots the arrays start with */
+#define TAB_REGISTRY_INITIAL 16
+
+static TabHandle MakeHandle(uint32_t nSlot, uint32_t nGeneration) {
+    return ((uint64_t)nGeneration << 32) | ((uint64_t)nSlot + 1);
+}
+
+void TabRegistryInit(TabRegistry* pReg, size_t nItemSize) {
+    memset(pReg, 0, sizeof(*pReg));
+    pReg->nItemSize = nItemSize;
+}
+
+void TabRegistryFree(TabRegistry* pReg) {
+    for (uint32_t i = 0; i < pReg->nSlots; i++) free(pReg->pSlots[i].pItem);
+    free(pReg->pSlots);
+    free(pReg->pOrder);
+    TabRegistryInit(pReg, pReg->nItemSize);
+}
+
+/* A slot to open a tab in, from the free list or a new one (returns nonzero on success) */
+static int TakeSlot(TabRegistry* pReg, uint32_t* pnSlot) {
+    if (pReg->nFreeHead) {
+        *pnSlot = pReg->nFreeHead - 1;
+        pReg->nFreeHead = pReg->pSlots[*pnSlot].nNextFree;
+        return 1;
+    }
+
+    if (pReg->nSlots == pReg->nSlotCapacity) {
+        /* Slot records move when this grows; the states they point to do not */
+        uint32_t nCapacity = pReg->nSlotCapacity ? pReg->nSlotCapacity * 2 : TAB_REGISTRY_INITIAL;
+        size_t nBytes = (size_t)nCapacity * sizeof(TabSlot);
+        TabSlot* pNew;
+        if (nCapacity <= pReg->nSlotCapacity || nBytes / sizeof(TabSlot) != nCapacity) return 0;
+        pNew = (TabSlot*)realloc(pReg->pSlots, nBytes);
+        if (!pNew) return 0;
+        pReg->pSlots = pNew;
+        pReg->nSlotCapacity = nCapacity;
+    }
+    memset(&pReg->pSlots[pReg->nSlots], 0, sizeof(TabSlot));
+    *pnSlot = pReg->nSlots++;
+    return 1;
+}
+
+/* Put a slot back on the free list (its state memory stays for the next tab) */
+static void ReleaseSlot(TabRegistry* pReg, uint32_t nSlot) {
+    TabSlot* pSlot = &pReg->pSlots[nSlot];
+    pSlot->bUsed = 0;
+    pSlot->nGeneration++;
+    pSlot->nNextFree = pReg->nFreeHead;
+    pReg->nFreeHead = nSlot + 1;
+}
+
+void* TabRegistryAdd(TabRegistry* pReg, TabHandle* phTab) {
+    TabSlot* pSlot;
+    uint32_t nSlot;
+
+    if (pReg->nCount == pReg->nOrderCapacity) {
+        size_t nCapacity = pReg->nOrderCapacity ? pReg->nOrderCapacity * 2 : TAB_REGISTRY_INITIAL;
+        uint32_t* pNew;
+        if (nCapacity > SIZE_MAX / sizeof(uint32_t)) return NULL;
+        pNew = (uint32_t*)realloc(pReg->pOrder, nCapacity * sizeof(uint32_t));
+        if (!pNew) return NULL;
+        pReg->pOrder = pNew;
+        pReg->nOrderCapacity = nCapacity;
+    }
+    if (!TakeSlot(pReg, &nSlot)) return NULL;
+
+    pSlot = &pReg->pSlots[nSlot];
+    if (!pSlot->pItem) {
+        pSlot->pItem = malloc(pReg->nItemSize ? pReg->nItemSize : 1);
+        if (!pSlot->pItem) {
+            ReleaseSlot(pReg, nSlot);
+            return NULL;
+        }
+    }
+    memset(pSlot->pItem, 0, pReg->nItemSize);
+    pSlot->bUsed = 1;
+    pSlot->nNextFree = 0;
+    pSlot->nIndex = pReg->nCount;
+
+    pReg->pOrder[pReg->nCount++] = nSlot;
+    if (phTab) *phTab = MakeHandle(nSlot, pSlot->nGeneration);
+    return pSlot->pItem;
+}
+
+int TabRegistryRemove(TabRegistry* pReg, size_t nIndex) {
+    uint32_t nSlot;
+
+    if (nIndex >= pReg->nCount) return 0;
+    nSlot = pReg->pOrder[nIndex];
+    memmove(&pReg->pOrder[nIndex], &pReg->pOrder[nIndex + 1], (pReg->nCount - nIndex - 1) * sizeof(uint32_t));
+    pReg->nCount--;
+    for (size_t i = nIndex; i < pReg->nCount; i++) pReg->pSlots[pReg->pOrder[i]].nIndex = i;
+    ReleaseSlot(pReg, nSlot);
+    return 1;
+}
+
+size_t TabRegistryCount(const TabRegistry* pReg) {
+    return pReg->nCount;
+}
+
+void* TabRegistryAt(const TabRegistry* pReg, size_t nIndex) {
+    return nIndex < pReg->nCount ? pReg->pSlots[pReg->pOrder[nIndex]].pItem : NULL;
+}
+
+TabHandle TabRegistryHandleAt(const TabRegistry* pReg, size_t nIndex) {
+    uint32_t nSlot;
+
+    if (nIndex >= pReg->nCount) return TAB_HANDLE_NONE;
+    nSlot = pReg->pOrder[nIndex];
+    return MakeHandle(nSlot, pReg->pSlots[nSlot].nGeneration);
+}
+
+/* Slot of the open tab a handle names (NULL once it has closed) */
+static const TabSlot* SlotOf(const TabRegistry* pReg, TabHandle hTab) {
+    uint64_t nSlot = (hTab & 0xFFFFFFFFu);
+    const TabSlot* pSlot;
+
+    if (nSlot == 0 || nSlot > pReg->nSlots) return NULL;
+    pSlot = &pReg->pSlots[nSlot - 1];
+    if (!pSlot->bUsed || pSlot->nGeneration != (uint32_t)(hTab >> 32)) return NULL;
+    return pSlot;
+}
+
+void* TabRegistryGet(const TabRegistry* pReg, TabHandle hTab) {
+    const TabSlot* pSlot = SlotOf(pReg, hTab);
+    return pSlot ? pSlot->pItem : NULL;
+}
+
+int TabRegistryIndexOf(const TabRegistry* pReg, TabHandle hTab, size_t* pnIndex) {
+    const TabSlot* pSlot = SlotOf(pReg, hTab);
+    if (!pSlot) return 0;
+    *pnIndex = pSlot->nIndex;
+    return 1;
+}
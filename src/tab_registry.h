@@ -0,0 +1,74 @@
+#ifndef TAB_REGISTRY_H
+#define TAB_REGISTRY_H
+
+/*
+ * Open tabs, in tab strip order, with no limit on how many.
+ *
+ * Portable C. Each tab's state lives in a slot of its own that never
+ * moves, so a pointer to it stays good until the tab closes, and closing a
+ * tab copies no other tab's state. Closed slots go on a free list and are
+ * reused, state memory included. A slot's generation changes every time
+ * it is freed, so a TabHandle kept past its tab's close (by a worker or a
+ * posted message) is seen to be stale instead of reaching whichever tab
+ * took the slot over.
+ *
+ * The tab strip order is a separate array of slot numbers: opening a tab
+ * appends one, closing a tab removes one and slides only the slot numbers
+ * after it. Each slot remembers its position, so finding a handle's tab
+ * and where it sits in the strip takes no search.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Names one open tab: slot number and generation (never 0) */
+typedef uint64_t TabHandle;
+
+/* No tab */
+#define TAB_HANDLE_NONE 0
+
+/* One tab's place in the registry */
+typedef struct {
+    void* pItem;                 /* Tab state (kept while the slot is free, for reuse) */
+    uint32_t nGeneration;        /* Changes each time the slot is freed */
+    uint32_t nNextFree;          /* Next free slot, plus one (0 ends the list) */
+    size_t nIndex;               /* Position in the tab strip order (while used) */
+    int bUsed;                   /* Holds an open tab */
+} TabSlot;
+
+/* Registry state (all zero is an empty registry) */
+typedef struct {
+    size_t nItemSize;            /* Bytes of state per tab */
+    TabSlot* pSlots;             /* Every slot, open or free (malloc) */
+    uint32_t nSlots;
+    uint32_t nSlotCapacity;
+    uint32_t nFreeHead;          /* First free slot, plus one (0 if none) */
+    uint32_t* pOrder;            /* Slot of each open tab, in tab strip order (malloc) */
+    size_t nCount;               /* Open tabs */
+    size_t nOrderCapacity;
+} TabRegistry;
+
+void TabRegistryInit(TabRegistry* pReg, size_t nItemSize);
+
+/* Free the registry and every tab's state memory (the caller has released what the states hold) */
+void TabRegistryFree(TabRegistry* pReg);
+
+/* Open a tab at the end of the order, with zeroed state (NULL if out of memory) */
+void* TabRegistryAdd(TabRegistry* pReg, TabHandle* phTab);
+
+/* Close the tab at position nIndex (returns nonzero if there was one) */
+int TabRegistryRemove(TabRegistry* pReg, size_t nIndex);
+
+size_t TabRegistryCount(const TabRegistry* pReg);
+
+/* State and handle of the tab at position nIndex (NULL or TAB_HANDLE_NONE if out of range) */
+void* TabRegistryAt(const TabRegistry* pReg, size_t nIndex);
+TabHandle TabRegistryHandleAt(const TabRegistry* pReg, size_t nIndex);
+
+/* State of the tab a handle names (NULL once it has closed) */
+void* TabRegistryGet(const TabRegistry* pReg, TabHandle hTab);
+
+/* Position of the tab a handle names (returns 0 once it has closed) */
+int TabRegistryIndexOf(const TabRegistry* pReg, TabHandle hTab, size_t* pnIndex);
+
+#endif /* TAB_REGISTRY_H */
@@ -0,0 +1,404 @@
+#include "text_encoding.h"
+#include "transcode.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TEXT_ENCODING_X86 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#endif
+
+/* Every fourth bit of a 64-bit byte mask, starting at bit 0 */
+#define LANE_MASK 0x1111111111111111ULL
+
+/* UTF-32: the top byte is at least (n-1)/n NUL, the plane byte as often 0x10 or below, the lowest byte at most 1/n NUL */
+#define UTF32_ZERO_SHARE 10
+
+/* Highest plane number, the largest value of UTF-32's second byte */
+#define UTF32_MAX_PLANE 0x10
+
+/* UTF-16 high byte lanes are at least 1/n NUL... */
+#define UTF16_ZERO_SHARE 16
+
+/* ...with n times as many NULs as the low byte lanes */
+#define UTF16_ZERO_RATIO 8
+
+/* Text that is neither UTF-8 nor ASCII: UTF-16 if its only NULs (1/n at least) are in the high byte lanes */
+#define UTF16_SPARSE_SHARE 1024
+
+/* Byte counts of a sample, by offset modulo 4 from the start of the file */
+typedef struct {
+    size_t nBytes[4];            /* Bytes sampled */
+    size_t nZero[4];             /* NUL bytes */
+    size_t nPlane[4];            /* Bytes UTF32_MAX_PLANE and below (NUL included) */
+    size_t nHigh;                /* Bytes 0x80 and above (all lanes) */
+} ByteStats;
+
+static inline int Popcount64(uint64_t x) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(x);
+#else
+    int n = 0;
+    while (x) {
+        x &= x - 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+static inline int HostIsBigEndian(void) {
+    const uint16_t n = 1;
+    return *(const uint8_t*)&n == 0;
+}
+
+/* ---- Byte statistics (pData sits at an offset divisible by 4) ---- */
+
+static void CountBytesScalar(const uint8_t* pData, size_t nLen, ByteStats* pStats) {
+    for (size_t i = 0; i < nLen; i++) {
+        pStats->nBytes[i & 3]++;
+        pStats->nZero[i & 3] += pData[i] == 0;
+        pStats->nPlane[i & 3] += pData[i] <= UTF32_MAX_PLANE;
+        pStats->nHigh += pData[i] >> 7;
+    }
+}
+
+#ifdef TEXT_ENCODING_X86
+
+TARGET_SSE2 static void CountBytesSse2(const uint8_t* pData, size_t nLen, ByteStats* pStats) {
+    const __m128i vZero = _mm_setzero_si128();
+    const __m128i vMaxPlane = _mm_set1_epi8(UTF32_MAX_PLANE);
+    size_t i = 0;
+
+    /* 64 bytes at a time: one bit per byte for NUL, for a plane number and for the high bit */
+    for (; i + 64 <= nLen; i += 64) {
+        uint64_t nZero = 0, nPlane = 0, nHigh = 0;
+        for (int k = 0; k < 4; k++) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(pData + i + 16 * k));
+            __m128i vIsPlane = _mm_cmpeq_epi8(_mm_min_epu8(v, vMaxPlane), v);
+            nZero |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vZero)) << (16 * k);
+            nPlane |= (uint64_t)(uint16_t)_mm_movemask_epi8(vIsPlane) << (16 * k);
+            nHigh |= (uint64_t)(uint16_t)_mm_movemask_epi8(v) << (16 * k);
+        }
+        for (int nLane = 0; nLane < 4; nLane++) {
+            pStats->nBytes[nLane] += 16;
+            pStats->nZero[nLane] += (size_t)Popcount64(nZero & (LANE_MASK << nLane));
+            pStats->nPlane[nLane] += (size_t)Popcount64(nPlane & (LANE_MASK << nLane));
+        }
+        pStats->nHigh += (size_t)Popcount64(nHigh);
+    }
+    CountBytesScalar(pData + i, nLen - i, pStats);
+}
+
+#endif
+
+typedef void (*CountBytesProc)(const uint8_t*, size_t, ByteStats*);
+
+static CountBytesProc g_pfnCountBytes = NULL;
+static const char* g_szKernel = NULL;
+
+/* Pick the kernel once (idempotent, so a race is harmless) */
+static CountBytesProc GetCountBytes(void) {
+    if (!g_pfnCountBytes) {
+        CountBytesProc pfnCount = CountBytesScalar;
+        const char* szName = "scalar";
+#ifdef TEXT_ENCODING_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse2")) {
+            pfnCount = CountBytesSse2;
+            szName = "sse2";
+        }
+#endif
+        g_szKernel = szName;
+        g_pfnCountBytes = pfnCount;
+    }
+    return g_pfnCountBytes;
+}
+
+const char* TextEncodingKernelName(void) {
+    GetCountBytes();
+    return g_szKernel;
+}
+
+/* ---- Detection ---- */
+
+/*
+ * Whether a sample is UTF-8. It may start inside a sequence (bCutStart)
+ * or end inside one (bCutEnd) where the file goes on past the sample.
+ */
+static int SampleIsUtf8(const uint8_t* pData, size_t nLen, int bCutStart, int bCutEnd) {
+    uint16_t* pUnits;
+    size_t nUnits, nBad;
+    int bUtf8;
+
+    for (int i = 0; bCutStart && i < 3 && nLen > 0 && (*pData & 0xC0) == 0x80; i++) {
+        pData++;
+        nLen--;
+    }
+    if (nLen == 0) return 1;
+
+    pUnits = (uint16_t*)malloc(nLen * sizeof(uint16_t));
+    if (!pUnits) return 1;
+    bUtf8 = Utf8ToUtf16(pData, nLen, pUnits, &nUnits, &nBad, NULL);
+    if (!bUtf8 && bCutEnd && nBad + 4 > nLen) bUtf8 = 1;
+
+    free(pUnits);
+    return bUtf8;
+}
+
+/* NUL bytes and bytes sampled in the lanes of nLanes (a bit per lane) */
+static void CountLanes(const ByteStats* pStats, unsigned nLanes, size_t* pnZero, size_t* pnBytes) {
+    *pnZero = *pnBytes = 0;
+    for (int nLane = 0; nLane < 4; nLane++) {
+        if (!(nLanes & (1u << nLane))) continue;
+        *pnZero += pStats->nZero[nLane];
+        *pnBytes += pStats->nBytes[nLane];
+    }
+}
+
+/*
+ * UTF-32: the top byte of nearly every character is zero and the next one
+ * a plane number (zero too, outside emoji and rare scripts), while the
+ * lowest byte is almost never zero
+ */
+static int LooksUtf32(const ByteStats* pStats, int nTopLane, int nPlaneLane, int nTextLane) {
+    size_t nTop = pStats->nBytes[nTopLane], nPlane = pStats->nBytes[nPlaneLane];
+
+    return nTop > 0 && nPlane > 0 &&
+           pStats->nZero[nTopLane] * UTF32_ZERO_SHARE >= nTop * (UTF32_ZERO_SHARE - 1) &&
+           pStats->nPlane[nPlaneLane] * UTF32_ZERO_SHARE >= nPlane * (UTF32_ZERO_SHARE - 1) &&
+           pStats->nZero[nTextLane] * UTF32_ZERO_SHARE <= pStats->nBytes[nTextLane];
+}
+
+/*
+ * UTF-16: every ASCII character (spaces and line breaks too) puts a NUL
+ * in the high byte's lane, while NULs in the other lane are rare, so the
+ * pattern holds even for text that is mostly CJK
+ */
+static int LooksUtf16(const ByteStats* pStats, unsigned nZeroLanes) {
+    size_t nZeroIn, nBytesIn, nZeroOut, nBytesOut;
+
+    CountLanes(pStats, nZeroLanes, &nZeroIn, &nBytesIn);
+    CountLanes(pStats, ~nZeroLanes & 0xF, &nZeroOut, &nBytesOut);
+    return nBytesIn > 0 && nZeroIn * UTF16_ZERO_SHARE >= nBytesIn && nZeroOut * UTF16_ZERO_RATIO <= nZeroIn;
+}
+
+/*
+ * UTF-16 with almost no ASCII, such as Chinese with only its line breaks:
+ * a few NULs, all in the high byte lanes. Only asked of samples that are
+ * not UTF-8, and text in a legacy code page has no NULs at all.
+ */
+static int LooksSparseUtf16(const ByteStats* pStats, unsigned nZeroLanes) {
+    size_t nZeroIn, nBytesIn, nZeroOut, nBytesOut;
+
+    CountLanes(pStats, nZeroLanes, &nZeroIn, &nBytesIn);
+    CountLanes(pStats, ~nZeroLanes & 0xF, &nZeroOut, &nBytesOut);
+    return nZeroIn > 0 && nZeroOut == 0 && nZeroIn * UTF16_SPARSE_SHARE >= nBytesIn;
+}
+
+/* A sample that failed the UTF-8 check */
+static int NotUtf8(const ByteStats* pStats) {
+    if (LooksSparseUtf16(pStats, 0xA)) return TEXT_ENCODING_UTF16LE;
+    if (LooksSparseUtf16(pStats, 0x5)) return TEXT_ENCODING_UTF16BE;
+    return TEXT_ENCODING_ANSI;
+}
+
+/* Encoding named by a byte order mark at the start (-1 if none) */
+static int DetectBom(const uint8_t* pData, size_t nSize, size_t* pnBomBytes) {
+    /* UTF-32 LE first: its mark starts with the UTF-16 LE one */
+    if (nSize >= 4 && pData[0] == 0xFF && pData[1] == 0xFE && pData[2] == 0 && pData[3] == 0) {
+        *pnBomBytes = 4;
+        return TEXT_ENCODING_UTF32LE;
+    }
+    if (nSize >= 4 && pData[0] == 0 && pData[1] == 0 && pData[2] == 0xFE && pData[3] == 0xFF) {
+        *pnBomBytes = 4;
+        return TEXT_ENCODING_UTF32BE;
+    }
+    if (nSize >= 3 && pData[0] == 0xEF && pData[1] == 0xBB && pData[2] == 0xBF) {
+        *pnBomBytes = 3;
+        return TEXT_ENCODING_UTF8;
+    }
+    if (nSize >= 2 && pData[0] == 0xFF && pData[1] == 0xFE) {
+        *pnBomBytes = 2;
+        return TEXT_ENCODING_UTF16LE;
+    }
+    if (nSize >= 2 && pData[0] == 0xFE && pData[1] == 0xFF) {
+        *pnBomBytes = 2;
+        return TEXT_ENCODING_UTF16BE;
+    }
+    return -1;
+}
+
+int DetectTextEncoding(const uint8_t* pData, size_t nSize, size_t* pnBomBytes) {
+    CountBytesProc pfnCount = GetCountBytes();
+    ByteStats stats;
+    size_t nHead, nTail;
+    int nEncoding;
+
+    *pnBomBytes = 0;
+    nEncoding = DetectBom(pData, nSize, pnBomBytes);
+    if (nEncoding >= 0) return nEncoding;
+
+    /* The head, and the tail from a 4-byte boundary so the lanes line up (all of a small file) */
+    memset(&stats, 0, sizeof(stats));
+    nHead = nSize < TEXT_DETECT_SAMPLE ? nSize : TEXT_DETECT_SAMPLE;
+    nTail = nSize > 2 * TEXT_DETECT_SAMPLE ? (nSize - TEXT_DETECT_SAMPLE) & ~(size_t)3 : nHead;
+    pfnCount(pData, nHead, &stats);
+    pfnCount(pData + nTail, nSize - nTail, &stats);
+
+    /* Wide text keeps its NULs in fixed lanes */
+    if (LooksUtf32(&stats, 3, 2, 0)) return TEXT_ENCODING_UTF32LE;
+    if (LooksUtf32(&stats, 0, 1, 3)) return TEXT_ENCODING_UTF32BE;
+    if (LooksUtf16(&stats, 0xA)) return TEXT_ENCODING_UTF16LE;
+    if (LooksUtf16(&stats, 0x5)) return TEXT_ENCODING_UTF16BE;
+
+    /* Plain ASCII reads the same either way */
+    if (stats.nHigh == 0) return TEXT_ENCODING_UTF8;
+
+    if (!SampleIsUtf8(pData, nHead, 0, nHead < nSize)) return NotUtf8(&stats);
+    if (nTail < nSize && nTail > 0 && !SampleIsUtf8(pData + nTail, nSize - nTail, 1, 0)) {
+        return NotUtf8(&stats);
+    }
+    return TEXT_ENCODING_UTF8;
+}
+
+size_t TextEncodingBom(int nEncoding, uint8_t* pBom) {
+    switch (nEncoding) {
+        case TEXT_ENCODING_UTF8:
+            pBom[0] = 0xEF;
+            pBom[1] = 0xBB;
+            pBom[2] = 0xBF;
+            return 3;
+        case TEXT_ENCODING_UTF16LE:
+            pBom[0] = 0xFF;
+            pBom[1] = 0xFE;
+            return 2;
+        case TEXT_ENCODING_UTF16BE:
+            pBom[0] = 0xFE;
+            pBom[1] = 0xFF;
+            return 2;
+        case TEXT_ENCODING_UTF32LE:
+            pBom[0] = 0xFF;
+            pBom[1] = 0xFE;
+            pBom[2] = pBom[3] = 0;
+            return 4;
+        case TEXT_ENCODING_UTF32BE:
+            pBom[0] = pBom[1] = 0;
+            pBom[2] = 0xFE;
+            pBom[3] = 0xFF;
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+int IsWideEncoding(int nEncoding) {
+    return nEncoding >= TEXT_ENCODING_UTF16LE && nEncoding <= TEXT_ENCODING_UTF32BE;
+}
+
+int IsNativeEncoding(int nEncoding) {
+    return nEncoding == (HostIsBigEndian() ? TEXT_ENCODING_UTF16BE : TEXT_ENCODING_UTF16LE);
+}
+
+/* ---- Conversion ---- */
+
+size_t Utf16FromBytes(const uint8_t* pSrc, size_t nSrc, int bBigEndian, uint16_t* pDst) {
+    size_t nUnits = nSrc / 2;
+
+    if (!bBigEndian == !HostIsBigEndian()) {
+        memcpy(pDst, pSrc, nUnits * sizeof(uint16_t));
+    } else if (bBigEndian) {
+        for (size_t i = 0; i < nUnits; i++) pDst[i] = (uint16_t)((pSrc[2 * i] << 8) | pSrc[2 * i + 1]);
+    } else {
+        for (size_t i = 0; i < nUnits; i++) pDst[i] = (uint16_t)(pSrc[2 * i] | (pSrc[2 * i + 1] << 8));
+    }
+    if (nSrc & 1) pDst[nUnits++] = 0xFFFD;
+    return nUnits;
+}
+
+void Utf16ToBytes(const uint16_t* pSrc, size_t nUnits, int bBigEndian, uint8_t* pDst) {
+    if (!bBigEndian == !HostIsBigEndian()) {
+        memcpy(pDst, pSrc, nUnits * sizeof(uint16_t));
+        return;
+    }
+    for (size_t i = 0; i < nUnits; i++) {
+        pDst[2 * i + (bBigEndian ? 1 : 0)] = (uint8_t)(pSrc[i] & 0xFF);
+        pDst[2 * i + (bBigEndian ? 0 : 1)] = (uint8_t)(pSrc[i] >> 8);
+    }
+}
+
+size_t Utf32ToUtf16(const uint8_t* pSrc, size_t nSrc, int bBigEndian, uint16_t* pDst) {
+    size_t nChars = nSrc / 4;
+    size_t nOut = 0;
+
+    for (size_t i = 0; i < nChars; i++, pSrc += 4) {
+        uint32_t nCode = bBigEndian
+            ? ((uint32_t)pSrc[0] << 24) | ((uint32_t)pSrc[1] << 16) | ((uint32_t)pSrc[2] << 8) | pSrc[3]
+            : ((uint32_t)pSrc[3] << 24) | ((uint32_t)pSrc[2] << 16) | ((uint32_t)pSrc[1] << 8) | pSrc[0];
+
+        if (nCode < 0x10000) {
+            pDst[nOut++] = (nCode >= 0xD800 && nCode <= 0xDFFF) ? 0xFFFD : (uint16_t)nCode;
+        } else if (nCode <= 0x10FFFF) {
+            nCode -= 0x10000;
+            pDst[nOut++] = (uint16_t)(0xD800 + (nCode >> 10));
+            pDst[nOut++] = (uint16_t)(0xDC00 + (nCode & 0x3FF));
+        } else {
+            pDst[nOut++] = 0xFFFD;
+        }
+    }
+    if (nSrc & 3) pDst[nOut++] = 0xFFFD;
+    return nOut;
+}
+
+/* Store one character as UTF-32 */
+static void PutUtf32(uint8_t* pDst, uint32_t nCode, int bBigEndian) {
+    for (int i = 0; i < 4; i++) pDst[bBigEndian ? 3 - i : i] = (uint8_t)(nCode >> (8 * i));
+}
+
+void Utf32EncoderInit(Utf32Encoder* pEncoder, int bBigEndian) {
+    pEncoder->nPendingHigh = 0;
+    pEncoder->bBigEndian = bBigEndian;
+}
+
+size_t Utf32EncoderEncode(Utf32Encoder* pEncoder, const uint16_t* pSrc, size_t nSrc,
+                          uint8_t* pDst, size_t nDstSize, size_t* pnWritten) {
+    size_t i = 0;
+    size_t nOut = 0;
+
+    while (i < nSrc && nDstSize - nOut >= 4) {
+        uint16_t u = pSrc[i];
+
+        if (pEncoder->nPendingHigh) {
+            if (u >= 0xDC00 && u <= 0xDFFF) {
+                uint32_t nCode = 0x10000 + (((uint32_t)pEncoder->nPendingHigh - 0xD800) << 10) + (u - 0xDC00);
+                PutUtf32(pDst + nOut, nCode, pEncoder->bBigEndian);
+                i++;
+            } else {
+                /* High surrogate without a low half; u is handled on the next step */
+                PutUtf32(pDst + nOut, 0xFFFD, pEncoder->bBigEndian);
+            }
+            nOut += 4;
+            pEncoder->nPendingHigh = 0;
+            continue;
+        }
+
+        if (u >= 0xD800 && u <= 0xDBFF) {
+            pEncoder->nPendingHigh = u;
+        } else {
+            PutUtf32(pDst + nOut, (u >= 0xDC00 && u <= 0xDFFF) ? 0xFFFD : u, pEncoder->bBigEndian);
+            nOut += 4;
+        }
+        i++;
+    }
+
+    *pnWritten = nOut;
+    return i;
+}
+
+size_t Utf32EncoderFinish(Utf32Encoder* pEncoder, uint8_t* pDst) {
+    if (!pEncoder->nPendingHigh) return 0;
+    pEncoder->nPendingHigh = 0;
+    PutUtf32(pDst, 0xFFFD, pEncoder->bBigEndian);
+    return 4;
+}
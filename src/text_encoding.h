@@ -0,0 +1,88 @@
+#ifndef TEXT_ENCODING_H
+#define TEXT_ENCODING_H
+
+/*
+ * Text encodings other than UTF-8: detection, and conversion between
+ * UTF-16 and the UTF-16 / UTF-32 byte forms.
+ *
+ * Portable C. Detection goes by the byte order mark if there is one.
+ * Otherwise it looks at a block from the start of the file and one from
+ * the end, never the whole file. It counts NUL bytes by offset modulo
+ * four, because UTF-16 and UTF-32 text puts its zero bytes in fixed lanes,
+ * and likewise bytes no larger than a UTF-32 plane number (0x10), so UTF-32
+ * full of emoji is caught too. It also counts bytes with the high bit set.
+ * The counting uses SSE2 when the CPU has it. A sample with high bytes is then checked for UTF-8
+ * structure. The answer is a best guess: a file that looks like UTF-8 can
+ * still fail a strict decode further in, and the caller falls back to the
+ * legacy code page then.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Encodings (stored in tab state and the session file: keep the values) */
+#define TEXT_ENCODING_UTF8    0
+#define TEXT_ENCODING_UTF16LE 1
+#define TEXT_ENCODING_UTF16BE 2
+#define TEXT_ENCODING_UTF32LE 3
+#define TEXT_ENCODING_UTF32BE 4
+#define TEXT_ENCODING_ANSI    5  /* Legacy single- or double-byte code page */
+
+/* Bytes sampled at each end of a file without a byte order mark */
+#define TEXT_DETECT_SAMPLE (64 * 1024)
+
+/*
+ * Guess the encoding of nSize bytes. *pnBomBytes receives the length of
+ * the byte order mark at the start (0 if none).
+ */
+int DetectTextEncoding(const uint8_t* pData, size_t nSize, size_t* pnBomBytes);
+
+/* Byte order mark of an encoding (returns its length; 0 for ANSI) */
+size_t TextEncodingBom(int nEncoding, uint8_t* pBom);
+
+/* Whether text in an encoding is made of 16- or 32-bit code units */
+int IsWideEncoding(int nEncoding);
+
+/* Whether text in an encoding has the same bytes as UTF-16 in memory (UTF-16 in the host's byte order) */
+int IsNativeEncoding(int nEncoding);
+
+/*
+ * Decode nSrc bytes of UTF-16 in the given byte order into pDst, which
+ * must hold (nSrc + 1) / 2 units. An odd last byte becomes U+FFFD. Returns
+ * the units stored.
+ */
+size_t Utf16FromBytes(const uint8_t* pSrc, size_t nSrc, int bBigEndian, uint16_t* pDst);
+
+/* Store nUnits units as UTF-16 bytes in the given byte order (2 * nUnits bytes) */
+void Utf16ToBytes(const uint16_t* pSrc, size_t nUnits, int bBigEndian, uint8_t* pDst);
+
+/*
+ * Decode nSrc bytes of UTF-32 in the given byte order into pDst, which
+ * must hold nSrc / 2 + 1 units. Characters above U+10FFFF, surrogates and
+ * a partial last character become U+FFFD. Returns the units stored.
+ */
+size_t Utf32ToUtf16(const uint8_t* pSrc, size_t nSrc, int bBigEndian, uint16_t* pDst);
+
+/* Streaming UTF-16 to UTF-32 encoder; a surrogate pair may span calls */
+typedef struct {
+    uint16_t nPendingHigh;       /* High surrogate waiting for its low half (0 if none) */
+    int bBigEndian;              /* Byte order written */
+} Utf32Encoder;
+
+void Utf32EncoderInit(Utf32Encoder* pEncoder, int bBigEndian);
+
+/*
+ * Encode units from pSrc into pDst until the input is used up or fewer
+ * than 4 bytes of room remain. Returns the units consumed and stores the
+ * bytes written in *pnWritten. Unpaired surrogates become U+FFFD.
+ */
+size_t Utf32EncoderEncode(Utf32Encoder* pEncoder, const uint16_t* pSrc, size_t nSrc,
+                          uint8_t* pDst, size_t nDstSize, size_t* pnWritten);
+
+/* End of input: returns bytes written to pDst (room for 4 needed) */
+size_t Utf32EncoderFinish(Utf32Encoder* pEncoder, uint8_t* pDst);
+
+/* Name of the statistics kernel picked for this CPU ("sse2" or "scalar") */
+const char* TextEncodingKernelName(void);
+
+#endif /* TEXT_ENCODING_H */
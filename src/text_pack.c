@@ -0,0 +1,286 @@
+#include "text_pack.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Compressed stream: a sequence of
+ *
+ *   token | literal length extension | literals | offset | match length extension
+ *
+ * The token's high nibble is the literal count and its low nibble the match
+ * length minus LZ_MIN_MATCH; 15 in either means extension bytes follow,
+ * each added on until one is below 255. The offset is two bytes, little
+ * endian, counted back from the end of the output. The last sequence has
+ * literals only: the input ends right after them.
+ */
+
+/* Shortest back reference */
+#define LZ_MIN_MATCH 4
+
+/* Farthest back reference */
+#define LZ_MAX_OFFSET 65535
+
+/* Match finder table size, as a power of two */
+#define LZ_HASH_BITS 12
+
+/* Misses before the match finder starts skipping ahead (incompressible data goes fast) */
+#define LZ_SKIP_TRIGGER 6
+
+static inline uint32_t Read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t HashOf(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Write the extension bytes of a length (returns NULL if out of room) */
+static uint8_t* PutExtension(uint8_t* pOut, const uint8_t* pEnd, size_t nLen) {
+    while (nLen >= 255) {
+        if (pOut == pEnd) return NULL;
+        *pOut++ = 255;
+        nLen -= 255;
+    }
+    if (pOut == pEnd) return NULL;
+    *pOut++ = (uint8_t)nLen;
+    return pOut;
+}
+
+/* Write one sequence; nMatch 0 makes it the last (returns NULL if out of room) */
+static uint8_t* PutSequence(uint8_t* pOut, const uint8_t* pEnd, const uint8_t* pLiterals, size_t nLiterals,
+                            size_t nMatch, size_t nOffset) {
+    size_t nMatchCode = nMatch ? nMatch - LZ_MIN_MATCH : 0;
+
+    if (pOut == pEnd) return NULL;
+    *pOut++ = (uint8_t)(((nLiterals < 15 ? nLiterals : 15) << 4) | (nMatchCode < 15 ? nMatchCode : 15));
+    if (nLiterals >= 15 && !(pOut = PutExtension(pOut, pEnd, nLiterals - 15))) return NULL;
+    if ((size_t)(pEnd - pOut) < nLiterals) return NULL;
+    memcpy(pOut, pLiterals, nLiterals);
+    pOut += nLiterals;
+    if (!nMatch) return pOut;
+
+    if (pEnd - pOut < 2) return NULL;
+    *pOut++ = (uint8_t)(nOffset & 0xFF);
+    *pOut++ = (uint8_t)(nOffset >> 8);
+    if (nMatchCode >= 15 && !(pOut = PutExtension(pOut, pEnd, nMatchCode - 15))) return NULL;
+    return pOut;
+}
+
+size_t LzCompressBound(size_t nLen) {
+    return nLen + nLen / 255 + 16;
+}
+
+size_t LzCompress(const uint8_t* pSrc, size_t nLen, uint8_t* pDst, size_t nCapacity) {
+    uint32_t table[1 << LZ_HASH_BITS];
+    const uint8_t* pEnd = pDst + nCapacity;
+    uint8_t* pOut = pDst;
+    size_t nAnchor = 0, i = 0;
+    unsigned nMisses = 0;
+
+    if (nLen > UINT32_MAX) return 0;
+    memset(table, 0, sizeof(table));
+
+    while (nLen >= LZ_MIN_MATCH && i <= nLen - LZ_MIN_MATCH) {
+        uint32_t v = Read32(pSrc + i);
+        uint32_t h = HashOf(v);
+        size_t nCandidate = table[h];
+
+        table[h] = (uint32_t)i;
+        if (nCandidate < i && i - nCandidate <= LZ_MAX_OFFSET && Read32(pSrc + nCandidate) == v) {
+            size_t nMatch = LZ_MIN_MATCH;
+
+            while (i + nMatch < nLen && pSrc[nCandidate + nMatch] == pSrc[i + nMatch]) nMatch++;
+
+            /* Literals just before the match may belong to it */
+            while (i > nAnchor && nCandidate > 0 && pSrc[i - 1] == pSrc[nCandidate - 1]) {
+                i--;
+                nCandidate--;
+                nMatch++;
+            }
+
+            pOut = PutSequence(pOut, pEnd, pSrc + nAnchor, i - nAnchor, nMatch, i - nCandidate);
+            if (!pOut) return 0;
+            i += nMatch;
+            nAnchor = i;
+            nMisses = 0;
+
+            /* Seed the table inside the match so the next one can start there */
+            if (i - 2 <= nLen - LZ_MIN_MATCH) table[HashOf(Read32(pSrc + i - 2))] = (uint32_t)(i - 2);
+        } else {
+            nMisses++;
+            i += 1 + (nMisses >> LZ_SKIP_TRIGGER);
+        }
+    }
+
+    if (nAnchor < nLen) {
+        pOut = PutSequence(pOut, pEnd, pSrc + nAnchor, nLen - nAnchor, 0, 0);
+        if (!pOut) return 0;
+    }
+    return (size_t)(pOut - pDst);
+}
+
+/* Read the extension bytes of a length onto *pnLen (returns NULL on truncated input) */
+static const uint8_t* GetExtension(const uint8_t* pIn, const uint8_t* pEnd, size_t* pnLen) {
+    uint8_t b;
+
+    do {
+        if (pIn == pEnd) return NULL;
+        b = *pIn++;
+        *pnLen += b;
+    } while (b == 255);
+    return pIn;
+}
+
+int LzDecompress(const uint8_t* pSrc, size_t nLen, uint8_t* pDst, size_t nDstLen) {
+    const uint8_t* pIn = pSrc;
+    const uint8_t* pInEnd = pSrc + nLen;
+    uint8_t* pOut = pDst;
+    const uint8_t* pOutEnd = pDst + nDstLen;
+
+    while (pIn < pInEnd) {
+        unsigned nToken = *pIn++;
+        size_t nLiterals = nToken >> 4;
+        size_t nMatch = (nToken & 15) + LZ_MIN_MATCH;
+        size_t nOffset;
+
+        if (nLiterals == 15 && !(pIn = GetExtension(pIn, pInEnd, &nLiterals))) return 0;
+        if (nLiterals > (size_t)(pInEnd - pIn) || nLiterals > (size_t)(pOutEnd - pOut)) return 0;
+        memcpy(pOut, pIn, nLiterals);
+        pIn += nLiterals;
+        pOut += nLiterals;
+        if (pIn == pInEnd) break;
+
+        if (pInEnd - pIn < 2) return 0;
+        nOffset = pIn[0] | ((size_t)pIn[1] << 8);
+        pIn += 2;
+        if ((nToken & 15) == 15 && !(pIn = GetExtension(pIn, pInEnd, &nMatch))) return 0;
+        if (nOffset == 0 || nOffset > (size_t)(pOut - pDst) || nMatch > (size_t)(pOutEnd - pOut)) return 0;
+
+        if (nOffset >= nMatch) {
+            memcpy(pOut, pOut - nOffset, nMatch);
+        } else {
+            /* Overlapping: the match repeats the last nOffset bytes */
+            const uint8_t* pFrom = pOut - nOffset;
+            for (size_t i = 0; i < nMatch; i++) pOut[i] = pFrom[i];
+        }
+        pOut += nMatch;
+    }
+    return pOut == pOutEnd;
+}
+
+/* Compress one frame of nUnits units; pBytes and pScratch are scratch space */
+static int PackFrame(TextPackFrame* pFrame, const TextUnit* pUnits, size_t nUnits,
+                     uint8_t* pBytes, uint8_t* pScratch, size_t nScratch) {
+    int bNarrow = 1;
+    size_t nRaw, nPacked;
+    const uint8_t* pKeep;
+
+    for (size_t i = 0; i < nUnits; i++) {
+        if (pUnits[i] > 0xFF) {
+            bNarrow = 0;
+            break;
+        }
+    }
+    if (bNarrow) {
+        for (size_t i = 0; i < nUnits; i++) pBytes[i] = (uint8_t)pUnits[i];
+        nRaw = nUnits;
+    } else {
+        for (size_t i = 0; i < nUnits; i++) {
+            pBytes[i] = (uint8_t)(pUnits[i] & 0xFF);
+            pBytes[nUnits + i] = (uint8_t)(pUnits[i] >> 8);
+        }
+        nRaw = nUnits * 2;
+    }
+
+    nPacked = LzCompress(pBytes, nRaw, pScratch, nScratch);
+    pFrame->nMode = bNarrow ? TEXT_PACK_NARROW : 0;
+    if (nPacked && nPacked < nRaw) {
+        pFrame->nMode |= TEXT_PACK_LZ;
+        pKeep = pScratch;
+    } else {
+        nPacked = nRaw;
+        pKeep = pBytes;
+    }
+
+    pFrame->pData = (uint8_t*)malloc(nPacked ? nPacked : 1);
+    if (!pFrame->pData) return 0;
+    memcpy(pFrame->pData, pKeep, nPacked);
+    pFrame->nBytes = (uint32_t)nPacked;
+    pFrame->nUnits = (uint32_t)nUnits;
+    return 1;
+}
+
+int TextPackDocument(TextPack* pPack, const PieceTable* pDoc) {
+    size_t nLen = PieceTableLength(pDoc);
+    size_t nFrames = (nLen + TEXT_PACK_FRAME_UNITS - 1) / TEXT_PACK_FRAME_UNITS;
+    size_t nScratch = LzCompressBound(TEXT_PACK_FRAME_UNITS * 2);
+    TextUnit* pUnits;
+    uint8_t* pBytes;
+    uint8_t* pScratch;
+    int bOk = 1;
+
+    memset(pPack, 0, sizeof(*pPack));
+    pPack->pFrames = (TextPackFrame*)calloc(nFrames ? nFrames : 1, sizeof(TextPackFrame));
+    pUnits = (TextUnit*)malloc(TEXT_PACK_FRAME_UNITS * sizeof(TextUnit));
+    pBytes = (uint8_t*)malloc(TEXT_PACK_FRAME_UNITS * 2);
+    pScratch = (uint8_t*)malloc(nScratch);
+    if (!pPack->pFrames || !pUnits || !pBytes || !pScratch) bOk = 0;
+
+    for (size_t i = 0; bOk && i < nFrames; i++) {
+        size_t nOffset = i * TEXT_PACK_FRAME_UNITS;
+        size_t nUnits = nLen - nOffset < TEXT_PACK_FRAME_UNITS ? nLen - nOffset : TEXT_PACK_FRAME_UNITS;
+
+        PieceTableCopy(pDoc, nOffset, pUnits, nUnits);
+        if (!PackFrame(&pPack->pFrames[i], pUnits, nUnits, pBytes, pScratch, nScratch)) {
+            bOk = 0;
+            break;
+        }
+        pPack->nFrames = i + 1;
+        pPack->nBytes += pPack->pFrames[i].nBytes;
+    }
+    pPack->nUnits = nLen;
+
+    free(pUnits);
+    free(pBytes);
+    free(pScratch);
+    if (!bOk) TextPackFree(pPack);
+    return bOk;
+}
+
+int TextPackUnpack(const TextPack* pPack, TextUnit* pDest) {
+    uint8_t* pBytes = (uint8_t*)malloc(TEXT_PACK_FRAME_UNITS * 2);
+    int bOk = pBytes != NULL;
+
+    for (size_t i = 0; bOk && i < pPack->nFrames; i++) {
+        const TextPackFrame* pFrame = &pPack->pFrames[i];
+        size_t nUnits = pFrame->nUnits;
+        size_t nRaw = (pFrame->nMode & TEXT_PACK_NARROW) ? nUnits : nUnits * 2;
+        const uint8_t* pRaw = pFrame->pData;
+
+        if (pFrame->nMode & TEXT_PACK_LZ) {
+            if (!LzDecompress(pFrame->pData, pFrame->nBytes, pBytes, nRaw)) {
+                bOk = 0;
+                break;
+            }
+            pRaw = pBytes;
+        }
+
+        if (pFrame->nMode & TEXT_PACK_NARROW) {
+            for (size_t j = 0; j < nUnits; j++) pDest[j] = pRaw[j];
+        } else {
+            for (size_t j = 0; j < nUnits; j++) pDest[j] = (TextUnit)(pRaw[j] | (pRaw[nUnits + j] << 8));
+        }
+        pDest += nUnits;
+    }
+
+    free(pBytes);
+    return bOk;
+}
+
+void TextPackFree(TextPack* pPack) {
+    for (size_t i = 0; i < pPack->nFrames; i++) free(pPack->pFrames[i].pData);
+    free(pPack->pFrames);
+    memset(pPack, 0, sizeof(*pPack));
+}
@@ -0,0 +1,61 @@
+#ifndef TEXT_PACK_H
+#define TEXT_PACK_H
+
+/*
+ * Compressed copy of a document, for tabs that hibernate.
+ *
+ * Portable C. The text is cut into frames of TEXT_PACK_FRAME_UNITS units
+ * and each frame is compressed on its own with a small LZ77 codec in the
+ * LZ4 mould: byte-aligned runs of literals and 16-bit back references, no
+ * entropy stage, so decoding is little more than memcpy. A frame whose
+ * units all fit in 8 bits (most logs and source files) is first narrowed
+ * to one byte per unit; any other frame is split into a plane of low bytes
+ * followed by a plane of high bytes, which keeps the repetitive high bytes
+ * together. A frame that does not shrink is kept as it is.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "piece_table.h"
+
+/* Units per frame */
+#define TEXT_PACK_FRAME_UNITS (64 * 1024)
+
+/* Frame modes */
+#define TEXT_PACK_NARROW 0x01    /* One byte per unit (otherwise low plane, then high plane) */
+#define TEXT_PACK_LZ     0x02    /* Compressed (otherwise stored) */
+
+/* One compressed frame */
+typedef struct {
+    uint8_t* pData;              /* Frame bytes (malloc) */
+    uint32_t nBytes;
+    uint32_t nUnits;             /* Units it decodes to */
+    unsigned nMode;              /* TEXT_PACK_ flags */
+} TextPackFrame;
+
+/* Compressed text */
+typedef struct {
+    TextPackFrame* pFrames;      /* In document order (malloc) */
+    size_t nFrames;
+    size_t nUnits;               /* Units of the whole text */
+    size_t nBytes;               /* Compressed bytes of all frames */
+} TextPack;
+
+/* Most bytes LzCompress can produce from nLen */
+size_t LzCompressBound(size_t nLen);
+
+/* Compress nLen bytes (returns the compressed size, or 0 if it would not fit in nCapacity) */
+size_t LzCompress(const uint8_t* pSrc, size_t nLen, uint8_t* pDst, size_t nCapacity);
+
+/* Decompress into exactly nDstLen bytes (returns nonzero on success; corrupt input fails) */
+int LzDecompress(const uint8_t* pSrc, size_t nLen, uint8_t* pDst, size_t nDstLen);
+
+/* Compress a whole document (returns nonzero on success) */
+int TextPackDocument(TextPack* pPack, const PieceTable* pDoc);
+
+/* Decompress the text into pDest, which holds pPack->nUnits units (returns nonzero on success) */
+int TextPackUnpack(const TextPack* pPack, TextUnit* pDest);
+
+void TextPackFree(TextPack* pPack);
+
+#endif /* TEXT_PACK_H */
@@ -0,0 +1,386 @@
+#include "text_scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TEXT_SCAN_X86 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+/* Units classified per step */
+#define BLOCK_UNITS 64
+
+/* ---- Bit helpers ---- */
+
+static inline int Popcount64(uint64_t x) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(x);
+#else
+    int n = 0;
+    while (x) {
+        x &= x - 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+static inline int Ctz64(uint64_t x) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(x);
+#else
+    int n = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+/* ---- Shared block logic ---- */
+
+/*
+ * Account for one block of nBits units whose CR and LF positions are given
+ * as bit masks (bit i = unit i). A CR in the last bit is left pending until
+ * the next block shows whether an LF follows.
+ */
+static inline void ProcessBlock(TextScan* pScan, uint64_t nCR, uint64_t nLF, int nBits) {
+    int bPendingIn = pScan->bPendingCR;
+
+    if (!(nCR | nLF) && !bPendingIn) {
+        pScan->nPos += (size_t)nBits;
+        return;
+    }
+
+    pScan->nCR += (size_t)Popcount64(nCR);
+    pScan->nLF += (size_t)Popcount64(nLF);
+    pScan->nCRLF += (size_t)Popcount64(nCR & (nLF >> 1)) + (size_t)(bPendingIn & (int)(nLF & 1));
+
+    if (pScan->pfnBreak) {
+        size_t nBase = pScan->nPos;
+        uint64_t nAll = nCR | nLF;
+
+        /* A pending CR not followed by LF is a break of its own */
+        if (bPendingIn && !(nLF & 1)) {
+            pScan->pfnBreak(pScan->pContext, nBase, LINE_BREAK_CR);
+        }
+
+        while (nAll) {
+            int i = Ctz64(nAll);
+            uint64_t nBit = (uint64_t)1 << i;
+            nAll &= nAll - 1;
+
+            if (nCR & nBit) {
+                if (i + 1 == nBits) break; /* Pending */
+                if (nLF & (nBit << 1)) {
+                    pScan->pfnBreak(pScan->pContext, nBase + (size_t)i + 2, LINE_BREAK_CRLF);
+                    nAll &= ~(nBit << 1);
+                } else {
+                    pScan->pfnBreak(pScan->pContext, nBase + (size_t)i + 1, LINE_BREAK_CR);
+                }
+            } else {
+                pScan->pfnBreak(pScan->pContext, nBase + (size_t)i + 1,
+                                (i == 0 && bPendingIn) ? LINE_BREAK_CRLF : LINE_BREAK_LF);
+            }
+        }
+    }
+
+    pScan->bPendingCR = (int)((nCR >> (nBits - 1)) & 1);
+    pScan->nPos += (size_t)nBits;
+}
+
+/* Count word starts in one block given its whitespace mask */
+static inline size_t WordsInBlock(uint64_t nSpace, int nBits, int* pbInWord) {
+    uint64_t nValid = (nBits == BLOCK_UNITS) ? ~(uint64_t)0 : (((uint64_t)1 << nBits) - 1);
+    uint64_t nWord = ~nSpace & nValid;
+    uint64_t nStarts = nWord & ~((nWord << 1) | (uint64_t)(*pbInWord != 0));
+
+    *pbInWord = (int)((nWord >> (nBits - 1)) & 1);
+    return (size_t)Popcount64(nStarts);
+}
+
+static inline int IsWordSpace(uint16_t u) {
+    return u == ' ' || u == '\t' || u == '\r' || u == '\n';
+}
+
+/* ---- Scalar kernel ---- */
+
+static void ScanBytesScalar(TextScan* pScan, const uint8_t* pText, size_t nLen) {
+    while (nLen > 0) {
+        int nBits = nLen < BLOCK_UNITS ? (int)nLen : BLOCK_UNITS;
+        uint64_t nCR = 0, nLF = 0;
+        for (int i = 0; i < nBits; i++) {
+            nCR |= (uint64_t)(pText[i] == '\r') << i;
+            nLF |= (uint64_t)(pText[i] == '\n') << i;
+        }
+        ProcessBlock(pScan, nCR, nLF, nBits);
+        pText += nBits;
+        nLen -= (size_t)nBits;
+    }
+}
+
+static void ScanUnitsScalar(TextScan* pScan, const uint16_t* pText, size_t nLen) {
+    while (nLen > 0) {
+        int nBits = nLen < BLOCK_UNITS ? (int)nLen : BLOCK_UNITS;
+        uint64_t nCR = 0, nLF = 0;
+        for (int i = 0; i < nBits; i++) {
+            nCR |= (uint64_t)(pText[i] == '\r') << i;
+            nLF |= (uint64_t)(pText[i] == '\n') << i;
+        }
+        ProcessBlock(pScan, nCR, nLF, nBits);
+        pText += nBits;
+        nLen -= (size_t)nBits;
+    }
+}
+
+static size_t CountWordsScalar(const uint16_t* pText, size_t nLen, int* pbInWord) {
+    size_t nWords = 0;
+    while (nLen > 0) {
+        int nBits = nLen < BLOCK_UNITS ? (int)nLen : BLOCK_UNITS;
+        uint64_t nSpace = 0;
+        for (int i = 0; i < nBits; i++) {
+            nSpace |= (uint64_t)IsWordSpace(pText[i]) << i;
+        }
+        nWords += WordsInBlock(nSpace, nBits, pbInWord);
+        pText += nBits;
+        nLen -= (size_t)nBits;
+    }
+    return nWords;
+}
+
+#ifdef TEXT_SCAN_X86
+
+/* ---- SSE2 kernel ---- */
+
+TARGET_SSE2 static inline uint64_t MaskBytesSse2(const uint8_t* p, __m128i vChar) {
+    uint64_t m0 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), vChar));
+    uint64_t m1 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), vChar));
+    uint64_t m2 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 32)), vChar));
+    uint64_t m3 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 48)), vChar));
+    return m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+}
+
+/* 16 units -> 16 mask bits; 0xFFFF compare lanes saturate to 0xFF when packed */
+TARGET_SSE2 static inline uint64_t Mask16UnitsSse2(const uint16_t* p, __m128i vChar) {
+    __m128i a = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)p), vChar);
+    __m128i b = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(p + 8)), vChar);
+    return (uint16_t)_mm_movemask_epi8(_mm_packs_epi16(a, b));
+}
+
+TARGET_SSE2 static inline uint64_t MaskUnitsSse2(const uint16_t* p, __m128i vChar) {
+    return Mask16UnitsSse2(p, vChar) | (Mask16UnitsSse2(p + 16, vChar) << 16) |
+           (Mask16UnitsSse2(p + 32, vChar) << 32) | (Mask16UnitsSse2(p + 48, vChar) << 48);
+}
+
+TARGET_SSE2 static void ScanBytesSse2(TextScan* pScan, const uint8_t* pText, size_t nLen) {
+    const __m128i vCR = _mm_set1_epi8('\r');
+    const __m128i vLF = _mm_set1_epi8('\n');
+    size_t i = 0;
+
+    for (; i + BLOCK_UNITS <= nLen; i += BLOCK_UNITS) {
+        ProcessBlock(pScan, MaskBytesSse2(pText + i, vCR), MaskBytesSse2(pText + i, vLF), BLOCK_UNITS);
+    }
+    ScanBytesScalar(pScan, pText + i, nLen - i);
+}
+
+TARGET_SSE2 static void ScanUnitsSse2(TextScan* pScan, const uint16_t* pText, size_t nLen) {
+    const __m128i vCR = _mm_set1_epi16('\r');
+    const __m128i vLF = _mm_set1_epi16('\n');
+    size_t i = 0;
+
+    for (; i + BLOCK_UNITS <= nLen; i += BLOCK_UNITS) {
+        ProcessBlock(pScan, MaskUnitsSse2(pText + i, vCR), MaskUnitsSse2(pText + i, vLF), BLOCK_UNITS);
+    }
+    ScanUnitsScalar(pScan, pText + i, nLen - i);
+}
+
+TARGET_SSE2 static inline uint64_t Space16UnitsSse2(const uint16_t* p) {
+    const __m128i vSpace = _mm_set1_epi16(' ');
+    const __m128i vTab = _mm_set1_epi16('\t');
+    const __m128i vCR = _mm_set1_epi16('\r');
+    const __m128i vLF = _mm_set1_epi16('\n');
+    __m128i a = _mm_loadu_si128((const __m128i*)p);
+    __m128i b = _mm_loadu_si128((const __m128i*)(p + 8));
+    __m128i sa = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi16(a, vSpace), _mm_cmpeq_epi16(a, vTab)),
+                              _mm_or_si128(_mm_cmpeq_epi16(a, vCR), _mm_cmpeq_epi16(a, vLF)));
+    __m128i sb = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi16(b, vSpace), _mm_cmpeq_epi16(b, vTab)),
+                              _mm_or_si128(_mm_cmpeq_epi16(b, vCR), _mm_cmpeq_epi16(b, vLF)));
+    return (uint16_t)_mm_movemask_epi8(_mm_packs_epi16(sa, sb));
+}
+
+TARGET_SSE2 static size_t CountWordsSse2(const uint16_t* pText, size_t nLen, int* pbInWord) {
+    size_t nWords = 0;
+    size_t i = 0;
+
+    for (; i + BLOCK_UNITS <= nLen; i += BLOCK_UNITS) {
+        uint64_t nSpace = Space16UnitsSse2(pText + i) | (Space16UnitsSse2(pText + i + 16) << 16) |
+                          (Space16UnitsSse2(pText + i + 32) << 32) | (Space16UnitsSse2(pText + i + 48) << 48);
+        nWords += WordsInBlock(nSpace, BLOCK_UNITS, pbInWord);
+    }
+    return nWords + CountWordsScalar(pText + i, nLen - i, pbInWord);
+}
+
+/* ---- AVX2 kernel ---- */
+
+TARGET_AVX2 static inline uint64_t MaskBytesAvx2(const uint8_t* p, __m256i vChar) {
+    uint64_t m0 = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), vChar));
+    uint64_t m1 = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 32)), vChar));
+    return m0 | (m1 << 32);
+}
+
+/* 32 units -> 32 mask bits; packs works per 128-bit lane, so restore order */
+TARGET_AVX2 static inline uint64_t Pack32Avx2(__m256i a, __m256i b) {
+    __m256i v = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xD8);
+    return (uint32_t)_mm256_movemask_epi8(v);
+}
+
+TARGET_AVX2 static inline uint64_t MaskUnitsAvx2(const uint16_t* p, __m256i vChar) {
+    __m256i a = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)p), vChar);
+    __m256i b = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)(p + 16)), vChar);
+    __m256i c = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)(p + 32)), vChar);
+    __m256i d = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)(p + 48)), vChar);
+    return Pack32Avx2(a, b) | (Pack32Avx2(c, d) << 32);
+}
+
+TARGET_AVX2 static void ScanBytesAvx2(TextScan* pScan, const uint8_t* pText, size_t nLen) {
+    const __m256i vCR = _mm256_set1_epi8('\r');
+    const __m256i vLF = _mm256_set1_epi8('\n');
+    size_t i = 0;
+
+    for (; i + BLOCK_UNITS <= nLen; i += BLOCK_UNITS) {
+        ProcessBlock(pScan, MaskBytesAvx2(pText + i, vCR), MaskBytesAvx2(pText + i, vLF), BLOCK_UNITS);
+    }
+    ScanBytesScalar(pScan, pText + i, nLen - i);
+}
+
+TARGET_AVX2 static void ScanUnitsAvx2(TextScan* pScan, const uint16_t* pText, size_t nLen) {
+    const __m256i vCR = _mm256_set1_epi16('\r');
+    const __m256i vLF = _mm256_set1_epi16('\n');
+    size_t i = 0;
+
+    for (; i + BLOCK_UNITS <= nLen; i += BLOCK_UNITS) {
+        ProcessBlock(pScan, MaskUnitsAvx2(pText + i, vCR), MaskUnitsAvx2(pText + i, vLF), BLOCK_UNITS);
+    }
+    ScanUnitsScalar(pScan, pText + i, nLen - i);
+}
+
+TARGET_AVX2 static inline __m256i SpaceUnitsAvx2(const uint16_t* p) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    return _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi16(v, _mm256_set1_epi16(' ')),
+                        _mm256_cmpeq_epi16(v, _mm256_set1_epi16('\t'))),
+        _mm256_or_si256(_mm256_cmpeq_epi16(v, _mm256_set1_epi16('\r')),
+                        _mm256_cmpeq_epi16(v, _mm256_set1_epi16('\n'))));
+}
+
+TARGET_AVX2 static size_t CountWordsAvx2(const uint16_t* pText, size_t nLen, int* pbInWord) {
+    size_t nWords = 0;
+    size_t i = 0;
+
+    for (; i + BLOCK_UNITS <= nLen; i += BLOCK_UNITS) {
+        uint64_t nSpace = Pack32Avx2(SpaceUnitsAvx2(pText + i), SpaceUnitsAvx2(pText + i + 16)) |
+                          (Pack32Avx2(SpaceUnitsAvx2(pText + i + 32), SpaceUnitsAvx2(pText + i + 48)) << 32);
+        nWords += WordsInBlock(nSpace, BLOCK_UNITS, pbInWord);
+    }
+    return nWords + CountWordsScalar(pText + i, nLen - i, pbInWord);
+}
+
+#endif /* TEXT_SCAN_X86 */
+
+/* ---- Runtime dispatch ---- */
+
+typedef struct {
+    const char* szName;
+    void (*pfnScanBytes)(TextScan*, const uint8_t*, size_t);
+    void (*pfnScanUnits)(TextScan*, const uint16_t*, size_t);
+    size_t (*pfnCountWords)(const uint16_t*, size_t, int*);
+} TextScanKernel;
+
+static const TextScanKernel g_ScalarKernel = {
+    "scalar", ScanBytesScalar, ScanUnitsScalar, CountWordsScalar
+};
+
+#ifdef TEXT_SCAN_X86
+static const TextScanKernel g_Sse2Kernel = {
+    "sse2", ScanBytesSse2, ScanUnitsSse2, CountWordsSse2
+};
+
+static const TextScanKernel g_Avx2Kernel = {
+    "avx2", ScanBytesAvx2, ScanUnitsAvx2, CountWordsAvx2
+};
+#endif
+
+static const TextScanKernel* g_pKernel = NULL;
+
+/* Pick the widest kernel the CPU supports (idempotent, so a race is harmless) */
+static const TextScanKernel* GetKernel(void) {
+    if (!g_pKernel) {
+        const TextScanKernel* pKernel = &g_ScalarKernel;
+#ifdef TEXT_SCAN_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            pKernel = &g_Avx2Kernel;
+        } else if (__builtin_cpu_supports("sse2")) {
+            pKernel = &g_Sse2Kernel;
+        }
+#endif
+        g_pKernel = pKernel;
+    }
+    return g_pKernel;
+}
+
+/* ---- Public API ---- */
+
+/* Start a scan; pfnBreak (optional) is called for every break in order */
+void TextScanInit(TextScan* pScan, TextBreakProc pfnBreak, void* pContext) {
+    pScan->nPos = 0;
+    pScan->nCR = 0;
+    pScan->nLF = 0;
+    pScan->nCRLF = 0;
+    pScan->bPendingCR = 0;
+    pScan->pfnBreak = pfnBreak;
+    pScan->pContext = pContext;
+}
+
+/* Scan 8-bit text (UTF-8 or any ASCII-compatible code page) */
+void TextScanBytes(TextScan* pScan, const uint8_t* pText, size_t nLen) {
+    GetKernel()->pfnScanBytes(pScan, pText, nLen);
+}
+
+/* Scan UTF-16 code units */
+void TextScanUnits(TextScan* pScan, const uint16_t* pText, size_t nLen) {
+    GetKernel()->pfnScanUnits(pScan, pText, nLen);
+}
+
+/* End of input: a trailing CR is a break of its own */
+void TextScanFinish(TextScan* pScan) {
+    if (pScan->bPendingCR) {
+        pScan->bPendingCR = 0;
+        if (pScan->pfnBreak) {
+            pScan->pfnBreak(pScan->pContext, pScan->nPos, LINE_BREAK_CR);
+        }
+    }
+}
+
+size_t TextScanLoneCR(const TextScan* pScan) {
+    return pScan->nCR - pScan->nCRLF;
+}
+
+size_t TextScanLoneLF(const TextScan* pScan) {
+    return pScan->nLF - pScan->nCRLF;
+}
+
+/* Nonzero if more than one kind of line break was seen */
+int TextScanIsMixed(const TextScan* pScan) {
+    int nKinds = (pScan->nCRLF > 0) + (TextScanLoneCR(pScan) > 0) + (TextScanLoneLF(pScan) > 0);
+    return nKinds > 1;
+}
+
+size_t TextCountWords(const uint16_t* pText, size_t nLen, int* pbInWord) {
+    return GetKernel()->pfnCountWords(pText, nLen, pbInWord);
+}
+
+const char* TextScanKernelName(void) {
+    return GetKernel()->szName;
+}
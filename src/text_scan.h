@@ -0,0 +1,56 @@
+#ifndef TEXT_SCAN_H
+#define TEXT_SCAN_H
+
+/*
+ * Vectorized line break and word scanning.
+ *
+ * Portable C. On x86 with GCC the kernels use SSE2 or AVX2, chosen at run
+ * time from the CPU features; other targets use the scalar kernel. All
+ * kernels classify 64 units per step into bit masks, so the scalar and SIMD
+ * paths share the same break handling and give identical results.
+ *
+ * Scans are streaming: a buffer may be fed in any number of pieces and a CR
+ * at the end of one piece pairs with an LF at the start of the next.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Line break kinds */
+#define LINE_BREAK_NONE 0        /* Last line of the document */
+#define LINE_BREAK_LF   1
+#define LINE_BREAK_CR   2
+#define LINE_BREAK_CRLF 3
+
+/* Receives each line break; nEnd is the offset just past it (the next line start) */
+typedef void (*TextBreakProc)(void* pContext, size_t nEnd, int nBreak);
+
+/* Streaming line break scan state */
+typedef struct {
+    size_t nPos;                 /* Units consumed so far */
+    size_t nCR;                  /* CR units (including those in CRLF) */
+    size_t nLF;                  /* LF units (including those in CRLF) */
+    size_t nCRLF;                /* CRLF pairs */
+    int bPendingCR;              /* Last unit consumed was CR */
+    TextBreakProc pfnBreak;      /* Optional per-break callback */
+    void* pContext;              /* Context for pfnBreak */
+} TextScan;
+
+/* Line break scanning (pfnBreak may be NULL to only count) */
+void TextScanInit(TextScan* pScan, TextBreakProc pfnBreak, void* pContext);
+void TextScanBytes(TextScan* pScan, const uint8_t* pText, size_t nLen);
+void TextScanUnits(TextScan* pScan, const uint16_t* pText, size_t nLen);
+void TextScanFinish(TextScan* pScan);
+
+/* Results (valid after TextScanFinish) */
+size_t TextScanLoneCR(const TextScan* pScan);
+size_t TextScanLoneLF(const TextScan* pScan);
+int TextScanIsMixed(const TextScan* pScan);
+
+/* Count words (runs not containing space, tab, CR or LF); *pbInWord carries across calls */
+size_t TextCountWords(const uint16_t* pText, size_t nLen, int* pbInWord);
+
+/* Name of the kernel picked for this CPU ("avx2", "sse2" or "scalar") */
+const char* TextScanKernelName(void);
+
+#endif /* TEXT_SCAN_H */
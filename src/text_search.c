@@ -0,0 +1,576 @@
+#include "text_search.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TEXT_SEARCH_X86 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+/* Returned by the kernels when nothing matches */
+#define NO_MATCH ((size_t)-1)
+
+static inline int Ctz32(uint32_t x) {
+#if defined(__GNUC__)
+    return __builtin_ctz(x);
+#else
+    int n = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+/* ---- Case folding and word characters ---- */
+
+TextUnit TextSearchFold(TextUnit u) {
+    if (u < 0x80) return (u >= 'A' && u <= 'Z') ? (TextUnit)(u + 32) : u;
+    if (u < 0x100) return (u >= 0xC0 && u <= 0xDE && u != 0xD7) ? (TextUnit)(u + 32) : u;
+
+    /* Latin Extended-A: upper and lower case alternate */
+    if (u < 0x180) {
+        if (((u >= 0x100 && u <= 0x12F) || (u >= 0x132 && u <= 0x137) || (u >= 0x14A && u <= 0x177)) &&
+            !(u & 1)) {
+            return (TextUnit)(u + 1);
+        }
+        if (((u >= 0x139 && u <= 0x148) || (u >= 0x179 && u <= 0x17E)) && (u & 1)) {
+            return (TextUnit)(u + 1);
+        }
+        return u == 0x178 ? 0xFF : u;
+    }
+
+    /* Greek and Cyrillic capitals */
+    if (u >= 0x391 && u <= 0x3AB && u != 0x3A2) return (TextUnit)(u + 32);
+    if (u >= 0x410 && u <= 0x42F) return (TextUnit)(u + 32);
+    if (u >= 0x400 && u <= 0x40F) return (TextUnit)(u + 80);
+    return u;
+}
+
+/* The other case of a folded unit (the unit itself if it has none) */
+static TextUnit OtherCase(TextUnit f) {
+    static const int deltas[] = {32, 1, 80};
+
+    for (size_t i = 0; i < sizeof(deltas) / sizeof(deltas[0]); i++) {
+        if (f >= deltas[i] && TextSearchFold((TextUnit)(f - deltas[i])) == f) {
+            return (TextUnit)(f - deltas[i]);
+        }
+    }
+    return f == 0xFF ? 0x178 : f;
+}
+
+int TextSearchIsWordUnit(TextUnit u) {
+    if (u < 0x80) {
+        return (u >= '0' && u <= '9') || (u >= 'A' && u <= 'Z') || (u >= 'a' && u <= 'z') || u == '_';
+    }
+    /* Letters of other scripts; general punctuation and ideographic space are not */
+    return u >= 0xC0 && u != 0xD7 && u != 0xF7 && !(u >= 0x2000 && u <= 0x206F) && u != 0x3000;
+}
+
+static int IsWordByte(const TextSearch* pSearch, uint8_t b) {
+    if (b < 0x80) return TextSearchIsWordUnit(b);
+    /* Any UTF-8 sequence byte is part of a character that may be a letter */
+    return (pSearch->nFlags & TEXT_SEARCH_LATIN1) ? TextSearchIsWordUnit(b) : 1;
+}
+
+/* ---- Verification ---- */
+
+static inline int VerifyUnits(const TextSearch* pSearch, const TextUnit* p) {
+    if (pSearch->nFlags & TEXT_SEARCH_MATCH_CASE) {
+        return memcmp(p, pSearch->pUnits, pSearch->nUnits * sizeof(TextUnit)) == 0;
+    }
+    for (size_t j = 0; j < pSearch->nUnits; j++) {
+        if (TextSearchFold(p[j]) != pSearch->pUnits[j]) return 0;
+    }
+    return 1;
+}
+
+static inline int VerifyBytes(const TextSearch* pSearch, const uint8_t* p) {
+    if (pSearch->nFlags & TEXT_SEARCH_MATCH_CASE) {
+        return memcmp(p, pSearch->pBytes, pSearch->nBytes) == 0;
+    }
+    for (size_t j = 0; j < pSearch->nBytes; j++) {
+        if (pSearch->byteFold[p[j]] != pSearch->pBytes[j]) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Kernels: the first verified match starting in [0, nStarts) of a buffer
+ * holding at least nStarts + pattern length - 1 units, or NO_MATCH.
+ */
+
+/* ---- Scalar kernel (Horspool) ---- */
+
+static size_t FindUnitsScalar(const TextSearch* pSearch, const TextUnit* p, size_t nStarts) {
+    const size_t nLast = pSearch->nUnits - 1;
+    const TextUnit lastUnit = pSearch->pUnits[nLast];
+    const int bFold = !(pSearch->nFlags & TEXT_SEARCH_MATCH_CASE);
+    size_t i = 0;
+
+    while (i < nStarts) {
+        TextUnit u = p[i + nLast];
+        if (bFold) u = TextSearchFold(u);
+        if (u == lastUnit && VerifyUnits(pSearch, p + i)) return i;
+        i += pSearch->unitShift[u & 0xFF];
+    }
+    return NO_MATCH;
+}
+
+static size_t FindBytesScalar(const TextSearch* pSearch, const uint8_t* p, size_t nStarts) {
+    const size_t nLast = pSearch->nBytes - 1;
+    const uint8_t lastByte = pSearch->pBytes[nLast];
+    size_t i = 0;
+
+    while (i < nStarts) {
+        uint8_t b = pSearch->byteFold[p[i + nLast]];
+        if (b == lastByte && VerifyBytes(pSearch, p + i)) return i;
+        i += pSearch->byteShift[b];
+    }
+    return NO_MATCH;
+}
+
+#ifdef TEXT_SEARCH_X86
+
+/* ---- SSE2 kernel ---- */
+
+/* Positions among 8 where the first and last units both match (0xFFFF lanes) */
+TARGET_SSE2 static inline __m128i PairUnitsSse2(const TextUnit* p, size_t nLast, const __m128i* pEnds) {
+    __m128i a = _mm_loadu_si128((const __m128i*)p);
+    __m128i b = _mm_loadu_si128((const __m128i*)(p + nLast));
+    return _mm_and_si128(_mm_or_si128(_mm_cmpeq_epi16(a, pEnds[0]), _mm_cmpeq_epi16(a, pEnds[1])),
+                         _mm_or_si128(_mm_cmpeq_epi16(b, pEnds[2]), _mm_cmpeq_epi16(b, pEnds[3])));
+}
+
+TARGET_SSE2 static inline uint32_t PairBytesSse2(const uint8_t* p, size_t nLast, const __m128i* pEnds) {
+    __m128i a = _mm_loadu_si128((const __m128i*)p);
+    __m128i b = _mm_loadu_si128((const __m128i*)(p + nLast));
+    return (uint32_t)_mm_movemask_epi8(
+        _mm_and_si128(_mm_or_si128(_mm_cmpeq_epi8(a, pEnds[0]), _mm_cmpeq_epi8(a, pEnds[1])),
+                      _mm_or_si128(_mm_cmpeq_epi8(b, pEnds[2]), _mm_cmpeq_epi8(b, pEnds[3]))));
+}
+
+TARGET_SSE2 static size_t FindUnitsSse2(const TextSearch* pSearch, const TextUnit* p, size_t nStarts) {
+    const size_t nLast = pSearch->nUnits - 1;
+    __m128i ends[4];
+    size_t i = 0, r;
+
+    for (int k = 0; k < 4; k++) ends[k] = _mm_set1_epi16((short)pSearch->unitEnds[k]);
+
+    for (; i + 16 <= nStarts; i += 16) {
+        uint32_t nMask = (uint32_t)_mm_movemask_epi8(
+            _mm_packs_epi16(PairUnitsSse2(p + i, nLast, ends), PairUnitsSse2(p + i + 8, nLast, ends)));
+        while (nMask) {
+            size_t j = i + (size_t)Ctz32(nMask);
+            if (VerifyUnits(pSearch, p + j)) return j;
+            nMask &= nMask - 1;
+        }
+    }
+    r = FindUnitsScalar(pSearch, p + i, nStarts - i);
+    return r == NO_MATCH ? NO_MATCH : i + r;
+}
+
+TARGET_SSE2 static size_t FindBytesSse2(const TextSearch* pSearch, const uint8_t* p, size_t nStarts) {
+    const size_t nLast = pSearch->nBytes - 1;
+    __m128i ends[4];
+    size_t i = 0, r;
+
+    for (int k = 0; k < 4; k++) ends[k] = _mm_set1_epi8((char)pSearch->byteEnds[k]);
+
+    for (; i + 32 <= nStarts; i += 32) {
+        uint32_t nMask = PairBytesSse2(p + i, nLast, ends) | (PairBytesSse2(p + i + 16, nLast, ends) << 16);
+        while (nMask) {
+            size_t j = i + (size_t)Ctz32(nMask);
+            if (VerifyBytes(pSearch, p + j)) return j;
+            nMask &= nMask - 1;
+        }
+    }
+    r = FindBytesScalar(pSearch, p + i, nStarts - i);
+    return r == NO_MATCH ? NO_MATCH : i + r;
+}
+
+/* ---- AVX2 kernel ---- */
+
+TARGET_AVX2 static inline __m256i PairUnitsAvx2(const TextUnit* p, size_t nLast, const __m256i* pEnds) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)p);
+    __m256i b = _mm256_loadu_si256((const __m256i*)(p + nLast));
+    return _mm256_and_si256(_mm256_or_si256(_mm256_cmpeq_epi16(a, pEnds[0]), _mm256_cmpeq_epi16(a, pEnds[1])),
+                            _mm256_or_si256(_mm256_cmpeq_epi16(b, pEnds[2]), _mm256_cmpeq_epi16(b, pEnds[3])));
+}
+
+TARGET_AVX2 static size_t FindUnitsAvx2(const TextSearch* pSearch, const TextUnit* p, size_t nStarts) {
+    const size_t nLast = pSearch->nUnits - 1;
+    __m256i ends[4];
+    size_t i = 0, r;
+
+    for (int k = 0; k < 4; k++) ends[k] = _mm256_set1_epi16((short)pSearch->unitEnds[k]);
+
+    for (; i + 32 <= nStarts; i += 32) {
+        /* packs works per 128-bit lane, so restore the order */
+        __m256i v = _mm256_permute4x64_epi64(
+            _mm256_packs_epi16(PairUnitsAvx2(p + i, nLast, ends), PairUnitsAvx2(p + i + 16, nLast, ends)), 0xD8);
+        uint32_t nMask = (uint32_t)_mm256_movemask_epi8(v);
+        while (nMask) {
+            size_t j = i + (size_t)Ctz32(nMask);
+            if (VerifyUnits(pSearch, p + j)) return j;
+            nMask &= nMask - 1;
+        }
+    }
+    r = FindUnitsScalar(pSearch, p + i, nStarts - i);
+    return r == NO_MATCH ? NO_MATCH : i + r;
+}
+
+TARGET_AVX2 static size_t FindBytesAvx2(const TextSearch* pSearch, const uint8_t* p, size_t nStarts) {
+    const size_t nLast = pSearch->nBytes - 1;
+    __m256i ends[4];
+    size_t i = 0, r;
+
+    for (int k = 0; k < 4; k++) ends[k] = _mm256_set1_epi8((char)pSearch->byteEnds[k]);
+
+    for (; i + 32 <= nStarts; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(p + i + nLast));
+        uint32_t nMask = (uint32_t)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_or_si256(_mm256_cmpeq_epi8(a, ends[0]), _mm256_cmpeq_epi8(a, ends[1])),
+                             _mm256_or_si256(_mm256_cmpeq_epi8(b, ends[2]), _mm256_cmpeq_epi8(b, ends[3]))));
+        while (nMask) {
+            size_t j = i + (size_t)Ctz32(nMask);
+            if (VerifyBytes(pSearch, p + j)) return j;
+            nMask &= nMask - 1;
+        }
+    }
+    r = FindBytesScalar(pSearch, p + i, nStarts - i);
+    return r == NO_MATCH ? NO_MATCH : i + r;
+}
+
+#endif /* TEXT_SEARCH_X86 */
+
+/* ---- Runtime dispatch ---- */
+
+typedef struct {
+    const char* szName;
+    size_t (*pfnFindUnits)(const TextSearch*, const TextUnit*, size_t);
+    size_t (*pfnFindBytes)(const TextSearch*, const uint8_t*, size_t);
+} TextSearchKernel;
+
+static const TextSearchKernel g_ScalarKernel = {"scalar", FindUnitsScalar, FindBytesScalar};
+
+#ifdef TEXT_SEARCH_X86
+static const TextSearchKernel g_Sse2Kernel = {"sse2", FindUnitsSse2, FindBytesSse2};
+static const TextSearchKernel g_Avx2Kernel = {"avx2", FindUnitsAvx2, FindBytesAvx2};
+#endif
+
+static const TextSearchKernel* g_pKernel = NULL;
+
+/* Pick the widest kernel the CPU supports (idempotent, so a race is harmless) */
+static const TextSearchKernel* GetKernel(void) {
+    if (!g_pKernel) {
+        const TextSearchKernel* pKernel = &g_ScalarKernel;
+#ifdef TEXT_SEARCH_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            pKernel = &g_Avx2Kernel;
+        } else if (__builtin_cpu_supports("sse2")) {
+            pKernel = &g_Sse2Kernel;
+        }
+#endif
+        g_pKernel = pKernel;
+    }
+    return g_pKernel;
+}
+
+const char* TextSearchKernelName(void) {
+    return GetKernel()->szName;
+}
+
+/* ---- Compiling ---- */
+
+/* Horspool shifts: distance from the last occurrence of each key (before the end) to the end */
+static void BuildShifts(uint32_t* pShift, size_t nLen, const void* pPattern, int bUnits) {
+    uint32_t nDefault = nLen > UINT32_MAX ? UINT32_MAX : (uint32_t)nLen;
+
+    for (int k = 0; k < 256; k++) pShift[k] = nDefault;
+    for (size_t j = 0; j + 1 < nLen; j++) {
+        unsigned nKey = bUnits ? (((const TextUnit*)pPattern)[j] & 0xFF) : ((const uint8_t*)pPattern)[j];
+        size_t nShift = nLen - 1 - j;
+        pShift[nKey] = nShift > UINT32_MAX ? UINT32_MAX : (uint32_t)nShift;
+    }
+}
+
+/* The pattern as UTF-8 or Latin-1 bytes (NULL if it cannot occur in such text) */
+static uint8_t* EncodeBytes(const TextUnit* pPattern, size_t nLen, int bLatin1, size_t* pnBytes) {
+    uint8_t* pBytes = (uint8_t*)malloc(nLen * 3);
+    size_t n = 0;
+
+    if (!pBytes) return NULL;
+    for (size_t i = 0; i < nLen; i++) {
+        uint32_t c = pPattern[i];
+
+        if (bLatin1 || c < 0x80) {
+            /* Units past Latin-1 never occur in Latin-1 text */
+            if (c > 0xFF) goto fail;
+            pBytes[n++] = (uint8_t)c;
+            continue;
+        }
+        if (c >= 0xD800 && c <= 0xDFFF) {
+            /* Only a complete surrogate pair encodes */
+            if (c > 0xDBFF || i + 1 >= nLen || pPattern[i + 1] < 0xDC00 || pPattern[i + 1] > 0xDFFF) goto fail;
+            c = 0x10000 + ((c - 0xD800) << 10) + (uint32_t)(pPattern[++i] - 0xDC00);
+        }
+        if (c < 0x800) {
+            pBytes[n++] = (uint8_t)(0xC0 | (c >> 6));
+        } else if (c < 0x10000) {
+            pBytes[n++] = (uint8_t)(0xE0 | (c >> 12));
+            pBytes[n++] = (uint8_t)(0x80 | ((c >> 6) & 0x3F));
+        } else {
+            pBytes[n++] = (uint8_t)(0xF0 | (c >> 18));
+            pBytes[n++] = (uint8_t)(0x80 | ((c >> 12) & 0x3F));
+            pBytes[n++] = (uint8_t)(0x80 | ((c >> 6) & 0x3F));
+        }
+        pBytes[n++] = (uint8_t)(0x80 | (c & 0x3F));
+    }
+    *pnBytes = n;
+    return pBytes;
+
+fail:
+    free(pBytes);
+    return NULL;
+}
+
+int TextSearchInit(TextSearch* pSearch, const TextUnit* pPattern, size_t nLen, unsigned nFlags) {
+    const int bFold = !(nFlags & TEXT_SEARCH_MATCH_CASE);
+    const int bLatin1 = (nFlags & TEXT_SEARCH_LATIN1) != 0;
+
+    memset(pSearch, 0, sizeof(*pSearch));
+    if (nLen == 0 || nLen > ((size_t)-1) / (3 * sizeof(TextUnit))) return 0;
+    pSearch->nFlags = nFlags;
+
+    pSearch->pUnits = (TextUnit*)malloc(nLen * sizeof(TextUnit));
+    pSearch->pWindow = (TextUnit*)malloc(2 * nLen * sizeof(TextUnit));
+    if (!pSearch->pUnits || !pSearch->pWindow) {
+        TextSearchFree(pSearch);
+        return 0;
+    }
+    for (size_t i = 0; i < nLen; i++) {
+        pSearch->pUnits[i] = bFold ? TextSearchFold(pPattern[i]) : pPattern[i];
+    }
+    pSearch->nUnits = nLen;
+    pSearch->unitEnds[0] = pSearch->pUnits[0];
+    pSearch->unitEnds[1] = bFold ? OtherCase(pSearch->pUnits[0]) : pSearch->pUnits[0];
+    pSearch->unitEnds[2] = pSearch->pUnits[nLen - 1];
+    pSearch->unitEnds[3] = bFold ? OtherCase(pSearch->pUnits[nLen - 1]) : pSearch->pUnits[nLen - 1];
+    BuildShifts(pSearch->unitShift, nLen, pSearch->pUnits, 1);
+
+    /* Bytes fold ASCII letters only, or all Latin-1 letters when the text is Latin-1 */
+    for (int b = 0; b < 256; b++) {
+        TextUnit f = (TextUnit)b;
+        if (bFold && (b < 0x80 || bLatin1)) f = TextSearchFold(f);
+        pSearch->byteFold[b] = (uint8_t)f;
+    }
+    pSearch->pBytes = EncodeBytes(pPattern, nLen, bLatin1, &pSearch->nBytes);
+    if (pSearch->pBytes) {
+        size_t nLast = pSearch->nBytes - 1;
+
+        for (size_t i = 0; i < pSearch->nBytes; i++) {
+            pSearch->pBytes[i] = pSearch->byteFold[pSearch->pBytes[i]];
+        }
+        pSearch->byteEnds[0] = pSearch->byteEnds[1] = pSearch->pBytes[0];
+        pSearch->byteEnds[2] = pSearch->byteEnds[3] = pSearch->pBytes[nLast];
+        for (int b = 0; b < 256; b++) {
+            if (pSearch->byteFold[b] != b && pSearch->byteFold[b] == pSearch->pBytes[0]) {
+                pSearch->byteEnds[1] = (uint8_t)b;
+            }
+            if (pSearch->byteFold[b] != b && pSearch->byteFold[b] == pSearch->pBytes[nLast]) {
+                pSearch->byteEnds[3] = (uint8_t)b;
+            }
+        }
+        BuildShifts(pSearch->byteShift, pSearch->nBytes, pSearch->pBytes, 0);
+    }
+    return 1;
+}
+
+void TextSearchFree(TextSearch* pSearch) {
+    free(pSearch->pUnits);
+    free(pSearch->pBytes);
+    free(pSearch->pWindow);
+    pSearch->pUnits = NULL;
+    pSearch->pBytes = NULL;
+    pSearch->pWindow = NULL;
+    pSearch->nUnits = 0;
+    pSearch->nBytes = 0;
+}
+
+/* ---- Flat buffers ---- */
+
+int TextSearchUnits(const TextSearch* pSearch, const TextUnit* pText, size_t nLen,
+                    size_t nFrom, size_t nTo, size_t* pnMatch) {
+    const TextSearchKernel* pKernel = GetKernel();
+    const size_t m = pSearch->nUnits;
+
+    if (nLen < m) return 0;
+    if (nTo > nLen - m + 1) nTo = nLen - m + 1;
+
+    while (nFrom < nTo) {
+        size_t r = pKernel->pfnFindUnits(pSearch, pText + nFrom, nTo - nFrom);
+        size_t nAt;
+        if (r == NO_MATCH) return 0;
+        nAt = nFrom + r;
+        if (!(pSearch->nFlags & TEXT_SEARCH_WHOLE_WORD) ||
+            ((nAt == 0 || !TextSearchIsWordUnit(pText[nAt - 1])) && (nAt + m == nLen || !TextSearchIsWordUnit(pText[nAt + m])))) {
+            *pnMatch = nAt;
+            return 1;
+        }
+        nFrom = nAt + 1;
+    }
+    return 0;
+}
+
+int TextSearchBytes(const TextSearch* pSearch, const uint8_t* pText, size_t nLen,
+                    size_t nFrom, size_t nTo, size_t* pnMatch) {
+    const TextSearchKernel* pKernel = GetKernel();
+    const size_t m = pSearch->nBytes;
+
+    if (!pSearch->pBytes || nLen < m) return 0;
+    if (nTo > nLen - m + 1) nTo = nLen - m + 1;
+
+    while (nFrom < nTo) {
+        size_t r = pKernel->pfnFindBytes(pSearch, pText + nFrom, nTo - nFrom);
+        size_t nAt;
+        if (r == NO_MATCH) return 0;
+        nAt = nFrom + r;
+        if (!(pSearch->nFlags & TEXT_SEARCH_WHOLE_WORD) ||
+            ((nAt == 0 || !IsWordByte(pSearch, pText[nAt - 1])) &&
+             (nAt + m == nLen || !IsWordByte(pSearch, pText[nAt + m])))) {
+            *pnMatch = nAt;
+            return 1;
+        }
+        nFrom = nAt + 1;
+    }
+    return 0;
+}
+
+int TextSearchBytesLast(const TextSearch* pSearch, const uint8_t* pText, size_t nLen,
+                        size_t nFrom, size_t nTo, size_t* pnMatch) {
+    size_t nHi = nTo;
+
+    /* Windows of the text from the end, each searched forwards to its last match */
+    while (nHi > nFrom) {
+        size_t nLo = nHi - nFrom > TEXT_SEARCH_BACK_WINDOW ? nHi - TEXT_SEARCH_BACK_WINDOW : nFrom;
+        size_t nAt = nLo, nFound;
+        int bFound = 0;
+
+        while (TextSearchBytes(pSearch, pText, nLen, nAt, nHi, &nFound)) {
+            *pnMatch = nFound;
+            bFound = 1;
+            nAt = nFound + 1;
+        }
+        if (bFound) return 1;
+        nHi = nLo;
+    }
+    return 0;
+}
+
+/* ---- Documents ---- */
+
+static int UnitAt(const PieceTable* pDoc, size_t nOffset, TextUnit* pUnit) {
+    size_t nSpan;
+    const TextUnit* pSpan = PieceTableSpanAt(pDoc, nOffset, &nSpan);
+    if (!pSpan) return 0;
+    *pUnit = *pSpan;
+    return 1;
+}
+
+static int IsWholeWordInDocument(const TextSearch* pSearch, const PieceTable* pDoc, size_t nAt) {
+    TextUnit u;
+
+    if (!(pSearch->nFlags & TEXT_SEARCH_WHOLE_WORD)) return 1;
+    if (nAt > 0 && UnitAt(pDoc, nAt - 1, &u) && TextSearchIsWordUnit(u)) return 0;
+    if (UnitAt(pDoc, nAt + pSearch->nUnits, &u) && TextSearchIsWordUnit(u)) return 0;
+    return 1;
+}
+
+/* First document match among nStarts starts of p (which begins at document offset nBase) */
+static int FindInRun(const TextSearch* pSearch, const PieceTable* pDoc, const TextUnit* p,
+                     size_t nStarts, size_t nBase, size_t* pnMatch) {
+    const TextSearchKernel* pKernel = GetKernel();
+    size_t i = 0;
+
+    while (i < nStarts) {
+        size_t r = pKernel->pfnFindUnits(pSearch, p + i, nStarts - i);
+        if (r == NO_MATCH) return 0;
+        i += r;
+        if (IsWholeWordInDocument(pSearch, pDoc, nBase + i)) {
+            *pnMatch = nBase + i;
+            return 1;
+        }
+        i++;
+    }
+    return 0;
+}
+
+int TextSearchDocument(TextSearch* pSearch, const PieceTable* pDoc,
+                       size_t nFrom, size_t nTo, size_t* pnMatch) {
+    const size_t m = pSearch->nUnits;
+    const size_t nDocLen = PieceTableLength(pDoc);
+    size_t nPos = nFrom;
+
+    if (nDocLen < m) return 0;
+    if (nTo > nDocLen - m + 1) nTo = nDocLen - m + 1;
+
+    while (nPos < nTo) {
+        size_t nSpan;
+        const TextUnit* pSpan = PieceTableSpanAt(pDoc, nPos, &nSpan);
+        size_t nEnd;
+
+        if (!pSpan) break;
+        nEnd = nPos + nSpan;
+
+        /* Matches that lie inside the span are searched in place */
+        if (nSpan >= m) {
+            size_t nStarts = nSpan - m + 1;
+            if (nStarts > nTo - nPos) nStarts = nTo - nPos;
+            if (FindInRun(pSearch, pDoc, pSpan, nStarts, nPos, pnMatch)) return 1;
+        }
+
+        /* Matches that run into the next span: copy the few units around the seam */
+        if (m > 1 && nEnd < nDocLen) {
+            size_t nSeam = nSpan >= m - 1 ? nEnd - (m - 1) : nPos;
+            size_t nWindow = PieceTableCopy(pDoc, nSeam, pSearch->pWindow, (nEnd - nSeam) + (m - 1));
+            size_t nStarts = nEnd - nSeam;
+
+            if (nSeam >= nTo) nStarts = 0;
+            else if (nStarts > nTo - nSeam) nStarts = nTo - nSeam;
+            if (nWindow >= m && nStarts > nWindow - m + 1) nStarts = nWindow - m + 1;
+            if (nWindow >= m && nStarts > 0 &&
+                FindInRun(pSearch, pDoc, pSearch->pWindow, nStarts, nSeam, pnMatch)) {
+                return 1;
+            }
+        }
+        nPos = nEnd;
+    }
+    return 0;
+}
+
+int TextSearchDocumentLast(TextSearch* pSearch, const PieceTable* pDoc,
+                           size_t nFrom, size_t nTo, size_t* pnMatch) {
+    size_t nHi = nTo;
+
+    /* Same windowing as TextSearchBytesLast */
+    while (nHi > nFrom) {
+        size_t nLo = nHi - nFrom > TEXT_SEARCH_BACK_WINDOW ? nHi - TEXT_SEARCH_BACK_WINDOW : nFrom;
+        size_t nAt = nLo, nFound;
+        int bFound = 0;
+
+        while (TextSearchDocument(pSearch, pDoc, nAt, nHi, &nFound)) {
+            *pnMatch = nFound;
+            bFound = 1;
+            nAt = nFound + 1;
+        }
+        if (bFound) return 1;
+        nHi = nLo;
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+#ifndef TEXT_SEARCH_H
+#define TEXT_SEARCH_H
+
+/*
+ * Literal text search.
+ *
+ * Portable C. A pattern is compiled once and then searched for in UTF-16
+ * text (flat buffers or a piece table document, span by span without
+ * copying it out) or in bytes (mapped files, UTF-8 or Latin-1).
+ *
+ * Candidates are found with a vector filter on the pattern's first and
+ * last units: both are compared across 16 or 32 positions per step and
+ * only positions where both match are verified. On x86 with GCC the
+ * filter uses SSE2 or AVX2, chosen at run time; other targets use a
+ * Horspool loop. Case-insensitive search folds Latin, Greek and Cyrillic
+ * letters one to one (ASCII only when searching bytes).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "piece_table.h"
+
+/* Search flags */
+#define TEXT_SEARCH_MATCH_CASE 0x01  /* Letters must match in case */
+#define TEXT_SEARCH_WHOLE_WORD 0x02  /* The match may not touch word characters on either side */
+#define TEXT_SEARCH_LATIN1     0x04  /* Byte searches read Latin-1 (otherwise UTF-8) */
+
+/* Units searched per window when looking backwards */
+#define TEXT_SEARCH_BACK_WINDOW (256 * 1024)
+
+/* Compiled pattern */
+typedef struct {
+    unsigned nFlags;             /* TEXT_SEARCH_ flags */
+    TextUnit* pUnits;            /* Pattern (folded unless matching case) */
+    size_t nUnits;
+    uint8_t* pBytes;             /* Pattern as bytes (NULL if it cannot occur in byte text) */
+    size_t nBytes;
+    TextUnit unitEnds[4];        /* First unit, its other case, last unit, its other case */
+    uint8_t byteEnds[4];         /* The same for the byte pattern */
+    uint8_t byteFold[256];       /* Byte case folding (identity when matching case) */
+    uint32_t unitShift[256];     /* Horspool shifts by low byte of the unit under the pattern's end */
+    uint32_t byteShift[256];
+    TextUnit* pWindow;           /* Document search scratch: text around a span boundary */
+} TextSearch;
+
+/* Compile a pattern (returns nonzero on success; an empty pattern fails) */
+int TextSearchInit(TextSearch* pSearch, const TextUnit* pPattern, size_t nLen, unsigned nFlags);
+void TextSearchFree(TextSearch* pSearch);
+
+/*
+ * Flat buffers: first match starting in [nFrom, nTo) that fits within
+ * nLen. The buffer ends count as word boundaries. These only read the
+ * compiled pattern, so threads may share one.
+ */
+int TextSearchUnits(const TextSearch* pSearch, const TextUnit* pText, size_t nLen,
+                    size_t nFrom, size_t nTo, size_t* pnMatch);
+int TextSearchBytes(const TextSearch* pSearch, const uint8_t* pText, size_t nLen,
+                    size_t nFrom, size_t nTo, size_t* pnMatch);
+
+/* Last match starting in [nFrom, nTo) of a byte buffer */
+int TextSearchBytesLast(const TextSearch* pSearch, const uint8_t* pText, size_t nLen,
+                        size_t nFrom, size_t nTo, size_t* pnMatch);
+
+/*
+ * Document: first (or last) match starting in [nFrom, nTo). Matches may
+ * span pieces. Uses the pattern's scratch, so one thread at a time.
+ */
+int TextSearchDocument(TextSearch* pSearch, const PieceTable* pDoc,
+                       size_t nFrom, size_t nTo, size_t* pnMatch);
+int TextSearchDocumentLast(TextSearch* pSearch, const PieceTable* pDoc,
+                           size_t nFrom, size_t nTo, size_t* pnMatch);
+
+/* Fold a unit for case-insensitive comparison */
+TextUnit TextSearchFold(TextUnit u);
+
+/* Whether a unit belongs to a word (letters, digits and underscore) */
+int TextSearchIsWordUnit(TextUnit u);
+
+/* Name of the filter picked for this CPU ("avx2", "sse2" or "scalar") */
+const char* TextSearchKernelName(void);
+
+#endif /* TEXT_SEARCH_H */
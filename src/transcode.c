@@ -0,0 +1,334 @@
+#include "transcode.h"
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TRANSCODE_X86 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+/* Input bytes decoded between hand-offs to the line scanner */
+#define SCAN_BLOCK_BYTES (64 * 1024)
+
+/*
+ * ASCII run kernels: widen the leading ASCII bytes of pSrc and return how
+ * many there were. The SIMD kernels may also write (garbage) units past the
+ * run, never past pDst[nLen - 1]; the decoder overwrites them. That is safe
+ * because the output position never runs ahead of the input position.
+ */
+
+static size_t AsciiRunScalar(const uint8_t* pSrc, size_t nLen, uint16_t* pDst) {
+    size_t i = 0;
+
+    while (i + 8 <= nLen) {
+        uint64_t nWord;
+        memcpy(&nWord, pSrc + i, 8);
+        if (nWord & 0x8080808080808080ULL) break;
+        for (int k = 0; k < 8; k++) pDst[i + k] = pSrc[i + k];
+        i += 8;
+    }
+    while (i < nLen && pSrc[i] < 0x80) {
+        pDst[i] = pSrc[i];
+        i++;
+    }
+    return i;
+}
+
+#ifdef TRANSCODE_X86
+
+TARGET_SSE2 static size_t AsciiRunSse2(const uint8_t* pSrc, size_t nLen, uint16_t* pDst) {
+    const __m128i vZero = _mm_setzero_si128();
+    size_t i = 0;
+
+    while (i + 16 <= nLen) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(pSrc + i));
+        int nMask = _mm_movemask_epi8(v);
+        _mm_storeu_si128((__m128i*)(pDst + i), _mm_unpacklo_epi8(v, vZero));
+        _mm_storeu_si128((__m128i*)(pDst + i + 8), _mm_unpackhi_epi8(v, vZero));
+        if (nMask) {
+            /* Units past the ASCII prefix are overwritten by the caller */
+            return i + (size_t)__builtin_ctz((unsigned)nMask);
+        }
+        i += 16;
+    }
+    return i + AsciiRunScalar(pSrc + i, nLen - i, pDst + i);
+}
+
+TARGET_AVX2 static size_t AsciiRunAvx2(const uint8_t* pSrc, size_t nLen, uint16_t* pDst) {
+    size_t i = 0;
+
+    while (i + 32 <= nLen) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(pSrc + i));
+        unsigned nMask = (unsigned)_mm256_movemask_epi8(v);
+        _mm256_storeu_si256((__m256i*)(pDst + i), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+        _mm256_storeu_si256((__m256i*)(pDst + i + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+        if (nMask) {
+            return i + (size_t)__builtin_ctz(nMask);
+        }
+        i += 32;
+    }
+    return i + AsciiRunScalar(pSrc + i, nLen - i, pDst + i);
+}
+
+#endif /* TRANSCODE_X86 */
+
+/* Narrowing kernels: copy the leading ASCII units of pSrc as bytes, return how many */
+static size_t NarrowRunScalar(const uint16_t* pSrc, size_t nLen, uint8_t* pDst) {
+    size_t i = 0;
+
+    while (i + 4 <= nLen) {
+        uint64_t nWord;
+        memcpy(&nWord, pSrc + i, 8);
+        if (nWord & 0xFF80FF80FF80FF80ULL) break;
+        for (int k = 0; k < 4; k++) pDst[i + k] = (uint8_t)pSrc[i + k];
+        i += 4;
+    }
+    while (i < nLen && pSrc[i] < 0x80) {
+        pDst[i] = (uint8_t)pSrc[i];
+        i++;
+    }
+    return i;
+}
+
+#ifdef TRANSCODE_X86
+
+TARGET_SSE2 static size_t NarrowRunSse2(const uint16_t* pSrc, size_t nLen, uint8_t* pDst) {
+    const __m128i vHigh = _mm_set1_epi16((short)0xFF80);
+    size_t i = 0;
+
+    while (i + 16 <= nLen) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(pSrc + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(pSrc + i + 8));
+        __m128i vAny = _mm_and_si128(_mm_or_si128(a, b), vHigh);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(vAny, _mm_setzero_si128())) != 0xFFFF) break;
+        _mm_storeu_si128((__m128i*)(pDst + i), _mm_packus_epi16(a, b));
+        i += 16;
+    }
+    return i + NarrowRunScalar(pSrc + i, nLen - i, pDst + i);
+}
+
+TARGET_AVX2 static size_t NarrowRunAvx2(const uint16_t* pSrc, size_t nLen, uint8_t* pDst) {
+    const __m256i vHigh = _mm256_set1_epi16((short)0xFF80);
+    size_t i = 0;
+
+    while (i + 32 <= nLen) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(pSrc + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(pSrc + i + 16));
+        if (!_mm256_testz_si256(_mm256_or_si256(a, b), vHigh)) break;
+        /* packus works per 128-bit lane, so restore order */
+        __m256i v = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+        _mm256_storeu_si256((__m256i*)(pDst + i), v);
+        i += 32;
+    }
+    /* GCC leaves the upper halves dirty across the call; mixed text pays for it on every run */
+    _mm256_zeroupper();
+    return i + NarrowRunScalar(pSrc + i, nLen - i, pDst + i);
+}
+
+#endif /* TRANSCODE_X86 */
+
+/* ---- Runtime dispatch ---- */
+
+typedef struct {
+    const char* szName;
+    size_t (*pfnAsciiRun)(const uint8_t*, size_t, uint16_t*);
+    size_t (*pfnNarrowRun)(const uint16_t*, size_t, uint8_t*);
+} TranscodeKernel;
+
+static const TranscodeKernel g_ScalarKernel = { "scalar", AsciiRunScalar, NarrowRunScalar };
+
+#ifdef TRANSCODE_X86
+static const TranscodeKernel g_Sse2Kernel = { "sse2", AsciiRunSse2, NarrowRunSse2 };
+static const TranscodeKernel g_Avx2Kernel = { "avx2", AsciiRunAvx2, NarrowRunAvx2 };
+#endif
+
+static const TranscodeKernel* g_pKernel = NULL;
+
+/* Pick the widest kernel the CPU supports (idempotent, so a race is harmless) */
+static const TranscodeKernel* GetKernel(void) {
+    if (!g_pKernel) {
+        const TranscodeKernel* pKernel = &g_ScalarKernel;
+#ifdef TRANSCODE_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            pKernel = &g_Avx2Kernel;
+        } else if (__builtin_cpu_supports("sse2")) {
+            pKernel = &g_Sse2Kernel;
+        }
+#endif
+        g_pKernel = pKernel;
+    }
+    return g_pKernel;
+}
+
+/* ---- Decoder ---- */
+
+static inline int IsContinuation(uint8_t b) {
+    return (b & 0xC0) == 0x80;
+}
+
+/*
+ * Decode one multi-byte sequence at pSrc (pSrc[0] >= 0x80).
+ * Returns the sequence length, or 0 if it is invalid or truncated.
+ * Bounds for the second byte follow the Unicode well-formed table, which
+ * rules out overlongs, surrogates and values above U+10FFFF.
+ */
+static inline int DecodeSequence(const uint8_t* pSrc, size_t nAvail, uint16_t* pDst, size_t* pnOut) {
+    uint8_t b0 = pSrc[0];
+    uint8_t nLow = 0x80, nHigh = 0xBF;
+    uint32_t nCode;
+
+    if (b0 < 0xC2) return 0;
+
+    if (b0 < 0xE0) {
+        if (nAvail < 2 || !IsContinuation(pSrc[1])) return 0;
+        pDst[(*pnOut)++] = (uint16_t)(((b0 & 0x1F) << 6) | (pSrc[1] & 0x3F));
+        return 2;
+    }
+
+    if (b0 < 0xF0) {
+        if (b0 == 0xE0) nLow = 0xA0;
+        else if (b0 == 0xED) nHigh = 0x9F;
+        if (nAvail < 2 || pSrc[1] < nLow || pSrc[1] > nHigh) return 0;
+        if (nAvail < 3 || !IsContinuation(pSrc[2])) return 0;
+        pDst[(*pnOut)++] = (uint16_t)(((b0 & 0x0F) << 12) | ((pSrc[1] & 0x3F) << 6) | (pSrc[2] & 0x3F));
+        return 3;
+    }
+
+    if (b0 < 0xF5) {
+        if (b0 == 0xF0) nLow = 0x90;
+        else if (b0 == 0xF4) nHigh = 0x8F;
+        if (nAvail < 2 || pSrc[1] < nLow || pSrc[1] > nHigh) return 0;
+        if (nAvail < 3 || !IsContinuation(pSrc[2])) return 0;
+        if (nAvail < 4 || !IsContinuation(pSrc[3])) return 0;
+        nCode = ((uint32_t)(b0 & 0x07) << 18) | ((uint32_t)(pSrc[1] & 0x3F) << 12) |
+                ((uint32_t)(pSrc[2] & 0x3F) << 6) | (uint32_t)(pSrc[3] & 0x3F);
+        nCode -= 0x10000;
+        pDst[(*pnOut)++] = (uint16_t)(0xD800 | (nCode >> 10));
+        pDst[(*pnOut)++] = (uint16_t)(0xDC00 | (nCode & 0x3FF));
+        return 4;
+    }
+
+    return 0;
+}
+
+int Utf8ToUtf16(const uint8_t* pSrc, size_t nSrc, uint16_t* pDst,
+                size_t* pnUnits, size_t* pnErrorOffset, TextScan* pScan) {
+    size_t (*pfnAsciiRun)(const uint8_t*, size_t, uint16_t*) = GetKernel()->pfnAsciiRun;
+    size_t i = 0;
+    size_t nOut = 0;
+
+    while (i < nSrc) {
+        /* Sequences may run past the block end; the next block starts after them */
+        size_t nStop = (nSrc - i > SCAN_BLOCK_BYTES) ? i + SCAN_BLOCK_BYTES : nSrc;
+        size_t nBlockOut = nOut;
+
+        while (i < nStop) {
+            if (pSrc[i] < 0x80) {
+                size_t nRun = pfnAsciiRun(pSrc + i, nStop - i, pDst + nOut);
+                i += nRun;
+                nOut += nRun;
+                continue;
+            }
+
+            int nSeq = DecodeSequence(pSrc + i, nSrc - i, pDst, &nOut);
+            if (!nSeq) {
+                if (pScan) TextScanUnits(pScan, pDst + nBlockOut, nOut - nBlockOut);
+                *pnUnits = nOut;
+                *pnErrorOffset = i;
+                return 0;
+            }
+            i += (size_t)nSeq;
+        }
+
+        if (pScan) TextScanUnits(pScan, pDst + nBlockOut, nOut - nBlockOut);
+    }
+
+    *pnUnits = nOut;
+    *pnErrorOffset = nSrc;
+    return 1;
+}
+
+/* ---- Encoder ---- */
+
+/* U+FFFD REPLACEMENT CHARACTER */
+static const uint8_t REPLACEMENT_UTF8[3] = { 0xEF, 0xBF, 0xBD };
+
+void Utf8EncoderInit(Utf8Encoder* pEncoder) {
+    pEncoder->nPendingHigh = 0;
+}
+
+size_t Utf8EncoderEncode(Utf8Encoder* pEncoder, const uint16_t* pSrc, size_t nSrc,
+                         uint8_t* pDst, size_t nDstSize, size_t* pnWritten) {
+    size_t (*pfnNarrowRun)(const uint16_t*, size_t, uint8_t*) = GetKernel()->pfnNarrowRun;
+    size_t i = 0;
+    size_t nOut = 0;
+
+    while (i < nSrc && nDstSize - nOut >= UTF8_ENCODE_MAX_STEP) {
+        uint16_t u = pSrc[i];
+
+        if (pEncoder->nPendingHigh) {
+            if (u >= 0xDC00 && u <= 0xDFFF) {
+                uint32_t nCode = 0x10000 + (((uint32_t)pEncoder->nPendingHigh - 0xD800) << 10) + (u - 0xDC00);
+                pDst[nOut++] = (uint8_t)(0xF0 | (nCode >> 18));
+                pDst[nOut++] = (uint8_t)(0x80 | ((nCode >> 12) & 0x3F));
+                pDst[nOut++] = (uint8_t)(0x80 | ((nCode >> 6) & 0x3F));
+                pDst[nOut++] = (uint8_t)(0x80 | (nCode & 0x3F));
+                pEncoder->nPendingHigh = 0;
+                i++;
+                continue;
+            }
+            /* High surrogate without a low half; u is handled on the next step */
+            memcpy(pDst + nOut, REPLACEMENT_UTF8, 3);
+            nOut += 3;
+            pEncoder->nPendingHigh = 0;
+            continue;
+        }
+
+        if (u < 0x80) {
+            size_t nRoom = nDstSize - nOut - (UTF8_ENCODE_MAX_STEP - 1);
+            size_t nEnd = i + ((nSrc - i < nRoom) ? nSrc - i : nRoom);
+            size_t nShortEnd = (nEnd - i < 8) ? nEnd : i + 8;
+
+            /* Short runs between non-ASCII characters are cheaper inline */
+            while (i < nShortEnd && pSrc[i] < 0x80) pDst[nOut++] = (uint8_t)pSrc[i++];
+            if (i == nShortEnd && i < nEnd) {
+                size_t nRun = pfnNarrowRun(pSrc + i, nEnd - i, pDst + nOut);
+                i += nRun;
+                nOut += nRun;
+            }
+            continue;
+        }
+
+        if (u < 0x800) {
+            pDst[nOut++] = (uint8_t)(0xC0 | (u >> 6));
+            pDst[nOut++] = (uint8_t)(0x80 | (u & 0x3F));
+        } else if (u >= 0xD800 && u <= 0xDBFF) {
+            pEncoder->nPendingHigh = u;
+        } else if (u >= 0xDC00 && u <= 0xDFFF) {
+            /* Low surrogate without a high half */
+            memcpy(pDst + nOut, REPLACEMENT_UTF8, 3);
+            nOut += 3;
+        } else {
+            pDst[nOut++] = (uint8_t)(0xE0 | (u >> 12));
+            pDst[nOut++] = (uint8_t)(0x80 | ((u >> 6) & 0x3F));
+            pDst[nOut++] = (uint8_t)(0x80 | (u & 0x3F));
+        }
+        i++;
+    }
+
+    *pnWritten = nOut;
+    return i;
+}
+
+size_t Utf8EncoderFinish(Utf8Encoder* pEncoder, uint8_t* pDst) {
+    if (!pEncoder->nPendingHigh) return 0;
+    pEncoder->nPendingHigh = 0;
+    memcpy(pDst, REPLACEMENT_UTF8, 3);
+    return 3;
+}
+
+const char* TranscodeKernelName(void) {
+    return GetKernel()->szName;
+}
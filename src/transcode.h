@@ -0,0 +1,55 @@
+#ifndef TRANSCODE_H
+#define TRANSCODE_H
+
+/*
+ * UTF-8 <-> UTF-16 transcoding.
+ *
+ * Portable C. Validation and conversion happen in a single pass; runs of
+ * ASCII are widened with SSE2 or AVX2 when the CPU has them (picked at run
+ * time, same as text_scan). Invalid input (overlong forms, surrogates, code
+ * points above U+10FFFF, stray or missing continuation bytes) stops the
+ * decode and reports the byte offset of the offending sequence.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "text_scan.h"
+
+/*
+ * Decode nSrc bytes of UTF-8 into pDst, which must hold at least nSrc units
+ * (UTF-8 never needs more UTF-16 units than bytes). On success returns
+ * nonzero and stores the unit count in *pnUnits. On failure returns 0 and
+ * stores the offset of the first invalid sequence in *pnErrorOffset.
+ *
+ * If pScan is not NULL the decoded text is fed to it block by block while
+ * still in cache, so line breaks come out of the same pass.
+ */
+int Utf8ToUtf16(const uint8_t* pSrc, size_t nSrc, uint16_t* pDst,
+                size_t* pnUnits, size_t* pnErrorOffset, TextScan* pScan);
+
+/* Streaming UTF-16 to UTF-8 encoder; a surrogate pair may span calls */
+typedef struct {
+    uint16_t nPendingHigh;       /* High surrogate waiting for its low half (0 if none) */
+} Utf8Encoder;
+
+/* Longest UTF-8 output for one step of the encoder (a surrogate pair) */
+#define UTF8_ENCODE_MAX_STEP 4
+
+void Utf8EncoderInit(Utf8Encoder* pEncoder);
+
+/*
+ * Encode units from pSrc into pDst until the input is used up or fewer than
+ * UTF8_ENCODE_MAX_STEP bytes of room remain. Returns the units consumed and
+ * stores the bytes written in *pnWritten. Unpaired surrogates become U+FFFD,
+ * as WideCharToMultiByte does.
+ */
+size_t Utf8EncoderEncode(Utf8Encoder* pEncoder, const uint16_t* pSrc, size_t nSrc,
+                         uint8_t* pDst, size_t nDstSize, size_t* pnWritten);
+
+/* End of input: returns bytes written to pDst (room for 3 needed) */
+size_t Utf8EncoderFinish(Utf8Encoder* pEncoder, uint8_t* pDst);
+
+/* Name of the ASCII kernel picked for this CPU ("avx2", "sse2" or "scalar") */
+const char* TranscodeKernelName(void);
+
+#endif /* TRANSCODE_H */
@@ -0,0 +1,720 @@
+#include "undo_journal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Record flags */
+#define UNDO_FLAG_GROUP         0x01 /* First record of an undo step */
+#define UNDO_FLAG_REMOVED_WIDE  0x02 /* Removed text stored as 16-bit units */
+#define UNDO_FLAG_INSERTED_WIDE 0x04 /* Inserted text stored as 16-bit units */
+#define UNDO_FLAG_MATCHES       0x08 /* Replace All: the matches and their replacement, not the span */
+
+/* Record kinds, for grouping keystrokes */
+#define UNDO_KIND_NONE   0
+#define UNDO_KIND_TYPE   1       /* One unit typed (or overtyped) */
+#define UNDO_KIND_DELETE 2       /* One unit deleted */
+#define UNDO_KIND_OTHER  3       /* Anything else: always a step of its own */
+
+/* Decode buffer kept between steps; a bigger one is freed once used */
+#define UNDO_SCRATCH_KEEP (64 * 1024)
+
+struct UndoBlock {
+    UndoBlock* pPrev;
+    UndoBlock* pNext;
+    size_t nStart;               /* First live byte (only the head block drops records) */
+    size_t nUsed;                /* Bytes written */
+    size_t nSize;                /* Bytes allocated in aData */
+    uint8_t aData[];
+};
+
+/* One decoded record */
+typedef struct {
+    int nFlags;
+    int64_t nDelta;              /* Offset minus the end of the previous edit */
+    size_t nRemoved;
+    size_t nInserted;
+    const uint8_t* pRemoved;     /* Removed text, or the first match of a Replace All */
+    const uint8_t* pInserted;    /* Inserted text, or the replacement of a Replace All */
+    size_t nMatches;             /* Replace All: matches, and units in the replacement */
+    size_t nWith;
+    size_t nSize;                /* Whole record, trailer included */
+} UndoRecord;
+
+static inline int IsRunBreak(TextUnit u) {
+    return u == ' ' || u == '\t' || u == '\r' || u == '\n';
+}
+
+/* ---- Encoding ---- */
+
+static size_t VarintSize(uint64_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static uint8_t* PutVarint(uint8_t* p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static const uint8_t* GetVarint(const uint8_t* p, uint64_t* pv) {
+    uint64_t v = 0;
+    int nShift = 0;
+    while (*p & 0x80) {
+        v |= (uint64_t)(*p++ & 0x7F) << nShift;
+        nShift += 7;
+    }
+    *pv = v | ((uint64_t)*p++ << nShift);
+    return p;
+}
+
+/*
+ * The size trailer is a varint stored back to front: the last byte holds the
+ * low 7 bits, and a set high bit means more bytes precede it.
+ */
+static uint8_t* PutTrailer(uint8_t* p, uint64_t v) {
+    size_t n = VarintSize(v);
+    for (size_t i = n; i-- > 0;) {
+        p[i] = (uint8_t)((v & 0x7F) | (i > 0 ? 0x80 : 0));
+        v >>= 7;
+    }
+    return p + n;
+}
+
+static uint64_t GetTrailer(const uint8_t* pEnd, size_t* pnLen) {
+    uint64_t v = 0;
+    int nShift = 0;
+    size_t n = 0;
+    uint8_t b;
+    do {
+        b = *--pEnd;
+        v |= (uint64_t)(b & 0x7F) << nShift;
+        nShift += 7;
+        n++;
+    } while (b & 0x80);
+    *pnLen = n;
+    return v;
+}
+
+static inline uint64_t ZigZag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t UnZigZag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static int FitsInBytes(const TextUnit* pText, size_t nLen) {
+    for (size_t i = 0; i < nLen; i++) {
+        if (pText[i] > 0xFF) return 0;
+    }
+    return 1;
+}
+
+static uint8_t* PutText(uint8_t* p, const TextUnit* pText, size_t nLen, int bWide) {
+    if (bWide) {
+        for (size_t i = 0; i < nLen; i++) {
+            *p++ = (uint8_t)pText[i];
+            *p++ = (uint8_t)(pText[i] >> 8);
+        }
+    } else {
+        for (size_t i = 0; i < nLen; i++) *p++ = (uint8_t)pText[i];
+    }
+    return p;
+}
+
+/* Removed text is written straight from the document's spans */
+typedef struct {
+    uint8_t* p;
+    int bWide;
+} PutContext;
+
+static int SpanFitsInBytes(void* pContext, const TextUnit* pText, size_t nLen) {
+    (void)pContext;
+    return FitsInBytes(pText, nLen);
+}
+
+static int PutSpan(void* pContext, const TextUnit* pText, size_t nLen) {
+    PutContext* pPut = (PutContext*)pContext;
+    pPut->p = PutText(pPut->p, pText, nLen, pPut->bWide);
+    return 1;
+}
+
+static uint8_t* PutDocumentText(uint8_t* p, const PieceTable* pDoc, size_t nOffset, size_t nLen, int bWide) {
+    PutContext put;
+    put.p = p;
+    put.bWide = bWide;
+    PieceTableForEach(pDoc, nOffset, nLen, PutSpan, &put);
+    return put.p;
+}
+
+static void GetText(const uint8_t* p, size_t nLen, int bWide, TextUnit* pDest) {
+    if (bWide) {
+        for (size_t i = 0; i < nLen; i++) pDest[i] = (TextUnit)(p[2 * i] | (p[2 * i + 1] << 8));
+    } else {
+        for (size_t i = 0; i < nLen; i++) pDest[i] = p[i];
+    }
+}
+
+/* Decode the record starting at p */
+static void ReadRecord(const uint8_t* p, UndoRecord* pRecord) {
+    const uint8_t* pStart = p;
+    uint64_t v;
+
+    pRecord->nFlags = *p++;
+    p = GetVarint(p, &v);
+    pRecord->nDelta = UnZigZag(v);
+    p = GetVarint(p, &v);
+    pRecord->nRemoved = (size_t)v;
+    p = GetVarint(p, &v);
+    pRecord->nInserted = (size_t)v;
+    pRecord->nMatches = 0;
+    pRecord->nWith = 0;
+
+    if (pRecord->nFlags & UNDO_FLAG_MATCHES) {
+        /* Match count and replacement, then each match: units since the last one, length, text */
+        p = GetVarint(p, &v);
+        pRecord->nMatches = (size_t)v;
+        p = GetVarint(p, &v);
+        pRecord->nWith = (size_t)v;
+        pRecord->pInserted = p;
+        p += pRecord->nWith * ((pRecord->nFlags & UNDO_FLAG_INSERTED_WIDE) ? 2 : 1);
+        pRecord->pRemoved = p;
+        for (size_t i = 0; i < pRecord->nMatches; i++) {
+            p = GetVarint(p, &v);
+            p = GetVarint(p, &v);
+            p += (size_t)v * ((pRecord->nFlags & UNDO_FLAG_REMOVED_WIDE) ? 2 : 1);
+        }
+    } else {
+        pRecord->pRemoved = p;
+        p += pRecord->nRemoved * ((pRecord->nFlags & UNDO_FLAG_REMOVED_WIDE) ? 2 : 1);
+        pRecord->pInserted = p;
+        p += pRecord->nInserted * ((pRecord->nFlags & UNDO_FLAG_INSERTED_WIDE) ? 2 : 1);
+    }
+
+    pRecord->nSize = (size_t)(p - pStart) + VarintSize((uint64_t)(p - pStart));
+}
+
+/* Decode the record ending at pEnd */
+static void ReadRecordBefore(const uint8_t* pEnd, UndoRecord* pRecord) {
+    size_t nTrailer;
+    uint64_t nBody = GetTrailer(pEnd, &nTrailer);
+    ReadRecord(pEnd - nTrailer - nBody, pRecord);
+}
+
+/*
+ * The span of a Replace All record as it reads after undo (bUndo) or redo:
+ * the text between matches comes from the document, which holds the span
+ * as it reads before, starting at nOffset. Returns nonzero on success.
+ */
+static int BuildMatchesText(const UndoRecord* pRecord, const PieceTable* pDoc, size_t nOffset, int bUndo,
+                            TextUnit* pDest) {
+    int bRemovedWide = (pRecord->nFlags & UNDO_FLAG_REMOVED_WIDE) != 0;
+    size_t nTotal = bUndo ? pRecord->nRemoved : pRecord->nInserted;
+    size_t nDocSpan = bUndo ? pRecord->nInserted : pRecord->nRemoved;
+    size_t nDoc = nOffset, nOut = 0;
+    const uint8_t* p = pRecord->pRemoved;
+    uint64_t nGap, nLen;
+
+    for (size_t i = 0; i < pRecord->nMatches; i++) {
+        p = GetVarint(p, &nGap);
+        p = GetVarint(p, &nLen);
+        if (nGap > nTotal - nOut || PieceTableCopy(pDoc, nDoc, pDest + nOut, (size_t)nGap) != nGap) return 0;
+        nOut += (size_t)nGap;
+        nDoc += (size_t)nGap;
+        if (bUndo) {
+            if (nLen > nTotal - nOut) return 0;
+            GetText(p, (size_t)nLen, bRemovedWide, pDest + nOut);
+            nOut += (size_t)nLen;
+            nDoc += pRecord->nWith;
+        } else {
+            if (pRecord->nWith > nTotal - nOut) return 0;
+            GetText(pRecord->pInserted, pRecord->nWith, pRecord->nFlags & UNDO_FLAG_INSERTED_WIDE, pDest + nOut);
+            nOut += pRecord->nWith;
+            nDoc += (size_t)nLen;
+        }
+        p += (size_t)nLen * (bRemovedWide ? 2 : 1);
+    }
+
+    /* Whatever follows the last match (a unit stepped over after an empty one) */
+    if (nDoc > nOffset + nDocSpan || nOffset + nDocSpan - nDoc != nTotal - nOut) return 0;
+    return PieceTableCopy(pDoc, nDoc, pDest + nOut, nTotal - nOut) == nTotal - nOut;
+}
+
+/* ---- Arena ---- */
+
+static UndoBlock* NewBlock(size_t nSize) {
+    UndoBlock* pBlock = (UndoBlock*)malloc(offsetof(UndoBlock, aData) + nSize);
+    if (!pBlock) return NULL;
+    pBlock->pPrev = NULL;
+    pBlock->pNext = NULL;
+    pBlock->nStart = 0;
+    pBlock->nUsed = 0;
+    pBlock->nSize = nSize;
+    return pBlock;
+}
+
+static void FreeBlocksFrom(UndoBlock* pBlock) {
+    while (pBlock) {
+        UndoBlock* pNext = pBlock->pNext;
+        free(pBlock);
+        pBlock = pNext;
+    }
+}
+
+static int EnsureScratch(UndoJournal* pJournal, size_t nLen) {
+    TextUnit* pNew;
+    size_t nCapacity;
+
+    if (nLen <= pJournal->nScratchCapacity) return 1;
+    nCapacity = pJournal->nScratchCapacity ? pJournal->nScratchCapacity : 256;
+    while (nCapacity < nLen) nCapacity *= 2;
+
+    pNew = (TextUnit*)realloc(pJournal->pScratch, nCapacity * sizeof(TextUnit));
+    if (!pNew) return 0;
+    pJournal->pScratch = pNew;
+    pJournal->nScratchCapacity = nCapacity;
+    return 1;
+}
+
+/* Let go of a decode buffer grown for one big step */
+static void TrimScratch(UndoJournal* pJournal) {
+    if (pJournal->nScratchCapacity <= UNDO_SCRATCH_KEEP) return;
+    free(pJournal->pScratch);
+    pJournal->pScratch = NULL;
+    pJournal->nScratchCapacity = 0;
+}
+
+/* Step the cursor back over block boundaries; returns 0 at the first record */
+static int CursorToPrevRecord(UndoJournal* pJournal) {
+    while (pJournal->pCursor && pJournal->nCursorPos == pJournal->pCursor->nStart) {
+        if (!pJournal->pCursor->pPrev) return 0;
+        pJournal->pCursor = pJournal->pCursor->pPrev;
+        pJournal->nCursorPos = pJournal->pCursor->nUsed;
+    }
+    return pJournal->pCursor != NULL;
+}
+
+/* Step the cursor forward over block boundaries; returns 0 past the last record */
+static int CursorToNextRecord(UndoJournal* pJournal) {
+    while (pJournal->pCursor && pJournal->nCursorPos == pJournal->pCursor->nUsed) {
+        if (!pJournal->pCursor->pNext) return 0;
+        pJournal->pCursor = pJournal->pCursor->pNext;
+        pJournal->nCursorPos = pJournal->pCursor->nStart;
+    }
+    return pJournal->pCursor != NULL;
+}
+
+/* Forget every record after the cursor (the redo history) */
+static void DropRedo(UndoJournal* pJournal) {
+    UndoBlock* pCursor = pJournal->pCursor;
+
+    if (!pCursor) return;
+    for (UndoBlock* pBlock = pCursor->pNext; pBlock; pBlock = pBlock->pNext) {
+        pJournal->nBytes -= pBlock->nUsed - pBlock->nStart;
+    }
+    FreeBlocksFrom(pCursor->pNext);
+    pCursor->pNext = NULL;
+
+    pJournal->nBytes -= pCursor->nUsed - pJournal->nCursorPos;
+    pCursor->nUsed = pJournal->nCursorPos;
+    pJournal->pTail = pCursor;
+    pJournal->pGroupBlock = NULL;
+}
+
+/* Remove the first record of the journal */
+static void DropFirstRecord(UndoJournal* pJournal) {
+    UndoBlock* pHead = pJournal->pHead;
+    UndoRecord record;
+
+    ReadRecord(pHead->aData + pHead->nStart, &record);
+    pHead->nStart += record.nSize;
+    pJournal->nBytes -= record.nSize;
+    pJournal->nDropped++;
+
+    /* An emptied block goes, unless it is the last one */
+    if (pHead->nStart == pHead->nUsed && pHead->pNext) {
+        if (pJournal->pCursor == pHead) {
+            pJournal->pCursor = pHead->pNext;
+            pJournal->nCursorPos = pHead->pNext->nStart;
+        }
+        pJournal->pHead = pHead->pNext;
+        pJournal->pHead->pPrev = NULL;
+        free(pHead);
+    }
+}
+
+/* First record of the journal, if any */
+static int PeekFirstRecord(const UndoJournal* pJournal, UndoRecord* pRecord) {
+    const UndoBlock* pHead = pJournal->pHead;
+    if (!pHead || pHead->nStart == pHead->nUsed) return 0;
+    ReadRecord(pHead->aData + pHead->nStart, pRecord);
+    return 1;
+}
+
+/* Drop whole undo steps, oldest first, until the budget is met; the newest step stays */
+static void EnforceBudget(UndoJournal* pJournal) {
+    UndoRecord record;
+
+    if (pJournal->nBudget == 0) return;
+    while (pJournal->nBytes > pJournal->nBudget && PeekFirstRecord(pJournal, &record)) {
+        if (pJournal->pHead == pJournal->pGroupBlock && pJournal->pHead->nStart == pJournal->nGroupPos) break;
+        do {
+            DropFirstRecord(pJournal);
+        } while (PeekFirstRecord(pJournal, &record) && !(record.nFlags & UNDO_FLAG_GROUP));
+    }
+}
+
+/* Room for an nSize-byte record at the end of the journal; NULL (and no history) if there is none */
+static uint8_t* StartRecord(UndoJournal* pJournal, size_t nSize, int bGroup) {
+    UndoBlock* pTail = pJournal->pTail;
+
+    /* Room in the newest block, or a new one */
+    if (!pTail || pTail->nSize - pTail->nUsed < nSize) {
+        UndoBlock* pBlock = NewBlock(nSize > UNDO_BLOCK_SIZE ? nSize : UNDO_BLOCK_SIZE);
+        if (!pBlock) {
+            UndoJournalClear(pJournal);
+            return NULL;
+        }
+        if (pTail && pTail->nUsed == pTail->nStart) {
+            /* Replace an empty block */
+            pBlock->pPrev = pTail->pPrev;
+            if (pTail->pPrev) pTail->pPrev->pNext = pBlock;
+            if (pJournal->pHead == pTail) pJournal->pHead = pBlock;
+            free(pTail);
+        } else if (pTail) {
+            pBlock->pPrev = pTail;
+            pTail->pNext = pBlock;
+        } else {
+            pJournal->pHead = pBlock;
+        }
+        pJournal->pTail = pTail = pBlock;
+    }
+
+    if (bGroup) {
+        pJournal->pGroupBlock = pTail;
+        pJournal->nGroupPos = pTail->nUsed;
+    }
+    return pTail->aData + pTail->nUsed;
+}
+
+/* Take the record just written in; nEnd is where its edit ends */
+static void EndRecord(UndoJournal* pJournal, size_t nSize, size_t nEnd, int nKind, TextUnit lastUnit) {
+    UndoBlock* pTail = pJournal->pTail;
+
+    pTail->nUsed += nSize;
+    pJournal->nBytes += nSize;
+    pJournal->pCursor = pTail;
+    pJournal->nCursorPos = pTail->nUsed;
+    pJournal->nCursorEnd = nEnd;
+    pJournal->nLastKind = nKind;
+    pJournal->lastUnit = lastUnit;
+    pJournal->bSealed = 0;
+
+    EnforceBudget(pJournal);
+}
+
+/* Layout of a Replace All record */
+typedef struct {
+    int nFlags;
+    size_t nInserted;            /* Units in the span after the replacement */
+    size_t nBody;
+    size_t nSize;
+} MatchesLayout;
+
+/* Lay out a Replace All record; returns 0 if the matches are not in order within the span */
+static int LayOutMatches(const UndoJournal* pJournal, const PieceTable* pDoc, size_t nOffset, size_t nRemoved,
+                         const UndoMatch* pMatches, size_t nMatches, const TextUnit* pWith, size_t nWith,
+                         MatchesLayout* pLayout) {
+    size_t nEnd = nOffset, nMatched = 0, nText = 0;
+    int64_t nDelta = (int64_t)nOffset - (int64_t)pJournal->nCursorEnd;
+
+    if (nOffset > PieceTableLength(pDoc) || nRemoved > PieceTableLength(pDoc) - nOffset) return 0;
+    pLayout->nFlags = UNDO_FLAG_GROUP | UNDO_FLAG_MATCHES;
+    for (size_t i = 0; i < nMatches; i++) {
+        if (pMatches[i].nAt < nEnd || pMatches[i].nLen > nOffset + nRemoved - pMatches[i].nAt) return 0;
+        nText += VarintSize(pMatches[i].nAt - nEnd) + VarintSize(pMatches[i].nLen);
+        if (!(pLayout->nFlags & UNDO_FLAG_REMOVED_WIDE) &&
+            !PieceTableForEach(pDoc, pMatches[i].nAt, pMatches[i].nLen, SpanFitsInBytes, NULL)) {
+            pLayout->nFlags |= UNDO_FLAG_REMOVED_WIDE;
+        }
+        nMatched += pMatches[i].nLen;
+        nEnd = pMatches[i].nAt + pMatches[i].nLen;
+    }
+    if (nWith > 0 && nMatches > ((size_t)-1 - nRemoved) / nWith) return 0;
+    if (!FitsInBytes(pWith, nWith)) pLayout->nFlags |= UNDO_FLAG_INSERTED_WIDE;
+
+    pLayout->nInserted = nRemoved - nMatched + nMatches * nWith;
+    pLayout->nBody = 1 + VarintSize(ZigZag(nDelta)) + VarintSize(nRemoved) + VarintSize(pLayout->nInserted) +
+                     VarintSize(nMatches) + VarintSize(nWith) +
+                     nWith * ((pLayout->nFlags & UNDO_FLAG_INSERTED_WIDE) ? 2 : 1) +
+                     nText + nMatched * ((pLayout->nFlags & UNDO_FLAG_REMOVED_WIDE) ? 2 : 1);
+    pLayout->nSize = pLayout->nBody + VarintSize(pLayout->nBody);
+    return 1;
+}
+
+/* ---- Public interface ---- */
+
+void UndoJournalInit(UndoJournal* pJournal, size_t nBudget) {
+    memset(pJournal, 0, sizeof(*pJournal));
+    pJournal->nBudget = nBudget;
+    pJournal->bSealed = 1;
+}
+
+void UndoJournalFree(UndoJournal* pJournal) {
+    FreeBlocksFrom(pJournal->pHead);
+    free(pJournal->pScratch);
+    UndoJournalInit(pJournal, pJournal->nBudget);
+}
+
+void UndoJournalClear(UndoJournal* pJournal) {
+    TextUnit* pScratch = pJournal->pScratch;
+    size_t nScratchCapacity = pJournal->nScratchCapacity;
+
+    FreeBlocksFrom(pJournal->pHead);
+    UndoJournalInit(pJournal, pJournal->nBudget);
+    pJournal->pScratch = pScratch;
+    pJournal->nScratchCapacity = nScratchCapacity;
+    TrimScratch(pJournal);
+}
+
+int UndoJournalRecord(UndoJournal* pJournal, const PieceTable* pDoc, size_t nOffset,
+                      size_t nRemoved, const TextUnit* pInsert, size_t nInsert) {
+    int nKind, bGroup, nFlags = 0;
+    int64_t nDelta = (int64_t)nOffset - (int64_t)pJournal->nCursorEnd;
+    size_t nBody, nSize;
+    uint8_t* p;
+
+    if (nRemoved == 0 && nInsert == 0) return 1;
+
+    /* A new edit ends the redo history */
+    if (CursorToNextRecord(pJournal)) DropRedo(pJournal);
+
+    /* Keystrokes continue the current step if they carry on where the last one ended */
+    if (nInsert == 1 && nRemoved <= 1) {
+        nKind = UNDO_KIND_TYPE;
+    } else if (nInsert == 0 && nRemoved == 1) {
+        nKind = UNDO_KIND_DELETE;
+    } else {
+        nKind = UNDO_KIND_OTHER;
+    }
+    bGroup = pJournal->bSealed || nKind != pJournal->nLastKind || nKind == UNDO_KIND_OTHER;
+    if (!bGroup && nKind == UNDO_KIND_TYPE) {
+        /* A new word starts a new step */
+        bGroup = nDelta != 0 || (IsRunBreak(pJournal->lastUnit) && !IsRunBreak(pInsert[0]));
+    } else if (!bGroup && nKind == UNDO_KIND_DELETE) {
+        /* Delete stays put, Backspace moves back one */
+        bGroup = nDelta != 0 && nDelta != -1;
+    }
+
+    /* The removed text is still in the document */
+    if (nOffset > PieceTableLength(pDoc) || nRemoved > PieceTableLength(pDoc) - nOffset) {
+        UndoJournalClear(pJournal);
+        return 0;
+    }
+
+    /* An edit bigger than the whole budget cannot be undone at all; tell before reading any text */
+    if (pJournal->nBudget && nRemoved + nInsert > pJournal->nBudget) {
+        UndoJournalClear(pJournal);
+        return 0;
+    }
+
+    if (bGroup) nFlags |= UNDO_FLAG_GROUP;
+    if (!PieceTableForEach(pDoc, nOffset, nRemoved, SpanFitsInBytes, NULL)) nFlags |= UNDO_FLAG_REMOVED_WIDE;
+    if (!FitsInBytes(pInsert, nInsert)) nFlags |= UNDO_FLAG_INSERTED_WIDE;
+
+    nBody = 1 + VarintSize(ZigZag(nDelta)) + VarintSize(nRemoved) + VarintSize(nInsert) +
+            nRemoved * ((nFlags & UNDO_FLAG_REMOVED_WIDE) ? 2 : 1) +
+            nInsert * ((nFlags & UNDO_FLAG_INSERTED_WIDE) ? 2 : 1);
+    nSize = nBody + VarintSize(nBody);
+
+    if (pJournal->nBudget && nSize > pJournal->nBudget) {
+        UndoJournalClear(pJournal);
+        return 0;
+    }
+
+    p = StartRecord(pJournal, nSize, bGroup);
+    if (!p) return 0;
+    *p++ = (uint8_t)nFlags;
+    p = PutVarint(p, ZigZag(nDelta));
+    p = PutVarint(p, nRemoved);
+    p = PutVarint(p, nInsert);
+    p = PutDocumentText(p, pDoc, nOffset, nRemoved, nFlags & UNDO_FLAG_REMOVED_WIDE);
+    p = PutText(p, pInsert, nInsert, nFlags & UNDO_FLAG_INSERTED_WIDE);
+    PutTrailer(p, nBody);
+
+    EndRecord(pJournal, nSize, nOffset + nInsert, nKind, nInsert ? pInsert[nInsert - 1] : 0);
+    return 1;
+}
+
+int UndoJournalCanRecordMatches(const UndoJournal* pJournal, const PieceTable* pDoc, size_t nOffset,
+                                size_t nRemoved, const UndoMatch* pMatches, size_t nMatches,
+                                const TextUnit* pWith, size_t nWith) {
+    MatchesLayout layout;
+    if (!LayOutMatches(pJournal, pDoc, nOffset, nRemoved, pMatches, nMatches, pWith, nWith, &layout)) return 0;
+    return pJournal->nBudget == 0 || layout.nSize <= pJournal->nBudget;
+}
+
+int UndoJournalRecordMatches(UndoJournal* pJournal, const PieceTable* pDoc, size_t nOffset,
+                             size_t nRemoved, const UndoMatch* pMatches, size_t nMatches,
+                             const TextUnit* pWith, size_t nWith) {
+    int64_t nDelta = (int64_t)nOffset - (int64_t)pJournal->nCursorEnd;
+    MatchesLayout layout;
+    size_t nEnd = nOffset;
+    uint8_t* p;
+
+    if (nMatches == 0) return 1;
+    if (CursorToNextRecord(pJournal)) DropRedo(pJournal);
+
+    if (!LayOutMatches(pJournal, pDoc, nOffset, nRemoved, pMatches, nMatches, pWith, nWith, &layout) ||
+        (pJournal->nBudget && layout.nSize > pJournal->nBudget)) {
+        UndoJournalClear(pJournal);
+        return 0;
+    }
+    if (nRemoved == 0 && layout.nInserted == 0) return 1;
+
+    p = StartRecord(pJournal, layout.nSize, 1);
+    if (!p) return 0;
+    *p++ = (uint8_t)layout.nFlags;
+    p = PutVarint(p, ZigZag(nDelta));
+    p = PutVarint(p, nRemoved);
+    p = PutVarint(p, layout.nInserted);
+    p = PutVarint(p, nMatches);
+    p = PutVarint(p, nWith);
+    p = PutText(p, pWith, nWith, layout.nFlags & UNDO_FLAG_INSERTED_WIDE);
+    for (size_t i = 0; i < nMatches; i++) {
+        p = PutVarint(p, pMatches[i].nAt - nEnd);
+        p = PutVarint(p, pMatches[i].nLen);
+        p = PutDocumentText(p, pDoc, pMatches[i].nAt, pMatches[i].nLen, layout.nFlags & UNDO_FLAG_REMOVED_WIDE);
+        nEnd = pMatches[i].nAt + pMatches[i].nLen;
+    }
+    PutTrailer(p, layout.nBody);
+
+    EndRecord(pJournal, layout.nSize, nOffset + layout.nInserted, UNDO_KIND_OTHER, 0);
+    return 1;
+}
+
+void UndoJournalSeal(UndoJournal* pJournal) {
+    pJournal->bSealed = 1;
+}
+
+int UndoJournalUndo(UndoJournal* pJournal, const PieceTable* pDoc, UndoApplyProc pfnApply, void* pContext,
+                    size_t* pnCaret) {
+    UndoRecord record;
+
+    if (!CursorToPrevRecord(pJournal)) return 0;
+
+    do {
+        size_t nOffset;
+
+        ReadRecordBefore(pJournal->pCursor->aData + pJournal->nCursorPos, &record);
+        nOffset = pJournal->nCursorEnd - record.nInserted;
+
+        /* Put the removed text back in place of the inserted text */
+        if (!EnsureScratch(pJournal, record.nRemoved)) {
+            UndoJournalClear(pJournal);
+            return 0;
+        }
+        if (record.nFlags & UNDO_FLAG_MATCHES) {
+            if (!BuildMatchesText(&record, pDoc, nOffset, 1, pJournal->pScratch)) {
+                UndoJournalClear(pJournal);
+                return 0;
+            }
+        } else {
+            GetText(record.pRemoved, record.nRemoved, record.nFlags & UNDO_FLAG_REMOVED_WIDE, pJournal->pScratch);
+        }
+        if (!pfnApply(pContext, nOffset, record.nInserted, pJournal->pScratch, record.nRemoved)) {
+            UndoJournalClear(pJournal);
+            return 0;
+        }
+
+        pJournal->nCursorPos -= record.nSize;
+        pJournal->nCursorEnd = (size_t)((int64_t)nOffset - record.nDelta);
+        if (pnCaret) *pnCaret = nOffset + record.nRemoved;
+    } while (!(record.nFlags & UNDO_FLAG_GROUP) && CursorToPrevRecord(pJournal));
+    TrimScratch(pJournal);
+
+    /* Typing after an undo never joins the step before it */
+    pJournal->bSealed = 1;
+    pJournal->nLastKind = UNDO_KIND_NONE;
+    return 1;
+}
+
+int UndoJournalRedo(UndoJournal* pJournal, const PieceTable* pDoc, UndoApplyProc pfnApply, void* pContext,
+                    size_t* pnCaret) {
+    UndoRecord record;
+
+    if (!CursorToNextRecord(pJournal)) return 0;
+
+    for (;;) {
+        size_t nOffset;
+
+        ReadRecord(pJournal->pCursor->aData + pJournal->nCursorPos, &record);
+        nOffset = (size_t)((int64_t)pJournal->nCursorEnd + record.nDelta);
+
+        if (!EnsureScratch(pJournal, record.nInserted)) {
+            UndoJournalClear(pJournal);
+            return 0;
+        }
+        if (record.nFlags & UNDO_FLAG_MATCHES) {
+            if (!BuildMatchesText(&record, pDoc, nOffset, 0, pJournal->pScratch)) {
+                UndoJournalClear(pJournal);
+                return 0;
+            }
+        } else {
+            GetText(record.pInserted, record.nInserted, record.nFlags & UNDO_FLAG_INSERTED_WIDE, pJournal->pScratch);
+        }
+        if (!pfnApply(pContext, nOffset, record.nRemoved, pJournal->pScratch, record.nInserted)) {
+            UndoJournalClear(pJournal);
+            return 0;
+        }
+
+        pJournal->nCursorPos += record.nSize;
+        pJournal->nCursorEnd = nOffset + record.nInserted;
+        if (pnCaret) *pnCaret = pJournal->nCursorEnd;
+
+        /* Stop in front of the next step */
+        if (!CursorToNextRecord(pJournal)) break;
+        ReadRecord(pJournal->pCursor->aData + pJournal->nCursorPos, &record);
+        if (record.nFlags & UNDO_FLAG_GROUP) break;
+    }
+    TrimScratch(pJournal);
+
+    pJournal->bSealed = 1;
+    pJournal->nLastKind = UNDO_KIND_NONE;
+    return 1;
+}
+
+int UndoJournalCanUndo(const UndoJournal* pJournal) {
+    const UndoBlock* pBlock = pJournal->pCursor;
+    size_t nPos = pJournal->nCursorPos;
+
+    while (pBlock && nPos == pBlock->nStart) {
+        if (!pBlock->pPrev) return 0;
+        pBlock = pBlock->pPrev;
+        nPos = pBlock->nUsed;
+    }
+    return pBlock != NULL;
+}
+
+int UndoJournalCanRedo(const UndoJournal* pJournal) {
+    const UndoBlock* pBlock = pJournal->pCursor;
+    size_t nPos = pJournal->nCursorPos;
+
+    while (pBlock && nPos == pBlock->nUsed) {
+        if (!pBlock->pNext) return 0;
+        pBlock = pBlock->pNext;
+        nPos = pBlock->nStart;
+    }
+    return pBlock != NULL;
+}
+
+size_t UndoJournalBytes(const UndoJournal* pJournal) {
+    return pJournal->nBytes;
+}
@@ -0,0 +1,112 @@
+#ifndef UNDO_JOURNAL_H
+#define UNDO_JOURNAL_H
+
+/*
+ * Undo/redo journal for a piece table document.
+ *
+ * Portable C. Every edit is one record in an arena of blocks:
+ *
+ *   flags | offset delta | removed | inserted | removed text | inserted text | size
+ *
+ * The offset is stored relative to where the previous edit ended, so typing
+ * and backspacing cost one byte for it; counts are LEB128 varints; text that
+ * fits in 8 bits is stored one byte per unit. The size trailer is written so
+ * it can be read backwards, which lets undo walk the records from the end.
+ * A Replace All is one record of its matches alone:
+ *
+ *   flags | offset delta | removed | inserted | matches | replacement length |
+ *   replacement | (units since the last match | length | match text)... | size
+ *
+ * so it costs what the matches cost however far apart they are; undo and
+ * redo rebuild the span from the document and apply it as one edit.
+ *
+ * Consecutive keystrokes (a typing run, a run of Backspace or Delete) are
+ * grouped and undone as one step; UndoJournalSeal ends a run early. When the
+ * records outgrow the memory budget the oldest groups are dropped.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "piece_table.h"
+
+/* Bytes per arena block (a bigger record gets a block of its own) */
+#define UNDO_BLOCK_SIZE (64 * 1024)
+
+typedef struct UndoBlock UndoBlock;
+
+/* Journal state */
+typedef struct {
+    UndoBlock* pHead;            /* Oldest block */
+    UndoBlock* pTail;            /* Newest block */
+    UndoBlock* pCursor;          /* Block holding the undo/redo split */
+    size_t nCursorPos;           /* Records before this position are applied */
+    size_t nCursorEnd;           /* Where the last applied edit ended (delta base) */
+    UndoBlock* pGroupBlock;      /* Start of the newest group */
+    size_t nGroupPos;
+    size_t nBytes;               /* Bytes of live records */
+    size_t nBudget;              /* Most bytes to keep (0 for no limit) */
+    size_t nDropped;             /* Records dropped for the budget */
+    int nLastKind;               /* Kind of the newest record, for grouping */
+    TextUnit lastUnit;           /* Last unit typed in the current run */
+    int bSealed;                 /* The next record starts a new group */
+    TextUnit* pScratch;          /* Decode buffer */
+    size_t nScratchCapacity;
+} UndoJournal;
+
+/* One match a Replace All is about to replace */
+typedef struct {
+    size_t nAt;                  /* Document offset */
+    size_t nLen;                 /* Units matched */
+} UndoMatch;
+
+/* Applies one edit: replace nRemove units at nOffset with pInsert (returns nonzero on success) */
+typedef int (*UndoApplyProc)(void* pContext, size_t nOffset, size_t nRemove,
+                             const TextUnit* pInsert, size_t nInsert);
+
+/* Lifetime */
+void UndoJournalInit(UndoJournal* pJournal, size_t nBudget);
+void UndoJournalFree(UndoJournal* pJournal);
+void UndoJournalClear(UndoJournal* pJournal);
+
+/*
+ * Record that [nOffset, nOffset + nRemoved) of pDoc is about to be replaced
+ * by pInsert. Call before changing the document. Returns 0 (and forgets all
+ * history) if the record cannot be stored; an edit bigger than the budget
+ * is turned away before any of its text is read.
+ */
+int UndoJournalRecord(UndoJournal* pJournal, const PieceTable* pDoc, size_t nOffset,
+                      size_t nRemoved, const TextUnit* pInsert, size_t nInsert);
+
+/*
+ * Record that each of nMatches matches (in order, not overlapping, within
+ * [nOffset, nOffset + nRemoved) of pDoc) is about to be replaced by pWith,
+ * the span being changed as one edit. The record is one undo step of its
+ * own. Returns 0 (and forgets all history) if it cannot be stored;
+ * UndoJournalCanRecordMatches says beforehand whether it fits the budget.
+ */
+int UndoJournalRecordMatches(UndoJournal* pJournal, const PieceTable* pDoc, size_t nOffset,
+                             size_t nRemoved, const UndoMatch* pMatches, size_t nMatches,
+                             const TextUnit* pWith, size_t nWith);
+int UndoJournalCanRecordMatches(const UndoJournal* pJournal, const PieceTable* pDoc, size_t nOffset,
+                                size_t nRemoved, const UndoMatch* pMatches, size_t nMatches,
+                                const TextUnit* pWith, size_t nWith);
+
+/* End the current typing run: the next edit starts a new undo step */
+void UndoJournalSeal(UndoJournal* pJournal);
+
+/*
+ * Undo or redo one step of pDoc through pfnApply (which changes pDoc).
+ * Returns nonzero if a step was applied; *pnCaret (may be NULL) receives
+ * where the last change ended. If pfnApply fails the history is cleared.
+ */
+int UndoJournalUndo(UndoJournal* pJournal, const PieceTable* pDoc, UndoApplyProc pfnApply, void* pContext,
+                    size_t* pnCaret);
+int UndoJournalRedo(UndoJournal* pJournal, const PieceTable* pDoc, UndoApplyProc pfnApply, void* pContext,
+                    size_t* pnCaret);
+
+/* Queries */
+int UndoJournalCanUndo(const UndoJournal* pJournal);
+int UndoJournalCanRedo(const UndoJournal* pJournal);
+size_t UndoJournalBytes(const UndoJournal* pJournal);
+
+#endif /* UNDO_JOURNAL_H */
@@ -0,0 +1,166 @@
+#include "wrap_layout.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* East Asian wide characters (two columns; a row may break before or after one) */
+static int IsWideUnit(TextUnit u) {
+    return (u >= 0x1100 && u <= 0x115F) || (u >= 0x2E80 && u <= 0x303E) ||
+           (u >= 0x3041 && u <= 0x33FF) || (u >= 0x3400 && u <= 0x4DBF) ||
+           (u >= 0x4E00 && u <= 0x9FFF) || (u >= 0xA000 && u <= 0xA4CF) ||
+           (u >= 0xAC00 && u <= 0xD7A3) || (u >= 0xF900 && u <= 0xFAFF) ||
+           (u >= 0xFE30 && u <= 0xFE4F) || (u >= 0xFF00 && u <= 0xFF60) ||
+           (u >= 0xFFE0 && u <= 0xFFE6);
+}
+
+/* Units drawn on top of the one before (no columns of their own) */
+static int IsZeroWidthUnit(TextUnit u) {
+    return (u >= 0xDC00 && u <= 0xDFFF) || (u >= 0x0300 && u <= 0x036F) ||
+           (u >= 0x1AB0 && u <= 0x1AFF) || (u >= 0x1DC0 && u <= 0x1DFF) ||
+           (u >= 0x20D0 && u <= 0x20FF) || (u >= 0xFE20 && u <= 0xFE2F) ||
+           (u >= 0x200B && u <= 0x200D);
+}
+
+size_t WrapUnitColumns(TextUnit u, size_t nCol) {
+    if (u == '\t') return WRAP_TAB_COLUMNS - nCol % WRAP_TAB_COLUMNS;
+    if (IsZeroWidthUnit(u)) return 0;
+    return IsWideUnit(u) ? 2 : 1;
+}
+
+size_t WrapLineColumns(const TextUnit* pText, size_t nLen) {
+    size_t nCol = 0;
+    for (size_t i = 0; i < nLen; i++) nCol += WrapUnitColumns(pText[i], nCol);
+    return nCol;
+}
+
+size_t WrapRowEnd(const TextUnit* pText, size_t nLen, size_t nStart, size_t nCols) {
+    size_t nCol = 0, nBreak = nStart, i = nStart;
+
+    if (nCols == 0) nCols = 1;
+    while (i < nLen) {
+        TextUnit u = pText[i];
+        size_t nWidth = WrapUnitColumns(u, nCol);
+
+        if (nWidth > 0 && nCol + nWidth > nCols) {
+            if (u == ' ' || u == '\t') {
+                /* Spaces (and marks on them) hang past the edge; the next row starts with the next word */
+                while (i < nLen && (pText[i] == ' ' || pText[i] == '\t' || IsZeroWidthUnit(pText[i]))) i++;
+                return i;
+            }
+            if (i == nStart) {
+                /* Wider than a whole row: it gets the row to itself, and any spaces after it hang */
+                i++;
+                while (i < nLen && (IsZeroWidthUnit(pText[i]) || pText[i] == ' ' || pText[i] == '\t')) i++;
+                return i;
+            }
+            if (IsWideUnit(u)) return i;
+            return nBreak > nStart ? nBreak : i;
+        }
+
+        nCol += nWidth;
+        i++;
+        if (u == ' ' || u == '\t' || u == '-' || IsWideUnit(u)) {
+            /* Not inside a character: marks that follow belong to it */
+            while (i < nLen && IsZeroWidthUnit(pText[i])) i++;
+            nBreak = i;
+        }
+    }
+    return nLen;
+}
+
+int WrapLineLayout(WrapLine* pLine, const TextUnit* pText, size_t nLen, size_t nCols) {
+    size_t nPos = 0;
+
+    pLine->nRows = 0;
+    pLine->bValid = 0;
+    do {
+        if (pLine->nRows == pLine->nCapacity) {
+            size_t nCapacity = pLine->nCapacity ? pLine->nCapacity * 2 : 8;
+            size_t* pNew = (size_t*)realloc(pLine->pStarts, nCapacity * sizeof(size_t));
+            if (!pNew) return 0;
+            pLine->pStarts = pNew;
+            pLine->nCapacity = nCapacity;
+        }
+        pLine->pStarts[pLine->nRows++] = nPos;
+        nPos = WrapRowEnd(pText, nLen, nPos, nCols);
+    } while (nPos < nLen);
+
+    pLine->nCols = nCols;
+    pLine->nLen = nLen;
+    pLine->nWidth = pLine->nRows == 1 ? WrapLineColumns(pText, nLen) : SIZE_MAX;
+    pLine->bValid = 1;
+    return 1;
+}
+
+void WrapLineFree(WrapLine* pLine) {
+    free(pLine->pStarts);
+    memset(pLine, 0, sizeof(*pLine));
+}
+
+size_t WrapLineRowStart(const WrapLine* pLine, size_t nRow) {
+    return nRow < pLine->nRows ? pLine->pStarts[nRow] : pLine->nLen;
+}
+
+size_t WrapLineRowEnd(const WrapLine* pLine, size_t nRow) {
+    return nRow + 1 < pLine->nRows ? pLine->pStarts[nRow + 1] : pLine->nLen;
+}
+
+size_t WrapLineRowOf(const WrapLine* pLine, size_t nOffset) {
+    size_t nLow = 0, nHigh = pLine->nRows;
+
+    /* Last row starting at or before nOffset */
+    while (nHigh - nLow > 1) {
+        size_t nMid = nLow + (nHigh - nLow) / 2;
+        if (pLine->pStarts[nMid] <= nOffset) nLow = nMid; else nHigh = nMid;
+    }
+    return nLow;
+}
+
+/* Slot a key goes to */
+static size_t CacheSlot(uint64_t nKey) {
+    return (size_t)((nKey * 0x9E3779B97F4A7C15ull) >> 56) % WRAP_CACHE_LINES;
+}
+
+void WrapCacheInit(WrapCache* pCache, size_t nCols) {
+    memset(pCache, 0, sizeof(*pCache));
+    pCache->nCols = nCols ? nCols : 1;
+}
+
+void WrapCacheFree(WrapCache* pCache) {
+    for (size_t i = 0; i < WRAP_CACHE_LINES; i++) WrapLineFree(&pCache->lines[i]);
+}
+
+void WrapCacheClear(WrapCache* pCache) {
+    for (size_t i = 0; i < WRAP_CACHE_LINES; i++) pCache->lines[i].bValid = 0;
+}
+
+void WrapCacheSetColumns(WrapCache* pCache, size_t nCols) {
+    if (nCols == 0) nCols = 1;
+    if (nCols == pCache->nCols) return;
+
+    /* A line that fit in one row still does if it is no wider than the new width */
+    for (size_t i = 0; i < WRAP_CACHE_LINES; i++) {
+        WrapLine* pLine = &pCache->lines[i];
+        if (!pLine->bValid) continue;
+        if (pLine->nRows == 1 && pLine->nWidth <= nCols) {
+            pLine->nCols = nCols;
+        } else {
+            pLine->bValid = 0;
+        }
+    }
+    pCache->nCols = nCols;
+}
+
+const WrapLine* WrapCacheFind(const WrapCache* pCache, uint64_t nKey) {
+    const WrapLine* pLine = &pCache->lines[CacheSlot(nKey)];
+    return (pLine->bValid && pLine->nKey == nKey && pLine->nCols == pCache->nCols) ? pLine : NULL;
+}
+
+const WrapLine* WrapCacheLayout(WrapCache* pCache, uint64_t nKey, const TextUnit* pText, size_t nLen) {
+    WrapLine* pLine = &pCache->lines[CacheSlot(nKey)];
+
+    if (pLine->bValid && pLine->nKey == nKey && pLine->nCols == pCache->nCols && pLine->nLen == nLen) {
+        return pLine;
+    }
+    pLine->nKey = nKey;
+    return WrapLineLayout(pLine, pText, nLen, pCache->nCols) ? pLine : NULL;
+}
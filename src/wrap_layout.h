@@ -0,0 +1,85 @@
+#ifndef WRAP_LAYOUT_H
+#define WRAP_LAYOUT_H
+
+/*
+ * Word wrap layout for a fixed-pitch font.
+ *
+ * Portable C. A line is measured in columns: most characters take one,
+ * East Asian wide characters two, combining marks and the second half of a
+ * surrogate pair none, and a tab runs to the next multiple of
+ * WRAP_TAB_COLUMNS. A line wider than the view is cut into rows after the
+ * last space, tab or hyphen that fits, or around a wide character; a word
+ * longer than a whole row is cut where the row is full. Spaces at a break
+ * stay at the end of the row they follow, even past the edge.
+ *
+ * WrapCache keeps the rows of recently shown lines, keyed by anything that
+ * names a line (a line number, a byte position), so only the lines a view
+ * actually shows are ever laid out. When the width changes, lines that fit
+ * both before and after keep their layout; the rest are laid out again the
+ * next time they are shown.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "piece_table.h"
+
+/* Columns between tab stops */
+#define WRAP_TAB_COLUMNS 8
+
+/* Lines WrapCache keeps */
+#define WRAP_CACHE_LINES 256
+
+/* Columns unit u takes when it starts at column nCol */
+size_t WrapUnitColumns(TextUnit u, size_t nCol);
+
+/* Columns of a whole line */
+size_t WrapLineColumns(const TextUnit* pText, size_t nLen);
+
+/* End of the row that starts at nStart, for rows of nCols columns (always past nStart if nStart < nLen) */
+size_t WrapRowEnd(const TextUnit* pText, size_t nLen, size_t nStart, size_t nCols);
+
+/* Rows of one line */
+typedef struct {
+    uint64_t nKey;               /* Line it belongs to (WrapCache) */
+    size_t nCols;                /* Width it was laid out for */
+    size_t nWidth;               /* Columns of the whole line (SIZE_MAX if it takes several rows) */
+    size_t nLen;                 /* Units in the line */
+    size_t nRows;                /* Rows (at least one) */
+    size_t* pStarts;             /* Offset in the line where each row starts (malloc) */
+    size_t nCapacity;
+    int bValid;                  /* Laid out for the cache's current width */
+} WrapLine;
+
+/* Lay out a line for rows of nCols columns (returns nonzero on success) */
+int WrapLineLayout(WrapLine* pLine, const TextUnit* pText, size_t nLen, size_t nCols);
+void WrapLineFree(WrapLine* pLine);
+
+/* Start and end of row nRow of a laid out line */
+size_t WrapLineRowStart(const WrapLine* pLine, size_t nRow);
+size_t WrapLineRowEnd(const WrapLine* pLine, size_t nRow);
+
+/* Row of a laid out line that holds offset nOffset */
+size_t WrapLineRowOf(const WrapLine* pLine, size_t nOffset);
+
+/* Recently laid out lines */
+typedef struct {
+    size_t nCols;                /* Current width in columns */
+    WrapLine lines[WRAP_CACHE_LINES]; /* Slot chosen by key */
+} WrapCache;
+
+void WrapCacheInit(WrapCache* pCache, size_t nCols);
+void WrapCacheFree(WrapCache* pCache);
+
+/* Forget every line (the text changed) */
+void WrapCacheClear(WrapCache* pCache);
+
+/* Change the width, keeping the lines it does not affect */
+void WrapCacheSetColumns(WrapCache* pCache, size_t nCols);
+
+/* Layout of a line if it is cached for the current width (NULL otherwise) */
+const WrapLine* WrapCacheFind(const WrapCache* pCache, uint64_t nKey);
+
+/* Layout of a line, laid out from pText unless cached (NULL if out of memory) */
+const WrapLine* WrapCacheLayout(WrapCache* pCache, uint64_t nKey, const TextUnit* pText, size_t nLen);
+
+#endif /* WRAP_LAYOUT_H */
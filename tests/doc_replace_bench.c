@@ -0,0 +1,154 @@
+/*
+ * Replace All on a large document (default 1 GB of UTF-16, one piece)
+ * across a sweep of match densities, from none to one match per hundred
+ * units: the time to scan and build the replacement span, and to swap it
+ * into the piece table as one edit, as EditReplaceAll does. Then the
+ * densest case again with a regular expression, and the old way -- a
+ * contiguous buffer edited in place once per match -- on small buffers,
+ * where doubling the size quadruples the time.
+ *
+ * Usage: doc_replace_bench [size in MB]
+ */
+
+#include "doc_replace.h"
+#include "text_search.h"
+#include "regex_search.h"
+#include "test_util.h"
+
+static const char g_szFiller[] = "the quick brown fox jumps over the lazy dog; pack my box with five dozen liquor jugs\n";
+#define FILLER_LEN (sizeof(g_szFiller) - 1)
+
+typedef struct {
+    int bRegex;
+    TextSearch text;
+    RegexSearch regex;
+    size_t nPattern;
+} Finder;
+
+/* The same finder as EditReplaceAll's */
+static int FindNextMatch(void* pContext, const PieceTable* pDoc, size_t nFrom, size_t* pnAt, size_t* pnLen) {
+    Finder* pFinder = (Finder*)pContext;
+    if (pFinder->bRegex) {
+        return RegexSearchDocument(&pFinder->regex, pDoc, nFrom, (size_t)-1, pnAt, pnLen);
+    }
+    *pnLen = pFinder->nPattern;
+    return TextSearchDocument(&pFinder->text, pDoc, nFrom, (size_t)-1, pnAt);
+}
+
+static void ToUnits(const char* szText, TextUnit* pUnits) {
+    while (*szText) *pUnits++ = (TextUnit)(uint8_t)*szText++;
+}
+
+/* Plant "needle" every nStride units (0 for none), or restore the filler there */
+static void Plant(TextUnit* pText, size_t nLen, size_t nStride, int bRestore) {
+    size_t nAt, i;
+    if (!nStride) return;
+    for (nAt = nStride / 2; nAt + 6 <= nLen; nAt += nStride) {
+        for (i = 0; i < 6; i++) pText[nAt + i] = bRestore ? (TextUnit)g_szFiller[(nAt + i) % FILLER_LEN] : (TextUnit)"needle"[i];
+    }
+}
+
+/* Replace every match in a document over pText and check the count (unreported if szLabel is NULL) */
+static void Run(const char* szLabel, TextUnit* pText, size_t nLen, Finder* pFinder, size_t nExpected) {
+    static const TextUnit with[] = {'p', 'i', 'n'};
+    DocReplacement replacement;
+    PieceTable doc;
+    double t0, dBuild, dApply = 0;
+
+    PieceTableInit(&doc);
+    REQUIRE(PieceTableLoad(&doc, pText, nLen, NULL, NULL));
+    t0 = TestSeconds();
+    REQUIRE(DocReplaceAll(&doc, FindNextMatch, pFinder, with, 3, &replacement));
+    dBuild = TestSeconds() - t0;
+    REQUIRE(replacement.nCount == nExpected);
+    if (replacement.nCount) {
+        t0 = TestSeconds();
+        REQUIRE(PieceTableDelete(&doc, replacement.nFrom, replacement.nTo - replacement.nFrom));
+        REQUIRE(PieceTableInsert(&doc, replacement.nFrom, replacement.pText, replacement.nLen));
+        dApply = TestSeconds() - t0;
+    }
+    REQUIRE(PieceTableLength(&doc) == nLen - 3 * nExpected);
+
+    if (szLabel) {
+        BenchReport(szLabel, dBuild + dApply, (double)nLen * sizeof(TextUnit));
+        printf("%-40s %9zu matches, scan and build %.2f s, apply %.2f s\n", "", replacement.nCount, dBuild, dApply);
+    }
+    DocReplacementFree(&replacement);
+    PieceTableFree(&doc);
+}
+
+/* The old Replace All: every match replaced in place, moving the tail each time */
+static double ReplaceInPlace(size_t nLen) {
+    static const TextUnit needle[] = {'n', 'e', 'e', 'd', 'l', 'e'}, with[] = {'p', 'i', 'n'};
+    TextUnit* pText = (TextUnit*)malloc(nLen * sizeof(TextUnit));
+    size_t nAt = 0, i;
+    double t0;
+
+    REQUIRE(pText);
+    for (i = 0; i < nLen; i++) pText[i] = (TextUnit)g_szFiller[i % FILLER_LEN];
+    Plant(pText, nLen, 100, 0);
+    t0 = TestSeconds();
+    while (nAt + 6 <= nLen) {
+        if (pText[nAt] == 'n' && memcmp(pText + nAt, needle, sizeof(needle)) == 0) {
+            memmove(pText + nAt + 3, pText + nAt + 6, (nLen - nAt - 6) * sizeof(TextUnit));
+            memcpy(pText + nAt, with, sizeof(with));
+            nLen -= 3;
+            nAt += 3;
+        } else {
+            nAt++;
+        }
+    }
+    t0 = TestSeconds() - t0;
+    free(pText);
+    return t0;
+}
+
+int main(int argc, char** argv) {
+    static const size_t strides[] = {0, 100000, 10000, 1000, 200, 100};
+    TextUnit needle[6], regex[8];
+    size_t nLen = (BenchSizeMB(argc, argv, 1024) << 20) / sizeof(TextUnit), s, i;
+    TextUnit* pText = (TextUnit*)malloc(nLen * sizeof(TextUnit));
+    const char* szError = NULL;
+    Finder finder;
+
+    REQUIRE(pText && nLen > 1000);
+    for (i = 0; i < nLen; i++) pText[i] = (TextUnit)g_szFiller[i % FILLER_LEN];
+    ToUnits("needle", needle);
+    ToUnits("ne+dle", regex);
+    memset(&finder, 0, sizeof(finder));
+    finder.nPattern = 6;
+    REQUIRE(TextSearchInit(&finder.text, needle, 6, TEXT_SEARCH_MATCH_CASE));
+
+    /* One untimed run first, so the first timed one is not charged for faulting in the heap */
+    Plant(pText, nLen, strides[1], 0);
+    Run(NULL, pText, nLen, &finder, (nLen - strides[1] / 2 - 6) / strides[1] + 1);
+    Plant(pText, nLen, strides[1], 1);
+
+    for (s = 0; s < sizeof(strides) / sizeof(strides[0]); s++) {
+        char szLabel[80];
+        size_t nExpected = strides[s] ? (nLen - strides[s] / 2 - 6) / strides[s] + 1 : 0;
+        Plant(pText, nLen, strides[s], 0);
+        if (strides[s]) snprintf(szLabel, sizeof(szLabel), "\"needle\" every %zu units", strides[s]);
+        else snprintf(szLabel, sizeof(szLabel), "\"needle\", no matches");
+        Run(szLabel, pText, nLen, &finder, nExpected);
+        if (s == sizeof(strides) / sizeof(strides[0]) - 1) {
+            finder.bRegex = 1;
+            REQUIRE(RegexSearchInit(&finder.regex, regex, 6, TEXT_SEARCH_MATCH_CASE, &szError));
+            snprintf(szLabel, sizeof(szLabel), "/ne+dle/ every %zu units", strides[s]);
+            Run(szLabel, pText, nLen, &finder, nExpected);
+            RegexSearchFree(&finder.regex);
+        }
+        Plant(pText, nLen, strides[s], 1);
+    }
+    TextSearchFree(&finder.text);
+    free(pText);
+
+    for (i = 1; i <= 4; i *= 2) {
+        char szLabel[80];
+        size_t nSmall = i << 20;
+        double dTime = ReplaceInPlace(nSmall);
+        snprintf(szLabel, sizeof(szLabel), "in place, %zuM units, every 100", i);
+        BenchReport(szLabel, dTime, (double)nSmall * sizeof(TextUnit));
+    }
+    return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * Incremental statistics against a full rescan and an independent count
+ * after randomized edit scripts: typing, backspacing, pasting and
+ * scattered replacements, on text heavy with separators, CR, LF, CRLF,
+ * surrogate pairs and lone surrogates, so edits keep joining and splitting
+ * words, breaks and pairs.
+ */
+
+#include "doc_stats.h"
+#include "test_util.h"
+
+static const TextUnit g_alphabet[] = {'a', 'b', ' ', '\t', '\r', '\n', '\r', '\n',
+                                      0xE9, 0x4E2D, 0xD83D, 0xDE00, 0xDC00, 0xD800, 'x', '.'};
+
+static TextUnit RandomUnit(TestRng* pRng) {
+    return g_alphabet[TestRngBelow(pRng, sizeof(g_alphabet) / sizeof(g_alphabet[0]))];
+}
+
+static int IsSeparator(TextUnit u) {
+    return u == ' ' || u == '\t' || u == '\r' || u == '\n';
+}
+
+/* Straightforward count, written from the definitions in doc_stats.h */
+static void CountText(const TextUnit* pText, size_t nLen, DocStats* pStats) {
+    size_t i;
+    memset(pStats, 0, sizeof(*pStats));
+    pStats->nUnits = nLen;
+    for (i = 0; i < nLen; i++) {
+        TextUnit u = pText[i], prev = i ? pText[i - 1] : ' ';
+        int bPairTail = u >= 0xDC00 && u <= 0xDFFF && prev >= 0xD800 && prev <= 0xDBFF;
+        if (!IsSeparator(u) && IsSeparator(prev)) pStats->nWords++;
+        if (u == '\r' || (u == '\n' && prev != '\r')) pStats->nBreaks++;
+        if (!bPairTail) pStats->nChars++;
+        /* A pair is 4 bytes (3 + 1 here); a lone surrogate is written as U+FFFD */
+        pStats->nBytes += u < 0x80 ? 1 : u < 0x800 ? 2 : bPairTail ? 1 : 3;
+    }
+}
+
+static int SameStats(const DocStats* pA, const DocStats* pB) {
+    return pA->nUnits == pB->nUnits && pA->nChars == pB->nChars && pA->nWords == pB->nWords &&
+           pA->nBreaks == pB->nBreaks && pA->nBytes == pB->nBytes;
+}
+
+/* The kept counts match a full rescan and the reference count */
+static void CheckStats(const DocStats* pStats, const PieceTable* pDoc) {
+    size_t nLen = PieceTableLength(pDoc);
+    TextUnit* pText = (TextUnit*)malloc((nLen + 1) * sizeof(TextUnit));
+    DocStats full, ref;
+
+    REQUIRE(pText);
+    REQUIRE(PieceTableCopy(pDoc, 0, pText, nLen) == nLen);
+    REQUIRE(DocStatsBuild(&full, pDoc));
+    CountText(pText, nLen, &ref);
+    CHECK(SameStats(&full, &ref));
+    CHECK(SameStats(pStats, &ref));
+    CHECK(DocStatsLineCount(pStats) == ref.nBreaks + 1);
+    free(pText);
+}
+
+/* Replace nDelete units at nOffset with nInsert random ones, keeping pStats current */
+static void Edit(PieceTable* pDoc, DocStats* pStats, size_t nOffset, size_t nDelete, size_t nInsert, TestRng* pRng) {
+    TextUnit insert[4096];
+    size_t i;
+
+    REQUIRE(nInsert <= sizeof(insert) / sizeof(insert[0]));
+    for (i = 0; i < nInsert; i++) insert[i] = RandomUnit(pRng);
+    REQUIRE(DocStatsRemove(pStats, pDoc, nOffset, nDelete));
+    REQUIRE(PieceTableDelete(pDoc, nOffset, nDelete));
+    REQUIRE(PieceTableInsert(pDoc, nOffset, insert, nInsert));
+    REQUIRE(DocStatsInsert(pStats, pDoc, nOffset, nInsert));
+}
+
+int main(void) {
+    TestRng rng;
+    size_t nEdits = 0;
+    int nScript;
+
+    TestRngInit(&rng, TestSeed(11));
+    for (nScript = 0; nScript < 300 && !g_nTestFailures; nScript++) {
+        size_t nLen = TestRngBelow(&rng, nScript % 10 == 0 ? 200000 : 300), i;
+        TextUnit* pText = (TextUnit*)malloc((nLen + 1) * sizeof(TextUnit));
+        size_t nCaret = 0;
+        PieceTable doc;
+        DocStats stats;
+        int e;
+
+        REQUIRE(pText);
+        for (i = 0; i < nLen; i++) pText[i] = RandomUnit(&rng);
+        PieceTableInit(&doc);
+        REQUIRE(PieceTableLoad(&doc, pText, nLen, NULL, NULL));
+        DocStatsInit(&stats);
+        DocStatsBuildFromText(&stats, pText, nLen);
+        CheckStats(&stats, &doc);
+
+        for (e = 0; e < 400; e++) {
+            size_t nDocLen = PieceTableLength(&doc), r = TestRngBelow(&rng, 100);
+            if (nCaret > nDocLen || r < 5) nCaret = TestRngBelow(&rng, nDocLen + 1);
+
+            if (r < 40) {
+                /* Typing at the caret */
+                Edit(&doc, &stats, nCaret, 0, 1, &rng);
+                nCaret++;
+            } else if (r < 60) {
+                /* Backspace, which may split a CRLF or a surrogate pair */
+                if (nCaret) Edit(&doc, &stats, --nCaret, 1, 0, &rng);
+            } else if (r < 70) {
+                /* Paste */
+                size_t nPaste = TestRngBelow(&rng, 4096);
+                Edit(&doc, &stats, nCaret, 0, nPaste, &rng);
+                nCaret += nPaste;
+            } else if (r < 72) {
+                /* Select all and delete, or select all and type */
+                Edit(&doc, &stats, 0, nDocLen, r == 71, &rng);
+                nCaret = r == 71;
+            } else {
+                /* Replace a selection somewhere */
+                size_t nOffset = TestRngBelow(&rng, nDocLen + 1);
+                size_t nDelete = TestRngBelow(&rng, (nDocLen - nOffset) % 20 + 1);
+                Edit(&doc, &stats, nOffset, nDelete, TestRngBelow(&rng, 12), &rng);
+                nCaret = nOffset;
+            }
+            nEdits++;
+            if (e % 50 == 49 || nDocLen < 1000) CheckStats(&stats, &doc);
+        }
+        CheckStats(&stats, &doc);
+        PieceTableFree(&doc);
+        free(pText);
+    }
+
+    printf("%zu edits\n", nEdits);
+    return TestResult("doc_stats_test");
+}
@@ -0,0 +1,59 @@
+/*
+ * Saving a large edited document (default 500 MB of UTF-16 text) to a real
+ * file with SaveDocument: throughput and how far the save raises peak RSS
+ * above the document itself. Usage: doc_writer_bench [size in MB]
+ */
+
+#include "doc_writer.h"
+#include "text_encoding.h"
+#include "test_util.h"
+
+static void TimeSave(const PieceTable* pDoc, const char* szPath, int nEncoding, const char* szName) {
+    long nBefore = BenchPeakRssKB();
+    double t0 = TestSeconds();
+    size_t nLen = 0;
+    FILE* pFile;
+
+    REQUIRE(SaveDocument(pDoc, szPath, nEncoding, 1));
+    BenchReport(szName, TestSeconds() - t0, (double)PieceTableLength(pDoc) * sizeof(TextUnit));
+    printf("%-40s %9ld KB\n", "  peak RSS growth", BenchPeakRssKB() - nBefore);
+
+    pFile = fopen(szPath, "rb");
+    REQUIRE(pFile && fseek(pFile, 0, SEEK_END) == 0);
+    nLen = (size_t)ftell(pFile);
+    fclose(pFile);
+    printf("%-40s %9zu MB\n", "  file size", nLen >> 20);
+    unlink(szPath);
+}
+
+int main(int argc, char** argv) {
+    size_t nUnits = BenchSizeMB(argc, argv, 500) * 1024 * 1024 / sizeof(TextUnit), i;
+    TextUnit* pText = (TextUnit*)malloc(nUnits * sizeof(TextUnit));
+    static const TextUnit edit[] = {'e', 'd', 'i', 't', 0xE9, '\r', '\n'};
+    PieceTable doc;
+    TestRng rng;
+    char szPath[256];
+
+    REQUIRE(pText);
+    TestRngInit(&rng, TestSeed(6));
+    for (i = 0; i < nUnits; i++) {
+        size_t r = TestRngBelow(&rng, 100);
+        pText[i] = (TextUnit)(i % 80 == 79 ? '\n' : r < 95 ? 'a' + r % 26 : 0x430 + r % 32);
+    }
+    PieceTableInit(&doc);
+    REQUIRE(PieceTableLoad(&doc, pText, nUnits, NULL, NULL));
+    for (i = 0; i < 10000; i++) {
+        REQUIRE(PieceTableInsert(&doc, TestRngBelow(&rng, PieceTableLength(&doc) + 1), edit, 7));
+    }
+    printf("document: %zu MB, %zu pieces, peak RSS %ld MB\n", nUnits * sizeof(TextUnit) >> 20,
+           PieceTablePieceCount(&doc), BenchPeakRssKB() >> 10);
+
+    TestTempPath(szPath, sizeof(szPath), "bench_save.txt");
+    TimeSave(&doc, szPath, TEXT_ENCODING_UTF8, "save UTF-8");
+    TimeSave(&doc, szPath, TEXT_ENCODING_UTF16LE, "save UTF-16LE (spans passed through)");
+    TimeSave(&doc, szPath, TEXT_ENCODING_UTF32LE, "save UTF-32LE");
+
+    PieceTableFree(&doc);
+    free(pText);
+    return 0;
+}
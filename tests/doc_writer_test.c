@@ -0,0 +1,218 @@
+/*
+ * Streaming writer through a memory sink shim: every Unicode encoding, with
+ * and without a BOM, against a reference encoder, on documents made of many
+ * pieces (surrogate pairs split between them) and of spans longer than a
+ * chunk. Also a sink that fails part way, and SaveDocument to real files.
+ */
+
+#include "doc_writer.h"
+#include "text_encoding.h"
+#include "test_util.h"
+
+/* Encode one code point in nEncoding */
+static size_t RefPut(uint32_t nCode, int nEncoding, uint8_t* pOut) {
+    switch (nEncoding) {
+        case TEXT_ENCODING_UTF8:
+            if (nCode < 0x80) { pOut[0] = (uint8_t)nCode; return 1; }
+            if (nCode < 0x800) {
+                pOut[0] = (uint8_t)(0xC0 | (nCode >> 6));
+                pOut[1] = (uint8_t)(0x80 | (nCode & 0x3F));
+                return 2;
+            }
+            if (nCode < 0x10000) {
+                pOut[0] = (uint8_t)(0xE0 | (nCode >> 12));
+                pOut[1] = (uint8_t)(0x80 | ((nCode >> 6) & 0x3F));
+                pOut[2] = (uint8_t)(0x80 | (nCode & 0x3F));
+                return 3;
+            }
+            pOut[0] = (uint8_t)(0xF0 | (nCode >> 18));
+            pOut[1] = (uint8_t)(0x80 | ((nCode >> 12) & 0x3F));
+            pOut[2] = (uint8_t)(0x80 | ((nCode >> 6) & 0x3F));
+            pOut[3] = (uint8_t)(0x80 | (nCode & 0x3F));
+            return 4;
+        case TEXT_ENCODING_UTF32LE:
+        case TEXT_ENCODING_UTF32BE:
+            for (int k = 0; k < 4; k++) {
+                int nShift = nEncoding == TEXT_ENCODING_UTF32LE ? 8 * k : 8 * (3 - k);
+                pOut[k] = (uint8_t)(nCode >> nShift);
+            }
+            return 4;
+    }
+    return 0;
+}
+
+/* Reference output of the whole text, BOM included */
+static size_t RefEncode(const uint16_t* pText, size_t nLen, int nEncoding, int bBom, uint8_t* pOut) {
+    size_t nOut = bBom ? TextEncodingBom(nEncoding, pOut) : 0;
+    for (size_t i = 0; i < nLen; i++) {
+        uint32_t nCode = pText[i];
+        if (nEncoding == TEXT_ENCODING_UTF16LE || nEncoding == TEXT_ENCODING_UTF16BE) {
+            /* UTF-16 is written unit for unit, unpaired surrogates included */
+            pOut[nOut + (nEncoding == TEXT_ENCODING_UTF16BE)] = (uint8_t)(nCode & 0xFF);
+            pOut[nOut + (nEncoding == TEXT_ENCODING_UTF16LE)] = (uint8_t)(nCode >> 8);
+            nOut += 2;
+            continue;
+        }
+        if (nCode >= 0xD800 && nCode <= 0xDBFF && i + 1 < nLen && pText[i + 1] >= 0xDC00 && pText[i + 1] <= 0xDFFF) {
+            nCode = 0x10000 + ((nCode - 0xD800) << 10) + (pText[++i] - 0xDC00);
+        } else if (nCode >= 0xD800 && nCode <= 0xDFFF) {
+            nCode = 0xFFFD;
+        }
+        nOut += RefPut(nCode, nEncoding, pOut + nOut);
+    }
+    return nOut;
+}
+
+/* Sink shim: collects the output in memory and can fail after a number of calls */
+typedef struct {
+    uint8_t* pData;
+    size_t nLen;
+    size_t nCapacity;
+    size_t nCalls;
+    size_t nFailAtCall;          /* 0 to never fail */
+    size_t nLargest;             /* Largest single write */
+} MemorySink;
+
+static int WriteToMemory(void* pContext, const uint8_t* pData, size_t nLen) {
+    MemorySink* pSink = (MemorySink*)pContext;
+    pSink->nCalls++;
+    if (pSink->nFailAtCall && pSink->nCalls >= pSink->nFailAtCall) return 0;
+    REQUIRE(pSink->nLen + nLen <= pSink->nCapacity);
+    memcpy(pSink->pData + pSink->nLen, pData, nLen);
+    pSink->nLen += nLen;
+    if (nLen > pSink->nLargest) pSink->nLargest = nLen;
+    return 1;
+}
+
+static uint16_t RandomUnit(TestRng* pRng, int bWide) {
+    size_t r = TestRngBelow(pRng, 100);
+    if (!bWide || r < 70) return (uint16_t)(r % 40 == 0 ? '\n' : 0x20 + TestRngBelow(pRng, 90));
+    if (r < 80) return (uint16_t)(0x80 + TestRngBelow(pRng, 0x700));
+    if (r < 90) return (uint16_t)(0x800 + TestRngBelow(pRng, 0xC000));
+    if (r < 95) return (uint16_t)(0xD800 + TestRngBelow(pRng, 0x400));
+    return (uint16_t)(0xDC00 + TestRngBelow(pRng, 0x400));
+}
+
+static void TestEncodings(void) {
+    static const int encodings[] = {TEXT_ENCODING_UTF8, TEXT_ENCODING_UTF16LE, TEXT_ENCODING_UTF16BE,
+                                    TEXT_ENCODING_UTF32LE, TEXT_ENCODING_UTF32BE};
+    TestRng rng;
+    int t;
+
+    TestRngInit(&rng, TestSeed(6));
+    for (t = 0; t < 120 && !g_nTestFailures; t++) {
+        /* A few documents are several chunks long, to cross chunk boundaries */
+        size_t nLen = t % 20 == 19 ? 1500000 + TestRngBelow(&rng, 500000) : TestRngBelow(&rng, 5000);
+        uint16_t* pText = (uint16_t*)malloc((nLen + 1) * sizeof(uint16_t));
+        uint8_t* pExpected = (uint8_t*)malloc(4 + nLen * 4);
+        MemorySink sink = {NULL, 0, 4 + nLen * 4, 0, 0, 0};
+        PieceTable doc;
+        size_t i, nPos = 0;
+        int e;
+
+        REQUIRE(pText && pExpected);
+        sink.pData = (uint8_t*)malloc(sink.nCapacity);
+        REQUIRE(sink.pData);
+        for (i = 0; i < nLen; i++) pText[i] = RandomUnit(&rng, t % 3 != 0);
+
+        /*
+         * Many small pieces, or one long original span for the passthrough.
+         * The pieces go in back to front, as appends would merge into one.
+         */
+        PieceTableInit(&doc);
+        if (t % 2) {
+            while (nPos < nLen) {
+                size_t nPiece = 1 + TestRngBelow(&rng, 700);
+                if (nPiece > nLen - nPos) nPiece = nLen - nPos;
+                nPos += nPiece;
+                REQUIRE(PieceTableInsert(&doc, 0, pText + nLen - nPos, nPiece));
+            }
+            CHECK(PieceTablePieceCount(&doc) > nLen / 700);
+        } else {
+            REQUIRE(PieceTableLoad(&doc, pText, nLen, NULL, NULL));
+        }
+
+        for (e = 0; e < (int)(sizeof(encodings) / sizeof(encodings[0])); e++) {
+            int bBom = (t + e) % 2;
+            size_t nExpected = RefEncode(pText, nLen, encodings[e], bBom, pExpected);
+            sink.nLen = sink.nCalls = sink.nLargest = 0;
+            CHECK(WriteDocumentText(&doc, encodings[e], bBom, WriteToMemory, &sink));
+            CHECK(sink.nLen == nExpected && memcmp(sink.pData, pExpected, nExpected) == 0);
+
+            /* Only a native span passed straight through may exceed one chunk */
+            if (!IsNativeEncoding(encodings[e]) || t % 2) CHECK(sink.nLargest <= DOC_WRITER_CHUNK);
+        }
+
+        PieceTableFree(&doc);
+        free(sink.pData);
+        free(pExpected);
+        free(pText);
+    }
+
+    /* ANSI needs a code page, which this module does not have */
+    {
+        PieceTable doc;
+        MemorySink sink = {NULL, 0, 0, 0, 0, 0};
+        PieceTableInit(&doc);
+        CHECK(!WriteDocumentText(&doc, TEXT_ENCODING_ANSI, 0, WriteToMemory, &sink));
+        CHECK(sink.nCalls == 0);
+        PieceTableFree(&doc);
+    }
+}
+
+/* A sink that fails stops the write at once and is not called again */
+static void TestFailingSink(void) {
+    size_t nLen = 3 * DOC_WRITER_CHUNK, i;
+    uint16_t* pText = (uint16_t*)malloc(nLen * sizeof(uint16_t));
+    MemorySink sink = {NULL, 0, 8 * DOC_WRITER_CHUNK, 0, 0, 0};
+    PieceTable doc;
+
+    REQUIRE(pText);
+    sink.pData = (uint8_t*)malloc(sink.nCapacity);
+    REQUIRE(sink.pData);
+    for (i = 0; i < nLen; i++) pText[i] = (uint16_t)(i % 50 == 49 ? '\n' : 'a' + i % 26);
+    PieceTableInit(&doc);
+    REQUIRE(PieceTableLoad(&doc, pText, nLen, NULL, NULL));
+
+    for (sink.nFailAtCall = 1; sink.nFailAtCall <= 4; sink.nFailAtCall++) {
+        sink.nLen = sink.nCalls = 0;
+        CHECK(!WriteDocumentText(&doc, TEXT_ENCODING_UTF8, 1, WriteToMemory, &sink));
+        CHECK(sink.nCalls == sink.nFailAtCall);
+    }
+
+    PieceTableFree(&doc);
+    free(sink.pData);
+    free(pText);
+}
+
+/* SaveDocument writes the file whole, and a failed save leaves no temp file behind */
+static void TestSave(void) {
+    static const uint16_t text[] = {'h', 0xE9, 'l', 'l', 'o', '\r', '\n', 0xD83D, 0xDE00};
+    static const uint8_t expected[] = "\xef\xbb\xbfh\xc3\xa9llo\r\n\xf0\x9f\x98\x80";
+    char szPath[256], szMissing[300];
+    PieceTable doc;
+    uint8_t* pData;
+    size_t nData = 0;
+
+    TestTempPath(szPath, sizeof(szPath), "save.txt");
+    PieceTableInit(&doc);
+    REQUIRE(PieceTableLoad(&doc, text, sizeof(text) / sizeof(text[0]), NULL, NULL));
+
+    REQUIRE(TestWriteFile(szPath, "old contents", 12));
+    CHECK(SaveDocument(&doc, szPath, TEXT_ENCODING_UTF8, 1));
+    pData = TestReadFile(szPath, &nData);
+    CHECK(pData && nData == sizeof(expected) - 1 && memcmp(pData, expected, nData) == 0);
+    free(pData);
+    unlink(szPath);
+
+    snprintf(szMissing, sizeof(szMissing), "%s.dir/missing.txt", szPath);
+    CHECK(!SaveDocument(&doc, szMissing, TEXT_ENCODING_UTF8, 0));
+    PieceTableFree(&doc);
+}
+
+int main(void) {
+    TestEncodings();
+    TestFailingSink();
+    TestSave();
+    return TestResult("doc_writer_test");
+}
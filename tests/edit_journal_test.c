@@ -0,0 +1,347 @@
+/*
+ * Edit journal crash recovery. A forked child edits a document through a
+ * journal (with checkpoints and the batching writer thread) and is killed
+ * with SIGKILL at a random moment; the replayed journal must then equal
+ * the document after some prefix of the edits, no shorter than what the
+ * writer had reported durable, and must take further edits after
+ * EditJournalResume. Also: a clean round trip, every truncation of a
+ * journal (a torn tail), flipped bytes, and a file base fingerprint.
+ */
+
+#include "edit_journal.h"
+#include "test_util.h"
+
+#include <glob.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define EDITS 20000
+
+static char g_szPath[256];
+static const TextUnit g_initial[] = {'h', 'e', 'l', 'l', 'o', '\r', '\n', 'w', 0x4E2D};
+
+/* Edit nOffset, nDelete, insert[nInsert] of a workload, or a request to checkpoint */
+typedef struct {
+    int bCheckpoint;
+    size_t nOffset;
+    size_t nDelete;
+    size_t nInsert;
+    TextUnit insert[32];
+} Step;
+
+static void NextStep(TestRng* pRng, const PieceTable* pDoc, Step* pStep) {
+    static const TextUnit alphabet[] = {'a', 'b', ' ', '\r', '\n', 0xE9, 0x4E2D, 'z'};
+    size_t nLen = PieceTableLength(pDoc), i;
+
+    pStep->bCheckpoint = TestRngBelow(pRng, 500) == 0;
+    if (pStep->bCheckpoint) return;
+    pStep->nOffset = TestRngBelow(pRng, nLen + 1);
+    pStep->nDelete = TestRngBelow(pRng, nLen - pStep->nOffset < 20 ? nLen - pStep->nOffset + 1 : 20);
+    pStep->nInsert = TestRngBelow(pRng, nLen > 6000 ? 4 : 24);
+    for (i = 0; i < pStep->nInsert; i++) pStep->insert[i] = alphabet[TestRngBelow(pRng, sizeof(alphabet) / sizeof(alphabet[0]))];
+}
+
+static void ApplyStep(PieceTable* pDoc, const Step* pStep) {
+    REQUIRE(PieceTableDelete(pDoc, pStep->nOffset, pStep->nDelete));
+    REQUIRE(PieceTableInsert(pDoc, pStep->nOffset, pStep->insert, pStep->nInsert));
+}
+
+static uint64_t HashDocument(const PieceTable* pDoc) {
+    size_t nLen = PieceTableLength(pDoc), i;
+    TextUnit* pText = (TextUnit*)malloc((nLen + 1) * sizeof(TextUnit));
+    uint64_t nHash = 1469598103934665603ull ^ nLen;
+
+    REQUIRE(pText);
+    PieceTableCopy(pDoc, 0, pText, nLen);
+    for (i = 0; i < nLen; i++) nHash = (nHash ^ pText[i]) * 1099511628211ull;
+    free(pText);
+    return nHash;
+}
+
+static void LoadInitial(PieceTable* pDoc) {
+    PieceTableInit(pDoc);
+    REQUIRE(PieceTableLoad(pDoc, g_initial, sizeof(g_initial) / sizeof(g_initial[0]), NULL, NULL));
+}
+
+/* Hash of the document after each prefix of the workload (index 0 is the initial text) */
+static uint64_t* PrefixHashes(uint64_t nSeed, long nEdits) {
+    uint64_t* pHashes = (uint64_t*)malloc((size_t)(nEdits + 1) * sizeof(uint64_t));
+    TestRng rng;
+    PieceTable doc;
+    Step step;
+    long k = 0;
+
+    REQUIRE(pHashes);
+    TestRngInit(&rng, nSeed);
+    LoadInitial(&doc);
+    pHashes[0] = HashDocument(&doc);
+    while (k < nEdits) {
+        NextStep(&rng, &doc, &step);
+        if (step.bCheckpoint) continue;
+        ApplyStep(&doc, &step);
+        pHashes[++k] = HashDocument(&doc);
+    }
+    PieceTableFree(&doc);
+    return pHashes;
+}
+
+/* First prefix of the workload from nFrom edits on that gives pRecovered's text, or -1 */
+static long MatchPrefix(uint64_t nSeed, const PieceTable* pRecovered, long nFrom, long nEdits) {
+    size_t nLen = PieceTableLength(pRecovered);
+    uint64_t nHash = HashDocument(pRecovered);
+    TestRng rng;
+    PieceTable doc;
+    Step step;
+    long k = 0, nMatch = -1;
+
+    TestRngInit(&rng, nSeed);
+    LoadInitial(&doc);
+    for (;;) {
+        if (k >= nFrom && PieceTableLength(&doc) == nLen && HashDocument(&doc) == nHash) {
+            nMatch = k;
+            break;
+        }
+        if (k == nEdits) break;
+        NextStep(&rng, &doc, &step);
+        if (step.bCheckpoint) continue;
+        ApplyStep(&doc, &step);
+        k++;
+    }
+    PieceTableFree(&doc);
+    return nMatch;
+}
+
+/*
+ * Edit through a journal as the editor does, checkpointing when asked or
+ * due, with the odd pause so the writer thread gets to run mid-workload.
+ * Publishes the durable edit count in *pnDurable (may be NULL).
+ */
+static void RunWorkload(uint64_t nSeed, long nEdits, unsigned nBatchMs, int bCheckpoints, volatile uint64_t* pnDurable) {
+    JournalWriter writer;
+    EditJournal* pJournal;
+    TestRng rng, jitter;
+    PieceTable doc;
+    Step step;
+    long k = 0;
+
+    REQUIRE(JournalWriterStart(&writer, nBatchMs));
+    LoadInitial(&doc);
+    pJournal = EditJournalCreate(&writer, g_szPath, EDIT_JOURNAL_BASE_SNAPSHOT, "", 0, &doc);
+    REQUIRE(pJournal);
+    TestRngInit(&rng, nSeed);
+    TestRngInit(&jitter, nSeed * 31 + 7);
+    while (k < nEdits) {
+        NextStep(&rng, &doc, &step);
+        if (step.bCheckpoint) {
+            if (bCheckpoints) REQUIRE(EditJournalCheckpoint(pJournal, &doc));
+            continue;
+        }
+        REQUIRE(EditJournalAppend(pJournal, step.nOffset, step.nDelete, step.insert, step.nInsert));
+        ApplyStep(&doc, &step);
+        k++;
+        if (pnDurable) *pnDurable = EditJournalDurableEdits(pJournal);
+        if (TestRngBelow(&jitter, 64) == 0) usleep((useconds_t)TestRngBelow(&jitter, 300));
+        if (bCheckpoints && EditJournalCheckpointDue(pJournal, PieceTableLength(&doc))) {
+            REQUIRE(EditJournalCheckpoint(pJournal, &doc));
+        }
+    }
+    CHECK(!EditJournalFailed(pJournal));
+    EditJournalClose(pJournal);
+    JournalWriterStop(&writer);
+    PieceTableFree(&doc);
+}
+
+static void TestRoundTrip(void) {
+    EditJournalInfo info;
+    PieceTable doc;
+
+    RunWorkload(TestSeed(14), EDITS, 2, 1, NULL);
+    PieceTableInit(&doc);
+    CHECK(EditJournalReplay(g_szPath, &doc, &info));
+    CHECK(info.nBaseKind == EDIT_JOURNAL_BASE_SNAPSHOT);
+    CHECK(MatchPrefix(TestSeed(14), &doc, EDITS, EDITS) == EDITS);
+    PieceTableFree(&doc);
+}
+
+/* Every cut of a journal replays to the prefix it holds, and flipped bytes never replay to anything else */
+static void TestTornTails(TestRng* pRng) {
+    enum { SHORT_RUN = 3000 };
+    uint64_t* pHashes = PrefixHashes(TestSeed(14), SHORT_RUN);
+    long nLast = -1;
+    size_t nSize = 0, nCut, nReplayed = 0;
+    uint8_t *pJournal, *pDamaged;
+    int i;
+
+    RunWorkload(TestSeed(14), SHORT_RUN, 1, 0, NULL);
+    pJournal = TestReadFile(g_szPath, &nSize);
+    pDamaged = (uint8_t*)malloc(nSize + 1);
+    REQUIRE(pJournal && pDamaged && nSize > 0);
+
+    /* Cut at random steps of up to 37 bytes, ending with the whole file */
+    nCut = 0;
+    for (;;) {
+        EditJournalInfo info;
+        PieceTable doc;
+        REQUIRE(TestWriteFile(g_szPath, pJournal, nCut));
+        PieceTableInit(&doc);
+        if (EditJournalReplay(g_szPath, &doc, &info)) {
+            CHECK(info.nEdits <= SHORT_RUN && HashDocument(&doc) == pHashes[info.nEdits]);
+            CHECK((long)info.nEdits >= nLast);
+            CHECK(info.nValidBytes <= nCut);
+            nLast = (long)info.nEdits;
+        } else {
+            /* Only a cut inside the base can fail outright */
+            CHECK(nLast < 0);
+        }
+        PieceTableFree(&doc);
+        if (nCut == nSize) break;
+        nCut += 1 + TestRngBelow(pRng, 37);
+        if (nCut > nSize) nCut = nSize;
+    }
+    CHECK(nLast == SHORT_RUN);
+
+    for (i = 0; i < 300; i++) {
+        EditJournalInfo info;
+        PieceTable doc;
+        memcpy(pDamaged, pJournal, nSize);
+        pDamaged[TestRngBelow(pRng, nSize)] ^= (uint8_t)(1 + TestRngBelow(pRng, 255));
+        REQUIRE(TestWriteFile(g_szPath, pDamaged, nSize));
+        PieceTableInit(&doc);
+        if (EditJournalReplay(g_szPath, &doc, &info)) {
+            CHECK(info.nEdits <= SHORT_RUN && HashDocument(&doc) == pHashes[info.nEdits]);
+            nReplayed++;
+        }
+        PieceTableFree(&doc);
+    }
+    /* Most flips land in an edit record, which stops the replay just before it */
+    CHECK(nReplayed > 0);
+
+    free(pDamaged);
+    free(pJournal);
+    free(pHashes);
+}
+
+/* A checkpoint cut short leaves its temp file; recovery deletes them, as here */
+static void DeleteStaleTemps(void) {
+    char szPattern[300];
+    glob_t found;
+    size_t i;
+
+    snprintf(szPattern, sizeof(szPattern), "%s.~*.tmp", g_szPath);
+    if (glob(szPattern, 0, NULL, &found) != 0) return;
+    for (i = 0; i < found.gl_pathc; i++) unlink(found.gl_pathv[i]);
+    globfree(&found);
+}
+
+/* Kill the editing process at random moments and recover what it left */
+static void TestKill(TestRng* pRng) {
+    volatile uint64_t* pnDurable = (volatile uint64_t*)mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    int nRun, nKilled = 0, nRecovered = 0;
+
+    REQUIRE(pnDurable != MAP_FAILED);
+    for (nRun = 0; nRun < 60 && !g_nTestFailures; nRun++) {
+        uint64_t nSeed = TestSeed(14) + (uint64_t)nRun;
+        EditJournalInfo info;
+        EditJournal* pJournal;
+        JournalWriter writer;
+        PieceTable doc, again;
+        TextUnit extra = 'Q';
+        long nPrefix;
+        int nStatus;
+        pid_t pid;
+
+        unlink(g_szPath);
+        *pnDurable = 0;
+        pid = fork();
+        REQUIRE(pid >= 0);
+        if (pid == 0) {
+            RunWorkload(nSeed, EDITS, 1 + nRun % 5, 1, pnDurable);
+            _exit(0);
+        }
+        usleep((useconds_t)(2000 + TestRngBelow(pRng, 60000)));
+        kill(pid, SIGKILL);
+        REQUIRE(waitpid(pid, &nStatus, 0) == pid);
+        nKilled += WIFSIGNALED(nStatus);
+        DeleteStaleTemps();
+
+        PieceTableInit(&doc);
+        if (!EditJournalReplay(g_szPath, &doc, &info)) {
+            /* Killed before the base reached the disk */
+            CHECK(*pnDurable == 0);
+            PieceTableFree(&doc);
+            continue;
+        }
+        nPrefix = MatchPrefix(nSeed, &doc, (long)*pnDurable, EDITS);
+        CHECK(nPrefix >= 0);
+        nRecovered++;
+
+        /* The recovered journal carries on where it stopped */
+        REQUIRE(JournalWriterStart(&writer, 1));
+        pJournal = EditJournalClaim(&writer, g_szPath);
+        CHECK(pJournal != NULL);
+        if (pJournal) {
+            CHECK(EditJournalResume(pJournal, &info));
+            CHECK(EditJournalAppend(pJournal, 0, 0, &extra, 1));
+            REQUIRE(PieceTableInsert(&doc, 0, &extra, 1));
+            EditJournalClose(pJournal);
+        }
+        JournalWriterStop(&writer);
+        PieceTableInit(&again);
+        CHECK(EditJournalReplay(g_szPath, &again, &info));
+        CHECK(HashDocument(&again) == HashDocument(&doc));
+
+        PieceTableFree(&again);
+        PieceTableFree(&doc);
+    }
+    printf("%d of %d writers killed mid-run, %d journals recovered\n", nKilled, nRun, nRecovered);
+    munmap((void*)pnDurable, 4096);
+}
+
+/* A file base records the file's fingerprint, which changes with the file */
+static void TestFileBase(void) {
+    static const char text[] = "hello\r\nworld\r\n";
+    char szDoc[300];
+    uint64_t nSize = 0, nHash = 0, nHashAfter = 0;
+    JournalWriter writer;
+    EditJournal* pJournal;
+    EditJournalInfo info;
+    PieceTable doc;
+
+    snprintf(szDoc, sizeof(szDoc), "%s.txt", g_szPath);
+    REQUIRE(TestWriteFile(szDoc, text, sizeof(text) - 1));
+    CHECK(EditJournalFingerprint(szDoc, &nSize, &nHash));
+    CHECK(nSize == sizeof(text) - 1);
+
+    LoadInitial(&doc);
+    REQUIRE(JournalWriterStart(&writer, 1));
+    pJournal = EditJournalCreate(&writer, g_szPath, EDIT_JOURNAL_BASE_FILE, szDoc, 1, &doc);
+    REQUIRE(pJournal);
+    CHECK(EditJournalAppend(pJournal, 0, 1, g_initial, 2));
+    EditJournalClose(pJournal);
+    JournalWriterStop(&writer);
+
+    CHECK(EditJournalReadBase(g_szPath, &info));
+    CHECK(info.nBaseKind == EDIT_JOURNAL_BASE_FILE && info.nLineEnding == 1);
+    CHECK(strcmp(info.szPath, szDoc) == 0);
+    CHECK(info.nFileSize == nSize && info.nFileHash == nHash);
+
+    REQUIRE(TestWriteFile(szDoc, "HELLO\r\nworld\r\n", sizeof(text) - 1));
+    CHECK(EditJournalFingerprint(szDoc, &nSize, &nHashAfter) && nHashAfter != nHash);
+
+    unlink(szDoc);
+    PieceTableFree(&doc);
+}
+
+int main(void) {
+    TestRng rng;
+
+    TestRngInit(&rng, TestSeed(14));
+    TestTempPath(g_szPath, sizeof(g_szPath), "journal.xnj");
+    TestRoundTrip();
+    TestTornTails(&rng);
+    TestKill(&rng);
+    TestFileBase();
+    unlink(g_szPath);
+    return TestResult("edit_journal_test");
+}
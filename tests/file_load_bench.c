@@ -0,0 +1,101 @@
+/*
+ * Parallel decode and indexing of a generated log (default 4 GB) with 1,
+ * 2, 4 ... threads up to the processor count: the best of three decodes
+ * at each count and the speedup over one thread. The decoded text needs
+ * two bytes per input byte, so the corpus is cut down where that would
+ * not fit in half the memory.
+ *
+ * Usage: file_load_bench [size in MB [highest thread count]]
+ */
+
+#include "file_load.h"
+#include "test_util.h"
+
+/* Write nSize bytes of CRLF log lines, some with non-ASCII text */
+static void MakeLog(const char* szPath, uint64_t nSize, TestRng* pRng) {
+    FILE* pFile = fopen(szPath, "wb");
+    char* pBuffer = (char*)malloc(1 << 20);
+    uint64_t nWritten = 0, nLine = 0;
+
+    REQUIRE(pFile && pBuffer);
+    while (nWritten < nSize) {
+        size_t n = 0;
+        while (n < (1 << 20) - 256) {
+            n += (size_t)sprintf(pBuffer + n, "2026-10-17 12:%02u:%02u.%03u INFO [worker-%u] request %llu %s in %u ms\r\n",
+                                 (unsigned)TestRngBelow(pRng, 60), (unsigned)TestRngBelow(pRng, 60),
+                                 (unsigned)TestRngBelow(pRng, 1000), (unsigned)TestRngBelow(pRng, 16),
+                                 (unsigned long long)nLine++,
+                                 TestRngBelow(pRng, 8) ? "completed" : "\xd0\xb7\xd0\xb0\xd0\xb2\xd0\xb5\xd1\x80\xd1\x88\xd1\x91\xd0\xbd",
+                                 (unsigned)TestRngBelow(pRng, 5000));
+        }
+        if (n > nSize - nWritten) n = (size_t)(nSize - nWritten);
+        REQUIRE(fwrite(pBuffer, 1, n, pFile) == n);
+        nWritten += n;
+    }
+    REQUIRE(fclose(pFile) == 0);
+    free(pBuffer);
+}
+
+int main(int argc, char** argv) {
+    uint64_t nSize = (uint64_t)BenchSizeMB(argc, argv, 4096) << 20;
+    uint64_t nMemory = (uint64_t)sysconf(_SC_PHYS_PAGES) * (uint64_t)sysconf(_SC_PAGESIZE);
+    long nProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+    double dOneThread = 0;
+    size_t nLines = 0, i;
+    uint16_t* pDst;
+    FileLoad load;
+    TestRng rng;
+    char szPath[256];
+    int nThreads;
+
+    if (nSize * sizeof(uint16_t) > nMemory / 2) {
+        nSize = nMemory / 4 & ~(uint64_t)0xFFFFF;
+        printf("corpus cut to %llu MB to fit in memory\n", (unsigned long long)(nSize >> 20));
+    }
+    if (argc > 2) nProcessors = atol(argv[2]);
+    if (nProcessors < 1) nProcessors = 1;
+    if (nProcessors > FILE_LOAD_MAX_THREADS) nProcessors = FILE_LOAD_MAX_THREADS;
+
+    TestRngInit(&rng, TestSeed(10));
+    TestTempPath(szPath, sizeof(szPath), "file_load.log");
+    MakeLog(szPath, nSize, &rng);
+    REQUIRE(FileLoadOpen(&load, szPath));
+    pDst = (uint16_t*)malloc((load.nTextSize + 1) * sizeof(uint16_t));
+    REQUIRE(pDst);
+
+    /* Fault in the output and read the file into the cache, outside the timings */
+    memset(pDst, 0, (load.nTextSize + 1) * sizeof(uint16_t));
+    for (i = 0; i < load.nTextSize; i += 4096) nLines += load.pText[i];
+
+    /* Powers of two, ending with the processor count */
+    for (nThreads = 1;; nThreads *= 2) {
+        double dBest = 0;
+        char szLabel[64];
+        int nRun;
+
+        if (nThreads > nProcessors) nThreads = (int)nProcessors;
+
+        for (nRun = 0; nRun < 3; nRun++) {
+            LineIndex lines;
+            double t0 = TestSeconds(), dTime;
+            LineIndexInit(&lines);
+            REQUIRE(FileLoadDecode(&load, pDst, &lines, nThreads, NULL, NULL) == FILE_LOAD_OK);
+            dTime = TestSeconds() - t0;
+            if (nRun == 0 || dTime < dBest) dBest = dTime;
+            if (nThreads == 1 && nRun == 0) nLines = LineIndexCount(&lines);
+            REQUIRE(LineIndexCount(&lines) == nLines);
+            LineIndexFree(&lines);
+        }
+        if (nThreads == 1) dOneThread = dBest;
+        snprintf(szLabel, sizeof(szLabel), "decode + index, %d thread(s) (%d used)", nThreads, load.nThreads);
+        BenchReport(szLabel, dBest, (double)load.nTextSize);
+        printf("%-40s %9.2fx\n", "  speedup", dOneThread / dBest);
+        if (nThreads == nProcessors) break;
+    }
+    printf("%-40s %9zu\n", "lines", nLines);
+
+    free(pDst);
+    FileLoadClose(&load);
+    unlink(szPath);
+    return 0;
+}
@@ -0,0 +1,310 @@
+/*
+ * The file loading pipeline against a one-shot decode: files of every size
+ * around the chunk boundaries, with breaks and UTF-8 sequences split
+ * between chunks, invalid bytes, a byte order mark, and one to five
+ * threads. The progress callback must see a growing prefix that already
+ * matches the final text. A load cancelled from the callback, before it
+ * starts or from another thread stops early with part of the text ready.
+ * Files past LARGE_FILE_THRESHOLD (sparse) go to the large file viewer in
+ * the encoding found, or nowhere if the viewer cannot page it.
+ */
+
+#include "file_load.h"
+#include "large_view.h"
+#include "piece_table.h"
+#include "text_encoding.h"
+#include "transcode.h"
+#include "test_util.h"
+
+#include <pthread.h>
+
+static char g_szPath[256];
+
+/* Random text, ASCII with LF breaks or mixed with multibyte sequences and every break */
+static size_t MakeText(uint8_t* pText, size_t nLen, int bMixed, TestRng* pRng) {
+    static const char* const multi[] = {"\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80", "\xd0\x96"};
+    static const char* const breaks[] = {"\n", "\r\n", "\r"};
+    size_t n = 0;
+    while (n + 4 < nLen) {
+        size_t r = TestRngBelow(pRng, 100);
+        const char* szPut = NULL;
+        if (r < 6) szPut = breaks[bMixed ? TestRngBelow(pRng, 3) : 0];
+        else if (bMixed && r < 20) szPut = multi[TestRngBelow(pRng, 4)];
+        if (szPut) {
+            memcpy(pText + n, szPut, strlen(szPut));
+            n += strlen(szPut);
+        } else {
+            pText[n++] = (uint8_t)('a' + TestRngBelow(pRng, 26));
+        }
+    }
+    return n;
+}
+
+/* What the progress callback saw */
+typedef struct {
+    int nCalls;
+    int nCancelAt;               /* Cancel from the callback on this call (0 never) */
+    size_t nFirstUnits;
+    size_t nLastUnits;
+    int bShrank;
+    int bPrefixWrong;
+    const uint16_t* pDst;
+    const uint16_t* pExpected;   /* Final text, or NULL not to compare */
+} Progress;
+
+static void OnProgress(void* pContext, const FileLoad* pLoad) {
+    Progress* pProgress = (Progress*)pContext;
+    size_t nUnits = FileLoadUnitsReady(pLoad);
+
+    if (pProgress->nCalls == 0) pProgress->nFirstUnits = nUnits;
+    if (nUnits < pProgress->nLastUnits) pProgress->bShrank = 1;
+    if (pProgress->pExpected && memcmp(pProgress->pDst, pProgress->pExpected, nUnits * sizeof(uint16_t))) {
+        pProgress->bPrefixWrong = 1;
+    }
+    pProgress->nLastUnits = nUnits;
+    if (++pProgress->nCalls == pProgress->nCancelAt) FileLoadCancel((FileLoad*)pLoad);
+}
+
+/* Lines and break counts of the load match a fresh index of the expected text */
+static void CheckLines(const FileLoad* pLoad, const LineIndex* pLines, const uint16_t* pExpected, size_t nExpected) {
+    PieceTable doc;
+    LineIndex ref;
+    TextScan scan;
+    size_t nLines, k;
+
+    PieceTableInit(&doc);
+    LineIndexInit(&ref);
+    REQUIRE(PieceTableLoad(&doc, pExpected, nExpected, NULL, NULL));
+    REQUIRE(LineIndexBuild(&ref, &doc));
+    nLines = LineIndexCount(&ref);
+    CHECK(LineIndexCount(pLines) == nLines);
+    for (k = 0; k < nLines && k < LineIndexCount(pLines); k += 1 + nLines / 500) {
+        int nBreak = 0, nRefBreak = 0;
+        CHECK(LineIndexLineStart(pLines, k) == LineIndexLineStart(&ref, k));
+        CHECK(LineIndexLineLength(pLines, k, &nBreak) == LineIndexLineLength(&ref, k, &nRefBreak));
+        CHECK(nBreak == nRefBreak);
+    }
+
+    TextScanInit(&scan, NULL, NULL);
+    TextScanUnits(&scan, pExpected, nExpected);
+    TextScanFinish(&scan);
+    CHECK(pLoad->nCRLF == scan.nCRLF);
+    CHECK(pLoad->nLoneLF == TextScanLoneLF(&scan));
+    CHECK(pLoad->nLoneCR == TextScanLoneCR(&scan));
+
+    LineIndexFree(&ref);
+    PieceTableFree(&doc);
+}
+
+/* Load nLen bytes through the pipeline and compare with a one-shot decode */
+static void CheckLoad(const uint8_t* pData, size_t nLen, int nThreads) {
+    size_t nSkip = nLen >= 3 && memcmp(pData, "\xEF\xBB\xBF", 3) == 0 ? 3 : 0;
+    size_t nText = nLen - nSkip, nExpected = 0, nError = 0;
+    size_t nChunks = nText == 0 ? 0
+                     : nText <= FILE_LOAD_FIRST_CHUNK
+                         ? 1
+                         : 1 + (nText - FILE_LOAD_FIRST_CHUNK + FILE_LOAD_CHUNK - 1) / FILE_LOAD_CHUNK;
+    uint16_t* pExpected = (uint16_t*)malloc((nLen + 1) * sizeof(uint16_t));
+    uint16_t* pDst = (uint16_t*)malloc((nLen + 1) * sizeof(uint16_t));
+    int bUtf8, nResult;
+    Progress progress;
+    FileLoad load;
+    LineIndex lines;
+
+    REQUIRE(pExpected && pDst);
+    bUtf8 = Utf8ToUtf16(pData + nSkip, nText, pExpected, &nExpected, &nError, NULL);
+
+    REQUIRE(TestWriteFile(g_szPath, pData, nLen));
+    REQUIRE(FileLoadOpen(&load, g_szPath));
+    CHECK(load.nTextSize == nText);
+    CHECK(load.bBom == (nSkip != 0));
+
+    memset(&progress, 0, sizeof(progress));
+    progress.pDst = pDst;
+    progress.pExpected = bUtf8 ? pExpected : NULL;
+    LineIndexInit(&lines);
+    nResult = FileLoadDecode(&load, pDst, &lines, nThreads, OnProgress, &progress);
+    CHECK(!progress.bShrank);
+    CHECK(!progress.bPrefixWrong);
+
+    if (!bUtf8) {
+        CHECK(nResult == FILE_LOAD_NOT_UTF8);
+    } else {
+        CHECK(nResult == FILE_LOAD_OK);
+        CHECK(load.nUnitsReady == nExpected);
+        CHECK(memcmp(pDst, pExpected, nExpected * sizeof(uint16_t)) == 0);
+        CHECK(FileLoadPercent(&load) == 100);
+        CHECK(load.bIndexed);
+        if (load.bIndexed) CheckLines(&load, &lines, pExpected, nExpected);
+
+        /* A report per stitched chunk; the first one is small, for the first screen */
+        CHECK(progress.nCalls + 1 >= (int)nChunks && progress.nCalls <= (int)nChunks + 1);
+        if (nText) CHECK(progress.nFirstUnits > 0 && progress.nFirstUnits <= FILE_LOAD_FIRST_CHUNK);
+    }
+
+    LineIndexFree(&lines);
+    FileLoadClose(&load);
+    free(pDst);
+    free(pExpected);
+}
+
+static void TestLoads(uint8_t* pData) {
+    TestRng rng;
+    int t;
+
+    memcpy(pData, "\xEF\xBB\xBFhi\r\n", 7);
+    CheckLoad(pData, 0, 1);
+    CheckLoad(pData, 3, 1);
+    CheckLoad(pData, 7, 2);
+
+    TestRngInit(&rng, TestSeed(9));
+    for (t = 0; t < 45 && !g_nTestFailures; t++) {
+        const size_t sizes[] = {10, 1000, FILE_LOAD_FIRST_CHUNK - 1, FILE_LOAD_FIRST_CHUNK, FILE_LOAD_FIRST_CHUNK + 1,
+                                FILE_LOAD_FIRST_CHUNK + FILE_LOAD_CHUNK + 3,
+                                3 * FILE_LOAD_CHUNK + TestRngBelow(&rng, 100000),
+                                FILE_LOAD_PARALLEL_MIN + TestRngBelow(&rng, 6u << 20), FILE_LOAD_PARALLEL_MIN + 3};
+        size_t nLen = MakeText(pData, sizes[t % 9], t % 2, &rng), nAt;
+
+        /* Split a CRLF, a CR before text or a four-byte sequence between later chunks */
+        for (nAt = FILE_LOAD_FIRST_CHUNK + FILE_LOAD_CHUNK; nAt + 4 < nLen; nAt += FILE_LOAD_CHUNK) {
+            if (t % 4 == 1) memcpy(pData + nAt - 1, "\r\n", 2);
+            if (t % 4 == 2) memcpy(pData + nAt - 1, "\rx", 2);
+            if (t % 4 == 3) memcpy(pData + nAt - 2, "\xf0\x9f\x98\x80", 4);
+        }
+        /* The same across the end of the first chunk */
+        if (t % 13 == 5 && nLen > FILE_LOAD_FIRST_CHUNK + 4) memcpy(pData + FILE_LOAD_FIRST_CHUNK - 1, "\xf0\x9f\x98\x80", 4);
+        if (t % 13 == 6 && nLen > FILE_LOAD_FIRST_CHUNK + 4) memcpy(pData + FILE_LOAD_FIRST_CHUNK - 1, "\r\n", 2);
+        /* An invalid byte somewhere, or a sequence cut off at the end */
+        if (t % 5 == 4) pData[TestRngBelow(&rng, nLen)] = 0xFF;
+        if (t % 11 == 3) pData[nLen - 1] = 0xE2;
+
+        CheckLoad(pData, nLen, 1 + t % 5);
+    }
+}
+
+/* Write nLen bytes of pStart, then zeros up to nSize (a hole where the file system allows) */
+static void WriteSparse(const char* pStart, size_t nLen, uint64_t nSize) {
+    REQUIRE(TestWriteFile(g_szPath, (const uint8_t*)pStart, nLen));
+    REQUIRE(truncate(g_szPath, (off_t)nSize) == 0);
+}
+
+/* Route of a file, and its detected encoding */
+static int RouteOf(const char* pStart, size_t nLen, uint64_t nSize, int* pnEncoding) {
+    FileLoad load;
+    int nRoute;
+
+    WriteSparse(pStart, nLen, nSize);
+    REQUIRE(FileLoadOpen(&load, g_szPath));
+    nRoute = FileLoadRoute(&load);
+    *pnEncoding = load.nEncoding;
+    FileLoadClose(&load);
+    return nRoute;
+}
+
+static void TestRoutes(void) {
+    int nMapped = IsNativeEncoding(TEXT_ENCODING_UTF16LE) ? FILE_LOAD_ROUTE_MAPPED : FILE_LOAD_ROUTE_DECODE;
+    LargeView view;
+    int nEncoding;
+
+    /* Small enough to edit */
+    CHECK(RouteOf("hello\n", 6, 6, &nEncoding) == FILE_LOAD_ROUTE_DECODE && nEncoding == TEXT_ENCODING_UTF8);
+    CHECK(RouteOf("\xFF\xFEh\0i\0", 6, 6, &nEncoding) == nMapped && nEncoding == TEXT_ENCODING_UTF16LE);
+    CHECK(RouteOf("\xFF\xFEh\0i", 5, 5, &nEncoding) == FILE_LOAD_ROUTE_DECODE);
+    CHECK(RouteOf("\xFE\xFF\0h\0i", 6, 6, &nEncoding) == FILE_LOAD_ROUTE_DECODE && nEncoding == TEXT_ENCODING_UTF16BE);
+
+    /* Too big: UTF-8 is paged in the encoding found, past its BOM */
+    CHECK(RouteOf("\xEF\xBB\xBFhi\n", 6, LARGE_FILE_THRESHOLD, &nEncoding) == FILE_LOAD_ROUTE_VIEWER);
+    CHECK(nEncoding == TEXT_ENCODING_UTF8);
+    REQUIRE(LargeViewOpen(&view, g_szPath, nEncoding, NULL));
+    CHECK(view.bUtf8 && view.nStart == 3 && view.nSize == LARGE_FILE_THRESHOLD);
+    LargeViewClose(&view);
+
+    /* The wide encodings are not mis-read as bytes: no route, and the viewer will not take them */
+    CHECK(RouteOf("\xFE\xFF\0h\0i", 6, LARGE_FILE_THRESHOLD, &nEncoding) == FILE_LOAD_ROUTE_NONE);
+    CHECK(nEncoding == TEXT_ENCODING_UTF16BE);
+    CHECK(!LargeViewOpen(&view, g_szPath, nEncoding, NULL));
+    CHECK(RouteOf("\xFF\xFE\0\0h\0\0\0", 8, LARGE_FILE_THRESHOLD + 4, &nEncoding) == FILE_LOAD_ROUTE_NONE);
+    CHECK(nEncoding == TEXT_ENCODING_UTF32LE);
+
+    /* ANSI is paged as single bytes */
+    WriteSparse("caf\xE9\n", 5, 5);
+    REQUIRE(LargeViewOpen(&view, g_szPath, TEXT_ENCODING_ANSI, NULL));
+    CHECK(!view.bUtf8 && view.nStart == 0);
+    LargeViewClose(&view);
+}
+
+static void* CancelSoon(void* pArg) {
+    usleep(2000);
+    FileLoadCancel((FileLoad*)pArg);
+    return NULL;
+}
+
+static void TestCancel(uint8_t* pData) {
+    size_t nLen;
+    uint16_t* pDst;
+    Progress progress;
+    FileLoad load;
+    LineIndex lines;
+    pthread_t thread;
+    TestRng rng;
+    int nResult;
+
+    TestRngInit(&rng, TestSeed(9));
+    nLen = MakeText(pData, 20u << 20, 1, &rng);
+    REQUIRE(TestWriteFile(g_szPath, pData, nLen));
+    pDst = (uint16_t*)malloc(nLen * sizeof(uint16_t));
+    REQUIRE(pDst);
+
+    /* From the progress callback: no more reports, and the prefix stays usable */
+    REQUIRE(FileLoadOpen(&load, g_szPath));
+    memset(&progress, 0, sizeof(progress));
+    progress.nCancelAt = 2;
+    LineIndexInit(&lines);
+    nResult = FileLoadDecode(&load, pDst, &lines, 4, OnProgress, &progress);
+    CHECK(nResult == FILE_LOAD_CANCELLED);
+    CHECK(progress.nCalls == 2);
+    CHECK(FileLoadIsCancelled(&load));
+    CHECK(FileLoadUnitsReady(&load) == progress.nLastUnits);
+    CHECK(FileLoadPercent(&load) < 100);
+    LineIndexFree(&lines);
+    FileLoadClose(&load);
+
+    /* Before the decode starts: nothing is reported */
+    REQUIRE(FileLoadOpen(&load, g_szPath));
+    FileLoadCancel(&load);
+    memset(&progress, 0, sizeof(progress));
+    LineIndexInit(&lines);
+    CHECK(FileLoadDecode(&load, pDst, &lines, 4, OnProgress, &progress) == FILE_LOAD_CANCELLED);
+    CHECK(progress.nCalls == 0);
+    LineIndexFree(&lines);
+    FileLoadClose(&load);
+
+    /* From another thread, while the decode runs (it may also finish first) */
+    REQUIRE(FileLoadOpen(&load, g_szPath));
+    memset(&progress, 0, sizeof(progress));
+    LineIndexInit(&lines);
+    REQUIRE(pthread_create(&thread, NULL, CancelSoon, &load) == 0);
+    nResult = FileLoadDecode(&load, pDst, &lines, 4, OnProgress, &progress);
+    pthread_join(thread, NULL);
+    CHECK(nResult == FILE_LOAD_CANCELLED || nResult == FILE_LOAD_OK);
+    if (nResult == FILE_LOAD_CANCELLED) CHECK(FileLoadUnitsReady(&load) < nLen);
+    LineIndexFree(&lines);
+    FileLoadClose(&load);
+
+    free(pDst);
+}
+
+int main(void) {
+    uint8_t* pData = (uint8_t*)malloc(24u << 20);
+    FileLoad load;
+
+    REQUIRE(pData);
+    TestTempPath(g_szPath, sizeof(g_szPath), "file_load.txt");
+    TestLoads(pData);
+    TestCancel(pData);
+    TestRoutes();
+    unlink(g_szPath);
+    CHECK(!FileLoadOpen(&load, g_szPath));
+    free(pData);
+    return TestResult("file_load_test");
+}
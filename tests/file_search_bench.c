@@ -0,0 +1,136 @@
+/*
+ * Find in Files over a generated tree (default 10000 files of 0-96 KB in
+ * a hundred folders): logs with LF, CRLF and CR line ends, some Latin-1,
+ * some binary. Times a rare literal, a case-folded frequent literal, a
+ * whole word and a regular expression on one worker, the minimum pool and
+ * the default pool, and checks the matching lines against counts kept
+ * while writing the files. The tree is written just before, so the page
+ * cache is warm. Usage: file_search_bench [files] [average KB]
+ */
+
+#include <sys/stat.h>
+#include "file_search.h"
+#include "test_util.h"
+
+typedef struct {
+    uint64_t nLines;             /* Matching lines reported */
+} Hits;
+
+static void CountHits(void* pContext, const PathChar* szPath, int bLatin1, const FileSearchHit* pHits, size_t nHits) {
+    (void)szPath;
+    (void)bLatin1;
+    (void)pHits;
+    ((Hits*)pContext)->nLines += nHits;
+}
+
+static void FilePath(char* szPath, size_t cchPath, const char* szRoot, int nFile, int bBinary) {
+    snprintf(szPath, cchPath, "%s/d%02d/s%d/app%d.log%s", szRoot, nFile / 1000, (nFile / 100) % 10, nFile,
+             bBinary ? ".bin" : "");
+}
+
+static void Run(const char* szRoot, const char* szLabel, const char* szPattern, unsigned nFlags, int bRegex,
+                uint64_t nExpected) {
+    static const int threads[] = {1, FILE_SEARCH_MIN_THREADS, 0};
+    TextUnit pattern[64];
+    size_t nPattern = strlen(szPattern), i, t;
+
+    for (i = 0; i < nPattern; i++) pattern[i] = (TextUnit)(uint8_t)szPattern[i];
+    for (t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+        const char* szError = NULL;
+        char szLine[80];
+        FileSearch search;
+        Hits hits = {0};
+        double t0, dTime;
+
+        REQUIRE(FileSearchInit(&search, szRoot, pattern, nPattern, nFlags, bRegex, &szError));
+        t0 = TestSeconds();
+        REQUIRE(FileSearchRun(&search, threads[t], CountHits, &hits) == FILE_SEARCH_OK);
+        dTime = TestSeconds() - t0;
+        if (threads[t]) snprintf(szLine, sizeof(szLine), "%s, %d thread%s", szLabel, threads[t], threads[t] > 1 ? "s" : "");
+        else snprintf(szLine, sizeof(szLine), "%s, default pool", szLabel);
+        BenchReport(szLine, dTime, (double)search.stats.nBytes);
+        printf("%-40s %9.0f files/s, %llu lines\n", "", (double)(search.stats.nFiles + search.stats.nBinary) / dTime,
+               (unsigned long long)hits.nLines);
+        REQUIRE(hits.nLines == search.stats.nHits);
+        REQUIRE(nExpected == UINT64_MAX || hits.nLines == nExpected);
+        FileSearchFree(&search);
+    }
+}
+
+int main(int argc, char** argv) {
+    static const char* const words[] = {"alpha", "beta", "gamma", "delta", "request", "handler", "timeout", "user",
+                                        "session", "cache", "db", "query", "retry", "socket", "worker"};
+    int nFiles = argc > 1 ? atoi(argv[1]) : 10000, nAverageKB = argc > 2 ? atoi(argv[2]) : 48, f;
+    uint64_t nNeedleLines = 0, nErrorLines = 0, nTotal = 0;
+    uint8_t* pKinds = (uint8_t*)malloc((size_t)nFiles + 1);
+    char szRoot[256], szPath[512];
+    TestRng rng;
+
+    REQUIRE(pKinds && nFiles > 0);
+    TestRngInit(&rng, TestSeed(17));
+    TestTempPath(szRoot, sizeof(szRoot), "tree");
+    REQUIRE(mkdir(szRoot, 0755) == 0);
+    for (f = 0; f < nFiles; f++) {
+        /* 0-2 binary, 3-5 Latin-1, 6-10 CRLF, 11-12 CR, the rest LF */
+        int nKind = (int)TestRngBelow(&rng, 100);
+        const char* szEol = nKind >= 6 && nKind <= 10 ? "\r\n" : nKind >= 11 && nKind <= 12 ? "\r" : "\n";
+        size_t nTarget = TestRngBelow(&rng, 2 * (size_t)nAverageKB * 1024 + 1), nLen = 0;
+        unsigned nLine = 0;
+        FILE* pFile;
+
+        pKinds[f] = (uint8_t)nKind;
+        snprintf(szPath, sizeof(szPath), "%s/d%02d", szRoot, f / 1000);
+        mkdir(szPath, 0755);
+        snprintf(szPath, sizeof(szPath), "%s/d%02d/s%d", szRoot, f / 1000, (f / 100) % 10);
+        mkdir(szPath, 0755);
+        FilePath(szPath, sizeof(szPath), szRoot, f, nKind < 3);
+        pFile = fopen(szPath, "wb");
+        REQUIRE(pFile);
+        if (nKind < 3) nLen += fwrite("\0", 1, 1, pFile);
+        while (nLen < nTarget) {
+            char szLine[512];
+            int bError = TestRngBelow(&rng, 50) == 0, n;
+            n = snprintf(szLine, sizeof(szLine), "2026-01-%02u 12:%02u:%02u [%s] %s %s id=%u", 1 + nLine % 28, nLine % 60,
+                         nLine * 7 % 60, bError ? "ERROR" : "INFO", words[TestRngBelow(&rng, 15)],
+                         words[TestRngBelow(&rng, 15)], (unsigned)TestRngBelow(&rng, 100000));
+            if (TestRngBelow(&rng, 200) == 0) {
+                unsigned nNeedle = (unsigned)TestRngBelow(&rng, 10);
+                n += snprintf(szLine + n, sizeof(szLine) - n, " needle%u", nNeedle);
+                if (nNeedle == 7 && nKind >= 3) nNeedleLines++;
+            }
+            if (nKind >= 3 && nKind <= 5 && TestRngBelow(&rng, 20) == 0) {
+                n += snprintf(szLine + n, sizeof(szLine) - n, " caf\xe9");
+            } else if (TestRngBelow(&rng, 30) == 0) {
+                n += snprintf(szLine + n, sizeof(szLine) - n, " caf\xc3\xa9");
+            }
+            if (bError && nKind >= 3) nErrorLines++;
+            nLen += fwrite(szLine, 1, (size_t)n, pFile) + fwrite(szEol, 1, strlen(szEol), pFile);
+            nLine++;
+        }
+        REQUIRE(fclose(pFile) == 0);
+        nTotal += nLen;
+    }
+    printf("%d files, %.1f MB\n", nFiles, nTotal / 1048576.0);
+
+    Run(szRoot, "rare literal", "needle7", TEXT_SEARCH_MATCH_CASE, 0, nNeedleLines);
+    Run(szRoot, "frequent, ignoring case", "error", 0, 0, nErrorLines);
+    Run(szRoot, "whole word", "needle7", TEXT_SEARCH_MATCH_CASE | TEXT_SEARCH_WHOLE_WORD, 0, nNeedleLines);
+    Run(szRoot, "regular expression", "\\[ERROR\\] (timeout|retry) \\w+ id=\\d{5}$", TEXT_SEARCH_MATCH_CASE, 1,
+        UINT64_MAX);
+
+    for (f = 0; f < nFiles; f++) {
+        FilePath(szPath, sizeof(szPath), szRoot, f, pKinds[f] < 3);
+        unlink(szPath);
+        if (f % 100 == 99 || f == nFiles - 1) {
+            snprintf(szPath, sizeof(szPath), "%s/d%02d/s%d", szRoot, f / 1000, (f / 100) % 10);
+            rmdir(szPath);
+        }
+        if (f % 1000 == 999 || f == nFiles - 1) {
+            snprintf(szPath, sizeof(szPath), "%s/d%02d", szRoot, f / 1000);
+            rmdir(szPath);
+        }
+    }
+    rmdir(szRoot);
+    free(pKinds);
+    return 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * Frame scheduler on a fake clock. A small host model plays the window:
+ * it keeps the one wakeup the scheduler asks for (firing it on time or
+ * late, as a timer would) and runs a frame when it fires. Checked: an idle
+ * scheduler asks for nothing, marks between frames merge into one frame,
+ * frames are at least FRAME_INTERVAL_MS apart, no mark is lost or waits
+ * longer than one interval plus the timer's lateness, and the scheduler is
+ * idle again once the marks stop.
+ */
+
+#include "frame_sched.h"
+#include "test_util.h"
+
+/* Fake clock and timer */
+typedef struct {
+    FrameScheduler sched;
+    uint64_t nNow;
+    int bTimer;                  /* A wakeup is set */
+    uint64_t nFireAt;
+    unsigned nLateMax;           /* Most milliseconds a wakeup fires late */
+    TestRng* pRng;
+    /* What the frames saw */
+    uint64_t nLastFrame;
+    uint64_t nFrames;
+    unsigned nPending;           /* Parts marked since the last frame began */
+    uint64_t nOldestMark;        /* When the oldest of those was marked */
+    uint64_t nMinGap;
+    uint64_t nMaxWait;
+} Host;
+
+static void HostInit(Host* pHost, uint64_t nStart, unsigned nLateMax, TestRng* pRng) {
+    memset(pHost, 0, sizeof(*pHost));
+    FrameSchedInit(&pHost->sched);
+    pHost->nNow = nStart;
+    pHost->nLateMax = nLateMax;
+    pHost->pRng = pRng;
+    pHost->nMinGap = UINT64_MAX;
+}
+
+static void HostMark(Host* pHost, unsigned nDirty) {
+    int nDelay = FrameSchedInvalidate(&pHost->sched, nDirty, pHost->nNow);
+    if (nDirty && !pHost->nPending) pHost->nOldestMark = pHost->nNow;
+    pHost->nPending |= nDirty;
+
+    if (nDelay == FRAME_NO_WAKEUP) {
+        /* Only when a wakeup is already out, or nothing was marked */
+        CHECK(pHost->bTimer || nDirty == 0);
+        return;
+    }
+    CHECK(!pHost->bTimer);
+    CHECK(nDelay >= 0 && nDelay <= FRAME_INTERVAL_MS);
+    pHost->bTimer = 1;
+    pHost->nFireAt = pHost->nNow + (uint64_t)nDelay + TestRngBelow(pHost->pRng, pHost->nLateMax + 1);
+}
+
+/* Move the clock to nTo, running every frame that falls due on the way */
+static void HostAdvance(Host* pHost, uint64_t nTo) {
+    while (pHost->bTimer && pHost->nFireAt <= nTo) {
+        unsigned nDirty;
+        pHost->nNow = pHost->nFireAt;
+        pHost->bTimer = 0;
+        nDirty = FrameSchedBeginFrame(&pHost->sched, pHost->nNow);
+
+        /* The frame gets exactly what was marked since the last one */
+        CHECK(nDirty == pHost->nPending);
+        if (nDirty) {
+            if (pHost->nFrames && pHost->nNow - pHost->nLastFrame < pHost->nMinGap) {
+                pHost->nMinGap = pHost->nNow - pHost->nLastFrame;
+            }
+            if (pHost->nNow - pHost->nOldestMark > pHost->nMaxWait) pHost->nMaxWait = pHost->nNow - pHost->nOldestMark;
+            pHost->nLastFrame = pHost->nNow;
+            pHost->nFrames++;
+        }
+        pHost->nPending = 0;
+    }
+    pHost->nNow = nTo;
+}
+
+static void TestBasics(void) {
+    FrameScheduler sched;
+
+    FrameSchedInit(&sched);
+    CHECK(FrameSchedIsIdle(&sched));
+    CHECK(FrameSchedInvalidate(&sched, 0, 1000) == FRAME_NO_WAKEUP);
+    CHECK(FrameSchedIsIdle(&sched));
+
+    /* The first mark runs at once; later ones ride along */
+    CHECK(FrameSchedInvalidate(&sched, FRAME_DIRTY_GUTTER, 1000) == 0);
+    CHECK(!FrameSchedIsIdle(&sched));
+    CHECK(FrameSchedInvalidate(&sched, FRAME_DIRTY_STATUS, 1000) == FRAME_NO_WAKEUP);
+    CHECK(FrameSchedInvalidate(&sched, FRAME_DIRTY_TITLE, 1001) == FRAME_NO_WAKEUP);
+    CHECK(FrameSchedBeginFrame(&sched, 1001) == (FRAME_DIRTY_GUTTER | FRAME_DIRTY_STATUS | FRAME_DIRTY_TITLE));
+    CHECK(FrameSchedIsIdle(&sched));
+    CHECK(sched.nFrames == 1);
+
+    /* Soon after a frame, the next waits out the interval */
+    CHECK(FrameSchedInvalidate(&sched, FRAME_DIRTY_LAYOUT, 1005) == FRAME_INTERVAL_MS - 4);
+    CHECK(FrameSchedBeginFrame(&sched, 1001 + FRAME_INTERVAL_MS) == FRAME_DIRTY_LAYOUT);
+
+    /* Marked while a frame runs: the next frame, one interval on */
+    CHECK(FrameSchedBeginFrame(&sched, 2000) == 0);
+    CHECK(FrameSchedInvalidate(&sched, FRAME_DIRTY_STATUS, 2000) == 0);
+    CHECK(FrameSchedBeginFrame(&sched, 2000) == FRAME_DIRTY_STATUS);
+    CHECK(FrameSchedInvalidate(&sched, FRAME_DIRTY_STATUS, 2000) == FRAME_INTERVAL_MS);
+
+    /* A wakeup with nothing left to do is not a frame */
+    FrameSchedInit(&sched);
+    CHECK(FrameSchedBeginFrame(&sched, 3000) == 0);
+    CHECK(sched.nFrames == 0 && !sched.bHadFrame);
+    CHECK(FrameSchedInvalidate(&sched, FRAME_DIRTY_GUTTER, 3000) == 0);
+
+    /* After a pause, at once again */
+    FrameSchedInit(&sched);
+    FrameSchedInvalidate(&sched, FRAME_DIRTY_GUTTER, 4000);
+    FrameSchedBeginFrame(&sched, 4000);
+    CHECK(FrameSchedInvalidate(&sched, FRAME_DIRTY_GUTTER, 4000 + FRAME_INTERVAL_MS) == 0);
+}
+
+/* Holding a key down: a mark every millisecond for a second gives paced frames, then idle */
+static void TestTyping(TestRng* pRng) {
+    Host host;
+    uint64_t nStart = 86400000ull * 40;   /* Forty days of uptime, as GetTickCount64 might report */
+    uint64_t t;
+
+    HostInit(&host, nStart, 0, pRng);
+    for (t = 0; t < 1000; t++) {
+        HostAdvance(&host, nStart + t);
+        HostMark(&host, FRAME_DIRTY_GUTTER | FRAME_DIRTY_STATUS);
+    }
+    HostAdvance(&host, nStart + 2000);
+
+    CHECK(host.nFrames >= 1000 / FRAME_INTERVAL_MS);
+    CHECK(host.nFrames <= 1000 / FRAME_INTERVAL_MS + 2);
+    CHECK(host.nMinGap >= FRAME_INTERVAL_MS);
+    CHECK(host.nMaxWait <= FRAME_INTERVAL_MS);
+    CHECK(host.nPending == 0);
+    CHECK(FrameSchedIsIdle(&host.sched) && !host.bTimer);
+
+    /* A long idle stretch asks for nothing at all */
+    HostAdvance(&host, nStart + 3600000);
+    CHECK(host.nFrames <= 1000 / FRAME_INTERVAL_MS + 2);
+    CHECK(!host.bTimer);
+}
+
+/* Random marks at random times, with late timers */
+static void TestRandom(TestRng* pRng) {
+    int nRun;
+
+    for (nRun = 0; nRun < 200 && !g_nTestFailures; nRun++) {
+        Host host;
+        unsigned nLateMax = (unsigned)TestRngBelow(pRng, 30);
+        uint64_t nTime = 1 + TestRngBelow(pRng, 1000000);
+        int k;
+
+        HostInit(&host, nTime, nLateMax, pRng);
+        for (k = 0; k < 2000; k++) {
+            size_t r = TestRngBelow(pRng, 10);
+            /* Bursts of marks close together, and the odd long pause */
+            nTime += r < 6 ? TestRngBelow(pRng, 3) : r < 9 ? TestRngBelow(pRng, 40) : TestRngBelow(pRng, 5000);
+            HostAdvance(&host, nTime);
+            HostMark(&host, (unsigned)TestRngBelow(pRng, 16));
+        }
+        HostAdvance(&host, nTime + FRAME_INTERVAL_MS + nLateMax);
+
+        if (host.nFrames > 1) CHECK(host.nMinGap >= FRAME_INTERVAL_MS);
+        CHECK(host.nMaxWait <= FRAME_INTERVAL_MS + nLateMax);
+        CHECK(host.nPending == 0);
+        CHECK(FrameSchedIsIdle(&host.sched) && !host.bTimer);
+        CHECK(host.sched.nFrames == host.nFrames);
+    }
+}
+
+int main(void) {
+    TestRng rng;
+
+    TestRngInit(&rng, TestSeed(12));
+    TestBasics();
+    TestTyping(&rng);
+    TestRandom(&rng);
+    return TestResult("frame_sched_test");
+}
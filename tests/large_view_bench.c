@@ -0,0 +1,110 @@
+/*
+ * Large file viewer core on a generated log (default 2 GB): open, the
+ * first screen at the top, middle and end, paging down and up, and the
+ * background line index. Usage: large_view_bench [size in MB]
+ */
+
+#include "large_view.h"
+#include "text_encoding.h"
+#include "test_util.h"
+
+#define SCREEN_ROWS 60
+#define PAGE_COUNT 20000
+
+/* Write nSize bytes of log lines (UTF-8, some non-ASCII, LF breaks) */
+static void MakeLog(const char* szPath, uint64_t nSize, TestRng* pRng) {
+    static const char* const words[] = {"INFO", "WARN", "request", "served", "in", "ms", "user",
+                                        "GET", "/api/v1/items", "200", "\xd0\xbe\xd1\x88\xd0\xb8\xd0\xb1\xd0\xba\xd0\xb0"};
+    FILE* pFile = fopen(szPath, "wb");
+    char* pBuffer = (char*)malloc(1 << 20);
+    uint64_t nWritten = 0;
+
+    REQUIRE(pFile && pBuffer);
+    while (nWritten < nSize) {
+        size_t n = 0;
+        while (n < (1 << 20) - 256) {
+            size_t nWords = 4 + TestRngBelow(pRng, 20), k;
+            n += (size_t)sprintf(pBuffer + n, "2026-10-17 12:%02u:%02u ", (unsigned)TestRngBelow(pRng, 60),
+                                 (unsigned)TestRngBelow(pRng, 60));
+            for (k = 0; k < nWords; k++) {
+                const char* szWord = words[TestRngBelow(pRng, sizeof(words) / sizeof(words[0]))];
+                size_t nWord = strlen(szWord);
+                memcpy(pBuffer + n, szWord, nWord);
+                n += nWord;
+                pBuffer[n++] = k + 1 < nWords ? ' ' : '\n';
+            }
+        }
+        if (n > nSize - nWritten) n = (size_t)(nSize - nWritten);
+        REQUIRE(fwrite(pBuffer, 1, n, pFile) == n);
+        nWritten += n;
+    }
+    REQUIRE(fclose(pFile) == 0);
+    free(pBuffer);
+}
+
+/* Decode one screen of rows from nRow (returns the row after it) */
+static uint64_t DecodeScreen(const LargeView* pView, uint64_t nRow, size_t* pnUnits) {
+    static uint16_t row[LARGE_VIEW_MAX_ROW];
+    for (int k = 0; k < SCREEN_ROWS; k++) {
+        int bLineEnd;
+        *pnUnits += LargeViewDecodeRow(pView, nRow, row, LARGE_VIEW_MAX_ROW, &nRow, &bLineEnd);
+    }
+    return nRow;
+}
+
+int main(int argc, char** argv) {
+    uint64_t nSize = (uint64_t)BenchSizeMB(argc, argv, 2048) << 20;
+    LargeView view;
+    TestRng rng;
+    char szPath[256];
+    uint64_t nRow, nLines = 0, nLine = 0;
+    size_t nUnits = 0, k;
+    double t0, dBytes = 0;
+
+    TestRngInit(&rng, TestSeed(8));
+    TestTempPath(szPath, sizeof(szPath), "large_view.log");
+    MakeLog(szPath, nSize, &rng);
+
+    t0 = TestSeconds();
+    REQUIRE(LargeViewOpen(&view, szPath, TEXT_ENCODING_UTF8, NULL));
+    BenchReport("open", TestSeconds() - t0, 0);
+
+    t0 = TestSeconds();
+    DecodeScreen(&view, view.nStart, &nUnits);
+    BenchReport("first screen, top", TestSeconds() - t0, 0);
+    t0 = TestSeconds();
+    DecodeScreen(&view, LargeViewRowStart(&view, nSize / 2), &nUnits);
+    BenchReport("first screen, middle", TestSeconds() - t0, 0);
+    t0 = TestSeconds();
+    nRow = view.nSize;
+    for (k = 0; k < SCREEN_ROWS; k++) nRow = LargeViewPrevRow(&view, nRow);
+    DecodeScreen(&view, nRow, &nUnits);
+    BenchReport("first screen, end", TestSeconds() - t0, 0);
+
+    /* Page down from the top, then back up, decoding every screen */
+    t0 = TestSeconds();
+    nRow = view.nStart;
+    for (k = 0; k < PAGE_COUNT && nRow < view.nSize; k++) nRow = DecodeScreen(&view, nRow, &nUnits);
+    dBytes = (double)(nRow - view.nStart);
+    BenchReport("page down x20000", TestSeconds() - t0, dBytes);
+    t0 = TestSeconds();
+    for (k = 0; k < (size_t)PAGE_COUNT * SCREEN_ROWS && nRow > view.nStart; k++) nRow = LargeViewPrevRow(&view, nRow);
+    BenchReport("rows up x1.2M", TestSeconds() - t0, dBytes);
+    REQUIRE(nRow == view.nStart);
+
+    /* The checkpoint index, in the steps the worker thread takes */
+    t0 = TestSeconds();
+    while (!LargeViewIndexStep(&view, 64 * LARGE_VIEW_CHECKPOINT)) {}
+    BenchReport("line index", TestSeconds() - t0, (double)nSize);
+    REQUIRE(LargeViewLineCount(&view, &nLines));
+
+    /* A lookup counts breaks from its checkpoint: half a checkpoint on average */
+    t0 = TestSeconds();
+    for (k = 0; k < 10000; k++) REQUIRE(LargeViewLineAt(&view, TestRngBelow(&rng, (size_t)nSize), &nLine));
+    BenchReport("line number lookups x10k", TestSeconds() - t0, 0);
+    printf("%-40s %9llu\n", "lines", (unsigned long long)nLines);
+
+    LargeViewClose(&view);
+    unlink(szPath);
+    return 0;
+}
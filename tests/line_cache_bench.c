@@ -0,0 +1,146 @@
+/*
+ * Line cache on a generated log (default 3 GB): opening it with an empty
+ * cache (map, detect the encoding, scan every line break, store the
+ * entry) against opening it again with the entry in place, both with the
+ * log dropped from the page cache first, as on the next morning. Then
+ * 64 MB appended, as a log grows overnight, and the reopen that scans
+ * only the new tail. Line counts are checked against what was written.
+ *
+ * Usage: line_cache_bench [size in MB]
+ */
+
+#include "large_view.h"
+#include "line_cache.h"
+#include "text_encoding.h"
+#include "test_util.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/* Append nSize bytes of log lines (UTF-8, some non-ASCII, LF breaks); returns the breaks written */
+static uint64_t AppendLog(const char* szPath, uint64_t nSize, TestRng* pRng) {
+    static const char* const words[] = {"INFO", "WARN", "request", "served", "in", "ms", "user",
+                                        "GET", "/api/v1/items", "200", "\xd0\xbe\xd1\x88\xd0\xb8\xd0\xb1\xd0\xba\xd0\xb0"};
+    FILE* pFile = fopen(szPath, "ab");
+    char* pBuffer = (char*)malloc(1 << 20);
+    uint64_t nWritten = 0, nBreaks = 0;
+
+    REQUIRE(pFile && pBuffer);
+    while (nWritten < nSize) {
+        size_t n = 0, i;
+        while (n < (1 << 20) - 256) {
+            size_t nWords = 4 + TestRngBelow(pRng, 20), k;
+            n += (size_t)sprintf(pBuffer + n, "2026-10-17 12:%02u:%02u ", (unsigned)TestRngBelow(pRng, 60),
+                                 (unsigned)TestRngBelow(pRng, 60));
+            for (k = 0; k < nWords; k++) {
+                const char* szWord = words[TestRngBelow(pRng, sizeof(words) / sizeof(words[0]))];
+                size_t nWord = strlen(szWord);
+                memcpy(pBuffer + n, szWord, nWord);
+                n += nWord;
+                pBuffer[n++] = k + 1 < nWords ? ' ' : '\n';
+            }
+        }
+        if (n > nSize - nWritten) n = (size_t)(nSize - nWritten);
+        for (i = 0; i < n; i++) nBreaks += pBuffer[i] == '\n';
+        REQUIRE(fwrite(pBuffer, 1, n, pFile) == n);
+        nWritten += n;
+    }
+    REQUIRE(fclose(pFile) == 0);
+    free(pBuffer);
+    return nBreaks;
+}
+
+/* Write the file back and drop it from the page cache, so the next open reads the disk */
+static void DropFromPageCache(const char* szPath) {
+    int fd = open(szPath, O_RDONLY);
+    REQUIRE(fd >= 0);
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+/* Open through the cache, finish the index and store it; returns the line count */
+static uint64_t OpenIndexed(const char* szLabel, const char* szPath, const char* szCacheDir, uint64_t nSize) {
+    double t0 = TestSeconds(), dOpen, dIndex, dStore;
+    uint64_t nLines = 0;
+    size_t nCached;
+    LargeView view;
+
+    REQUIRE(LargeViewOpen(&view, szPath, TEXT_ENCODING_UTF8, szCacheDir));
+    dOpen = TestSeconds() - t0;
+    nCached = view.nReady;
+    t0 = TestSeconds();
+    while (!LargeViewIndexStep(&view, 64 * LARGE_VIEW_CHECKPOINT)) {}
+    dIndex = TestSeconds() - t0;
+    REQUIRE(LargeViewLineCount(&view, &nLines));
+    t0 = TestSeconds();
+    REQUIRE(LargeViewSaveIndex(&view, szPath, szCacheDir));
+    dStore = TestSeconds() - t0;
+    LargeViewClose(&view);
+
+    BenchReport(szLabel, dOpen + dIndex + dStore, (double)nSize);
+    printf("%-40s open %.3f s, index %.3f s, store %.3f s, %zu of %zu checkpoints cached\n", "", dOpen, dIndex,
+           dStore, nCached, (size_t)(nSize / LARGE_VIEW_CHECKPOINT) + 1);
+    fflush(stdout);
+    return nLines;
+}
+
+/* Cache directory being cleared, and the bytes its entries held */
+typedef struct {
+    const char* szDir;
+    uint64_t nBytes;
+} CacheDir;
+
+static int DeleteEntry(void* pContext, const PathChar* szName, int bDirectory) {
+    CacheDir* pDir = (CacheDir*)pContext;
+    char szPath[512];
+    struct stat st;
+
+    (void)bDirectory;
+    snprintf(szPath, sizeof(szPath), "%s/%s", pDir->szDir, szName);
+    if (stat(szPath, &st) == 0) pDir->nBytes += (uint64_t)st.st_size;
+    DeleteFilePath(szPath);
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    uint64_t nSize = (uint64_t)BenchSizeMB(argc, argv, 3072) << 20;
+    uint64_t nAppend = 64ull << 20, nBreaks, nLines;
+    char szPath[256], szCacheDir[256];
+    CacheDir dir;
+    TestRng rng;
+
+    TestRngInit(&rng, TestSeed(23));
+    TestTempPath(szPath, sizeof(szPath), "line_cache.log");
+    TestTempPath(szCacheDir, sizeof(szCacheDir), "line_cache");
+    REQUIRE(mkdir(szCacheDir, 0700) == 0);
+    unlink(szPath);
+    nBreaks = AppendLog(szPath, nSize, &rng);
+
+    DropFromPageCache(szPath);
+    nLines = OpenIndexed("cold open (empty cache)", szPath, szCacheDir, nSize);
+    REQUIRE(nLines == nBreaks + 1);
+    DropFromPageCache(szPath);
+    nLines = OpenIndexed("warm open (cached index)", szPath, szCacheDir, nSize);
+    REQUIRE(nLines == nBreaks + 1);
+
+    /* The log grows; only the tail past the last whole checkpoint is scanned */
+    nBreaks += AppendLog(szPath, nAppend, &rng);
+    nSize += nAppend;
+    DropFromPageCache(szPath);
+    nLines = OpenIndexed("warm open after a 64 MB append", szPath, szCacheDir, nSize);
+    REQUIRE(nLines == nBreaks + 1);
+    DropFromPageCache(szPath);
+    nLines = OpenIndexed("warm open again", szPath, szCacheDir, nSize);
+    REQUIRE(nLines == nBreaks + 1);
+    printf("%-40s %9llu\n", "lines", (unsigned long long)nLines);
+
+    /* The entry is a few kilobytes however large the log */
+    dir.szDir = szCacheDir;
+    dir.nBytes = 0;
+    REQUIRE(ListDirectory(szCacheDir, DeleteEntry, &dir));
+    printf("%-40s %9llu bytes\n", "cache entry", (unsigned long long)dir.nBytes);
+    rmdir(szCacheDir);
+    unlink(szPath);
+    return 0;
+}
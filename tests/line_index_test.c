@@ -0,0 +1,160 @@
+/*
+ * Line index after random edits against a naive scan of the text. The
+ * alphabet is heavy in CR and LF so edits keep splitting and joining CRLF
+ * pairs, and the occasional large insert or delete crosses chunks.
+ */
+
+#include "line_index.h"
+#include "test_util.h"
+
+#define MAX_TEXT 80000
+#define EDIT_COUNT 20000
+#define CHECK_EVERY 100
+
+static TextUnit g_text[MAX_TEXT];
+static size_t g_nLen;
+
+/* Naive scan results */
+static size_t g_starts[MAX_TEXT + 1];
+static int g_breaks[MAX_TEXT + 1];
+static size_t g_nLines;
+
+static void ScanLines(void) {
+    size_t i = 0;
+    g_nLines = 0;
+    g_starts[0] = 0;
+    while (i < g_nLen) {
+        if (g_text[i] == '\r' && i + 1 < g_nLen && g_text[i + 1] == '\n') {
+            g_breaks[g_nLines] = LINE_BREAK_CRLF;
+            i += 2;
+        } else if (g_text[i] == '\r') {
+            g_breaks[g_nLines] = LINE_BREAK_CR;
+            i++;
+        } else if (g_text[i] == '\n') {
+            g_breaks[g_nLines] = LINE_BREAK_LF;
+            i++;
+        } else {
+            i++;
+            continue;
+        }
+        g_starts[++g_nLines] = i;
+    }
+    g_breaks[g_nLines++] = LINE_BREAK_NONE;
+}
+
+/* Between the CR and LF of a CRLF pair */
+static int InsideCrlf(size_t nOffset) {
+    return nOffset > 0 && nOffset < g_nLen && g_text[nOffset - 1] == '\r' && g_text[nOffset] == '\n';
+}
+
+static void CheckIndex(const LineIndex* pIndex) {
+    size_t nLine, nOffset, nCollapsed = 0;
+
+    ScanLines();
+    CHECK(LineIndexCount(pIndex) == g_nLines);
+    if (LineIndexCount(pIndex) != g_nLines) return;
+
+    for (nLine = 0; nLine < g_nLines; nLine++) {
+        size_t nEnd = nLine + 1 < g_nLines ? g_starts[nLine + 1] : g_nLen;
+        int nBreak = -1;
+        CHECK(LineIndexLineStart(pIndex, nLine) == g_starts[nLine]);
+        CHECK(LineIndexLineLength(pIndex, nLine, &nBreak) == nEnd - g_starts[nLine]);
+        CHECK(nBreak == g_breaks[nLine]);
+    }
+
+    /* Every offset: its line, and the round trip through collapsed offsets */
+    nLine = 0;
+    for (nOffset = 0; nOffset <= g_nLen; nOffset++) {
+        while (nLine + 1 < g_nLines && g_starts[nLine + 1] <= nOffset) nLine++;
+        CHECK(LineIndexLineFromOffset(pIndex, nOffset) == nLine);
+        CHECK(LineIndexCollapsedFromOffset(pIndex, nOffset) == nCollapsed);
+        if (!InsideCrlf(nOffset)) {
+            CHECK(LineIndexOffsetFromCollapsed(pIndex, nCollapsed) == nOffset);
+        }
+        if (nOffset < g_nLen && !InsideCrlf(nOffset)) nCollapsed++;
+        if (g_nTestFailures) return;
+    }
+    CHECK(LineIndexOffsetFromCollapsed(pIndex, nCollapsed + 5) == g_nLen);
+}
+
+static void TestRandomEdits(void) {
+    static const TextUnit alphabet[] = {'a', 'b', '\r', '\n', 'x', '\r', '\n'};
+    static TextUnit run[4000];
+    PieceTable doc;
+    LineIndex index, rebuilt;
+    TestRng rng;
+    int it;
+
+    TestRngInit(&rng, TestSeed(2));
+    PieceTableInit(&doc);
+    LineIndexInit(&index);
+    LineIndexInit(&rebuilt);
+    g_nLen = 0;
+    REQUIRE(LineIndexBuild(&index, &doc));
+    CheckIndex(&index);
+
+    for (it = 0; it < EDIT_COUNT && !g_nTestFailures; it++) {
+        size_t nOffset = TestRngBelow(&rng, g_nLen + 1);
+        int bLarge = TestRngBelow(&rng, 8) == 0;
+
+        if (TestRngBelow(&rng, 3) < 2 || g_nLen < 10) {
+            size_t nLen = TestRngBelow(&rng, bLarge ? 3000 : 6), k;
+            if (g_nLen + nLen > MAX_TEXT) continue;
+            for (k = 0; k < nLen; k++) run[k] = alphabet[TestRngBelow(&rng, sizeof(alphabet) / sizeof(alphabet[0]))];
+            memmove(g_text + nOffset + nLen, g_text + nOffset, (g_nLen - nOffset) * sizeof(TextUnit));
+            memcpy(g_text + nOffset, run, nLen * sizeof(TextUnit));
+            g_nLen += nLen;
+            REQUIRE(PieceTableInsert(&doc, nOffset, run, nLen));
+            REQUIRE(LineIndexApplyEdit(&index, &doc, nOffset, 0, nLen));
+        } else {
+            size_t nLen = TestRngBelow(&rng, bLarge ? 4000 : 5);
+            if (nLen > g_nLen - nOffset) nLen = g_nLen - nOffset;
+            memmove(g_text + nOffset, g_text + nOffset + nLen, (g_nLen - nOffset - nLen) * sizeof(TextUnit));
+            g_nLen -= nLen;
+            REQUIRE(PieceTableDelete(&doc, nOffset, nLen));
+            REQUIRE(LineIndexApplyEdit(&index, &doc, nOffset, nLen, 0));
+        }
+        if (it % CHECK_EVERY == 0) CheckIndex(&index);
+    }
+    CheckIndex(&index);
+
+    /* A fresh build of the same text agrees with the incremental one */
+    REQUIRE(LineIndexBuild(&rebuilt, &doc));
+    CheckIndex(&rebuilt);
+    printf("line_index_test: %zu units, %zu lines after %d edits\n", g_nLen, g_nLines, it);
+
+    LineIndexFree(&rebuilt);
+    LineIndexFree(&index);
+    PieceTableFree(&doc);
+}
+
+/* Replacing text in one edit (remove and insert together) */
+static void TestReplace(void) {
+    static const TextUnit before[] = {'a', '\r', '\n', 'b', '\r', 'c'};
+    static const TextUnit with[] = {'\n', 'x', '\r'};
+    PieceTable doc;
+    LineIndex index;
+
+    PieceTableInit(&doc);
+    LineIndexInit(&index);
+    REQUIRE(PieceTableInsert(&doc, 0, before, 6));
+    REQUIRE(LineIndexBuild(&index, &doc));
+
+    /* "a CR LF b CR c" becomes "a CR LF x CR CR c": one edit, new breaks on both sides */
+    REQUIRE(PieceTableDelete(&doc, 2, 2));
+    REQUIRE(PieceTableInsert(&doc, 2, with, 3));
+    REQUIRE(LineIndexApplyEdit(&index, &doc, 2, 2, 3));
+
+    g_nLen = PieceTableCopy(&doc, 0, g_text, MAX_TEXT);
+    CHECK(g_nLen == 7);
+    CheckIndex(&index);
+
+    LineIndexFree(&index);
+    PieceTableFree(&doc);
+}
+
+int main(void) {
+    TestReplace();
+    TestRandomEdits();
+    return TestResult("line_index_test");
+}
@@ -0,0 +1,71 @@
+/*
+ * Edit cost on a large document (default 1 GB of UTF-16 text): random
+ * single-unit typing, scattered inserts and deletes, and a read back.
+ * Usage: piece_table_bench [size in MB]
+ */
+
+#include "piece_table.h"
+#include "test_util.h"
+
+#define EDIT_COUNT 1000000
+
+int main(int argc, char** argv) {
+    size_t nBytes = BenchSizeMB(argc, argv, 1024) * 1024 * 1024;
+    size_t nUnits = nBytes / sizeof(TextUnit), i;
+    TextUnit* pText = (TextUnit*)malloc(nBytes);
+    TextUnit* pOut;
+    TextUnit run[4] = {'a', 'b', 'c', '\n'};
+    PieceTable table;
+    TestRng rng;
+    double t0;
+    char szLabel[64];
+
+    REQUIRE(pText && nUnits > 0);
+    for (i = 0; i < nUnits; i++) pText[i] = (TextUnit)(i % 80 == 79 ? '\n' : 'x');
+    TestRngInit(&rng, TestSeed(7));
+    PieceTableInit(&table);
+
+    t0 = TestSeconds();
+    REQUIRE(PieceTableLoad(&table, pText, nUnits, NULL, NULL));
+    BenchReport("load (no copy)", TestSeconds() - t0, 0);
+
+    /* Typing: runs of single units at a caret that jumps now and then */
+    t0 = TestSeconds();
+    {
+        size_t nCaret = nUnits / 2;
+        for (i = 0; i < EDIT_COUNT; i++) {
+            if (i % 64 == 0) nCaret = TestRngBelow(&rng, PieceTableLength(&table) + 1);
+            REQUIRE(PieceTableInsert(&table, nCaret, run + (i & 3), 1));
+            nCaret++;
+        }
+    }
+    snprintf(szLabel, sizeof(szLabel), "%d typed units", EDIT_COUNT);
+    BenchReport(szLabel, TestSeconds() - t0, 0);
+
+    /* Scattered edits: every piece boundary is somewhere new */
+    t0 = TestSeconds();
+    for (i = 0; i < EDIT_COUNT; i++) {
+        size_t nLen = PieceTableLength(&table);
+        if (i & 1) {
+            REQUIRE(PieceTableDelete(&table, TestRngBelow(&rng, nLen), 1 + TestRngBelow(&rng, 4)));
+        } else {
+            REQUIRE(PieceTableInsert(&table, TestRngBelow(&rng, nLen + 1), run, 4));
+        }
+    }
+    snprintf(szLabel, sizeof(szLabel), "%d scattered edits", EDIT_COUNT);
+    BenchReport(szLabel, TestSeconds() - t0, 0);
+    printf("%-40s %9zu\n", "pieces", PieceTablePieceCount(&table));
+
+    /* Reading the whole edited document back */
+    pOut = (TextUnit*)malloc(PieceTableLength(&table) * sizeof(TextUnit));
+    REQUIRE(pOut);
+    t0 = TestSeconds();
+    REQUIRE(PieceTableCopy(&table, 0, pOut, PieceTableLength(&table)) == PieceTableLength(&table));
+    BenchReport("copy out", TestSeconds() - t0, (double)PieceTableLength(&table) * sizeof(TextUnit));
+    printf("%-40s %9ld KB\n", "peak RSS", BenchPeakRssKB());
+
+    PieceTableFree(&table);
+    free(pOut);
+    free(pText);
+    return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * Piece table against a flat reference buffer: random inserts and deletes,
+ * then every read path (copy, cursor, span lookup, span walk) must agree.
+ */
+
+#include "piece_table.h"
+#include "test_util.h"
+
+#define EDIT_COUNT 200000
+#define CHECK_EVERY 5000
+
+static TextUnit g_ref[4 * 1024 * 1024];
+static size_t g_nRefLen;
+
+typedef struct {
+    const TextUnit* pExpected;
+    size_t nOffset;
+    int bMatch;
+} SpanCompare;
+
+static int CompareSpan(void* pContext, const TextUnit* pText, size_t nLen) {
+    SpanCompare* pCompare = (SpanCompare*)pContext;
+    if (memcmp(pText, pCompare->pExpected + pCompare->nOffset, nLen * sizeof(TextUnit)) != 0) {
+        pCompare->bMatch = 0;
+        return 0;
+    }
+    pCompare->nOffset += nLen;
+    return 1;
+}
+
+static int g_nReleases;
+
+static void CountRelease(void* pContext, const TextUnit* pText, size_t nLen) {
+    (void)pContext;
+    (void)pText;
+    (void)nLen;
+    g_nReleases++;
+}
+
+/* Compare the table with the reference through every read path */
+static void CheckContents(const PieceTable* pTable, TestRng* pRng) {
+    static TextUnit copy[sizeof(g_ref) / sizeof(g_ref[0])];
+    PieceCursor cursor;
+    SpanCompare compare;
+    size_t i;
+
+    CHECK(PieceTableLength(pTable) == g_nRefLen);
+    CHECK(PieceTableCopy(pTable, 0, copy, g_nRefLen) == g_nRefLen);
+    CHECK(memcmp(copy, g_ref, g_nRefLen * sizeof(TextUnit)) == 0);
+
+    /* Backwards, so the cursor has to leave its cached span every time */
+    PieceCursorInit(&cursor, pTable);
+    for (i = g_nRefLen; i-- > 0;) {
+        TextUnit u;
+        if (!PieceCursorAt(&cursor, i, &u) || u != g_ref[i]) {
+            CHECK(!"cursor disagrees with the reference");
+            break;
+        }
+    }
+
+    if (g_nRefLen) {
+        size_t nOffset = TestRngBelow(pRng, g_nRefLen), nSpan = 0;
+        const TextUnit* pSpan = PieceTableSpanAt(pTable, nOffset, &nSpan);
+        CHECK(pSpan && nSpan > 0 && nOffset + nSpan <= g_nRefLen);
+        if (pSpan) CHECK(memcmp(pSpan, g_ref + nOffset, nSpan * sizeof(TextUnit)) == 0);
+
+        compare.pExpected = g_ref;
+        compare.nOffset = nOffset / 2;
+        compare.bMatch = 1;
+        CHECK(PieceTableForEach(pTable, nOffset / 2, g_nRefLen - nOffset / 2, CompareSpan, &compare));
+        CHECK(compare.bMatch && compare.nOffset == g_nRefLen);
+    }
+}
+
+static void TestRandomEdits(void) {
+    PieceTable table;
+    TestRng rng;
+    TextUnit* pOriginal = (TextUnit*)malloc(1000 * sizeof(TextUnit));
+    TextUnit run[16];
+    int it;
+
+    REQUIRE(pOriginal);
+    for (it = 0; it < 1000; it++) pOriginal[it] = g_ref[it] = (TextUnit)('a' + it % 26);
+    g_nRefLen = 1000;
+
+    TestRngInit(&rng, TestSeed(1));
+    PieceTableInit(&table);
+    g_nReleases = 0;
+    REQUIRE(PieceTableLoad(&table, pOriginal, 1000, CountRelease, NULL));
+
+    for (it = 0; it < EDIT_COUNT; it++) {
+        if (TestRngBelow(&rng, 3) < 2) {
+            size_t nOffset = TestRngBelow(&rng, 4) ? TestRngBelow(&rng, g_nRefLen + 1) : g_nRefLen;
+            size_t nLen = 1 + TestRngBelow(&rng, 8), k;
+            for (k = 0; k < nLen; k++) run[k] = (TextUnit)('A' + TestRngBelow(&rng, 26));
+            if (g_nRefLen + nLen > sizeof(g_ref) / sizeof(g_ref[0])) continue;
+            REQUIRE(PieceTableInsert(&table, nOffset, run, nLen));
+            memmove(g_ref + nOffset + nLen, g_ref + nOffset, (g_nRefLen - nOffset) * sizeof(TextUnit));
+            memcpy(g_ref + nOffset, run, nLen * sizeof(TextUnit));
+            g_nRefLen += nLen;
+        } else if (g_nRefLen) {
+            size_t nOffset = TestRngBelow(&rng, g_nRefLen);
+            size_t nLen = 1 + TestRngBelow(&rng, 10);
+            if (nLen > g_nRefLen - nOffset) nLen = g_nRefLen - nOffset;
+            REQUIRE(PieceTableDelete(&table, nOffset, nLen));
+            memmove(g_ref + nOffset, g_ref + nOffset + nLen, (g_nRefLen - nOffset - nLen) * sizeof(TextUnit));
+            g_nRefLen -= nLen;
+        }
+        CHECK(PieceTableLength(&table) == g_nRefLen);
+        if (it % CHECK_EVERY == 0) CheckContents(&table, &rng);
+        if (g_nTestFailures) break;
+    }
+    CheckContents(&table, &rng);
+
+    /* The original is released exactly once, when the table lets it go */
+    CHECK(g_nReleases == 0);
+    PieceTableFree(&table);
+    CHECK(g_nReleases == 1);
+    free(pOriginal);
+}
+
+static void TestEdges(void) {
+    static const TextUnit abc[] = {'a', 'b', 'c'};
+    static const TextUnit moved[] = {'a', 'b', 'c'};
+    PieceTable table;
+    TextUnit out[8];
+
+    PieceTableInit(&table);
+    CHECK(PieceTableLength(&table) == 0);
+    CHECK(PieceTableCopy(&table, 0, out, 8) == 0);
+
+    /* Edits past the end are refused; a delete running past it is clamped */
+    CHECK(!PieceTableInsert(&table, 1, abc, 3));
+    CHECK(!PieceTableDelete(&table, 1, 1));
+    CHECK(PieceTableInsert(&table, 0, abc, 3));
+    CHECK(PieceTableDelete(&table, 2, 5));
+    CHECK(PieceTableLength(&table) == 2);
+    CHECK(PieceTableDelete(&table, 0, 2));
+    CHECK(PieceTableLength(&table) == 0 && PieceTablePieceCount(&table) == 0);
+    PieceTableFree(&table);
+
+    /* Moving the original to an identical copy releases the old one */
+    g_nReleases = 0;
+    PieceTableInit(&table);
+    CHECK(PieceTableLoad(&table, abc, 3, CountRelease, NULL));
+    PieceTableMoveOriginal(&table, moved, NULL, NULL);
+    CHECK(g_nReleases == 1);
+    CHECK(PieceTableCopy(&table, 0, out, 3) == 3 && memcmp(out, abc, sizeof(abc)) == 0);
+    PieceTableFree(&table);
+    CHECK(g_nReleases == 1);
+}
+
+int main(void) {
+    TestEdges();
+    TestRandomEdits();
+    return TestResult("piece_table_test");
+}
@@ -0,0 +1,88 @@
+/*
+ * Regular expression search over a generated log (default 2 GB): every
+ * match of patterns with and without a literal prefix to filter on, rare
+ * and frequent, matching case and not, with the DFA's states, cache
+ * flushes and NFA fallbacks for each; then patterns that take a
+ * backtracking engine exponential time, on two sizes of input to show
+ * the time grows linearly. Usage: regex_search_bench [size in MB]
+ */
+
+#include "regex_search.h"
+#include "test_util.h"
+
+static void ToUnits(const char* szText, TextUnit* pUnits) {
+    while (*szText) *pUnits++ = (TextUnit)(uint8_t)*szText++;
+}
+
+/* Every match, as Find Next would step through them */
+static size_t Run(const char* szLabel, const char* szPattern, unsigned nFlags, const uint8_t* pText, size_t nLen) {
+    TextUnit pattern[256];
+    const char* szError = NULL;
+    size_t nFrom = 0, nMatch, nMatchLen, nCount = 0;
+    RegexSearch re;
+    double t0;
+
+    ToUnits(szPattern, pattern);
+    REQUIRE(RegexSearchInit(&re, pattern, strlen(szPattern), nFlags, &szError));
+    t0 = TestSeconds();
+    while (nFrom <= nLen && RegexSearchBytes(&re, pText, nLen, nFrom, nLen + 1, &nMatch, &nMatchLen)) {
+        nCount++;
+        nFrom = nMatch + (nMatchLen ? nMatchLen : 1);
+    }
+    BenchReport(szLabel, TestSeconds() - t0, (double)nLen);
+    printf("%-40s %9zu matches, %llu states, %llu flushes, %llu fallbacks%s\n", "", nCount,
+           (unsigned long long)re.stats.nStates, (unsigned long long)re.stats.nFlushes,
+           (unsigned long long)re.stats.nFallbacks, re.bPrefixBytes ? ", prefix filter" : "");
+    RegexSearchFree(&re);
+    return nCount;
+}
+
+int main(int argc, char** argv) {
+    static const char* const levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+    static const char* const events[] = {"request served", "cache miss", "connection reset by peer", "timeout waiting for lock",
+                                         "session opened", "session closed"};
+    static const char szNeedle[] = "NEEDLE_4711 found\n";
+    size_t nSize = BenchSizeMB(argc, argv, 2048) << 20, nLen = 0, nRun;
+    uint8_t* pText = (uint8_t*)malloc(nSize + 1);
+    TestRng rng;
+
+    REQUIRE(pText && nSize > 4096);
+    TestRngInit(&rng, TestSeed(16));
+    for (;;) {
+        char szLine[160];
+        int n = snprintf(szLine, sizeof(szLine), "2026-10-%02u %02u:%02u:%02u %s %s id=%u user=%c%c%u in %u ms\n",
+                         (unsigned)(1 + TestRngBelow(&rng, 28)), (unsigned)TestRngBelow(&rng, 24),
+                         (unsigned)TestRngBelow(&rng, 60), (unsigned)TestRngBelow(&rng, 60),
+                         levels[TestRngBelow(&rng, 6)], events[TestRngBelow(&rng, 6)], (unsigned)TestRngNext(&rng),
+                         (char)('a' + TestRngBelow(&rng, 26)), (char)('a' + TestRngBelow(&rng, 26)),
+                         (unsigned)TestRngBelow(&rng, 1000), (unsigned)TestRngBelow(&rng, 5000));
+        if (nLen + (size_t)n > nSize) break;
+        memcpy(pText + nLen, szLine, (size_t)n);
+        nLen += (size_t)n;
+    }
+    memset(pText + nLen, '\n', nSize - nLen);
+    nLen = nSize;
+    memcpy(pText + nLen / 2, szNeedle, sizeof(szNeedle) - 1);
+
+    REQUIRE(Run("rare, literal prefix", "NEEDLE_\\d+", TEXT_SEARCH_MATCH_CASE, pText, nLen) == 1);
+    REQUIRE(Run("rare, literal prefix, ignoring case", "needle_\\d+", 0, pText, nLen) == 1);
+    Run("absent, no literal", "[xyz]{3}\\d", TEXT_SEARCH_MATCH_CASE, pText, nLen);
+    Run("frequent, literal prefix", "ERROR \\w+ \\w+", TEXT_SEARCH_MATCH_CASE, pText, nLen);
+    Run("frequent, no literal", "\\b[a-f][a-z]\\d+ in \\d{4} ms$", TEXT_SEARCH_MATCH_CASE, pText, nLen);
+    Run("line anchors and words", "^\\S+ 1\\d:\\d\\d:\\d\\d WARN\\b", TEXT_SEARCH_MATCH_CASE, pText, nLen);
+    Run("ignoring case, no literal", "(timeout|reset) \\w+ \\w+ (lock|peer)", 0, pText, nLen);
+
+    /* Lines of 'x' with no 'y': a backtracker tries every way to split each run */
+    for (nRun = nSize / 8; nRun >= nSize / 16; nRun /= 2) {
+        char szLabel[80];
+        size_t i;
+        for (i = 0; i < nRun; i++) pText[i] = i % 1000 == 999 ? '\n' : 'x';
+        snprintf(szLabel, sizeof(szLabel), "(x+x+)+y, %zu MB", nRun >> 20);
+        REQUIRE(Run(szLabel, "(x+x+)+y", TEXT_SEARCH_MATCH_CASE, pText, nRun) == 0);
+        snprintf(szLabel, sizeof(szLabel), "x{500}y, %zu MB", nRun >> 20);
+        REQUIRE(Run(szLabel, "x{500}y", TEXT_SEARCH_MATCH_CASE, pText, nRun) == 0);
+    }
+
+    free(pText);
+    return 0;
+}
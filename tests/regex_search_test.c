@@ -0,0 +1,674 @@
+/*
+ * Regular expression search: a table of syntax cases, the corner where a
+ * repeated subpattern can match empty text (Perl and Python stop a loop
+ * after an empty iteration, the DFA does not), pattern errors, and random
+ * patterns checked against a backtracking reference matcher over UTF-16
+ * units, documents of many pieces, UTF-8 and Latin-1, with DFA caches
+ * small enough to force flushes and the NFA fallback.
+ *
+ * Usage: regex_search_test [random patterns]
+ */
+
+#include "regex_search.h"
+#include "test_util.h"
+
+#define MAX_TEXT 320
+
+/* ---- Text in three encodings, with code point offsets mapped to each ---- */
+
+typedef struct {
+    uint32_t points[MAX_TEXT];
+    int nPoints;
+    TextUnit units[2 * MAX_TEXT];
+    size_t nUnits;
+    size_t unitAt[MAX_TEXT + 1];
+    uint8_t bytes[4 * MAX_TEXT];
+    size_t nBytes;
+    size_t byteAt[MAX_TEXT + 1];
+    int bLatin1;                 /* Bytes are Latin-1 (every point below 0x100), else UTF-8 */
+} Text;
+
+static void EncodeText(Text* pText, int bLatin1) {
+    int i;
+    pText->nUnits = pText->nBytes = 0;
+    pText->bLatin1 = bLatin1;
+    for (i = 0; i < pText->nPoints; i++) {
+        uint32_t c = pText->points[i];
+        pText->unitAt[i] = pText->nUnits;
+        pText->byteAt[i] = pText->nBytes;
+        if (c >= 0x10000) {
+            pText->units[pText->nUnits++] = (TextUnit)(0xD800 + ((c - 0x10000) >> 10));
+            pText->units[pText->nUnits++] = (TextUnit)(0xDC00 + ((c - 0x10000) & 0x3FF));
+        } else {
+            pText->units[pText->nUnits++] = (TextUnit)c;
+        }
+        if (bLatin1) {
+            pText->bytes[pText->nBytes++] = (uint8_t)c;
+        } else if (c < 0x80) {
+            pText->bytes[pText->nBytes++] = (uint8_t)c;
+        } else if (c < 0x800) {
+            pText->bytes[pText->nBytes++] = (uint8_t)(0xC0 | (c >> 6));
+            pText->bytes[pText->nBytes++] = (uint8_t)(0x80 | (c & 0x3F));
+        } else if (c < 0x10000) {
+            pText->bytes[pText->nBytes++] = (uint8_t)(0xE0 | (c >> 12));
+            pText->bytes[pText->nBytes++] = (uint8_t)(0x80 | ((c >> 6) & 0x3F));
+            pText->bytes[pText->nBytes++] = (uint8_t)(0x80 | (c & 0x3F));
+        } else {
+            pText->bytes[pText->nBytes++] = (uint8_t)(0xF0 | (c >> 18));
+            pText->bytes[pText->nBytes++] = (uint8_t)(0x80 | ((c >> 12) & 0x3F));
+            pText->bytes[pText->nBytes++] = (uint8_t)(0x80 | ((c >> 6) & 0x3F));
+            pText->bytes[pText->nBytes++] = (uint8_t)(0x80 | (c & 0x3F));
+        }
+    }
+    pText->unitAt[pText->nPoints] = pText->nUnits;
+    pText->byteAt[pText->nPoints] = pText->nBytes;
+}
+
+/* Code points of a UTF-8 string */
+static int DecodeUtf8(const char* sz, uint32_t* pPoints) {
+    const uint8_t* p = (const uint8_t*)sz;
+    int n = 0;
+    while (*p) {
+        uint32_t c = *p++;
+        int nMore = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+        if (nMore) c &= 0x3F >> nMore;
+        while (nMore-- > 0) c = (c << 6) | (*p++ & 0x3F);
+        pPoints[n++] = c;
+    }
+    return n;
+}
+
+static int CompileUtf8(RegexSearch* pRe, const char* szPattern, unsigned nFlags, const char** pszError) {
+    Text pattern;
+    pattern.nPoints = DecodeUtf8(szPattern, pattern.points);
+    EncodeText(&pattern, 0);
+    return RegexSearchInit(pRe, pattern.units, pattern.nUnits, nFlags, pszError);
+}
+
+/* Piece table of pText's units in pieces of one to seven units */
+static void LoadPieces(PieceTable* pDoc, const Text* pText, TestRng* pRng) {
+    size_t nPos = 0;
+    PieceTableInit(pDoc);
+    while (nPos < pText->nUnits) {
+        size_t nLen = 1 + TestRngBelow(pRng, 7);
+        if (nLen > pText->nUnits - nPos) nLen = pText->nUnits - nPos;
+        REQUIRE(PieceTableInsert(pDoc, nPos, pText->units + nPos, nLen));
+        nPos += nLen;
+    }
+    /* Insert at the front once more, so the pieces are not all appends */
+    if (pText->nUnits > 4) {
+        REQUIRE(PieceTableDelete(pDoc, 1, 1));
+        REQUIRE(PieceTableInsert(pDoc, 1, pText->units + 1, 1));
+    }
+}
+
+/*
+ * Search [from, to) in code points in every form of the text and compare
+ * with the expected match (nStart < 0 for none). Returns nonzero if all agree.
+ */
+static int SearchAll(RegexSearch* pRe, const Text* pText, const PieceTable* pDoc, int nFrom, int nTo,
+                     int nStart, int nEnd) {
+    size_t nUnitTo = nTo > pText->nPoints ? pText->nUnits + 1 : pText->unitAt[nTo];
+    size_t nByteTo = nTo > pText->nPoints ? pText->nBytes + 1 : pText->byteAt[nTo];
+    size_t nMatch = 0, nMatchLen = 0;
+    int bAll = 1, bFound;
+
+#define AGREES(found, at, len, map) \
+    ((found) == (nStart >= 0) && (!(found) || ((at) == (map)[nStart] && (len) == (map)[nEnd] - (map)[nStart])))
+
+    bFound = RegexSearchUnits(pRe, pText->units, pText->nUnits, pText->unitAt[nFrom], nUnitTo, &nMatch, &nMatchLen);
+    bAll &= AGREES(bFound, nMatch, nMatchLen, pText->unitAt);
+    if (pDoc) {
+        bFound = RegexSearchDocument(pRe, pDoc, pText->unitAt[nFrom], nUnitTo, &nMatch, &nMatchLen);
+        bAll &= AGREES(bFound, nMatch, nMatchLen, pText->unitAt);
+    }
+    bFound = RegexSearchBytes(pRe, pText->bytes, pText->nBytes, pText->byteAt[nFrom], nByteTo, &nMatch, &nMatchLen);
+    bAll &= AGREES(bFound, nMatch, nMatchLen, pText->byteAt);
+#undef AGREES
+    return bAll;
+}
+
+/* ---- Fixed cases ---- */
+
+typedef struct {
+    const char* szPattern;       /* UTF-8; offsets below are in code points */
+    const char* szText;
+    unsigned nFlags;
+    int nStart;                  /* -1 for no match */
+    int nLen;
+} RegexCase;
+
+#define CASE TEXT_SEARCH_MATCH_CASE
+
+static const RegexCase g_cases[] = {
+    /* Literals, classes, escapes */
+    {"abc", "xxabcxx", CASE, 2, 3},
+    {"a.c", "a\nc abc", CASE, 4, 3},
+    {"a.c", "a\rc", CASE, -1, 0},
+    {"[b-d]+", "axbdcz", CASE, 2, 3},
+    {"[^a-c ]+", "abc def", CASE, 4, 3},
+    {"[]a]+", "x]a]", CASE, 1, 3},
+    {"\\d{2,3}", "a1234", CASE, 1, 3},
+    {"\\w+", "  h\xc3\xa9llo_1 ", CASE, 2, 7},
+    {"\\s+", "a \t\r\nb", CASE, 1, 4},
+    {"\\S\\D\\W", "1a  ", CASE, 0, 3},
+    {"\\x41\\u00e9", "zA\xc3\xa9", CASE, 1, 2},
+    {"\\.\\*", "a.*b", CASE, 1, 2},
+    {"a{", "xa{", CASE, 1, 2},
+    {"colou?r", "color colour", CASE, 0, 5},
+    {"(?:ab)+", "xababab", CASE, 1, 6},
+    {"a{3}", "aaaa", CASE, 0, 3},
+    {"a{2,}", "aaaa", CASE, 0, 4},
+    {"a{1,2}", "aaaa", CASE, 0, 2},
+    {"x*", "abc", CASE, 0, 0},
+    {"\\u00e9+", "\xc3\xa9\xc3\xa9", CASE, 0, 2},
+    {".", "\xf0\x9f\x98\x80", CASE, 0, 1},
+    /* Leftmost first: earlier alternatives and greedy repeats win */
+    {"cat|dog", "hotdog cat", CASE, 3, 3},
+    {"ab|abc", "abc", CASE, 0, 2},
+    {"abc|ab", "abc", CASE, 0, 3},
+    {"a+?", "aaa", CASE, 0, 1},
+    {"a*?b", "aaab", CASE, 0, 4},
+    {"<.+>", "<a><b>", CASE, 0, 6},
+    {"<.+?>", "<a><b>", CASE, 0, 3},
+    /* Lines end at LF, CRLF or CR */
+    {"^b", "a\nb", CASE, 2, 1},
+    {"^b", "a\r\nb", CASE, 3, 1},
+    {"^b", "a\rb", CASE, 2, 1},
+    {"a$", "a\r\nb", CASE, 0, 1},
+    {"a$", "ba\rc", CASE, 1, 1},
+    {"b$", "ab", CASE, 1, 1},
+    {"^$", "a\r\n\r\nb", CASE, 3, 0},
+    {"\\bcat\\b", "concat cat", CASE, 7, 3},
+    {"\\Bcat", "cat concat", CASE, 7, 3},
+    /* Ignoring case */
+    {"HELLO", "say hello", 0, 4, 5},
+    {"\xc3\x89" "a", "x\xc3\xa9" "A", 0, 1, 2},
+    {"\xcf\x83+", "\xce\xa3\xce\xa3", 0, 0, 2},
+    {"[a-c]+", "xABC", 0, 1, 3},
+    /* Whole words */
+    {"cat", "concat cat", CASE | TEXT_SEARCH_WHOLE_WORD, 7, 3},
+    {"a+", "baaa aa", CASE | TEXT_SEARCH_WHOLE_WORD, 5, 2},
+};
+
+/*
+ * A repeat whose body prefers to match empty text. Python's re (like Perl)
+ * ends the loop after an empty iteration and takes the shorter match; the
+ * DFA has no notion of an iteration and skips the empty one, going on to
+ * the body's next choice. Both start at the same place. This is the one
+ * difference found comparing the engine with Python on 3000 random
+ * patterns; the lengths here are the engine's, with Python's alongside.
+ */
+typedef struct {
+    const char* szPattern;
+    const char* szText;
+    int nStart;
+    int nLen;
+    int nPythonLen;
+} EmptyIterationCase;
+
+static const EmptyIterationCase g_emptyIteration[] = {
+    {"(|a)*", "aab", 0, 2, 0},
+    {"(|a)*", "ab", 0, 1, 0},
+    {"(?:a*?)*", "aa", 0, 1, 0},
+    {"(?:|ab)*", "abc", 0, 2, 0},
+    {"(?:(?:)|a)*a", "aab", 0, 2, 1},
+    /* With a consuming choice first the two agree */
+    {"(a|)*", "aab", 0, 2, 2},
+    {"(?:a?)*", "aab", 0, 2, 2},
+    {"(?:|a)*b", "aab", 0, 3, 3},
+};
+
+static const struct {
+    const char* szPattern;
+    int bValid;
+} g_syntax[] = {
+    {"[a", 0}, {"(a", 0}, {"a)", 0}, {"a**", 0}, {"*a", 0}, {"\\q", 0}, {"x{1001}", 0}, {"x{3,2}", 0},
+    {"a\\", 0}, {"[z-a]", 0}, {"(?=a)", 0}, {"\\x4", 0}, {"a{2}{3}", 0},
+    {"a{", 1}, {"a{2", 1}, {"[]a]", 1}, {"[^]]", 1}, {"x{1000}", 1}, {"((((((((((a))))))))))", 1},
+};
+
+static void TestTables(TestRng* pRng) {
+    size_t i;
+
+    for (i = 0; i < sizeof(g_cases) / sizeof(g_cases[0]); i++) {
+        const RegexCase* pCase = &g_cases[i];
+        const char* szError = NULL;
+        RegexSearch re;
+        PieceTable doc;
+        Text text;
+        int bOk;
+
+        text.nPoints = DecodeUtf8(pCase->szText, text.points);
+        EncodeText(&text, 0);
+        REQUIRE(CompileUtf8(&re, pCase->szPattern, pCase->nFlags, &szError));
+        LoadPieces(&doc, &text, pRng);
+        bOk = SearchAll(&re, &text, &doc, 0, text.nPoints + 1, pCase->nStart, pCase->nStart + pCase->nLen);
+        if (!bOk) fprintf(stderr, "case %zu: /%s/\n", i, pCase->szPattern);
+        CHECK(bOk);
+        PieceTableFree(&doc);
+        RegexSearchFree(&re);
+    }
+
+    for (i = 0; i < sizeof(g_emptyIteration) / sizeof(g_emptyIteration[0]); i++) {
+        const EmptyIterationCase* pCase = &g_emptyIteration[i];
+        const char* szError = NULL;
+        RegexSearch re;
+        Text text;
+        int bOk;
+
+        text.nPoints = DecodeUtf8(pCase->szText, text.points);
+        EncodeText(&text, 0);
+        REQUIRE(CompileUtf8(&re, pCase->szPattern, CASE, &szError));
+        bOk = SearchAll(&re, &text, NULL, 0, text.nPoints + 1, pCase->nStart, pCase->nStart + pCase->nLen);
+        if (!bOk) fprintf(stderr, "empty iteration case %zu: /%s/\n", i, pCase->szPattern);
+        CHECK(bOk);
+        CHECK(pCase->nPythonLen <= pCase->nLen);
+        RegexSearchFree(&re);
+    }
+
+    for (i = 0; i < sizeof(g_syntax) / sizeof(g_syntax[0]); i++) {
+        const char* szError = NULL;
+        RegexSearch re;
+        int bValid = CompileUtf8(&re, g_syntax[i].szPattern, CASE, &szError);
+        if (bValid) RegexSearchFree(&re);
+        if (bValid != g_syntax[i].bValid) fprintf(stderr, "syntax: /%s/\n", g_syntax[i].szPattern);
+        CHECK(bValid == g_syntax[i].bValid);
+        CHECK(bValid || (szError && *szError));
+    }
+}
+
+/* ---- Random patterns against a backtracking reference ---- */
+
+enum { NODE_CHAR, NODE_ANY, NODE_CLASS, NODE_SHORTHAND, NODE_CONCAT, NODE_ALT, NODE_REPEAT,
+       NODE_LINE_START, NODE_LINE_END, NODE_WORD_EDGE, NODE_NOT_WORD_EDGE, NODE_EMPTY };
+
+typedef struct Node {
+    int nKind;
+    uint32_t c;                  /* NODE_CHAR */
+    uint32_t set[3];             /* NODE_CLASS members */
+    int nSet;
+    int bNegated;
+    char shorthand;              /* NODE_SHORTHAND: d w s D W S */
+    struct Node* pLeft;          /* NODE_CONCAT, NODE_ALT, NODE_REPEAT (body) */
+    struct Node* pRight;
+    int nMin, nMax;              /* NODE_REPEAT; nMax < 0 for no limit */
+    int bLazy;
+} Node;
+
+/* Letters in both cases, separators, line breaks, a pair and a metacharacter */
+static const uint32_t g_alphabet[] = {'a', 'b', 'A', 'B', ' ', '_', '\n', '\r', 0xE9, 0xC9, 0x1F600, 'c', '.'};
+#define ALPHABET_SIZE (sizeof(g_alphabet) / sizeof(g_alphabet[0]))
+
+static Node* NewNode(int nKind) {
+    Node* pNode = (Node*)calloc(1, sizeof(Node));
+    REQUIRE(pNode);
+    pNode->nKind = nKind;
+    return pNode;
+}
+
+static void FreeNode(Node* pNode) {
+    if (!pNode) return;
+    FreeNode(pNode->pLeft);
+    FreeNode(pNode->pRight);
+    free(pNode);
+}
+
+static int CanMatchEmpty(const Node* pNode) {
+    switch (pNode->nKind) {
+        case NODE_CHAR: case NODE_ANY: case NODE_CLASS: case NODE_SHORTHAND: return 0;
+        case NODE_CONCAT: return CanMatchEmpty(pNode->pLeft) && CanMatchEmpty(pNode->pRight);
+        case NODE_ALT: return CanMatchEmpty(pNode->pLeft) || CanMatchEmpty(pNode->pRight);
+        case NODE_REPEAT: return pNode->nMin == 0 || CanMatchEmpty(pNode->pLeft);
+    }
+    return 1;
+}
+
+static Node* RandomNode(TestRng* pRng, int nDepth) {
+    size_t r = nDepth <= 0 ? TestRngBelow(pRng, 4) : TestRngBelow(pRng, 12);
+    Node* pNode;
+    int i;
+
+    if (r < 2) {
+        pNode = NewNode(NODE_CHAR);
+        pNode->c = g_alphabet[TestRngBelow(pRng, ALPHABET_SIZE)];
+    } else if (r == 2) {
+        if (TestRngBelow(pRng, 2)) return NewNode(NODE_ANY);
+        pNode = NewNode(NODE_CLASS);
+        pNode->nSet = 1 + (int)TestRngBelow(pRng, 3);
+        for (i = 0; i < pNode->nSet; i++) pNode->set[i] = g_alphabet[TestRngBelow(pRng, ALPHABET_SIZE)];
+        pNode->bNegated = TestRngBelow(pRng, 3) == 0;
+    } else if (r == 3) {
+        size_t s = TestRngBelow(pRng, 8);
+        if (s < 5) {
+            pNode = NewNode(NODE_SHORTHAND);
+            pNode->shorthand = "wdsWS"[s];
+        } else {
+            pNode = NewNode(s == 5 ? NODE_LINE_START : s == 6 ? NODE_LINE_END
+                            : TestRngBelow(pRng, 2) ? NODE_WORD_EDGE : NODE_NOT_WORD_EDGE);
+        }
+    } else if (r < 9) {
+        pNode = NewNode(r < 7 ? NODE_CONCAT : NODE_ALT);
+        pNode->pLeft = RandomNode(pRng, nDepth - 1);
+        pNode->pRight = RandomNode(pRng, nDepth - 1);
+    } else if (r == 9) {
+        pNode = NewNode(NODE_EMPTY);
+    } else {
+        /* A body that can match empty is the corner covered by the table above */
+        size_t q = TestRngBelow(pRng, 6);
+        pNode = NewNode(NODE_REPEAT);
+        do {
+            FreeNode(pNode->pLeft);
+            pNode->pLeft = RandomNode(pRng, nDepth - 1);
+        } while (CanMatchEmpty(pNode->pLeft));
+        pNode->bLazy = TestRngBelow(pRng, 3) == 0;
+        pNode->nMin = q == 1 ? 1 : q == 3 || q == 4 ? (int)TestRngBelow(pRng, 3) : q == 5 ? (int)TestRngBelow(pRng, 2) : 0;
+        pNode->nMax = q == 0 || q == 1 || q == 4 ? -1 : q == 2 ? 1 : q == 3 ? pNode->nMin : pNode->nMin + (int)TestRngBelow(pRng, 3);
+    }
+    return pNode;
+}
+
+static void PutPoint(TextUnit* pOut, size_t* pn, uint32_t c) {
+    if (c == '\n' || c == '\r' || c == '.') {
+        pOut[(*pn)++] = '\\';
+        c = c == '\n' ? 'n' : c == '\r' ? 'r' : '.';
+    }
+    if (c >= 0x10000) {
+        pOut[(*pn)++] = (TextUnit)(0xD800 + ((c - 0x10000) >> 10));
+        pOut[(*pn)++] = (TextUnit)(0xDC00 + ((c - 0x10000) & 0x3FF));
+    } else {
+        pOut[(*pn)++] = (TextUnit)c;
+    }
+}
+
+static void PutAscii(TextUnit* pOut, size_t* pn, const char* sz) {
+    while (*sz) pOut[(*pn)++] = (TextUnit)*sz++;
+}
+
+static void RenderNode(const Node* pNode, TextUnit* pOut, size_t* pn) {
+    char szCount[32];
+    int i;
+
+    switch (pNode->nKind) {
+        case NODE_CHAR: PutPoint(pOut, pn, pNode->c); break;
+        case NODE_ANY: PutAscii(pOut, pn, "."); break;
+        case NODE_CLASS:
+            PutAscii(pOut, pn, pNode->bNegated ? "[^" : "[");
+            for (i = 0; i < pNode->nSet; i++) PutPoint(pOut, pn, pNode->set[i]);
+            PutAscii(pOut, pn, "]");
+            break;
+        case NODE_SHORTHAND:
+            PutAscii(pOut, pn, "\\");
+            pOut[(*pn)++] = (TextUnit)pNode->shorthand;
+            break;
+        case NODE_LINE_START: PutAscii(pOut, pn, "^"); break;
+        case NODE_LINE_END: PutAscii(pOut, pn, "$"); break;
+        case NODE_WORD_EDGE: PutAscii(pOut, pn, "\\b"); break;
+        case NODE_NOT_WORD_EDGE: PutAscii(pOut, pn, "\\B"); break;
+        case NODE_EMPTY: PutAscii(pOut, pn, "()"); break;
+        case NODE_CONCAT:
+            PutAscii(pOut, pn, "(?:");
+            RenderNode(pNode->pLeft, pOut, pn);
+            RenderNode(pNode->pRight, pOut, pn);
+            PutAscii(pOut, pn, ")");
+            break;
+        case NODE_ALT:
+            PutAscii(pOut, pn, "(");
+            RenderNode(pNode->pLeft, pOut, pn);
+            PutAscii(pOut, pn, "|");
+            RenderNode(pNode->pRight, pOut, pn);
+            PutAscii(pOut, pn, ")");
+            break;
+        case NODE_REPEAT:
+            PutAscii(pOut, pn, "(");
+            RenderNode(pNode->pLeft, pOut, pn);
+            PutAscii(pOut, pn, ")");
+            if (pNode->nMin == 0 && pNode->nMax < 0) strcpy(szCount, "*");
+            else if (pNode->nMin == 1 && pNode->nMax < 0) strcpy(szCount, "+");
+            else if (pNode->nMin == 0 && pNode->nMax == 1) strcpy(szCount, "?");
+            else if (pNode->nMax < 0) snprintf(szCount, sizeof(szCount), "{%d,}", pNode->nMin);
+            else if (pNode->nMax == pNode->nMin) snprintf(szCount, sizeof(szCount), "{%d}", pNode->nMin);
+            else snprintf(szCount, sizeof(szCount), "{%d,%d}", pNode->nMin, pNode->nMax);
+            PutAscii(pOut, pn, szCount);
+            if (pNode->bLazy) PutAscii(pOut, pn, "?");
+            break;
+    }
+}
+
+/*
+ * The reference works on code points of g_pText, in continuation passing
+ * style. Nested repeats can take it exponential time, so it gives up after
+ * a budget of steps and that search is left out of the comparison.
+ */
+#define REFERENCE_STEPS 2000000
+
+static const uint32_t* g_pText;
+static int g_nText;
+static int g_bFold;
+static long g_nSteps;
+
+typedef struct Next Next;
+struct Next {
+    int (*pfn)(const Next* pNext, int nAt);
+    const Node* pNode;
+    const Next* pOuter;
+    int nCount;                  /* Repeat: iterations done */
+    int nIterationStart;         /* Repeat: where this iteration started */
+};
+
+static int Match(const Node* pNode, int nAt, const Next* pNext);
+
+static int IsWordPoint(uint32_t c) {
+    return c > 0xFFFF || TextSearchIsWordUnit((TextUnit)c);
+}
+
+/* What is at nAt: 4 outside the text, 3 LF, 2 CR, 1 word character, 0 anything else */
+static int KindAt(int nAt) {
+    if (nAt < 0 || nAt >= g_nText) return 4;
+    if (g_pText[nAt] == '\r') return 2;
+    if (g_pText[nAt] == '\n') return 3;
+    return IsWordPoint(g_pText[nAt]);
+}
+
+static uint32_t Fold(uint32_t c) {
+    return g_bFold && c < 0x500 ? TextSearchFold((TextUnit)c) : c;
+}
+
+static int MatchesPoint(const Node* pNode, uint32_t c) {
+    int bIn = 0, i;
+    switch (pNode->nKind) {
+        case NODE_CHAR: return Fold(c) == Fold(pNode->c);
+        case NODE_ANY: return c != '\n' && c != '\r';
+        case NODE_CLASS:
+            for (i = 0; i < pNode->nSet; i++) bIn |= Fold(c) == Fold(pNode->set[i]);
+            return bIn != pNode->bNegated;
+        case NODE_SHORTHAND:
+            switch (pNode->shorthand | 32) {
+                case 'd': bIn = c >= '0' && c <= '9'; break;
+                case 'w': bIn = IsWordPoint(c); break;
+                default: bIn = (c >= 9 && c <= 13) || c == ' ' || c == 0x85 || c == 0xA0; break;
+            }
+            return (pNode->shorthand & 32) ? bIn : !bIn;
+    }
+    return 0;
+}
+
+static int Finish(const Next* pNext, int nAt) {
+    (void)pNext;
+    return nAt;
+}
+
+static int ContinueConcat(const Next* pNext, int nAt) {
+    return Match(pNext->pNode, nAt, pNext->pOuter);
+}
+
+static int Repeat(const Node* pNode, int nCount, int nAt, const Next* pNext);
+
+static int ContinueRepeat(const Next* pNext, int nAt) {
+    /* Iterations past the minimum of an unbounded repeat must consume text */
+    if (pNext->pNode->nMax < 0 && pNext->nCount > pNext->pNode->nMin && nAt == pNext->nIterationStart) return -1;
+    return Repeat(pNext->pNode, pNext->nCount, nAt, pNext->pOuter);
+}
+
+static int Repeat(const Node* pNode, int nCount, int nAt, const Next* pNext) {
+    Next again = {ContinueRepeat, pNode, pNext, nCount + 1, nAt};
+    int nEnd;
+
+    if (nCount < pNode->nMin) return Match(pNode->pLeft, nAt, &again);
+    if (pNode->nMax >= 0 && nCount >= pNode->nMax) return pNext->pfn(pNext, nAt);
+    if (pNode->bLazy) {
+        nEnd = pNext->pfn(pNext, nAt);
+        return nEnd >= 0 ? nEnd : Match(pNode->pLeft, nAt, &again);
+    }
+    nEnd = Match(pNode->pLeft, nAt, &again);
+    return nEnd >= 0 ? nEnd : pNext->pfn(pNext, nAt);
+}
+
+/* End of the first match of pNode at nAt followed by pNext, or -1 */
+static int Match(const Node* pNode, int nAt, const Next* pNext) {
+    int nBefore = KindAt(nAt - 1), nAfter = KindAt(nAt), nEnd;
+
+    if (++g_nSteps > REFERENCE_STEPS) return -1;
+    switch (pNode->nKind) {
+        case NODE_CHAR: case NODE_ANY: case NODE_CLASS: case NODE_SHORTHAND:
+            return nAt < g_nText && MatchesPoint(pNode, g_pText[nAt]) ? pNext->pfn(pNext, nAt + 1) : -1;
+        case NODE_EMPTY:
+            return pNext->pfn(pNext, nAt);
+        case NODE_LINE_START:
+            return nBefore == 3 || nBefore == 4 || (nBefore == 2 && nAfter != 3) ? pNext->pfn(pNext, nAt) : -1;
+        case NODE_LINE_END:
+            return nAfter == 2 || nAfter == 4 || (nAfter == 3 && nBefore != 2) ? pNext->pfn(pNext, nAt) : -1;
+        case NODE_WORD_EDGE:
+            return (nBefore == 1) != (nAfter == 1) ? pNext->pfn(pNext, nAt) : -1;
+        case NODE_NOT_WORD_EDGE:
+            return (nBefore == 1) == (nAfter == 1) ? pNext->pfn(pNext, nAt) : -1;
+        case NODE_CONCAT: {
+            Next then = {ContinueConcat, pNode->pRight, pNext, 0, 0};
+            return Match(pNode->pLeft, nAt, &then);
+        }
+        case NODE_ALT:
+            nEnd = Match(pNode->pLeft, nAt, pNext);
+            return nEnd >= 0 ? nEnd : Match(pNode->pRight, nAt, pNext);
+        case NODE_REPEAT:
+            return Repeat(pNode, 0, nAt, pNext);
+    }
+    return -1;
+}
+
+/* First match starting in [nFrom, nTo); -1 if the reference gave up */
+static int ReferenceSearch(const Node* pNode, int nFrom, int nTo, int* pnStart, int* pnEnd) {
+    Next done = {Finish, NULL, NULL, 0, 0};
+    int nAt;
+    g_nSteps = 0;
+    for (nAt = nFrom; nAt < nTo && nAt <= g_nText; nAt++) {
+        int nEnd = Match(pNode, nAt, &done);
+        if (nEnd >= 0) {
+            *pnStart = nAt;
+            *pnEnd = nEnd;
+            return 1;
+        }
+    }
+    return g_nSteps > REFERENCE_STEPS ? -1 : 0;
+}
+
+static void ReportPattern(const TextUnit* pPattern, size_t nPattern, const Text* pText) {
+    size_t i;
+    fprintf(stderr, "  pattern: ");
+    for (i = 0; i < nPattern; i++) fprintf(stderr, pPattern[i] >= 32 && pPattern[i] < 127 ? "%c" : "<%x>", pPattern[i]);
+    fprintf(stderr, "\n  text: ");
+    for (i = 0; i < (size_t)pText->nPoints; i++) {
+        fprintf(stderr, pText->points[i] >= 32 && pText->points[i] < 127 ? "%c" : "<%x>", pText->points[i]);
+    }
+    fprintf(stderr, "\n");
+}
+
+static void TestRandom(int nPatterns, TestRng* pRng) {
+    uint64_t nFlushes = 0, nFallbacks = 0;
+    int nIteration, nGaveUp = 0;
+
+    for (nIteration = 0; nIteration < nPatterns && !g_nTestFailures; nIteration++) {
+        Node* pNode = RandomNode(pRng, 1 + (int)TestRngBelow(pRng, 5));
+        TextUnit pattern[4096];
+        size_t nPattern = 0;
+        unsigned nFlags = TestRngBelow(pRng, 2) ? CASE : 0;
+        const char* szError = NULL;
+        int bLatin1 = 1, i, q, nStart = 0, nEnd = 0, nLastStart = -1, nLastEnd = -1, nAt;
+        size_t nMatch = 0, nMatchLen = 0;
+        RegexSearch re;
+        PieceTable doc;
+        Text text;
+
+        RenderNode(pNode, pattern, &nPattern);
+        text.nPoints = (int)TestRngBelow(pRng, nIteration % 8 == 7 ? 300 : 60);
+        for (i = 0; i < text.nPoints; i++) {
+            text.points[i] = g_alphabet[TestRngBelow(pRng, ALPHABET_SIZE)];
+            if (text.points[i] > 0xFF) bLatin1 = 0;
+        }
+        EncodeText(&text, bLatin1);
+        g_pText = text.points;
+        g_nText = text.nPoints;
+        g_bFold = !(nFlags & CASE);
+
+        REQUIRE(RegexSearchInit(&re, pattern, nPattern, nFlags | (bLatin1 ? TEXT_SEARCH_LATIN1 : 0), &szError));
+        /* A quarter run with caches that hold a state or two, to force flushes and the NFA */
+        if (nIteration % 4 == 3) re.nCacheBytes = TestRngBelow(pRng, 2) ? 1 : 600 + TestRngBelow(pRng, 3000);
+        LoadPieces(&doc, &text, pRng);
+
+        for (q = 0; q < 4; q++) {
+            int nFrom = (int)TestRngBelow(pRng, text.nPoints + 1);
+            int nTo = nFrom + (int)TestRngBelow(pRng, text.nPoints + 3);
+            int bFound = ReferenceSearch(pNode, nFrom, nTo, &nStart, &nEnd);
+            if (bFound < 0) {
+                nGaveUp++;
+                continue;
+            }
+            if (!SearchAll(&re, &text, &doc, nFrom, nTo, bFound ? nStart : -1, nEnd)) {
+                fprintf(stderr, "search of [%d, %d) differs from the reference\n", nFrom, nTo);
+                ReportPattern(pattern, nPattern, &text);
+                CHECK(0);
+                break;
+            }
+        }
+
+        /* The last match is the last of successive matches from the start */
+        nAt = 0;
+        while (nAt <= text.nPoints && (i = ReferenceSearch(pNode, nAt, text.nPoints + 1, &nStart, &nEnd)) > 0) {
+            nLastStart = nStart;
+            nLastEnd = nEnd;
+            nAt = nEnd > nStart ? nEnd : nStart + 1;
+        }
+        if (i < 0) {
+            nGaveUp++;
+        } else {
+            int bFound = RegexSearchDocumentLast(&re, &doc, 0, text.nUnits + 1, &nMatch, &nMatchLen);
+            int bSame = bFound == (nLastStart >= 0);
+            if (bSame && bFound) {
+                bSame = nMatch == text.unitAt[nLastStart] && nMatchLen == text.unitAt[nLastEnd] - text.unitAt[nLastStart];
+            }
+            if (!bSame) {
+                fprintf(stderr, "last match differs from the reference\n");
+                ReportPattern(pattern, nPattern, &text);
+                CHECK(0);
+            }
+        }
+
+        nFlushes += re.stats.nFlushes;
+        nFallbacks += re.stats.nFallbacks;
+        PieceTableFree(&doc);
+        RegexSearchFree(&re);
+        FreeNode(pNode);
+    }
+    printf("%d random patterns: %llu cache flushes, %llu NFA fallbacks, %d searches too slow for the reference\n",
+           nIteration, (unsigned long long)nFlushes, (unsigned long long)nFallbacks, nGaveUp);
+    /* A full run must have gone through the cache flushes and the NFA */
+    if (nIteration == nPatterns && nPatterns >= 1000) CHECK(nFlushes > 0 && nFallbacks > 0);
+}
+
+int main(int argc, char** argv) {
+    TestRng rng;
+
+    TestRngInit(&rng, TestSeed(16));
+    TestTables(&rng);
+    TestRandom(argc > 1 ? atoi(argv[1]) : 8000, &rng);
+    return TestResult("regex_search_test");
+}
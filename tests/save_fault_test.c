@@ -0,0 +1,196 @@
+/*
+ * Fault injection for saving: write(2), fsync(2) and rename(2) are wrapped
+ * at link time (-Wl,--wrap) so the platform shim can be made to see short
+ * writes, EINTR, a disk that fills up after any number of bytes, a failed
+ * flush or a failed rename. A save that fails must leave the original file
+ * as it was and no temp file behind; one that succeeds must write every
+ * byte.
+ */
+
+#include "doc_writer.h"
+#include "text_encoding.h"
+#include "test_util.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+ssize_t __real_write(int fd, const void* pData, size_t nLen);
+int __real_fsync(int fd);
+int __real_rename(const char* szFrom, const char* szTo);
+
+/* Faults to inject into the writes of the file being saved (fd > 2) */
+static struct {
+    size_t nMaxWrite;            /* Largest write let through at once (0 for no limit) */
+    int bInterrupt;              /* Fail every other write with EINTR */
+    int bDiskLimit;              /* Stop with ENOSPC once nDiskLeft bytes are written */
+    size_t nDiskLeft;
+    int bFailFsync;
+    int bFailRename;
+    size_t nWriteCalls;
+} g_fault;
+
+ssize_t __wrap_write(int fd, const void* pData, size_t nLen) {
+    if (fd <= 2) return __real_write(fd, pData, nLen);
+    g_fault.nWriteCalls++;
+    if (g_fault.bInterrupt && g_fault.nWriteCalls % 2) {
+        errno = EINTR;
+        return -1;
+    }
+    if (g_fault.nMaxWrite && nLen > g_fault.nMaxWrite) nLen = g_fault.nMaxWrite;
+    if (g_fault.bDiskLimit) {
+        if (g_fault.nDiskLeft == 0) {
+            errno = ENOSPC;
+            return -1;
+        }
+        /* A disk that fills mid-write takes what fits, as write(2) does */
+        if (nLen > g_fault.nDiskLeft) nLen = g_fault.nDiskLeft;
+        g_fault.nDiskLeft -= nLen;
+    }
+    return __real_write(fd, pData, nLen);
+}
+
+int __wrap_fsync(int fd) {
+    if (g_fault.bFailFsync) {
+        errno = EIO;
+        return -1;
+    }
+    return __real_fsync(fd);
+}
+
+int __wrap_rename(const char* szFrom, const char* szTo) {
+    if (g_fault.bFailRename) {
+        errno = EACCES;
+        return -1;
+    }
+    return __real_rename(szFrom, szTo);
+}
+
+static size_t g_nLastWriteCalls;
+static char g_szDir[256];
+static char g_szTarget[300];
+static const char g_original[] = "the original contents\n";
+
+/* Files in the scratch directory other than the target */
+static int CountStrayFiles(void) {
+    DIR* pDir = opendir(g_szDir);
+    struct dirent* pEntry;
+    int nStray = 0;
+    REQUIRE(pDir);
+    while ((pEntry = readdir(pDir)) != NULL) {
+        if (strcmp(pEntry->d_name, ".") && strcmp(pEntry->d_name, "..") && strcmp(pEntry->d_name, "target.txt")) {
+            nStray++;
+        }
+    }
+    closedir(pDir);
+    return nStray;
+}
+
+/* The target holds exactly nLen bytes of pExpected */
+static int TargetHolds(const void* pExpected, size_t nLen) {
+    size_t nData = 0;
+    uint8_t* pData = TestReadFile(g_szTarget, &nData);
+    int bSame = pData && nData == nLen && memcmp(pData, pExpected, nLen) == 0;
+    free(pData);
+    return bSame;
+}
+
+/* Save over a fresh original with the current faults; returns the save's result */
+static int SaveWithFaults(const PieceTable* pDoc) {
+    int bOk;
+    REQUIRE(TestWriteFile(g_szTarget, g_original, sizeof(g_original) - 1));
+    g_fault.nWriteCalls = 0;
+    bOk = SaveDocument(pDoc, g_szTarget, TEXT_ENCODING_UTF8, 0);
+    g_nLastWriteCalls = g_fault.nWriteCalls;
+    memset(&g_fault, 0, sizeof(g_fault));
+    return bOk;
+}
+
+int main(void) {
+    size_t nUnits = 3 * DOC_WRITER_CHUNK + 12345, i;
+    TextUnit* pText = (TextUnit*)malloc(nUnits * sizeof(TextUnit));
+    uint8_t* pExpected = (uint8_t*)malloc(nUnits);
+    size_t nTotal = nUnits;      /* ASCII text: one byte per unit */
+    static const size_t limits[] = {0, 1, DOC_WRITER_CHUNK - 1, DOC_WRITER_CHUNK, DOC_WRITER_CHUNK + 1,
+                                    2 * DOC_WRITER_CHUNK + 77, 3 * DOC_WRITER_CHUNK + 12344};
+    PieceTable doc;
+    TestRng rng;
+
+    REQUIRE(pText && pExpected);
+    TestRngInit(&rng, TestSeed(7));
+    for (i = 0; i < nUnits; i++) {
+        pText[i] = (TextUnit)(i % 64 == 63 ? '\n' : 'a' + TestRngBelow(&rng, 26));
+        pExpected[i] = (uint8_t)pText[i];
+    }
+    PieceTableInit(&doc);
+    REQUIRE(PieceTableLoad(&doc, pText, nUnits, NULL, NULL));
+
+    TestTempPath(g_szDir, sizeof(g_szDir), "save_fault");
+    REQUIRE(mkdir(g_szDir, 0700) == 0);
+    snprintf(g_szTarget, sizeof(g_szTarget), "%s/target.txt", g_szDir);
+
+    /* Short writes and EINTR are retried until every byte is out */
+    g_fault.nMaxWrite = 4093;
+    CHECK(SaveWithFaults(&doc));
+    CHECK(g_nLastWriteCalls >= nTotal / 4093);
+    CHECK(TargetHolds(pExpected, nTotal));
+    g_fault.nMaxWrite = 1 << 16;
+    g_fault.bInterrupt = 1;
+    CHECK(SaveWithFaults(&doc));
+    CHECK(TargetHolds(pExpected, nTotal));
+    CHECK(CountStrayFiles() == 0);
+
+    /* The disk fills at every interesting point: the original survives, the temp file goes */
+    for (i = 0; i < sizeof(limits) / sizeof(limits[0]); i++) {
+        g_fault.bDiskLimit = 1;
+        g_fault.nDiskLeft = limits[i];
+        g_fault.nMaxWrite = i % 2 ? 1000 : 0;
+        CHECK(!SaveWithFaults(&doc));
+        CHECK(TargetHolds(g_original, sizeof(g_original) - 1));
+        CHECK(CountStrayFiles() == 0);
+    }
+
+    /* Exactly enough room is enough, and the replaced file keeps its permissions */
+    {
+        struct stat st;
+        REQUIRE(chmod(g_szTarget, 0640) == 0);
+        g_fault.bDiskLimit = 1;
+        g_fault.nDiskLeft = nTotal;
+        CHECK(SaveWithFaults(&doc));
+        CHECK(TargetHolds(pExpected, nTotal));
+        CHECK(stat(g_szTarget, &st) == 0 && (st.st_mode & 0777) == 0640);
+    }
+
+    /* A flush or rename that fails is a failed save, too */
+    g_fault.bFailFsync = 1;
+    CHECK(!SaveWithFaults(&doc));
+    CHECK(TargetHolds(g_original, sizeof(g_original) - 1));
+    CHECK(CountStrayFiles() == 0);
+    g_fault.bFailRename = 1;
+    CHECK(!SaveWithFaults(&doc));
+    CHECK(TargetHolds(g_original, sizeof(g_original) - 1));
+    CHECK(CountStrayFiles() == 0);
+
+    /* OutputFileWrite itself: partial writes complete, ENOSPC is reported */
+    {
+        OutputFile file;
+        char szPath[400];
+        snprintf(szPath, sizeof(szPath), "%s/direct.bin", g_szDir);
+        REQUIRE(OutputFileCreate(&file, szPath));
+        g_fault.nMaxWrite = 3;
+        CHECK(OutputFileWrite(&file, pExpected, 1000));
+        g_fault.bDiskLimit = 1;
+        g_fault.nDiskLeft = 10;
+        CHECK(!OutputFileWrite(&file, pExpected, 1000));
+        memset(&g_fault, 0, sizeof(g_fault));
+        CHECK(OutputFileClose(&file));
+        unlink(szPath);
+    }
+
+    unlink(g_szTarget);
+    rmdir(g_szDir);
+    PieceTableFree(&doc);
+    free(pExpected);
+    free(pText);
+    return TestResult("save_fault_test");
+}
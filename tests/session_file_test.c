@@ -0,0 +1,446 @@
+/*
+ * Session snapshot reader and writer. A writer follows a model of the tab
+ * strip through opens, closes, moves, switches and caret moves, and the
+ * file is loaded back and compared with the model as it goes, across
+ * rewrites and reopens; unchanged records are not written again and a
+ * second writer cannot claim the file. Then every truncation of a log (a
+ * torn tail) and flipped bytes must read back as the state after the last
+ * intact record, a writer opened on a torn file must cut the tail and go
+ * on, and random well-framed records must not upset the reader. Last, the
+ * load time of a 50-tab session against the 100 ms startup budget.
+ *
+ * Usage: session_file_test [steps]
+ */
+
+#include "session_file.h"
+#include "test_util.h"
+
+#define MAX_TABS 50
+
+/* Records of the log that is torn and flipped */
+#define LOG_RECORDS 120
+
+/* A tab of the model, and the checksum of its last tab record */
+typedef struct {
+    SessionTab tab;
+    uint32_t nCrc;
+} ModelTab;
+
+/* The tab strip the writer follows */
+typedef struct {
+    ModelTab tabs[MAX_TABS];
+    size_t nTabs;
+    size_t nActive;
+    uint64_t nMaxId;
+    uint32_t nOrderCrc;
+} Model;
+
+/* What a record left: every recorded tab and the last order */
+typedef struct {
+    SessionTab recorded[LOG_RECORDS];
+    size_t nRecorded;
+    uint64_t order[MAX_TABS];
+    size_t nOrder;
+    uint64_t nActiveId;
+} Shadow;
+
+/* The records of a log: where each ends and the state it left (index 0 is the bare magic) */
+typedef struct {
+    Shadow* pStates;
+    uint64_t* pEnds;
+    size_t nRecords;
+} RecordLog;
+
+static char g_szPath[256];
+
+static void RandomPath(PathChar* szPath, TestRng* pRng) {
+    size_t n = (size_t)snprintf(szPath, SESSION_MAX_PATH, "/home/user/logs/app%u.log", (unsigned)TestRngBelow(pRng, 100000));
+    size_t nLong = TestRngBelow(pRng, 8) == 0 ? TestRngBelow(pRng, SESSION_MAX_PATH - n) : 0;
+    while (nLong--) szPath[n++] = TestRngBelow(pRng, 4) ? (PathChar)('a' + TestRngBelow(pRng, 26)) : (PathChar)0xD0;
+    szPath[n] = 0;
+}
+
+static void RandomCaret(SessionTab* pTab, TestRng* pRng) {
+    pTab->nSelStart = TestRngBelow(pRng, 4) ? TestRngBelow(pRng, 100000) : TestRngNext(pRng) >> 20;
+    pTab->nSelEnd = pTab->nSelStart + TestRngBelow(pRng, 3) * TestRngBelow(pRng, 500);
+    pTab->nFirstLine = TestRngBelow(pRng, 50000);
+}
+
+static int SameTab(const SessionTab* a, const SessionTab* b) {
+    return a->nId == b->nId && a->nEncoding == b->nEncoding && a->nLineEnding == b->nLineEnding &&
+           a->nSelStart == b->nSelStart && a->nSelEnd == b->nSelEnd && a->nFirstLine == b->nFirstLine &&
+           strcmp(a->szPath, b->szPath) == 0;
+}
+
+static int MatchesModel(const SessionSnapshot* pSnapshot, const Model* pModel) {
+    size_t i;
+    if (pSnapshot->nTabs != pModel->nTabs || (pModel->nTabs && pSnapshot->nActive != pModel->nActive)) return 0;
+    if (pSnapshot->nMaxId < pModel->nMaxId) return 0;
+    for (i = 0; i < pModel->nTabs; i++) {
+        if (!SameTab(&pSnapshot->pTabs[i], &pModel->tabs[i].tab)) return 0;
+    }
+    return 1;
+}
+
+/* The ordered tabs that have records, as the reader picks them out */
+static int MatchesShadow(const SessionSnapshot* pSnapshot, const Shadow* pShadow) {
+    size_t nTabs = 0, i, j;
+    for (i = 0; i < pShadow->nOrder; i++) {
+        for (j = pShadow->nRecorded; j-- > 0;) {
+            if (pShadow->recorded[j].nId != pShadow->order[i]) continue;
+            if (nTabs >= pSnapshot->nTabs || !SameTab(&pSnapshot->pTabs[nTabs], &pShadow->recorded[j])) return 0;
+            if (pShadow->order[i] == pShadow->nActiveId && pSnapshot->nActive != nTabs) return 0;
+            nTabs++;
+            break;
+        }
+    }
+    return nTabs == pSnapshot->nTabs;
+}
+
+static void ShadowTab(Shadow* pShadow, const SessionTab* pTab) {
+    size_t i;
+    for (i = 0; i < pShadow->nRecorded && pShadow->recorded[i].nId != pTab->nId; i++) {
+    }
+    REQUIRE(i < sizeof(pShadow->recorded) / sizeof(pShadow->recorded[0]));
+    pShadow->recorded[i] = *pTab;
+    if (i == pShadow->nRecorded) pShadow->nRecorded++;
+}
+
+/* Note a record the writer just appended, with the state it left */
+static Shadow* NoteRecord(const SessionWriter* pWriter, uint64_t nBefore, RecordLog* pLog) {
+    Shadow* pState;
+    if (!pLog || pWriter->nBytes == nBefore || pLog->nRecords > LOG_RECORDS) return NULL;
+    pState = &pLog->pStates[pLog->nRecords];
+    *pState = pLog->pStates[pLog->nRecords - 1];
+    pLog->pEnds[pLog->nRecords++] = pWriter->nBytes;
+    return pState;
+}
+
+static void PutOrder(SessionWriter* pWriter, Model* pModel, RecordLog* pLog) {
+    uint64_t ids[MAX_TABS];
+    uint64_t nActiveId = pModel->nTabs ? pModel->tabs[pModel->nActive].tab.nId : 0;
+    uint64_t nBefore = pWriter->nBytes;
+    Shadow* pState;
+    size_t i;
+
+    for (i = 0; i < pModel->nTabs; i++) ids[i] = pModel->tabs[i].tab.nId;
+    CHECK(SessionWriterPutOrder(pWriter, ids, pModel->nTabs, nActiveId, &pModel->nOrderCrc));
+    if ((pState = NoteRecord(pWriter, nBefore, pLog)) != NULL) {
+        memcpy(pState->order, ids, pModel->nTabs * sizeof(uint64_t));
+        pState->nOrder = pModel->nTabs;
+        pState->nActiveId = nActiveId;
+    }
+}
+
+static void PutTab(SessionWriter* pWriter, ModelTab* pTab, RecordLog* pLog) {
+    uint64_t nBefore = pWriter->nBytes;
+    Shadow* pState;
+
+    CHECK(SessionWriterPutTab(pWriter, &pTab->tab, &pTab->nCrc));
+    if ((pState = NoteRecord(pWriter, nBefore, pLog)) != NULL) ShadowTab(pState, &pTab->tab);
+}
+
+/* Open a tab at the end of the strip and make it active */
+static void OpenTab(SessionWriter* pWriter, Model* pModel, RecordLog* pLog, TestRng* pRng) {
+    ModelTab* pTab = &pModel->tabs[pModel->nTabs];
+
+    memset(pTab, 0, sizeof(*pTab));
+    pTab->tab.nId = ++pModel->nMaxId;
+    pTab->tab.nEncoding = (int)TestRngBelow(pRng, 8);
+    pTab->tab.nLineEnding = (int)TestRngBelow(pRng, 3);
+    RandomCaret(&pTab->tab, pRng);
+    RandomPath(pTab->tab.szPath, pRng);
+    pModel->nActive = pModel->nTabs++;
+    PutTab(pWriter, pTab, pLog);
+    PutOrder(pWriter, pModel, pLog);
+}
+
+/* One random change to the tab strip, written as session.c would write it */
+static void Step(SessionWriter* pWriter, Model* pModel, RecordLog* pLog, TestRng* pRng) {
+    size_t nOp = TestRngBelow(pRng, 6), i, j;
+    ModelTab* pTab;
+
+    if (pModel->nTabs == 0 || (nOp == 0 && pModel->nTabs < MAX_TABS)) {
+        OpenTab(pWriter, pModel, pLog, pRng);
+    } else if (nOp == 1) {
+        i = TestRngBelow(pRng, pModel->nTabs);
+        memmove(&pModel->tabs[i], &pModel->tabs[i + 1], (pModel->nTabs - i - 1) * sizeof(ModelTab));
+        pModel->nTabs--;
+        if (pModel->nActive >= pModel->nTabs) pModel->nActive = pModel->nTabs ? pModel->nTabs - 1 : 0;
+        PutOrder(pWriter, pModel, pLog);
+    } else if (nOp == 2) {
+        ModelTab moved;
+        i = TestRngBelow(pRng, pModel->nTabs);
+        j = TestRngBelow(pRng, pModel->nTabs);
+        moved = pModel->tabs[i];
+        if (i < j) memmove(&pModel->tabs[i], &pModel->tabs[i + 1], (j - i) * sizeof(ModelTab));
+        else memmove(&pModel->tabs[j + 1], &pModel->tabs[j], (i - j) * sizeof(ModelTab));
+        pModel->tabs[j] = moved;
+        pModel->nActive = j;
+        PutOrder(pWriter, pModel, pLog);
+    } else if (nOp == 3) {
+        pModel->nActive = TestRngBelow(pRng, pModel->nTabs);
+        PutOrder(pWriter, pModel, pLog);
+    } else if (nOp == 4) {
+        pTab = &pModel->tabs[pModel->nActive];
+        RandomCaret(&pTab->tab, pRng);
+        if (TestRngBelow(pRng, 10) == 0) pTab->tab.nEncoding = (int)TestRngBelow(pRng, 8);
+        PutTab(pWriter, pTab, pLog);
+    } else {
+        /* Nothing changed: neither record is written again */
+        uint64_t nBytes = pWriter->nBytes;
+        PutTab(pWriter, &pModel->tabs[TestRngBelow(pRng, pModel->nTabs)], pLog);
+        PutOrder(pWriter, pModel, pLog);
+        CHECK(pWriter->nBytes == nBytes);
+    }
+}
+
+static void Rewrite(SessionWriter* pWriter, const Model* pModel) {
+    SessionTab* pTabs = (SessionTab*)malloc((pModel->nTabs + 1) * sizeof(SessionTab));
+    size_t i;
+
+    REQUIRE(pTabs);
+    for (i = 0; i < pModel->nTabs; i++) pTabs[i] = pModel->tabs[i].tab;
+    CHECK(SessionWriterRewrite(pWriter, pTabs, pModel->nTabs, pModel->nTabs ? pTabs[pModel->nActive].nId : 0));
+    CHECK(pWriter->nBytes == pWriter->nRewritten && !SessionWriterRewriteDue(pWriter));
+    free(pTabs);
+}
+
+static void TestChurn(long nSteps, TestRng* pRng) {
+    Model* pModel = (Model*)calloc(1, sizeof(Model));
+    SessionSnapshot snapshot;
+    SessionWriter writer, second;
+    long nRewrites = 0, nReopens = 0, k;
+
+    REQUIRE(pModel);
+    DeleteFilePath(g_szPath);
+    REQUIRE(SessionWriterOpen(&writer, g_szPath, &snapshot));
+    CHECK(snapshot.nTabs == 0 && snapshot.nMaxId == 0);
+    SessionSnapshotFree(&snapshot);
+
+    for (k = 1; k <= nSteps; k++) {
+        Step(&writer, pModel, NULL, pRng);
+        CHECK(!writer.bFailed);
+        if (SessionWriterRewriteDue(&writer)) {
+            Rewrite(&writer, pModel);
+            nRewrites++;
+        }
+        if (k % 500 == 0) {
+            CHECK(SessionLoad(g_szPath, &snapshot));
+            CHECK(MatchesModel(&snapshot, pModel));
+            CHECK(snapshot.nValidBytes == writer.nBytes);
+            SessionSnapshotFree(&snapshot);
+        }
+        if (k % 2000 == 0) {
+            /* Held by this writer, so nobody else can claim it */
+            CHECK(!SessionWriterOpen(&second, g_szPath, &snapshot));
+
+            /* Reopened, the writer reads back the model */
+            SessionWriterClose(&writer);
+            REQUIRE(SessionWriterOpen(&writer, g_szPath, &snapshot));
+            CHECK(MatchesModel(&snapshot, pModel));
+            CHECK(snapshot.nMaxId == pModel->nMaxId);
+            SessionSnapshotFree(&snapshot);
+            nReopens++;
+        }
+        if (g_nTestFailures) break;
+    }
+    SessionWriterClose(&writer);
+    CHECK(SessionLoad(g_szPath, &snapshot) && MatchesModel(&snapshot, pModel));
+    SessionSnapshotFree(&snapshot);
+    printf("%ld steps, %ld rewrites, %ld reopens, %zu tabs at the end\n", nSteps, nRewrites, nReopens, pModel->nTabs);
+    DeleteFilePath(g_szPath);
+    free(pModel);
+}
+
+/* A short log of LOG_RECORDS records, noting each in pLog */
+static uint8_t* MakeLog(TestRng* pRng, size_t* pnLen, RecordLog* pLog) {
+    Model* pModel = (Model*)calloc(1, sizeof(Model));
+    SessionSnapshot snapshot;
+    SessionWriter writer;
+    uint8_t* pData;
+
+    pLog->pStates = (Shadow*)calloc(LOG_RECORDS + 1, sizeof(Shadow));
+    pLog->pEnds = (uint64_t*)calloc(LOG_RECORDS + 1, sizeof(uint64_t));
+    REQUIRE(pModel && pLog->pStates && pLog->pEnds);
+    DeleteFilePath(g_szPath);
+    REQUIRE(SessionWriterOpen(&writer, g_szPath, &snapshot));
+    SessionSnapshotFree(&snapshot);
+    pLog->pEnds[0] = writer.nBytes;
+    pLog->nRecords = 1;
+
+    /* A step writes at most two records */
+    while (pLog->nRecords < LOG_RECORDS) Step(&writer, pModel, pLog, pRng);
+    SessionWriterClose(&writer);
+    REQUIRE((pData = TestReadFile(g_szPath, pnLen)) != NULL);
+    REQUIRE(*pnLen == pLog->pEnds[pLog->nRecords - 1]);
+    free(pModel);
+    return pData;
+}
+
+static void TestTornTail(TestRng* pRng) {
+    RecordLog log;
+    size_t nLen, nRecord = 0, nLenAt;
+    uint8_t* pData = MakeLog(pRng, &nLen, &log);
+    const uint64_t* pEnds = log.pEnds;
+    const Shadow* pStates = log.pStates;
+    size_t nRecords = log.nRecords;
+    SessionSnapshot snapshot;
+    SessionWriter writer;
+    int i;
+
+    for (nLenAt = 0; nLenAt <= nLen; nLenAt++) {
+        while (nRecord + 1 < nRecords && pEnds[nRecord + 1] <= nLenAt) nRecord++;
+        if (nLenAt < 4) {
+            CHECK(!SessionParse(pData, nLenAt, &snapshot));
+            continue;
+        }
+        CHECK(SessionParse(pData, nLenAt, &snapshot));
+        CHECK(snapshot.nValidBytes == pEnds[nRecord]);
+        CHECK(MatchesShadow(&snapshot, &pStates[nRecord]));
+        SessionSnapshotFree(&snapshot);
+        if (g_nTestFailures) break;
+    }
+
+    /* A flipped bit stops the reader at the record before it */
+    for (i = 0; i < 2000; i++) {
+        size_t nAt = 4 + TestRngBelow(pRng, nLen - 4);
+        uint8_t nBit = (uint8_t)(1u << TestRngBelow(pRng, 8));
+        for (nRecord = 0; pEnds[nRecord + 1] <= nAt; nRecord++) {
+        }
+        pData[nAt] ^= nBit;
+        CHECK(SessionParse(pData, nLen, &snapshot));
+        CHECK(snapshot.nValidBytes == pEnds[nRecord]);
+        CHECK(MatchesShadow(&snapshot, &pStates[nRecord]));
+        SessionSnapshotFree(&snapshot);
+        pData[nAt] ^= nBit;
+    }
+    pData[0] ^= 1;
+    CHECK(!SessionParse(pData, nLen, &snapshot));
+    pData[0] ^= 1;
+
+    /* A writer cuts a torn tail off and appends after the last intact record */
+    nLenAt = (size_t)pEnds[nRecords / 2] + 3;
+    REQUIRE(TestWriteFile(g_szPath, pData, nLenAt));
+    REQUIRE(SessionWriterOpen(&writer, g_szPath, &snapshot));
+    CHECK(MatchesShadow(&snapshot, &pStates[nRecords / 2]));
+    CHECK(writer.nBytes == pEnds[nRecords / 2]);
+    SessionSnapshotFree(&snapshot);
+    {
+        uint64_t nId = pStates[nRecords / 2].nRecorded ? pStates[nRecords / 2].recorded[0].nId : 0;
+        CHECK(SessionWriterPutOrder(&writer, &nId, nId ? 1 : 0, nId, NULL));
+    }
+    SessionWriterClose(&writer);
+    CHECK(SessionLoad(g_szPath, &snapshot));
+    CHECK(snapshot.nValidBytes == writer.nBytes);
+    CHECK(snapshot.nTabs == (pStates[nRecords / 2].nRecorded ? 1u : 0u));
+    SessionSnapshotFree(&snapshot);
+
+    /* Not a session file at all: the writer starts it over */
+    REQUIRE(TestWriteFile(g_szPath, "not a session", 13));
+    REQUIRE(SessionWriterOpen(&writer, g_szPath, &snapshot));
+    CHECK(snapshot.nTabs == 0 && writer.nBytes == 4);
+    SessionSnapshotFree(&snapshot);
+    SessionWriterClose(&writer);
+
+    printf("%zu records, %zu bytes: every truncation and 2000 flipped bits\n", nRecords - 1, nLen);
+    DeleteFilePath(g_szPath);
+    free(pData);
+    free(log.pEnds);
+    free(log.pStates);
+}
+
+/* Crc32 of session_file.c, to frame records the writer would never produce */
+static uint32_t Crc32(const uint8_t* p, size_t nLen) {
+    uint32_t nCrc = 0xFFFFFFFFu;
+    while (nLen--) {
+        nCrc ^= *p++;
+        for (int i = 0; i < 8; i++) nCrc = (nCrc >> 1) ^ (0xEDB88320u & (0u - (nCrc & 1)));
+    }
+    return nCrc ^ 0xFFFFFFFFu;
+}
+
+static void TestMalformed(TestRng* pRng) {
+    uint8_t data[4 + 64 * 80];
+    int nRun, i;
+
+    for (nRun = 0; nRun < 20000; nRun++) {
+        size_t n = 4, nRecords = 1 + TestRngBelow(pRng, 64);
+        SessionSnapshot snapshot;
+
+        memcpy(data, "XNS1", 4);
+        while (nRecords--) {
+            size_t nBody = 1 + TestRngBelow(pRng, 70);
+            uint32_t nCrc;
+            data[n++] = (uint8_t)nBody;
+            data[n] = (uint8_t)(1 + TestRngBelow(pRng, 3));
+            for (i = 1; i < (int)nBody; i++) {
+                /* Mostly small varints, so some records parse */
+                data[n + i] = (uint8_t)(TestRngBelow(pRng, 4) ? TestRngBelow(pRng, 8) : TestRngNext(pRng));
+            }
+            nCrc = Crc32(data + n, nBody);
+            n += nBody;
+            for (i = 0; i < 4; i++) data[n++] = (uint8_t)(nCrc >> (8 * i));
+        }
+        CHECK(SessionParse(data, n, &snapshot));
+        CHECK(snapshot.nValidBytes <= n && (snapshot.nTabs == 0 || snapshot.nActive < snapshot.nTabs));
+        for (size_t t = 0; t < snapshot.nTabs; t++) {
+            CHECK(snapshot.pTabs[t].nId != 0 && snapshot.pTabs[t].nId <= snapshot.nMaxId);
+            CHECK(strlen(snapshot.pTabs[t].szPath) < SESSION_MAX_PATH);
+        }
+        SessionSnapshotFree(&snapshot);
+        if (g_nTestFailures) break;
+    }
+}
+
+/* 50 tabs after a day of caret moves and switches, loaded as at launch */
+static void TestLoadTime(TestRng* pRng) {
+    Model* pModel = (Model*)calloc(1, sizeof(Model));
+    SessionSnapshot snapshot;
+    SessionWriter writer;
+    double dBest = 0;
+    int i;
+
+    REQUIRE(pModel);
+    DeleteFilePath(g_szPath);
+    REQUIRE(SessionWriterOpen(&writer, g_szPath, &snapshot));
+    SessionSnapshotFree(&snapshot);
+    while (pModel->nTabs < MAX_TABS) OpenTab(&writer, pModel, NULL, pRng);
+    for (i = 0; i < 100000; i++) {
+        if (TestRngBelow(pRng, 10) == 0) {
+            pModel->nActive = TestRngBelow(pRng, pModel->nTabs);
+            PutOrder(&writer, pModel, NULL);
+        } else {
+            RandomCaret(&pModel->tabs[pModel->nActive].tab, pRng);
+            PutTab(&writer, &pModel->tabs[pModel->nActive], NULL);
+        }
+        /* As NoteSessionTab does */
+        if (SessionWriterRewriteDue(&writer)) Rewrite(&writer, pModel);
+    }
+    SessionWriterClose(&writer);
+
+    for (i = 0; i < 5; i++) {
+        double t0 = TestSeconds(), dTime;
+        CHECK(SessionLoad(g_szPath, &snapshot));
+        dTime = TestSeconds() - t0;
+        CHECK(MatchesModel(&snapshot, pModel));
+        if (i == 0 || dTime < dBest) dBest = dTime;
+        SessionSnapshotFree(&snapshot);
+    }
+    CHECK(dBest < 0.1);
+    printf("%zu tabs, %llu byte log: loaded in %.3f ms\n", pModel->nTabs, (unsigned long long)writer.nBytes, dBest * 1e3);
+    DeleteFilePath(g_szPath);
+    free(pModel);
+}
+
+int main(int argc, char** argv) {
+    TestRng rng;
+
+    TestTempPath(g_szPath, sizeof(g_szPath), "session.xns");
+    TestRngInit(&rng, TestSeed(22));
+    TestChurn(argc > 1 ? atol(argv[1]) : 20000, &rng);
+    TestTornTail(&rng);
+    TestMalformed(&rng);
+    TestLoadTime(&rng);
+    return TestResult("session_file_test");
+}
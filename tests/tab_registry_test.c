@@ -0,0 +1,112 @@
+/*
+ * Tab registry churn: 100000 opens and 100000 closes at random positions,
+ * in phases that grow to a few thousand tabs and shrink back, against a
+ * model of the tab strip. Every step checks the order, that each tab's
+ * state pointer never moves and holds what was written to it, that new
+ * tabs start zeroed, that handles find their tabs and positions, that
+ * handles of closed tabs stay stale after their slots are reused, and that
+ * slots are reused rather than grown.
+ *
+ * Usage: tab_registry_test [opens]
+ */
+
+#include "tab_registry.h"
+#include "test_util.h"
+
+typedef struct {
+    uint64_t nSerial;            /* Which open this tab came from */
+    unsigned char filler[200];   /* Written with the serial's low byte */
+} Item;
+
+typedef struct {
+    TabHandle hTab;
+    Item* pItem;
+    uint64_t nSerial;
+} ModelTab;
+
+static int IsZero(const Item* pItem) {
+    const unsigned char* p = (const unsigned char*)pItem;
+    size_t i;
+    for (i = 0; i < sizeof(Item); i++) {
+        if (p[i]) return 0;
+    }
+    return 1;
+}
+
+/* The tab at position nIndex agrees with the model */
+static int Agrees(const TabRegistry* pReg, const ModelTab* pModel, size_t nIndex) {
+    const ModelTab* pTab = &pModel[nIndex];
+    const Item* pItem = (const Item*)TabRegistryAt(pReg, nIndex);
+    size_t nFound = (size_t)-1;
+    return TabRegistryIndexOf(pReg, pTab->hTab, &nFound) && nFound == nIndex && pItem == pTab->pItem && TabRegistryHandleAt(pReg, nIndex) == pTab->hTab &&
+           TabRegistryGet(pReg, pTab->hTab) == pItem && pItem->nSerial == pTab->nSerial &&
+           pItem->filler[0] == (unsigned char)pTab->nSerial && pItem->filler[sizeof(pItem->filler) - 1] == (unsigned char)pTab->nSerial;
+}
+
+static void TestChurn(long nOpens, TestRng* pRng) {
+    ModelTab* pModel = (ModelTab*)malloc((size_t)nOpens * sizeof(ModelTab));
+    TabHandle* pClosed = (TabHandle*)malloc((size_t)nOpens * sizeof(TabHandle));
+    size_t nCount = 0, nClosed = 0, nPeak = 0, nTarget = 0, nGone, i;
+    long nOpened = 0;
+    TabRegistry reg;
+
+    REQUIRE(pModel && pClosed);
+    TabRegistryInit(&reg, sizeof(Item));
+    while (nOpened < nOpens || nCount > 0) {
+        /* Head for a new target size now and then, from none to a few thousand */
+        if (TestRngBelow(pRng, 2000) == 0) nTarget = TestRngBelow(pRng, 4000);
+        if (nOpened < nOpens && (nCount == 0 || (nCount < nTarget ? TestRngBelow(pRng, 4) != 0 : TestRngBelow(pRng, 4) == 0))) {
+            TabHandle hTab = TAB_HANDLE_NONE;
+            Item* pItem = (Item*)TabRegistryAdd(&reg, &hTab);
+            REQUIRE(pItem);
+            CHECK(hTab != TAB_HANDLE_NONE);
+            CHECK(IsZero(pItem));
+            pItem->nSerial = (uint64_t)nOpened;
+            memset(pItem->filler, (unsigned char)nOpened, sizeof(pItem->filler));
+            pModel[nCount].hTab = hTab;
+            pModel[nCount].pItem = pItem;
+            pModel[nCount].nSerial = (uint64_t)nOpened;
+            nCount++;
+            nOpened++;
+            if (nCount > nPeak) nPeak = nCount;
+        } else {
+            size_t nIndex = TestRngBelow(pRng, nCount);
+            CHECK(TabRegistryRemove(&reg, nIndex));
+            pClosed[nClosed++] = pModel[nIndex].hTab;
+            memmove(&pModel[nIndex], &pModel[nIndex + 1], (nCount - nIndex - 1) * sizeof(ModelTab));
+            nCount--;
+        }
+
+        CHECK(TabRegistryCount(&reg) == nCount);
+        CHECK(!TabRegistryRemove(&reg, nCount));
+        CHECK(!TabRegistryAt(&reg, nCount) && TabRegistryHandleAt(&reg, nCount) == TAB_HANDLE_NONE);
+        for (i = 0; i < 8 && nCount; i++) CHECK(Agrees(&reg, pModel, TestRngBelow(pRng, nCount)));
+        for (i = 0; i < 8 && nClosed; i++) CHECK(!TabRegistryGet(&reg, pClosed[TestRngBelow(pRng, nClosed)]));
+        /* Slots are reused: never more of them than tabs were ever open at once */
+        CHECK(reg.nSlots <= nPeak);
+        if (g_nTestFailures) break;
+
+        if ((nOpened + nClosed) % 10000 == 0) {
+            for (i = 0; i < nCount; i++) CHECK(Agrees(&reg, pModel, i));
+        }
+    }
+    for (i = 0; i < nClosed; i++) CHECK(!TabRegistryGet(&reg, pClosed[i]) && !TabRegistryIndexOf(&reg, pClosed[i], &nGone));
+    CHECK(!TabRegistryGet(&reg, TAB_HANDLE_NONE));
+    printf("%ld opens, %zu closes, at most %zu tabs in %u slots\n", nOpened, nClosed, nPeak, reg.nSlots);
+
+    /* A freed registry starts over empty and still works */
+    TabRegistryFree(&reg);
+    CHECK(TabRegistryCount(&reg) == 0 && !TabRegistryGet(&reg, pClosed[0]));
+    CHECK(TabRegistryAdd(&reg, NULL) && TabRegistryCount(&reg) == 1);
+    TabRegistryFree(&reg);
+    free(pClosed);
+    free(pModel);
+}
+
+int main(int argc, char** argv) {
+    TestRng rng;
+
+    TestRngInit(&rng, TestSeed(20));
+    TestChurn(argc > 1 ? atol(argv[1]) : 100000, &rng);
+    return TestResult("tab_registry_test");
+}
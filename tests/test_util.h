@@ -0,0 +1,143 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+/*
+ * Shared helpers for the host tests and benchmarks.
+ *
+ * Each *_test.c and *_bench.c in this directory is a small program linked
+ * against the portable modules with the host compiler ("make test" and
+ * "make bench"). A test prints every failed check and exits nonzero; a
+ * benchmark prints one line per measurement. Benchmarks take an optional
+ * size argument so a quick run can use a smaller input than the default.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+static int g_nTestFailures;
+
+/* Record a failed condition and keep going */
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            g_nTestFailures++; \
+        } \
+    } while (0)
+
+/* Stop the test here if the condition fails (for setup the rest depends on) */
+#define REQUIRE(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: required: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while (0)
+
+/* Exit status for main: report and return nonzero if any check failed */
+static inline int TestResult(const char* szName) {
+    if (g_nTestFailures) {
+        fprintf(stderr, "%s: %d check(s) failed\n", szName, g_nTestFailures);
+        return 1;
+    }
+    printf("%s: ok\n", szName);
+    return 0;
+}
+
+/* Monotonic time in seconds */
+static inline double TestSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Deterministic xorshift generator, so a failing run can be repeated */
+typedef struct {
+    uint64_t nState;
+} TestRng;
+
+static inline void TestRngInit(TestRng* pRng, uint64_t nSeed) {
+    pRng->nState = nSeed ? nSeed : 0x9E3779B97F4A7C15ull;
+}
+
+static inline uint64_t TestRngNext(TestRng* pRng) {
+    uint64_t x = pRng->nState;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    pRng->nState = x;
+    return x;
+}
+
+/* Uniform value in [0, nLimit); 0 when nLimit is 0 */
+static inline size_t TestRngBelow(TestRng* pRng, size_t nLimit) {
+    return nLimit ? (size_t)(TestRngNext(pRng) % nLimit) : 0;
+}
+
+/* Seed from the TEST_SEED environment variable, or nDefault */
+static inline uint64_t TestSeed(uint64_t nDefault) {
+    const char* szSeed = getenv("TEST_SEED");
+    return szSeed ? strtoull(szSeed, NULL, 0) : nDefault;
+}
+
+/* Path for a scratch file in $TMPDIR (or /tmp), unique to this process */
+static inline void TestTempPath(char* szPath, size_t cchPath, const char* szName) {
+    const char* szDir = getenv("TMPDIR");
+    snprintf(szPath, cchPath, "%s/xnote_%ld_%s", szDir && *szDir ? szDir : "/tmp", (long)getpid(), szName);
+}
+
+/* Write nLen bytes to a new file (returns nonzero on success) */
+static inline int TestWriteFile(const char* szPath, const void* pData, size_t nLen) {
+    FILE* pFile = fopen(szPath, "wb");
+    int bOk;
+    if (!pFile) return 0;
+    bOk = fwrite(pData, 1, nLen, pFile) == nLen;
+    return fclose(pFile) == 0 && bOk;
+}
+
+/* Read a whole file into a malloc'd buffer (NULL on failure) */
+static inline uint8_t* TestReadFile(const char* szPath, size_t* pnLen) {
+    FILE* pFile = fopen(szPath, "rb");
+    uint8_t* pData = NULL;
+    long nLen;
+    if (!pFile) return NULL;
+    if (fseek(pFile, 0, SEEK_END) == 0 && (nLen = ftell(pFile)) >= 0 && fseek(pFile, 0, SEEK_SET) == 0) {
+        pData = (uint8_t*)malloc((size_t)nLen + 1);
+        if (pData && fread(pData, 1, (size_t)nLen, pFile) != (size_t)nLen) {
+            free(pData);
+            pData = NULL;
+        }
+        *pnLen = (size_t)nLen;
+    }
+    fclose(pFile);
+    return pData;
+}
+
+/* Size argument of a benchmark in MB (argv[1]), or nDefault */
+static inline size_t BenchSizeMB(int argc, char** argv, size_t nDefault) {
+    return argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : nDefault;
+}
+
+/* Peak resident set of this process in KB */
+static inline long BenchPeakRssKB(void) {
+    struct rusage ru;
+    return getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_maxrss : 0;
+}
+
+/* Print one measurement, with throughput when dBytes is known */
+static inline void BenchReport(const char* szName, double dSeconds, double dBytes) {
+    if (dBytes > 0 && dSeconds > 0) {
+        printf("%-40s %9.3f s %9.1f MB/s\n", szName, dSeconds, dBytes / dSeconds / 1e6);
+    } else {
+        printf("%-40s %9.3f s\n", szName, dSeconds);
+    }
+    fflush(stdout);
+}
+
+#endif /* TEST_UTIL_H */
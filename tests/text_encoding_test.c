@@ -0,0 +1,376 @@
+/*
+ * Encoding detection on a generated corpus: text in ten scripts, from 16
+ * to 2M characters, stored as UTF-8, UTF-16 and UTF-32 in both byte
+ * orders with and without a byte order mark, and in the Windows code page
+ * of its script where there is one. Prints the accuracy by encoding and by
+ * length and fails on any miss from 128 characters up; wide text that was detected is
+ * also decoded and compared. Then UTF-8 cut at the edges of the samples,
+ * the statistics kernels against each other, and the time to detect,
+ * which must not grow with the file. The module source is included so
+ * every kernel this CPU can run is tested.
+ */
+
+#include "text_encoding.c"
+#include "test_util.h"
+
+#define MAX_CHARS (4 << 20)
+
+/* Stored forms: an encoding, and whether it starts with a byte order mark */
+typedef struct {
+    const char* szName;
+    int nEncoding;
+    int bBom;
+} Form;
+
+static const Form g_forms[] = {
+    {"utf-8", TEXT_ENCODING_UTF8, 0},       {"utf-8 bom", TEXT_ENCODING_UTF8, 1},
+    {"utf-16le", TEXT_ENCODING_UTF16LE, 0}, {"utf-16le bom", TEXT_ENCODING_UTF16LE, 1},
+    {"utf-16be", TEXT_ENCODING_UTF16BE, 0}, {"utf-16be bom", TEXT_ENCODING_UTF16BE, 1},
+    {"utf-32le", TEXT_ENCODING_UTF32LE, 0}, {"utf-32le bom", TEXT_ENCODING_UTF32LE, 1},
+    {"utf-32be", TEXT_ENCODING_UTF32BE, 0}, {"utf-32be bom", TEXT_ENCODING_UTF32BE, 1},
+    {"ansi", TEXT_ENCODING_ANSI, 0},
+};
+#define FORM_COUNT (sizeof(g_forms) / sizeof(g_forms[0]))
+
+/* Words of a script, and the code page byte of a character (0 if it has none there) */
+typedef struct {
+    const char* szName;
+    const char* const* ppWords;
+    size_t nWords;
+    uint8_t (*pfnAnsi)(uint32_t nCode);
+    int bSpaces;                 /* Words are separated by spaces */
+} Script;
+
+static uint8_t AnsiLatin1(uint32_t nCode) {
+    return nCode < 0x100 ? (uint8_t)nCode : 0;
+}
+
+/* Windows-1251, А..я only */
+static uint8_t AnsiCyrillic(uint32_t nCode) {
+    if (nCode < 0x80) return (uint8_t)nCode;
+    return nCode >= 0x410 && nCode <= 0x44F ? (uint8_t)(nCode - 0x350) : 0;
+}
+
+/* Windows-1253, where the Greek block maps straight across */
+static uint8_t AnsiGreek(uint32_t nCode) {
+    if (nCode < 0x80) return (uint8_t)nCode;
+    return nCode >= 0x388 && nCode <= 0x3CE && nCode != 0x3A2 ? (uint8_t)(nCode - 0x2D0) : 0;
+}
+
+static const char* const g_english[] = {"the", "request", "was", "served", "in", "12", "ms", "and", "logged", "to", "disk,"};
+static const char* const g_code[] = {"int", "main(void)", "{", "}", "return", "0;", "if", "(x", "==", "y)", "//", "/*", "*/"};
+static const char* const g_french[] = {"le", "caf\xc3\xa9", "\xc3\xa9l\xc3\xa8ve", "gar\xc3\xa7on", "d\xc3\xa9j\xc3\xa0", "na\xc3\xafve", "et", "la", "fen\xc3\xaatre"};
+static const char* const g_german[] = {"die", "Gr\xc3\xb6\xc3\x9f" "e", "\xc3\xbc" "ber", "Stra\xc3\x9f" "e", "und", "M\xc3\xa4" "dchen", "der"};
+static const char* const g_russian[] = {"\xd0\xbf\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82", "\xd0\xbc\xd0\xb8\xd1\x80",
+                                        "\xd1\x84\xd0\xb0\xd0\xb9\xd0\xbb", "\xd0\xa1\xd1\x82\xd1\x80\xd0\xbe\xd0\xba\xd0\xb0", "\xd0\xb8", "42"};
+static const char* const g_greek[] = {"\xce\xba\xce\xb1\xce\xbb\xce\xb7\xce\xbc\xce\xad\xcf\x81\xce\xb1", "\xce\xba\xcf\x8c\xcf\x83\xce\xbc\xce\xb5",
+                                      "\xce\x91\xce\xb8\xce\xae\xce\xbd\xce\xb1", "\xce\xba\xce\xb1\xce\xb9", "7"};
+static const char* const g_chinese[] = {"\xe6\x97\xa5\xe5\xbf\x97", "\xe6\x96\x87\xe4\xbb\xb6", "\xe8\xaf\xb7\xe6\xb1\x82",
+                                        "\xe5\xae\x8c\xe6\x88\x90", "\xe3\x80\x82", "\xef\xbc\x8c"};
+static const char* const g_japanese[] = {"\xe3\x81\x93\xe3\x82\x93\xe3\x81\xab\xe3\x81\xa1\xe3\x81\xaf", "\xe3\x83\x95\xe3\x82\xa1\xe3\x82\xa4\xe3\x83\xab",
+                                         "\xe5\x87\xa6\xe7\x90\x86", "\xe3\x81\xae", "ID", "\xe3\x80\x81"};
+static const char* const g_emoji[] = {"ok", "\xf0\x9f\x98\x80", "\xf0\x9f\x9a\x80\xf0\x9f\x8c\x8d", "deploy", "\xe2\x9c\x94"};
+
+static const Script g_scripts[] = {
+    {"english", g_english, 11, AnsiLatin1, 1},
+    {"code", g_code, 13, AnsiLatin1, 1},
+    {"french", g_french, 9, AnsiLatin1, 1},
+    {"german", g_german, 7, AnsiLatin1, 1},
+    {"russian", g_russian, 6, AnsiCyrillic, 1},
+    {"greek", g_greek, 5, AnsiGreek, 1},
+    {"chinese", g_chinese, 6, NULL, 1},
+    {"japanese", g_japanese, 6, NULL, 1},
+    {"emoji", g_emoji, 5, NULL, 1},
+    {"cjk only", g_chinese, 4, NULL, 0}, /* No ASCII but the line breaks */
+};
+#define SCRIPT_COUNT (sizeof(g_scripts) / sizeof(g_scripts[0]))
+
+/* Characters of text */
+static const size_t g_sizes[] = {16, 128, 2048, 128 * 1024, 2 << 20};
+#define SIZE_COUNT (sizeof(g_sizes) / sizeof(g_sizes[0]))
+
+/* Next code point of a UTF-8 string */
+static uint32_t NextCode(const char** psz) {
+    const uint8_t* p = (const uint8_t*)*psz;
+    uint32_t nCode;
+    int nMore;
+    if (p[0] < 0x80) { nCode = p[0]; nMore = 0; }
+    else if (p[0] < 0xE0) { nCode = p[0] & 0x1F; nMore = 1; }
+    else if (p[0] < 0xF0) { nCode = p[0] & 0x0F; nMore = 2; }
+    else { nCode = p[0] & 0x07; nMore = 3; }
+    for (int i = 1; i <= nMore; i++) nCode = (nCode << 6) | (p[i] & 0x3F);
+    *psz += 1 + nMore;
+    return nCode;
+}
+
+/* About nChars characters of a script in lines of up to 70, CRLF or LF breaks */
+static size_t MakeText(const Script* pScript, size_t nChars, uint32_t* pCodes, TestRng* pRng) {
+    int bCrlf = TestRngBelow(pRng, 2) == 0;
+    size_t n = 0, nLine = 0;
+    while (n < nChars) {
+        const char* sz = pScript->ppWords[TestRngBelow(pRng, pScript->nWords)];
+        while (*sz && n < nChars) pCodes[n++] = NextCode(&sz);
+        nLine++;
+        if (nLine >= 8 && n + 2 <= nChars) {
+            if (bCrlf) pCodes[n++] = '\r';
+            pCodes[n++] = '\n';
+            nLine = 0;
+        } else if (pScript->bSpaces && n < nChars) {
+            pCodes[n++] = ' ';
+        }
+    }
+    return n;
+}
+
+/* Store code points in a form (returns the bytes, or 0 if the code page cannot hold them) */
+static size_t Encode(const uint32_t* pCodes, size_t nCodes, const Form* pForm, const Script* pScript, uint8_t* pOut) {
+    size_t n = pForm->bBom ? TextEncodingBom(pForm->nEncoding, pOut) : 0, i;
+    int bBig = pForm->nEncoding == TEXT_ENCODING_UTF16BE || pForm->nEncoding == TEXT_ENCODING_UTF32BE;
+
+    for (i = 0; i < nCodes; i++) {
+        uint32_t c = pCodes[i];
+        switch (pForm->nEncoding) {
+            case TEXT_ENCODING_UTF8:
+                if (c < 0x80) {
+                    pOut[n++] = (uint8_t)c;
+                } else if (c < 0x800) {
+                    pOut[n++] = (uint8_t)(0xC0 | (c >> 6));
+                    pOut[n++] = (uint8_t)(0x80 | (c & 0x3F));
+                } else if (c < 0x10000) {
+                    pOut[n++] = (uint8_t)(0xE0 | (c >> 12));
+                    pOut[n++] = (uint8_t)(0x80 | ((c >> 6) & 0x3F));
+                    pOut[n++] = (uint8_t)(0x80 | (c & 0x3F));
+                } else {
+                    pOut[n++] = (uint8_t)(0xF0 | (c >> 18));
+                    pOut[n++] = (uint8_t)(0x80 | ((c >> 12) & 0x3F));
+                    pOut[n++] = (uint8_t)(0x80 | ((c >> 6) & 0x3F));
+                    pOut[n++] = (uint8_t)(0x80 | (c & 0x3F));
+                }
+                break;
+            case TEXT_ENCODING_UTF16LE:
+            case TEXT_ENCODING_UTF16BE: {
+                uint16_t units[2];
+                size_t nUnits = 1;
+                if (c >= 0x10000) {
+                    units[0] = (uint16_t)(0xD800 | ((c - 0x10000) >> 10));
+                    units[1] = (uint16_t)(0xDC00 | ((c - 0x10000) & 0x3FF));
+                    nUnits = 2;
+                } else {
+                    units[0] = (uint16_t)c;
+                }
+                Utf16ToBytes(units, nUnits, bBig, pOut + n);
+                n += 2 * nUnits;
+                break;
+            }
+            case TEXT_ENCODING_UTF32LE:
+            case TEXT_ENCODING_UTF32BE:
+                PutUtf32(pOut + n, c, bBig);
+                n += 4;
+                break;
+            default:
+                if (!pScript->pfnAnsi || (c >= 0x80 && !pScript->pfnAnsi(c))) return 0;
+                pOut[n++] = c < 0x80 ? (uint8_t)c : pScript->pfnAnsi(c);
+                break;
+        }
+    }
+    return n;
+}
+
+/* What detection should say: ASCII in a code page reads the same as UTF-8 */
+static int Expected(const Form* pForm, const uint32_t* pCodes, size_t nCodes) {
+    size_t i;
+    if (pForm->nEncoding != TEXT_ENCODING_ANSI) return pForm->nEncoding;
+    for (i = 0; i < nCodes && pCodes[i] < 0x80; i++) {
+    }
+    return i == nCodes ? TEXT_ENCODING_UTF8 : TEXT_ENCODING_ANSI;
+}
+
+/* Decode detected wide text and compare it with the UTF-16 of the code points */
+static int DecodesBack(const uint8_t* pData, size_t nLen, int nEncoding, size_t nBom, const uint32_t* pCodes, size_t nCodes,
+                       uint16_t* pUnits) {
+    int bBig = nEncoding == TEXT_ENCODING_UTF16BE || nEncoding == TEXT_ENCODING_UTF32BE;
+    size_t nUnits, i, k = 0;
+
+    if (nEncoding == TEXT_ENCODING_UTF16LE || nEncoding == TEXT_ENCODING_UTF16BE) {
+        nUnits = Utf16FromBytes(pData + nBom, nLen - nBom, bBig, pUnits);
+    } else {
+        nUnits = Utf32ToUtf16(pData + nBom, nLen - nBom, bBig, pUnits);
+    }
+    for (i = 0; i < nCodes; i++) {
+        if (pCodes[i] >= 0x10000) {
+            if (k + 2 > nUnits || pUnits[k] != (0xD800 | ((pCodes[i] - 0x10000) >> 10)) ||
+                pUnits[k + 1] != (0xDC00 | ((pCodes[i] - 0x10000) & 0x3FF))) {
+                return 0;
+            }
+            k += 2;
+        } else if (k >= nUnits || pUnits[k++] != pCodes[i]) {
+            return 0;
+        }
+    }
+    return k == nUnits;
+}
+
+static void TestCorpus(TestRng* pRng) {
+    uint32_t* pCodes = (uint32_t*)malloc(MAX_CHARS * sizeof(uint32_t));
+    uint8_t* pData = (uint8_t*)malloc(4 * MAX_CHARS + 4);
+    uint16_t* pUnits = (uint16_t*)malloc(2 * MAX_CHARS * sizeof(uint16_t) + 2);
+    size_t nRight[FORM_COUNT][SIZE_COUNT], nTotal[FORM_COUNT][SIZE_COUNT];
+    size_t f, s, c;
+
+    REQUIRE(pCodes && pData && pUnits);
+    memset(nRight, 0, sizeof(nRight));
+    memset(nTotal, 0, sizeof(nTotal));
+    for (c = 0; c < SCRIPT_COUNT; c++) {
+        for (s = 0; s < SIZE_COUNT; s++) {
+            /* Each form holds the same text */
+            size_t nCodes = MakeText(&g_scripts[c], g_sizes[s], pCodes, pRng);
+            for (f = 0; f < FORM_COUNT; f++) {
+                size_t nLen = Encode(pCodes, nCodes, &g_forms[f], &g_scripts[c], pData), nBom = 99;
+                uint8_t bom[4];
+                int nExpected = Expected(&g_forms[f], pCodes, nCodes), nGot;
+
+                if (!nLen) continue;
+                nGot = DetectTextEncoding(pData, nLen, &nBom);
+                nTotal[f][s]++;
+                if (nGot == nExpected && nBom == (g_forms[f].bBom ? TextEncodingBom(nGot, bom) : 0)) {
+                    nRight[f][s]++;
+                    if (IsWideEncoding(nGot)) CHECK(DecodesBack(pData, nLen, nGot, nBom, pCodes, nCodes, pUnits));
+                } else if (g_sizes[s] >= 128 || g_forms[f].bBom) {
+                    fprintf(stderr, "%s, %zu bytes of %s: detected %d\n", g_scripts[c].szName, nLen, g_forms[f].szName, nGot);
+                    CHECK(nGot == nExpected);
+                }
+            }
+        }
+    }
+
+    printf("%-14s", "accuracy");
+    for (s = 0; s < SIZE_COUNT; s++) printf(" %8zu ch", g_sizes[s]);
+    printf("\n");
+    for (f = 0; f < FORM_COUNT; f++) {
+        printf("%-14s", g_forms[f].szName);
+        for (s = 0; s < SIZE_COUNT; s++) printf(" %7zu/%-3zu", nRight[f][s], nTotal[f][s]);
+        printf("\n");
+    }
+    free(pUnits);
+    free(pData);
+    free(pCodes);
+}
+
+/* UTF-8 whose characters straddle the ends of both samples, and odd cases */
+static void TestEdges(void) {
+    uint8_t* pData = (uint8_t*)malloc(3 * TEXT_DETECT_SAMPLE + 16);
+    size_t nBom, nShift, i;
+
+    REQUIRE(pData);
+    for (nShift = 0; nShift < 3; nShift++) {
+        size_t nLen = 3 * TEXT_DETECT_SAMPLE + nShift;
+        /* Three-byte characters after nShift ASCII: the sample cuts fall anywhere in a character */
+        memset(pData, 'a', nShift);
+        for (i = nShift; i + 3 <= nLen; i += 3) memcpy(pData + i, "\xe6\x97\xa5", 3);
+        memset(pData + i, '\n', nLen - i);
+        CHECK(DetectTextEncoding(pData, nLen, &nBom) == TEXT_ENCODING_UTF8 && nBom == 0);
+        /* One byte broken in the head, or in the tail, makes it not UTF-8 */
+        pData[nShift + 30] = 0xFF;
+        CHECK(DetectTextEncoding(pData, nLen, &nBom) == TEXT_ENCODING_ANSI);
+        memcpy(pData + nShift + 30, "\xe6\x97\xa5", 3);
+        pData[nLen - 100] = 0xC0;
+        CHECK(DetectTextEncoding(pData, nLen, &nBom) == TEXT_ENCODING_ANSI);
+    }
+
+    CHECK(DetectTextEncoding(pData, 0, &nBom) == TEXT_ENCODING_UTF8 && nBom == 0);
+    CHECK(DetectTextEncoding((const uint8_t*)"\xff\xfe", 2, &nBom) == TEXT_ENCODING_UTF16LE && nBom == 2);
+    CHECK(DetectTextEncoding((const uint8_t*)"\xfe\xff", 2, &nBom) == TEXT_ENCODING_UTF16BE && nBom == 2);
+    CHECK(DetectTextEncoding((const uint8_t*)"\xff\xfe\0\0", 4, &nBom) == TEXT_ENCODING_UTF32LE && nBom == 4);
+    CHECK(DetectTextEncoding((const uint8_t*)"\xef\xbb\xbf", 3, &nBom) == TEXT_ENCODING_UTF8 && nBom == 3);
+    /* UTF-16 LE with an odd last byte decodes it as U+FFFD */
+    {
+        uint16_t units[4];
+        CHECK(Utf16FromBytes((const uint8_t*)"a\0b\0c", 5, 0, units) == 3 && units[2] == 0xFFFD);
+    }
+    free(pData);
+}
+
+/* Both statistics kernels count the same at every length and alignment */
+static void TestKernels(TestRng* pRng) {
+#ifdef TEXT_ENCODING_X86
+    uint8_t data[1024];
+    int nRun;
+
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("sse2")) return;
+    for (nRun = 0; nRun < 20000; nRun++) {
+        size_t nLen = TestRngBelow(pRng, sizeof(data) + 1), i;
+        ByteStats scalar, sse2;
+        for (i = 0; i < nLen; i++) {
+            size_t nKind = TestRngBelow(pRng, 3);
+            data[i] = nKind == 0 ? 0 : nKind == 1 ? (uint8_t)TestRngNext(pRng) : (uint8_t)('a' + TestRngBelow(pRng, 26));
+        }
+        memset(&scalar, 0, sizeof(scalar));
+        memset(&sse2, 0, sizeof(sse2));
+        CountBytesScalar(data, nLen, &scalar);
+        CountBytesSse2(data, nLen, &sse2);
+        CHECK(memcmp(&scalar, &sse2, sizeof(scalar)) == 0);
+        if (g_nTestFailures) break;
+    }
+#else
+    (void)pRng;
+#endif
+}
+
+/* Detection time on files of growing size: the samples are the same size, so the time is too */
+static void TestSpeed(TestRng* pRng) {
+    static const size_t sizes[] = {1 << 20, 64 << 20, 512 << 20};
+    const Script* pScript = &g_scripts[4];
+    uint32_t* pCodes = (uint32_t*)malloc(MAX_CHARS * sizeof(uint32_t));
+    uint8_t* pData = (uint8_t*)malloc(sizes[2]);
+    size_t nCodes, nChunk, i, s;
+    double dFirst = 0;
+
+    REQUIRE(pCodes && pData);
+    nCodes = MakeText(pScript, MAX_CHARS / 4, pCodes, pRng);
+    nChunk = Encode(pCodes, nCodes, &g_forms[0], pScript, pData);
+    for (i = nChunk; i + nChunk <= sizes[2]; i += nChunk) memcpy(pData + i, pData, nChunk);
+    memset(pData + i, '\n', sizes[2] - i);
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        double t0 = TestSeconds(), dTime;
+        size_t nLen = sizes[s], nBom;
+        int nRun;
+        /* End on a whole character */
+        while (nLen < sizes[2] && (pData[nLen] & 0xC0) == 0x80) nLen--;
+        for (nRun = 0; nRun < 200; nRun++) CHECK(DetectTextEncoding(pData, nLen, &nBom) == TEXT_ENCODING_UTF8);
+        dTime = (TestSeconds() - t0) / 200;
+        if (s == 0) dFirst = dTime;
+        printf("detect %4zu MB of UTF-8 (%s): %.1f us\n", sizes[s] >> 20, TextEncodingKernelName(), dTime * 1e6);
+        CHECK(dTime < 4 * dFirst + 1e-4);
+    }
+
+    {
+        ByteStats stats;
+        double t0 = TestSeconds();
+        memset(&stats, 0, sizeof(stats));
+        CountBytesScalar(pData, 64 << 20, &stats);
+        BenchReport("byte statistics, scalar", TestSeconds() - t0, 64 << 20);
+#ifdef TEXT_ENCODING_X86
+        if (__builtin_cpu_supports("sse2")) {
+            t0 = TestSeconds();
+            memset(&stats, 0, sizeof(stats));
+            CountBytesSse2(pData, 64 << 20, &stats);
+            BenchReport("byte statistics, sse2", TestSeconds() - t0, 64 << 20);
+        }
+#endif
+    }
+    free(pData);
+    free(pCodes);
+}
+
+int main(void) {
+    TestRng rng;
+
+    TestRngInit(&rng, TestSeed(24));
+    TestCorpus(&rng);
+    TestEdges();
+    TestKernels(&rng);
+    TestSpeed(&rng);
+    return TestResult("text_encoding_test");
+}
@@ -0,0 +1,176 @@
+/*
+ * Tab hibernation codec on log corpora (default 256 MB of text each): an
+ * access log, an application log with request ids, an application log
+ * with Cyrillic and CJK messages (wide frames) and random units (stored
+ * frames). For each: the compression ratio, the time to pack, and the
+ * time to restore a tab as RestoreHibernatedTab does -- unpack, load the
+ * piece table and build the line index. Then the restore latency at
+ * typical tab sizes, the best of five, against a 16 ms frame. Log files
+ * (UTF-8) named after the size are measured the same way.
+ *
+ * Usage: text_pack_bench [size in MB [log file ...]]
+ */
+
+#include "text_pack.h"
+#include "line_index.h"
+#include "transcode.h"
+#include "test_util.h"
+
+typedef enum { CORPUS_ACCESS, CORPUS_APP, CORPUS_WIDE, CORPUS_RANDOM } Corpus;
+
+/* Append szText (UTF-8) to pText as units; returns the new length, or nLen if it would pass nCap */
+static size_t Append(TextUnit* pText, size_t nLen, size_t nCap, const char* szText) {
+    size_t nUnits = 0, nError = 0, nBytes = strlen(szText);
+    if (nCap - nLen < nBytes) return nLen;
+    if (!Utf8ToUtf16((const uint8_t*)szText, nBytes, pText + nLen, &nUnits, &nError, NULL)) return nLen;
+    return nLen + nUnits;
+}
+
+/* Fill pText with nLen units of the corpus (whole lines, then padding) */
+static void MakeCorpus(TextUnit* pText, size_t nLen, Corpus corpus, TestRng* pRng) {
+    static const char* const paths[] = {"/", "/index.html", "/api/v1/items", "/api/v1/items/42", "/static/app.js",
+                                        "/static/style.css", "/login", "/favicon.ico"};
+    static const char* const wide[] = {"\xd0\xb7\xd0\xb0\xd0\xbf\xd1\x80\xd0\xbe\xd1\x81 \xd0\xb2\xd1\x8b\xd0\xbf\xd0\xbe\xd0\xbb\xd0\xbd\xd0\xb5\xd0\xbd",
+                                       "\xe8\xaf\xb7\xe6\xb1\x82\xe5\xb7\xb2\xe5\xae\x8c\xe6\x88\x90",
+                                       "\xe5\x87\xa6\xe7\x90\x86\xe3\x81\x8c\xe5\xae\x8c\xe4\xba\x86\xe3\x81\x97\xe3\x81\xbe\xe3\x81\x97\xe3\x81\x9f",
+                                       "completed"};
+    size_t n = 0, nLine = 0;
+    char szLine[256];
+
+    if (corpus == CORPUS_RANDOM) {
+        for (n = 0; n < nLen; n++) pText[n] = (TextUnit)TestRngNext(pRng);
+        return;
+    }
+    for (;;) {
+        size_t nNext;
+        if (corpus == CORPUS_ACCESS) {
+            snprintf(szLine, sizeof(szLine), "10.%u.%u.%u - - [17/Oct/2026:12:%02u:%02u +0000] \"GET %s HTTP/1.1\" %u %u\r\n",
+                     (unsigned)TestRngBelow(pRng, 4), (unsigned)TestRngBelow(pRng, 256), (unsigned)TestRngBelow(pRng, 256),
+                     (unsigned)TestRngBelow(pRng, 60), (unsigned)TestRngBelow(pRng, 60), paths[TestRngBelow(pRng, 8)],
+                     TestRngBelow(pRng, 10) ? 200 : 404, (unsigned)TestRngBelow(pRng, 50000));
+        } else {
+            snprintf(szLine, sizeof(szLine), "2026-10-17 12:%02u:%02u.%03u %s [worker-%u] request %016llx %s in %u ms\r\n",
+                     (unsigned)TestRngBelow(pRng, 60), (unsigned)TestRngBelow(pRng, 60), (unsigned)TestRngBelow(pRng, 1000),
+                     TestRngBelow(pRng, 20) ? "INFO" : "WARN", (unsigned)TestRngBelow(pRng, 16),
+                     (unsigned long long)(TestRngNext(pRng) >> (nLine++ % 48)),
+                     corpus == CORPUS_WIDE ? wide[TestRngBelow(pRng, 4)] : "completed", (unsigned)TestRngBelow(pRng, 5000));
+        }
+        nNext = Append(pText, n, nLen, szLine);
+        if (nNext == n) break;
+        n = nNext;
+    }
+    while (n < nLen) pText[n++] = ' ';
+}
+
+/* Restore as RestoreHibernatedTab does; returns the seconds taken */
+static double Restore(const TextPack* pPack, const TextUnit* pExpected) {
+    TextUnit* pText = (TextUnit*)malloc((pPack->nUnits ? pPack->nUnits : 1) * sizeof(TextUnit));
+    LineIndex lines;
+    PieceTable doc;
+    double t0;
+
+    REQUIRE(pText);
+    PieceTableInit(&doc);
+    LineIndexInit(&lines);
+    t0 = TestSeconds();
+    REQUIRE(TextPackUnpack(pPack, pText));
+    REQUIRE(PieceTableLoad(&doc, pText, pPack->nUnits, NULL, NULL));
+    REQUIRE(LineIndexBuild(&lines, &doc));
+    t0 = TestSeconds() - t0;
+    REQUIRE(memcmp(pText, pExpected, pPack->nUnits * sizeof(TextUnit)) == 0);
+    LineIndexFree(&lines);
+    PieceTableFree(&doc);
+    free(pText);
+    return t0;
+}
+
+/* Pack and restore nLen units of pText, reporting under szName */
+static void Measure(const char* szName, const TextUnit* pText, size_t nLen) {
+    double dBytes = (double)nLen * sizeof(TextUnit), t0, dPack;
+    size_t nStored = 0, nNarrow = 0, i;
+    char szLabel[80];
+    PieceTable doc;
+    TextPack pack;
+
+    PieceTableInit(&doc);
+    REQUIRE(PieceTableLoad(&doc, pText, nLen, NULL, NULL));
+    t0 = TestSeconds();
+    REQUIRE(TextPackDocument(&pack, &doc));
+    dPack = TestSeconds() - t0;
+    for (i = 0; i < pack.nFrames; i++) {
+        if (!(pack.pFrames[i].nMode & TEXT_PACK_LZ)) nStored++;
+        if (pack.pFrames[i].nMode & TEXT_PACK_NARROW) nNarrow++;
+    }
+
+    snprintf(szLabel, sizeof(szLabel), "%s pack", szName);
+    BenchReport(szLabel, dPack, dBytes);
+    printf("%-40s %9.2fx, %zu frames, %zu narrow, %zu stored, %.1f MB left\n", "",
+           pack.nBytes ? dBytes / (double)pack.nBytes : 0, pack.nFrames, nNarrow, nStored, (double)pack.nBytes / 1e6);
+    snprintf(szLabel, sizeof(szLabel), "%s restore", szName);
+    BenchReport(szLabel, Restore(&pack, pText), dBytes);
+
+    TextPackFree(&pack);
+    PieceTableFree(&doc);
+}
+
+/* Restore latency of a tab of nMB megabytes of text: best of five */
+static void Latency(const char* szName, const TextUnit* pText, size_t nMB) {
+    size_t nLen = (nMB << 20) / sizeof(TextUnit);
+    double dBest = 0;
+    PieceTable doc;
+    TextPack pack;
+    int i;
+
+    PieceTableInit(&doc);
+    REQUIRE(PieceTableLoad(&doc, pText, nLen, NULL, NULL));
+    REQUIRE(TextPackDocument(&pack, &doc));
+    for (i = 0; i < 5; i++) {
+        double dTime = Restore(&pack, pText);
+        if (i == 0 || dTime < dBest) dBest = dTime;
+    }
+    printf("%-8s %4zu MB tab restore %8.2f ms (%.1f frames at 60 Hz)\n", szName, nMB, dBest * 1e3, dBest / (1.0 / 60));
+    fflush(stdout);
+    TextPackFree(&pack);
+    PieceTableFree(&doc);
+}
+
+int main(int argc, char** argv) {
+    static const struct {
+        const char* szName;
+        Corpus corpus;
+    } corpora[] = {
+        {"access", CORPUS_ACCESS}, {"app", CORPUS_APP}, {"wide", CORPUS_WIDE}, {"random", CORPUS_RANDOM},
+    };
+    static const size_t tabs[] = {1, 4, 16, 64};
+    size_t nLen = (BenchSizeMB(argc, argv, 256) << 20) / sizeof(TextUnit), c, t;
+    TextUnit* pText = (TextUnit*)malloc(nLen * sizeof(TextUnit));
+    TestRng rng;
+    int a;
+
+    REQUIRE(pText && nLen > 0);
+    TestRngInit(&rng, TestSeed(21));
+    for (c = 0; c < sizeof(corpora) / sizeof(corpora[0]); c++) {
+        MakeCorpus(pText, nLen, corpora[c].corpus, &rng);
+        Measure(corpora[c].szName, pText, nLen);
+        for (t = 0; t < sizeof(tabs) / sizeof(tabs[0]) && (tabs[t] << 20) / sizeof(TextUnit) <= nLen; t++) {
+            Latency(corpora[c].szName, pText, tabs[t]);
+        }
+    }
+    free(pText);
+
+    for (a = 2; a < argc; a++) {
+        size_t nBytes = 0, nUnits = 0, nError = 0;
+        uint8_t* pFile = TestReadFile(argv[a], &nBytes);
+        if (!pFile) {
+            fprintf(stderr, "%s: cannot read\n", argv[a]);
+            return 1;
+        }
+        pText = (TextUnit*)malloc((nBytes ? nBytes : 1) * sizeof(TextUnit));
+        REQUIRE(pText);
+        REQUIRE(Utf8ToUtf16(pFile, nBytes, pText, &nUnits, &nError, NULL));
+        Measure(argv[a], pText, nUnits);
+        free(pText);
+        free(pFile);
+    }
+    return 0;
+}
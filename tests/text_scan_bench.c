@@ -0,0 +1,141 @@
+/*
+ * Line break and word scanning against the per-unit loops they replaced
+ * (DetectLineEnding in file_ops.c, CountLogicalLines in line_numbers.c and
+ * CountWords in statusbar.c), on UTF-8 and UTF-16 copies of the same text.
+ * Usage: text_scan_bench [size in MB]
+ */
+
+#include "text_scan.h"
+#include "test_util.h"
+
+/* The old loops, kept as they were apart from the types */
+static int OldDetectLineEnding(const char* pBuffer, size_t nSize, int* pbHasLF, int* pbHasCR) {
+    int bHasCR = 0, bHasLF = 0, bHasCRLF = 0;
+    for (size_t i = 0; i < nSize; i++) {
+        if (pBuffer[i] == '\r') {
+            if (i + 1 < nSize && pBuffer[i + 1] == '\n') {
+                bHasCRLF = 1;
+                i++;
+            } else {
+                bHasCR = 1;
+            }
+        } else if (pBuffer[i] == '\n') {
+            bHasLF = 1;
+        }
+    }
+    *pbHasLF = bHasLF;
+    *pbHasCR = bHasCR;
+    return bHasCRLF;
+}
+
+static size_t OldCountLines(const uint16_t* pText, size_t nLen) {
+    size_t nLines = 1;
+    for (size_t i = 0; i < nLen; i++) {
+        if (pText[i] == '\n') nLines++;
+    }
+    return nLines;
+}
+
+static size_t OldCountWords(const uint16_t* pText, size_t nLen) {
+    size_t nWords = 0;
+    int bInWord = 0;
+    for (size_t i = 0; i < nLen; i++) {
+        uint16_t ch = pText[i];
+        if (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n') {
+            bInWord = 0;
+        } else if (!bInWord) {
+            bInWord = 1;
+            nWords++;
+        }
+    }
+    return nWords;
+}
+
+/* Record line starts, as the line index does */
+typedef struct {
+    size_t nBreaks;
+    size_t nLastEnd;
+} BreakTally;
+
+static void TallyBreak(void* pContext, size_t nEnd, int nBreak) {
+    BreakTally* pTally = (BreakTally*)pContext;
+    (void)nBreak;
+    pTally->nBreaks++;
+    pTally->nLastEnd = nEnd;
+}
+
+/* Log-like text: words of a few letters, lines of 20 to 140 units, CRLF breaks */
+static void MakeText(uint8_t* pText, size_t nLen, TestRng* pRng) {
+    size_t i = 0, nLineEnd = 0;
+    while (i < nLen) {
+        if (i >= nLineEnd) {
+            if (i + 2 <= nLen) {
+                pText[i++] = '\r';
+                pText[i++] = '\n';
+            }
+            nLineEnd = i + 20 + TestRngBelow(pRng, 120);
+            continue;
+        }
+        pText[i++] = TestRngBelow(pRng, 6) == 0 ? ' ' : (uint8_t)('a' + TestRngBelow(pRng, 26));
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t nLen = BenchSizeMB(argc, argv, 100) * 1000 * 1000;
+    uint8_t* pBytes = (uint8_t*)malloc(nLen);
+    uint16_t* pUnits = (uint16_t*)malloc(nLen * sizeof(uint16_t));
+    TestRng rng;
+    TextScan scan;
+    BreakTally tally = {0, 0};
+    size_t nOld, nNew, i;
+    int bHasLF, bHasCR, bCrlf, bInWord = 0;
+    double t0;
+
+    REQUIRE(pBytes && pUnits);
+    TestRngInit(&rng, TestSeed(3));
+    MakeText(pBytes, nLen, &rng);
+    for (i = 0; i < nLen; i++) pUnits[i] = pBytes[i];
+    printf("kernel: %s, %zu MB\n", TextScanKernelName(), nLen / 1000000);
+
+    /* Line ending detection over the file bytes */
+    t0 = TestSeconds();
+    bCrlf = OldDetectLineEnding((const char*)pBytes, nLen, &bHasLF, &bHasCR);
+    BenchReport("old DetectLineEnding (bytes)", TestSeconds() - t0, (double)nLen);
+    t0 = TestSeconds();
+    TextScanInit(&scan, NULL, NULL);
+    TextScanBytes(&scan, pBytes, nLen);
+    TextScanFinish(&scan);
+    BenchReport("TextScanBytes, counts only", TestSeconds() - t0, (double)nLen);
+    REQUIRE((scan.nCRLF > 0) == bCrlf && (TextScanLoneLF(&scan) > 0) == bHasLF &&
+            (TextScanLoneCR(&scan) > 0) == bHasCR);
+
+    t0 = TestSeconds();
+    TextScanInit(&scan, TallyBreak, &tally);
+    TextScanBytes(&scan, pBytes, nLen);
+    TextScanFinish(&scan);
+    BenchReport("TextScanBytes, with line starts", TestSeconds() - t0, (double)nLen);
+
+    /* Line count over the editor text */
+    t0 = TestSeconds();
+    nOld = OldCountLines(pUnits, nLen);
+    BenchReport("old CountLogicalLines (UTF-16)", TestSeconds() - t0, (double)nLen * 2);
+    t0 = TestSeconds();
+    TextScanInit(&scan, NULL, NULL);
+    TextScanUnits(&scan, pUnits, nLen);
+    TextScanFinish(&scan);
+    BenchReport("TextScanUnits, counts only", TestSeconds() - t0, (double)nLen * 2);
+    REQUIRE(scan.nLF + 1 == nOld && tally.nBreaks + 1 == nOld);
+
+    /* Word count */
+    t0 = TestSeconds();
+    nOld = OldCountWords(pUnits, nLen);
+    BenchReport("old CountWords (UTF-16)", TestSeconds() - t0, (double)nLen * 2);
+    t0 = TestSeconds();
+    nNew = TextCountWords(pUnits, nLen, &bInWord);
+    BenchReport("TextCountWords", TestSeconds() - t0, (double)nLen * 2);
+    REQUIRE(nNew == nOld);
+
+    free(pUnits);
+    free(pBytes);
+    return 0;
+}
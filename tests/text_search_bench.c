@@ -0,0 +1,136 @@
+/*
+ * Literal search against glibc memmem on a generated log (default 1 GB):
+ * every occurrence of a rare, an absent and a frequent pattern, for each
+ * filter this CPU can run, matching case and not; then a search of the
+ * same text as a UTF-16 document of many pieces. Includes the module
+ * source to pin each filter. Usage: text_search_bench [size in MB]
+ */
+
+#define _GNU_SOURCE
+#include "text_search.c"
+#include "test_util.h"
+
+/* Occurrences of szPattern, counted with memmem */
+static size_t CountMemmem(const uint8_t* pText, size_t nLen, const char* szPattern) {
+    size_t nPattern = strlen(szPattern), nCount = 0;
+    const uint8_t* pAt = pText;
+    const uint8_t* pFound;
+
+    while ((pFound = (const uint8_t*)memmem(pAt, nLen - (size_t)(pAt - pText), szPattern, nPattern)) != NULL) {
+        nCount++;
+        pAt = pFound + 1;
+    }
+    return nCount;
+}
+
+static size_t CountTextSearch(const TextSearch* pSearch, const uint8_t* pText, size_t nLen) {
+    size_t nCount = 0, nFrom = 0, nMatch;
+    while (TextSearchBytes(pSearch, pText, nLen, nFrom, nLen, &nMatch)) {
+        nCount++;
+        nFrom = nMatch + 1;
+    }
+    return nCount;
+}
+
+static void ToUnits(const char* szText, TextUnit* pUnits) {
+    while (*szText) *pUnits++ = (TextUnit)(uint8_t)*szText++;
+}
+
+int main(int argc, char** argv) {
+    static const char* const words[] = {"INFO", "WARN", "request", "served", "in", "ms", "user", "id", "session", "GET",
+                                        "/api/v1/items", "200", "404", "timeout", "connection", "reset", "by", "peer",
+                                        "\n"};
+    static const char* const patterns[] = {"NEEDLE_in_haystack", "zq", "timeoutx", "connection reset by peerX", "request"};
+    static const char szNeedle[] = "NEEDLE_in_haystack";
+    const TextSearchKernel* kernels[3];
+    size_t nSize = BenchSizeMB(argc, argv, 1024) << 20, nLen = 0, nUnits, p, i;
+    uint8_t* pText = (uint8_t*)malloc(nSize);
+    TextUnit* pUnits;
+    int nKernels = 0, k;
+    TestRng rng;
+    PieceTable doc;
+
+    REQUIRE(pText && nSize > 64);
+    kernels[nKernels++] = &g_ScalarKernel;
+#ifdef TEXT_SEARCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) kernels[nKernels++] = &g_Sse2Kernel;
+    if (__builtin_cpu_supports("avx2")) kernels[nKernels++] = &g_Avx2Kernel;
+#endif
+
+    TestRngInit(&rng, TestSeed(15));
+    for (;;) {
+        const char* szWord = words[TestRngBelow(&rng, sizeof(words) / sizeof(words[0]))];
+        size_t nWord = strlen(szWord);
+        if (nLen + nWord + 1 > nSize) break;
+        memcpy(pText + nLen, szWord, nWord);
+        nLen += nWord;
+        pText[nLen++] = ' ';
+    }
+    memset(pText + nLen, ' ', nSize - nLen);
+    nLen = nSize;
+    memcpy(pText + nLen - 40, szNeedle, sizeof(szNeedle) - 1);
+
+    for (p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        TextUnit pattern[64];
+        size_t nPattern = strlen(patterns[p]), nExpected;
+        char szLabel[80];
+        double t0 = TestSeconds();
+
+        nExpected = CountMemmem(pText, nLen, patterns[p]);
+        snprintf(szLabel, sizeof(szLabel), "\"%s\" memmem", patterns[p]);
+        BenchReport(szLabel, TestSeconds() - t0, (double)nLen);
+        printf("%-40s %9zu\n", "  matches", nExpected);
+
+        ToUnits(patterns[p], pattern);
+        for (k = 0; k < nKernels; k++) {
+            int bIgnoreCase;
+            g_pKernel = kernels[k];
+            for (bIgnoreCase = 0; bIgnoreCase <= 1; bIgnoreCase++) {
+                TextSearch search;
+                size_t nCount;
+                REQUIRE(TextSearchInit(&search, pattern, nPattern, bIgnoreCase ? 0 : TEXT_SEARCH_MATCH_CASE));
+                t0 = TestSeconds();
+                nCount = CountTextSearch(&search, pText, nLen);
+                snprintf(szLabel, sizeof(szLabel), "  %-6s %s", g_pKernel->szName, bIgnoreCase ? "ignoring case" : "matching case");
+                BenchReport(szLabel, TestSeconds() - t0, (double)nLen);
+                /* The corpus has no other case forms of these patterns */
+                REQUIRE(nCount == nExpected);
+                TextSearchFree(&search);
+            }
+        }
+    }
+
+    /* Half the text as a UTF-16 document; a thousand inserts split it into about 2000 pieces */
+    nUnits = nLen / 2;
+    pUnits = (TextUnit*)malloc(nUnits * sizeof(TextUnit));
+    REQUIRE(pUnits);
+    for (i = 0; i < nUnits; i++) pUnits[i] = pText[nLen - nUnits + i];
+    PieceTableInit(&doc);
+    REQUIRE(PieceTableLoad(&doc, pUnits, nUnits, NULL, NULL));
+    for (i = 0; i < 1000; i++) {
+        TextUnit mark = '#';
+        REQUIRE(PieceTableInsert(&doc, TestRngBelow(&rng, nUnits - 100), &mark, 1));
+    }
+    for (k = 0; k < nKernels; k++) {
+        TextUnit pattern[sizeof(szNeedle)];
+        TextSearch search;
+        size_t nMatch = 0;
+        char szLabel[80];
+        double t0;
+
+        g_pKernel = kernels[k];
+        ToUnits(szNeedle, pattern);
+        REQUIRE(TextSearchInit(&search, pattern, sizeof(szNeedle) - 1, TEXT_SEARCH_MATCH_CASE));
+        t0 = TestSeconds();
+        REQUIRE(TextSearchDocument(&search, &doc, 0, PieceTableLength(&doc), &nMatch));
+        snprintf(szLabel, sizeof(szLabel), "UTF-16 document, %zu pieces, %s", PieceTablePieceCount(&doc), g_pKernel->szName);
+        BenchReport(szLabel, TestSeconds() - t0, (double)nUnits * sizeof(TextUnit));
+        TextSearchFree(&search);
+    }
+
+    PieceTableFree(&doc);
+    free(pUnits);
+    free(pText);
+    return 0;
+}
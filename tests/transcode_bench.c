@@ -0,0 +1,99 @@
+/*
+ * UTF-8 -> UTF-16 decoding and UTF-16 -> UTF-8 encoding throughput for each
+ * kernel this CPU can run, on ASCII text and on text that is mostly
+ * Cyrillic, CJK or emoji. Usage: transcode_bench [size in MB]
+ */
+
+#include "transcode.c"
+#include "test_util.h"
+
+/* Fill pText with nLen bytes of whole words from szWords (space separated), lines of about 80 */
+static size_t MakeText(uint8_t* pText, size_t nLen, const char* const* ppWords, size_t nWords, TestRng* pRng) {
+    size_t n = 0, nLine = 0;
+    for (;;) {
+        const char* szWord = ppWords[TestRngBelow(pRng, nWords)];
+        size_t nWord = strlen(szWord);
+        if (n + nWord + 1 > nLen) break;
+        memcpy(pText + n, szWord, nWord);
+        n += nWord;
+        nLine += nWord + 1;
+        pText[n++] = nLine > 80 ? '\n' : ' ';
+        if (nLine > 80) nLine = 0;
+    }
+    return n;
+}
+
+int main(int argc, char** argv) {
+    static const char* const ascii[] = {"request", "served", "in", "ms", "GET", "/api/v1/items", "200", "timeout"};
+    static const char* const cyrillic[] = {"\xd0\xbf\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82",
+                                           "\xd0\xbc\xd0\xb8\xd1\x80", "\xd0\xb8", "ok"};
+    static const char* const cjk[] = {"\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e", "\xe4\xb8\xad\xe6\x96\x87",
+                                      "\xed\x95\x9c\xea\xb5\xad\xec\x96\xb4"};
+    static const char* const emoji[] = {"\xf0\x9f\x98\x80", "\xf0\x9f\x9a\x80\xf0\x9f\x8c\x8d", "ok"};
+    static const struct {
+        const char* szName;
+        const char* const* ppWords;
+        size_t nWords;
+    } corpora[] = {
+        {"ascii", ascii, 8}, {"cyrillic", cyrillic, 4}, {"cjk", cjk, 3}, {"emoji", emoji, 3},
+    };
+    const TranscodeKernel* kernels[3];
+    int nKernels = 0;
+    size_t nSize = BenchSizeMB(argc, argv, 256) * 1000 * 1000;
+    uint8_t* pText = (uint8_t*)malloc(nSize);
+    uint16_t* pUnits = (uint16_t*)malloc(nSize * sizeof(uint16_t));
+    uint8_t* pBack = (uint8_t*)malloc(nSize + UTF8_ENCODE_MAX_STEP);
+    TestRng rng;
+    size_t c;
+    int k;
+
+    REQUIRE(pText && pUnits && pBack);
+    /* Fault the output buffers in now rather than in the first timing */
+    memset(pUnits, 0, nSize * sizeof(uint16_t));
+    memset(pBack, 0, nSize + UTF8_ENCODE_MAX_STEP);
+    kernels[nKernels++] = &g_ScalarKernel;
+#ifdef TRANSCODE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) kernels[nKernels++] = &g_Sse2Kernel;
+    if (__builtin_cpu_supports("avx2")) kernels[nKernels++] = &g_Avx2Kernel;
+#endif
+
+    TestRngInit(&rng, TestSeed(5));
+    for (c = 0; c < sizeof(corpora) / sizeof(corpora[0]); c++) {
+        size_t nLen = MakeText(pText, nSize, corpora[c].ppWords, corpora[c].nWords, &rng);
+        for (k = 0; k < nKernels; k++) {
+            size_t nUnits = 0, nError = 0, nIn, nBytes = 0;
+            Utf8Encoder encoder;
+            TextScan scan;
+            char szLabel[64];
+            double t0;
+
+            g_pKernel = kernels[k];
+            REQUIRE(Utf8ToUtf16(pText, nLen, pUnits, &nUnits, &nError, NULL)); /* warm up */
+            t0 = TestSeconds();
+            REQUIRE(Utf8ToUtf16(pText, nLen, pUnits, &nUnits, &nError, NULL));
+            snprintf(szLabel, sizeof(szLabel), "%-8s %-6s decode", corpora[c].szName, g_pKernel->szName);
+            BenchReport(szLabel, TestSeconds() - t0, (double)nLen);
+
+            t0 = TestSeconds();
+            TextScanInit(&scan, NULL, NULL);
+            REQUIRE(Utf8ToUtf16(pText, nLen, pUnits, &nUnits, &nError, &scan));
+            TextScanFinish(&scan);
+            snprintf(szLabel, sizeof(szLabel), "%-8s %-6s decode + line scan", corpora[c].szName, g_pKernel->szName);
+            BenchReport(szLabel, TestSeconds() - t0, (double)nLen);
+
+            t0 = TestSeconds();
+            Utf8EncoderInit(&encoder);
+            nIn = Utf8EncoderEncode(&encoder, pUnits, nUnits, pBack, nSize + UTF8_ENCODE_MAX_STEP, &nBytes);
+            nBytes += Utf8EncoderFinish(&encoder, pBack + nBytes);
+            snprintf(szLabel, sizeof(szLabel), "%-8s %-6s encode", corpora[c].szName, g_pKernel->szName);
+            BenchReport(szLabel, TestSeconds() - t0, (double)nLen);
+            REQUIRE(nIn == nUnits && nBytes == nLen && memcmp(pBack, pText, nLen) == 0);
+        }
+    }
+
+    free(pBack);
+    free(pUnits);
+    free(pText);
+    return 0;
+}
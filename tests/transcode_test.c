@@ -0,0 +1,225 @@
+/*
+ * UTF-8 decoding against the Unicode conformance edge cases and a plain
+ * reference decoder, and UTF-16 encoding round trips. The module source is
+ * included so every kernel this CPU can run is tested, not just the one
+ * dispatch picks.
+ */
+
+#include "transcode.c"
+#include "test_util.h"
+
+static const TranscodeKernel* g_kernels[3];
+static int g_nKernels;
+
+static void FindKernels(void) {
+    g_kernels[g_nKernels++] = &g_ScalarKernel;
+#ifdef TRANSCODE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) g_kernels[g_nKernels++] = &g_Sse2Kernel;
+    if (__builtin_cpu_supports("avx2")) g_kernels[g_nKernels++] = &g_Avx2Kernel;
+#endif
+}
+
+/* Straightforward decoder: generic decode, then reject overlongs, surrogates and out of range */
+static int RefDecode(const uint8_t* pSrc, size_t nSrc, uint16_t* pDst, size_t* pnUnits, size_t* pnError) {
+    size_t i = 0, nOut = 0;
+    while (i < nSrc) {
+        uint8_t b = pSrc[i];
+        uint32_t nCode, nMin;
+        size_t nLen, k;
+        if (b < 0x80) {
+            pDst[nOut++] = b;
+            i++;
+            continue;
+        }
+        if ((b & 0xE0) == 0xC0) { nLen = 2; nCode = b & 0x1F; nMin = 0x80; }
+        else if ((b & 0xF0) == 0xE0) { nLen = 3; nCode = b & 0x0F; nMin = 0x800; }
+        else if ((b & 0xF8) == 0xF0) { nLen = 4; nCode = b & 0x07; nMin = 0x10000; }
+        else break;
+        if (i + nLen > nSrc) break;
+        for (k = 1; k < nLen && (pSrc[i + k] & 0xC0) == 0x80; k++) nCode = (nCode << 6) | (pSrc[i + k] & 0x3F);
+        if (k < nLen || nCode < nMin || nCode > 0x10FFFF || (nCode >= 0xD800 && nCode <= 0xDFFF)) break;
+        if (nCode >= 0x10000) {
+            nCode -= 0x10000;
+            pDst[nOut++] = (uint16_t)(0xD800 | (nCode >> 10));
+            pDst[nOut++] = (uint16_t)(0xDC00 | (nCode & 0x3FF));
+        } else {
+            pDst[nOut++] = (uint16_t)nCode;
+        }
+        i += nLen;
+    }
+    *pnUnits = nOut;
+    *pnError = i;
+    return i == nSrc;
+}
+
+/* Line breaks reported by a scan, packed as offset * 4 + kind */
+typedef struct {
+    size_t nCount;
+    size_t aBreaks[1 << 16];
+} BreakList;
+
+static void RecordBreak(void* pContext, size_t nEnd, int nBreak) {
+    BreakList* pList = (BreakList*)pContext;
+    if (pList->nCount < sizeof(pList->aBreaks) / sizeof(pList->aBreaks[0])) {
+        pList->aBreaks[pList->nCount++] = nEnd * 4 + (size_t)nBreak;
+    }
+}
+
+static void TestConformance(void) {
+    /* Table 3-7 boundaries, then the ill-formed sequences of chapter 3 and the stress test cases */
+    static const struct {
+        const char* szBytes;
+        int bValid;
+        size_t nError;
+    } cases[] = {
+        {"\x7f", 1, 0}, {"\xc2\x80", 1, 0}, {"\xdf\xbf", 1, 0}, {"\xe0\xa0\x80", 1, 0},
+        {"\xef\xbf\xbf", 1, 0}, {"\xf0\x90\x80\x80", 1, 0}, {"\xf4\x8f\xbf\xbf", 1, 0},
+        {"\xed\x9f\xbf", 1, 0}, {"\xee\x80\x80", 1, 0}, {"\xef\xbf\xbe", 1, 0},
+        {"\xef\xb7\x90", 1, 0},                               /* noncharacters are well formed */
+        {"\xc0\x80", 0, 0}, {"\xc1\xbf", 0, 0},               /* overlong two-byte */
+        {"\xe0\x80\x80", 0, 0}, {"\xe0\x9f\xbf", 0, 0},       /* overlong three-byte */
+        {"\xf0\x80\x80\x80", 0, 0}, {"\xf0\x8f\xbf\xbf", 0, 0}, /* overlong four-byte */
+        {"\xed\xa0\x80", 0, 0}, {"\xed\xbf\xbf", 0, 0},       /* surrogates */
+        {"\xed\xa0\x80\xed\xb0\x80", 0, 0},                   /* CESU-8 pair */
+        {"\xf4\x90\x80\x80", 0, 0}, {"\xf5\x80\x80\x80", 0, 0}, /* above U+10FFFF */
+        {"\xf8\x88\x80\x80\x80", 0, 0}, {"\xfc\x84\x80\x80\x80\x80", 0, 0},
+        {"\xfe", 0, 0}, {"\xff", 0, 0},
+        {"\x80", 0, 0}, {"\xbf", 0, 0}, {"a\x80", 0, 1},      /* stray continuations */
+        {"\xc2", 0, 0}, {"\xe0\xa0", 0, 0}, {"\xf0\x90\x80", 0, 0}, {"ab\xc2", 0, 2}, /* truncated */
+        {"\xc2\x41", 0, 0}, {"\xe1\x80\x41", 0, 0}, {"\xf1\x80\x80\x41", 0, 0},       /* missing continuation */
+        {"0123456789abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopq\xc3\x28", 0, 63},
+    };
+    size_t c;
+    int k;
+
+    for (k = 0; k < g_nKernels; k++) {
+        g_pKernel = g_kernels[k];
+        for (c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+            uint16_t out[80];
+            size_t nLen = strlen(cases[c].szBytes), nUnits = 0, nError = 0;
+            int bValid = Utf8ToUtf16((const uint8_t*)cases[c].szBytes, nLen, out, &nUnits, &nError, NULL);
+            if (bValid != cases[c].bValid || (!bValid && nError != cases[c].nError)) {
+                fprintf(stderr, "[%s] case %zu: valid %d, error offset %zu\n", g_pKernel->szName, c, bValid, nError);
+                CHECK(!"conformance case");
+            }
+        }
+    }
+}
+
+/* Random mixtures of valid and invalid sequences, often crossing the 64-byte blocks */
+static void TestRandomAgainstReference(void) {
+    static const char* pieces[] = {
+        "a", "hello ", "\r\n", "\n", "\r", "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80", "\xd0\xbf\xd1\x80",
+        "\xe0\x80\x80", "\xc2", "\xed\xa0\x80", "\x80", "\xf4\x90\x80\x80",
+    };
+    static uint8_t text[200000];
+    static uint16_t expected[200000], actual[200000];
+    static BreakList fromDecode, fromUnits;
+    TestRng rng;
+    int it, k;
+
+    TestRngInit(&rng, TestSeed(5));
+    for (it = 0; it < 3000 && !g_nTestFailures; it++) {
+        size_t nLen = 0, nTarget = TestRngBelow(&rng, 3) == 0 ? 60000 + TestRngBelow(&rng, 80000) : TestRngBelow(&rng, 300);
+        int bBad = TestRngBelow(&rng, 4) == 0;
+        size_t nRefUnits, nRefError;
+        int bRefValid;
+
+        while (nLen < nTarget && nLen + 300 < sizeof(text)) {
+            const char* szPiece = pieces[TestRngBelow(&rng, bBad ? 14 : 9)];
+            memcpy(text + nLen, szPiece, strlen(szPiece));
+            nLen += strlen(szPiece);
+            if (TestRngBelow(&rng, 50) == 0) {
+                memset(text + nLen, 'x', 200);
+                nLen += 200;
+            }
+        }
+        bRefValid = RefDecode(text, nLen, expected, &nRefUnits, &nRefError);
+
+        for (k = 0; k < g_nKernels; k++) {
+            size_t nUnits = 0, nError = 0;
+            TextScan scan;
+            int bValid;
+
+            g_pKernel = g_kernels[k];
+            fromDecode.nCount = 0;
+            TextScanInit(&scan, RecordBreak, &fromDecode);
+            bValid = Utf8ToUtf16(text, nLen, actual, &nUnits, &nError, &scan);
+            TextScanFinish(&scan);
+
+            CHECK(bValid == bRefValid);
+            if (!bValid) {
+                CHECK(nError == nRefError);
+                continue;
+            }
+            CHECK(nUnits == nRefUnits && memcmp(actual, expected, nUnits * sizeof(uint16_t)) == 0);
+
+            /* The side scan sees the same breaks as a scan of the output */
+            fromUnits.nCount = 0;
+            TextScanInit(&scan, RecordBreak, &fromUnits);
+            TextScanUnits(&scan, expected, nRefUnits);
+            TextScanFinish(&scan);
+            CHECK(fromDecode.nCount == fromUnits.nCount &&
+                  memcmp(fromDecode.aBreaks, fromUnits.aBreaks, fromUnits.nCount * sizeof(size_t)) == 0);
+        }
+    }
+}
+
+/* Encode in pieces of nStep units into a buffer of nRoom bytes per call */
+static size_t EncodeInSteps(const uint16_t* pSrc, size_t nSrc, size_t nStep, size_t nRoom, uint8_t* pOut) {
+    Utf8Encoder encoder;
+    size_t nIn = 0, nOut = 0;
+    Utf8EncoderInit(&encoder);
+    while (nIn < nSrc) {
+        size_t nAvail = nSrc - nIn < nStep ? nSrc - nIn : nStep, nWritten = 0;
+        nIn += Utf8EncoderEncode(&encoder, pSrc + nIn, nAvail, pOut + nOut, nRoom, &nWritten);
+        nOut += nWritten;
+    }
+    return nOut + Utf8EncoderFinish(&encoder, pOut + nOut);
+}
+
+static void TestEncoder(void) {
+    /* U+00E9, U+20AC, U+1F600, a lone low surrogate, ASCII, a lone high surrogate at the end */
+    static const uint16_t units[] = {'a', 0xE9, 0x20AC, 0xD83D, 0xDE00, 0xDC00, 'b', 0xD83D, 'c', 0xD800};
+    static const uint8_t expected[] = "a\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\xef\xbf\xbd" "b\xef\xbf\xbd" "c\xef\xbf\xbd";
+    static uint16_t text[50000], back[50000];
+    static uint8_t bytes[200000];
+    TestRng rng;
+    size_t nStep, i, nBytes, nUnits, nError;
+    int k;
+
+    for (k = 0; k < g_nKernels; k++) {
+        g_pKernel = g_kernels[k];
+        /* The surrogate pair may be split across calls, and the room may be tight */
+        for (nStep = 1; nStep <= sizeof(units) / sizeof(units[0]); nStep++) {
+            uint8_t out[64];
+            nBytes = EncodeInSteps(units, sizeof(units) / sizeof(units[0]), nStep, UTF8_ENCODE_MAX_STEP + nStep % 3, out);
+            CHECK(nBytes == sizeof(expected) - 1 && memcmp(out, expected, nBytes) == 0);
+        }
+
+        /* Valid UTF-16 survives the round trip through UTF-8 */
+        TestRngInit(&rng, TestSeed(6));
+        for (i = 0; i < sizeof(text) / sizeof(text[0]); i++) {
+            size_t r = TestRngBelow(&rng, 10);
+            if (r < 6) text[i] = (uint16_t)(' ' + TestRngBelow(&rng, 95));
+            else if (r < 8) text[i] = (uint16_t)(0x100 + TestRngBelow(&rng, 0xD700));
+            else if (i + 1 < sizeof(text) / sizeof(text[0])) {
+                text[i++] = (uint16_t)(0xD800 + TestRngBelow(&rng, 0x400));
+                text[i] = (uint16_t)(0xDC00 + TestRngBelow(&rng, 0x400));
+            } else text[i] = 'z';
+        }
+        nBytes = EncodeInSteps(text, sizeof(text) / sizeof(text[0]), 4093, 8192, bytes);
+        CHECK(Utf8ToUtf16(bytes, nBytes, back, &nUnits, &nError, NULL));
+        CHECK(nUnits == sizeof(text) / sizeof(text[0]) && memcmp(back, text, sizeof(text)) == 0);
+    }
+}
+
+int main(void) {
+    FindKernels();
+    TestConformance();
+    TestRandomAgainstReference();
+    TestEncoder();
+    printf("transcode_test: %d kernel(s) checked\n", g_nKernels);
+    return TestResult("transcode_test");
+}
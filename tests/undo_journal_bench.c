@@ -0,0 +1,90 @@
+/*
+ * Undo journal memory per edit and recording speed for typical editing
+ * patterns, next to what a plain record (offset, two counts, both texts as
+ * UTF-16) would need. Usage: undo_journal_bench [edits in millions]
+ */
+
+#include "undo_journal.h"
+#include "test_util.h"
+
+enum { TYPING, TYPING_CJK, REPLACE, PASTE, DELETE_RANGE };
+
+static void Run(const char* szName, int nPattern, size_t nEdits, TestRng* pRng) {
+    TextUnit insert[1024];
+    size_t nCaret = 0, nPlain = 0, e, i;
+    UndoJournal journal;
+    PieceTable doc;
+    double t0, dTime;
+
+    PieceTableInit(&doc);
+    UndoJournalInit(&journal, 0);
+    t0 = TestSeconds();
+    for (e = 0; e < nEdits; e++) {
+        size_t nLen = PieceTableLength(&doc), nOffset = nCaret, nDelete = 0, nInsert = 0;
+        switch (nPattern) {
+            case TYPING:
+                /* Words and spaces, with a click elsewhere now and then */
+                insert[nInsert++] = TestRngBelow(pRng, 6) ? (TextUnit)('a' + TestRngBelow(pRng, 26)) : ' ';
+                if (TestRngBelow(pRng, 80) == 0) {
+                    nOffset = TestRngBelow(pRng, nLen + 1);
+                    UndoJournalSeal(&journal);
+                }
+                break;
+            case TYPING_CJK:
+                if (TestRngBelow(pRng, 4) == 0 && nCaret) {
+                    nOffset = nCaret - 1;
+                    nDelete = 1;
+                } else {
+                    insert[nInsert++] = (TextUnit)(0x4E00 + TestRngBelow(pRng, 500));
+                }
+                break;
+            case REPLACE:
+                nOffset = TestRngBelow(pRng, nLen + 1);
+                nDelete = TestRngBelow(pRng, nLen - nOffset < 8 ? nLen - nOffset + 1 : 8);
+                nInsert = 1 + TestRngBelow(pRng, 8);
+                for (i = 0; i < nInsert; i++) insert[i] = (TextUnit)('a' + TestRngBelow(pRng, 26));
+                break;
+            case PASTE:
+                nOffset = TestRngBelow(pRng, nLen + 1);
+                nInsert = 1024;
+                for (i = 0; i < nInsert; i++) insert[i] = (TextUnit)(i % 64 == 63 ? '\n' : 'a' + TestRngBelow(pRng, 26));
+                break;
+            case DELETE_RANGE:
+                /* Paste a block, then cut part of the text somewhere else */
+                if (e % 2 == 0) {
+                    nInsert = 1024;
+                    for (i = 0; i < nInsert; i++) insert[i] = (TextUnit)('a' + TestRngBelow(pRng, 26));
+                } else {
+                    nOffset = TestRngBelow(pRng, nLen + 1);
+                    nDelete = TestRngBelow(pRng, nLen - nOffset < 1024 ? nLen - nOffset + 1 : 1024);
+                }
+                break;
+        }
+        REQUIRE(UndoJournalRecord(&journal, &doc, nOffset, nDelete, insert, nInsert));
+        REQUIRE(PieceTableDelete(&doc, nOffset, nDelete));
+        REQUIRE(PieceTableInsert(&doc, nOffset, insert, nInsert));
+        nCaret = nOffset + nInsert;
+        nPlain += 3 * sizeof(size_t) + (nDelete + nInsert) * sizeof(TextUnit);
+    }
+    dTime = TestSeconds() - t0;
+
+    BenchReport(szName, dTime, 0);
+    printf("%-40s %9.2f bytes/edit (plain record %.2f)\n", "  journal", (double)UndoJournalBytes(&journal) / nEdits,
+           (double)nPlain / nEdits);
+    printf("%-40s %9.0f edits/s\n", "  record + apply", nEdits / dTime);
+    UndoJournalFree(&journal);
+    PieceTableFree(&doc);
+}
+
+int main(int argc, char** argv) {
+    size_t nEdits = (argc > 1 ? (size_t)atol(argv[1]) : 2) * 1000000;
+    TestRng rng;
+
+    TestRngInit(&rng, TestSeed(13));
+    Run("typing, ASCII", TYPING, nEdits, &rng);
+    Run("typing and Backspace, CJK", TYPING_CJK, nEdits, &rng);
+    Run("replacements of up to 8 units", REPLACE, nEdits, &rng);
+    Run("1024-unit pastes", PASTE, nEdits / 100, &rng);
+    Run("1024-unit pastes and cuts", DELETE_RANGE, nEdits / 100, &rng);
+    return 0;
+}
@@ -0,0 +1,325 @@
+/*
+ * Undo journal stress: 10 million random edits (typing, Backspace, Delete,
+ * replacements, sealed and unsealed runs) with undo/redo bursts and new
+ * edits after a partial undo along the way. Undoing everything must give
+ * back the original text unit for unit, and redoing everything the final
+ * one. A journal with a small budget must drop its oldest records and
+ * undo back to exactly the state after them. An edit bigger than the
+ * budget must be turned away without copying its text, and a big step
+ * must not leave a document-sized decode buffer behind. Replace All on a
+ * document bigger than the budget must be one step that costs what its
+ * matches cost, and undo and redo exactly, the history before it intact.
+ *
+ * Usage: undo_journal_test [edits]
+ */
+
+#include "undo_journal.h"
+#include "doc_replace.h"
+#include "test_util.h"
+
+static TextUnit RandomUnit(TestRng* pRng) {
+    static const TextUnit alphabet[] = {'a', 'b', 'c', ' ', '\r', '\n', 0xE9, 0x4E2D, 0xD83D, 0xDE00, 'z'};
+    return alphabet[TestRngBelow(pRng, sizeof(alphabet) / sizeof(alphabet[0]))];
+}
+
+static int ApplyToDocument(void* pContext, size_t nOffset, size_t nRemove, const TextUnit* pInsert, size_t nInsert) {
+    PieceTable* pDoc = (PieceTable*)pContext;
+    if (nOffset + nRemove > PieceTableLength(pDoc)) return 0;
+    return PieceTableDelete(pDoc, nOffset, nRemove) && PieceTableInsert(pDoc, nOffset, pInsert, nInsert);
+}
+
+static TextUnit* Snapshot(const PieceTable* pDoc, size_t* pnLen) {
+    TextUnit* pText;
+    *pnLen = PieceTableLength(pDoc);
+    pText = (TextUnit*)malloc((*pnLen + 1) * sizeof(TextUnit));
+    REQUIRE(pText);
+    PieceTableCopy(pDoc, 0, pText, *pnLen);
+    return pText;
+}
+
+static int Holds(const PieceTable* pDoc, const TextUnit* pText, size_t nLen) {
+    size_t nDocLen;
+    TextUnit* pDocText = Snapshot(pDoc, &nDocLen);
+    int bSame = nDocLen == nLen && memcmp(pDocText, pText, nLen * sizeof(TextUnit)) == 0;
+    free(pDocText);
+    return bSame;
+}
+
+/* One random edit at or near the caret, recorded first; returns nonzero if it changed anything */
+static int RandomEdit(PieceTable* pDoc, UndoJournal* pJournal, size_t* pnCaret, TestRng* pRng) {
+    size_t nLen = PieceTableLength(pDoc), r = TestRngBelow(pRng, 10);
+    TextUnit insert[48];
+
+    if (*pnCaret > nLen) *pnCaret = nLen;
+    if (r < 5) {
+        insert[0] = RandomUnit(pRng);
+        REQUIRE(UndoJournalRecord(pJournal, pDoc, *pnCaret, 0, insert, 1));
+        REQUIRE(PieceTableInsert(pDoc, *pnCaret, insert, 1));
+        ++*pnCaret;
+    } else if (r < 7 && *pnCaret > 0) {
+        REQUIRE(UndoJournalRecord(pJournal, pDoc, *pnCaret - 1, 1, NULL, 0));
+        REQUIRE(PieceTableDelete(pDoc, --*pnCaret, 1));
+    } else if (r < 8 && *pnCaret < nLen) {
+        REQUIRE(UndoJournalRecord(pJournal, pDoc, *pnCaret, 1, NULL, 0));
+        REQUIRE(PieceTableDelete(pDoc, *pnCaret, 1));
+    } else {
+        size_t nOffset = TestRngBelow(pRng, nLen + 1);
+        size_t nDelete = TestRngBelow(pRng, nLen - nOffset < 40 ? nLen - nOffset + 1 : 40);
+        size_t nInsert = TestRngBelow(pRng, nLen > 20000 ? 8 : 48), i;
+        for (i = 0; i < nInsert; i++) insert[i] = RandomUnit(pRng);
+        REQUIRE(UndoJournalRecord(pJournal, pDoc, nOffset, nDelete, insert, nInsert));
+        REQUIRE(PieceTableDelete(pDoc, nOffset, nDelete));
+        REQUIRE(PieceTableInsert(pDoc, nOffset, insert, nInsert));
+        *pnCaret = nOffset + nInsert;
+        if (TestRngBelow(pRng, 4) == 0) UndoJournalSeal(pJournal);
+        return nDelete || nInsert;
+    }
+    return 1;
+}
+
+static void TestStress(long nEdits, TestRng* pRng) {
+    size_t nOriginal = 5000, nFinal, nCaret = 0, nSteps = 0, i;
+    TextUnit* pOriginal = (TextUnit*)malloc(nOriginal * sizeof(TextUnit));
+    TextUnit* pFinal;
+    UndoJournal journal;
+    PieceTable doc;
+    double t0;
+    long e;
+
+    REQUIRE(pOriginal);
+    for (i = 0; i < nOriginal; i++) pOriginal[i] = RandomUnit(pRng);
+    PieceTableInit(&doc);
+    REQUIRE(PieceTableLoad(&doc, pOriginal, nOriginal, NULL, NULL));
+    UndoJournalInit(&journal, 0);
+
+    t0 = TestSeconds();
+    for (e = 0; e < nEdits; e++) {
+        RandomEdit(&doc, &journal, &nCaret, pRng);
+        if (TestRngBelow(pRng, 1000) == 0) {
+            /* Undo a few steps, then redo them all or carry on editing from there */
+            size_t nLen, nUndone = 0, nBurst = 1 + TestRngBelow(pRng, 20);
+            TextUnit* pBefore = Snapshot(&doc, &nLen);
+            for (i = 0; i < nBurst; i++) nUndone += UndoJournalUndo(&journal, &doc, ApplyToDocument, &doc, &nCaret) != 0;
+            if (TestRngBelow(pRng, 2)) {
+                for (i = 0; i < nUndone; i++) CHECK(UndoJournalRedo(&journal, &doc, ApplyToDocument, &doc, &nCaret));
+                CHECK(!UndoJournalCanRedo(&journal));
+                CHECK(Holds(&doc, pBefore, nLen));
+            }
+            free(pBefore);
+        }
+    }
+    printf("%ld edits in %.1f s, journal %zu bytes\n", nEdits, TestSeconds() - t0, UndoJournalBytes(&journal));
+
+    pFinal = Snapshot(&doc, &nFinal);
+    while (UndoJournalUndo(&journal, &doc, ApplyToDocument, &doc, NULL)) nSteps++;
+    CHECK(!UndoJournalCanUndo(&journal));
+    CHECK(Holds(&doc, pOriginal, nOriginal));
+    while (UndoJournalRedo(&journal, &doc, ApplyToDocument, &doc, NULL)) {}
+    CHECK(Holds(&doc, pFinal, nFinal));
+    printf("undo all: %zu steps back to the original\n", nSteps);
+
+    free(pFinal);
+    UndoJournalFree(&journal);
+    PieceTableFree(&doc);
+    free(pOriginal);
+}
+
+/* Over budget the oldest records go; undo stops at the state they led to */
+static void TestBudget(TestRng* pRng) {
+    enum { EDITS = 20000, BUDGET = 4096 };
+    TextUnit** ppStates = (TextUnit**)malloc((EDITS + 1) * sizeof(TextUnit*));
+    size_t* pLengths = (size_t*)malloc((EDITS + 1) * sizeof(size_t));
+    size_t nCaret = 0;
+    UndoJournal journal;
+    PieceTable doc;
+    int e = 0;
+
+    REQUIRE(ppStates && pLengths);
+    PieceTableInit(&doc);
+    UndoJournalInit(&journal, BUDGET);
+    ppStates[0] = Snapshot(&doc, &pLengths[0]);
+    while (e < EDITS) {
+        if (!RandomEdit(&doc, &journal, &nCaret, pRng)) continue;
+        e++;
+        ppStates[e] = Snapshot(&doc, &pLengths[e]);
+        /* The newest undo step is never dropped, so allow a little over */
+        CHECK(UndoJournalBytes(&journal) <= BUDGET + 200);
+    }
+    while (UndoJournalUndo(&journal, &doc, ApplyToDocument, &doc, NULL)) {}
+    CHECK(journal.nDropped > 0 && journal.nDropped <= EDITS);
+    if (journal.nDropped <= EDITS) CHECK(Holds(&doc, ppStates[journal.nDropped], pLengths[journal.nDropped]));
+
+    for (e = 0; e <= EDITS; e++) free(ppStates[e]);
+    free(pLengths);
+    free(ppStates);
+    UndoJournalFree(&journal);
+    PieceTableFree(&doc);
+}
+
+/* Select all and delete on a document bigger than the budget, and a big step that fits */
+static void TestOverBudget(TestRng* pRng) {
+    enum { BUDGET = 1 << 20 };
+    size_t nLen = 3 * BUDGET, i;
+    TextUnit* pText = (TextUnit*)malloc(nLen * sizeof(TextUnit));
+    UndoJournal journal;
+    PieceTable doc;
+
+    REQUIRE(pText);
+    for (i = 0; i < nLen; i++) pText[i] = RandomUnit(pRng);
+    PieceTableInit(&doc);
+    REQUIRE(PieceTableLoad(&doc, pText, nLen, NULL, NULL));
+    UndoJournalInit(&journal, BUDGET);
+
+    /* Turned away before the text is read: no history, and no buffer the size of the document */
+    REQUIRE(UndoJournalRecord(&journal, &doc, 0, 1, NULL, 0));
+    CHECK(!UndoJournalRecord(&journal, &doc, 0, nLen, NULL, 0));
+    CHECK(!UndoJournalCanUndo(&journal) && journal.nScratchCapacity <= 64 * 1024);
+
+    /* A step that fits is undone and redone; its decode buffer goes afterwards */
+    REQUIRE(UndoJournalRecord(&journal, &doc, 100, BUDGET / 4, NULL, 0));
+    REQUIRE(PieceTableDelete(&doc, 100, BUDGET / 4));
+    CHECK(UndoJournalUndo(&journal, &doc, ApplyToDocument, &doc, NULL) && Holds(&doc, pText, nLen));
+    CHECK(journal.nScratchCapacity <= 64 * 1024);
+    CHECK(UndoJournalRedo(&journal, &doc, ApplyToDocument, &doc, NULL) && PieceTableLength(&doc) == nLen - BUDGET / 4);
+    CHECK(journal.nScratchCapacity <= 64 * 1024);
+
+    UndoJournalFree(&journal);
+    PieceTableFree(&doc);
+    free(pText);
+}
+
+/* Replace All finder over the document's text as a plain array: a needle, or an empty match every nEvery units */
+typedef struct {
+    const TextUnit* pText;
+    size_t nLen;
+    const TextUnit* pNeedle;
+    size_t nNeedle;
+    size_t nEvery;
+} Finder;
+
+static int FindInArray(void* pContext, const PieceTable* pDoc, size_t nFrom, size_t* pnAt, size_t* pnLen) {
+    const Finder* pFinder = (const Finder*)pContext;
+    (void)pDoc;
+    if (pFinder->nEvery) {
+        *pnAt = (nFrom + pFinder->nEvery - 1) / pFinder->nEvery * pFinder->nEvery;
+        *pnLen = 0;
+        return *pnAt <= pFinder->nLen;
+    }
+    for (size_t i = nFrom; i + pFinder->nNeedle <= pFinder->nLen; i++) {
+        if (memcmp(pFinder->pText + i, pFinder->pNeedle, pFinder->nNeedle * sizeof(TextUnit)) == 0) {
+            *pnAt = i;
+            *pnLen = pFinder->nNeedle;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* One Replace All as EditReplaceAll does it: recorded as its matches, applied as one edit of the span */
+static int ReplaceAll(PieceTable* pDoc, UndoJournal* pJournal, Finder* pFinder, const TextUnit* pWith, size_t nWith) {
+    DocReplacement replacement;
+    size_t nRemove;
+    int bFits;
+
+    REQUIRE(DocReplaceAll(pDoc, FindInArray, pFinder, pWith, nWith, &replacement) && replacement.nCount > 0);
+    nRemove = replacement.nTo - replacement.nFrom;
+    bFits = UndoJournalCanRecordMatches(pJournal, pDoc, replacement.nFrom, nRemove, replacement.pMatches,
+                                        replacement.nCount, pWith, nWith);
+    CHECK(UndoJournalRecordMatches(pJournal, pDoc, replacement.nFrom, nRemove, replacement.pMatches,
+                                   replacement.nCount, pWith, nWith) == bFits);
+    REQUIRE(ApplyToDocument(pDoc, replacement.nFrom, nRemove, replacement.pText, replacement.nLen));
+    DocReplacementFree(&replacement);
+    return bFits;
+}
+
+/* Replace All over a span far bigger than the budget, then undo and redo it */
+static void TestReplaceAll(TestRng* pRng) {
+    enum { BUDGET = 1 << 20 };
+    static const TextUnit needle[] = {'f', 'o', 'x'}, wideNeedle[] = {0x4E2D, 'x'}, common[] = {'a'};
+    static const TextUnit with[] = {'w', 'o', 'l', 'f', 0xE9}, wideWith[] = {0xD83D, 0xDE00};
+    size_t nLen = 4 * BUDGET, nBefore, nAfter, i;
+    TextUnit* pText = (TextUnit*)malloc(nLen * sizeof(TextUnit));
+    TextUnit *pBefore, *pAfter;
+    UndoJournal journal;
+    PieceTable doc;
+    Finder finder;
+
+    REQUIRE(pText);
+    for (i = 0; i < nLen; i++) pText[i] = (TextUnit)('a' + TestRngBelow(pRng, 4));
+    for (i = 1000; i + 3 < nLen; i += 1000 + TestRngBelow(pRng, 2000)) memcpy(pText + i, needle, sizeof(needle));
+    for (i = 777; i + 2 < nLen; i += 5000 + TestRngBelow(pRng, 5000)) memcpy(pText + i, wideNeedle, sizeof(wideNeedle));
+    PieceTableInit(&doc);
+    REQUIRE(PieceTableLoad(&doc, pText, nLen, NULL, NULL));
+    UndoJournalInit(&journal, BUDGET);
+
+    /* History before the Replace All, which must survive it */
+    REQUIRE(UndoJournalRecord(&journal, &doc, 5, 2, with, 5));
+    REQUIRE(ApplyToDocument(&doc, 5, 2, with, 5));
+    pBefore = Snapshot(&doc, &nBefore);
+
+    /* Sparse matches: a small record, one step that undoes and redoes exactly */
+    memset(&finder, 0, sizeof(finder));
+    finder.pText = pBefore;
+    finder.nLen = nBefore;
+    finder.pNeedle = needle;
+    finder.nNeedle = 3;
+    CHECK(ReplaceAll(&doc, &journal, &finder, with, 5));
+    CHECK(UndoJournalBytes(&journal) < BUDGET / 8);
+    pAfter = Snapshot(&doc, &nAfter);
+    CHECK(nAfter > nBefore);
+    CHECK(UndoJournalUndo(&journal, &doc, ApplyToDocument, &doc, NULL) && Holds(&doc, pBefore, nBefore));
+    CHECK(UndoJournalRedo(&journal, &doc, ApplyToDocument, &doc, NULL) && Holds(&doc, pAfter, nAfter));
+    CHECK(UndoJournalUndo(&journal, &doc, ApplyToDocument, &doc, NULL) && Holds(&doc, pBefore, nBefore));
+    CHECK(UndoJournalUndo(&journal, &doc, ApplyToDocument, &doc, NULL) && Holds(&doc, pText, nLen));
+    CHECK(UndoJournalRedo(&journal, &doc, ApplyToDocument, &doc, NULL) && Holds(&doc, pBefore, nBefore));
+    CHECK(UndoJournalRedo(&journal, &doc, ApplyToDocument, &doc, NULL) && Holds(&doc, pAfter, nAfter));
+    CHECK(journal.nScratchCapacity <= 64 * 1024);
+    free(pAfter);
+
+    /* Wide matches and replacement, on top, then undone together with the first */
+    finder.pText = pAfter = Snapshot(&doc, &nAfter);
+    finder.nLen = nAfter;
+    finder.pNeedle = wideNeedle;
+    finder.nNeedle = 2;
+    CHECK(ReplaceAll(&doc, &journal, &finder, wideWith, 2));
+    CHECK(UndoJournalUndo(&journal, &doc, ApplyToDocument, &doc, NULL) && Holds(&doc, pAfter, nAfter));
+    CHECK(UndoJournalUndo(&journal, &doc, ApplyToDocument, &doc, NULL) && Holds(&doc, pBefore, nBefore));
+    free(pAfter);
+
+    /* Empty matches: the replacement goes in front of every 4096th unit, the span ending past the last */
+    memset(&finder, 0, sizeof(finder));
+    finder.pText = pBefore;
+    finder.nLen = nBefore;
+    finder.nEvery = 4096;
+    CHECK(ReplaceAll(&doc, &journal, &finder, with, 5));
+    pAfter = Snapshot(&doc, &nAfter);
+    CHECK(nAfter == nBefore + 5 * (nBefore / 4096 + 1));
+    CHECK(UndoJournalUndo(&journal, &doc, ApplyToDocument, &doc, NULL) && Holds(&doc, pBefore, nBefore));
+    CHECK(UndoJournalRedo(&journal, &doc, ApplyToDocument, &doc, NULL) && Holds(&doc, pAfter, nAfter));
+    CHECK(UndoJournalUndo(&journal, &doc, ApplyToDocument, &doc, NULL) && Holds(&doc, pBefore, nBefore));
+    free(pAfter);
+
+    /* Every 'a' (a quarter of the text): does not fit, said beforehand, and then nothing can be undone */
+    finder.nEvery = 0;
+    finder.pNeedle = common;
+    finder.nNeedle = 1;
+    CHECK(!ReplaceAll(&doc, &journal, &finder, wideWith, 2));
+    CHECK(!UndoJournalCanUndo(&journal));
+
+    free(pBefore);
+    UndoJournalFree(&journal);
+    PieceTableFree(&doc);
+    free(pText);
+}
+
+int main(int argc, char** argv) {
+    long nEdits = argc > 1 ? atol(argv[1]) : 10000000L;
+    TestRng rng;
+
+    TestRngInit(&rng, TestSeed(13));
+    TestStress(nEdits, &rng);
+    TestBudget(&rng);
+    TestOverBudget(&rng);
+    TestReplaceAll(&rng);
+    return TestResult("undo_journal_test");
+}
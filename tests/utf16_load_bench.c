@@ -0,0 +1,166 @@
+/*
+ * Opening a UTF-16 LE file (default 1 GB, past the large file threshold)
+ * where it lies, as file_ops.c does -- map, detect, route, hand the
+ * mapping to the piece table -- against the cost of the mapping alone,
+ * warm and with the file dropped from the page cache, and against the
+ * decode path it replaces (a heap copy of the whole text). Building the
+ * line index, which reads every page, is reported apart, as the first
+ * screen does not wait for it.
+ *
+ * Usage: utf16_load_bench [size in MB]
+ */
+
+#include "file_load.h"
+#include "line_index.h"
+#include "text_encoding.h"
+#include "test_util.h"
+
+#include <fcntl.h>
+
+/* Write nSize bytes of UTF-16 LE log text with a BOM */
+static void WriteLog(const char* szPath, uint64_t nSize, TestRng* pRng) {
+    static const TextUnit words[][6] = {{'I', 'N', 'F', 'O'}, {'W', 'A', 'R', 'N'}, {'u', 's', 'e', 'r'},
+                                        {0x8BF7, 0x6C42}, {0x0437, 0x0430, 0x043F, 0x0440, 0x043E, 0x0441}, {'2', '0', '0'}};
+    FILE* pFile = fopen(szPath, "wb");
+    size_t nCap = 1 << 19;
+    TextUnit* pBuffer = (TextUnit*)malloc(nCap * sizeof(TextUnit));
+    uint64_t nWritten = 2;
+
+    REQUIRE(pFile && pBuffer);
+    REQUIRE(fwrite("\xff\xfe", 1, 2, pFile) == 2);
+    while (nWritten < nSize) {
+        size_t n = 0, nBytes;
+        while (n < nCap - 64) {
+            size_t nWords = 4 + TestRngBelow(pRng, 12), k, u;
+            for (k = 0; k < nWords; k++) {
+                const TextUnit* pWord = words[TestRngBelow(pRng, sizeof(words) / sizeof(words[0]))];
+                for (u = 0; u < 6 && pWord[u]; u++) pBuffer[n++] = pWord[u];
+                if (n >= nCap - 8) break;
+                pBuffer[n++] = ' ';
+            }
+            pBuffer[n++] = '\r';
+            pBuffer[n++] = '\n';
+        }
+        nBytes = n * sizeof(TextUnit);
+        if (nBytes > nSize - nWritten) nBytes = (size_t)(nSize - nWritten) & ~(size_t)1;
+        if (nBytes == 0) break;
+        REQUIRE(fwrite(pBuffer, 1, nBytes, pFile) == nBytes);
+        nWritten += nBytes;
+    }
+    REQUIRE(fclose(pFile) == 0);
+    free(pBuffer);
+}
+
+/* Write the file back and drop it from the page cache, so the next open reads the disk */
+static void DropFromPageCache(const char* szPath) {
+    int fd = open(szPath, O_RDONLY);
+    REQUIRE(fd >= 0);
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+static void ReleaseMapped(void* pContext, const TextUnit* pText, size_t nLen) {
+    (void)pText;
+    (void)nLen;
+    UnmapFile((MappedFile*)pContext);
+}
+
+static void ReleaseHeap(void* pContext, const TextUnit* pText, size_t nLen) {
+    (void)pContext;
+    (void)nLen;
+    free((void*)pText);
+}
+
+/* Map the file and nothing else; the floor for any open */
+static double MapOnly(const char* szPath) {
+    double t0 = TestSeconds();
+    MappedFile map;
+    REQUIRE(MapFileReadOnly(&map, szPath));
+    t0 = TestSeconds() - t0;
+    UnmapFile(&map);
+    return t0;
+}
+
+/* Open where the text lies, as UseMappedText does; then index, timed apart */
+static double OpenMapped(const char* szPath, double* pdIndex, size_t* pnLines) {
+    double t0 = TestSeconds(), dOpen;
+    MappedFile map;
+    LineIndex lines;
+    PieceTable doc;
+    FileLoad load;
+
+    PieceTableInit(&doc);
+    LineIndexInit(&lines);
+    REQUIRE(FileLoadOpen(&load, szPath));
+    REQUIRE(load.nEncoding == TEXT_ENCODING_UTF16LE && FileLoadRoute(&load) == FILE_LOAD_ROUTE_MAPPED);
+    FileLoadTakeMapping(&load, &map);
+    REQUIRE(PieceTableLoad(&doc, (const TextUnit*)load.pText, load.nTextSize / sizeof(TextUnit), ReleaseMapped, &map));
+    FileLoadClose(&load);
+    dOpen = TestSeconds() - t0;
+
+    t0 = TestSeconds();
+    REQUIRE(LineIndexBuild(&lines, &doc));
+    *pdIndex = TestSeconds() - t0;
+    *pnLines = LineIndexCount(&lines);
+    LineIndexFree(&lines);
+    PieceTableFree(&doc);
+    return dOpen;
+}
+
+/* Open by decoding into the heap, as before */
+static double OpenCopied(const char* szPath) {
+    double t0 = TestSeconds();
+    TextUnit* pText;
+    PieceTable doc;
+    FileLoad load;
+    size_t nUnits;
+
+    PieceTableInit(&doc);
+    REQUIRE(FileLoadOpen(&load, szPath));
+    pText = (TextUnit*)malloc(load.nTextSize / sizeof(TextUnit) * sizeof(TextUnit) + sizeof(TextUnit));
+    REQUIRE(pText);
+    nUnits = Utf16FromBytes(load.pText, load.nTextSize, 0, pText);
+    FileLoadClose(&load);
+    REQUIRE(PieceTableLoad(&doc, pText, nUnits, ReleaseHeap, NULL));
+    t0 = TestSeconds() - t0;
+    PieceTableFree(&doc);
+    return t0;
+}
+
+int main(int argc, char** argv) {
+    uint64_t nSize = (uint64_t)BenchSizeMB(argc, argv, 1024) << 20;
+    double dMap, dOpen, dIndex, dBestMap = 0, dBestOpen = 0;
+    size_t nLines = 0;
+    char szPath[256];
+    TestRng rng;
+    int i;
+
+    TestRngInit(&rng, TestSeed(25));
+    TestTempPath(szPath, sizeof(szPath), "utf16_load.txt");
+    WriteLog(szPath, nSize, &rng);
+
+    DropFromPageCache(szPath);
+    dMap = MapOnly(szPath);
+    BenchReport("cold map only", dMap, (double)nSize);
+    DropFromPageCache(szPath);
+    dOpen = OpenMapped(szPath, &dIndex, &nLines);
+    BenchReport("cold open in place", dOpen, (double)nSize);
+    BenchReport("cold line index (reads every page)", dIndex, (double)nSize);
+
+    /* Warm: the best of five, in microseconds, as the costs are too small for MB/s to mean much */
+    for (i = 0; i < 5; i++) {
+        dMap = MapOnly(szPath);
+        dOpen = OpenMapped(szPath, &dIndex, &nLines);
+        if (i == 0 || dMap < dBestMap) dBestMap = dMap;
+        if (i == 0 || dOpen < dBestOpen) dBestOpen = dOpen;
+    }
+    printf("%-40s %9.1f us\n", "warm map only", dBestMap * 1e6);
+    printf("%-40s %9.1f us\n", "warm open in place", dBestOpen * 1e6);
+    BenchReport("warm line index", dIndex, (double)nSize);
+    BenchReport("warm open by copy (before)", OpenCopied(szPath), (double)nSize);
+    printf("%-40s %9zu\n", "lines", nLines);
+    printf("%-40s %9.1f MB\n", "peak RSS", BenchPeakRssKB() / 1024.0);
+    unlink(szPath);
+    return 0;
+}
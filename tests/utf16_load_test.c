@@ -0,0 +1,276 @@
+/*
+ * UTF-16 LE files used where they lie, as file_ops.c does: the mapping
+ * after the BOM becomes the document's original buffer with nothing
+ * decoded or copied, and is unmapped exactly once when the document lets
+ * go of it. Saves write the same bytes back, with long spans handed to
+ * the sink straight from the mapping; saving over the mapped file itself
+ * first moves the text to the heap. Edits after the move, files without a
+ * BOM, odd byte counts and UTF-16 BE (which takes the decode path) too,
+ * and a (sparse) file past LARGE_FILE_THRESHOLD, which is mapped the same
+ * rather than going to the large file viewer.
+ */
+
+#include "file_load.h"
+#include "doc_writer.h"
+#include "text_encoding.h"
+#include "test_util.h"
+
+static char g_szPath[256];
+static char g_szCopy[256];
+
+/* The mapping a document's text lies in, as MappedText in file_ops.c */
+typedef struct {
+    MappedFile map;
+    int nReleases;
+} Mapped;
+
+static void ReleaseMapped(void* pContext, const TextUnit* pText, size_t nLen) {
+    Mapped* pMapped = (Mapped*)pContext;
+    (void)pText;
+    (void)nLen;
+    UnmapFile(&pMapped->map);
+    pMapped->nReleases++;
+}
+
+static void ReleaseHeap(void* pContext, const TextUnit* pText, size_t nLen) {
+    (void)pContext;
+    (void)nLen;
+    free((void*)pText);
+}
+
+/* nUnits of text with CRLF lines, some non-ASCII and surrogate pairs */
+static void MakeUnits(TextUnit* pUnits, size_t nUnits, TestRng* pRng) {
+    static const TextUnit alphabet[] = {'a', 'b', 'c', ' ', '0', 0xE9, 0x0416, 0x4E2D, 0xFFFD};
+    size_t i = 0;
+    while (i < nUnits) {
+        size_t nKind = TestRngBelow(pRng, 40);
+        if (nKind == 0 && i + 2 <= nUnits) {
+            pUnits[i++] = '\r';
+            pUnits[i++] = '\n';
+        } else if (nKind == 1 && i + 2 <= nUnits) {
+            pUnits[i++] = 0xD83D;
+            pUnits[i++] = 0xDE00;
+        } else {
+            pUnits[i++] = alphabet[TestRngBelow(pRng, sizeof(alphabet) / sizeof(alphabet[0]))];
+        }
+    }
+}
+
+/* Write units as a file in an encoding, with or without its BOM, plus nExtra stray bytes */
+static void WriteUnits(const char* szPath, const TextUnit* pUnits, size_t nUnits, int nEncoding, int bBom, size_t nExtra) {
+    uint8_t* pBytes = (uint8_t*)malloc(4 + 2 * nUnits + nExtra);
+    size_t n = bBom ? TextEncodingBom(nEncoding, pBytes) : 0;
+    REQUIRE(pBytes);
+    Utf16ToBytes(pUnits, nUnits, nEncoding == TEXT_ENCODING_UTF16BE, pBytes + n);
+    n += 2 * nUnits;
+    memset(pBytes + n, 'x', nExtra);
+    REQUIRE(TestWriteFile(szPath, pBytes, n + nExtra));
+    free(pBytes);
+}
+
+static int SameText(const PieceTable* pDoc, const TextUnit* pUnits, size_t nUnits) {
+    TextUnit* pText = (TextUnit*)malloc((nUnits + 1) * sizeof(TextUnit));
+    int bSame;
+    REQUIRE(pText);
+    bSame = PieceTableLength(pDoc) == nUnits && PieceTableCopy(pDoc, 0, pText, nUnits) == nUnits &&
+            memcmp(pText, pUnits, nUnits * sizeof(TextUnit)) == 0;
+    free(pText);
+    return bSame;
+}
+
+static int SameFiles(const char* szA, const char* szB) {
+    size_t nA = 0, nB = 0;
+    uint8_t* pA = TestReadFile(szA, &nA);
+    uint8_t* pB = TestReadFile(szB, &nB);
+    int bSame = pA && pB && nA == nB && memcmp(pA, pB, nA) == 0;
+    free(pA);
+    free(pB);
+    return bSame;
+}
+
+/* Open as file_ops.c does; returns nonzero if the text was used where it lies */
+static int OpenMapped(const char* szPath, PieceTable* pDoc, Mapped* pMapped, FileLoad* pLoad) {
+    REQUIRE(FileLoadOpen(pLoad, szPath));
+    PieceTableInit(pDoc);
+    memset(pMapped, 0, sizeof(*pMapped));
+    if (FileLoadRoute(pLoad) != FILE_LOAD_ROUTE_MAPPED) {
+        return 0;
+    }
+    FileLoadTakeMapping(pLoad, &pMapped->map);
+    REQUIRE(PieceTableLoad(pDoc, (const TextUnit*)pLoad->pText, pLoad->nTextSize / sizeof(TextUnit), ReleaseMapped, pMapped));
+    FileLoadClose(pLoad);
+    return 1;
+}
+
+/* Move a mapped document's text to the heap, as UnmapDocumentsOf does */
+static void MoveToHeap(PieceTable* pDoc) {
+    TextUnit* pCopy = (TextUnit*)malloc(pDoc->nOriginalLen * sizeof(TextUnit));
+    REQUIRE(pCopy);
+    memcpy(pCopy, pDoc->pOriginal, pDoc->nOriginalLen * sizeof(TextUnit));
+    PieceTableMoveOriginal(pDoc, pCopy, ReleaseHeap, NULL);
+}
+
+/* Sink that writes a file and notes how many bytes came straight from the mapping */
+typedef struct {
+    FILE* pFile;
+    const uint8_t* pFrom;
+    const uint8_t* pTo;
+    size_t nDirect;
+} DirectSink;
+
+static int SinkDirect(void* pContext, const uint8_t* pData, size_t nLen) {
+    DirectSink* pSink = (DirectSink*)pContext;
+    if (pData >= pSink->pFrom && pData + nLen <= pSink->pTo) pSink->nDirect += nLen;
+    return fwrite(pData, 1, nLen, pSink->pFile) == nLen;
+}
+
+static void TestMapped(size_t nUnits, int bBom, TestRng* pRng) {
+    TextUnit* pUnits = (TextUnit*)malloc(nUnits * sizeof(TextUnit) + 1);
+    const TextUnit* pSpan;
+    size_t nSpan = 0;
+    PieceTable doc;
+    FileLoad load;
+    Mapped mapped;
+    DirectSink sink;
+
+    REQUIRE(pUnits);
+    MakeUnits(pUnits, nUnits, pRng);
+    WriteUnits(g_szPath, pUnits, nUnits, TEXT_ENCODING_UTF16LE, bBom, 0);
+
+    /* The document's text is the mapping itself, after the BOM */
+    CHECK(OpenMapped(g_szPath, &doc, &mapped, &load));
+    CHECK(load.nEncoding == TEXT_ENCODING_UTF16LE && load.bBom == bBom);
+    pSpan = PieceTableSpanAt(&doc, 0, &nSpan);
+    CHECK(pSpan == (const TextUnit*)(mapped.map.pData + (bBom ? 2 : 0)) && nSpan == nUnits);
+    CHECK(SameText(&doc, pUnits, nUnits));
+
+    /* Saved back, the file is the same; chunk-sized spans go to the sink from the mapping */
+    sink.pFile = fopen(g_szCopy, "wb");
+    sink.pFrom = mapped.map.pData;
+    sink.pTo = mapped.map.pData + mapped.map.nSize;
+    sink.nDirect = 0;
+    REQUIRE(sink.pFile);
+    CHECK(WriteDocumentText(&doc, TEXT_ENCODING_UTF16LE, bBom, SinkDirect, &sink));
+    REQUIRE(fclose(sink.pFile) == 0);
+    CHECK(SameFiles(g_szPath, g_szCopy));
+    if (nUnits * sizeof(TextUnit) >= DOC_WRITER_CHUNK) CHECK(sink.nDirect == nUnits * sizeof(TextUnit));
+    CHECK(SaveDocument(&doc, g_szCopy, TEXT_ENCODING_UTF16LE, bBom) && SameFiles(g_szPath, g_szCopy));
+
+    /* Saving over the mapped file: the text moves to the heap first, and the mapping goes */
+    MoveToHeap(&doc);
+    CHECK(mapped.nReleases == 1 && mapped.map.pData == NULL);
+    CHECK(SameText(&doc, pUnits, nUnits));
+    CHECK(SaveDocument(&doc, g_szPath, TEXT_ENCODING_UTF16LE, bBom) && SameFiles(g_szPath, g_szCopy));
+    PieceTableFree(&doc);
+    CHECK(mapped.nReleases == 1);
+    free(pUnits);
+}
+
+/* Edits after the move to the heap, then a save and a mapped reopen */
+static void TestEdits(TestRng* pRng) {
+    size_t nUnits = 300000, i;
+    TextUnit* pUnits = (TextUnit*)malloc((nUnits + 64 * 1000) * sizeof(TextUnit));
+    PieceTable doc, again;
+    FileLoad load;
+    Mapped mapped, mappedAgain;
+
+    REQUIRE(pUnits);
+    MakeUnits(pUnits, nUnits, pRng);
+    WriteUnits(g_szPath, pUnits, nUnits, TEXT_ENCODING_UTF16LE, 1, 0);
+    REQUIRE(OpenMapped(g_szPath, &doc, &mapped, &load));
+    MoveToHeap(&doc);
+    for (i = 0; i < 1000; i++) {
+        size_t nAt = TestRngBelow(pRng, nUnits + 1), nDelete = TestRngBelow(pRng, nUnits - nAt < 50 ? nUnits - nAt + 1 : 50);
+        TextUnit insert[64];
+        size_t nInsert = TestRngBelow(pRng, 64);
+        MakeUnits(insert, nInsert, pRng);
+        CHECK(PieceTableDelete(&doc, nAt, nDelete) && PieceTableInsert(&doc, nAt, insert, nInsert));
+        memmove(pUnits + nAt + nInsert, pUnits + nAt + nDelete, (nUnits - nAt - nDelete) * sizeof(TextUnit));
+        memcpy(pUnits + nAt, insert, nInsert * sizeof(TextUnit));
+        nUnits = nUnits - nDelete + nInsert;
+    }
+    CHECK(SameText(&doc, pUnits, nUnits));
+    CHECK(SaveDocument(&doc, g_szPath, TEXT_ENCODING_UTF16LE, 1));
+    CHECK(OpenMapped(g_szPath, &again, &mappedAgain, &load));
+    CHECK(SameText(&again, pUnits, nUnits));
+    PieceTableFree(&again);
+    PieceTableFree(&doc);
+    CHECK(mapped.nReleases == 1 && mappedAgain.nReleases == 1);
+    free(pUnits);
+}
+
+/* Files the mapped path must not take */
+static void TestOthers(TestRng* pRng) {
+    TextUnit units[1000], decoded[1002];
+    PieceTable doc;
+    FileLoad load;
+    Mapped mapped;
+
+    MakeUnits(units, 1000, pRng);
+
+    /* An odd byte count: decoded, the stray byte becoming U+FFFD */
+    WriteUnits(g_szPath, units, 1000, TEXT_ENCODING_UTF16LE, 1, 1);
+    CHECK(!OpenMapped(g_szPath, &doc, &mapped, &load));
+    CHECK(load.nEncoding == TEXT_ENCODING_UTF16LE && load.nTextSize == 2001);
+    CHECK(Utf16FromBytes(load.pText, load.nTextSize, 0, decoded) == 1001);
+    CHECK(memcmp(decoded, units, sizeof(units)) == 0 && decoded[1000] == 0xFFFD);
+    FileLoadClose(&load);
+
+    /* UTF-16 BE is decoded; saved back as BE it is the same file */
+    WriteUnits(g_szPath, units, 1000, TEXT_ENCODING_UTF16BE, 1, 0);
+    CHECK(!OpenMapped(g_szPath, &doc, &mapped, &load));
+    CHECK(load.nEncoding == TEXT_ENCODING_UTF16BE);
+    CHECK(Utf16FromBytes(load.pText, load.nTextSize, 1, decoded) == 1000 && memcmp(decoded, units, sizeof(units)) == 0);
+    FileLoadClose(&load);
+    REQUIRE(PieceTableLoad(&doc, decoded, 1000, NULL, NULL));
+    CHECK(SaveDocument(&doc, g_szCopy, TEXT_ENCODING_UTF16BE, 1) && SameFiles(g_szPath, g_szCopy));
+    PieceTableFree(&doc);
+
+    /* A BOM alone: an empty document, nothing to map */
+    WriteUnits(g_szPath, units, 0, TEXT_ENCODING_UTF16LE, 1, 0);
+    REQUIRE(FileLoadOpen(&load, g_szPath));
+    CHECK(load.nEncoding == TEXT_ENCODING_UTF16LE && load.nTextSize == 0);
+    FileLoadClose(&load);
+}
+
+/* Past the large file threshold, UTF-16 LE still becomes the document where it lies */
+static void TestLarge(TestRng* pRng) {
+    TextUnit units[1000], head[1000];
+    size_t nUnits = (size_t)(LARGE_FILE_THRESHOLD / sizeof(TextUnit));
+    PieceTable doc;
+    FileLoad load;
+    Mapped mapped;
+
+    if (!IsNativeEncoding(TEXT_ENCODING_UTF16LE) || (uint64_t)SIZE_MAX < LARGE_FILE_THRESHOLD) return;
+    MakeUnits(units, 1000, pRng);
+
+    /* BOM, text, then a hole of NULs up to one unit past the threshold */
+    WriteUnits(g_szPath, units, 1000, TEXT_ENCODING_UTF16LE, 1, 0);
+    REQUIRE(truncate(g_szPath, (off_t)(LARGE_FILE_THRESHOLD + 2)) == 0);
+    REQUIRE(OpenMapped(g_szPath, &doc, &mapped, &load));
+    CHECK(PieceTableLength(&doc) == nUnits);
+    CHECK(PieceTableCopy(&doc, 0, head, 1000) == 1000 && memcmp(head, units, sizeof(units)) == 0);
+    CHECK(PieceTableCopy(&doc, nUnits - 1, head, 1) == 1 && head[0] == 0);
+    PieceTableFree(&doc);
+    CHECK(mapped.nReleases == 1);
+}
+
+int main(void) {
+    static const size_t sizes[] = {1, 2, 1000, DOC_WRITER_CHUNK / 2 - 1, DOC_WRITER_CHUNK / 2, 3 * DOC_WRITER_CHUNK + 7};
+    TestRng rng;
+    size_t s;
+
+    TestTempPath(g_szPath, sizeof(g_szPath), "utf16.txt");
+    TestTempPath(g_szCopy, sizeof(g_szCopy), "utf16_copy.txt");
+    TestRngInit(&rng, TestSeed(25));
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        TestMapped(sizes[s], 1, &rng);
+        TestMapped(sizes[s], 0, &rng);
+    }
+    TestEdits(&rng);
+    TestOthers(&rng);
+    TestLarge(&rng);
+    unlink(g_szPath);
+    unlink(g_szCopy);
+    return TestResult("utf16_load_test");
+}
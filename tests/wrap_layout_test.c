@@ -0,0 +1,272 @@
+/*
+ * Word wrap layout: column widths, a table of row breaks, random lines
+ * checked against the rules in wrap_layout.h (rows cover the line, fit the
+ * width unless a single character is wider, never start inside a
+ * character, break at the last opportunity and could not have taken the
+ * next word), and the cache across width changes and clears.
+ *
+ * Usage: wrap_layout_test [random lines]
+ */
+
+#include "wrap_layout.h"
+#include "test_util.h"
+
+#define WIDE 0x4E2D              /* A CJK ideograph, two columns */
+#define MARK 0x0301              /* Combining acute accent, no columns */
+
+/* Units of a case string: W is a wide character, ^ a combining mark, @ a surrogate pair */
+static size_t CaseUnits(const char* sz, TextUnit* pUnits) {
+    size_t n = 0;
+    for (; *sz; sz++) {
+        if (*sz == '|') continue;
+        if (*sz == '@') {
+            pUnits[n++] = 0xD83D;
+            pUnits[n++] = 0xDE00;
+        } else {
+            pUnits[n++] = *sz == 'W' ? WIDE : *sz == '^' ? MARK : (TextUnit)(uint8_t)*sz;
+        }
+    }
+    return n;
+}
+
+static const struct {
+    size_t nCols;
+    const char* szRows;          /* The line with | where rows break */
+} g_cases[] = {
+    {10, "hello |world foo"},
+    {11, "hello world"},
+    {5, "abcde|fghij"},
+    {5, "ab-|cdefg"},
+    {4, "ab      |cd"},
+    {5, "WW|W"},
+    {3, "aW"},
+    {4, "abc|W"},
+    {4, "abW|cd"},
+    {1, "W"},
+    {1, "W|W"},
+    {3, "ab^c|d^e"},
+    {3, "abc^|d"},
+    {8, "\t|ab"},
+    {3, "a\t|b"},
+    {2, "a@|b"},
+    {1, "a|@"},
+    {0, "a|b"},
+    {5, "one  |two  |three"},
+    {6, "a-b-c-|d"},
+    {3, "abc ^|d"},
+    {1, "W  |b"},
+    {20, ""},
+};
+
+static void TestFixed(void) {
+    WrapLine line;
+    size_t i;
+
+    CHECK(WrapUnitColumns('a', 0) == 1);
+    CHECK(WrapUnitColumns(WIDE, 0) == 2);
+    CHECK(WrapUnitColumns(0xAC00, 5) == 2);
+    CHECK(WrapUnitColumns(MARK, 3) == 0);
+    CHECK(WrapUnitColumns(0xDE00, 3) == 0);
+    CHECK(WrapUnitColumns(0x200B, 3) == 0);
+    CHECK(WrapUnitColumns('\t', 0) == WRAP_TAB_COLUMNS);
+    CHECK(WrapUnitColumns('\t', 3) == WRAP_TAB_COLUMNS - 3);
+    CHECK(WrapUnitColumns('\t', WRAP_TAB_COLUMNS) == WRAP_TAB_COLUMNS);
+
+    memset(&line, 0, sizeof(line));
+    for (i = 0; i < sizeof(g_cases) / sizeof(g_cases[0]); i++) {
+        TextUnit units[64];
+        size_t nLen = CaseUnits(g_cases[i].szRows, units), nRow = 0, nAt = 0, bOk;
+        const char* p;
+
+        REQUIRE(WrapLineLayout(&line, units, nLen, g_cases[i].nCols));
+        bOk = line.nRows >= 1 && line.pStarts[0] == 0 && line.nLen == nLen;
+        for (p = g_cases[i].szRows; *p; p++) {
+            if (*p == '|') {
+                nRow++;
+                bOk &= nRow < line.nRows && line.pStarts[nRow] == nAt;
+            } else {
+                nAt += *p == '@' ? 2 : 1;
+            }
+        }
+        bOk &= line.nRows == nRow + 1;
+        if (!bOk) fprintf(stderr, "case %zu: \"%s\" at %zu columns gave %zu rows\n", i, g_cases[i].szRows, g_cases[i].nCols, line.nRows);
+        CHECK(bOk);
+    }
+    WrapLineFree(&line);
+}
+
+/* ---- Random lines against the rules ---- */
+
+static int IsZeroWidth(TextUnit u) {
+    return WrapUnitColumns(u, 0) == 0;
+}
+
+static int IsSpace(TextUnit u) {
+    return u == ' ' || u == '\t';
+}
+
+/* A row may end at nAt: after a space, tab, hyphen or wide character (and its marks), or before a wide character */
+static int IsBreak(const TextUnit* pText, size_t nLen, size_t nAt) {
+    size_t nBefore = nAt;
+    if (nAt == 0 || nAt >= nLen || IsZeroWidth(pText[nAt])) return 0;
+    if (pText[nAt] == WIDE) return 1;
+    while (nBefore > 0 && IsZeroWidth(pText[nBefore - 1])) nBefore--;
+    return nBefore > 0 && (IsSpace(pText[nBefore - 1]) || pText[nBefore - 1] == '-' || pText[nBefore - 1] == WIDE);
+}
+
+/* End of [nStart, nEnd) without the spaces (and marks on them) at its end */
+static size_t TrimmedEnd(const TextUnit* pText, size_t nStart, size_t nEnd) {
+    for (;;) {
+        size_t nBefore = nEnd;
+        while (nBefore > nStart && IsZeroWidth(pText[nBefore - 1])) nBefore--;
+        if (nBefore == nStart || !IsSpace(pText[nBefore - 1])) return nEnd;
+        nEnd = nBefore - 1;
+    }
+}
+
+/* Columns of [nStart, nEnd) as a row, leaving out spaces at its end */
+static size_t TrimmedColumns(const TextUnit* pText, size_t nStart, size_t nEnd) {
+    return WrapLineColumns(pText + nStart, TrimmedEnd(pText, nStart, nEnd) - nStart);
+}
+
+/* Offset after the character at nAt and its marks */
+static size_t NextCharacter(const TextUnit* pText, size_t nLen, size_t nAt) {
+    nAt++;
+    while (nAt < nLen && IsZeroWidth(pText[nAt])) nAt++;
+    return nAt;
+}
+
+static size_t RandomLine(TextUnit* pText, size_t nMax, TestRng* pRng) {
+    static const TextUnit alphabet[] = {'a', 'b', 'c', 'd', 'e', ' ', ' ', '-', '\t', WIDE, MARK, 0x200B, 0xD83D};
+    size_t nLen = TestRngBelow(pRng, nMax - 1), n = 0;
+    while (n < nLen) {
+        pText[n] = alphabet[TestRngBelow(pRng, sizeof(alphabet) / sizeof(alphabet[0]))];
+        if (pText[n++] == 0xD83D) pText[n++] = 0xDE00;
+    }
+    return n;
+}
+
+/* The first rule a layout breaks, or NULL if it keeps them all */
+static const char* BrokenRule(const WrapLine* pLine, const TextUnit* pText, size_t nLen, size_t nCols) {
+    size_t nRow, nOffset;
+
+    if (nCols == 0) nCols = 1;
+    if (pLine->nRows == 0 || pLine->pStarts[0] != 0 || pLine->nLen != nLen) return "rows do not start the line";
+    for (nRow = 0; nRow < pLine->nRows; nRow++) {
+        size_t nStart = WrapLineRowStart(pLine, nRow), nEnd = WrapLineRowEnd(pLine, nRow), nNext, i;
+        int bBreakInside = 0;
+
+        if (nEnd <= nStart && nLen > 0) return "empty row";
+        if (nRow > 0 && (IsZeroWidth(pText[nStart]) || IsSpace(pText[nStart]))) return "row starts inside a character or with a space";
+        /* Fits, or is a single character wider than a row */
+        if (TrimmedColumns(pText, nStart, nEnd) > nCols &&
+            NextCharacter(pText, nLen, nStart) != TrimmedEnd(pText, nStart, nEnd)) {
+            return "row too wide";
+        }
+        if (nEnd == nLen) continue;
+
+        /* A row cut inside a word has nowhere better to break */
+        for (i = nStart + 1; i <= nEnd; i++) bBreakInside |= IsBreak(pText, nLen, i);
+        if (!IsBreak(pText, nLen, nEnd) && bBreakInside) return "row cut inside a word";
+
+        /* Taking the text up to the next place it could end would not fit */
+        nNext = nEnd;
+        if (bBreakInside) {
+            do nNext++; while (nNext < nLen && !IsBreak(pText, nLen, nNext));
+        } else {
+            nNext = NextCharacter(pText, nLen, nEnd);
+        }
+        if (TrimmedColumns(pText, nStart, nNext) <= nCols) return "row ends too early";
+    }
+    for (nOffset = 0; nOffset < nLen; nOffset++) {
+        nRow = WrapLineRowOf(pLine, nOffset);
+        if (WrapLineRowStart(pLine, nRow) > nOffset || WrapLineRowEnd(pLine, nRow) <= nOffset) return "WrapLineRowOf";
+    }
+    return pLine->nRows > 1 || pLine->nWidth == WrapLineColumns(pText, nLen) ? NULL : "width of a one-row line";
+}
+
+static void ReportLine(const TextUnit* pText, size_t nLen, size_t nCols) {
+    size_t i;
+    fprintf(stderr, "  %zu columns: \"", nCols);
+    for (i = 0; i < nLen; i++) fprintf(stderr, pText[i] >= 32 && pText[i] < 127 ? "%c" : "<%x>", pText[i]);
+    fprintf(stderr, "\"\n");
+}
+
+static void TestRandom(long nLines, TestRng* pRng) {
+    TextUnit text[60];
+    WrapLine line;
+    long l;
+
+    memset(&line, 0, sizeof(line));
+    for (l = 0; l < nLines; l++) {
+        size_t nLen = RandomLine(text, sizeof(text) / sizeof(text[0]), pRng), nCols = TestRngBelow(pRng, 30);
+        const char* szBroken;
+        REQUIRE(WrapLineLayout(&line, text, nLen, nCols));
+        if ((szBroken = BrokenRule(&line, text, nLen, nCols)) != NULL) {
+            fprintf(stderr, "%s\n", szBroken);
+            ReportLine(text, nLen, nCols);
+            CHECK(0);
+            break;
+        }
+    }
+    WrapLineFree(&line);
+}
+
+/* The cache gives the layout a fresh one would, across widths and clears */
+static void TestCache(TestRng* pRng) {
+    enum { LINES = 2000 };
+    TextUnit* pTexts = (TextUnit*)malloc(LINES * 64 * sizeof(TextUnit));
+    size_t lengths[LINES], nKept = 0, nWidths, i;
+    WrapCache cache;
+    WrapLine fresh;
+
+    REQUIRE(pTexts);
+    memset(&fresh, 0, sizeof(fresh));
+    for (i = 0; i < LINES; i++) lengths[i] = RandomLine(pTexts + i * 64, 64, pRng);
+    WrapCacheInit(&cache, 20);
+
+    for (nWidths = 0; nWidths < 50; nWidths++) {
+        size_t nCols = 1 + TestRngBelow(pRng, 60), nFirst = TestRngBelow(pRng, LINES - 300);
+
+        /* Width changes keep only lines whose layout is unchanged */
+        WrapCacheSetColumns(&cache, nCols);
+        for (i = 0; i < LINES; i++) {
+            const WrapLine* pCached = WrapCacheFind(&cache, i);
+            if (!pCached) continue;
+            nKept++;
+            REQUIRE(WrapLineLayout(&fresh, pTexts + i * 64, lengths[i], nCols));
+            CHECK(pCached->nRows == fresh.nRows && memcmp(pCached->pStarts, fresh.pStarts, fresh.nRows * sizeof(size_t)) == 0);
+        }
+
+        /* A screenful of lines, as a view would show them */
+        for (i = nFirst; i < nFirst + 300; i++) {
+            const WrapLine* pCached = WrapCacheLayout(&cache, i, pTexts + i * 64, lengths[i]);
+            REQUIRE(pCached);
+            REQUIRE(WrapLineLayout(&fresh, pTexts + i * 64, lengths[i], nCols));
+            CHECK(pCached->nRows == fresh.nRows && memcmp(pCached->pStarts, fresh.pStarts, fresh.nRows * sizeof(size_t)) == 0);
+            CHECK(WrapCacheFind(&cache, i) == pCached);
+            CHECK(WrapCacheLayout(&cache, i, pTexts + i * 64, lengths[i]) == pCached);
+        }
+
+        if (nWidths % 10 == 9) {
+            WrapCacheClear(&cache);
+            for (i = 0; i < LINES; i++) CHECK(!WrapCacheFind(&cache, i));
+        }
+    }
+    /* Some lines fit every width they were shown at */
+    CHECK(nKept > 0);
+
+    WrapLineFree(&fresh);
+    WrapCacheFree(&cache);
+    free(pTexts);
+}
+
+int main(int argc, char** argv) {
+    TestRng rng;
+
+    TestRngInit(&rng, TestSeed(19));
+    TestFixed();
+    TestRandom(argc > 1 ? atol(argv[1]) : 300000, &rng);
+    TestCache(&rng);
+    return TestResult("wrap_layout_test");
+}